@@ -717,6 +717,315 @@ void freeFakeClient(struct client *c) {
     zfree(c);
 }
 
+/* ----------------------------------------------------------------------------
+ * AOF replay parser
+ *
+ * Instead of issuing a fgets() / fread() call for every line and argument of
+ * every command, the AOF is consumed in big chunks of AOF_LOAD_BUF_LEN bytes
+ * and the protocol is parsed in place. Arguments larger than the buffer are
+ * read directly into the target SDS string.
+ *
+ * When aof-fast-load is enabled the parsing is performed by a background
+ * thread that fills batches of ready to execute commands, so that the main
+ * thread only has to execute them.
+ * ------------------------------------------------------------------------- */
+
+#define AOF_LOAD_BUF_LEN (1024*1024*4)  /* 4 MB read buffer. */
+#define AOF_LOAD_MAX_LINE 128           /* Max length of a *<n> / $<n> line. */
+#define AOF_LOAD_BATCH_CMDS 1024        /* Commands in every parsed batch. */
+#define AOF_LOAD_BATCHES 4              /* Batches in flight. */
+
+/* aofReadCommand() return codes. */
+#define AOF_PARSE_OK 0      /* A command was parsed. */
+#define AOF_PARSE_EOF 1     /* Clean EOF between two commands. */
+#define AOF_PARSE_SHORT 2   /* EOF reached in the middle of a command. */
+#define AOF_PARSE_IOERR 3   /* Read error. */
+#define AOF_PARSE_FMTERR 4  /* Protocol error. */
+
+typedef struct aofReader {
+    FILE *fp;
+    char *buf;
+    size_t pos;         /* Read position inside 'buf'. */
+    size_t len;         /* Bytes of valid data inside 'buf'. */
+    off_t offset;       /* File offset of buf[pos]. */
+} aofReader;
+
+/* A parsed command. The argv array is reused from one command to the next,
+ * only the string objects it references are allocated for every command. */
+typedef struct aofParsedCommand {
+    int argc;
+    int argvcap;        /* Number of slots allocated in 'argv'. */
+    robj **argv;
+    off_t offset;       /* File offset just after this command. */
+} aofParsedCommand;
+
+typedef struct aofLoadBatch {
+    aofParsedCommand cmds[AOF_LOAD_BATCH_CMDS];
+    int count;          /* Number of parsed commands in 'cmds'. */
+    int status;         /* AOF_PARSE_OK if the batch is full, otherwise the
+                           code that terminated the parsing. */
+} aofLoadBatch;
+
+typedef struct aofLoader {
+    aofReader reader;
+    int threaded;               /* Parsing happens in 'thread'. */
+    aofParsedCommand cmd;       /* Single command slot of the inline parser. */
+    /* Threaded parser state. */
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    aofLoadBatch *batches;
+    int filled;                 /* Batches ready to be executed. */
+    int head;                   /* Next batch the thread fills. */
+    int tail;                   /* Batch the main thread is executing. */
+    int next;                   /* Next command to return from 'tail'. */
+} aofLoader;
+
+static void aofReaderInit(aofReader *r, FILE *fp) {
+    r->fp = fp;
+    r->buf = zmalloc(AOF_LOAD_BUF_LEN);
+    r->pos = r->len = 0;
+    r->offset = ftello(fp);
+}
+
+/* Move the unread data at the start of the buffer and append as much data
+ * as possible from the file. Returns the number of bytes read, 0 on EOF and
+ * -1 on read error. */
+static ssize_t aofReaderFill(aofReader *r) {
+    size_t nread;
+
+    if (r->pos) {
+        memmove(r->buf,r->buf+r->pos,r->len-r->pos);
+        r->len -= r->pos;
+        r->pos = 0;
+    }
+    nread = fread(r->buf+r->len,1,AOF_LOAD_BUF_LEN-r->len,r->fp);
+    if (nread == 0 && ferror(r->fp)) return -1;
+    r->len += nread;
+    return nread;
+}
+
+/* Parse a "<type><number>\r\n" line, storing the number in '*val'. */
+static int aofReaderReadHeader(aofReader *r, char type, long long *val) {
+    char *p, *nl;
+    ssize_t nread;
+    size_t linelen;
+
+    while ((nl = memchr(r->buf+r->pos,'\n',r->len-r->pos)) == NULL) {
+        if (r->len - r->pos >= AOF_LOAD_MAX_LINE) return AOF_PARSE_FMTERR;
+        nread = aofReaderFill(r);
+        if (nread == -1) return AOF_PARSE_IOERR;
+        if (nread == 0)
+            return (r->pos == r->len) ? AOF_PARSE_EOF : AOF_PARSE_SHORT;
+    }
+    p = r->buf+r->pos;
+    linelen = nl-p+1;
+    if (p[0] != type) return AOF_PARSE_FMTERR;
+    if (nl > p && nl[-1] == '\r') nl--;
+    if (!string2ll(p+1,nl-p-1,val)) return AOF_PARSE_FMTERR;
+    r->pos += linelen;
+    r->offset += linelen;
+    return AOF_PARSE_OK;
+}
+
+/* Read 'len' bytes of payload into 's' and discard the trailing CRLF. */
+static int aofReaderReadBulk(aofReader *r, char *s, size_t len) {
+    size_t copied = 0, chunk;
+    ssize_t nread;
+
+    while (copied < len) {
+        if (r->pos == r->len) {
+            /* Big arguments skip the intermediate buffer. */
+            if (len-copied >= AOF_LOAD_BUF_LEN) {
+                chunk = fread(s+copied,1,len-copied,r->fp);
+                if (chunk == 0)
+                    return ferror(r->fp) ? AOF_PARSE_IOERR : AOF_PARSE_SHORT;
+                copied += chunk;
+                r->offset += chunk;
+                continue;
+            }
+            nread = aofReaderFill(r);
+            if (nread == -1) return AOF_PARSE_IOERR;
+            if (nread == 0) return AOF_PARSE_SHORT;
+        }
+        chunk = r->len-r->pos;
+        if (chunk > len-copied) chunk = len-copied;
+        memcpy(s+copied,r->buf+r->pos,chunk);
+        copied += chunk;
+        r->pos += chunk;
+        r->offset += chunk;
+    }
+
+    /* Discard CRLF. */
+    while (r->len-r->pos < 2) {
+        nread = aofReaderFill(r);
+        if (nread == -1) return AOF_PARSE_IOERR;
+        if (nread == 0) return AOF_PARSE_SHORT;
+    }
+    r->pos += 2;
+    r->offset += 2;
+    return AOF_PARSE_OK;
+}
+
+static void aofFreeParsedArgv(aofParsedCommand *cmd, int argc) {
+    int j;
+
+    for (j = 0; j < argc; j++) decrRefCount(cmd->argv[j]);
+    cmd->argc = 0;
+}
+
+/* Parse the next command of the AOF into 'cmd'. */
+static int aofReadCommand(aofReader *r, aofParsedCommand *cmd) {
+    long long ll;
+    int j, argc, res;
+
+    res = aofReaderReadHeader(r,'*',&ll);
+    if (res != AOF_PARSE_OK) return res;
+    if (ll < 1 || ll > INT_MAX) return AOF_PARSE_FMTERR;
+    argc = ll;
+
+    if (argc > cmd->argvcap) {
+        cmd->argv = zrealloc(cmd->argv,sizeof(robj*)*argc);
+        cmd->argvcap = argc;
+    }
+
+    for (j = 0; j < argc; j++) {
+        sds argsds;
+
+        res = aofReaderReadHeader(r,'$',&ll);
+        if (res == AOF_PARSE_OK && ll < 0) res = AOF_PARSE_FMTERR;
+        if (res == AOF_PARSE_EOF) res = AOF_PARSE_SHORT;
+        if (res != AOF_PARSE_OK) {
+            aofFreeParsedArgv(cmd,j);
+            return res;
+        }
+        argsds = sdsnewlen(SDS_NOINIT,ll);
+        res = aofReaderReadBulk(r,argsds,ll);
+        if (res != AOF_PARSE_OK) {
+            sdsfree(argsds);
+            aofFreeParsedArgv(cmd,j);
+            return res;
+        }
+        cmd->argv[j] = createObject(OBJ_STRING,argsds);
+    }
+    cmd->argc = argc;
+    cmd->offset = r->offset;
+    return AOF_PARSE_OK;
+}
+
+/* Body of the parser thread: fill batches until the end of the file or an
+ * error is reached. */
+static void *aofLoadParserThread(void *arg) {
+    aofLoader *l = arg;
+    aofLoadBatch *b;
+    int status = AOF_PARSE_OK;
+
+    redis_set_thread_title("aof_load");
+    while (status == AOF_PARSE_OK) {
+        pthread_mutex_lock(&l->mutex);
+        while (l->filled == AOF_LOAD_BATCHES)
+            pthread_cond_wait(&l->cond,&l->mutex);
+        b = &l->batches[l->head];
+        pthread_mutex_unlock(&l->mutex);
+
+        for (b->count = 0; b->count < AOF_LOAD_BATCH_CMDS; b->count++) {
+            status = aofReadCommand(&l->reader,&b->cmds[b->count]);
+            if (status != AOF_PARSE_OK) break;
+        }
+        b->status = status;
+
+        pthread_mutex_lock(&l->mutex);
+        l->head = (l->head+1) % AOF_LOAD_BATCHES;
+        l->filled++;
+        pthread_cond_signal(&l->cond);
+        pthread_mutex_unlock(&l->mutex);
+    }
+    return NULL;
+}
+
+static void aofLoaderInit(aofLoader *l, FILE *fp, int threaded) {
+    memset(l,0,sizeof(*l));
+    aofReaderInit(&l->reader,fp);
+    l->threaded = threaded;
+    if (!threaded) return;
+
+    l->batches = zcalloc(sizeof(aofLoadBatch)*AOF_LOAD_BATCHES);
+    pthread_mutex_init(&l->mutex,NULL);
+    pthread_cond_init(&l->cond,NULL);
+    if (pthread_create(&l->thread,NULL,aofLoadParserThread,l) != 0) {
+        serverLog(LL_WARNING,
+            "Can't create the AOF parser thread, loading inline.");
+        pthread_mutex_destroy(&l->mutex);
+        pthread_cond_destroy(&l->cond);
+        zfree(l->batches);
+        l->batches = NULL;
+        l->threaded = 0;
+    }
+}
+
+/* Return in '*cmdp' the next command to execute. */
+static int aofLoaderNext(aofLoader *l, aofParsedCommand **cmdp) {
+    aofLoadBatch *b;
+
+    if (!l->threaded) {
+        *cmdp = &l->cmd;
+        return aofReadCommand(&l->reader,&l->cmd);
+    }
+
+    pthread_mutex_lock(&l->mutex);
+    while (l->filled == 0) pthread_cond_wait(&l->cond,&l->mutex);
+    b = &l->batches[l->tail];
+    if (l->next == b->count && b->status == AOF_PARSE_OK) {
+        /* Give the executed batch back to the parser. */
+        l->tail = (l->tail+1) % AOF_LOAD_BATCHES;
+        l->next = 0;
+        l->filled--;
+        pthread_cond_signal(&l->cond);
+        while (l->filled == 0) pthread_cond_wait(&l->cond,&l->mutex);
+        b = &l->batches[l->tail];
+    }
+    pthread_mutex_unlock(&l->mutex);
+
+    if (l->next == b->count) return b->status;
+    *cmdp = &b->cmds[l->next++];
+    return AOF_PARSE_OK;
+}
+
+/* Release the arguments of an executed command, keeping the argv array for
+ * the next command parsed into the same slot. Command implementations may
+ * have replaced the client argv (see rewriteClientCommandVector()), in that
+ * case the original array was already freed and we adopt the new one. */
+static void aofLoaderReleaseArgv(aofParsedCommand *cmd, client *c) {
+    int j;
+
+    for (j = 0; j < c->argc; j++) decrRefCount(c->argv[j]);
+    if (c->argv != cmd->argv) {
+        cmd->argv = c->argv;
+        cmd->argvcap = c->argc;
+    }
+    cmd->argc = 0;
+    c->argv = NULL;
+    c->argc = 0;
+}
+
+/* Called once parsing ended (or the process is about to exit). */
+static void aofLoaderRelease(aofLoader *l) {
+    int i, j;
+
+    if (l->threaded) {
+        pthread_join(l->thread,NULL);
+        pthread_mutex_destroy(&l->mutex);
+        pthread_cond_destroy(&l->cond);
+        for (i = 0; i < AOF_LOAD_BATCHES; i++) {
+            for (j = 0; j < AOF_LOAD_BATCH_CMDS; j++)
+                zfree(l->batches[i].cmds[j].argv);
+        }
+        zfree(l->batches);
+    }
+    zfree(l->cmd.argv);
+    zfree(l->reader.buf);
+}
+
 /* Replay the append log file. On success C_OK is returned. On non fatal
  * error (the append only file is zero-length) C_ERR is returned. On
  * fatal error an error message is logged and the program exists. */
@@ -725,9 +1034,12 @@ int loadAppendOnlyFile(char *filename) {
     FILE *fp = fopen(filename,"r");
     struct redis_stat sb;
     int old_aof_state = server.aof_state;
+    int fast_load = server.aof_fast_load;
     long loops = 0;
     off_t valid_up_to = 0; /* Offset of latest well-formed command loaded. */
     off_t valid_before_multi = 0; /* Offset before MULTI command loaded. */
+    aofLoader loader;
+    int res;
 
     if (fp == NULL) {
         serverLog(LL_WARNING,"Fatal error: can't open the append log file for reading: %s",strerror(errno));
@@ -772,77 +1084,46 @@ int loadAppendOnlyFile(char *filename) {
             serverLog(LL_NOTICE,"Reading the remaining AOF tail...");
         }
     }
+    valid_up_to = valid_before_multi = ftello(fp);
+
+    /* In fast load mode keyspace events are not published while replaying,
+     * nobody can reasonably depend on the notifications of the loading
+     * process. Modules are still notified. The configured flags are left
+     * alone, so that a CONFIG SET during the load is not lost. */
+    server.aof_fast_loading = fast_load;
+    aofLoaderInit(&loader,fp,fast_load);
 
     /* Read the actual AOF file, in REPL format, command by command. */
     while(1) {
-        int argc, j;
-        unsigned long len;
-        robj **argv;
-        char buf[128];
-        sds argsds;
+        aofParsedCommand *parsed = NULL;
         struct redisCommand *cmd;
 
         /* Serve the clients from time to time */
         if (!(loops++ % 1000)) {
-            loadingProgress(ftello(fp));
+            loadingProgress(valid_up_to);
             processEventsWhileBlocked();
             processModuleLoadingProgressEvent(1);
         }
 
-        if (fgets(buf,sizeof(buf),fp) == NULL) {
-            if (feof(fp))
-                break;
-            else
-                goto readerr;
+        res = aofLoaderNext(&loader,&parsed);
+        if (res == AOF_PARSE_EOF) break;
+        if (res != AOF_PARSE_OK) {
+            aofLoaderRelease(&loader);
+            if (res == AOF_PARSE_FMTERR) goto fmterr;
+            goto readerr;
         }
-        if (buf[0] != '*') goto fmterr;
-        if (buf[1] == '\0') goto readerr;
-        argc = atoi(buf+1);
-        if (argc < 1) goto fmterr;
 
         /* Load the next command in the AOF as our fake client
          * argv. */
-        argv = zmalloc(sizeof(robj*)*argc);
-        fakeClient->argc = argc;
-        fakeClient->argv = argv;
-
-        for (j = 0; j < argc; j++) {
-            /* Parse the argument len. */
-            char *readres = fgets(buf,sizeof(buf),fp);
-            if (readres == NULL || buf[0] != '$') {
-                fakeClient->argc = j; /* Free up to j-1. */
-                freeFakeClientArgv(fakeClient);
-                if (readres == NULL)
-                    goto readerr;
-                else
-                    goto fmterr;
-            }
-            len = strtol(buf+1,NULL,10);
-
-            /* Read it into a string object. */
-            argsds = sdsnewlen(SDS_NOINIT,len);
-            if (len && fread(argsds,len,1,fp) == 0) {
-                sdsfree(argsds);
-                fakeClient->argc = j; /* Free up to j-1. */
-                freeFakeClientArgv(fakeClient);
-                goto readerr;
-            }
-            argv[j] = createObject(OBJ_STRING,argsds);
-
-            /* Discard CRLF. */
-            if (fread(buf,2,1,fp) == 0) {
-                fakeClient->argc = j+1; /* Free up to j. */
-                freeFakeClientArgv(fakeClient);
-                goto readerr;
-            }
-        }
+        fakeClient->argc = parsed->argc;
+        fakeClient->argv = parsed->argv;
 
         /* Command lookup */
-        cmd = lookupCommand(argv[0]->ptr);
+        cmd = lookupCommand(fakeClient->argv[0]->ptr);
         if (!cmd) {
             serverLog(LL_WARNING,
                 "Unknown command '%s' reading the append only file",
-                (char*)argv[0]->ptr);
+                (char*)fakeClient->argv[0]->ptr);
             exit(1);
         }
 
@@ -866,13 +1147,14 @@ int loadAppendOnlyFile(char *filename) {
         serverAssert((fakeClient->flags & CLIENT_BLOCKED) == 0);
 
         /* Clean up. Command code may have changed argv/argc so we use the
-         * argv/argc of the client instead of the local variables. */
-        freeFakeClientArgv(fakeClient);
+         * argv/argc of the client instead of the parsed ones. */
+        aofLoaderReleaseArgv(parsed,fakeClient);
         fakeClient->cmd = NULL;
-        if (server.aof_load_truncated) valid_up_to = ftello(fp);
+        valid_up_to = parsed->offset;
         if (server.key_load_delay)
             usleep(server.key_load_delay);
     }
+    aofLoaderRelease(&loader);
 
     /* This point can only be reached when EOF is reached without errors.
      * If the client is in the middle of a MULTI/EXEC, handle it as it was
@@ -889,6 +1171,7 @@ loaded_ok: /* DB loaded, cleanup and return C_OK to the caller. */
     fclose(fp);
     freeFakeClient(fakeClient);
     server.aof_state = old_aof_state;
+    server.aof_fast_loading = 0;
     stopLoading(1);
     aofUpdateCurrentSize();
     server.aof_rewrite_base_size = server.aof_current_size;
@@ -1014,6 +1297,49 @@ int rewriteSetObject(rio *r, robj *key, robj *o) {
             if (++count == AOF_REWRITE_ITEMS_PER_CMD) count = 0;
             items--;
         }
+    } else if (o->encoding == OBJ_ENCODING_ROARING) {
+        roaringIterator it;
+        int64_t llval;
+
+        roaringInitIterator(o->ptr,&it);
+        while(roaringNext(&it,&llval)) {
+            if (count == 0) {
+                int cmd_items = (items > AOF_REWRITE_ITEMS_PER_CMD) ?
+                    AOF_REWRITE_ITEMS_PER_CMD : items;
+
+                if (rioWriteBulkCount(r,'*',2+cmd_items) == 0) return 0;
+                if (rioWriteBulkString(r,"SADD",4) == 0) return 0;
+                if (rioWriteBulkObject(r,key) == 0) return 0;
+            }
+            if (rioWriteBulkLongLong(r,llval) == 0) return 0;
+            if (++count == AOF_REWRITE_ITEMS_PER_CMD) count = 0;
+            items--;
+        }
+    } else if (o->encoding == OBJ_ENCODING_LISTPACK) {
+        unsigned char *p = lpFirst(o->ptr);
+        unsigned char *vstr;
+        unsigned int vlen;
+        long long vll;
+
+        while(p) {
+            if (count == 0) {
+                int cmd_items = (items > AOF_REWRITE_ITEMS_PER_CMD) ?
+                    AOF_REWRITE_ITEMS_PER_CMD : items;
+
+                if (rioWriteBulkCount(r,'*',2+cmd_items) == 0) return 0;
+                if (rioWriteBulkString(r,"SADD",4) == 0) return 0;
+                if (rioWriteBulkObject(r,key) == 0) return 0;
+            }
+            vstr = lpGetValue(p,&vlen,&vll);
+            if (vstr) {
+                if (rioWriteBulkString(r,(char*)vstr,vlen) == 0) return 0;
+            } else {
+                if (rioWriteBulkLongLong(r,vll) == 0) return 0;
+            }
+            if (++count == AOF_REWRITE_ITEMS_PER_CMD) count = 0;
+            items--;
+            p = lpNext(o->ptr,p);
+        }
     } else if (o->encoding == OBJ_ENCODING_HT) {
         dictIterator *di = dictGetIterator(o->ptr);
         dictEntry *de;
@@ -1044,7 +1370,7 @@ int rewriteSetObject(rio *r, robj *key, robj *o) {
 int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
     long long count = 0, items = zsetLength(o);
 
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = o->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -1052,13 +1378,13 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
         long long vll;
         double score;
 
-        eptr = ziplistIndex(zl,0);
+        eptr = lpSeek(zl,0);
         serverAssert(eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         serverAssert(sptr != NULL);
 
         while (eptr != NULL) {
-            serverAssert(ziplistGet(eptr,&vstr,&vlen,&vll));
+            vstr = lpGetValue(eptr,&vlen,&vll);
             score = zzlGetScore(sptr);
 
             if (count == 0) {
@@ -1079,14 +1405,15 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
             if (++count == AOF_REWRITE_ITEMS_PER_CMD) count = 0;
             items--;
         }
-    } else if (o->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (o->encoding == OBJ_ENCODING_SKIPLIST ||
+               o->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = o->ptr;
         dictIterator *di = dictGetIterator(zs->dict);
         dictEntry *de;
 
         while((de = dictNext(di)) != NULL) {
             sds ele = dictGetKey(de);
-            double *score = dictGetVal(de);
+            double score = zsetDictGetScore(zs,de);
 
             if (count == 0) {
                 int cmd_items = (items > AOF_REWRITE_ITEMS_PER_CMD) ?
@@ -1096,7 +1423,7 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
                 if (rioWriteBulkString(r,"ZADD",4) == 0) return 0;
                 if (rioWriteBulkObject(r,key) == 0) return 0;
             }
-            if (rioWriteBulkDouble(r,*score) == 0) return 0;
+            if (rioWriteBulkDouble(r,score) == 0) return 0;
             if (rioWriteBulkString(r,ele,sdslen(ele)) == 0) return 0;
             if (++count == AOF_REWRITE_ITEMS_PER_CMD) count = 0;
             items--;
@@ -1115,12 +1442,12 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
  *
  * The function returns 0 on error, non-zero on success. */
 static int rioWriteHashIteratorCursor(rio *r, hashTypeIterator *hi, int what) {
-    if (hi->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (hi->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        hashTypeCurrentFromZiplist(hi, what, &vstr, &vlen, &vll);
+        hashTypeCurrentFromListpack(hi, what, &vstr, &vlen, &vll);
         if (vstr)
             return rioWriteBulkString(r, (char*)vstr, vlen);
         else
@@ -1332,8 +1659,11 @@ int rewriteAppendOnlyFileRio(rio *aof) {
     dictIterator *di = NULL;
     dictEntry *de;
     size_t processed = 0;
+    size_t keys = 0, keys_total = 0;
     int j;
 
+    for (j = 0; j < server.dbnum; j++) keys_total += dictSize(server.db[j].dict);
+
     for (j = 0; j < server.dbnum; j++) {
         char selectcmd[] = "*2\r\n$6\r\nSELECT\r\n";
         redisDb *db = server.db+j;
@@ -1392,6 +1722,10 @@ int rewriteAppendOnlyFileRio(rio *aof) {
                 processed = aof->processed_bytes;
                 aofReadDiffFromParent();
             }
+
+            /* Report the progress to the parent from time to time. */
+            if (!(++keys % CHILD_INFO_KEYS_INTERVAL))
+                sendChildInfoProgress(CHILD_INFO_TYPE_AOF,keys,keys_total);
         }
         dictReleaseIterator(di);
         di = NULL;
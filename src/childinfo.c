@@ -30,6 +30,15 @@
 #include "server.h"
 #include <unistd.h>
 
+/* Forget the progress reported by the previous child. */
+static void resetChildInfoCurrent(void) {
+    server.stat_current_cow_bytes = 0;
+    server.stat_current_cow_updated = 0;
+    server.stat_current_save_keys_processed = 0;
+    server.stat_current_save_keys_total = 0;
+    server.stat_current_fork_start = 0;
+}
+
 /* Open a child-parent channel used in order to move information about the
  * RDB / AOF saving process from the child to the parent (for instance
  * the amount of copy on write memory used) */
@@ -42,6 +51,8 @@ void openChildInfoPipe(void) {
         closeChildInfoPipe();
     } else {
         memset(&server.child_info_data,0,sizeof(server.child_info_data));
+        resetChildInfoCurrent();
+        server.stat_current_fork_start = mstime();
     }
 }
 
@@ -55,6 +66,7 @@ void closeChildInfoPipe(void) {
         server.child_info_pipe[0] = -1;
         server.child_info_pipe[1] = -1;
     }
+    resetChildInfoCurrent();
 }
 
 /* Send COW data to parent. The child should call this function after populating
@@ -69,13 +81,48 @@ void sendChildInfo(int ptype) {
     }
 }
 
-/* Receive COW data from parent. */
+/* Send the progress of the child (COW size and keys processed so far) to
+ * the parent while the child is still working. The function is cheap to
+ * call often: the updates are rate limited, see CHILD_INFO_PERIOD_US and
+ * CHILD_COW_DUTY_CYCLE. Does nothing when not called from a forked child. */
+void sendChildInfoProgress(int ptype, size_t keys, size_t keys_total) {
+    static long long last_update = 0, update_cost = 0;
+    long long now;
+
+    if (!server.in_fork_child || server.child_info_pipe[1] == -1) return;
+    now = ustime();
+    if (now-last_update < CHILD_INFO_PERIOD_US ||
+        now-last_update < update_cost*CHILD_COW_DUTY_CYCLE) return;
+
+    server.child_info_data.cow_size = zmalloc_get_private_dirty(-1);
+    last_update = ustime();
+    update_cost = last_update-now;
+
+    server.child_info_data.final = 0;
+    server.child_info_data.keys = keys;
+    server.child_info_data.keys_total = keys_total;
+    sendChildInfo(ptype);
+}
+
+/* Receive COW data from parent. All the pending reports are consumed: the
+ * progress reports update the current child stats, the final one the stats
+ * of the last completed child of its type. */
 void receiveChildInfo(void) {
     if (server.child_info_pipe[0] == -1) return;
     ssize_t wlen = sizeof(server.child_info_data);
-    if (read(server.child_info_pipe[0],&server.child_info_data,wlen) == wlen &&
-        server.child_info_data.magic == CHILD_INFO_MAGIC)
-    {
+    while (read(server.child_info_pipe[0],&server.child_info_data,wlen) == wlen) {
+        if (server.child_info_data.magic != CHILD_INFO_MAGIC) continue;
+
+        server.stat_current_cow_bytes = server.child_info_data.cow_size;
+        server.stat_current_cow_updated = mstime();
+        if (!server.child_info_data.final) {
+            server.stat_current_save_keys_processed =
+                server.child_info_data.keys;
+            server.stat_current_save_keys_total =
+                server.child_info_data.keys_total;
+            continue;
+        }
+
         if (server.child_info_data.process_type == CHILD_INFO_TYPE_RDB) {
             server.stat_rdb_cow_bytes = server.child_info_data.cow_size;
         } else if (server.child_info_data.process_type == CHILD_INFO_TYPE_AOF) {
@@ -51,7 +51,11 @@ int clusterAddNode(clusterNode *node);
 void clusterAcceptHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void clusterReadHandler(connection *conn);
 void clusterSendPing(clusterLink *link, int type);
+void clusterSendPingToNode(clusterLink *link, int type, clusterNode *target);
+int clusterProcessLightHeader(clusterLink *link);
 void clusterSendFail(char *nodename);
+void clusterSendFailQuery(clusterNode *node);
+void clusterSendFailReport(clusterLink *link, clusterNode *node);
 void clusterSendFailoverAuthIfNeeded(clusterNode *node, clusterMsg *request);
 void clusterUpdateState(void);
 int clusterNodeGetSlotBit(clusterNode *n, int slot);
@@ -72,6 +76,13 @@ void resetManualFailover(void);
 void clusterCloseAllSlots(void);
 void clusterSetNodeAsMaster(clusterNode *n);
 void clusterDelNode(clusterNode *delnode);
+void clusterInvalidateCachedReplies(void);
+void clusterMigrateSlotCommand(client *c);
+void clusterSlotStatsCommand(client *c);
+void addDumpPayloadFooter(rio *payload);
+void clusterSlotMigrationCron(void);
+void clusterSlotReleaseCron(void);
+void clusterSlotReleaseNow(int slot, int importing);
 sds representClusterNodeFlags(sds ci, uint16_t flags);
 uint64_t clusterGetMaxEpoch(void);
 int clusterBumpConfigEpochWithoutConsensus(void);
@@ -461,8 +472,29 @@ void clusterInit(void) {
     for (int i = 0; i < CLUSTERMSG_TYPE_COUNT; i++) {
         server.cluster->stats_bus_messages_sent[i] = 0;
         server.cluster->stats_bus_messages_received[i] = 0;
+        server.cluster->stats_bus_bytes_sent[i] = 0;
+        server.cluster->stats_bus_bytes_received[i] = 0;
     }
+    server.cluster->stats_bus_light_sent = 0;
+    server.cluster->stats_bus_light_received = 0;
+    clusterSlotStatsReset(-1);
     server.cluster->stats_pfail_nodes = 0;
+    server.cluster->slots_reply = NULL;
+    server.cluster->nodes_info_cached = 0;
+    server.cluster->stats_slots_cache_hits = 0;
+    server.cluster->stats_slots_cache_misses = 0;
+    server.cluster->stats_nodes_cache_hits = 0;
+    server.cluster->stats_nodes_cache_misses = 0;
+    server.cluster->slot_migration = NULL;
+    server.cluster->stats_slot_migrations_completed = 0;
+    server.cluster->stats_slot_migrations_aborted = 0;
+    server.cluster->stats_slot_migration_last_keys = 0;
+    server.cluster->stats_slot_migration_last_bytes = 0;
+    server.cluster->stats_slot_migration_last_duration = 0;
+    server.cluster->stats_slot_migration_last_pause = 0;
+    memset(server.cluster->slots_to_release,CLUSTER_SLOT_KEEP,
+           sizeof(server.cluster->slots_to_release));
+    server.cluster->slots_to_release_count = 0;
     memset(server.cluster->slots,0, sizeof(server.cluster->slots));
     clusterCloseAllSlots();
 
@@ -514,10 +546,8 @@ void clusterInit(void) {
         }
     }
 
-    /* The slots -> keys map is a radix tree. Initialize it here. */
-    server.cluster->slots_to_keys = raxNew();
-    memset(server.cluster->slots_keys_count,0,
-           sizeof(server.cluster->slots_keys_count));
+    /* The slots -> keys map is a dict per slot, created on demand. */
+    memset(server.cluster->slots_keys,0,sizeof(server.cluster->slots_keys));
 
     /* Set myself->port / cport to my listening ports, we'll just need to
      * discover the IP address via MEET messages. */
@@ -760,6 +790,10 @@ clusterNode *createClusterNode(char *nodename, int flags) {
     node->orphaned_time = 0;
     node->repl_offset_time = 0;
     node->repl_offset = 0;
+    node->slots_info = NULL;
+    node->sent_slots_hash = 0;
+    node->sent_slots_time = 0;
+    node->recv_slots = NULL;
     listSetFreeMethod(node->fail_reports,zfree);
     return node;
 }
@@ -872,6 +906,7 @@ int clusterNodeRemoveSlave(clusterNode *master, clusterNode *slave) {
             master->numslaves--;
             if (master->numslaves == 0)
                 master->flags &= ~CLUSTER_NODE_MIGRATE_TO;
+            clusterInvalidateCachedReplies();
             return C_OK;
         }
     }
@@ -889,6 +924,7 @@ int clusterNodeAddSlave(clusterNode *master, clusterNode *slave) {
     master->slaves[master->numslaves] = slave;
     master->numslaves++;
     master->flags |= CLUSTER_NODE_MIGRATE_TO;
+    clusterInvalidateCachedReplies();
     return C_OK;
 }
 
@@ -922,7 +958,13 @@ void freeClusterNode(clusterNode *n) {
     if (n->link) freeClusterLink(n->link);
     listRelease(n->fail_reports);
     zfree(n->slaves);
+    zfree(n->recv_slots);
+    if (n->slots_info) {
+        sdsfree(n->slots_info);
+        server.cluster->nodes_info_cached--;
+    }
     zfree(n);
+    clusterInvalidateCachedReplies();
 }
 
 /* Add a node to the nodes hash table */
@@ -931,6 +973,7 @@ int clusterAddNode(clusterNode *node) {
 
     retval = dictAdd(server.cluster->nodes,
             sdsnewlen(node->name,CLUSTER_NAMELEN), node);
+    clusterInvalidateCachedReplies();
     return (retval == DICT_OK) ? C_OK : C_ERR;
 }
 
@@ -1215,9 +1258,9 @@ int clusterBlacklistExists(char *nodeid) {
 /* This function checks if a given node should be marked as FAIL.
  * It happens if the following conditions are met:
  *
- * 1) We received enough failure reports from other master nodes via gossip.
- *    Enough means that the majority of the masters signaled the node is
- *    down recently.
+ * 1) We received enough failure reports from other master nodes via gossip
+ *    or FAIL_QUERY / FAIL_REPORT messages. Enough means that the majority
+ *    of the masters signaled the node is down recently.
  * 2) We believe this node is in PFAIL state.
  *
  * If a failure is detected we also inform the whole cluster about this
@@ -1252,6 +1295,7 @@ void markNodeAsFailingIfNeeded(clusterNode *node) {
     node->flags &= ~CLUSTER_NODE_PFAIL;
     node->flags |= CLUSTER_NODE_FAIL;
     node->fail_time = mstime();
+    clusterInvalidateCachedReplies();
 
     /* Broadcast the failing node name to everybody, forcing all the other
      * reachable nodes to flag the node as FAIL. */
@@ -1275,6 +1319,7 @@ void clearNodeFailureIfNeeded(clusterNode *node) {
                 node->name,
                 nodeIsSlave(node) ? "replica" : "master without slots");
         node->flags &= ~CLUSTER_NODE_FAIL;
+        clusterInvalidateCachedReplies();
         clusterDoBeforeSleep(CLUSTER_TODO_UPDATE_STATE|CLUSTER_TODO_SAVE_CONFIG);
     }
 
@@ -1290,6 +1335,7 @@ void clearNodeFailureIfNeeded(clusterNode *node) {
             "Clear FAIL state for node %.40s: is reachable again and nobody is serving its slots after some time.",
                 node->name);
         node->flags &= ~CLUSTER_NODE_FAIL;
+        clusterInvalidateCachedReplies();
         clusterDoBeforeSleep(CLUSTER_TODO_UPDATE_STATE|CLUSTER_TODO_SAVE_CONFIG);
     }
 }
@@ -1460,6 +1506,7 @@ void clusterProcessGossipSection(clusterMsg *hdr, clusterLink *link) {
                 node->port = ntohs(g->port);
                 node->cport = ntohs(g->cport);
                 node->flags &= ~CLUSTER_NODE_NOADDR;
+                clusterInvalidateCachedReplies();
             }
         } else {
             /* If it's not in NOADDR state and we don't have it, we
@@ -1536,6 +1583,7 @@ int nodeUpdateAddressIfNeeded(clusterNode *node, clusterLink *link,
     memcpy(node->ip,ip,sizeof(ip));
     node->port = port;
     node->cport = cport;
+    clusterInvalidateCachedReplies();
     if (node->link) freeClusterLink(node->link);
     node->flags &= ~CLUSTER_NODE_NOADDR;
     serverLog(LL_WARNING,"Address updated for node %.40s, now %s:%d",
@@ -1716,12 +1764,17 @@ int clusterProcessPacket(clusterLink *link) {
         explen = sizeof(clusterMsg)-sizeof(union clusterMsgData);
         explen += (sizeof(clusterMsgDataGossip)*count);
         if (totlen != explen) return 1;
-    } else if (type == CLUSTERMSG_TYPE_FAIL) {
+    } else if (type == CLUSTERMSG_TYPE_FAIL ||
+               type == CLUSTERMSG_TYPE_FAIL_QUERY ||
+               type == CLUSTERMSG_TYPE_FAIL_REPORT)
+    {
         uint32_t explen = sizeof(clusterMsg)-sizeof(union clusterMsgData);
 
         explen += sizeof(clusterMsgDataFail);
         if (totlen != explen) return 1;
-    } else if (type == CLUSTERMSG_TYPE_PUBLISH) {
+    } else if (type == CLUSTERMSG_TYPE_PUBLISH ||
+               type == CLUSTERMSG_TYPE_PUBLISHSHARD)
+    {
         uint32_t explen = sizeof(clusterMsg)-sizeof(union clusterMsgData);
 
         explen += sizeof(clusterMsgDataPublish) -
@@ -1843,7 +1896,7 @@ int clusterProcessPacket(clusterLink *link) {
             clusterProcessGossipSection(hdr,link);
 
         /* Anyway reply with a PONG */
-        clusterSendPing(link,CLUSTERMSG_TYPE_PONG);
+        clusterSendPingToNode(link,CLUSTERMSG_TYPE_PONG,sender);
     }
 
     /* PING, PONG, MEET: process config information. */
@@ -1912,6 +1965,14 @@ int clusterProcessPacket(clusterLink *link) {
             sender->flags |= nofailover;
         }
 
+        /* Remember if the sender is able to handle FAIL_QUERY messages. */
+        if (sender) {
+            if (hdr->mflags[0] & CLUSTERMSG_FLAG0_FAIL_QUERY)
+                sender->flags |= CLUSTER_NODE_FAIL_QUERY;
+            else
+                sender->flags &= ~CLUSTER_NODE_FAIL_QUERY;
+        }
+
         /* Update the node address if it changed. */
         if (sender && type == CLUSTERMSG_TYPE_PING &&
             !nodeInHandshake(sender) &&
@@ -1934,6 +1995,7 @@ int clusterProcessPacket(clusterLink *link) {
              * conditions detected by clearNodeFailureIfNeeded(). */
             if (nodeTimedOut(link->node)) {
                 link->node->flags &= ~CLUSTER_NODE_PFAIL;
+                clusterInvalidateCachedReplies();
                 clusterDoBeforeSleep(CLUSTER_TODO_SAVE_CONFIG|
                                      CLUSTER_TODO_UPDATE_STATE);
             } else if (nodeFailed(link->node)) {
@@ -2072,6 +2134,7 @@ int clusterProcessPacket(clusterLink *link) {
                 failing->flags |= CLUSTER_NODE_FAIL;
                 failing->fail_time = now;
                 failing->flags &= ~CLUSTER_NODE_PFAIL;
+                clusterInvalidateCachedReplies();
                 clusterDoBeforeSleep(CLUSTER_TODO_SAVE_CONFIG|
                                      CLUSTER_TODO_UPDATE_STATE);
             }
@@ -2080,6 +2143,34 @@ int clusterProcessPacket(clusterLink *link) {
                 "Ignoring FAIL message from unknown node %.40s about %.40s",
                 hdr->sender, hdr->data.fail.about.nodename);
         }
+    } else if (type == CLUSTERMSG_TYPE_FAIL_QUERY ||
+               type == CLUSTERMSG_TYPE_FAIL_REPORT)
+    {
+        clusterNode *failing;
+
+        if (!sender) return 1; /* We don't know that node. */
+        failing = clusterLookupNode(hdr->data.fail.about.nodename);
+        if (!failing || failing == sender || failing == myself) return 1;
+
+        /* Both messages mean that the sender can't reach the node: exactly
+         * like a PFAIL flag in the gossip section, it is a failure report
+         * if the sender is a master. */
+        if (nodeIsMaster(sender)) {
+            if (clusterNodeAddFailureReport(failing,sender)) {
+                serverLog(LL_VERBOSE,
+                    "Node %.40s reported node %.40s as not reachable.",
+                    sender->name, failing->name);
+            }
+            markNodeAsFailingIfNeeded(failing);
+        }
+
+        /* Reply to a query with our own report if we are a master that
+         * can't reach the node as well. */
+        if (type == CLUSTERMSG_TYPE_FAIL_QUERY && nodeIsMaster(myself) &&
+            failing->flags & (CLUSTER_NODE_PFAIL|CLUSTER_NODE_FAIL))
+        {
+            clusterSendFailReport(link,failing);
+        }
     } else if (type == CLUSTERMSG_TYPE_PUBLISH) {
         robj *channel, *message;
         uint32_t channel_len, message_len;
@@ -2100,6 +2191,23 @@ int clusterProcessPacket(clusterLink *link) {
             decrRefCount(channel);
             decrRefCount(message);
         }
+    } else if (type == CLUSTERMSG_TYPE_PUBLISHSHARD) {
+        robj *channel, *message;
+        uint32_t channel_len, message_len;
+
+        if (!sender) return 1;  /* We don't know that node. */
+        if (dictSize(server.pubsubshard_channels)) {
+            channel_len = ntohl(hdr->data.publish.msg.channel_len);
+            message_len = ntohl(hdr->data.publish.msg.message_len);
+            channel = createStringObject(
+                        (char*)hdr->data.publish.msg.bulk_data,channel_len);
+            message = createStringObject(
+                        (char*)hdr->data.publish.msg.bulk_data+channel_len,
+                        message_len);
+            pubsubPublishShardMessage(channel,message);
+            decrRefCount(channel);
+            decrRefCount(message);
+        }
     } else if (type == CLUSTERMSG_TYPE_FAILOVER_AUTH_REQUEST) {
         if (!sender) return 1;  /* We don't know that node. */
         clusterSendFailoverAuthIfNeeded(sender,hdr);
@@ -2239,6 +2347,76 @@ void clusterLinkConnectHandler(connection *conn) {
             node->name, node->ip, node->cport);
 }
 
+/* Called for every message read from the bus before clusterProcessPacket():
+ * update the bytes received stats, and if the message is a light PING or
+ * PONG, restore the slots bitmap omitted by the sender, so that the rest of
+ * the code can always process a full header. Full PING / PONG / MEET headers
+ * are used to learn if the sender accepts light headers and to remember its
+ * slots bitmap, even when it does not accept them: it may start sending
+ * light headers after a config change, based on the last full header sent.
+ *
+ * C_ERR is returned if the message is too short to be valid. */
+int clusterProcessLightHeader(clusterLink *link) {
+    clusterMsg *hdr = (clusterMsg*) link->rcvbuf;
+    uint32_t totlen = ntohl(hdr->totlen);
+    uint16_t type = ntohs(hdr->type);
+    int light = type & CLUSTERMSG_LIGHT;
+    clusterNode *sender;
+
+    type &= ~CLUSTERMSG_LIGHT;
+    if (type < CLUSTERMSG_TYPE_COUNT)
+        server.cluster->stats_bus_bytes_received[type] += totlen;
+    if (!light && totlen < CLUSTERMSG_MIN_LEN) return C_ERR;
+    if (light && type != CLUSTERMSG_TYPE_PING &&
+                 type != CLUSTERMSG_TYPE_PONG) return C_ERR;
+
+    /* The sender field comes before myslots, so it is at the same offset
+     * in light and full headers. */
+    sender = clusterLookupNode(hdr->sender);
+    if (!light) {
+        if (sender && (type == CLUSTERMSG_TYPE_PING ||
+                       type == CLUSTERMSG_TYPE_PONG ||
+                       type == CLUSTERMSG_TYPE_MEET))
+        {
+            if (hdr->mflags[0] & CLUSTERMSG_FLAG0_LIGHT_HDR)
+                sender->flags |= CLUSTER_NODE_LIGHT_HDR;
+            else
+                sender->flags &= ~CLUSTER_NODE_LIGHT_HDR;
+            if (sender->recv_slots == NULL)
+                sender->recv_slots = zmalloc(sizeof(hdr->myslots));
+            memcpy(sender->recv_slots,hdr->myslots,sizeof(hdr->myslots));
+        }
+        return C_OK;
+    }
+
+    /* Rebuild the full header: the fields after myslots are moved forward
+     * and the bitmap is taken from the last full header of the sender. If
+     * we don't have it, use what we know about the slots of the sender. */
+    size_t prefix = offsetof(clusterMsg,myslots);
+    size_t slotslen = sizeof(hdr->myslots);
+    sds full = sdsnewlen(NULL,totlen+slotslen);
+    unsigned char *slots = (unsigned char*) full+prefix;
+
+    memcpy(full,link->rcvbuf,prefix);
+    memcpy(slots+slotslen,link->rcvbuf+prefix,totlen-prefix);
+    if (sender && sender->recv_slots) {
+        memcpy(slots,sender->recv_slots,slotslen);
+    } else if (sender) {
+        clusterNode *master = (nodeIsSlave(sender) && sender->slaveof) ?
+                              sender->slaveof : sender;
+        memcpy(slots,master->slots,slotslen);
+    } else {
+        memset(slots,0,slotslen);
+    }
+    sdsfree(link->rcvbuf);
+    link->rcvbuf = full;
+    hdr = (clusterMsg*) full;
+    hdr->type = htons(type);
+    hdr->totlen = htonl(totlen+slotslen);
+    server.cluster->stats_bus_light_received++;
+    return C_OK;
+}
+
 /* Read data. Try to read the first field of the header first to check the
  * full length of the packet. When a whole packet is in memory this function
  * will call the function to process the packet. And so forth. */
@@ -2262,7 +2440,7 @@ void clusterReadHandler(connection *conn) {
                 /* Perform some sanity check on the message signature
                  * and length. */
                 if (memcmp(hdr->sig,"RCmb",4) != 0 ||
-                    ntohl(hdr->totlen) < CLUSTERMSG_MIN_LEN)
+                    ntohl(hdr->totlen) < CLUSTERMSG_LIGHT_MIN_LEN)
                 {
                     serverLog(LL_WARNING,
                         "Bad message length or signature received "
@@ -2293,6 +2471,13 @@ void clusterReadHandler(connection *conn) {
 
         /* Total length obtained? Process this packet. */
         if (rcvbuflen >= 8 && rcvbuflen == ntohl(hdr->totlen)) {
+            if (clusterProcessLightHeader(link) == C_ERR) {
+                serverLog(LL_WARNING,
+                    "Bad message length or type received "
+                    "from Cluster bus.");
+                handleLinkIOError(link);
+                return;
+            }
             if (clusterProcessPacket(link)) {
                 sdsfree(link->rcvbuf);
                 link->rcvbuf = sdsempty();
@@ -2316,9 +2501,11 @@ void clusterSendMessage(clusterLink *link, unsigned char *msg, size_t msglen) {
 
     /* Populate sent messages stats. */
     clusterMsg *hdr = (clusterMsg*) msg;
-    uint16_t type = ntohs(hdr->type);
-    if (type < CLUSTERMSG_TYPE_COUNT)
+    uint16_t type = ntohs(hdr->type) & ~CLUSTERMSG_LIGHT;
+    if (type < CLUSTERMSG_TYPE_COUNT) {
         server.cluster->stats_bus_messages_sent[type]++;
+        server.cluster->stats_bus_bytes_sent[type] += msglen;
+    }
 }
 
 /* Send a message to all the nodes that are part of the cluster having
@@ -2406,10 +2593,16 @@ void clusterBuildMessageHdr(clusterMsg *hdr, int type) {
     /* Set the message flags. */
     if (nodeIsMaster(myself) && server.cluster->mf_end)
         hdr->mflags[0] |= CLUSTERMSG_FLAG0_PAUSED;
+    if (server.cluster_light_header)
+        hdr->mflags[0] |= CLUSTERMSG_FLAG0_LIGHT_HDR;
+    hdr->mflags[0] |= CLUSTERMSG_FLAG0_FAIL_QUERY;
 
     /* Compute the message length for certain messages. For other messages
      * this is up to the caller. */
-    if (type == CLUSTERMSG_TYPE_FAIL) {
+    if (type == CLUSTERMSG_TYPE_FAIL ||
+        type == CLUSTERMSG_TYPE_FAIL_QUERY ||
+        type == CLUSTERMSG_TYPE_FAIL_REPORT)
+    {
         totlen = sizeof(clusterMsg)-sizeof(union clusterMsgData);
         totlen += sizeof(clusterMsgDataFail);
     } else if (type == CLUSTERMSG_TYPE_UPDATE) {
@@ -2447,9 +2640,47 @@ void clusterSetGossipEntry(clusterMsg *hdr, int i, clusterNode *n) {
     gossip->notused1 = 0;
 }
 
+/* Turn the PING or PONG message 'hdr' of length 'totlen' into a light one
+ * if 'target' accepts light headers, and the slots bitmap is the same we sent
+ * it in the last full header, after the link was created and not longer
+ * than a node timeout ago. The new length of the message is returned. */
+uint32_t clusterMakeLightHeader(clusterLink *link, clusterNode *target,
+                                clusterMsg *hdr, uint32_t totlen)
+{
+    mstime_t now = mstime();
+    uint64_t hash = dictGenHashFunction(hdr->myslots,sizeof(hdr->myslots));
+    size_t prefix = offsetof(clusterMsg,myslots);
+    size_t slotslen = sizeof(hdr->myslots);
+
+    if (!server.cluster_light_header || !nodeSupportsLightHdr(target) ||
+        hash != target->sent_slots_hash ||
+        target->sent_slots_time < link->ctime ||
+        now - target->sent_slots_time > server.cluster_node_timeout)
+    {
+        target->sent_slots_hash = hash;
+        target->sent_slots_time = now;
+        return totlen;
+    }
+
+    memmove(((unsigned char*)hdr)+prefix,
+            ((unsigned char*)hdr)+prefix+slotslen,totlen-prefix-slotslen);
+    totlen -= slotslen;
+    hdr->type = htons(ntohs(hdr->type) | CLUSTERMSG_LIGHT);
+    hdr->totlen = htonl(totlen);
+    server.cluster->stats_bus_light_sent++;
+    return totlen;
+}
+
 /* Send a PING or PONG packet to the specified node, making sure to add enough
  * gossip informations. */
 void clusterSendPing(clusterLink *link, int type) {
+    clusterSendPingToNode(link,type,link->node);
+}
+
+/* Like clusterSendPing(), but 'target' is the node at the other side of the
+ * link, if known, since for incoming links link->node is NULL. It is used in
+ * order to send a light header when possible, see clusterMakeLightHeader(). */
+void clusterSendPingToNode(clusterLink *link, int type, clusterNode *target) {
     unsigned char *buf;
     clusterMsg *hdr;
     int gossipcount = 0; /* Number of gossip sections added so far. */
@@ -2573,6 +2804,8 @@ void clusterSendPing(clusterLink *link, int type) {
     totlen += (sizeof(clusterMsgDataGossip)*gossipcount);
     hdr->count = htons(gossipcount);
     hdr->totlen = htonl(totlen);
+    if (target && type != CLUSTERMSG_TYPE_MEET)
+        totlen = clusterMakeLightHeader(link,target,hdr,totlen);
     clusterSendMessage(link,buf,totlen);
     zfree(buf);
 }
@@ -2614,10 +2847,12 @@ void clusterBroadcastPong(int target) {
     dictReleaseIterator(di);
 }
 
-/* Send a PUBLISH message.
+/* Send a PUBLISH message, or a PUBLISHSHARD one depending on 'type'.
  *
  * If link is NULL, then the message is broadcasted to the whole cluster. */
-void clusterSendPublish(clusterLink *link, robj *channel, robj *message) {
+void clusterSendPublish(clusterLink *link, robj *channel, robj *message,
+                        int type)
+{
     unsigned char *payload;
     clusterMsg buf[1];
     clusterMsg *hdr = (clusterMsg*) buf;
@@ -2629,7 +2864,7 @@ void clusterSendPublish(clusterLink *link, robj *channel, robj *message) {
     channel_len = sdslen(channel->ptr);
     message_len = sdslen(message->ptr);
 
-    clusterBuildMessageHdr(hdr,CLUSTERMSG_TYPE_PUBLISH);
+    clusterBuildMessageHdr(hdr,type);
     totlen = sizeof(clusterMsg)-sizeof(union clusterMsgData);
     totlen += sizeof(clusterMsgDataPublish) - 8 + channel_len + message_len;
 
@@ -2673,6 +2908,46 @@ void clusterSendFail(char *nodename) {
     clusterBroadcastMessage(buf,ntohl(hdr->totlen));
 }
 
+/* Send a FAIL_QUERY message about 'node', that we just flagged as PFAIL, to
+ * all the masters we are connected with, except the node itself. Every
+ * master counts it as a failure report, and replies with a FAIL_REPORT if it
+ * can't reach the node as well, so we don't have to wait for the reports to
+ * spread with the gossip section of PING / PONG messages. */
+void clusterSendFailQuery(clusterNode *node) {
+    clusterMsg buf[1];
+    clusterMsg *hdr = (clusterMsg*) buf;
+    dictIterator *di;
+    dictEntry *de;
+
+    clusterBuildMessageHdr(hdr,CLUSTERMSG_TYPE_FAIL_QUERY);
+    memcpy(hdr->data.fail.about.nodename,node->name,CLUSTER_NAMELEN);
+
+    di = dictGetSafeIterator(server.cluster->nodes);
+    while((de = dictNext(di)) != NULL) {
+        clusterNode *target = dictGetVal(de);
+
+        if (!target->link || target == node) continue;
+        if (target->flags & (CLUSTER_NODE_MYSELF|CLUSTER_NODE_HANDSHAKE))
+            continue;
+        if (!nodeIsMaster(target) || !nodeSupportsFailQuery(target) ||
+            nodeFailed(target)) continue;
+        clusterSendMessage(target->link,(unsigned char*)buf,
+                           ntohl(hdr->totlen));
+    }
+    dictReleaseIterator(di);
+}
+
+/* Reply to a FAIL_QUERY received from 'link' telling we also can't reach
+ * 'node'. */
+void clusterSendFailReport(clusterLink *link, clusterNode *node) {
+    clusterMsg buf[1];
+    clusterMsg *hdr = (clusterMsg*) buf;
+
+    clusterBuildMessageHdr(hdr,CLUSTERMSG_TYPE_FAIL_REPORT);
+    memcpy(hdr->data.fail.about.nodename,node->name,CLUSTER_NAMELEN);
+    clusterSendMessage(link,(unsigned char*)buf,ntohl(hdr->totlen));
+}
+
 /* Send an UPDATE message to the specified link carrying the specified 'node'
  * slots configuration. The node name, slots bitmap, and configEpoch info
  * are included. */
@@ -2752,7 +3027,29 @@ int clusterSendModuleMessageToTarget(const char *target, uint64_t module_id, uin
  * messages to hosts without receives for a given channel.
  * -------------------------------------------------------------------------- */
 void clusterPropagatePublish(robj *channel, robj *message) {
-    clusterSendPublish(NULL, channel, message);
+    clusterSendPublish(NULL, channel, message, CLUSTERMSG_TYPE_PUBLISH);
+}
+
+/* Shard channels (SPUBLISH) only need to reach the nodes of the shard
+ * serving the channel slot, that is our master (if we are a replica) and
+ * the replicas of our master, since subscribers can only be connected to
+ * them. */
+void clusterPropagatePublishShard(robj *channel, robj *message) {
+    clusterNode *master = nodeIsSlave(myself) ? myself->slaveof : myself;
+    int j;
+
+    if (master == NULL) return;
+    if (master != myself && master->link)
+        clusterSendPublish(master->link,channel,message,
+                           CLUSTERMSG_TYPE_PUBLISHSHARD);
+    for (j = 0; j < master->numslaves; j++) {
+        clusterNode *node = master->slaves[j];
+
+        if (node == myself || node->link == NULL || nodeInHandshake(node))
+            continue;
+        clusterSendPublish(node->link,channel,message,
+                           CLUSTERMSG_TYPE_PUBLISHSHARD);
+    }
 }
 
 /* -----------------------------------------------------------------------------
@@ -3450,6 +3747,7 @@ void clusterCron(void) {
             } else {
                 myself->ip[0] = '\0'; /* Force autodetection. */
             }
+            clusterInvalidateCachedReplies();
         }
     }
 
@@ -3634,7 +3932,9 @@ void clusterCron(void) {
                 serverLog(LL_DEBUG,"*** NODE %.40s possibly failing",
                     node->name);
                 node->flags |= CLUSTER_NODE_PFAIL;
+                clusterInvalidateCachedReplies();
                 update_state = 1;
+                if (server.cluster_fail_query) clusterSendFailQuery(node);
             }
         }
     }
@@ -3654,6 +3954,11 @@ void clusterCron(void) {
     /* Abourt a manual failover if the timeout is reached. */
     manualFailoverCheckTimeout();
 
+    /* Check the slot migration in progress, if any, and delete the keys
+     * of the slots already migrated. */
+    clusterSlotMigrationCron();
+    clusterSlotReleaseCron();
+
     if (nodeIsSlave(myself)) {
         clusterHandleManualFailover();
         if (!(server.cluster_module_flags & CLUSTER_MODULE_FLAG_NO_FAILOVER))
@@ -3700,6 +4005,11 @@ void clusterBeforeSleep(void) {
 
 void clusterDoBeforeSleep(int flags) {
     server.cluster->todo_before_sleep |= flags;
+    /* Callers asking to save the config or update the state are reporting a
+     * change in the cluster configuration, so this is the catch-all place
+     * where the cached replies are dropped. */
+    if (flags & (CLUSTER_TODO_SAVE_CONFIG|CLUSTER_TODO_UPDATE_STATE))
+        clusterInvalidateCachedReplies();
 }
 
 /* -----------------------------------------------------------------------------
@@ -3789,8 +4099,10 @@ int clusterNodeGetSlotBit(clusterNode *n, int slot) {
  * an error and C_ERR is returned. */
 int clusterAddSlot(clusterNode *n, int slot) {
     if (server.cluster->slots[slot]) return C_ERR;
+    if (n == myself) clusterSlotReleaseNow(slot,0);
     clusterNodeSetSlotBit(n,slot);
     server.cluster->slots[slot] = n;
+    clusterInvalidateCachedReplies();
     return C_OK;
 }
 
@@ -3803,6 +4115,8 @@ int clusterDelSlot(int slot) {
     if (!n) return C_ERR;
     serverAssert(clusterNodeClearSlotBit(n,slot) == 1);
     server.cluster->slots[slot] = NULL;
+    if (n == myself) clusterSlotStatsReset(slot);
+    clusterInvalidateCachedReplies();
     return C_OK;
 }
 
@@ -3827,6 +4141,7 @@ void clusterCloseAllSlots(void) {
         sizeof(server.cluster->migrating_slots_to));
     memset(server.cluster->importing_slots_from,0,
         sizeof(server.cluster->importing_slots_from));
+    clusterInvalidateCachedReplies();
 }
 
 /* -----------------------------------------------------------------------------
@@ -3841,6 +4156,27 @@ void clusterCloseAllSlots(void) {
 #define CLUSTER_MIN_REJOIN_DELAY 500
 #define CLUSTER_WRITABLE_DELAY 2000
 
+/* Unsubscribe the clients from the shard channels whose slot is no longer
+ * served by our shard, for instance after the slot was moved to another
+ * node: messages published to them would never reach this node again.
+ * The clients receive an sunsubscribe notification for every channel. */
+void clusterRemoveStaleShardChannels(void) {
+    clusterNode *master = nodeIsSlave(myself) ? myself->slaveof : myself;
+    dictIterator *di;
+    dictEntry *de;
+
+    if (dictSize(server.pubsubshard_channels) == 0) return;
+    di = dictGetSafeIterator(server.pubsubshard_channels);
+    while((de = dictNext(di)) != NULL) {
+        robj *channel = dictGetKey(de);
+        int slot = keyHashSlot(channel->ptr,sdslen(channel->ptr));
+
+        if (master != NULL && server.cluster->slots[slot] == master) continue;
+        pubsubShardUnsubscribeAllClients(channel);
+    }
+    dictReleaseIterator(di);
+}
+
 void clusterUpdateState(void) {
     int j, new_state;
     int reachable_masters = 0;
@@ -3849,6 +4185,8 @@ void clusterUpdateState(void) {
 
     server.cluster->todo_before_sleep &= ~CLUSTER_TODO_UPDATE_STATE;
 
+    clusterRemoveStaleShardChannels();
+
     /* If this is a master node, wait some time before turning the state
      * into OK, since it is not a good idea to rejoin the cluster as a writable
      * master, after a reboot, without giving the cluster a chance to
@@ -4071,33 +4409,11 @@ sds representClusterNodeFlags(sds ci, uint16_t flags) {
  * See clusterGenNodesDescription() top comment for more information.
  *
  * The function returns the string representation as an SDS string. */
-sds clusterGenNodeDescription(clusterNode *node) {
+/* Generate the slots part of the node description: the slot ranges served
+ * by the node and, only for MYSELF, the migrating / importing slots. */
+static sds clusterGenNodeSlotsInfo(clusterNode *node) {
     int j, start;
-    sds ci;
-
-    /* Node coordinates */
-    ci = sdscatprintf(sdsempty(),"%.40s %s:%d@%d ",
-        node->name,
-        node->ip,
-        node->port,
-        node->cport);
-
-    /* Flags */
-    ci = representClusterNodeFlags(ci, node->flags);
-
-    /* Slave of... or just "-" */
-    if (node->slaveof)
-        ci = sdscatprintf(ci," %.40s ",node->slaveof->name);
-    else
-        ci = sdscatlen(ci," - ",3);
-
-    /* Latency from the POV of this node, config epoch, link status */
-    ci = sdscatprintf(ci,"%lld %lld %llu %s",
-        (long long) node->ping_sent,
-        (long long) node->pong_received,
-        (unsigned long long) node->configEpoch,
-        (node->link || node->flags & CLUSTER_NODE_MYSELF) ?
-                    "connected" : "disconnected");
+    sds ci = sdsempty();
 
     /* Slots served by this instance */
     start = -1;
@@ -4136,6 +4452,44 @@ sds clusterGenNodeDescription(clusterNode *node) {
     return ci;
 }
 
+sds clusterGenNodeDescription(clusterNode *node) {
+    sds ci;
+
+    /* Node coordinates */
+    ci = sdscatprintf(sdsempty(),"%.40s %s:%d@%d ",
+        node->name,
+        node->ip,
+        node->port,
+        node->cport);
+
+    /* Flags */
+    ci = representClusterNodeFlags(ci, node->flags);
+
+    /* Slave of... or just "-" */
+    if (node->slaveof)
+        ci = sdscatprintf(ci," %.40s ",node->slaveof->name);
+    else
+        ci = sdscatlen(ci," - ",3);
+
+    /* Latency from the POV of this node, config epoch, link status */
+    ci = sdscatprintf(ci,"%lld %lld %llu %s",
+        (long long) node->ping_sent,
+        (long long) node->pong_received,
+        (unsigned long long) node->configEpoch,
+        (node->link || node->flags & CLUSTER_NODE_MYSELF) ?
+                    "connected" : "disconnected");
+
+    /* Slots served by this instance. This part is the expensive one to
+     * generate, so it is cached in the node and only rebuilt after
+     * clusterInvalidateCachedReplies() is called. */
+    if (node->slots_info == NULL) {
+        node->slots_info = clusterGenNodeSlotsInfo(node);
+        server.cluster->nodes_info_cached++;
+    }
+    ci = sdscatsds(ci,node->slots_info);
+    return ci;
+}
+
 /* Generate a csv-alike representation of the nodes we are aware of,
  * including the "myself" node, and return an SDS string containing the
  * representation (it is up to the caller to free it).
@@ -4183,6 +4537,9 @@ const char *clusterGetMessageTypeString(int type) {
     case CLUSTERMSG_TYPE_UPDATE: return "update";
     case CLUSTERMSG_TYPE_MFSTART: return "mfstart";
     case CLUSTERMSG_TYPE_MODULE: return "module";
+    case CLUSTERMSG_TYPE_PUBLISHSHARD: return "publishshard";
+    case CLUSTERMSG_TYPE_FAIL_QUERY: return "fail-query";
+    case CLUSTERMSG_TYPE_FAIL_REPORT: return "fail-report";
     }
     return "unknown";
 }
@@ -4199,7 +4556,26 @@ int getSlotOrReply(client *c, robj *o) {
     return (int) slot;
 }
 
-void clusterReplyMultiBulkSlots(client *c) {
+/* Append a RESP bulk string to the CLUSTER SLOTS reply being generated. */
+static sds clusterSlotsReplyAddBulk(sds reply, const char *p, size_t len) {
+    reply = sdscatfmt(reply,"$%U\r\n",(unsigned long long)len);
+    reply = sdscatlen(reply,p,len);
+    return sdscatlen(reply,"\r\n",2);
+}
+
+/* Append the "ip, port, node ID" array of a node to the CLUSTER SLOTS
+ * reply being generated. */
+static sds clusterSlotsReplyAddNode(sds reply, clusterNode *node) {
+    reply = sdscatlen(reply,"*3\r\n",4);
+    reply = clusterSlotsReplyAddBulk(reply,node->ip,strlen(node->ip));
+    reply = sdscatfmt(reply,":%i\r\n",node->port);
+    return clusterSlotsReplyAddBulk(reply,node->name,CLUSTER_NAMELEN);
+}
+
+/* Generate the CLUSTER SLOTS reply already encoded in the RESP protocol.
+ * The reply only uses arrays, integers and bulk strings, that are encoded
+ * the same way in RESP2 and RESP3, so the same buffer serves both. */
+static sds clusterGenSlotsReply(void) {
     /* Format: 1) 1) start slot
      *            2) end slot
      *            3) 1) master IP
@@ -4212,7 +4588,7 @@ void clusterReplyMultiBulkSlots(client *c) {
      */
 
     int num_masters = 0;
-    void *slot_replylen = addReplyDeferredLen(c);
+    sds ranges = sdsempty(), reply;
 
     dictEntry *de;
     dictIterator *di = dictGetSafeIterator(server.cluster->nodes);
@@ -4237,43 +4613,69 @@ void clusterReplyMultiBulkSlots(client *c) {
                 if (start == -1) start = j;
             }
             if (start != -1 && (!bit || j == CLUSTER_SLOTS-1)) {
-                addReplyArrayLen(c, nested_elements + 3); /* slots (2) + master addr (1). */
+                /* slots (2) + master addr (1). */
+                ranges = sdscatfmt(ranges,"*%i\r\n",nested_elements + 3);
 
                 if (bit && j == CLUSTER_SLOTS-1) j++;
 
-                /* If slot exists in output map, add to it's list.
-                 * else, create a new output map for this slot */
-                if (start == j-1) {
-                    addReplyLongLong(c, start); /* only one slot; low==high */
-                    addReplyLongLong(c, start);
-                } else {
-                    addReplyLongLong(c, start); /* low */
-                    addReplyLongLong(c, j-1);   /* high */
-                }
+                /* Low and high slot, the same for a single slot range. */
+                ranges = sdscatfmt(ranges,":%i\r\n:%i\r\n",start,j-1);
                 start = -1;
 
                 /* First node reply position is always the master */
-                addReplyArrayLen(c, 3);
-                addReplyBulkCString(c, node->ip);
-                addReplyLongLong(c, node->port);
-                addReplyBulkCBuffer(c, node->name, CLUSTER_NAMELEN);
+                ranges = clusterSlotsReplyAddNode(ranges,node);
 
                 /* Remaining nodes in reply are replicas for slot range */
                 for (i = 0; i < node->numslaves; i++) {
                     /* This loop is copy/pasted from clusterGenNodeDescription()
                      * with modifications for per-slot node aggregation */
                     if (nodeFailed(node->slaves[i])) continue;
-                    addReplyArrayLen(c, 3);
-                    addReplyBulkCString(c, node->slaves[i]->ip);
-                    addReplyLongLong(c, node->slaves[i]->port);
-                    addReplyBulkCBuffer(c, node->slaves[i]->name, CLUSTER_NAMELEN);
+                    ranges = clusterSlotsReplyAddNode(ranges,node->slaves[i]);
                 }
                 num_masters++;
             }
         }
     }
     dictReleaseIterator(di);
-    setDeferredArrayLen(c, slot_replylen, num_masters);
+    reply = sdscatfmt(sdsempty(),"*%i\r\n",num_masters);
+    reply = sdscatsds(reply,ranges);
+    sdsfree(ranges);
+    return reply;
+}
+
+/* Drop the cached CLUSTER SLOTS reply and the cached slots part of every
+ * node description. Called every time something that is part of those
+ * replies changes: slots ownership, nodes addresses and roles, the set of
+ * known nodes, failure flags, and in general whenever clusterDoBeforeSleep()
+ * reports a configuration change. */
+void clusterInvalidateCachedReplies(void) {
+    if (server.cluster->slots_reply) {
+        sdsfree(server.cluster->slots_reply);
+        server.cluster->slots_reply = NULL;
+    }
+    if (server.cluster->nodes_info_cached == 0) return;
+
+    dictEntry *de;
+    dictIterator *di = dictGetSafeIterator(server.cluster->nodes);
+    while((de = dictNext(di)) != NULL) {
+        clusterNode *node = dictGetVal(de);
+
+        sdsfree(node->slots_info);
+        node->slots_info = NULL;
+    }
+    dictReleaseIterator(di);
+    server.cluster->nodes_info_cached = 0;
+}
+
+void clusterReplyMultiBulkSlots(client *c) {
+    if (server.cluster->slots_reply) {
+        server.cluster->stats_slots_cache_hits++;
+    } else {
+        server.cluster->slots_reply = clusterGenSlotsReply();
+        server.cluster->stats_slots_cache_misses++;
+    }
+    addReplyProto(c,server.cluster->slots_reply,
+                  sdslen(server.cluster->slots_reply));
 }
 
 void clusterCommand(client *c) {
@@ -4296,6 +4698,9 @@ void clusterCommand(client *c) {
 "INFO - Return information about the cluster.",
 "KEYSLOT <key> -- Return the hash slot for <key>.",
 "MEET <ip> <port> [bus-port] -- Connect nodes into a working cluster.",
+"MIGRATESLOT <slot> <node-id> -- Stream all the keys of <slot> to <node-id>, then hand over the slot.",
+"MIGRATESLOT ABORT -- Abort the slot migration in progress.",
+"MIGRATESLOT <slot> CANCEL -- Stop importing <slot> and delete its keys, sent to the target by an aborted migration.",
 "MYID -- Return the node id.",
 "NODES -- Return cluster configuration seen by node. Output format:",
 "    <id> <ip:port> <flags> <master> <pings> <pongs> <epoch> <link> <slot> ... <slot>",
@@ -4307,6 +4712,8 @@ void clusterCommand(client *c) {
 "SAVECONFIG - Force saving cluster configuration on disk.",
 "SLOTS -- Return information about slots range mappings. Each range is made of:",
 "    start, end, master and replicas IP addresses, ports and ids",
+"SLOT-STATS SLOTSRANGE <start> <end> -- Return key count, memory, reads, writes and network bytes of the slots in range.",
+"SLOT-STATS ORDERBY <metric> [LIMIT <count>] [ASC|DESC] -- Return the slots with the highest (or lowest) value of <metric>.",
 NULL
         };
         addReplyHelp(c, help);
@@ -4340,6 +4747,11 @@ NULL
         }
     } else if (!strcasecmp(c->argv[1]->ptr,"nodes") && c->argc == 2) {
         /* CLUSTER NODES */
+        if (server.cluster->nodes_info_cached ==
+            dictSize(server.cluster->nodes))
+            server.cluster->stats_nodes_cache_hits++;
+        else
+            server.cluster->stats_nodes_cache_misses++;
         sds nodes = clusterGenNodesDescription(0);
         addReplyVerbatim(c,nodes,sdslen(nodes),"txt");
         sdsfree(nodes);
@@ -4408,6 +4820,13 @@ NULL
         zfree(slots);
         clusterDoBeforeSleep(CLUSTER_TODO_UPDATE_STATE|CLUSTER_TODO_SAVE_CONFIG);
         addReply(c,shared.ok);
+    } else if (!strcasecmp(c->argv[1]->ptr,"slot-stats") && c->argc >= 3) {
+        /* CLUSTER SLOT-STATS SLOTSRANGE <start> <end> |
+         *                    ORDERBY <metric> [LIMIT <count>] [ASC|DESC] */
+        clusterSlotStatsCommand(c);
+    } else if (!strcasecmp(c->argv[1]->ptr,"migrateslot") && c->argc >= 3) {
+        /* CLUSTER MIGRATESLOT <slot> <node-id> | <slot> CANCEL | ABORT */
+        clusterMigrateSlotCommand(c);
     } else if (!strcasecmp(c->argv[1]->ptr,"setslot") && c->argc >= 4) {
         /* SETSLOT 10 MIGRATING <node ID> */
         /* SETSLOT 10 IMPORTING <node ID> */
@@ -4445,6 +4864,7 @@ NULL
                     (char*)c->argv[4]->ptr);
                 return;
             }
+            clusterSlotReleaseNow(slot,1);
             server.cluster->importing_slots_from[slot] = n;
         } else if (!strcasecmp(c->argv[3]->ptr,"stable") && c->argc == 4) {
             /* CLUSTER SETSLOT <SLOT> STABLE */
@@ -4546,6 +4966,10 @@ NULL
             "cluster_size:%d\r\n"
             "cluster_current_epoch:%llu\r\n"
             "cluster_my_epoch:%llu\r\n"
+            "cluster_slots_cache_hits:%lld\r\n"
+            "cluster_slots_cache_misses:%lld\r\n"
+            "cluster_nodes_cache_hits:%lld\r\n"
+            "cluster_nodes_cache_misses:%lld\r\n"
             , statestr[server.cluster->state],
             slots_assigned,
             slots_ok,
@@ -4554,34 +4978,85 @@ NULL
             dictSize(server.cluster->nodes),
             server.cluster->size,
             (unsigned long long) server.cluster->currentEpoch,
-            (unsigned long long) myepoch
+            (unsigned long long) myepoch,
+            server.cluster->stats_slots_cache_hits,
+            server.cluster->stats_slots_cache_misses,
+            server.cluster->stats_nodes_cache_hits,
+            server.cluster->stats_nodes_cache_misses
         );
 
+        /* Show the server side slot migration stats. */
+        clusterSlotMigration *sm = server.cluster->slot_migration;
+        long long last_duration =
+            server.cluster->stats_slot_migration_last_duration;
+        info = sdscatprintf(info,
+            "cluster_slot_migration_in_progress:%d\r\n"
+            "cluster_slot_migration_slot:%d\r\n"
+            "cluster_slot_migration_keys_sent:%lld\r\n"
+            "cluster_slot_migration_bytes_sent:%lld\r\n"
+            "cluster_slot_migrations_completed:%lld\r\n"
+            "cluster_slot_migrations_aborted:%lld\r\n"
+            "cluster_slot_migration_last_keys:%lld\r\n"
+            "cluster_slot_migration_last_bytes:%lld\r\n"
+            "cluster_slot_migration_last_duration_ms:%lld\r\n"
+            "cluster_slot_migration_last_bytes_per_sec:%lld\r\n"
+            "cluster_slot_migration_last_pause_us:%lld\r\n",
+            sm != NULL,
+            sm ? sm->slot : -1,
+            sm ? sm->keys : 0,
+            sm ? sm->bytes : 0,
+            server.cluster->stats_slot_migrations_completed,
+            server.cluster->stats_slot_migrations_aborted,
+            server.cluster->stats_slot_migration_last_keys,
+            server.cluster->stats_slot_migration_last_bytes,
+            last_duration,
+            server.cluster->stats_slot_migration_last_bytes*1000/
+                (last_duration ? last_duration : 1),
+            server.cluster->stats_slot_migration_last_pause);
+
         /* Show stats about messages sent and received. */
         long long tot_msg_sent = 0;
         long long tot_msg_received = 0;
+        long long tot_bytes_sent = 0;
+        long long tot_bytes_received = 0;
 
         for (int i = 0; i < CLUSTERMSG_TYPE_COUNT; i++) {
             if (server.cluster->stats_bus_messages_sent[i] == 0) continue;
             tot_msg_sent += server.cluster->stats_bus_messages_sent[i];
+            tot_bytes_sent += server.cluster->stats_bus_bytes_sent[i];
             info = sdscatprintf(info,
-                "cluster_stats_messages_%s_sent:%lld\r\n",
+                "cluster_stats_messages_%s_sent:%lld\r\n"
+                "cluster_stats_bytes_%s_sent:%lld\r\n",
+                clusterGetMessageTypeString(i),
+                server.cluster->stats_bus_messages_sent[i],
                 clusterGetMessageTypeString(i),
-                server.cluster->stats_bus_messages_sent[i]);
+                server.cluster->stats_bus_bytes_sent[i]);
         }
         info = sdscatprintf(info,
-            "cluster_stats_messages_sent:%lld\r\n", tot_msg_sent);
+            "cluster_stats_messages_sent:%lld\r\n"
+            "cluster_stats_bytes_sent:%lld\r\n"
+            "cluster_stats_messages_light_sent:%lld\r\n",
+            tot_msg_sent, tot_bytes_sent,
+            server.cluster->stats_bus_light_sent);
 
         for (int i = 0; i < CLUSTERMSG_TYPE_COUNT; i++) {
             if (server.cluster->stats_bus_messages_received[i] == 0) continue;
             tot_msg_received += server.cluster->stats_bus_messages_received[i];
+            tot_bytes_received += server.cluster->stats_bus_bytes_received[i];
             info = sdscatprintf(info,
-                "cluster_stats_messages_%s_received:%lld\r\n",
+                "cluster_stats_messages_%s_received:%lld\r\n"
+                "cluster_stats_bytes_%s_received:%lld\r\n",
                 clusterGetMessageTypeString(i),
-                server.cluster->stats_bus_messages_received[i]);
+                server.cluster->stats_bus_messages_received[i],
+                clusterGetMessageTypeString(i),
+                server.cluster->stats_bus_bytes_received[i]);
         }
         info = sdscatprintf(info,
-            "cluster_stats_messages_received:%lld\r\n", tot_msg_received);
+            "cluster_stats_messages_received:%lld\r\n"
+            "cluster_stats_bytes_received:%lld\r\n"
+            "cluster_stats_messages_light_received:%lld\r\n",
+            tot_msg_received, tot_bytes_received,
+            server.cluster->stats_bus_light_received);
 
         /* Produce the reply protocol. */
         addReplyVerbatim(c,info,sdslen(info),"txt");
@@ -4861,14 +5336,29 @@ NULL
 /* Generates a DUMP-format representation of the object 'o', adding it to the
  * io stream pointed by 'rio'. This function can't fail. */
 void createDumpPayload(rio *payload, robj *o, robj *key) {
-    unsigned char buf[2];
-    uint64_t crc;
-
     /* Serialize the object in a RDB-like format. It consist of an object type
      * byte followed by the serialized object. This is understood by RESTORE. */
     rioInitWithBuffer(payload,sdsempty());
     serverAssert(rdbSaveObjectType(payload,o));
     serverAssert(rdbSaveObject(payload,o,key));
+    addDumpPayloadFooter(payload);
+}
+
+/* Append an object with its TTL in milliseconds (0 if the key is persistent)
+ * to a RESTORE-BATCH payload, that must be initialized with
+ * rioInitWithBuffer() by the caller, and terminated calling
+ * addDumpPayloadFooter() once all the keys were added. */
+void addDumpBatchPayloadEntry(rio *payload, robj *o, robj *key, long long ttl) {
+    serverAssert(rdbSaveMillisecondTime(payload,ttl));
+    serverAssert(rdbSaveObjectType(payload,o));
+    serverAssert(rdbSaveObject(payload,o,key));
+}
+
+/* Terminate a DUMP or RESTORE-BATCH payload appending the RDB version and
+ * the checksum of the whole payload. */
+void addDumpPayloadFooter(rio *payload) {
+    unsigned char buf[2];
+    uint64_t crc;
 
     /* Write the footer, this is how it looks like:
      * ----------------+---------------------+---------------+
@@ -5019,6 +5509,102 @@ void restoreCommand(client *c) {
     server.dirty++;
 }
 
+/* RESTORE-BATCH numkeys key [key ...] payload [REPLACE] [ABSTTL]
+ *
+ * Restore many keys with a single command, used by MIGRATE with multiple
+ * keys. The payload is made of the TTL, the type and the serialized value of
+ * every key, in the same order of the key arguments, followed by a single
+ * footer with RDB version and CRC64 as in the DUMP format.
+ *
+ * The reply is an array with the reply RESTORE would give for every key:
+ * keys already existing (and REPLACE not given) get a BUSYKEY error while
+ * the others are restored. If the payload is not valid no key is restored
+ * and a single error is returned instead. */
+void restoreBatchCommand(client *c) {
+    long long numkeys, *ttls;
+    int j, type, replace = 0, absttl = 0, payload_idx;
+    robj **objs, **keys;
+    sds p;
+    rio payload;
+
+    if (getLongLongFromObjectOrReply(c,c->argv[1],&numkeys,NULL) != C_OK)
+        return;
+    if (numkeys <= 0 || numkeys > c->argc-3) {
+        addReplyError(c,"Number of keys can't be greater than number of args");
+        return;
+    }
+    keys = c->argv+2;
+    payload_idx = 2+numkeys;
+
+    /* Parse additional options */
+    for (j = payload_idx+1; j < c->argc; j++) {
+        if (!strcasecmp(c->argv[j]->ptr,"replace")) {
+            replace = 1;
+        } else if (!strcasecmp(c->argv[j]->ptr,"absttl")) {
+            absttl = 1;
+        } else {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+    }
+
+    /* Verify RDB version and data checksum of the whole payload. */
+    p = c->argv[payload_idx]->ptr;
+    if (verifyDumpPayload((unsigned char*)p,sdslen(p)) == C_ERR) {
+        addReplyError(c,"DUMP payload version or checksum are wrong");
+        return;
+    }
+
+    /* Load all the objects before touching the dataset. */
+    objs = zmalloc(sizeof(robj*)*numkeys);
+    ttls = zmalloc(sizeof(long long)*numkeys);
+    rioInitWithBuffer(&payload,p);
+    for (j = 0; j < numkeys; j++) {
+        ttls[j] = rdbLoadMillisecondTime(&payload,RDB_VERSION);
+        if (rioGetReadError(&payload) || ttls[j] < 0 ||
+            (type = rdbLoadObjectType(&payload)) == -1 ||
+            (objs[j] = rdbLoadObject(type,&payload,keys[j]->ptr)) == NULL)
+        {
+            break;
+        }
+    }
+    /* Only the footer must be left after the last object. */
+    if (j != numkeys || (size_t)payload.io.buffer.pos != sdslen(p)-10) {
+        while(j--) decrRefCount(objs[j]);
+        zfree(objs);
+        zfree(ttls);
+        addReplyError(c,"Bad data format");
+        return;
+    }
+
+    /* Every key gets its own reply, exactly like if a RESTORE command
+     * was sent for each key, so that the caller knows what was stored. */
+    addReplyArrayLen(c,numkeys);
+    for (j = 0; j < numkeys; j++) {
+        /* Make sure this key does not already exist here... */
+        if (replace) {
+            dbDelete(c->db,keys[j]);
+        } else if (lookupKeyWrite(c->db,keys[j]) != NULL) {
+            decrRefCount(objs[j]);
+            addReply(c,shared.busykeyerr);
+            continue;
+        }
+
+        /* Create the key and set the TTL if any */
+        dbAdd(c->db,keys[j],objs[j]);
+        if (ttls[j]) {
+            long long ttl = absttl ? ttls[j] : ttls[j]+mstime();
+            setExpire(c,c->db,keys[j],ttl);
+        }
+        signalModifiedKey(c,c->db,keys[j]);
+        notifyKeyspaceEvent(NOTIFY_GENERIC,"restore",keys[j],c->db->id);
+        server.dirty++;
+        addReply(c,shared.ok);
+    }
+    zfree(objs);
+    zfree(ttls);
+}
+
 /* MIGRATE socket cache implementation.
  *
  * We take a map between host:ip and a TCP socket that we used to connect
@@ -5032,6 +5618,7 @@ typedef struct migrateCachedSocket {
     connection *conn;
     long last_dbid;
     time_t last_use_time;
+    int no_batch;       /* Target does not understand RESTORE-BATCH. */
 } migrateCachedSocket;
 
 /* Return a migrateCachedSocket containing a TCP socket connected with the
@@ -5089,6 +5676,7 @@ migrateCachedSocket* migrateGetSocket(client *c, robj *host, robj *port, long ti
 
     cs->last_dbid = -1;
     cs->last_use_time = server.unixtime;
+    cs->no_batch = 0;
     dictAdd(server.migrate_cached_sockets,name,cs);
     return cs;
 }
@@ -5150,6 +5738,8 @@ void migrateCommand(client *c) {
     int may_retry = 1;
     int write_error = 0;
     int argv_rewritten = 0;
+    int batch; /* Send a single RESTORE-BATCH instead of one RESTORE per key. */
+    int replies; /* Number of per key replies to read from the target. */
 
     /* To support the KEYS option we need the following additional state. */
     int first_key = 3; /* Argument index of the first key. */
@@ -5260,6 +5850,19 @@ try_again:
                             so certain keys that were found non expired by the
                             lookupKey() function, may be expired later. */
 
+    /* With multiple keys all the values are serialized in a single payload
+     * with a single checksum, restored by the target with one command
+     * execution. Fall back to one RESTORE per key if the
+     * target does not know RESTORE-BATCH, or in cluster mode if the keys
+     * are not all in the same slot, since the target would refuse it. */
+    batch = num_keys > 1 && !cs->no_batch;
+    if (batch && server.cluster_enabled) {
+        unsigned int slot = keyHashSlot(kv[0]->ptr,sdslen(kv[0]->ptr));
+        for (j = 1; j < num_keys && batch; j++)
+            batch = keyHashSlot(kv[j]->ptr,sdslen(kv[j]->ptr)) == slot;
+    }
+    if (batch) rioInitWithBuffer(&payload,sdsempty());
+
     /* Create RESTORE payload and generate the protocol to call the command. */
     for (j = 0; j < num_keys; j++) {
         long long ttl = 0;
@@ -5276,8 +5879,14 @@ try_again:
         /* Relocate valid (non expired) keys into the array in successive
          * positions to remove holes created by the keys that were present
          * in the first lookup but are now expired after the second lookup. */
+        ov[non_expired] = ov[j];
         kv[non_expired++] = kv[j];
 
+        if (batch) {
+            addDumpBatchPayloadEntry(&payload,ov[j],kv[j],ttl);
+            continue;
+        }
+
         serverAssertWithInfo(c,NULL,
             rioWriteBulkCount(&cmd,'*',replace ? 5 : 4));
 
@@ -5308,6 +5917,33 @@ try_again:
     /* Fix the actual number of keys we are migrating. */
     num_keys = non_expired;
 
+    /* Emit the RESTORE-BATCH numkeys key ... key payload [REPLACE] command. */
+    if (batch && num_keys == 0) {
+        sdsfree(payload.io.buffer.ptr); /* All the keys expired meanwhile. */
+    } else if (batch) {
+        addDumpPayloadFooter(&payload);
+        serverAssertWithInfo(c,NULL,
+            rioWriteBulkCount(&cmd,'*',3+num_keys+replace));
+        if (server.cluster_enabled)
+            serverAssertWithInfo(c,NULL,
+                rioWriteBulkString(&cmd,"RESTORE-BATCH-ASKING",20));
+        else
+            serverAssertWithInfo(c,NULL,
+                rioWriteBulkString(&cmd,"RESTORE-BATCH",13));
+        serverAssertWithInfo(c,NULL,rioWriteBulkLongLong(&cmd,num_keys));
+        for (j = 0; j < num_keys; j++) {
+            serverAssertWithInfo(c,NULL,sdsEncodedObject(kv[j]));
+            serverAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,kv[j]->ptr,
+                    sdslen(kv[j]->ptr)));
+        }
+        serverAssertWithInfo(c,NULL,
+            rioWriteBulkString(&cmd,payload.io.buffer.ptr,
+                               sdslen(payload.io.buffer.ptr)));
+        sdsfree(payload.io.buffer.ptr);
+        if (replace)
+            serverAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,"REPLACE",7));
+    }
+
     /* Transfer the query to the other node in 64K chunks. */
     errno = 0;
     {
@@ -5349,7 +5985,41 @@ try_again:
      * command name itself. */
     if (!copy) newargv = zmalloc(sizeof(robj*)*(num_keys+1));
 
-    for (j = 0; j < num_keys; j++) {
+    /* RESTORE-BATCH replies with an array with the result of every key,
+     * so after the array header the replies are read exactly like the
+     * ones of multiple RESTORE commands. An error instead of the array
+     * means that no key was restored. */
+    replies = num_keys;
+    if (batch && num_keys) {
+        j = 0; /* Nothing was processed if we fail to read the header. */
+        replies = 0;
+        if (connSyncReadLine(cs->conn, buf2, sizeof(buf2), timeout) <= 0) {
+            socket_error = 1;
+        } else if (buf2[0] == '-') {
+            if (!(password && buf0[0] == '-') &&
+                !(select && buf1[0] == '-') &&
+                !strncmp(buf2,"-ERR unknown command",20))
+            {
+                /* Older target: nothing was restored, so we can safely
+                 * send the keys again, one RESTORE per key. */
+                cs->no_batch = 1;
+                cs->last_dbid = -1;
+                sdsfree(cmd.io.buffer.ptr);
+                zfree(newargv);
+                newargv = NULL;
+                goto try_again;
+            }
+            cs->last_dbid = -1;
+            error_from_target = 1;
+            addReplyErrorFormat(c,"Target instance replied with error: %s",
+                (password && buf0[0] == '-') ? buf0+1 :
+                (select && buf1[0] == '-') ? buf1+1 : buf2+1);
+        } else {
+            replies = num_keys;
+        }
+    }
+
+    for (j = 0; j < replies; j++) {
         if (connSyncReadLine(cs->conn, buf2, sizeof(buf2), timeout) <= 0) {
             socket_error = 1;
             break;
@@ -5473,6 +6143,845 @@ socket_err:
     return;
 }
 
+/* -----------------------------------------------------------------------------
+ * CLUSTER MIGRATESLOT: server side migration of a whole slot
+ *
+ * Instead of moving the keys a batch at a time with blocking MIGRATE calls,
+ * the slot is walked incrementally and every key is streamed to the target
+ * as a pipelined RESTORE-ASKING command over a non blocking connection, so
+ * that this node keeps serving clients in the meantime. The keys are not
+ * removed while they are streamed, and the slot keeps being served here:
+ * keys of the slot that are modified or deleted after the migration
+ * started are remembered and sent again (or deleted on the target).
+ *
+ * Once the whole slot was transferred and only a few changed keys are left,
+ * the handover happens synchronously, so no client can run in the middle:
+ * the remaining keys are sent and the target takes the slot with CLUSTER
+ * SETSLOT NODE. The local copies of the keys are deleted later, a batch at
+ * a time, so that the pause does not depend on the size of the slot.
+ * -------------------------------------------------------------------------- */
+
+static void clusterSlotMigrationWriteHandler(connection *conn);
+
+static void clusterSlotMigrationFree(clusterSlotMigration *sm) {
+    if (sm->conn) connClose(sm->conn);
+    sdsfree(sm->buf);
+    dictRelease(sm->changed);
+    zfree(sm);
+}
+
+/* Delete the keys of 'slot' a batch at a time, propagating the deletions to
+ * our replicas and AOF, until 'deadline' (unix time in microseconds, or zero
+ * to delete all the keys) is reached. Large values are released by the
+ * lazyfree thread. Returns 1 if no key is left in the slot. */
+static int clusterSlotDeleteKeys(int slot, long long deadline) {
+    robj *keys[CLUSTER_SLOT_MIGRATION_BATCH];
+    unsigned int j, numkeys;
+
+    /* Collect the names first: deleting the last key releases the dict. */
+    while ((numkeys = getKeysInSlot(slot,keys,CLUSTER_SLOT_MIGRATION_BATCH))) {
+        for (j = 0; j < numkeys; j++) {
+            robj *argv[2] = {shared.del, keys[j]};
+
+            dbAsyncDelete(server.db,keys[j]);
+            propagate(server.delCommand,0,argv,2,
+                      PROPAGATE_AOF|PROPAGATE_REPL);
+            signalModifiedKey(NULL,server.db,keys[j]);
+            notifyKeyspaceEvent(NOTIFY_GENERIC,"del",keys[j],0);
+            server.dirty++;
+            decrRefCount(keys[j]);
+        }
+        if (deadline && ustime() > deadline) break;
+    }
+    return countKeysInSlot(slot) == 0;
+}
+
+/* Set the state of the keys of a slot this node no longer serves. They are
+ * not deleted while clients are paused for the handover, but later by
+ * clusterSlotReleaseCron(). Until then clients are redirected to the new
+ * owner, and only commands not routed by slot, like KEYS or SCAN, can see
+ * them. */
+static void clusterSlotRelease(int slot, int state) {
+    unsigned char *old = &server.cluster->slots_to_release[slot];
+
+    if (*old == CLUSTER_SLOT_KEEP && state != CLUSTER_SLOT_KEEP)
+        server.cluster->slots_to_release_count++;
+    else if (*old != CLUSTER_SLOT_KEEP && state == CLUSTER_SLOT_KEEP)
+        server.cluster->slots_to_release_count--;
+    *old = state;
+}
+
+/* Called when this node serves or imports 'slot' again: the keys left by a
+ * previous migration are stale, so they are deleted right away. The keys of
+ * a handover whose outcome is unknown are kept instead if this node serves
+ * the slot again: the target may never have taken it. */
+void clusterSlotReleaseNow(int slot, int importing) {
+    int state = server.cluster->slots_to_release[slot];
+
+    if (state == CLUSTER_SLOT_KEEP) return;
+    if (importing || state == CLUSTER_SLOT_RELEASE)
+        clusterSlotDeleteKeys(slot,0);
+    clusterSlotRelease(slot,CLUSTER_SLOT_KEEP);
+}
+
+/* Called by clusterCron(): delete the keys of the released slots, spending
+ * at most CLUSTER_SLOT_RELEASE_TIME_LIMIT milliseconds. Replicas just forget
+ * the slots, since their master propagates the deletions. Slots in
+ * CLUSTER_SLOT_RELEASE_CLAIMED state wait until the last full header of
+ * their owner lists them. */
+void clusterSlotReleaseCron(void) {
+    long long deadline = ustime()+CLUSTER_SLOT_RELEASE_TIME_LIMIT*1000;
+    int j;
+
+    for (j = 0; j < CLUSTER_SLOTS &&
+                server.cluster->slots_to_release_count; j++)
+    {
+        clusterNode *owner = server.cluster->slots[j];
+
+        if (server.cluster->slots_to_release[j] == CLUSTER_SLOT_KEEP)
+            continue;
+        if (server.cluster->slots_to_release[j] ==
+            CLUSTER_SLOT_RELEASE_CLAIMED && !nodeIsSlave(myself) &&
+            (owner == NULL || owner->recv_slots == NULL ||
+             !bitmapTestBit(owner->recv_slots,j))) continue;
+        if (!nodeIsSlave(myself) && !clusterSlotDeleteKeys(j,deadline))
+            break;
+        clusterSlotRelease(j,CLUSTER_SLOT_KEEP);
+    }
+}
+
+/* Append "CLUSTER SETSLOT <slot> <subcommand> [<node-id>]" to 'r'. */
+static void clusterSlotMigrationAppendSetSlot(rio *r, int slot,
+                                              char *subcommand, char *node)
+{
+    serverAssert(rioWriteBulkCount(r,'*',node ? 5 : 4));
+    serverAssert(rioWriteBulkString(r,"CLUSTER",7));
+    serverAssert(rioWriteBulkString(r,"SETSLOT",7));
+    serverAssert(rioWriteBulkLongLong(r,slot));
+    serverAssert(rioWriteBulkString(r,subcommand,strlen(subcommand)));
+    if (node) serverAssert(rioWriteBulkString(r,node,CLUSTER_NAMELEN));
+}
+
+/* Write 'buf' to the target and read '*replies' reply lines, blocking for
+ * at most the node timeout for every operation. On error C_ERR is returned
+ * and 'err' is set to the reason. If the target replied with an error,
+ * '*replies' is left to the number of replies still to read, otherwise, on
+ * I/O errors and timeouts, it is set to -1: the stream is no longer usable. */
+static int clusterSlotMigrationSyncCall(connection *conn, sds buf,
+                                        long long *replies, char *err,
+                                        size_t errlen)
+{
+    size_t pos = 0, towrite;
+    char line[1024];
+
+    snprintf(err,errlen,"error or timeout talking with the target");
+    while ((towrite = sdslen(buf)-pos) > 0) {
+        towrite = (towrite > (64*1024) ? (64*1024) : towrite);
+        if (connSyncWrite(conn,buf+pos,towrite,server.cluster_node_timeout)
+            != (ssize_t)towrite)
+        {
+            *replies = -1;
+            return C_ERR;
+        }
+        pos += towrite;
+    }
+    while (*replies > 0) {
+        if (connSyncReadLine(conn,line,sizeof(line),
+                             server.cluster_node_timeout) <= 0)
+        {
+            *replies = -1;
+            return C_ERR;
+        }
+        (*replies)--;
+        if (line[0] == '-') {
+            snprintf(err,errlen,"target replied with error: %.200s",line+1);
+            return C_ERR;
+        }
+    }
+    err[0] = '\0';
+    return C_OK;
+}
+
+/* Stop the migration in progress, if any. The slot stays served by this
+ * node, and the target is asked to stop importing it and to delete the keys
+ * copied so far with CLUSTER MIGRATESLOT <slot> CANCEL. If the link with the
+ * target is broken the keys are left there, like it happens when a
+ * resharding performed with MIGRATE is interrupted. */
+void clusterSlotMigrationAbort(const char *reason) {
+    clusterSlotMigration *sm;
+
+    if (!server.cluster_enabled) return;
+    if ((sm = server.cluster->slot_migration) == NULL) return;
+    server.cluster->slot_migration = NULL;
+    serverLog(LL_WARNING,"Migration of slot %d to %.40s aborted: %s",
+        sm->slot, sm->target, reason);
+
+    /* Complete the command we are in the middle of writing, if any, and
+     * cancel the import on the target. */
+    if (sm->conn && connGetState(sm->conn) == CONN_STATE_CONNECTED) {
+        long long replies = sm->pending+1, noreplies = 0;
+        char err[256];
+        rio r;
+
+        connSetReadHandler(sm->conn,NULL);
+        connSetWriteHandler(sm->conn,NULL);
+        rioInitWithBuffer(&r,sdsnewlen(sm->buf+sm->bufpos,
+                                       sdslen(sm->buf)-sm->bufpos));
+        serverAssert(rioWriteBulkCount(&r,'*',4));
+        serverAssert(rioWriteBulkString(&r,"CLUSTER",7));
+        serverAssert(rioWriteBulkString(&r,"MIGRATESLOT",11));
+        serverAssert(rioWriteBulkLongLong(&r,sm->slot));
+        serverAssert(rioWriteBulkString(&r,"CANCEL",6));
+        if (clusterSlotMigrationSyncCall(sm->conn,r.io.buffer.ptr,&noreplies,
+                                         err,sizeof(err)) == C_OK)
+        {
+            /* Read every reply, errors included: closing the connection
+             * with unread data would reset it, and the target could drop
+             * the commands it did not process yet. */
+            while (replies-- &&
+                   connSyncReadLine(sm->conn,err,sizeof(err),
+                                    server.cluster_node_timeout) > 0);
+        }
+        sdsfree(r.io.buffer.ptr);
+    }
+    server.cluster->stats_slot_migrations_aborted++;
+    clusterSlotMigrationFree(sm);
+}
+
+/* Install the write handler if there is something to send. */
+static void clusterSlotMigrationWantWrite(clusterSlotMigration *sm) {
+    if (sm->writing) return;
+    if (connSetWriteHandler(sm->conn,clusterSlotMigrationWriteHandler)
+        == C_ERR)
+    {
+        clusterSlotMigrationAbort("can't install the write handler");
+        return;
+    }
+    sm->writing = 1;
+}
+
+/* Called every time a key is modified or deleted: if the key belongs to the
+ * slot being migrated, it will have to be sent again. */
+void clusterSlotMigrationKeyChanged(sds key) {
+    clusterSlotMigration *sm = server.cluster->slot_migration;
+
+    if (sm == NULL || (int)keyHashSlot(key,sdslen(key)) != sm->slot) return;
+    if (dictFind(sm->changed,key) == NULL)
+        dictAdd(sm->changed,sdsdup(key),NULL);
+    clusterSlotMigrationWantWrite(sm);
+}
+
+/* Append to 'r' the commands that reproduce the current state of 'key' on
+ * the target: RESTORE-ASKING if the key exists, ASKING + DEL otherwise.
+ * Return the number of replies the target will send. */
+static int clusterSlotMigrationFeedKey(clusterSlotMigration *sm, rio *r,
+                                       robj *key)
+{
+    redisDb *db = server.db;
+    robj *o = lookupKeyReadWithFlags(db,key,LOOKUP_NOTOUCH);
+
+    /* Whatever happened to the key so far is now going to the target. */
+    dictDelete(sm->changed,key->ptr);
+    sm->keys++;
+
+    if (o == NULL) {
+        serverAssert(rioWriteBulkCount(r,'*',1));
+        serverAssert(rioWriteBulkString(r,"ASKING",6));
+        serverAssert(rioWriteBulkCount(r,'*',2));
+        serverAssert(rioWriteBulkString(r,"DEL",3));
+        serverAssert(rioWriteBulkString(r,key->ptr,sdslen(key->ptr)));
+        return 2;
+    } else {
+        rio payload;
+        long long expireat = getExpire(db,key);
+
+        serverAssert(rioWriteBulkCount(r,'*',6));
+        serverAssert(rioWriteBulkString(r,"RESTORE-ASKING",14));
+        serverAssert(rioWriteBulkString(r,key->ptr,sdslen(key->ptr)));
+        serverAssert(rioWriteBulkLongLong(r,expireat == -1 ? 0 : expireat));
+        createDumpPayload(&payload,o,key);
+        serverAssert(rioWriteBulkString(r,payload.io.buffer.ptr,
+                                        sdslen(payload.io.buffer.ptr)));
+        sdsfree(payload.io.buffer.ptr);
+        serverAssert(rioWriteBulkString(r,"REPLACE",7));
+        serverAssert(rioWriteBulkString(r,"ABSTTL",6));
+        return 1;
+    }
+}
+
+/* Fill the output buffer with the next batch of keys: changed keys first,
+ * then the next keys of the slot iteration. */
+static void clusterSlotMigrationFill(clusterSlotMigration *sm) {
+    unsigned int count = 0;
+    rio r;
+
+    rioInitWithBuffer(&r,sm->buf);
+    while (dictSize(sm->changed) && count < CLUSTER_SLOT_MIGRATION_BATCH) {
+        dictEntry *de = dictGetRandomKey(sm->changed);
+        sds name = dictGetKey(de);
+        robj *key = createStringObject(name,sdslen(name));
+
+        sm->pending += clusterSlotMigrationFeedKey(sm,&r,key);
+        decrRefCount(key);
+        count++;
+    }
+    if (!sm->iteration_done && count < CLUSTER_SLOT_MIGRATION_BATCH) {
+        list *keys = listCreate();
+        listNode *ln;
+
+        /* Collect the names first: looking up the keys may expire them,
+         * modifying the dict we are scanning. */
+        sm->cursor = scanKeysInSlot(sm->slot,sm->cursor,keys,
+                                    CLUSTER_SLOT_MIGRATION_BATCH-count);
+        if (sm->cursor == 0) sm->iteration_done = 1;
+        while ((ln = listFirst(keys)) != NULL) {
+            robj *key = listNodeValue(ln);
+
+            sm->pending += clusterSlotMigrationFeedKey(sm,&r,key);
+            decrRefCount(key);
+            listDelNode(keys,ln);
+        }
+        listRelease(keys);
+    }
+    sm->buf = r.io.buffer.ptr;
+}
+
+/* Send 'sm->buf' to the target during the handover and wait for the
+ * 'replies' expected. On error C_ERR is returned and 'err' is set to the
+ * reason. If the link failed, the connection is closed and 'sm->conn' set
+ * to NULL: the target may have executed the commands or not. */
+static int clusterSlotMigrationHandoverCall(clusterSlotMigration *sm,
+                                            long long replies, char *err,
+                                            size_t errlen)
+{
+    sm->bufpos = sdslen(sm->buf);
+    sm->bytes += sdslen(sm->buf);
+    sm->pending = replies;
+    if (clusterSlotMigrationSyncCall(sm->conn,sm->buf,&sm->pending,err,
+                                     errlen) == C_OK) return C_OK;
+    if (sm->pending == -1) {
+        /* The stream may be broken: send nothing else. */
+        connClose(sm->conn);
+        sm->conn = NULL;
+    }
+    return C_ERR;
+}
+
+/* Complete the migration once the whole slot was sent, the target
+ * acknowledged everything, and only a few changed keys are left. This runs
+ * synchronously: the time spent here is the pause clients experience.
+ *
+ * The ownership change is the last step: the target is asked to take the
+ * slot only once it acknowledged every key. If it refuses, the migration is
+ * aborted and the slot stays here. If the link fails instead, we can't tell
+ * if the target took the slot: since it holds every key, and no client ran
+ * in the meantime, the slot is handed over anyway, so that the two nodes
+ * never serve it at the same time. The local keys are then only released
+ * once the target claims the slot, and are left here otherwise. */
+static void clusterSlotMigrationHandoverIfReady(clusterSlotMigration *sm) {
+    clusterNode *target;
+    long long start, replies = 0;
+    int release = CLUSTER_SLOT_RELEASE;
+    char err[256];
+    rio r;
+
+    if (!sm->iteration_done || sm->pending || sm->bufpos != sdslen(sm->buf) ||
+        dictSize(sm->changed) > CLUSTER_SLOT_MIGRATION_HANDOVER_KEYS) return;
+    if (server.cluster->slots[sm->slot] != myself) {
+        clusterSlotMigrationAbort("the slot is no longer served by this node");
+        return;
+    }
+    if ((target = clusterLookupNode(sm->target)) == NULL) {
+        clusterSlotMigrationAbort("the target node was removed");
+        return;
+    }
+
+    start = ustime();
+    connSetReadHandler(sm->conn,NULL);
+    connSetWriteHandler(sm->conn,NULL);
+    sm->writing = 0;
+
+    /* Send the last changed keys. */
+    sdsclear(sm->buf);
+    rioInitWithBuffer(&r,sm->buf);
+    while (dictSize(sm->changed)) {
+        sds name = dictGetKey(dictGetRandomKey(sm->changed));
+        robj *key = createStringObject(name,sdslen(name));
+
+        replies += clusterSlotMigrationFeedKey(sm,&r,key);
+        decrRefCount(key);
+    }
+    sm->buf = r.io.buffer.ptr;
+    if (replies && clusterSlotMigrationHandoverCall(sm,replies,err,
+                                                    sizeof(err)) == C_ERR)
+    {
+        clusterSlotMigrationAbort(err);
+        return;
+    }
+
+    /* Then hand over the slot. */
+    sdsclear(sm->buf);
+    rioInitWithBuffer(&r,sm->buf);
+    clusterSlotMigrationAppendSetSlot(&r,sm->slot,"NODE",
+        server.cluster_handover_debug == SLOT_MIGRATION_HANDOVER_REFUSE ?
+        "0000000000000000000000000000000000000000" : sm->target);
+    sm->buf = r.io.buffer.ptr;
+    if (clusterSlotMigrationHandoverCall(sm,1,err,sizeof(err)) == C_ERR &&
+        sm->conn)
+    {
+        clusterSlotMigrationAbort(err);
+        return;
+    }
+    if (server.cluster_handover_debug == SLOT_MIGRATION_HANDOVER_LOSE_REPLY &&
+        sm->conn)
+    {
+        connClose(sm->conn);
+        sm->conn = NULL;
+    }
+    if (sm->conn == NULL) {
+        serverLog(LL_WARNING,"Lost the reply of %.40s to the handover of "
+            "slot %d: the slot is given to it, and the keys are kept until "
+            "it claims the slot", sm->target, sm->slot);
+        release = CLUSTER_SLOT_RELEASE_CLAIMED;
+    }
+
+    /* The target owns the slot now: update our view, the keys are deleted
+     * by clusterSlotReleaseCron(). */
+    server.cluster->slot_migration = NULL;
+    clusterDelSlot(sm->slot);
+    clusterAddSlot(target,sm->slot);
+    clusterSlotRelease(sm->slot,release);
+    clusterDoBeforeSleep(CLUSTER_TODO_SAVE_CONFIG|CLUSTER_TODO_UPDATE_STATE|
+                         CLUSTER_TODO_FSYNC_CONFIG);
+
+    server.cluster->stats_slot_migrations_completed++;
+    server.cluster->stats_slot_migration_last_keys = sm->keys;
+    server.cluster->stats_slot_migration_last_bytes = sm->bytes;
+    server.cluster->stats_slot_migration_last_duration =
+        mstime()-sm->start_time;
+    server.cluster->stats_slot_migration_last_pause = ustime()-start;
+    serverLog(LL_NOTICE,"Slot %d migrated to %.40s: %lld keys, %lld bytes "
+        "in %lld ms, handover pause %lld us",
+        sm->slot, sm->target, sm->keys, sm->bytes,
+        server.cluster->stats_slot_migration_last_duration,
+        server.cluster->stats_slot_migration_last_pause);
+    clusterSlotMigrationFree(sm);
+}
+
+static void clusterSlotMigrationWriteHandler(connection *conn) {
+    clusterSlotMigration *sm = server.cluster->slot_migration;
+    ssize_t nwritten;
+
+    if (sm->bufpos == sdslen(sm->buf)) {
+        sdsclear(sm->buf);
+        sm->bufpos = 0;
+        clusterSlotMigrationFill(sm);
+        if (sdslen(sm->buf) == 0) {
+            /* Nothing left to send for now: wait for the replies or for
+             * more changed keys. */
+            connSetWriteHandler(conn,NULL);
+            sm->writing = 0;
+            clusterSlotMigrationHandoverIfReady(sm);
+            return;
+        }
+    }
+
+    nwritten = connWrite(conn,sm->buf+sm->bufpos,sdslen(sm->buf)-sm->bufpos);
+    if (nwritten <= 0) {
+        if (nwritten == -1 && connGetState(conn) == CONN_STATE_CONNECTED)
+            return;
+        clusterSlotMigrationAbort("error writing to the target");
+        return;
+    }
+    sm->bufpos += nwritten;
+    sm->bytes += nwritten;
+    sm->last_io_time = mstime();
+}
+
+static void clusterSlotMigrationReadHandler(connection *conn) {
+    clusterSlotMigration *sm = server.cluster->slot_migration;
+    char buf[PROTO_IOBUF_LEN];
+    ssize_t nread, j;
+
+    nread = connRead(conn,buf,sizeof(buf));
+    if (nread <= 0) {
+        if (nread == -1 && connGetState(conn) == CONN_STATE_CONNECTED)
+            return;
+        clusterSlotMigrationAbort(nread == 0 ?
+            "connection closed by the target" :
+            "error reading from the target");
+        return;
+    }
+    sm->last_io_time = mstime();
+
+    /* Every reply we expect is a single line: just count them, checking
+     * that none is an error. */
+    for (j = 0; j < nread; j++) {
+        if (sm->reply_start && buf[j] == '-') {
+            char *eol = memchr(buf+j,'\r',nread-j);
+            sds err = sdscatfmt(sdsempty(),"target replied with error: ");
+
+            err = sdscatlen(err,buf+j+1,(eol ? eol : buf+nread)-(buf+j+1));
+            /* The replies already read must not be waited for again by
+             * clusterSlotMigrationAbort(). */
+            for (; j < nread; j++) if (buf[j] == '\n') sm->pending--;
+            clusterSlotMigrationAbort(err);
+            sdsfree(err);
+            return;
+        }
+        sm->reply_start = buf[j] == '\n';
+        if (sm->reply_start) sm->pending--;
+    }
+    clusterSlotMigrationHandoverIfReady(sm);
+}
+
+/* Called by clusterCron(): stop the migration if the slot changed owner or
+ * the target stopped making progress. */
+void clusterSlotMigrationCron(void) {
+    clusterSlotMigration *sm = server.cluster->slot_migration;
+
+    if (sm == NULL) return;
+    if (nodeIsSlave(myself) || server.cluster->slots[sm->slot] != myself) {
+        clusterSlotMigrationAbort("the slot is no longer served by this node");
+    } else if (clusterLookupNode(sm->target) == NULL) {
+        clusterSlotMigrationAbort("the target node was removed");
+    } else if ((sm->pending || sm->bufpos != sdslen(sm->buf)) &&
+               mstime()-sm->last_io_time > server.cluster_node_timeout)
+    {
+        /* Don't block trying to cancel the import on a stuck target. */
+        connClose(sm->conn);
+        sm->conn = NULL;
+        clusterSlotMigrationAbort("timeout talking with the target");
+    }
+}
+
+/* CLUSTER MIGRATESLOT <slot> <node-id> | <slot> CANCEL | ABORT */
+void clusterMigrateSlotCommand(client *c) {
+    clusterSlotMigration *sm;
+    clusterNode *n;
+    connection *conn;
+    long long replies;
+    char err[256];
+    int slot;
+    rio r;
+
+    if (c->argc == 3 && !strcasecmp(c->argv[2]->ptr,"abort")) {
+        if (server.cluster->slot_migration == NULL) {
+            addReplyError(c,"No slot migration in progress");
+            return;
+        }
+        clusterSlotMigrationAbort("aborted by CLUSTER MIGRATESLOT ABORT");
+        addReply(c,shared.ok);
+        return;
+    }
+    if (c->argc == 4 && !strcasecmp(c->argv[3]->ptr,"cancel")) {
+        /* Sent to the target by the source of an aborted migration: the
+         * keys imported so far are deleted by clusterSlotReleaseCron(). */
+        if ((slot = getSlotOrReply(c,c->argv[2])) == -1) return;
+        if (server.cluster->slots[slot] == myself) {
+            addReplyErrorFormat(c,"I'm the owner of hash slot %u",slot);
+            return;
+        }
+        server.cluster->importing_slots_from[slot] = NULL;
+        clusterSlotRelease(slot,CLUSTER_SLOT_RELEASE);
+        clusterDoBeforeSleep(CLUSTER_TODO_SAVE_CONFIG);
+        addReply(c,shared.ok);
+        return;
+    }
+    if (c->argc != 4) {
+        addReplySubcommandSyntaxError(c);
+        return;
+    }
+    if (server.cluster->slot_migration) {
+        addReplyError(c,"A slot migration is already in progress");
+        return;
+    }
+    if ((slot = getSlotOrReply(c,c->argv[2])) == -1) return;
+    if (server.cluster->slots[slot] != myself || nodeIsSlave(myself)) {
+        addReplyErrorFormat(c,"I'm not the owner of hash slot %u",slot);
+        return;
+    }
+    if (server.cluster->migrating_slots_to[slot] ||
+        server.cluster->importing_slots_from[slot])
+    {
+        addReplyErrorFormat(c,"Hash slot %d is already being migrated "
+                              "or imported",slot);
+        return;
+    }
+    if ((n = clusterLookupNode(c->argv[3]->ptr)) == NULL) {
+        addReplyErrorFormat(c,"I don't know about node %s",
+            (char*)c->argv[3]->ptr);
+        return;
+    }
+    if (n == myself || !nodeIsMaster(n)) {
+        addReplyError(c,"The target node must be another master");
+        return;
+    }
+
+    /* Connect and put the slot in importing state on the target. */
+    conn = server.tls_cluster ? connCreateTLS() : connCreateSocket();
+    if (connBlockingConnect(conn,n->ip,n->port,server.cluster_node_timeout)
+        != C_OK)
+    {
+        addReplyError(c,"-IOERR error or timeout connecting to the target");
+        connClose(conn);
+        return;
+    }
+    connEnableTcpNoDelay(conn);
+    rioInitWithBuffer(&r,sdsempty());
+    if (server.masterauth) {
+        serverAssert(rioWriteBulkCount(&r,'*',server.masteruser ? 3 : 2));
+        serverAssert(rioWriteBulkString(&r,"AUTH",4));
+        if (server.masteruser)
+            serverAssert(rioWriteBulkString(&r,server.masteruser,
+                                            strlen(server.masteruser)));
+        serverAssert(rioWriteBulkString(&r,server.masterauth,
+                                        strlen(server.masterauth)));
+    }
+    clusterSlotMigrationAppendSetSlot(&r,slot,"IMPORTING",myself->name);
+    replies = server.masterauth ? 2 : 1;
+    if (clusterSlotMigrationSyncCall(conn,r.io.buffer.ptr,&replies,
+                                     err,sizeof(err)) == C_ERR)
+    {
+        addReplyErrorFormat(c,"Can't start the migration: %s",err);
+        sdsfree(r.io.buffer.ptr);
+        connClose(conn);
+        return;
+    }
+    sdsfree(r.io.buffer.ptr);
+
+    sm = zmalloc(sizeof(*sm));
+    sm->slot = slot;
+    memcpy(sm->target,n->name,CLUSTER_NAMELEN);
+    sm->conn = conn;
+    sm->cursor = 0;
+    sm->iteration_done = 0;
+    sm->changed = dictCreate(&setDictType,NULL);
+    sm->buf = sdsempty();
+    sm->bufpos = 0;
+    sm->pending = 0;
+    sm->reply_start = 1;
+    sm->writing = 0;
+    sm->keys = 0;
+    sm->bytes = 0;
+    sm->start_time = sm->last_io_time = mstime();
+    server.cluster->slot_migration = sm;
+
+    connNonBlock(conn);
+    if (connSetReadHandler(conn,clusterSlotMigrationReadHandler) == C_ERR) {
+        clusterSlotMigrationAbort("can't install the read handler");
+        addReplyError(c,"Can't start the migration");
+        return;
+    }
+    clusterSlotMigrationWantWrite(sm);
+    if (server.cluster->slot_migration == NULL) {
+        addReplyError(c,"Can't start the migration");
+        return;
+    }
+    serverLog(LL_NOTICE,"Migrating slot %d to %.40s", slot, n->name);
+    addReply(c,shared.ok);
+}
+
+/* -----------------------------------------------------------------------------
+ * CLUSTER SLOT-STATS: per slot statistics
+ *
+ * Reads, writes and network bytes are accounted by processCommand() for every
+ * command executed with the hash slot computed by getNodeByQuery(), so the
+ * cost on the command path is a few increments. Key counts come from the per
+ * slot keys index, and the memory usage is estimated on demand sampling a few
+ * keys of the slot, exactly like MEMORY USAGE does for a single key.
+ * -------------------------------------------------------------------------- */
+
+#define CLUSTER_SLOT_STATS_MEMORY_SAMPLES 16
+
+enum {
+    SLOT_STAT_KEY_COUNT,
+    SLOT_STAT_MEMORY_BYTES,
+    SLOT_STAT_READS,
+    SLOT_STAT_WRITES,
+    SLOT_STAT_NET_BYTES_IN,
+    SLOT_STAT_NET_BYTES_OUT,
+    SLOT_STAT_COUNT
+};
+
+static const char *slotStatNames[SLOT_STAT_COUNT] = {
+    "key-count", "memory-bytes", "reads", "writes",
+    "network-bytes-in", "network-bytes-out"
+};
+
+/* Account the command just executed by 'c' against 'slot'. */
+void clusterSlotStatsAddCommand(client *c, int slot) {
+    clusterSlotStats *stats = &server.cluster->slot_stats[slot];
+    int j;
+
+    if (c->cmd->flags & CMD_WRITE)
+        stats->writes++;
+    else
+        stats->reads++;
+    for (j = 0; j < c->argc; j++)
+        stats->net_bytes_in += stringObjectLen(c->argv[j]);
+    stats->net_bytes_out += c->cmd_reply_bytes;
+}
+
+/* Reset the statistics of a single slot, or of all the slots if 'slot'
+ * is -1. */
+void clusterSlotStatsReset(int slot) {
+    if (slot == -1)
+        memset(server.cluster->slot_stats,0,
+               sizeof(server.cluster->slot_stats));
+    else
+        memset(&server.cluster->slot_stats[slot],0,sizeof(clusterSlotStats));
+}
+
+/* Return the approximated memory used by the keys of 'slot': the memory of
+ * a few sampled keys is scaled to the number of keys in the slot. */
+static long long clusterSlotMemoryUsage(int slot) {
+    dict *d = server.cluster->slots_keys[slot];
+    dictEntry *samples[CLUSTER_SLOT_STATS_MEMORY_SAMPLES];
+    unsigned long count, j;
+    long long usage = 0;
+
+    if (d == NULL) return 0;
+    count = dictGetSomeKeys(d,samples,CLUSTER_SLOT_STATS_MEMORY_SAMPLES);
+    if (count == 0) return 0;
+    for (j = 0; j < count; j++) {
+        sds key = dictGetKey(samples[j]);
+        dictEntry *de = dictFind(server.db[0].dict,key);
+
+        if (de == NULL) continue;
+        usage += objectComputeSize(dictGetVal(de),5);
+        usage += sdsAllocSize(key);
+        usage += sizeof(dictEntry);
+    }
+    return usage * dictSize(d) / count;
+}
+
+static long long clusterSlotStatValue(int slot, int stat) {
+    clusterSlotStats *stats = &server.cluster->slot_stats[slot];
+
+    switch(stat) {
+    case SLOT_STAT_KEY_COUNT: return countKeysInSlot(slot);
+    case SLOT_STAT_MEMORY_BYTES: return clusterSlotMemoryUsage(slot);
+    case SLOT_STAT_READS: return stats->reads;
+    case SLOT_STAT_WRITES: return stats->writes;
+    case SLOT_STAT_NET_BYTES_IN: return stats->net_bytes_in;
+    case SLOT_STAT_NET_BYTES_OUT: return stats->net_bytes_out;
+    }
+    return 0;
+}
+
+/* Return true if the slot is served by this node, or by our master. */
+static int clusterSlotIsServed(int slot) {
+    clusterNode *master = (nodeIsSlave(myself) && myself->slaveof) ?
+                          myself->slaveof : myself;
+    return server.cluster->slots[slot] == master;
+}
+
+static void addReplySlotStats(client *c, int slot) {
+    int j;
+
+    addReplyArrayLen(c,2);
+    addReplyLongLong(c,slot);
+    addReplyMapLen(c,SLOT_STAT_COUNT);
+    for (j = 0; j < SLOT_STAT_COUNT; j++) {
+        addReplyBulkCString(c,slotStatNames[j]);
+        addReplyLongLong(c,clusterSlotStatValue(slot,j));
+    }
+}
+
+typedef struct {
+    int slot;
+    long long value;
+} slotStatEntry;
+
+static int slotStatCompareDesc(const void *a, const void *b) {
+    const slotStatEntry *sa = a, *sb = b;
+    if (sa->value != sb->value) return sa->value < sb->value ? 1 : -1;
+    return sa->slot - sb->slot;
+}
+
+static int slotStatCompareAsc(const void *a, const void *b) {
+    const slotStatEntry *sa = a, *sb = b;
+    if (sa->value != sb->value) return sa->value > sb->value ? 1 : -1;
+    return sa->slot - sb->slot;
+}
+
+/* CLUSTER SLOT-STATS SLOTSRANGE <start> <end>
+ * CLUSTER SLOT-STATS ORDERBY <metric> [LIMIT <count>] [ASC|DESC]
+ *
+ * Only the slots served by this node (or by its master) are reported. */
+void clusterSlotStatsCommand(client *c) {
+    int j;
+
+    if (!strcasecmp(c->argv[2]->ptr,"slotsrange") && c->argc == 5) {
+        int start, end, count = 0;
+        void *replylen;
+
+        if ((start = getSlotOrReply(c,c->argv[3])) == -1 ||
+            (end = getSlotOrReply(c,c->argv[4])) == -1) return;
+        if (start > end) {
+            addReplyErrorFormat(c,"Start slot number %d is greater than "
+                                  "end slot number %d", start, end);
+            return;
+        }
+        replylen = addReplyDeferredLen(c);
+        for (j = start; j <= end; j++) {
+            if (!clusterSlotIsServed(j)) continue;
+            addReplySlotStats(c,j);
+            count++;
+        }
+        setDeferredArrayLen(c,replylen,count);
+    } else if (!strcasecmp(c->argv[2]->ptr,"orderby") && c->argc >= 4) {
+        int stat = -1, desc = 1, count = 0;
+        long limit = 16;
+        slotStatEntry *entries;
+
+        for (j = 0; j < SLOT_STAT_COUNT; j++) {
+            if (!strcasecmp(c->argv[3]->ptr,slotStatNames[j])) stat = j;
+        }
+        if (stat == -1) {
+            addReplyErrorFormat(c,"Unknown slot statistic '%s'",
+                                (char*)c->argv[3]->ptr);
+            return;
+        }
+        for (j = 4; j < c->argc; j++) {
+            int moreargs = j < c->argc-1;
+
+            if (!strcasecmp(c->argv[j]->ptr,"limit") && moreargs) {
+                if (getLongFromObjectOrReply(c,c->argv[++j],&limit,NULL)
+                    != C_OK) return;
+                if (limit < 1 || limit > CLUSTER_SLOTS) {
+                    addReplyError(c,"Limit must be between 1 and 16384");
+                    return;
+                }
+            } else if (!strcasecmp(c->argv[j]->ptr,"asc")) {
+                desc = 0;
+            } else if (!strcasecmp(c->argv[j]->ptr,"desc")) {
+                desc = 1;
+            } else {
+                addReply(c,shared.syntaxerr);
+                return;
+            }
+        }
+
+        entries = zmalloc(sizeof(slotStatEntry)*CLUSTER_SLOTS);
+        for (j = 0; j < CLUSTER_SLOTS; j++) {
+            if (!clusterSlotIsServed(j)) continue;
+            entries[count].slot = j;
+            entries[count].value = clusterSlotStatValue(j,stat);
+            count++;
+        }
+        qsort(entries,count,sizeof(slotStatEntry),
+              desc ? slotStatCompareDesc : slotStatCompareAsc);
+        if (count > limit) count = limit;
+        addReplyArrayLen(c,count);
+        for (j = 0; j < count; j++) addReplySlotStats(c,entries[j].slot);
+        zfree(entries);
+    } else {
+        addReply(c,shared.syntaxerr);
+    }
+}
+
 /* -----------------------------------------------------------------------------
  * Cluster functions related to serving / redirecting clients
  * -------------------------------------------------------------------------- */
@@ -5643,8 +7152,11 @@ clusterNode *getNodeByQuery(client *c, struct redisCommand *cmd, robj **argv, in
                 }
             }
 
-            /* Migarting / Improrting slot? Count keys we don't have. */
+            /* Migarting / Improrting slot? Count keys we don't have.
+             * Shard channels are not keys: they are served by the slot
+             * owner until the slot is handed over. */
             if ((migrating_slot || importing_slot) &&
+                !(mcmd->flags & CMD_PUBSUB) &&
                 lookupKeyRead(&server.db[0],thiskey) == NULL)
             {
                 missing_keys++;
@@ -5703,7 +7215,10 @@ clusterNode *getNodeByQuery(client *c, struct redisCommand *cmd, robj **argv, in
     if (importing_slot &&
         (c->flags & CLIENT_ASKING || cmd->flags & CMD_ASKING))
     {
-        if (multiple_keys && missing_keys) {
+        /* Commands flagged as cluster-asking (RESTORE-ASKING and
+         * RESTORE-BATCH-ASKING) only create keys, so missing keys are
+         * expected. */
+        if (multiple_keys && missing_keys && !(cmd->flags & CMD_ASKING)) {
             if (error_code) *error_code = CLUSTER_REDIR_UNSTABLE;
             return NULL;
         } else {
@@ -20,6 +20,18 @@
 #define CLUSTER_MF_TIMEOUT 5000 /* Milliseconds to do a manual failover. */
 #define CLUSTER_MF_PAUSE_MULT 2 /* Master pause manual failover mult. */
 #define CLUSTER_SLAVE_MIGRATION_DELAY 5000 /* Delay for slave migration. */
+#define CLUSTER_SLOT_MIGRATION_BATCH 128 /* Keys streamed per write event. */
+#define CLUSTER_SLOT_MIGRATION_HANDOVER_KEYS 128 /* Max changed keys to send
+                                                    synchronously at handover. */
+#define CLUSTER_SLOT_RELEASE_TIME_LIMIT 5 /* Milliseconds per cron call spent
+                                             deleting released slots keys. */
+
+/* What to do with the keys of a slot this node no longer serves, see
+ * clusterSlotRelease(). */
+#define CLUSTER_SLOT_KEEP 0     /* Nothing, the slot was not released. */
+#define CLUSTER_SLOT_RELEASE 1  /* Delete the keys from clusterCron(). */
+#define CLUSTER_SLOT_RELEASE_CLAIMED 2 /* Delete them once the new owner
+                                          claims the slot. */
 
 /* Redirection errors returned by getNodeByQuery(). */
 #define CLUSTER_REDIR_NONE 0          /* Node can serve the request. */
@@ -33,6 +45,35 @@
 
 struct clusterNode;
 
+/* State of the CLUSTER MIGRATESLOT operation in progress, if any. */
+typedef struct clusterSlotMigration {
+    int slot;                   /* Slot being migrated. */
+    char target[CLUSTER_NAMELEN]; /* Name of the node receiving the slot. */
+    connection *conn;           /* Non blocking connection with the target. */
+    unsigned long cursor;       /* Slot iteration cursor, see
+                                   scanKeysInSlot(). */
+    int iteration_done;         /* True once every key was streamed once. */
+    dict *changed;              /* Keys of the slot changed or deleted after
+                                   the migration started: sent again. */
+    sds buf;                    /* Commands not yet written to the target. */
+    size_t bufpos;              /* Bytes of 'buf' already written. */
+    long long pending;          /* Replies still expected from the target. */
+    int reply_start;            /* Next byte read starts a new reply. */
+    int writing;                /* True if the write handler is installed. */
+    long long keys;             /* Keys sent so far. */
+    long long bytes;            /* Bytes sent so far. */
+    mstime_t start_time;        /* Migration start time. */
+    mstime_t last_io_time;      /* Last time the target made progress. */
+} clusterSlotMigration;
+
+/* Counters of the commands served for a slot, see CLUSTER SLOT-STATS. */
+typedef struct clusterSlotStats {
+    long long reads;            /* Commands not flagged as write. */
+    long long writes;           /* Write commands. */
+    long long net_bytes_in;     /* Bytes of the arguments of the commands. */
+    long long net_bytes_out;    /* Bytes of the replies. */
+} clusterSlotStats;
+
 /* clusterLink encapsulates everything needed to talk with a remote node. */
 typedef struct clusterLink {
     mstime_t ctime;             /* Link creation time */
@@ -53,6 +94,8 @@ typedef struct clusterLink {
 #define CLUSTER_NODE_MEET 128     /* Send a MEET message to this node */
 #define CLUSTER_NODE_MIGRATE_TO 256 /* Master elegible for replica migration. */
 #define CLUSTER_NODE_NOFAILOVER 512 /* Slave will not try to failver. */
+#define CLUSTER_NODE_LIGHT_HDR 1024 /* Node accepts light PING/PONG headers. */
+#define CLUSTER_NODE_FAIL_QUERY 2048 /* Node handles FAIL_QUERY messages. */
 #define CLUSTER_NODE_NULL_NAME "\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000"
 
 #define nodeIsMaster(n) ((n)->flags & CLUSTER_NODE_MASTER)
@@ -63,6 +106,8 @@ typedef struct clusterLink {
 #define nodeTimedOut(n) ((n)->flags & CLUSTER_NODE_PFAIL)
 #define nodeFailed(n) ((n)->flags & CLUSTER_NODE_FAIL)
 #define nodeCantFailover(n) ((n)->flags & CLUSTER_NODE_NOFAILOVER)
+#define nodeSupportsLightHdr(n) ((n)->flags & CLUSTER_NODE_LIGHT_HDR)
+#define nodeSupportsFailQuery(n) ((n)->flags & CLUSTER_NODE_FAIL_QUERY)
 
 /* Reasons why a slave is not able to failover. */
 #define CLUSTER_CANT_FAILOVER_NONE 0
@@ -94,7 +139,10 @@ typedef struct clusterLink {
 #define CLUSTERMSG_TYPE_UPDATE 7        /* Another node slots configuration */
 #define CLUSTERMSG_TYPE_MFSTART 8       /* Pause clients for manual failover */
 #define CLUSTERMSG_TYPE_MODULE 9        /* Module cluster API message. */
-#define CLUSTERMSG_TYPE_COUNT 10        /* Total number of message types. */
+#define CLUSTERMSG_TYPE_PUBLISHSHARD 10 /* Pub/Sub shard channel propagation */
+#define CLUSTERMSG_TYPE_FAIL_QUERY 11   /* Is node xxx failing for you too? */
+#define CLUSTERMSG_TYPE_FAIL_REPORT 12  /* Yes, node xxx is failing for me */
+#define CLUSTERMSG_TYPE_COUNT 13        /* Total number of message types. */
 
 /* Flags that a module can set in order to prevent certain Redis Cluster
  * features to be enabled. Useful when implementing a different distributed
@@ -135,6 +183,14 @@ typedef struct clusterNode {
     int cport;                  /* Latest known cluster port of this node. */
     clusterLink *link;          /* TCP/IP link with this node */
     list *fail_reports;         /* List of nodes signaling this as failing */
+    sds slots_info;             /* Cached slots part of the CLUSTER NODES line,
+                                   NULL when it must be regenerated. */
+    uint64_t sent_slots_hash;   /* Hash of the slots bitmap in the last full
+                                   PING/PONG header we sent to this node. */
+    mstime_t sent_slots_time;   /* Time of the last full header sent. */
+    unsigned char *recv_slots;  /* Slots bitmap of the last full PING/PONG
+                                   header received from this node, used to
+                                   expand its light headers, or NULL. */
 } clusterNode;
 
 //集群数据
@@ -148,8 +204,7 @@ typedef struct clusterState {
     clusterNode *migrating_slots_to[CLUSTER_SLOTS];
     clusterNode *importing_slots_from[CLUSTER_SLOTS];
     clusterNode *slots[CLUSTER_SLOTS];
-    uint64_t slots_keys_count[CLUSTER_SLOTS];//集群中key的数量计数
-    rax *slots_to_keys;//删减的key数据存储地方
+    dict *slots_keys[CLUSTER_SLOTS];//每个slot的key，NULL表示slot中没有key
     /* The following fields are used to take the slave state on elections. */
     mstime_t failover_auth_time; /* Time of previous or next election. */
     int failover_auth_count;    /* Number of votes received so far. */
@@ -174,8 +229,32 @@ typedef struct clusterState {
     /* Messages received and sent by type. */
     long long stats_bus_messages_sent[CLUSTERMSG_TYPE_COUNT];
     long long stats_bus_messages_received[CLUSTERMSG_TYPE_COUNT];
+    long long stats_bus_bytes_sent[CLUSTERMSG_TYPE_COUNT];
+    long long stats_bus_bytes_received[CLUSTERMSG_TYPE_COUNT];
+    long long stats_bus_light_sent;     /* PING/PONG sent with light header. */
+    long long stats_bus_light_received; /* Light headers received. */
+    clusterSlotStats slot_stats[CLUSTER_SLOTS]; /* CLUSTER SLOT-STATS. */
     long long stats_pfail_nodes;    /* Number of nodes in PFAIL status,
                                        excluding nodes without address. */
+    /* Cached CLUSTER SLOTS / CLUSTER NODES replies, dropped by
+     * clusterInvalidateCachedReplies() on every topology change. */
+    sds slots_reply;            /* Encoded CLUSTER SLOTS reply or NULL. */
+    unsigned long nodes_info_cached; /* Nodes with a cached slots_info. */
+    long long stats_slots_cache_hits;
+    long long stats_slots_cache_misses;
+    long long stats_nodes_cache_hits;
+    long long stats_nodes_cache_misses;
+    /* Server side slot migration, see CLUSTER MIGRATESLOT. */
+    clusterSlotMigration *slot_migration; /* Migration in progress or NULL. */
+    long long stats_slot_migrations_completed;
+    long long stats_slot_migrations_aborted;
+    long long stats_slot_migration_last_keys;
+    long long stats_slot_migration_last_bytes;
+    long long stats_slot_migration_last_duration; /* Milliseconds. */
+    long long stats_slot_migration_last_pause;    /* Microseconds. */
+    unsigned char slots_to_release[CLUSTER_SLOTS]; /* CLUSTER_SLOT_KEEP or
+                                   CLUSTER_SLOT_RELEASE* for every slot. */
+    int slots_to_release_count; /* Slots not in CLUSTER_SLOT_KEEP state. */
 } clusterState;
 
 /* Redis cluster messages header */
@@ -224,7 +303,7 @@ union clusterMsgData {
         clusterMsgDataGossip gossip[1];
     } ping;
 
-    /* FAIL */
+    /* FAIL, FAIL_QUERY and FAIL_REPORT */
     struct {
         clusterMsgDataFail about;
     } fail;
@@ -274,13 +353,25 @@ typedef struct {
 
 #define CLUSTERMSG_MIN_LEN (sizeof(clusterMsg)-sizeof(union clusterMsgData))
 
+/* A PING or PONG whose type has the CLUSTERMSG_LIGHT bit set is a "light"
+ * message: the myslots field is not transmitted, and the following fields
+ * are moved back accordingly. The receiver restores the bitmap from the
+ * last full header it got from the sender. Light messages are only sent to
+ * nodes that set CLUSTERMSG_FLAG0_LIGHT_HDR in their own messages. */
+#define CLUSTERMSG_LIGHT 0x8000
+#define CLUSTERMSG_LIGHT_MIN_LEN (CLUSTERMSG_MIN_LEN-CLUSTER_SLOTS/8)
+
 /* Message flags better specify the packet content or are used to
  * provide some information about the node state. */
 #define CLUSTERMSG_FLAG0_PAUSED (1<<0) /* Master paused for manual failover. */
 #define CLUSTERMSG_FLAG0_FORCEACK (1<<1) /* Give ACK to AUTH_REQUEST even if
                                             master is up. */
+#define CLUSTERMSG_FLAG0_LIGHT_HDR (1<<2) /* Sender accepts light headers. */
+#define CLUSTERMSG_FLAG0_FAIL_QUERY (1<<3) /* Sender handles FAIL_QUERY. */
 
 /* ---------------------- API exported outside cluster.c -------------------- */
+void clusterSlotStatsAddCommand(client *c, int slot);
+void clusterSlotStatsReset(int slot);
 clusterNode *getNodeByQuery(client *c, struct redisCommand *cmd, robj **argv, int argc, int *hashslot, int *ask);
 int clusterRedirectBlockedClientIfNeeded(client *c);
 void clusterRedirectClient(client *c, clusterNode *n, int hashslot, int error_code);
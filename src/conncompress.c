@@ -0,0 +1,548 @@
+/*
+ * Copyright (c) 2020, Redis Labs
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include "connhelpers.h"
+#include "lzf.h"
+#include "endianconv.h"
+
+/* Compressed connections wrap another connection (socket or TLS) in order to
+ * compress what is written to it, or to decompress what is read from it: the
+ * other direction passes through unchanged. They are used for the
+ * replication link when the master and the replica negotiated it (see
+ * "REPLCONF capa lzf"): the master compresses the RDB payload and the
+ * replication stream, the replica decompresses them, while the REPLCONF
+ * ACKs flowing the other way are sent as they are.
+ *
+ * Every write becomes a frame composed of an 8 bytes header, that is the
+ * length of the payload and the length of the original data (both 32 bit
+ * little endian), followed by the payload itself. The payload is LZF
+ * compressed, unless compressing did not save any space: in such a case
+ * the two lengths are the same and the data is stored as it is.
+ *
+ * The wrapper takes the place of the inner connection for its owner: the
+ * handlers registered on the wrapper are called by trampolines installed on
+ * the inner connection. Like TLS, decompressed data may be buffered when
+ * the socket is no longer readable, so connections with pending data are
+ * served from beforeSleep() via connCompressProcessPendingData(). */
+
+#define CONN_COMPRESS_HDR_LEN 8
+#define CONN_COMPRESS_FRAME_LEN (1024*64) /* Max original data per frame. */
+#define CONN_COMPRESS_MIN_LEN 64          /* Don't try to compress less. */
+#define CONN_COMPRESS_BUF_LEN (CONN_COMPRESS_HDR_LEN+CONN_COMPRESS_FRAME_LEN)
+
+typedef struct compressed_connection {
+    connection c;
+    connection *inner;
+    int mode;                   /* CONN_COMPRESS_WRITE or CONN_COMPRESS_READ. */
+    int corrupted;              /* Set when an invalid frame was received. */
+    listNode *pending_list_node;
+    /* Frame being written: obuf[opos..olen) is still to send. */
+    char *obuf;
+    size_t opos, olen;
+    /* Frames received: ibuf[ipos..ilen) is still to decode, and
+     * dbuf[dpos..dlen) is decoded data not yet returned to the caller. */
+    char *ibuf, *dbuf;
+    size_t ipos, ilen, dpos, dlen;
+    /* Stats. */
+    long long raw_bytes;        /* Original data bytes. */
+    long long wire_bytes;       /* Frame bytes, headers included. */
+    long long usec;             /* Time spent compressing / decompressing. */
+} compressed_connection;
+
+ConnectionType CT_Compressed;
+static list *pending_list = NULL;
+
+static void connCompressInnerReadHandler(connection *inner);
+static void connCompressInnerWriteHandler(connection *inner);
+
+/* Create a compressed connection on top of 'inner', that must be already
+ * connected. The handlers registered on 'inner' are moved to the new
+ * connection, which from now on must be used in place of 'inner'. */
+connection *connCreateCompressed(connection *inner, int mode) {
+    compressed_connection *cc = zcalloc(sizeof(*cc));
+    ConnectionCallbackFunc rfunc = inner->read_handler;
+    ConnectionCallbackFunc wfunc = inner->write_handler;
+    int barrier = (inner->flags & CONN_FLAG_WRITE_BARRIER) != 0;
+
+    cc->c.type = &CT_Compressed;
+    cc->c.state = inner->state;
+    cc->c.fd = inner->fd;
+    cc->c.private_data = inner->private_data;
+    cc->inner = inner;
+    cc->mode = mode;
+    if (mode == CONN_COMPRESS_WRITE) {
+        cc->obuf = zmalloc(CONN_COMPRESS_BUF_LEN);
+    } else {
+        cc->ibuf = zmalloc(CONN_COMPRESS_BUF_LEN);
+        cc->dbuf = zmalloc(CONN_COMPRESS_FRAME_LEN);
+    }
+    inner->private_data = cc;
+    connSetReadHandler(&cc->c,rfunc);
+    connSetWriteHandlerWithBarrier(&cc->c,wfunc,barrier);
+    return &cc->c;
+}
+
+int connIsCompressed(connection *conn) {
+    return conn && conn->type == &CT_Compressed;
+}
+
+/* Return the number of original bytes, the number of bytes that actually
+ * traveled on the wire, and the microseconds of CPU time spent compressing
+ * or decompressing them. */
+void connGetCompressionStats(connection *conn, long long *raw,
+                             long long *wire, long long *usec)
+{
+    compressed_connection *cc = (compressed_connection*)conn;
+    *raw = cc->raw_bytes;
+    *wire = cc->wire_bytes;
+    *usec = cc->usec;
+}
+
+/* Reflect the state of the inner connection after an operation on it. */
+static void connCompressSyncState(compressed_connection *cc) {
+    if (cc->corrupted) return;
+    cc->c.state = cc->inner->state;
+    cc->c.last_errno = cc->inner->last_errno;
+}
+
+/* ------------------------------- Writing ---------------------------------- */
+
+/* Turn 'len' bytes of 'data' into the frame to send next. */
+static void connCompressEncode(compressed_connection *cc, const void *data,
+                               size_t len)
+{
+    long long start = ustime();
+    uint32_t hdr[2];
+    size_t plen = 0;
+
+    if (len >= CONN_COMPRESS_MIN_LEN)
+        plen = lzf_compress(data,len,cc->obuf+CONN_COMPRESS_HDR_LEN,len-1);
+    if (plen == 0) {
+        memcpy(cc->obuf+CONN_COMPRESS_HDR_LEN,data,len);
+        plen = len;
+    }
+    hdr[0] = plen;
+    hdr[1] = len;
+    memrev32ifbe(&hdr[0]);
+    memrev32ifbe(&hdr[1]);
+    memcpy(cc->obuf,hdr,CONN_COMPRESS_HDR_LEN);
+    cc->opos = 0;
+    cc->olen = CONN_COMPRESS_HDR_LEN+plen;
+
+    cc->raw_bytes += len;
+    cc->wire_bytes += cc->olen;
+    cc->usec += ustime()-start;
+}
+
+/* Write what is left of the current frame. Returns C_OK once it was written
+ * completely, otherwise C_ERR: the connection state tells apart a socket
+ * that is just not writable from an error. */
+static int connCompressFlush(compressed_connection *cc) {
+    while (cc->opos < cc->olen) {
+        int nwritten = connWrite(cc->inner,cc->obuf+cc->opos,
+                                 cc->olen-cc->opos);
+        connCompressSyncState(cc);
+        if (nwritten <= 0) return C_ERR;
+        cc->opos += nwritten;
+    }
+    return C_OK;
+}
+
+/* The inner write handler is needed while the owner has one, or while part
+ * of a frame is still to be sent: the owner considers that data written
+ * already, so nobody else will ask to send it. */
+static int connCompressUpdateWriteHandler(compressed_connection *cc) {
+    int needed = cc->c.write_handler != NULL || cc->opos < cc->olen;
+    return connSetWriteHandlerWithBarrier(cc->inner,
+        needed ? connCompressInnerWriteHandler : NULL,
+        (cc->c.flags & CONN_FLAG_WRITE_BARRIER) != 0);
+}
+
+static int connCompressWrite(connection *conn, const void *data, size_t data_len) {
+    compressed_connection *cc = (compressed_connection*)conn;
+    int ret;
+
+    if (cc->mode != CONN_COMPRESS_WRITE) {
+        ret = connWrite(cc->inner,data,data_len);
+        connCompressSyncState(cc);
+        return ret;
+    }
+
+    /* A new frame is started only once the previous one was written. */
+    if (connCompressFlush(cc) == C_ERR) return -1;
+    if (data_len == 0) return 0;
+    if (data_len > CONN_COMPRESS_FRAME_LEN) data_len = CONN_COMPRESS_FRAME_LEN;
+    connCompressEncode(cc,data,data_len);
+    if (connCompressFlush(cc) == C_ERR &&
+        conn->state != CONN_STATE_CONNECTED) return -1;
+    connCompressUpdateWriteHandler(cc);
+    return data_len;
+}
+
+static int connCompressSetWriteHandler(connection *conn, ConnectionCallbackFunc func, int barrier) {
+    compressed_connection *cc = (compressed_connection*)conn;
+
+    conn->write_handler = func;
+    if (barrier)
+        conn->flags |= CONN_FLAG_WRITE_BARRIER;
+    else
+        conn->flags &= ~CONN_FLAG_WRITE_BARRIER;
+    return connCompressUpdateWriteHandler(cc);
+}
+
+static void connCompressInnerWriteHandler(connection *inner) {
+    compressed_connection *cc = connGetPrivateData(inner);
+    connection *conn = &cc->c;
+
+    if (connCompressFlush(cc) == C_ERR) {
+        if (conn->state == CONN_STATE_CONNECTED) return;
+        /* Let the owner notice the error with its next I/O, and stop
+         * trying to send the rest of the frame. */
+        cc->opos = cc->olen;
+        if (!callHandler(conn, conn->write_handler ? conn->write_handler :
+                                                     conn->read_handler))
+            return;
+    } else if (conn->write_handler) {
+        if (!callHandler(conn, conn->write_handler)) return;
+    }
+    connCompressUpdateWriteHandler(cc);
+}
+
+/* ------------------------------- Reading ---------------------------------- */
+
+/* Return true if ibuf holds a complete frame. Invalid frame headers mark
+ * the connection as corrupted. */
+static int connCompressFrameReady(compressed_connection *cc) {
+    uint32_t hdr[2];
+
+    if (cc->ilen-cc->ipos < CONN_COMPRESS_HDR_LEN) return 0;
+    memcpy(hdr,cc->ibuf+cc->ipos,CONN_COMPRESS_HDR_LEN);
+    memrev32ifbe(&hdr[0]);
+    memrev32ifbe(&hdr[1]);
+    if (hdr[1] == 0 || hdr[1] > CONN_COMPRESS_FRAME_LEN || hdr[0] > hdr[1]) {
+        cc->corrupted = 1;
+        return 0;
+    }
+    return cc->ilen-cc->ipos >= CONN_COMPRESS_HDR_LEN+hdr[0];
+}
+
+/* Flag the connection as broken because of an invalid frame. */
+static int connCompressCorrupted(compressed_connection *cc) {
+    cc->corrupted = 1;
+    cc->c.state = CONN_STATE_ERROR;
+    cc->c.last_errno = EPROTO;
+    errno = EPROTO;
+    return -1;
+}
+
+/* Decode the next frame into dbuf, reading from the inner connection as
+ * needed. Returns 1 on success, otherwise what the read from the inner
+ * connection returned (0 or -1). */
+static int connCompressFill(compressed_connection *cc) {
+    uint32_t hdr[2];
+
+    while (!connCompressFrameReady(cc)) {
+        if (cc->corrupted) return connCompressCorrupted(cc);
+        if (cc->ipos) {
+            memmove(cc->ibuf,cc->ibuf+cc->ipos,cc->ilen-cc->ipos);
+            cc->ilen -= cc->ipos;
+            cc->ipos = 0;
+        }
+        int nread = connRead(cc->inner,cc->ibuf+cc->ilen,
+                             CONN_COMPRESS_BUF_LEN-cc->ilen);
+        connCompressSyncState(cc);
+        if (nread <= 0) return nread;
+        cc->ilen += nread;
+        cc->wire_bytes += nread;
+    }
+
+    long long start = ustime();
+    memcpy(hdr,cc->ibuf+cc->ipos,CONN_COMPRESS_HDR_LEN);
+    memrev32ifbe(&hdr[0]);
+    memrev32ifbe(&hdr[1]);
+    char *payload = cc->ibuf+cc->ipos+CONN_COMPRESS_HDR_LEN;
+    if (hdr[0] == hdr[1]) {
+        memcpy(cc->dbuf,payload,hdr[1]);
+    } else if (lzf_decompress(payload,hdr[0],cc->dbuf,hdr[1]) != hdr[1]) {
+        return connCompressCorrupted(cc);
+    }
+    cc->ipos += CONN_COMPRESS_HDR_LEN+hdr[0];
+    cc->dpos = 0;
+    cc->dlen = hdr[1];
+    cc->raw_bytes += hdr[1];
+    cc->usec += ustime()-start;
+    return 1;
+}
+
+/* Track the connections that have data to serve without the socket being
+ * readable, see connCompressProcessPendingData(). */
+static void connCompressUpdatePending(compressed_connection *cc) {
+    int pending = cc->mode == CONN_COMPRESS_READ &&
+                  cc->c.read_handler != NULL &&
+                  cc->c.state == CONN_STATE_CONNECTED &&
+                  (cc->dpos < cc->dlen || connCompressFrameReady(cc));
+
+    if (pending && !cc->pending_list_node) {
+        if (!pending_list) pending_list = listCreate();
+        listAddNodeTail(pending_list,cc);
+        cc->pending_list_node = listLast(pending_list);
+    } else if (!pending && cc->pending_list_node) {
+        listDelNode(pending_list,cc->pending_list_node);
+        cc->pending_list_node = NULL;
+    }
+}
+
+static int connCompressRead(connection *conn, void *buf, size_t buf_len) {
+    compressed_connection *cc = (compressed_connection*)conn;
+    int ret;
+
+    if (cc->mode != CONN_COMPRESS_READ) {
+        ret = connRead(cc->inner,buf,buf_len);
+        connCompressSyncState(cc);
+        return ret;
+    }
+
+    if (buf_len == 0) return 0;
+    if (cc->dpos == cc->dlen) {
+        ret = connCompressFill(cc);
+        if (ret <= 0) {
+            connCompressUpdatePending(cc);
+            return ret;
+        }
+    }
+    size_t avail = cc->dlen-cc->dpos;
+    if (buf_len > avail) buf_len = avail;
+    memcpy(buf,cc->dbuf+cc->dpos,buf_len);
+    cc->dpos += buf_len;
+    connCompressUpdatePending(cc);
+    return buf_len;
+}
+
+static int connCompressSetReadHandler(connection *conn, ConnectionCallbackFunc func) {
+    compressed_connection *cc = (compressed_connection*)conn;
+
+    conn->read_handler = func;
+    if (connSetReadHandler(cc->inner,
+            func ? connCompressInnerReadHandler : NULL) == C_ERR)
+        return C_ERR;
+    connCompressUpdatePending(cc);
+    return C_OK;
+}
+
+static void connCompressInnerReadHandler(connection *inner) {
+    compressed_connection *cc = connGetPrivateData(inner);
+
+    connCompressSyncState(cc);
+    callHandler(&cc->c, cc->c.read_handler);
+}
+
+int connCompressHasPendingData(void) {
+    return pending_list && listLength(pending_list) > 0;
+}
+
+int connCompressProcessPendingData(void) {
+    listIter li;
+    listNode *ln;
+
+    if (!pending_list) return 0;
+    int processed = listLength(pending_list);
+    listRewind(pending_list,&li);
+    while((ln = listNext(&li))) {
+        compressed_connection *cc = listNodeValue(ln);
+        callHandler(&cc->c, cc->c.read_handler);
+    }
+    return processed;
+}
+
+/* ------------------------- Synchronous I/O -------------------------------- */
+
+#define CONN_COMPRESS_SYNCIO_RESOLUTION 10 /* Milliseconds, like syncio.c */
+
+static ssize_t connCompressSyncWrite(connection *conn, char *ptr, ssize_t size, long long timeout) {
+    compressed_connection *cc = (compressed_connection*)conn;
+    ssize_t ret = size;
+    long long start = mstime();
+    long long remaining = timeout;
+
+    if (cc->mode != CONN_COMPRESS_WRITE) {
+        ret = connSyncWrite(cc->inner,ptr,size,timeout);
+        connCompressSyncState(cc);
+        return ret;
+    }
+
+    while(1) {
+        long long wait = (remaining > CONN_COMPRESS_SYNCIO_RESOLUTION) ?
+                          remaining : CONN_COMPRESS_SYNCIO_RESOLUTION;
+        long long elapsed;
+
+        if (size) {
+            int nwritten = connCompressWrite(conn,ptr,size);
+            if (nwritten > 0) {
+                ptr += nwritten;
+                size -= nwritten;
+                continue;
+            }
+        } else if (connCompressFlush(cc) == C_OK) {
+            return ret;
+        }
+        if (conn->state != CONN_STATE_CONNECTED) return -1;
+
+        aeWait(conn->fd,AE_WRITABLE,wait);
+        elapsed = mstime() - start;
+        if (elapsed >= timeout) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        remaining = timeout - elapsed;
+    }
+}
+
+static ssize_t connCompressSyncRead(connection *conn, char *ptr, ssize_t size, long long timeout) {
+    compressed_connection *cc = (compressed_connection*)conn;
+    ssize_t totread = 0;
+    long long start = mstime();
+    long long remaining = timeout;
+
+    if (cc->mode != CONN_COMPRESS_READ) {
+        totread = connSyncRead(cc->inner,ptr,size,timeout);
+        connCompressSyncState(cc);
+        return totread;
+    }
+
+    if (size == 0) return 0;
+    while(1) {
+        long long wait = (remaining > CONN_COMPRESS_SYNCIO_RESOLUTION) ?
+                          remaining : CONN_COMPRESS_SYNCIO_RESOLUTION;
+        long long elapsed;
+
+        int nread = connCompressRead(conn,ptr,size);
+        if (nread == 0) return -1; /* short read. */
+        if (nread == -1) {
+            if (conn->state != CONN_STATE_CONNECTED) return -1;
+        } else {
+            ptr += nread;
+            size -= nread;
+            totread += nread;
+            if (size == 0) return totread;
+            continue;
+        }
+
+        aeWait(conn->fd,AE_READABLE,wait);
+        elapsed = mstime() - start;
+        if (elapsed >= timeout) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        remaining = timeout - elapsed;
+    }
+}
+
+static ssize_t connCompressSyncReadLine(connection *conn, char *ptr, ssize_t size, long long timeout) {
+    compressed_connection *cc = (compressed_connection*)conn;
+    ssize_t nread = 0;
+
+    if (cc->mode != CONN_COMPRESS_READ) {
+        nread = connSyncReadLine(cc->inner,ptr,size,timeout);
+        connCompressSyncState(cc);
+        return nread;
+    }
+
+    size--;
+    while(size) {
+        char c;
+
+        if (connCompressSyncRead(conn,&c,1,timeout) == -1) return -1;
+        if (c == '\n') {
+            *ptr = '\0';
+            if (nread && *(ptr-1) == '\r') *(ptr-1) = '\0';
+            return nread;
+        } else {
+            *ptr++ = c;
+            *ptr = '\0';
+            nread++;
+        }
+        size--;
+    }
+    return nread;
+}
+
+/* --------------------------------- Misc ----------------------------------- */
+
+static void connCompressClose(connection *conn) {
+    compressed_connection *cc = (compressed_connection*)conn;
+
+    if (cc->pending_list_node) {
+        listDelNode(pending_list,cc->pending_list_node);
+        cc->pending_list_node = NULL;
+    }
+    if (cc->inner) {
+        connClose(cc->inner);
+        cc->inner = NULL;
+        conn->fd = -1;
+    }
+
+    /* If called from within a handler, schedule the close but
+     * keep the connection until the handler returns. */
+    if (connHasRefs(conn)) {
+        conn->flags |= CONN_FLAG_CLOSE_SCHEDULED;
+        return;
+    }
+
+    zfree(cc->obuf);
+    zfree(cc->ibuf);
+    zfree(cc->dbuf);
+    zfree(cc);
+}
+
+static const char *connCompressGetLastError(connection *conn) {
+    compressed_connection *cc = (compressed_connection*)conn;
+
+    if (cc->corrupted) return "Corrupted compressed stream";
+    if (cc->inner) return connGetLastError(cc->inner);
+    return strerror(conn->last_errno);
+}
+
+/* Compressed connections are created on top of connections that are
+ * already established, so there is nothing to accept or connect. */
+ConnectionType CT_Compressed = {
+    .ae_handler = NULL,
+    .accept = NULL,
+    .connect = NULL,
+    .blocking_connect = NULL,
+    .read = connCompressRead,
+    .write = connCompressWrite,
+    .close = connCompressClose,
+    .set_write_handler = connCompressSetWriteHandler,
+    .set_read_handler = connCompressSetReadHandler,
+    .get_last_error = connCompressGetLastError,
+    .sync_write = connCompressSyncWrite,
+    .sync_read = connCompressSyncRead,
+    .sync_readline = connCompressSyncReadLine,
+};
@@ -224,4 +224,14 @@ const char *connGetInfo(connection *conn, char *buf, size_t buf_len);
 int tlsHasPendingData();
 int tlsProcessPendingData();
 
+/* Compressed connections, see conncompress.c */
+#define CONN_COMPRESS_WRITE 1   /* Compress writes, reads pass through. */
+#define CONN_COMPRESS_READ 2    /* Decompress reads, writes pass through. */
+
+connection *connCreateCompressed(connection *inner, int mode);
+int connIsCompressed(connection *conn);
+void connGetCompressionStats(connection *conn, long long *raw, long long *wire, long long *usec);
+int connCompressHasPendingData(void);
+int connCompressProcessPendingData(void);
+
 #endif  /* __REDIS_CONNECTION_H */
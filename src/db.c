@@ -200,8 +200,8 @@ void dbAdd(redisDb *db, robj *key, robj *val) {
         val->type == OBJ_ZSET ||
         val->type == OBJ_STREAM)
         signalKeyAsReady(db, key);//代表key在server和db的dict中都准备好
-    //集群数据增加
-    if (server.cluster_enabled) slotToKeyAdd(key->ptr);
+    //集群数据增加，slot的dict引用db->dict中的sds
+    if (server.cluster_enabled) slotToKeyAdd(copy);
 }
 
 /* This is a special version of dbAdd() that is used only when loading
@@ -325,9 +325,12 @@ int dbSyncDelete(redisDb *db, robj *key) {
      * the key, because it is shared with the main dictionary. */
     //删除过期的keys中对应的key
     if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
-    if (dictDelete(db->dict,key->ptr) == DICT_OK) {//删除原数据的key
-        //判断是否开启了集群，对集群中key做插入和删除处理
+    dictEntry *de = dictUnlink(db->dict,key->ptr);
+    if (de) {//删除原数据的key
+        //集群模式下先从slot的dict中删除，因为它引用了db->dict中key的sds
         if (server.cluster_enabled) slotToKeyDel(key->ptr);
+        dictFreeUnlinkedEntry(db->dict,de);
+        rdbMarkKeyDirty(key);
         return 1;
     } else {
         return 0;
@@ -448,6 +451,7 @@ long long emptyDbGeneric(redisDb *dbarray, int dbnum, int flags, void(callback)(
             }
         }
         if (dbnum == -1) flushSlaveKeysWithExpireList();
+        rdbMarkAllDirty();
 
         /* Also fire the end event. Note that this event will fire almost
          * immediately after the start event if the flush is asynchronous. */
@@ -495,6 +499,9 @@ long long dbTotalServerKeyCount() {
 void signalModifiedKey(client *c, redisDb *db, robj *key) {
     touchWatchedKey(db,key);//修改监听这个key的客户端标记
     trackingInvalidateKey(c,key);//通知客户端修改
+    rdbMarkKeyDirty(key);
+    if (server.cluster_enabled && sdsEncodedObject(key))
+        clusterSlotMigrationKeyChanged(key->ptr);
 }
 
 void signalFlushedDb(int dbid) {
@@ -697,7 +704,7 @@ void scanCallback(void *privdata, const dictEntry *de) {
     } else if (o->type == OBJ_ZSET) {
         sds sdskey = dictGetKey(de);
         key = createStringObject(sdskey,sdslen(sdskey));
-        val = createStringObjectFromLongDouble(*(double*)dictGetVal(de),0);
+        val = createStringObjectFromLongDouble(zsetDictGetScore(o->ptr,de),0);
     } else {
         serverPanic("Type not handled in SCAN callback.");
     }
@@ -791,11 +798,13 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
 
     /* Step 2: Iterate the collection.
      *
-     * Note that if the object is encoded with a ziplist, intset, or any other
+     * Note that if the object is encoded with a listpack, intset, or any other
      * representation that is not a hash table, we are sure that it is also
      * composed of a small number of elements. So to avoid taking state we
      * just return everything inside the object in a single call, setting the
-     * cursor to zero to signal the end of the iteration. */
+     * cursor to zero to signal the end of the iteration. The exception are
+     * roaring bitmaps, that are scanned one container at a time using the
+     * key of the next container plus one as cursor. */
 
     /* Handle the case of a hash table. */
     ht = NULL;
@@ -806,7 +815,8 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
     } else if (o->type == OBJ_HASH && o->encoding == OBJ_ENCODING_HT) {
         ht = o->ptr;
         count *= 2; /* We return key / value for this type. */
-    } else if (o->type == OBJ_ZSET && o->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (o->type == OBJ_ZSET && (o->encoding == OBJ_ENCODING_SKIPLIST ||
+                                       o->encoding == OBJ_ENCODING_BTREE)) {
         zset *zs = o->ptr;
         ht = zs->dict;
         count *= 2; /* We return key / value for this type. */
@@ -830,25 +840,49 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
         } while (cursor &&
               maxiterations-- &&
               listLength(keys) < (unsigned long)count);
-    } else if (o->type == OBJ_SET) {
+    } else if (o->type == OBJ_SET && o->encoding == OBJ_ENCODING_INTSET) {
         int pos = 0;
         int64_t ll;
 
         while(intsetGet(o->ptr,pos++,&ll))
             listAddNodeTail(keys,createStringObjectFromLongLong(ll));
         cursor = 0;
-    } else if (o->type == OBJ_HASH || o->type == OBJ_ZSET) {
-        unsigned char *p = ziplistIndex(o->ptr,0);
+    } else if (o->type == OBJ_SET && o->encoding == OBJ_ENCODING_ROARING) {
+        roaring *r = o->ptr;
+        roaringIterator it;
+        uint32_t ci;
+        int64_t ll;
+
+        roaringInitIterator(r,&it);
+        if (cursor) roaringSeek(&it,cursor-1);
+        ci = it.ci;
+        cursor = 0;
+        while (roaringNext(&it,&ll)) {
+            /* Containers are never split between calls, so values that are
+             * not added or removed meanwhile are returned exactly once. */
+            if (it.ci != ci) {
+                if (listLength(keys) >= (unsigned long)count) {
+                    cursor = r->containers[it.ci].key+1;
+                    break;
+                }
+                ci = it.ci;
+            }
+            listAddNodeTail(keys,createStringObjectFromLongLong(ll));
+        }
+    } else if (o->type == OBJ_SET || o->type == OBJ_HASH ||
+               o->type == OBJ_ZSET)
+    {
+        unsigned char *p = lpSeek(o->ptr,0);
         unsigned char *vstr;
         unsigned int vlen;
         long long vll;
 
         while(p) {
-            ziplistGet(p,&vstr,&vlen,&vll);
+            vstr = lpGetValue(p,&vlen,&vll);
             listAddNodeTail(keys,
                 (vstr != NULL) ? createStringObject((char*)vstr,vlen) :
                                  createStringObjectFromLongLong(vll));
-            p = ziplistNext(o->ptr,p);
+            p = lpNext(o->ptr,p);
         }
         cursor = 0;
     } else {
@@ -1165,6 +1199,7 @@ int dbSwapDatabases(long id1, long id2) {
      * if needed. */
     scanDatabaseForReadyLists(db1);
     scanDatabaseForReadyLists(db2);
+    rdbMarkAllDirty();
     return C_OK;
 }
 
@@ -1452,7 +1487,8 @@ void getKeysFreeResult(int *result) {
 
 /* Helper function to extract keys from following commands:
  * ZUNIONSTORE <destkey> <num-keys> <key> <key> ... <key> <options>
- * ZINTERSTORE <destkey> <num-keys> <key> <key> ... <key> <options> */
+ * ZINTERSTORE <destkey> <num-keys> <key> <key> ... <key> <options>
+ * ZDIFFSTORE <destkey> <num-keys> <key> <key> ... <key> */
 int *zunionInterGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys) {
     int i, num, *keys;
     UNUSED(cmd);
@@ -1508,6 +1544,59 @@ int *evalGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys)
     return keys;
 }
 
+/* Helper function to extract keys from the ZUNION, ZINTER and ZDIFF
+ * commands, that have no destination key:
+ * ZUNION <num-keys> <key> <key> ... <key> <options> */
+int *zunionInterDiffGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys) {
+    int i, num, *keys;
+    UNUSED(cmd);
+
+    num = atoi(argv[1]->ptr);
+    /* Sanity check. Don't return any key if the command is going to
+     * reply with syntax error. */
+    if (num < 1 || num > (argc-2)) {
+        *numkeys = 0;
+        return NULL;
+    }
+
+    keys = getKeysTempBuffer;
+    if (num>MAX_KEYS_BUFFER)
+        keys = zmalloc(sizeof(int)*num);
+
+    *numkeys = num;
+
+    /* Add all key positions for argv[2...n] to keys[] */
+    for (i = 0; i < num; i++) keys[i] = 2+i;
+
+    return keys;
+}
+
+/* Helper function to extract keys from the SINTERCARD command:
+ * SINTERCARD <num-keys> <key> <key> ... <key> [LIMIT limit] */
+int *sintercardGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys) {
+    int i, num, *keys;
+    UNUSED(cmd);
+
+    num = atoi(argv[1]->ptr);
+    /* Sanity check. Don't return any key if the command is going to
+     * reply with syntax error. */
+    if (num <= 0 || num > (argc-2)) {
+        *numkeys = 0;
+        return NULL;
+    }
+
+    keys = getKeysTempBuffer;
+    if (num>MAX_KEYS_BUFFER)
+        keys = zmalloc(sizeof(int)*num);
+
+    *numkeys = num;
+
+    /* Add all key positions for argv[2...n] to keys[] */
+    for (i = 0; i < num; i++) keys[i] = 2+i;
+
+    return keys;
+}
+
 /* Helper function to extract keys from the SORT command.
  *
  * SORT <sort-key> ... STORE <store-key> ...
@@ -1587,6 +1676,29 @@ int *migrateGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkey
     return keys;
 }
 
+/* Helper function to extract keys from the RESTORE-BATCH command:
+ * RESTORE-BATCH numkeys key [key ...] payload [REPLACE] [ABSTTL] */
+int *restoreBatchGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys) {
+    int i, num, *keys;
+    UNUSED(cmd);
+
+    num = atoi(argv[1]->ptr);
+    /* Sanity check. Don't return any key if the command is going to
+     * reply with syntax error. */
+    if (num <= 0 || num > (argc-3)) {
+        *numkeys = 0;
+        return NULL;
+    }
+
+    keys = getKeysTempBuffer;
+    if (num>MAX_KEYS_BUFFER)
+        keys = zmalloc(sizeof(int)*num);
+
+    *numkeys = num;
+    for (i = 0; i < num; i++) keys[i] = 2+i;
+    return keys;
+}
+
 /* Helper function to extract keys from following commands:
  * GEORADIUS key x y radius unit [WITHDIST] [WITHHASH] [WITHCOORD] [ASC|DESC]
  *                             [COUNT count] [STORE key] [STOREDIST key]
@@ -1719,95 +1831,116 @@ int *xreadGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys)
 /* Slot to Key API. This is used by Redis Cluster in order to obtain in
  * a fast way a key that belongs to a specified hash slot. This is useful
  * while rehashing the cluster and in other conditions when we need to
- * understand if we have keys for a given hash slot. */
-/*
-根据add判断插入key还是删除key
-*/
-void slotToKeyUpdateKey(sds key, int add) {
-    //获取key的长度
-    size_t keylen = sdslen(key);
-    //获取这个key的hash值
-    unsigned int hashslot = keyHashSlot(key,keylen);
-    unsigned char buf[64];
-    unsigned char *indexed = buf;
-    //对集群的hash表中的hash位置计数++/--
-    server.cluster->slots_keys_count[hashslot] += add ? 1 : -1;
-    //key长度大于64，需要多申请重新申请空间，大小为2+keylen
-    if (keylen+2 > 64) indexed = zmalloc(keylen+2);
-    //将hash值放在index前两位
-    indexed[0] = (hashslot >> 8) & 0xff;
-    indexed[1] = hashslot & 0xff;
-    //index的数据为前两位存储的是key的长度，后面的为key的原数据
-    memcpy(indexed+2,key,keylen);
-    if (add) {//如果增加
-        raxInsert(server.cluster->slots_to_keys,indexed,keylen+2,NULL,NULL);
-    } else {//如果删除
-        raxRemove(server.cluster->slots_to_keys,indexed,keylen+2,NULL);
-    }
-    //如果index为新申请的空间需要释放，不然为原始的buf会在函数结束系统回收
-    if (indexed != buf) zfree(indexed);
-}
-
-//向集群数据中插入key
+ * understand if we have keys for a given hash slot.
+ *
+ * The keyspace is partitioned into one dict per slot, created when the
+ * first key of the slot is added and released when the last one is
+ * removed. The slot dicts reference the same sds strings of the main
+ * dictionary, so a key must be removed from its slot dict before the key
+ * is released. */
+//每个slot一个dict，key的sds与db->dict共享
 void slotToKeyAdd(sds key) {
-    slotToKeyUpdateKey(key,1);
+    unsigned int hashslot = keyHashSlot(key,sdslen(key));
+    dict **d = server.cluster->slots_keys+hashslot;
+
+    if (*d == NULL) *d = dictCreate(&keyptrDictType,NULL);
+    serverAssert(dictAdd(*d,key,NULL) == DICT_OK);
 }
 
-//删除集群中的key
+//删除集群中的key，需要在key的sds被释放前调用
 void slotToKeyDel(sds key) {
-    slotToKeyUpdateKey(key,0);
+    unsigned int hashslot = keyHashSlot(key,sdslen(key));
+    dict **d = server.cluster->slots_keys+hashslot;
+
+    if (*d && dictDelete(*d,key) == DICT_OK && dictSize(*d) == 0) {
+        dictRelease(*d);
+        *d = NULL;
+    }
+    clusterSlotMigrationKeyChanged(key);
+}
+
+/* Detach all the slot dicts, returning the number of keys they were
+ * referencing. If 'old' is not NULL the dicts are moved there instead of
+ * being released. */
+unsigned long slotToKeyDetach(dict **old) {
+    unsigned long numkeys = 0;
+
+    clusterSlotMigrationAbort("the dataset was flushed");
+    for (int j = 0; j < CLUSTER_SLOTS; j++) {
+        dict *d = server.cluster->slots_keys[j];
+
+        if (d) numkeys += dictSize(d);
+        if (old) old[j] = d;
+        else if (d) dictRelease(d);
+        server.cluster->slots_keys[j] = NULL;
+    }
+    return numkeys;
 }
 
 void slotToKeyFlush(void) {
-    raxFree(server.cluster->slots_to_keys);
-    server.cluster->slots_to_keys = raxNew();
-    memset(server.cluster->slots_keys_count,0,
-           sizeof(server.cluster->slots_keys_count));
+    slotToKeyDetach(NULL);
 }
 
 /* Pupulate the specified array of objects with keys in the specified slot.
  * New objects are returned to represent keys, it's up to the caller to
  * decrement the reference count to release the keys names. */
 unsigned int getKeysInSlot(unsigned int hashslot, robj **keys, unsigned int count) {
-    raxIterator iter;
+    dict *d = server.cluster->slots_keys[hashslot];
+    dictIterator *di;
+    dictEntry *de;
     int j = 0;
-    unsigned char indexed[2];
 
-    indexed[0] = (hashslot >> 8) & 0xff;
-    indexed[1] = hashslot & 0xff;
-    raxStart(&iter,server.cluster->slots_to_keys);
-    raxSeek(&iter,">=",indexed,2);
-    while(count-- && raxNext(&iter)) {
-        if (iter.key[0] != indexed[0] || iter.key[1] != indexed[1]) break;
-        keys[j++] = createStringObject((char*)iter.key+2,iter.key_len-2);
+    if (d == NULL || count == 0) return 0;
+    di = dictGetIterator(d);
+    while(count-- && (de = dictNext(di)) != NULL) {
+        sds key = dictGetKey(de);
+        keys[j++] = createStringObject(key,sdslen(key));
     }
-    raxStop(&iter);
+    dictReleaseIterator(di);
     return j;
 }
 
+void scanKeysInSlotCallback(void *privdata, const dictEntry *de) {
+    list *keys = privdata;
+    sds key = dictGetKey(de);
+    listAddNodeTail(keys,createStringObject(key,sdslen(key)));
+}
+
+/* Iterate the keys of a slot a few at a time with the same guarantees of
+ * SCAN: every key present in the slot for the whole iteration is returned
+ * at least once. Starting from 'cursor', at least 'count' keys are appended
+ * to the 'keys' list as new objects (unless the iteration ends before),
+ * and the cursor to use for the next call is returned: zero means that
+ * the iteration is complete. */
+unsigned long scanKeysInSlot(unsigned int hashslot, unsigned long cursor, list *keys, unsigned int count) {
+    dict *d = server.cluster->slots_keys[hashslot];
+    unsigned long start = listLength(keys);
+
+    if (d == NULL) return 0;
+    do {
+        cursor = dictScan(d,cursor,scanKeysInSlotCallback,NULL,keys);
+    } while(cursor && listLength(keys)-start < count);
+    return cursor;
+}
+
 /* Remove all the keys in the specified hash slot.
  * The number of removed items is returned. */
 unsigned int delKeysInSlot(unsigned int hashslot) {
-    raxIterator iter;
-    int j = 0;
-    unsigned char indexed[2];
-
-    indexed[0] = (hashslot >> 8) & 0xff;
-    indexed[1] = hashslot & 0xff;
-    raxStart(&iter,server.cluster->slots_to_keys);
-    while(server.cluster->slots_keys_count[hashslot]) {
-        raxSeek(&iter,">=",indexed,2);
-        raxNext(&iter);
-
-        robj *key = createStringObject((char*)iter.key+2,iter.key_len-2);
-        dbDelete(&server.db[0],key);
-        decrRefCount(key);
-        j++;
+    robj *keys[128];
+    unsigned int numkeys, j, deleted = 0;
+
+    /* Collect the names first: deleting the last key releases the dict. */
+    while ((numkeys = getKeysInSlot(hashslot,keys,128)) != 0) {
+        for (j = 0; j < numkeys; j++) {
+            dbDelete(&server.db[0],keys[j]);
+            decrRefCount(keys[j]);
+        }
+        deleted += numkeys;
     }
-    raxStop(&iter);
-    return j;
+    return deleted;
 }
 
 unsigned int countKeysInSlot(unsigned int hashslot) {
-    return server.cluster->slots_keys_count[hashslot];
+    dict *d = server.cluster->slots_keys[hashslot];
+    return d ? dictSize(d) : 0;
 }
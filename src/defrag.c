@@ -35,6 +35,7 @@
  */
 
 #include "server.h"
+#include "cluster.h"
 #include <time.h>
 #include <assert.h>
 #include <stddef.h>
@@ -247,6 +248,13 @@ long activeDefragZsetEntry(zset *zs, dictEntry *de) {
     sds sdsele = dictGetKey(de);
     if ((newsds = activeDefragSds(sdsele)))
         defragged++, de->key = newsds;
+    if (zs->zbt) {
+        /* The B+tree keeps the scores inside the dict entries, so only the
+         * references to the element from the tree nodes need an update. */
+        if (newsds)
+            zbtReplaceEle(zs->zbt, dictGetDoubleVal(de), sdsele, newsds);
+        return defragged;
+    }
     newscore = zslDefrag(zs->zsl, *(double*)dictGetVal(de), sdsele, newsds);
     if (newscore) {
         dictSetVal(zs->dict, de, newscore);
@@ -417,8 +425,8 @@ long activeDefragQuickListNode(quicklist *ql, quicklistNode **node_ref) {
         *node_ref = node = newnode;
         defragged++;
     }
-    if ((newzl = activeDefragAlloc(node->zl)))
-        defragged++, node->zl = newzl;
+    if ((newzl = activeDefragAlloc(node->entry)))
+        defragged++, node->entry = newzl;
     return defragged;
 }
 
@@ -497,7 +505,8 @@ void scanLaterZsetCallback(void *privdata, const dictEntry *_de) {
 }
 
 long scanLaterZset(robj *ob, unsigned long *cursor) {
-    if (ob->type != OBJ_ZSET || ob->encoding != OBJ_ENCODING_SKIPLIST)
+    if (ob->type != OBJ_ZSET || (ob->encoding != OBJ_ENCODING_SKIPLIST &&
+                                 ob->encoding != OBJ_ENCODING_BTREE))
         return 0;
     zset *zs = (zset*)ob->ptr;
     dict *d = zs->dict;
@@ -515,8 +524,32 @@ void scanLaterSetCallback(void *privdata, const dictEntry *_de) {
     server.stat_active_defrag_scanned++;
 }
 
+/* Defrag the container of the roaring bitmap having the key *cursor-1, or
+ * the next one, setting the cursor to the key of the following container
+ * plus one, or to zero when done. */
+long scanLaterRoaring(roaring *r, unsigned long *cursor) {
+    roaringIterator it;
+    void *newptr;
+
+    roaringInitIterator(r,&it);
+    if (!roaringSeek(&it,*cursor ? *cursor-1 : 0)) {
+        *cursor = 0;
+        return 0;
+    }
+    roaringContainer *c = &r->containers[it.ci];
+    *cursor = it.ci+1 < r->len ? r->containers[it.ci+1].key+1 : 0;
+    server.stat_active_defrag_scanned++;
+    if ((newptr = activeDefragAlloc(c->data))) {
+        c->data = newptr;
+        return 1;
+    }
+    return 0;
+}
+
 long scanLaterSet(robj *ob, unsigned long *cursor) {
     long defragged = 0;
+    if (ob->type == OBJ_SET && ob->encoding == OBJ_ENCODING_ROARING)
+        return scanLaterRoaring(ob->ptr, cursor);
     if (ob->type != OBJ_SET || ob->encoding != OBJ_ENCODING_HT)
         return 0;
     dict *d = ob->ptr;
@@ -592,6 +625,68 @@ long defragZsetSkiplist(redisDb *db, dictEntry *kde) {
     return defragged;
 }
 
+/* Defrag the nodes of the B+tree subtree rooted at 'node', returning the new
+ * address of the node, or NULL if it was not moved. Children are handled
+ * first, so when a leaf moves its neighbours in the leaves list already have
+ * their final address and can be updated to point to the new leaf. */
+void *defragZbtreeNode(zbtree *zbt, void *node, int height, long *defragged) {
+    void *newnode;
+
+    if (height > 0) {
+        zbtreeInner *in = node;
+        for (unsigned int j = 0; j < in->count; j++) {
+            void *newchild = defragZbtreeNode(zbt, in->children[j], height-1,
+                                              defragged);
+            if (newchild) in->children[j] = newchild;
+        }
+        if ((newnode = activeDefragAlloc(node))) (*defragged)++;
+        return newnode;
+    }
+    if ((newnode = activeDefragAlloc(node))) {
+        zbtreeLeaf *leaf = newnode;
+        (*defragged)++;
+        if (leaf->prev) leaf->prev->next = leaf; else zbt->head = leaf;
+        if (leaf->next) leaf->next->prev = leaf; else zbt->tail = leaf;
+    }
+    return newnode;
+}
+
+long defragZsetBtree(redisDb *db, dictEntry *kde) {
+    robj *ob = dictGetVal(kde);
+    long defragged = 0;
+    zset *zs = (zset*)ob->ptr;
+    zset *newzs;
+    zbtree *newzbt;
+    dict *newdict;
+    dictEntry *de;
+    void *newroot;
+    serverAssert(ob->type == OBJ_ZSET && ob->encoding == OBJ_ENCODING_BTREE);
+    if ((newzs = activeDefragAlloc(zs)))
+        defragged++, ob->ptr = zs = newzs;
+    if ((newzbt = activeDefragAlloc(zs->zbt)))
+        defragged++, zs->zbt = newzbt;
+    /* The nodes are few compared to the elements (every leaf holds tens of
+     * them), so they are always handled in a single pass. */
+    if ((newroot = defragZbtreeNode(zs->zbt, zs->zbt->root, zs->zbt->height,
+                                    &defragged)))
+        zs->zbt->root = newroot;
+    if (dictSize(zs->dict) > server.active_defrag_max_scan_fields)
+        defragLater(db, kde);
+    else {
+        dictIterator *di = dictGetIterator(zs->dict);
+        while((de = dictNext(di)) != NULL) {
+            defragged += activeDefragZsetEntry(zs, de);
+        }
+        dictReleaseIterator(di);
+    }
+    /* handle the dict struct */
+    if ((newdict = activeDefragAlloc(zs->dict)))
+        defragged++, zs->dict = newdict;
+    /* defrag the dict tables */
+    defragged += dictDefragTables(zs->dict);
+    return defragged;
+}
+
 long defragHash(redisDb *db, dictEntry *kde) {
     long defragged = 0;
     robj *ob = dictGetVal(kde);
@@ -610,6 +705,32 @@ long defragHash(redisDb *db, dictEntry *kde) {
     return defragged;
 }
 
+long defragRoaringSet(redisDb *db, dictEntry *kde) {
+    long defragged = 0;
+    robj *ob = dictGetVal(kde);
+    roaring *r;
+    void *newptr;
+    serverAssert(ob->type == OBJ_SET && ob->encoding == OBJ_ENCODING_ROARING);
+    /* handle the bitmap struct, the containers array and the rank tree */
+    if ((newptr = activeDefragAlloc(ob->ptr)))
+        defragged++, ob->ptr = newptr;
+    r = ob->ptr;
+    if (r->containers && (newptr = activeDefragAlloc(r->containers)))
+        defragged++, r->containers = newptr;
+    if (r->tree && (newptr = activeDefragAlloc(r->tree)))
+        defragged++, r->tree = newptr;
+    /* handle the containers data */
+    if (r->len > server.active_defrag_max_scan_fields) {
+        defragLater(db, kde);
+    } else {
+        for (uint32_t j = 0; j < r->len; j++) {
+            if ((newptr = activeDefragAlloc(r->containers[j].data)))
+                defragged++, r->containers[j].data = newptr;
+        }
+    }
+    return defragged;
+}
+
 long defragSet(redisDb *db, dictEntry *kde) {
     long defragged = 0;
     robj *ob = dictGetVal(kde);
@@ -815,6 +936,13 @@ long defragKey(redisDb *db, dictEntry *de) {
         uint64_t hash = dictGetHash(db->dict, de->key);
         replaceSateliteDictKeyPtrAndOrDefragDictEntry(db->expires, keysds, newsds, hash, &defragged);
     }
+    if (server.cluster_enabled) {
+        /* The dict of the slot references the key sds as well. */
+        sds key = dictGetKey(de);
+        dict *slotdict = server.cluster->slots_keys[keyHashSlot(key,sdslen(key))];
+        uint64_t hash = dictGetHash(db->dict, key);
+        replaceSateliteDictKeyPtrAndOrDefragDictEntry(slotdict, keysds, newsds, hash, &defragged);
+    }
 
     /* Try to defrag robj and / or string value. */
     ob = dictGetVal(de);
@@ -841,20 +969,27 @@ long defragKey(redisDb *db, dictEntry *de) {
             intset *newis, *is = ob->ptr;
             if ((newis = activeDefragAlloc(is)))
                 defragged++, ob->ptr = newis;
+        } else if (ob->encoding == OBJ_ENCODING_LISTPACK) {
+            if ((newzl = activeDefragAlloc(ob->ptr)))
+                defragged++, ob->ptr = newzl;
+        } else if (ob->encoding == OBJ_ENCODING_ROARING) {
+            defragged += defragRoaringSet(db, de);
         } else {
             serverPanic("Unknown set encoding");
         }
     } else if (ob->type == OBJ_ZSET) {
-        if (ob->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (ob->encoding == OBJ_ENCODING_LISTPACK) {
             if ((newzl = activeDefragAlloc(ob->ptr)))
                 defragged++, ob->ptr = newzl;
         } else if (ob->encoding == OBJ_ENCODING_SKIPLIST) {
             defragged += defragZsetSkiplist(db, de);
+        } else if (ob->encoding == OBJ_ENCODING_BTREE) {
+            defragged += defragZsetBtree(db, de);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
     } else if (ob->type == OBJ_HASH) {
-        if (ob->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (ob->encoding == OBJ_ENCODING_LISTPACK) {
             if ((newzl = activeDefragAlloc(ob->ptr)))
                 defragged++, ob->ptr = newzl;
         } else if (ob->encoding == OBJ_ENCODING_HT) {
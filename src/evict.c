@@ -359,7 +359,7 @@ unsigned long LFUDecrAndReturn(robj *o) {
  * used memory: the eviction should use mostly data size. This function
  * returns the sum of AOF and slaves buffer. */
 size_t freeMemoryGetNotCountedMemory(void) {
-    size_t overhead = 0;
+    size_t overhead = 0, backlog;
     int slaves = listLength(server.slaves);
 
     if (slaves) {
@@ -369,9 +369,18 @@ size_t freeMemoryGetNotCountedMemory(void) {
         listRewind(server.slaves,&li);
         while((ln = listNext(&li))) {
             client *slave = listNodeValue(ln);
-            overhead += getClientOutputBufferMemoryUsage(slave);
+            overhead += getClientOutputBufferMemoryUsage(slave) -
+                        getReplicaPendingReplicationBytes(slave);
         }
     }
+
+    /* The replication buffer is shared with the backlog: what exceeds the
+     * backlog size is used to buffer the slaves output, or holds blocks
+     * that are released incrementally after the slaves went away. */
+    backlog = server.repl_backlog ? (size_t)server.repl_backlog_size : 0;
+    if (server.repl_buffer_mem > backlog)
+        overhead += server.repl_buffer_mem - backlog;
+
     if (server.aof_state != AOF_OFF) {
         overhead += sdsalloc(server.aof_buf)+aofRewriteBufferSize();
     }
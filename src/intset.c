@@ -114,51 +114,102 @@ static intset *intsetResize(intset *is, uint32_t len) {
     return is;
 }
 
+/* Below this number of candidates the lower bound searches switch from
+ * bisection to a linear count. The linear count has no data dependent
+ * branches, so the compiler is able to turn it into vector instructions. */
+#define INTSET_LINEAR_SEARCH 16
+
+/* When a set is this many times larger than the values to intersect with it,
+ * intsetIntersect() gallops instead of merging the two sorted sequences. */
+#define INTSET_GALLOP_RATIO 32
+
+/* Lower bound search over the native array 'a' of the given type: 'base' is
+ * moved to the first of the 'n' elements starting at 'base' that is not
+ * smaller than 'v'. Each bisection step compares the last element of the
+ * lower half and keeps the half that contains the lower bound, without
+ * branching on the data. The remaining candidates are counted linearly:
+ * the ones smaller than 'v' are all before the lower bound. Both 'base'
+ * and 'n' are modified. */
+#define INTSET_LOWER_BOUND(type,a,v,base,n) do { \
+    const type *_a = (const type*)(a); \
+    type _v = (type)(v); \
+    uint32_t _cnt = 0, _i; \
+    while ((n) > INTSET_LINEAR_SEARCH) { \
+        uint32_t _half = (n) >> 1; \
+        (base) = (_a[(base)+_half-1] < _v) ? (base)+_half : (base); \
+        (n) -= _half; \
+    } \
+    for (_i = 0; _i < (n); _i++) _cnt += _a[(base)+_i] < _v; \
+    (base) += _cnt; \
+} while(0)
+
+/* Return the position of the first element not smaller than "value" among
+ * the elements at positions [lo,hi) of the intset, or "hi" when all of them
+ * are smaller. The value may be outside the range of the set encoding. */
+static uint32_t intsetLowerBound(intset *is, int64_t value, uint32_t lo,
+                                 uint32_t hi) {
+    uint8_t enc = intrev32ifbe(is->encoding);
+    uint32_t n = hi-lo;
+
+    if (lo >= hi) return lo;
+    /* A value that doesn't fit the encoding is smaller than every element
+     * when negative, and larger than every element otherwise. */
+    if (_intsetValueEncoding(value) > enc) return value < 0 ? lo : hi;
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+    //小端机器上直接按原生类型读取数组，避免逐个元素转换字节序
+    if (enc == INTSET_ENC_INT64) {
+        INTSET_LOWER_BOUND(int64_t,is->contents,value,lo,n);
+    } else if (enc == INTSET_ENC_INT32) {
+        INTSET_LOWER_BOUND(int32_t,is->contents,value,lo,n);
+    } else {
+        INTSET_LOWER_BOUND(int16_t,is->contents,value,lo,n);
+    }
+#else
+    //二分查找：保证[lo,lo+n)中包含第一个不小于value的位置
+    while (n > 0) {
+        uint32_t half = n >> 1;
+        if (_intsetGetEncoded(is,lo+half,enc) < value) {
+            lo += half+1;
+            n -= half+1;
+        } else {
+            n = half;
+        }
+    }
+#endif
+    return lo;
+}
+
 /* Search for the position of "value". Return 1 when the value was found and
  * sets "pos" to the position of the value within the intset. Return 0 when
  * the value is not present in the intset and sets "pos" to the position
  * where "value" can be inserted. */
 //在intset中查找value并将位置赋值给pos，返回值1代表找到0代表没找到
 static uint8_t intsetSearch(intset *is, int64_t value, uint32_t *pos) {
-    int min = 0, max = intrev32ifbe(is->length)-1, mid = -1;
-    int64_t cur = -1;
+    uint32_t len = intrev32ifbe(is->length), p;
 
     /* The value can never be found when the set is empty */
-    if (intrev32ifbe(is->length) == 0) {//没有数据
+    if (len == 0) {//没有数据
         if (pos) *pos = 0;
         return 0;
-    } else {
-        /* Check for the case where we know we cannot find the value,
-         * but do know the insert position. */
-        if (value > _intsetGet(is,max)) {//如果这个值大于当前intset的最大值
-            if (pos) *pos = intrev32ifbe(is->length);//pos为长度，代表下标越界
-            return 0;
-        } else if (value < _intsetGet(is,0)) {//如果值小于最小值
-            if (pos) *pos = 0;
-            return 0;
-        }
-    }
-    //二分查找
-    while(max >= min) {
-        //中间为的下标 >>1代替/2
-        mid = ((unsigned int)min + (unsigned int)max) >> 1;
-        cur = _intsetGet(is,mid);//获取中间位的数据
-        if (value > cur) {//下标变化
-            min = mid+1;
-        } else if (value < cur) {
-            max = mid-1;
-        } else {
-            break;
-        }
     }
 
-    if (value == cur) {//如果找到数据
-        if (pos) *pos = mid;//pos为数据所在的下标
-        return 1;
-    } else {
-        if (pos) *pos = min;//返回这个值应该插入的pos
+    /* Check for the case where we know we cannot find the value,
+     * but do know the insert position: appending is the common case.
+     * Values smaller than the minimum need no special case, the lower
+     * bound below is 0 for them. */
+    if (value > _intsetGet(is,len-1)) {//如果这个值大于当前intset的最大值
+        if (pos) *pos = len;//pos为长度，代表下标越界
         return 0;
     }
+
+    /* The first element not smaller than "value" is either "value" itself,
+     * or the element that has to be moved to the right to insert "value"
+     * keeping the set sorted: in both cases its position is "pos". */
+    //二分查找第一个不小于value的元素的下标
+    p = intsetLowerBound(is,value,0,len);
+    if (pos) *pos = p;//数据所在的下标，或者这个值应该插入的pos
+    //该下标上的元素等于value说明找到了，否则p就是插入的位置
+    return p < len && _intsetGet(is,p) == value;
 }
 
 /* Upgrades the intset to a larger encoding and inserts the given integer. */
@@ -276,6 +327,52 @@ uint8_t intsetFind(intset *is, int64_t value) {
     return valenc <= intrev32ifbe(is->encoding) && intsetSearch(is,value,NULL);
 }
 
+/* Intersect the intset with the "count" values of the sorted array "vals",
+ * that must not contain duplicates: the values that are not members of the
+ * intset are removed from the array, and the number of remaining values is
+ * returned. When "limit" is not zero the intersection stops as soon as
+ * "limit" common values are found.
+ *
+ * When the array is much smaller than the intset every value is searched
+ * galloping from the position of the previous one, otherwise the two sorted
+ * sequences are merged. */
+uint32_t intsetIntersect(intset *is, int64_t *vals, uint32_t count, uint32_t limit) {
+    uint32_t len = intrev32ifbe(is->length);
+    uint8_t enc = intrev32ifbe(is->encoding);
+    uint32_t i, j = 0, found = 0;
+
+    if (len == 0) return 0;
+    if (limit == 0 || limit > count) limit = count;
+    if ((uint64_t)count*INTSET_GALLOP_RATIO < len) {
+        for (i = 0; i < count && j < len && found < limit; i++) {
+            uint32_t bound = 1, lo, hi;
+
+            /* Double the distance from the last match until we find an
+             * element not smaller than the value, then bisect. */
+            while (j+bound < len && _intsetGetEncoded(is,j+bound,enc) < vals[i])
+                bound <<= 1;
+            lo = j+(bound>>1);
+            hi = (j+bound < len) ? j+bound+1 : len;
+            j = intsetLowerBound(is,vals[i],lo,hi);
+            if (j < len && _intsetGetEncoded(is,j,enc) == vals[i]) {
+                vals[found++] = vals[i];
+                j++;
+            }
+        }
+    } else {
+        int64_t cur = _intsetGetEncoded(is,0,enc);
+
+        for (i = 0; i < count && found < limit; i++) {
+            while (cur < vals[i]) {
+                if (++j == len) return found;
+                cur = _intsetGetEncoded(is,j,enc);
+            }
+            if (cur == vals[i]) vals[found++] = vals[i];
+        }
+    }
+    return found;
+}
+
 /* Return random member */
 //随机获取一个intset中的一个值
 int64_t intsetRandom(intset *is) {
@@ -496,6 +593,79 @@ int intsetTest(int argc, char **argv) {
                num,size,usec()-start);
     }
 
+    printf("Intersection: "); {
+        intset *small;
+        int64_t *vals, v;
+        uint32_t count, found, expected, j;
+
+        for (int bits = 10; bits <= 30; bits += 10) {
+            is = createSet(bits,10000);
+            for (int size = 10; size <= 20000; size *= 10) {
+                small = createSet(bits,size);
+                count = intsetLen(small);
+                vals = zmalloc(sizeof(int64_t)*count);
+                for (j = 0; j < count; j++) intsetGet(small,j,&vals[j]);
+                expected = 0;
+                for (j = 0; j < count; j++)
+                    if (intsetFind(is,vals[j])) expected++;
+                found = intsetIntersect(is,vals,count,0);
+                assert(found == expected);
+                for (j = 0; j < found; j++) {
+                    assert(intsetFind(is,vals[j]));
+                    assert(intsetFind(small,vals[j]));
+                    if (j) assert(vals[j-1] < vals[j]);
+                }
+                if (found > 1) {
+                    int64_t first = vals[0];
+                    for (j = 0; j < count; j++) intsetGet(small,j,&vals[j]);
+                    assert(intsetIntersect(is,vals,count,1) == 1);
+                    assert(vals[0] == first);
+                }
+                zfree(vals);
+                zfree(small);
+            }
+            zfree(is);
+        }
+
+        /* Values outside the range of the set encoding. */
+        is = intsetNew();
+        is = intsetAdd(is,5,NULL);
+        is = intsetAdd(is,7,NULL);
+        v = 4294967295;
+        assert(intsetIntersect(is,&v,1,0) == 0);
+        v = -4294967295;
+        assert(intsetIntersect(is,&v,1,0) == 0);
+        zfree(is);
+        ok();
+    }
+
+    printf("Stress intersections: "); {
+        long num = 100, size = 100000;
+        int bits = 24;
+        long long start;
+        intset *small;
+        int64_t *vals;
+        uint32_t count, j;
+
+        is = createSet(bits,size);
+        for (int smallsize = 100; smallsize <= size; smallsize *= 10) {
+            small = createSet(bits,smallsize);
+            count = intsetLen(small);
+            vals = zmalloc(sizeof(int64_t)*count);
+            start = usec();
+            for (i = 0; i < num; i++) {
+                for (j = 0; j < count; j++) intsetGet(small,j,&vals[j]);
+                intsetIntersect(is,vals,count,0);
+            }
+            printf("\n%ld intersections, %u x %u elements, %lldusec",
+                   num,count,intsetLen(is),usec()-start);
+            zfree(vals);
+            zfree(small);
+        }
+        printf("\n");
+        zfree(is);
+    }
+
     printf("Stress add+delete: "); {
         int i, v1, v2;
         is = intsetNew();
@@ -43,6 +43,7 @@ intset *intsetNew(void);//创建一个空的intset
 intset *intsetAdd(intset *is, int64_t value, uint8_t *success);//插入一个元素，会将最新的对象返回回来
 intset *intsetRemove(intset *is, int64_t value, int *success);//在intset中删除value，返回最新的intset
 uint8_t intsetFind(intset *is, int64_t value);//查看这个value是否在这个intset中
+uint32_t intsetIntersect(intset *is, int64_t *vals, uint32_t count, uint32_t limit);//将有序数组vals中不在intset的值删除，返回剩下的个数
 int64_t intsetRandom(intset *is);//随机获取一个intset中的一个值
 uint8_t intsetGet(intset *is, uint32_t pos, int64_t *value);//获取intset在pos位置的数据将数据赋值给value
 uint32_t intsetLen(const intset *is);//返回intset的长度
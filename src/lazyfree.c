@@ -36,9 +36,15 @@ size_t lazyfreeGetFreeEffort(robj *obj) {
     } else if (obj->type == OBJ_SET && obj->encoding == OBJ_ENCODING_HT) {
         dict *ht = obj->ptr;
         return dictSize(ht);
+    } else if (obj->type == OBJ_SET && obj->encoding == OBJ_ENCODING_ROARING) {
+        roaring *r = obj->ptr;
+        return r->len;
     } else if (obj->type == OBJ_ZSET && obj->encoding == OBJ_ENCODING_SKIPLIST){
         zset *zs = obj->ptr;
         return zs->zsl->length;
+    } else if (obj->type == OBJ_ZSET && obj->encoding == OBJ_ENCODING_BTREE){
+        zset *zs = obj->ptr;
+        return zs->zbt->length;
     } else if (obj->type == OBJ_HASH && obj->encoding == OBJ_ENCODING_HT) {
         dict *ht = obj->ptr;
         return dictSize(ht);
@@ -97,9 +103,10 @@ int dbAsyncDelete(redisDb *db, robj *key) {
     if (de) {//找到元素
         //在调用dictUnlink（）后，需要调用此函数才能真正释放条目。使用'he'=NULL调用此函数是安全的
         //逻辑有问题，6.2.6版本已修改
-        dictFreeUnlinkedEntry(db->dict,de);
-        //集群中需要删除这个key
+        //集群中需要删除这个key，slot的dict引用了key的sds，需在释放前删除
         if (server.cluster_enabled) slotToKeyDel(key->ptr);
+        dictFreeUnlinkedEntry(db->dict,de);
+        rdbMarkKeyDirty(key);
         return 1;
     } else {
         return 0;
@@ -128,15 +135,13 @@ void emptyDbAsync(redisDb *db) {
     bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,oldht1,oldht2);
 }
 
-/* Empty the slots-keys map of Redis CLuster by creating a new empty one
- * and scheduiling the old for lazy freeing. */
+/* Empty the slots-keys map of Redis CLuster by detaching the per slot dicts
+ * and scheduiling them for lazy freeing. */
 void slotToKeyFlushAsync(void) {
-    rax *old = server.cluster->slots_to_keys;
+    dict **old = zmalloc(sizeof(dict*)*CLUSTER_SLOTS);
+    unsigned long numkeys = slotToKeyDetach(old);
 
-    server.cluster->slots_to_keys = raxNew();
-    memset(server.cluster->slots_keys_count,0,
-           sizeof(server.cluster->slots_keys_count));
-    atomicIncr(lazyfree_objects,old->numele);
+    atomicIncr(lazyfree_objects,numkeys);
     bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,NULL,old);
 }
 
@@ -159,10 +164,17 @@ void lazyfreeFreeDatabaseFromBioThread(dict *ht1, dict *ht2) {
     atomicDecr(lazyfree_objects,numkeys);
 }
 
-/* Release the skiplist mapping Redis Cluster keys to slots in the
- * lazyfree thread. */
-void lazyfreeFreeSlotsMapFromBioThread(rax *rt) {
-    size_t len = rt->numele;
-    raxFree(rt);
+/* Release the per slot dicts mapping Redis Cluster slots to keys in the
+ * lazyfree thread. The dicts don't own the keys, so this is safe even if
+ * the keys themselves are being released at the same time. */
+void lazyfreeFreeSlotsMapFromBioThread(dict **slots) {
+    size_t len = 0;
+
+    for (int j = 0; j < CLUSTER_SLOTS; j++) {
+        if (slots[j] == NULL) continue;
+        len += dictSize(slots[j]);
+        dictRelease(slots[j]);
+    }
+    zfree(slots);
     atomicDecr(lazyfree_objects,len);
 }
@@ -568,6 +568,68 @@ unsigned char *lpGet(unsigned char *p, int64_t *count, unsigned char *intbuf) {
     }
 }
 
+/* Like lpGet() but with the same calling convention of ziplistGet(): if the
+ * element is a string it is returned and its length is stored in '*slen',
+ * otherwise NULL is returned and the integer value is stored in '*lval'. */
+unsigned char *lpGetValue(unsigned char *p, unsigned int *slen, long long *lval) {
+    unsigned char *vstr;
+    int64_t ele_len;
+
+    vstr = lpGet(p,&ele_len,NULL);
+    if (vstr) {
+        *slen = ele_len;
+    } else {
+        *lval = ele_len;
+    }
+    return vstr;
+}
+
+/* Return 1 if the element pointed by 'p' is equal to the string 's' of
+ * length 'slen', 0 otherwise. Integer encoded elements are compared by
+ * converting 's' to an integer, which is faster than the other way around. */
+int lpCompare(unsigned char *p, unsigned char *s, uint32_t slen) {
+    unsigned char *value;
+    int64_t sz, sval;
+
+    if (p[0] == LP_EOF) return 0;
+    value = lpGet(p,&sz,NULL);
+    if (value) return (slen == sz) && memcmp(value,s,slen) == 0;
+    if (lpStringToInt64((const char*)s,slen,&sval)) return sz == sval;
+    return 0;
+}
+
+/* Find the element equal to the string 's' of length 'slen', starting the
+ * search at the element pointed by 'p' and skipping 'skip' elements between
+ * every comparison (so a skip of 1 only looks at the fields of a listpack of
+ * field-value pairs). Returns NULL when the element could not be found.
+ *
+ * The integer value of 's', if any, is computed only once, so that integer
+ * encoded elements are compared without converting them to strings. */
+unsigned char *lpFind(unsigned char *lp, unsigned char *p, unsigned char *s, uint32_t slen, unsigned int skip) {
+    int skipcnt = 0;
+    int sval_valid = -1; /* -1: not computed yet, 0: not an integer. */
+    int64_t sval = 0;
+
+    while (p) {
+        if (skipcnt == 0) {
+            int64_t count;
+            unsigned char *value = lpGet(p,&count,NULL);
+            if (value) {
+                if (count == slen && memcmp(value,s,slen) == 0) return p;
+            } else {
+                if (sval_valid == -1)
+                    sval_valid = lpStringToInt64((const char*)s,slen,&sval);
+                if (sval_valid && count == sval) return p;
+            }
+            skipcnt = skip;
+        } else {
+            skipcnt--;
+        }
+        p = lpNext(lp,p);
+    }
+    return NULL;
+}
+
 /* Insert, delete or replace the specified element 'ele' of length 'len' at
  * the specified position 'p', with 'p' being a listpack element pointer
  * obtained with lpFirst(), lpLast(), lpIndex(), lpNext(), lpPrev() or
@@ -739,6 +801,22 @@ unsigned char *lpAppend(unsigned char *lp, unsigned char *ele, uint32_t size) {
     return lpInsert(lp,ele,size,eofptr,LP_BEFORE,NULL);
 }
 
+/* Prepend the specified element 'ele' of length 'len' at the start of the
+ * listpack. It is implemented in terms of lpInsert(), so the return value is
+ * the same as lpInsert(). */
+unsigned char *lpPrepend(unsigned char *lp, unsigned char *ele, uint32_t size) {
+    unsigned char *p = lpFirst(lp);
+    if (!p) return lpAppend(lp,ele,size);
+    return lpInsert(lp,ele,size,p,LP_BEFORE,NULL);
+}
+
+/* Replace the element pointed by '*p' with the element 'ele' of length
+ * 'len'. On return '*p' points to the new element. The return value is the
+ * same as lpInsert(). */
+unsigned char *lpReplace(unsigned char *lp, unsigned char **p, unsigned char *ele, uint32_t size) {
+    return lpInsert(lp,ele,size,*p,LP_REPLACE,p);
+}
+
 /* Remove the element pointed by 'p', and return the resulting listpack.
  * If 'newp' is not NULL, the next element pointer (to the right of the
  * deleted one) is returned by reference. If the deleted element was the
@@ -747,11 +825,204 @@ unsigned char *lpDelete(unsigned char *lp, unsigned char *p, unsigned char **new
     return lpInsert(lp,NULL,0,p,LP_REPLACE,newp);
 }
 
+/* Delete 'num' consecutive elements starting at the element with the
+ * specified zero-based 'index' (negative indexes count from the tail as in
+ * lpSeek()). If there are less than 'num' elements after 'index', all of
+ * them are deleted. The elements are removed with a single memmove(), so
+ * the cost does not depend on the number of deleted elements. The
+ * resulting listpack is returned. */
+unsigned char *lpDeleteRange(unsigned char *lp, long index, unsigned long num) {
+    unsigned char *first, *tail;
+    uint32_t numele = lpGetNumElements(lp);
+    uint32_t bytes = lpGetTotalBytes(lp);
+    unsigned long deleted = 0;
+
+    if (num == 0) return lp;
+    if ((first = lpSeek(lp,index)) == NULL) return lp;
+
+    /* Find the first element after the range, or the EOF. */
+    tail = first;
+    while (tail[0] != LP_EOF && deleted < num) {
+        tail = lpSkip(tail);
+        deleted++;
+    }
+
+    /* Move the tail of the listpack, EOF included, over the range. */
+    memmove(first,tail,(lp+bytes)-tail);
+    bytes -= tail-first;
+    lpSetTotalBytes(lp,bytes);
+    if (numele != LP_HDR_NUMELE_UNKNOWN) lpSetNumElements(lp,numele-deleted);
+    return lp_realloc(lp,bytes);
+}
+
+/* Merge listpacks 'first' and 'second' by appending 'second' to 'first'.
+ *
+ * NOTE: The larger listpack is reallocated to contain the new merged listpack.
+ * Either 'first' or 'second' can be used for the result. The parameter not
+ * used will be free'd and set to NULL.
+ *
+ * After calling this function, the input parameters are no longer valid since
+ * they are changed and free'd in-place.
+ *
+ * The result listpack is the contents of 'first' followed by 'second'.
+ *
+ * On failure: returns NULL if the merge is impossible.
+ * On success: returns the merged listpack (which is expanded version of either
+ * 'first' or 'second', also frees the other unused input listpack, and sets the
+ * input listpack argument equal to newly reallocated listpack return value. */
+unsigned char *lpMerge(unsigned char **first, unsigned char **second) {
+    /* If any params are null, we can't merge, so NULL. */
+    if (first == NULL || *first == NULL || second == NULL || *second == NULL)
+        return NULL;
+
+    /* Can't merge same list into itself. */
+    if (*first == *second)
+        return NULL;
+
+    unsigned char *lp1 = *first, *lp2 = *second;
+    size_t lp1bytes = lpBytes(lp1), lp2bytes = lpBytes(lp2);
+    size_t lp1len = lpLength(lp1), lp2len = lpLength(lp2);
+
+    /* We realloc the larger listpack, and append or prepend the other one,
+     * so that we move as little memory as possible. */
+    int append;
+    unsigned char *source, *target;
+    size_t sourcebytes, targetbytes;
+    if (lp1len >= lp2len) {
+        target = lp1; targetbytes = lp1bytes;
+        source = lp2; sourcebytes = lp2bytes;
+        append = 1;
+    } else {
+        target = lp2; targetbytes = lp2bytes;
+        source = lp1; sourcebytes = lp1bytes;
+        append = 0;
+    }
+
+    /* Total bytes in the new listpack, with a single header and EOF. */
+    size_t lpbytes = lp1bytes + lp2bytes - LP_HDR_SIZE - 1;
+    if (lpbytes > UINT32_MAX) return NULL;
+    size_t lplength = lp1len + lp2len;
+    if (lplength > LP_HDR_NUMELE_UNKNOWN) lplength = LP_HDR_NUMELE_UNKNOWN;
+
+    target = lp_realloc(target,lpbytes);
+    if (append) {
+        /* [TARGET - EOF, SOURCE - HEADER] */
+        memcpy(target+targetbytes-1,source+LP_HDR_SIZE,
+               sourcebytes-LP_HDR_SIZE);
+    } else {
+        /* [SOURCE - EOF, TARGET - HEADER] */
+        memmove(target+sourcebytes-1,target+LP_HDR_SIZE,
+                targetbytes-LP_HDR_SIZE);
+        memcpy(target,source,sourcebytes-1);
+    }
+    lpSetNumElements(target,lplength);
+    lpSetTotalBytes(target,lpbytes);
+
+    /* Now free and NULL out what we didn't realloc. */
+    if (append) {
+        lp_free(*second);
+        *second = NULL;
+        *first = target;
+    } else {
+        lp_free(*first);
+        *first = NULL;
+        *second = target;
+    }
+    return target;
+}
+
 /* Return the total number of bytes the listpack is composed of. */
 uint32_t lpBytes(unsigned char *lp) {
     return lpGetTotalBytes(lp);
 }
 
+/* Check the integrity of a listpack of 'size' bytes loaded from an untrusted
+ * source, like an RDB file: the header must match the size, and every entry
+ * must be correctly encoded and end before the EOF byte. Returns 1 if the
+ * listpack is valid, 0 otherwise. */
+int lpValidateIntegrity(unsigned char *lp, size_t size) {
+    unsigned char *p, *eof;
+    uint32_t count = 0;
+
+    if (size < LP_HDR_SIZE+1 || lpGetTotalBytes(lp) != size) return 0;
+    eof = lp+size-1;
+    if (eof[0] != LP_EOF) return 0;
+
+    p = lp+LP_HDR_SIZE;
+    while (p < eof) {
+        size_t avail = eof-p;
+        uint64_t encsize, entrylen;
+
+        /* Make sure the length of the string is inside the listpack
+         * before reading it. */
+        if (LP_ENCODING_IS_12BIT_STR(p[0]) && avail < 2) return 0;
+        if (LP_ENCODING_IS_32BIT_STR(p[0]) &&
+            (avail < 5 || LP_ENCODING_32BIT_STR_LEN(p) > avail)) return 0;
+        if ((encsize = lpCurrentEncodedSize(p)) == 0) return 0;
+        entrylen = encsize+lpEncodeBacklen(NULL,encsize);
+        if (entrylen > avail) return 0;
+        if (lpDecodeBacklen(p+entrylen-1) != encsize) return 0;
+        p += entrylen;
+        count++;
+    }
+    if (p != eof) return 0;
+    if (lpGetNumElements(lp) != LP_HDR_NUMELE_UNKNOWN &&
+        lpGetNumElements(lp) != count) return 0;
+    return 1;
+}
+
+/* Return an upper bound of the bytes needed to store a string element of
+ * 'size' bytes in a listpack: encoding header, data and backlen. */
+size_t lpEntrySizeUpperBound(size_t size) {
+    size_t enclen = size + (size < 64 ? 1 : size < 4096 ? 2 : 5);
+    return enclen + lpEncodeBacklen(NULL,enclen);
+}
+
+/* Print the listpack structure on stdout, one block per element. */
+void lpRepr(unsigned char *lp) {
+    unsigned char *p, *vstr;
+    int64_t vlen;
+    unsigned char intbuf[LP_INTBUF_SIZE];
+    int index = 0;
+
+    printf("{total bytes %u} {num entries %u}\n",
+        lpGetTotalBytes(lp), lpGetNumElements(lp));
+    p = lpFirst(lp);
+    while(p) {
+        uint32_t encoded_size = lpCurrentEncodedSize(p);
+        unsigned long back_len = lpEncodeBacklen(NULL,encoded_size);
+        printf(
+            "{\n"
+                "\taddr 0x%08lx,\n"
+                "\tindex %2d,\n"
+                "\toffset %5lu,\n"
+                "\thdr+entry len: %5u,\n"
+                "\tbacklen len: %2lu,\n",
+            (long unsigned)p,
+            index,
+            (unsigned long) (p-lp),
+            encoded_size,
+            back_len);
+        printf("\tbytes: ");
+        for (unsigned long i = 0; i < encoded_size+back_len; i++) {
+            printf("%02x|",p[i]);
+        }
+        printf("\n");
+        vstr = lpGet(p,&vlen,intbuf);
+        printf("\t[str]");
+        if (vlen > 40) {
+            if (fwrite(vstr,40,1,stdout) == 0) perror("fwrite");
+            printf("...");
+        } else {
+            if (fwrite(vstr,vlen,1,stdout) == 0) perror("fwrite");
+        }
+        printf("\n}\n");
+        index++;
+        p = lpNext(lp,p);
+    }
+    printf("{end}\n\n");
+}
+
 /* Seek the specified element and returns the pointer to the seeked element.
  * Positive indexes specify the zero-based element to seek from the head to
  * the tail, negative indexes specify elements starting from the tail, where
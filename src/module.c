@@ -184,6 +184,8 @@ struct RedisModuleKey {
     uint32_t zstart;        /* Start pos for positional ranges. */
     uint32_t zend;          /* End pos for positional ranges. */
     void *zcurrent;         /* Zset iterator current node. */
+    zbtreePos zpos;         /* Zset iterator position for the B+tree
+                               encoding, zcurrent is its leaf. */
     int zer;                /* Zset iterator end reached flag
                                (true if end was reached). */
 };
@@ -509,7 +511,7 @@ int moduleCreateEmptyKey(RedisModuleKey *key, int type) {
                             server.list_compress_depth);
         break;
     case REDISMODULE_KEYTYPE_ZSET:
-        obj = createZsetZiplistObject();
+        obj = createZsetListpackObject();
         break;
     case REDISMODULE_KEYTYPE_HASH:
         obj = createHashObject();
@@ -2481,7 +2483,7 @@ int zsetInitScoreRange(RedisModuleKey *key, double min, double max, int minex, i
     zrs->minex = minex;
     zrs->maxex = maxex;
 
-    if (key->value->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (key->value->encoding == OBJ_ENCODING_LISTPACK) {
         key->zcurrent = first ? zzlFirstInRange(key->value->ptr,zrs) :
                                 zzlLastInRange(key->value->ptr,zrs);
     } else if (key->value->encoding == OBJ_ENCODING_SKIPLIST) {
@@ -2489,6 +2491,11 @@ int zsetInitScoreRange(RedisModuleKey *key, double min, double max, int minex, i
         zskiplist *zsl = zs->zsl;
         key->zcurrent = first ? zslFirstInRange(zsl,zrs) :
                                 zslLastInRange(zsl,zrs);
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = key->value->ptr;
+        int found = first ? zbtFirstInRange(zs->zbt,zrs,&key->zpos) :
+                            zbtLastInRange(zs->zbt,zrs,&key->zpos);
+        key->zcurrent = found ? key->zpos.leaf : NULL;
     } else {
         serverPanic("Unsupported zset encoding");
     }
@@ -2545,7 +2552,7 @@ int zsetInitLexRange(RedisModuleKey *key, RedisModuleString *min, RedisModuleStr
      * otherwise we don't want the zlexrangespec to be freed. */
     key->ztype = REDISMODULE_ZSET_RANGE_LEX;
 
-    if (key->value->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (key->value->encoding == OBJ_ENCODING_LISTPACK) {
         key->zcurrent = first ? zzlFirstInLexRange(key->value->ptr,zlrs) :
                                 zzlLastInLexRange(key->value->ptr,zlrs);
     } else if (key->value->encoding == OBJ_ENCODING_SKIPLIST) {
@@ -2553,6 +2560,11 @@ int zsetInitLexRange(RedisModuleKey *key, RedisModuleString *min, RedisModuleStr
         zskiplist *zsl = zs->zsl;
         key->zcurrent = first ? zslFirstInLexRange(zsl,zlrs) :
                                 zslLastInLexRange(zsl,zlrs);
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = key->value->ptr;
+        int found = first ? zbtFirstInLexRange(zs->zbt,zlrs,&key->zpos) :
+                            zbtLastInLexRange(zs->zbt,zlrs,&key->zpos);
+        key->zcurrent = found ? key->zpos.leaf : NULL;
     } else {
         serverPanic("Unsupported zset encoding");
     }
@@ -2590,12 +2602,12 @@ RedisModuleString *RM_ZsetRangeCurrentElement(RedisModuleKey *key, double *score
     RedisModuleString *str;
 
     if (key->zcurrent == NULL) return NULL;
-    if (key->value->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (key->value->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *eptr, *sptr;
         eptr = key->zcurrent;
-        sds ele = ziplistGetObject(eptr);
+        sds ele = lpGetObject(eptr);
         if (score) {
-            sptr = ziplistNext(key->value->ptr,eptr);
+            sptr = lpNext(key->value->ptr,eptr);
             *score = zzlGetScore(sptr);
         }
         str = createObject(OBJ_STRING,ele);
@@ -2603,6 +2615,10 @@ RedisModuleString *RM_ZsetRangeCurrentElement(RedisModuleKey *key, double *score
         zskiplistNode *ln = key->zcurrent;
         if (score) *score = ln->score;
         str = createStringObject(ln->ele,sdslen(ln->ele));
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
+        zbtreeEntry *e = zbtPosEntry(&key->zpos);
+        if (score) *score = e->score;
+        str = createStringObject(e->ele,sdslen(e->ele));
     } else {
         serverPanic("Unsupported zset encoding");
     }
@@ -2616,12 +2632,12 @@ RedisModuleString *RM_ZsetRangeCurrentElement(RedisModuleKey *key, double *score
 int RM_ZsetRangeNext(RedisModuleKey *key) {
     if (!key->ztype || !key->zcurrent) return 0; /* No active iterator. */
 
-    if (key->value->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (key->value->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = key->value->ptr;
         unsigned char *eptr = key->zcurrent;
         unsigned char *next;
-        next = ziplistNext(zl,eptr); /* Skip element. */
-        if (next) next = ziplistNext(zl,next); /* Skip score. */
+        next = lpNext(zl,eptr); /* Skip element. */
+        if (next) next = lpNext(zl,next); /* Skip score. */
         if (next == NULL) {
             key->zer = 1;
             return 0;
@@ -2631,7 +2647,7 @@ int RM_ZsetRangeNext(RedisModuleKey *key) {
                 /* Fetch the next element score for the
                  * range check. */
                 unsigned char *saved_next = next;
-                next = ziplistNext(zl,next); /* Skip next element. */
+                next = lpNext(zl,next); /* Skip next element. */
                 double score = zzlGetScore(next); /* Obtain the next score. */
                 if (!zslValueLteMax(score,&key->zrs)) {
                     key->zer = 1;
@@ -2668,6 +2684,26 @@ int RM_ZsetRangeNext(RedisModuleKey *key) {
             key->zcurrent = next;
             return 1;
         }
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
+        zbtreePos next = key->zpos;
+        zbtreeEntry *e;
+        if (!zbtNext(&next)) {
+            key->zer = 1;
+            return 0;
+        }
+        /* Are we still within the range? */
+        e = zbtPosEntry(&next);
+        if ((key->ztype == REDISMODULE_ZSET_RANGE_SCORE &&
+             !zslValueLteMax(e->score,&key->zrs)) ||
+            (key->ztype == REDISMODULE_ZSET_RANGE_LEX &&
+             !zslLexValueLteMax(e->ele,&key->zlrs)))
+        {
+            key->zer = 1;
+            return 0;
+        }
+        key->zpos = next;
+        key->zcurrent = next.leaf;
+        return 1;
     } else {
         serverPanic("Unsupported zset encoding");
     }
@@ -2679,12 +2715,12 @@ int RM_ZsetRangeNext(RedisModuleKey *key) {
 int RM_ZsetRangePrev(RedisModuleKey *key) {
     if (!key->ztype || !key->zcurrent) return 0; /* No active iterator. */
 
-    if (key->value->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (key->value->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = key->value->ptr;
         unsigned char *eptr = key->zcurrent;
         unsigned char *prev;
-        prev = ziplistPrev(zl,eptr); /* Go back to previous score. */
-        if (prev) prev = ziplistPrev(zl,prev); /* Back to previous ele. */
+        prev = lpPrev(zl,eptr); /* Go back to previous score. */
+        if (prev) prev = lpPrev(zl,prev); /* Back to previous ele. */
         if (prev == NULL) {
             key->zer = 1;
             return 0;
@@ -2694,7 +2730,7 @@ int RM_ZsetRangePrev(RedisModuleKey *key) {
                 /* Fetch the previous element score for the
                  * range check. */
                 unsigned char *saved_prev = prev;
-                prev = ziplistNext(zl,prev); /* Skip element to get the score.*/
+                prev = lpNext(zl,prev); /* Skip element to get the score.*/
                 double score = zzlGetScore(prev); /* Obtain the prev score. */
                 if (!zslValueGteMin(score,&key->zrs)) {
                     key->zer = 1;
@@ -2731,6 +2767,26 @@ int RM_ZsetRangePrev(RedisModuleKey *key) {
             key->zcurrent = prev;
             return 1;
         }
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
+        zbtreePos prev = key->zpos;
+        zbtreeEntry *e;
+        if (!zbtPrev(&prev)) {
+            key->zer = 1;
+            return 0;
+        }
+        /* Are we still within the range? */
+        e = zbtPosEntry(&prev);
+        if ((key->ztype == REDISMODULE_ZSET_RANGE_SCORE &&
+             !zslValueGteMin(e->score,&key->zrs)) ||
+            (key->ztype == REDISMODULE_ZSET_RANGE_LEX &&
+             !zslLexValueGteMin(e->ele,&key->zlrs)))
+        {
+            key->zer = 1;
+            return 0;
+        }
+        key->zpos = prev;
+        key->zcurrent = prev.leaf;
+        return 1;
     } else {
         serverPanic("Unsupported zset encoding");
     }
@@ -6619,8 +6675,7 @@ static void moduleScanKeyCallback(void *privdata, const dictEntry *de) {
         sds val = dictGetVal(de);
         value = createStringObject(val, sdslen(val));
     } else if (o->type == OBJ_ZSET) {
-        double *val = (double*)dictGetVal(de);
-        value = createStringObjectFromLongDouble(*val, 0);
+        value = createStringObjectFromLongDouble(zsetDictGetScore(o->ptr,de), 0);
     }
 
     data->fn(data->key, field, value, data->user_data);
@@ -6686,7 +6741,8 @@ int RM_ScanKey(RedisModuleKey *key, RedisModuleScanCursor *cursor, RedisModuleSc
         if (o->encoding == OBJ_ENCODING_HT)
             ht = o->ptr;
     } else if (o->type == OBJ_ZSET) {
-        if (o->encoding == OBJ_ENCODING_SKIPLIST)
+        if (o->encoding == OBJ_ENCODING_SKIPLIST ||
+            o->encoding == OBJ_ENCODING_BTREE)
             ht = ((zset *)o->ptr)->dict;
     } else {
         errno = EINVAL;
@@ -6715,23 +6771,52 @@ int RM_ScanKey(RedisModuleKey *key, RedisModuleScanCursor *cursor, RedisModuleSc
         cursor->cursor = 1;
         cursor->done = 1;
         ret = 0;
+    } else if (o->type == OBJ_SET && o->encoding == OBJ_ENCODING_ROARING) {
+        roaringIterator it;
+        int64_t ll;
+        roaringInitIterator(o->ptr,&it);
+        while(roaringNext(&it,&ll)) {
+            robj *field = createStringObjectFromLongLong(ll);
+            fn(key, field, NULL, privdata);
+            decrRefCount(field);
+        }
+        cursor->cursor = 1;
+        cursor->done = 1;
+        ret = 0;
+    } else if (o->type == OBJ_SET && o->encoding == OBJ_ENCODING_LISTPACK) {
+        unsigned char *p = lpFirst(o->ptr);
+        unsigned char *vstr;
+        unsigned int vlen;
+        long long vll;
+        while(p) {
+            vstr = lpGetValue(p,&vlen,&vll);
+            robj *field = (vstr != NULL) ?
+                createStringObject((char*)vstr,vlen) :
+                createStringObjectFromLongLong(vll);
+            fn(key, field, NULL, privdata);
+            p = lpNext(o->ptr,p);
+            decrRefCount(field);
+        }
+        cursor->cursor = 1;
+        cursor->done = 1;
+        ret = 0;
     } else if (o->type == OBJ_HASH || o->type == OBJ_ZSET) {
-        unsigned char *p = ziplistIndex(o->ptr,0);
+        unsigned char *p = lpSeek(o->ptr,0);
         unsigned char *vstr;
         unsigned int vlen;
         long long vll;
         while(p) {
-            ziplistGet(p,&vstr,&vlen,&vll);
+            vstr = lpGetValue(p,&vlen,&vll);
             robj *field = (vstr != NULL) ?
                 createStringObject((char*)vstr,vlen) :
                 createStringObjectFromLongLong(vll);
-            p = ziplistNext(o->ptr,p);
-            ziplistGet(p,&vstr,&vlen,&vll);
+            p = lpNext(o->ptr,p);
+            vstr = lpGetValue(p,&vlen,&vll);
             robj *value = (vstr != NULL) ?
                 createStringObject((char*)vstr,vlen) :
                 createStringObjectFromLongLong(vll);
             fn(key, field, value, privdata);
-            p = ziplistNext(o->ptr,p);
+            p = lpNext(o->ptr,p);
             decrRefCount(field);
             decrRefCount(value);
         }
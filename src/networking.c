@@ -128,6 +128,8 @@ client *createClient(connection *conn) {
                        !(c->user->flags & USER_FLAG_DISABLED);
     c->replstate = REPL_STATE_NONE;
     c->repl_put_online_on_ack = 0;
+    c->repl_from_spool = 0;
+    c->repl_filter = NULL;
     c->reploff = 0;
     c->read_reploff = 0;
     c->repl_ack_off = 0;
@@ -137,6 +139,9 @@ client *createClient(connection *conn) {
     c->slave_capa = SLAVE_CAPA_NONE;
     c->reply = listCreate();
     c->reply_bytes = 0;
+    c->cmd_reply_bytes = 0;
+    c->ref_repl_buf_node = NULL;
+    c->ref_block_pos = 0;
     c->obuf_soft_limit_reached_time = 0;
     listSetFreeMethod(c->reply,freeClientReplyValue);
     listSetDupMethod(c->reply,dupClientReplyValue);
@@ -153,6 +158,7 @@ client *createClient(connection *conn) {
     c->watched_keys = listCreate();
     c->pubsub_channels = dictCreate(&objectKeyPointerValueDictType,NULL);
     c->pubsub_patterns = listCreate();
+    c->pubsubshard_channels = dictCreate(&objectKeyPointerValueDictType,NULL);
     c->peerid = NULL;
     c->client_list_node = NULL;
     c->client_tracking_redirection = 0;
@@ -258,11 +264,13 @@ int _addReplyToBuffer(client *c, const char *s, size_t len) {
 
     memcpy(c->buf+c->bufpos,s,len);
     c->bufpos+=len;
+    c->cmd_reply_bytes += len;
     return C_OK;
 }
 
 void _addReplyProtoToList(client *c, const char *s, size_t len) {
     if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
+    c->cmd_reply_bytes += len;
 
     listNode *ln = listLast(c->reply);
     clientReplyBlock *tail = ln? listNodeValue(ln): NULL;
@@ -492,6 +500,7 @@ void setDeferredAggregateLen(client *c, void *node, long length, char prefix) {
      * we return NULL in addReplyDeferredLen() */
     if (node == NULL) return;
     serverAssert(!listNodeValue(ln));
+    c->cmd_reply_bytes += lenstr_len;
 
     /* Normally we fill this dummy NULL node, added by addReplyDeferredLen(),
      * with a new buffer structure containing the protocol needed to specify
@@ -822,8 +831,14 @@ void copyClientOutputBuffer(client *dst, client *src) {
 }
 
 /* Return true if the specified client has pending reply buffers to write to
- * the socket. */
+ * the socket. For replicas this includes the part of the shared replication
+ * buffer they did not receive yet. */
 int clientHasPendingReplies(client *c) {
+    if (c->ref_repl_buf_node) {
+        replBufBlock *o = listNodeValue(c->ref_repl_buf_node);
+        if (c->ref_block_pos < o->used ||
+            listNextNode(c->ref_repl_buf_node)) return 1;
+    }
     return c->bufpos || listLength(c->reply);
 }
 
@@ -1158,7 +1173,9 @@ void freeClient(client *c) {
     /* Unsubscribe from all the pubsub channels */
     pubsubUnsubscribeAllChannels(c,0);
     pubsubUnsubscribeAllPatterns(c,0);
+    pubsubUnsubscribeShardAllChannels(c,0);
     dictRelease(c->pubsub_channels);
+    dictRelease(c->pubsubshard_channels);
     listRelease(c->pubsub_patterns);
 
     /* Free data structures. */
@@ -1177,10 +1194,14 @@ void freeClient(client *c) {
             if (c->repldbfd != -1) close(c->repldbfd);
             if (c->replpreamble) sdsfree(c->replpreamble);
         }
+        if (c->repl_from_spool) replicationSpoolRemoveReader(c);
+        if (c->repl_filter && !(c->flags & CLIENT_MONITOR))
+            server.repl_filtered_slaves--;
         list *l = (c->flags & CLIENT_MONITOR) ? server.monitors : server.slaves;
         ln = listSearchKey(l,c);
         serverAssert(ln != NULL);
         listDelNode(l,ln);
+        replicaReleaseReplicationBuffer(c);
         /* We need to remember the time when we started to have zero
          * attached slaves, as after some time we'll free the replication
          * backlog. */
@@ -1209,6 +1230,7 @@ void freeClient(client *c) {
     zfree(c->argv);
     freeClientMultiState(c);
     sdsfree(c->peerid);
+    replFilterFree(c->repl_filter);
     zfree(c);
 }
 
@@ -1291,7 +1313,7 @@ int writeToClient(client *c, int handler_installed) {
                 c->bufpos = 0;
                 c->sentlen = 0;
             }
-        } else {
+        } else if (listLength(c->reply)) {
             o = listNodeValue(listFirst(c->reply));
             objlen = o->used;
 
@@ -1316,6 +1338,21 @@ int writeToClient(client *c, int handler_installed) {
                 if (listLength(c->reply) == 0)
                     serverAssert(c->reply_bytes == 0);
             }
+        } else {
+            /* Replicas: send the shared replication buffer starting from
+             * the block they reference. */
+            replBufBlock *rb = listNodeValue(c->ref_repl_buf_node);
+
+            if (c->ref_block_pos == rb->used) {
+                replicaAdvanceReplicationBuffer(c);
+                continue;
+            }
+            nwritten = connWrite(c->conn, rb->buf + c->ref_block_pos,
+                                 rb->used - c->ref_block_pos);
+            if (nwritten <= 0) break;
+            c->ref_block_pos += nwritten;
+            totwritten += nwritten;
+            if (c->ref_block_pos == rb->used) replicaAdvanceReplicationBuffer(c);
         }
         /* Note that we avoid to send more than NET_MAX_WRITES_PER_EVENT
          * bytes, in a single threaded server it's a good idea to serve
@@ -2648,7 +2685,8 @@ void rewriteClientCommandArgument(client *c, int i, robj *newval) {
  * enforcing the client output length limits. */
 unsigned long getClientOutputBufferMemoryUsage(client *c) {
     unsigned long list_item_size = sizeof(listNode) + sizeof(clientReplyBlock);
-    return c->reply_bytes + (list_item_size*listLength(c->reply));
+    return c->reply_bytes + (list_item_size*listLength(c->reply)) +
+           getReplicaPendingReplicationBytes(c);
 }
 
 /* Get the class of a client, used in order to enforce limits to different
@@ -2743,7 +2781,8 @@ int checkClientOutputBufferLimits(client *c) {
 void asyncCloseClientOnOutputBufferLimitReached(client *c) {
     if (!c->conn) return; /* It is unsafe to free fake clients. */
     serverAssert(c->reply_bytes < SIZE_MAX-(1024*64));
-    if (c->reply_bytes == 0 || c->flags & CLIENT_CLOSE_ASAP) return;
+    if ((c->reply_bytes == 0 && c->ref_repl_buf_node == NULL) ||
+        c->flags & CLIENT_CLOSE_ASAP) return;
     if (checkClientOutputBufferLimits(c)) {
         sds client = catClientInfoString(sdsempty(),c);
 
@@ -3047,7 +3086,10 @@ int handleClientsWithPendingWritesUsingThreads(void) {
     while((ln = listNext(&li))) {
         client *c = listNodeValue(ln);
         c->flags &= ~CLIENT_PENDING_WRITE;
-        int target_id = item_id % server.io_threads_num;
+        /* Replicas release the blocks of the shared replication buffer
+         * as they are sent: serve them from the main thread. */
+        int target_id = c->ref_repl_buf_node ? 0 :
+                        item_id % server.io_threads_num;
         listAddNodeTail(io_threads_list[target_id],c);
         item_id++;
     }
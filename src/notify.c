@@ -115,6 +115,9 @@ void notifyKeyspaceEvent(int type, char *event, robj *key, int dbid) {
      * they are interested in. */
      moduleNotifyKeyspaceEvent(type, event, key, dbid);
 
+    /* Nothing is published while the AOF is replayed in fast load mode. */
+    if (server.aof_fast_loading) return;
+
     /* If notifications for this class of events are off, return ASAP. */
     if (!(server.notify_keyspace_events & type)) return;
 
@@ -264,28 +264,51 @@ robj *createIntsetObject(void) {
     return o;
 }
 
+//创建listpack类型的set
+robj *createSetListpackObject(void) {
+    unsigned char *lp = lpNew();
+    robj *o = createObject(OBJ_SET,lp);
+    o->encoding = OBJ_ENCODING_LISTPACK;
+    return o;
+}
+
+//创建roaring bitmap类型的set
+robj *createSetRoaringObject(void) {
+    roaring *r = roaringNew();
+    robj *o = createObject(OBJ_SET,r);
+    o->encoding = OBJ_ENCODING_ROARING;
+    return o;
+}
+
 robj *createHashObject(void) {
-    unsigned char *zl = ziplistNew();
+    unsigned char *zl = lpNew();
     robj *o = createObject(OBJ_HASH, zl);
-    o->encoding = OBJ_ENCODING_ZIPLIST;
+    o->encoding = OBJ_ENCODING_LISTPACK;
     return o;
 }
 
+//创建skiplist编码的zset，zset-btree-encoding打开时创建B+树编码的zset
 robj *createZsetObject(void) {
     zset *zs = zmalloc(sizeof(*zs));
     robj *o;
 
     zs->dict = dictCreate(&zsetDictType,NULL);
-    zs->zsl = zslCreate();
+    if (server.zset_btree_encoding) {
+        zs->zsl = NULL;
+        zs->zbt = zbtCreate();
+    } else {
+        zs->zsl = zslCreate();
+        zs->zbt = NULL;
+    }
     o = createObject(OBJ_ZSET,zs);
-    o->encoding = OBJ_ENCODING_SKIPLIST;
+    o->encoding = zs->zbt ? OBJ_ENCODING_BTREE : OBJ_ENCODING_SKIPLIST;
     return o;
 }
 
-robj *createZsetZiplistObject(void) {
-    unsigned char *zl = ziplistNew();
-    robj *o = createObject(OBJ_ZSET,zl);
-    o->encoding = OBJ_ENCODING_ZIPLIST;
+robj *createZsetListpackObject(void) {
+    unsigned char *lp = lpNew();
+    robj *o = createObject(OBJ_ZSET,lp);
+    o->encoding = OBJ_ENCODING_LISTPACK;
     return o;
 }
 
@@ -325,6 +348,12 @@ void freeSetObject(robj *o) {
     case OBJ_ENCODING_INTSET:
         zfree(o->ptr);
         break;
+    case OBJ_ENCODING_LISTPACK:
+        lpFree(o->ptr);
+        break;
+    case OBJ_ENCODING_ROARING:
+        roaringFree(o->ptr);
+        break;
     default:
         serverPanic("Unknown set encoding type");
     }
@@ -339,8 +368,14 @@ void freeZsetObject(robj *o) {
         zslFree(zs->zsl);
         zfree(zs);
         break;
-    case OBJ_ENCODING_ZIPLIST:
-        zfree(o->ptr);
+    case OBJ_ENCODING_BTREE:
+        zs = o->ptr;
+        dictRelease(zs->dict);
+        zbtFree(zs->zbt);
+        zfree(zs);
+        break;
+    case OBJ_ENCODING_LISTPACK:
+        lpFree(o->ptr);
         break;
     default:
         serverPanic("Unknown sorted set encoding");
@@ -352,8 +387,8 @@ void freeHashObject(robj *o) {
     case OBJ_ENCODING_HT:
         dictRelease((dict*) o->ptr);
         break;
-    case OBJ_ENCODING_ZIPLIST:
-        zfree(o->ptr);
+    case OBJ_ENCODING_LISTPACK:
+        lpFree(o->ptr);
         break;
     default:
         serverPanic("Unknown hash encoding type");
@@ -774,7 +809,10 @@ char *strEncoding(int encoding) {
     case OBJ_ENCODING_HT: return "hashtable";
     case OBJ_ENCODING_QUICKLIST: return "quicklist";
     case OBJ_ENCODING_ZIPLIST: return "ziplist";
+    case OBJ_ENCODING_LISTPACK: return "listpack";
     case OBJ_ENCODING_INTSET: return "intset";
+    case OBJ_ENCODING_ROARING: return "roaring";
+    case OBJ_ENCODING_BTREE: return "btree";
     case OBJ_ENCODING_SKIPLIST: return "skiplist";
     case OBJ_ENCODING_EMBSTR: return "embstr";
     default: return "unknown";
@@ -835,7 +873,7 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
             quicklistNode *node = ql->head;
             asize = sizeof(*o)+sizeof(quicklist);
             do {
-                elesize += sizeof(quicklistNode)+ziplistBlobLen(node->zl);
+                elesize += sizeof(quicklistNode)+lpBytes(node->entry);
                 samples++;
             } while ((node = node->next) && samples < sample_size);
             asize += (double)elesize/samples*ql->len;
@@ -859,12 +897,16 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
         } else if (o->encoding == OBJ_ENCODING_INTSET) {
             intset *is = o->ptr;
             asize = sizeof(*o)+sizeof(*is)+is->encoding*is->length;
+        } else if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            asize = sizeof(*o)+lpBytes(o->ptr);
+        } else if (o->encoding == OBJ_ENCODING_ROARING) {
+            asize = sizeof(*o)+roaringAllocSize(o->ptr);
         } else {
             serverPanic("Unknown set encoding");
         }
     } else if (o->type == OBJ_ZSET) {
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            asize = sizeof(*o)+(ziplistBlobLen(o->ptr));
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            asize = sizeof(*o)+(lpBytes(o->ptr));
         } else if (o->encoding == OBJ_ENCODING_SKIPLIST) {
             d = ((zset*)o->ptr)->dict;
             zskiplist *zsl = ((zset*)o->ptr)->zsl;
@@ -879,12 +921,26 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
                 znode = znode->level[0].forward;
             }
             if (samples) asize += (double)elesize/samples*dictSize(d);
+        } else if (o->encoding == OBJ_ENCODING_BTREE) {
+            zbtree *zbt = ((zset*)o->ptr)->zbt;
+            zbtreePos pos;
+            d = ((zset*)o->ptr)->dict;
+            asize = sizeof(*o)+sizeof(zset)+sizeof(dict)+
+                    (sizeof(struct dictEntry*)*dictSlots(d))+zbtAllocSize(zbt);
+            zbtFirst(zbt,&pos);
+            while(pos.leaf != NULL && samples < sample_size) {
+                elesize += sdsAllocSize(zbtPosEntry(&pos)->ele);
+                elesize += sizeof(struct dictEntry);
+                samples++;
+                zbtNext(&pos);
+            }
+            if (samples) asize += (double)elesize/samples*dictSize(d);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
     } else if (o->type == OBJ_HASH) {
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            asize = sizeof(*o)+(ziplistBlobLen(o->ptr));
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            asize = sizeof(*o)+(lpBytes(o->ptr));
         } else if (o->encoding == OBJ_ENCODING_HT) {
             d = o->ptr;
             di = dictGetIterator(d);
@@ -1014,16 +1070,28 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
 
     mem_total += server.initial_memory_usage;
 
+    /* The replication buffer is shared by the backlog and the replicas:
+     * when there are replicas, up to repl-backlog-size bytes are accounted
+     * to the backlog, and the rest to the replicas output buffers. */
+    size_t repl_slaves_mem = 0;
+    if (listLength(server.slaves) &&
+        (long long)server.repl_buffer_mem > server.repl_backlog_size)
+    {
+        repl_slaves_mem = server.repl_buffer_mem - server.repl_backlog_size;
+    }
     mem = 0;
-    if (server.repl_backlog)
+    if (server.repl_backlog) {
         mem += zmalloc_size(server.repl_backlog);
+        mem += server.repl_buffer_mem - repl_slaves_mem;
+    }
     mh->repl_backlog = mem;
     mem_total += mem;
 
     /* Computing the memory used by the clients would be O(N) if done
      * here online. We use our values computed incrementally by
      * clientsCronTrackClientsMemUsage(). */
-    mh->clients_slaves = server.stat_clients_type_memory[CLIENT_TYPE_SLAVE];
+    mh->clients_slaves = server.stat_clients_type_memory[CLIENT_TYPE_SLAVE]+
+                         repl_slaves_mem;
     mh->clients_normal = server.stat_clients_type_memory[CLIENT_TYPE_MASTER]+
                          server.stat_clients_type_memory[CLIENT_TYPE_PUBSUB]+
                          server.stat_clients_type_memory[CLIENT_TYPE_NORMAL];
@@ -30,6 +30,48 @@
 #include "server.h"
 
 int clientSubscriptionsCount(client *c);
+int clientShardSubscriptionsCount(client *c);
+
+/* Global channels (SUBSCRIBE / PUBLISH) and shard channels (SSUBSCRIBE /
+ * SPUBLISH) share the same implementation: this structure tells the
+ * functions below which dictionaries and reply strings to use. */
+typedef struct pubsubtype {
+    int shard;
+    dict *(*clientPubSubChannels)(client*);
+    int (*subscriptionCount)(client*);
+    dict **serverPubSubChannels;
+    robj **subscribeMsg;
+    robj **unsubscribeMsg;
+    robj **messageBulk;
+} pubsubtype;
+
+static dict *getClientPubSubChannels(client *c) {
+    return c->pubsub_channels;
+}
+
+static dict *getClientPubSubShardChannels(client *c) {
+    return c->pubsubshard_channels;
+}
+
+pubsubtype pubSubType = {
+    .shard = 0,
+    .clientPubSubChannels = getClientPubSubChannels,
+    .subscriptionCount = clientSubscriptionsCount,
+    .serverPubSubChannels = &server.pubsub_channels,
+    .subscribeMsg = &shared.subscribebulk,
+    .unsubscribeMsg = &shared.unsubscribebulk,
+    .messageBulk = &shared.messagebulk,
+};
+
+pubsubtype pubSubShardType = {
+    .shard = 1,
+    .clientPubSubChannels = getClientPubSubShardChannels,
+    .subscriptionCount = clientShardSubscriptionsCount,
+    .serverPubSubChannels = &server.pubsubshard_channels,
+    .subscribeMsg = &shared.ssubscribebulk,
+    .unsubscribeMsg = &shared.sunsubscribebulk,
+    .messageBulk = &shared.smessagebulk,
+};
 
 /*-----------------------------------------------------------------------------
  * Pubsub client replies API
@@ -41,11 +83,19 @@ int clientSubscriptionsCount(client *c);
  * to send a special message (for instance an Array type) by using the
  * addReply*() API family. */
 void addReplyPubsubMessage(client *c, robj *channel, robj *msg) {
+    addReplyPubsubTypeMessage(c,channel,msg,shared.messagebulk);
+}
+
+/* Like addReplyPubsubMessage() but with the message type specified by the
+ * caller, for instance "smessage" for shard channels. */
+void addReplyPubsubTypeMessage(client *c, robj *channel, robj *msg,
+                               robj *msgbulk)
+{
     if (c->resp == 2)
         addReply(c,shared.mbulkhdr[3]);
     else
         addReplyPushLen(c,3);
-    addReply(c,shared.messagebulk);
+    addReply(c,msgbulk);
     addReplyBulk(c,channel);
     if (msg) addReplyBulk(c,msg);
 }
@@ -65,31 +115,31 @@ void addReplyPubsubPatMessage(client *c, robj *pat, robj *channel, robj *msg) {
 }
 
 /* Send the pubsub subscription notification to the client. */
-void addReplyPubsubSubscribed(client *c, robj *channel) {
+void addReplyPubsubSubscribed(client *c, robj *channel, pubsubtype type) {
     if (c->resp == 2)
         addReply(c,shared.mbulkhdr[3]);
     else
         addReplyPushLen(c,3);
-    addReply(c,shared.subscribebulk);
+    addReply(c,*type.subscribeMsg);
     addReplyBulk(c,channel);
-    addReplyLongLong(c,clientSubscriptionsCount(c));
+    addReplyLongLong(c,type.subscriptionCount(c));
 }
 
 /* Send the pubsub unsubscription notification to the client.
  * Channel can be NULL: this is useful when the client sends a mass
  * unsubscribe command but there are no channels to unsubscribe from: we
  * still send a notification. */
-void addReplyPubsubUnsubscribed(client *c, robj *channel) {
+void addReplyPubsubUnsubscribed(client *c, robj *channel, pubsubtype type) {
     if (c->resp == 2)
         addReply(c,shared.mbulkhdr[3]);
     else
         addReplyPushLen(c,3);
-    addReply(c,shared.unsubscribebulk);
+    addReply(c,*type.unsubscribeMsg);
     if (channel)
         addReplyBulk(c,channel);
     else
         addReplyNull(c);
-    addReplyLongLong(c,clientSubscriptionsCount(c));
+    addReplyLongLong(c,type.subscriptionCount(c));
 }
 
 /* Send the pubsub pattern subscription notification to the client. */
@@ -144,22 +194,33 @@ int clientSubscriptionsCount(client *c) {
            listLength(c->pubsub_patterns);
 }
 
+/* Return the number of shard channels a client is subscribed to. */
+int clientShardSubscriptionsCount(client *c) {
+    return dictSize(c->pubsubshard_channels);
+}
+
+/* Return the number of subscriptions of any kind of the client: when zero
+ * the client is no longer in Pub/Sub mode. */
+int clientTotalSubscriptionsCount(client *c) {
+    return clientSubscriptionsCount(c)+clientShardSubscriptionsCount(c);
+}
+
 /* Subscribe a client to a channel. Returns 1 if the operation succeeded, or
  * 0 if the client was already subscribed to that channel. */
-int pubsubSubscribeChannel(client *c, robj *channel) {
+int pubsubSubscribeChannel(client *c, robj *channel, pubsubtype type) {
     dictEntry *de;
     list *clients = NULL;
     int retval = 0;
 
     /* Add the channel to the client -> channels hash table */
-    if (dictAdd(c->pubsub_channels,channel,NULL) == DICT_OK) {
+    if (dictAdd(type.clientPubSubChannels(c),channel,NULL) == DICT_OK) {
         retval = 1;
         incrRefCount(channel);
         /* Add the client to the channel -> list of clients hash table */
-        de = dictFind(server.pubsub_channels,channel);
+        de = dictFind(*type.serverPubSubChannels,channel);
         if (de == NULL) {
             clients = listCreate();
-            dictAdd(server.pubsub_channels,channel,clients);
+            dictAdd(*type.serverPubSubChannels,channel,clients);
             incrRefCount(channel);
         } else {
             clients = dictGetVal(de);
@@ -167,13 +228,13 @@ int pubsubSubscribeChannel(client *c, robj *channel) {
         listAddNodeTail(clients,c);
     }
     /* Notify the client */
-    addReplyPubsubSubscribed(c,channel);
+    addReplyPubsubSubscribed(c,channel,type);
     return retval;
 }
 
 /* Unsubscribe a client from a channel. Returns 1 if the operation succeeded, or
  * 0 if the client was not subscribed to the specified channel. */
-int pubsubUnsubscribeChannel(client *c, robj *channel, int notify) {
+int pubsubUnsubscribeChannel(client *c, robj *channel, int notify, pubsubtype type) {
     dictEntry *de;
     list *clients;
     listNode *ln;
@@ -182,10 +243,10 @@ int pubsubUnsubscribeChannel(client *c, robj *channel, int notify) {
     /* Remove the channel from the client -> channels hash table */
     incrRefCount(channel); /* channel may be just a pointer to the same object
                             we have in the hash tables. Protect it... */
-    if (dictDelete(c->pubsub_channels,channel) == DICT_OK) {
+    if (dictDelete(type.clientPubSubChannels(c),channel) == DICT_OK) {
         retval = 1;
         /* Remove the client from the channel -> clients list hash table */
-        de = dictFind(server.pubsub_channels,channel);
+        de = dictFind(*type.serverPubSubChannels,channel);
         serverAssertWithInfo(c,NULL,de != NULL);
         clients = dictGetVal(de);
         ln = listSearchKey(clients,c);
@@ -195,15 +256,35 @@ int pubsubUnsubscribeChannel(client *c, robj *channel, int notify) {
             /* Free the list and associated hash entry at all if this was
              * the latest client, so that it will be possible to abuse
              * Redis PUBSUB creating millions of channels. */
-            dictDelete(server.pubsub_channels,channel);
+            dictDelete(*type.serverPubSubChannels,channel);
         }
     }
     /* Notify the client */
-    if (notify) addReplyPubsubUnsubscribed(c,channel);
+    if (notify) addReplyPubsubUnsubscribed(c,channel,type);
     decrRefCount(channel); /* it is finally safe to release it */
     return retval;
 }
 
+/* Unsubscribe all the clients from a shard channel, notifying them. Used
+ * when this node stops serving the slot of the channel. */
+void pubsubShardUnsubscribeAllClients(robj *channel) {
+    list *clients = dictFetchValue(server.pubsubshard_channels,channel);
+    listNode *ln;
+
+    if (clients == NULL) return;
+    incrRefCount(channel);
+    /* The list is released together with the last subscriber. */
+    while (dictFind(server.pubsubshard_channels,channel)) {
+        ln = listFirst(clients);
+        client *c = listNodeValue(ln);
+
+        pubsubUnsubscribeChannel(c,channel,1,pubSubShardType);
+        if (clientTotalSubscriptionsCount(c) == 0)
+            c->flags &= ~CLIENT_PUBSUB;
+    }
+    decrRefCount(channel);
+}
+
 /* Subscribe a client to a pattern. Returns 1 if the operation succeeded, or 0 if the client was already subscribed to that pattern. */
 int pubsubSubscribePattern(client *c, robj *pattern) {
     dictEntry *de;
@@ -271,24 +352,36 @@ int pubsubUnsubscribePattern(client *c, robj *pattern, int notify) {
     return retval;
 }
 
-/* Unsubscribe from all the channels. Return the number of channels the
- * client was subscribed to. */
-int pubsubUnsubscribeAllChannels(client *c, int notify) {
-    dictIterator *di = dictGetSafeIterator(c->pubsub_channels);
+/* Unsubscribe from all the channels of the given type. Return the number
+ * of channels the client was subscribed to. */
+int pubsubUnsubscribeAllChannelsInternal(client *c, int notify, pubsubtype type) {
+    dictIterator *di = dictGetSafeIterator(type.clientPubSubChannels(c));
     dictEntry *de;
     int count = 0;
 
     while((de = dictNext(di)) != NULL) {
         robj *channel = dictGetKey(de);
 
-        count += pubsubUnsubscribeChannel(c,channel,notify);
+        count += pubsubUnsubscribeChannel(c,channel,notify,type);
     }
     /* We were subscribed to nothing? Still reply to the client. */
-    if (notify && count == 0) addReplyPubsubUnsubscribed(c,NULL);
+    if (notify && count == 0) addReplyPubsubUnsubscribed(c,NULL,type);
     dictReleaseIterator(di);
     return count;
 }
 
+/* Unsubscribe from all the channels. Return the number of channels the
+ * client was subscribed to. */
+int pubsubUnsubscribeAllChannels(client *c, int notify) {
+    return pubsubUnsubscribeAllChannelsInternal(c,notify,pubSubType);
+}
+
+/* Unsubscribe from all the shard channels. Return the number of shard
+ * channels the client was subscribed to. */
+int pubsubUnsubscribeShardAllChannels(client *c, int notify) {
+    return pubsubUnsubscribeAllChannelsInternal(c,notify,pubSubShardType);
+}
+
 /* Unsubscribe from all the patterns. Return the number of patterns the
  * client was subscribed from. */
 int pubsubUnsubscribeAllPatterns(client *c, int notify) {
@@ -306,16 +399,14 @@ int pubsubUnsubscribeAllPatterns(client *c, int notify) {
     return count;
 }
 
-/* Publish a message */
-int pubsubPublishMessage(robj *channel, robj *message) {
+/* Send a message to the clients subscribed to the channel, returning the
+ * number of receivers. Patterns are only matched against global channels. */
+static int pubsubPublishMessageToChannel(robj *channel, robj *message,
+                                         pubsubtype type)
+{
     int receivers = 0;
-    dictEntry *de;
-    dictIterator *di;
-    listNode *ln;
-    listIter li;
+    dictEntry *de = dictFind(*type.serverPubSubChannels,channel);
 
-    /* Send to clients listening for that channel */
-    de = dictFind(server.pubsub_channels,channel);
     if (de) {
         list *list = dictGetVal(de);
         listNode *ln;
@@ -324,10 +415,29 @@ int pubsubPublishMessage(robj *channel, robj *message) {
         listRewind(list,&li);
         while ((ln = listNext(&li)) != NULL) {
             client *c = ln->value;
-            addReplyPubsubMessage(c,channel,message);
+            addReplyPubsubTypeMessage(c,channel,message,*type.messageBulk);
             receivers++;
         }
     }
+    return receivers;
+}
+
+/* Publish a message to the subscribers of a shard channel. */
+int pubsubPublishShardMessage(robj *channel, robj *message) {
+    return pubsubPublishMessageToChannel(channel,message,pubSubShardType);
+}
+
+/* Publish a message */
+int pubsubPublishMessage(robj *channel, robj *message) {
+    int receivers;
+    dictEntry *de;
+    dictIterator *di;
+    listNode *ln;
+    listIter li;
+
+    /* Send to clients listening for that channel */
+    receivers = pubsubPublishMessageToChannel(channel,message,pubSubType);
+
     /* Send to clients listening to matching channels */
     di = dictGetIterator(server.pubsub_patterns_dict);
     if (di) {
@@ -361,7 +471,7 @@ void subscribeCommand(client *c) {
     int j;
 
     for (j = 1; j < c->argc; j++)
-        pubsubSubscribeChannel(c,c->argv[j]);
+        pubsubSubscribeChannel(c,c->argv[j],pubSubType);
     c->flags |= CLIENT_PUBSUB;
 }
 
@@ -372,9 +482,9 @@ void unsubscribeCommand(client *c) {
         int j;
 
         for (j = 1; j < c->argc; j++)
-            pubsubUnsubscribeChannel(c,c->argv[j],1);
+            pubsubUnsubscribeChannel(c,c->argv[j],1,pubSubType);
     }
-    if (clientSubscriptionsCount(c) == 0) c->flags &= ~CLIENT_PUBSUB;
+    if (clientTotalSubscriptionsCount(c) == 0) c->flags &= ~CLIENT_PUBSUB;
 }
 
 void psubscribeCommand(client *c) {
@@ -394,7 +504,7 @@ void punsubscribeCommand(client *c) {
         for (j = 1; j < c->argc; j++)
             pubsubUnsubscribePattern(c,c->argv[j],1);
     }
-    if (clientSubscriptionsCount(c) == 0) c->flags &= ~CLIENT_PUBSUB;
+    if (clientTotalSubscriptionsCount(c) == 0) c->flags &= ~CLIENT_PUBSUB;
 }
 
 void publishCommand(client *c) {
@@ -406,6 +516,45 @@ void publishCommand(client *c) {
     addReplyLongLong(c,receivers);
 }
 
+/* SSUBSCRIBE shardchannel [shardchannel ...]
+ *
+ * Shard channels are bound to the hash slot of their name like keys are,
+ * so in cluster mode all the channels must hash to the same slot, served
+ * by the master (or, with READONLY, the replicas) of the shard. */
+void ssubscribeCommand(client *c) {
+    int j;
+
+    for (j = 1; j < c->argc; j++)
+        pubsubSubscribeChannel(c,c->argv[j],pubSubShardType);
+    c->flags |= CLIENT_PUBSUB;
+}
+
+void sunsubscribeCommand(client *c) {
+    if (c->argc == 1) {
+        pubsubUnsubscribeShardAllChannels(c,1);
+    } else {
+        int j;
+
+        for (j = 1; j < c->argc; j++)
+            pubsubUnsubscribeChannel(c,c->argv[j],1,pubSubShardType);
+    }
+    if (clientTotalSubscriptionsCount(c) == 0) c->flags &= ~CLIENT_PUBSUB;
+}
+
+/* SPUBLISH shardchannel message
+ *
+ * Unlike PUBLISH, in cluster mode the message is only propagated to the
+ * nodes of the shard serving the channel slot, and not to the whole
+ * cluster. */
+void spublishCommand(client *c) {
+    int receivers = pubsubPublishShardMessage(c->argv[1],c->argv[2]);
+    if (server.cluster_enabled)
+        clusterPropagatePublishShard(c->argv[1],c->argv[2]);
+    else
+        forceCommandPropagation(c,PROPAGATE_REPL);
+    addReplyLongLong(c,receivers);
+}
+
 /* PUBSUB command for Pub/Sub introspection. */
 void pubsubCommand(client *c) {
     if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"help")) {
@@ -413,15 +562,20 @@ void pubsubCommand(client *c) {
 "CHANNELS [<pattern>] -- Return the currently active channels matching a pattern (default: all).",
 "NUMPAT -- Return number of subscriptions to patterns.",
 "NUMSUB [channel-1 .. channel-N] -- Returns the number of subscribers for the specified channels (excluding patterns, default: none).",
+"SHARDCHANNELS [<pattern>] -- Return the currently active shard channels matching a pattern (default: all).",
+"SHARDNUMSUB [shardchannel-1 .. shardchannel-N] -- Returns the number of subscribers for the specified shard channels.",
 NULL
         };
         addReplyHelp(c, help);
-    } else if (!strcasecmp(c->argv[1]->ptr,"channels") &&
+    } else if ((!strcasecmp(c->argv[1]->ptr,"channels") ||
+                !strcasecmp(c->argv[1]->ptr,"shardchannels")) &&
         (c->argc == 2 || c->argc == 3))
     {
-        /* PUBSUB CHANNELS [<pattern>] */
+        /* PUBSUB CHANNELS [<pattern>] / PUBSUB SHARDCHANNELS [<pattern>] */
         sds pat = (c->argc == 2) ? NULL : c->argv[2]->ptr;
-        dictIterator *di = dictGetIterator(server.pubsub_channels);
+        dict *channels = strcasecmp(c->argv[1]->ptr,"channels") ?
+                         server.pubsubshard_channels : server.pubsub_channels;
+        dictIterator *di = dictGetIterator(channels);
         dictEntry *de;
         long mblen = 0;
         void *replylen;
@@ -440,13 +594,17 @@ NULL
         }
         dictReleaseIterator(di);
         setDeferredArrayLen(c,replylen,mblen);
-    } else if (!strcasecmp(c->argv[1]->ptr,"numsub") && c->argc >= 2) {
-        /* PUBSUB NUMSUB [Channel_1 ... Channel_N] */
+    } else if ((!strcasecmp(c->argv[1]->ptr,"numsub") ||
+                !strcasecmp(c->argv[1]->ptr,"shardnumsub")) && c->argc >= 2) {
+        /* PUBSUB NUMSUB [Channel_1 ... Channel_N] /
+         * PUBSUB SHARDNUMSUB [Channel_1 ... Channel_N] */
+        dict *channels = strcasecmp(c->argv[1]->ptr,"numsub") ?
+                         server.pubsubshard_channels : server.pubsub_channels;
         int j;
 
         addReplyArrayLen(c,(c->argc-2)*2);
         for (j = 2; j < c->argc; j++) {
-            list *l = dictFetchValue(server.pubsub_channels,c->argv[j]);
+            list *l = dictFetchValue(channels,c->argv[j]);
 
             addReplyBulk(c,c->argv[j]);
             addReplyLongLong(c,l ? listLength(l) : 0);
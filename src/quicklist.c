@@ -1,4 +1,4 @@
-/* quicklist.c - A doubly linked list of ziplists
+/* quicklist.c - A doubly linked list of listpacks
  *
  * Copyright (c) 2014, Matt Stancliff <matt@genges.com>
  * All rights reserved.
@@ -32,6 +32,7 @@
 #include "quicklist.h"
 #include "zmalloc.h"
 #include "ziplist.h"
+#include "listpack.h"
 #include "util.h" /* for ll2string */
 #include "lzf.h"
 
@@ -46,11 +47,11 @@
 /* Optimization levels for size-based filling */
 static const size_t optimization_level[] = {4096, 8192, 16384, 32768, 65536};
 
-/* Maximum size in bytes of any multi-element ziplist.
- * Larger values will live in their own isolated ziplists. */
+/* Maximum size in bytes of any multi-element listpack.
+ * Larger values will live in their own isolated listpacks. */
 #define SIZE_SAFETY_LIMIT 8192
 
-/* Minimum ziplist size in bytes for attempting compression. */
+/* Minimum listpack size in bytes for attempting compression. */
 #define MIN_COMPRESS_BYTES 48
 
 /* Minimum size reduction in bytes to store compressed quicklistNode data.
@@ -146,12 +147,12 @@ quicklist *quicklistNew(int fill, int compress) {
 REDIS_STATIC quicklistNode *quicklistCreateNode(void) {
     quicklistNode *node;
     node = zmalloc(sizeof(*node));
-    node->zl = NULL;
+    node->entry = NULL;
     node->count = 0;
     node->sz = 0;
     node->next = node->prev = NULL;
     node->encoding = QUICKLIST_NODE_ENCODING_RAW;
-    node->container = QUICKLIST_NODE_CONTAINER_ZIPLIST;
+    node->container = QUICKLIST_NODE_CONTAINER_PACKED;
     node->recompress = 0;
     return node;
 }
@@ -171,8 +172,8 @@ void quicklistRelease(quicklist *quicklist) {
     while (len--) {
         //获取下一个节点
         next = current->next;
-        //释放当前节点的ziplist
-        zfree(current->zl);
+        //释放当前节点的listpack
+        zfree(current->entry);
         //数量更新
         quicklist->count -= current->count;
         //将当前节点释放
@@ -188,9 +189,9 @@ void quicklistRelease(quicklist *quicklist) {
     zfree(quicklist);
 }
 
-/* Compress the ziplist in 'node' and update encoding details.
- * Returns 1 if ziplist compressed successfully.
- * Returns 0 if compression failed or if ziplist too small to compress. */
+/* Compress the listpack in 'node' and update encoding details.
+ * Returns 1 if listpack compressed successfully.
+ * Returns 0 if compression failed or if listpack too small to compress. */
 REDIS_STATIC int __quicklistCompressNode(quicklistNode *node) {
 #ifdef REDIS_TEST
     node->attempted_compress = 1;
@@ -205,7 +206,7 @@ REDIS_STATIC int __quicklistCompressNode(quicklistNode *node) {
 
     /* Cancel if compression fails or doesn't compress small enough */
     //压缩失败或者压缩减小的空间小于最小的程度都是失败
-    if (((lzf->sz = lzf_compress(node->zl, node->sz, lzf->compressed,
+    if (((lzf->sz = lzf_compress(node->entry, node->sz, lzf->compressed,
                                  node->sz)) == 0) ||
         lzf->sz + MIN_COMPRESS_IMPROVE >= node->sz) {
         /* lzf_compress aborts/rejects compression if value not compressable. */
@@ -216,9 +217,9 @@ REDIS_STATIC int __quicklistCompressNode(quicklistNode *node) {
     //重新申请空间，按照内存排列将sz和compress变成一个可被转换为(unsigned char *)的存在
     lzf = zrealloc(lzf, sizeof(*lzf) + lzf->sz);
     //释放之前的zl
-    zfree(node->zl);
+    zfree(node->entry);
     //将这个lzf赋值给zl，这个数据会在解压的时候再被类型转化为quicklistLZF
-    node->zl = (unsigned char *)lzf;
+    node->entry = (unsigned char *)lzf;
     //设置encoding方式为lzf
     node->encoding = QUICKLIST_NODE_ENCODING_LZF;
     //设置压缩标志
@@ -236,16 +237,16 @@ REDIS_STATIC int __quicklistCompressNode(quicklistNode *node) {
         }                                                                      \
     } while (0)
 
-/* Uncompress the ziplist in 'node' and update encoding details.
+/* Uncompress the listpack in 'node' and update encoding details.
  * Returns 1 on successful decode, 0 on failure to decode. */
 REDIS_STATIC int __quicklistDecompressNode(quicklistNode *node) {
 #ifdef REDIS_TEST
     node->attempted_compress = 0;
 #endif
-    //获取节点ziplist长度大小的空间
+    //获取节点listpack长度大小的空间
     void *decompressed = zmalloc(node->sz);
-    //将ziplist的char*转化为quicklistLZF
-    quicklistLZF *lzf = (quicklistLZF *)node->zl;
+    //将listpack的char*转化为quicklistLZF
+    quicklistLZF *lzf = (quicklistLZF *)node->entry;
     //解压数据失败
     if (lzf_decompress(lzf->compressed, lzf->sz, decompressed, node->sz) == 0) {
         /* Someone requested decompress, but we can't decompress.  Not good. */
@@ -255,7 +256,7 @@ REDIS_STATIC int __quicklistDecompressNode(quicklistNode *node) {
     //将中间变量lzf释放
     zfree(lzf);
     //zl赋值为解压后的数据
-    node->zl = decompressed;
+    node->entry = decompressed;
     //设置压缩状态为未压缩
     node->encoding = QUICKLIST_NODE_ENCODING_RAW;
     return 1;
@@ -285,7 +286,7 @@ REDIS_STATIC int __quicklistDecompressNode(quicklistNode *node) {
  * Return value is the length of compressed LZF data. */
 //获取quicklist这个node压缩过的quicklistLZF数据
 size_t quicklistGetLzf(const quicklistNode *node, void **data) {
-    quicklistLZF *lzf = (quicklistLZF *)node->zl;
+    quicklistLZF *lzf = (quicklistLZF *)node->entry;
     *data = lzf->compressed;
     return lzf->sz;
 }
@@ -452,7 +453,7 @@ REDIS_STATIC void _quicklistInsertNodeAfter(quicklist *quicklist,
     __quicklistInsertNode(quicklist, old_node, new_node, 1);
 }
 
-//判断新的ziplist长度是否满足fill设置的标准
+//判断新的listpack长度是否满足fill设置的标准
 REDIS_STATIC int
 _quicklistNodeSizeMeetsOptimizationRequirement(const size_t sz,
                                                const int fill) {
@@ -476,33 +477,18 @@ _quicklistNodeSizeMeetsOptimizationRequirement(const size_t sz,
 
 #define sizeMeetsSafetyLimit(sz) ((sz) <= SIZE_SAFETY_LIMIT)
 
-//判断这个node存放的ziplist可不可以加上这段长度的数据
+//判断这个node存放的listpack可不可以加上这段长度的数据
 REDIS_STATIC int _quicklistNodeAllowInsert(const quicklistNode *node,
                                            const int fill, const size_t sz) {
     //查看node是否存在
     if (unlikely(!node))
         return 0;
 
-    int ziplist_overhead;
-    /* size of previous offset */
-    //根据value的长度判断ziplist需要多加多少内存来存储长度，存储encoding
-    if (sz < 254)
-        ziplist_overhead = 1;
-    else
-        ziplist_overhead = 5;
-
-    /* size of forward offset */
-    //用于下一个元素扩展存储prevlen，之前的头节点的那一个prevlen直接当作新的entry的首空间
-    if (sz < 64)
-        ziplist_overhead += 1;
-    else if (likely(sz < 16384))
-        ziplist_overhead += 2;
-    else
-        ziplist_overhead += 5;
-
-    /* new_sz overestimates if 'sz' encodes to an integer type */
+    /* The listpack entry is self contained (encoding, data and backlen), so
+     * unlike the ziplist the other entries never grow when we insert.
+     * new_sz overestimates if 'sz' encodes to an integer type */
     //新的size
-    unsigned int new_sz = node->sz + sz + ziplist_overhead;
+    unsigned int new_sz = node->sz + lpEntrySizeUpperBound(sz);
     //根据fill值判断是否可以插入
     if (likely(_quicklistNodeSizeMeetsOptimizationRequirement(new_sz, fill)))
         return 1;
@@ -514,18 +500,16 @@ REDIS_STATIC int _quicklistNodeAllowInsert(const quicklistNode *node,
         return 0;
 }
 
-//判断两个ziplist是否可以被合并
+//判断两个listpack是否可以被合并
 REDIS_STATIC int _quicklistNodeAllowMerge(const quicklistNode *a,
                                           const quicklistNode *b,
                                           const int fill) {
     if (!a || !b)
         return 0;
 
-    /* approximate merged ziplist size (- 11 to remove one ziplist
-     * header/trailer) */
-     //ziplist的head+tail的长度就是11个字节head=32*2+16,tail=8
-     //这个就是两个zip总长度，但是感觉漏了第二个ziplist的首元素的prev长度的空间需求
-    unsigned int merge_sz = a->sz + b->sz - 11;
+    /* merged listpack size (- 7 to remove one listpack header/EOF) */
+    //listpack的header+EOF的长度就是7个字节header=32+16,EOF=8
+    unsigned int merge_sz = a->sz + b->sz - 7;
     if (likely(_quicklistNodeSizeMeetsOptimizationRequirement(merge_sz, fill)))
         return 1;
     else if (!sizeMeetsSafetyLimit(merge_sz))
@@ -538,7 +522,7 @@ REDIS_STATIC int _quicklistNodeAllowMerge(const quicklistNode *a,
 
 #define quicklistNodeUpdateSz(node)                                            \
     do {                                                                       \
-        (node)->sz = ziplistBlobLen((node)->zl);                               \
+        (node)->sz = lpBytes((node)->entry);                                   \
     } while (0)
 
 /* Add new entry to head node of quicklist.
@@ -555,17 +539,16 @@ int quicklistPushHead(quicklist *quicklist, void *value, size_t sz) {
     quicklistNode *orig_head = quicklist->head;
     if (likely(
             _quicklistNodeAllowInsert(quicklist->head, quicklist->fill, sz))) {
-        //如果可以插入则这个节点zl指向的ziplist会在头部插入value
-        quicklist->head->zl =
-            ziplistPush(quicklist->head->zl, value, sz, ZIPLIST_HEAD);
-        //更新节点的ziplist的长度数据
+        //如果可以插入则这个节点entry指向的listpack会在头部插入value
+        quicklist->head->entry = lpPrepend(quicklist->head->entry, value, sz);
+        //更新节点的listpack的长度数据
         quicklistNodeUpdateSz(quicklist->head);
     } else {//如果没法插入
         //创建新的node
         quicklistNode *node = quicklistCreateNode();
-        //将这个元素插入新node的ziplist
-        node->zl = ziplistPush(ziplistNew(), value, sz, ZIPLIST_HEAD);
-        //更新这个node的ziplist长度
+        //将这个元素插入新node的listpack
+        node->entry = lpPrepend(lpNew(), value, sz);
+        //更新这个node的listpack长度
         quicklistNodeUpdateSz(node);
         //在head前插入node
         _quicklistInsertNodeBefore(quicklist, quicklist->head, node);
@@ -587,12 +570,11 @@ int quicklistPushTail(quicklist *quicklist, void *value, size_t sz) {
     quicklistNode *orig_tail = quicklist->tail;
     if (likely(
             _quicklistNodeAllowInsert(quicklist->tail, quicklist->fill, sz))) {
-        quicklist->tail->zl =
-            ziplistPush(quicklist->tail->zl, value, sz, ZIPLIST_TAIL);
+        quicklist->tail->entry = lpAppend(quicklist->tail->entry, value, sz);
         quicklistNodeUpdateSz(quicklist->tail);
     } else {
         quicklistNode *node = quicklistCreateNode();
-        node->zl = ziplistPush(ziplistNew(), value, sz, ZIPLIST_TAIL);
+        node->entry = lpAppend(lpNew(), value, sz);
 
         quicklistNodeUpdateSz(node);
         _quicklistInsertNodeAfter(quicklist, quicklist->tail, node);
@@ -604,25 +586,37 @@ int quicklistPushTail(quicklist *quicklist, void *value, size_t sz) {
     return (orig_tail != quicklist->tail);
 }
 
-/* Create new node consisting of a pre-formed ziplist.
- * Used for loading RDBs where entire ziplists have been stored
+/* Create new node consisting of a pre-formed listpack.
+ * Used for loading RDBs where entire listpacks have been stored
  * to be retrieved later. */
 //quicklist插入一个新的node并将这个node放在tail之后，node中元素为zl
-void quicklistAppendZiplist(quicklist *quicklist, unsigned char *zl) {
+void quicklistAppendListpack(quicklist *quicklist, unsigned char *zl) {
     //创建一个新的node
     quicklistNode *node = quicklistCreateNode();
 
-    node->zl = zl;
-    //获取ziplist的entry个数
-    node->count = ziplistLen(node->zl);
-    //获取ziplist总长度
-    node->sz = ziplistBlobLen(zl);
+    node->entry = zl;
+    //获取listpack的entry个数
+    node->count = lpLength(node->entry);
+    //获取listpack总长度
+    node->sz = lpBytes(zl);
     //在尾节点之后插入新的node
     _quicklistInsertNodeAfter(quicklist, quicklist->tail, node);
     //更新quicklist的count数量
     quicklist->count += node->count;
 }
 
+/* Create new node consisting of the elements of a pre-formed ziplist,
+ * converted to a listpack. Used for loading old RDBs where quicklist
+ * nodes were stored as ziplists.
+ *
+ * Frees passed-in ziplist 'zl'. */
+//将zl代表的ziplist转换为listpack，作为一个新的node插入到tail之后
+void quicklistAppendZiplist(quicklist *quicklist, unsigned char *zl) {
+    unsigned char *lp = ziplistToListpack(zl);
+    zfree(zl);
+    quicklistAppendListpack(quicklist, lp);
+}
+
 /* Append all values of ziplist 'zl' individually into 'quicklist'.
  *
  * This allows us to restore old RDB ziplists into new quicklists
@@ -708,7 +702,7 @@ REDIS_STATIC void __quicklistDelNode(quicklist *quicklist,
     //count更新
     quicklist->count -= node->count;
     //释放node
-    zfree(node->zl);
+    zfree(node->entry);
     zfree(node);
     //修改quicklist的节点数
     quicklist->len--;
@@ -721,13 +715,13 @@ REDIS_STATIC void __quicklistDelNode(quicklist *quicklist,
  *       already had to get *p from an uncompressed node somewhere.
  *
  * Returns 1 if the entire node was deleted, 0 if node still exists.
- * Also updates in/out param 'p' with the next offset in the ziplist. */
+ * Also updates in/out param 'p' with the next offset in the listpack. */
  //删除quicklist中node节点中p指向的元素，返回0代表node不变，返回1代表node被删除
 REDIS_STATIC int quicklistDelIndex(quicklist *quicklist, quicklistNode *node,
                                    unsigned char **p) {
     int gone = 0;
     //删除p所在的节点
-    node->zl = ziplistDelete(node->zl, p);
+    node->entry = lpDelete(node->entry, *p, p);
     //更新节点信息
     node->count--;
     //如果node中元素为空
@@ -748,11 +742,11 @@ REDIS_STATIC int quicklistDelIndex(quicklist *quicklist, quicklistNode *node,
 /* Delete one element represented by 'entry'
  *
  * 'entry' stores enough metadata to delete the proper position in
- * the correct ziplist in the correct quicklist node. */
+ * the correct listpack in the correct quicklist node. */
 /*
-删除entry所在的quicklist中node的ziplist中zi位置的元素
+删除entry所在的quicklist中node的listpack中zi位置的元素
 如果这个node被删除了，需要根据iter的direction更新这个iter指向的node和offset
-iter的zi必须置为空，因为指向的是老的ziplist的指针，ziplist在数据做修改会重新申请空间，原来的zi是个野指针
+iter的zi必须置为空，因为指向的是老的listpack的指针，listpack在数据做修改会重新申请空间，原来的zi是个野指针
 */
 void quicklistDelEntry(quicklistIter *iter, quicklistEntry *entry) {
     //节点的前置和后置节点
@@ -763,7 +757,7 @@ void quicklistDelEntry(quicklistIter *iter, quicklistEntry *entry) {
                                          entry->node, &entry->zi);
 
     /* after delete, the zi is now invalid for any future usage. */
-    //node已经删除了代表迭代器中的zi已经不可获取了，原因时ziplist的内存已经变了，老地址不可达
+    //node已经删除了代表迭代器中的zi已经不可获取了，原因时listpack的内存已经变了，老地址不可达
     iter->zi = NULL;
 
     /* If current node is deleted, we must update iterator node and offset. */
@@ -785,7 +779,7 @@ void quicklistDelEntry(quicklistIter *iter, quicklistEntry *entry) {
      *   - [1, 2, 3] => delete offset 1 => [1, 3]: next element still offset 1
      *   - [1, 2, 3] => delete offset 0 => [2, 3]: next element still offset 0
      *  if we deleted the last element at offet N and now
-     *  length of this ziplist is N-1, the next call into
+     *  length of this listpack is N-1, the next call into
      *  quicklistNext() will jump to the next node. */
 }
 
@@ -800,10 +794,8 @@ int quicklistReplaceAtIndex(quicklist *quicklist, long index, void *data,
     //查找quicklist位于index位置的元素，数据放在entry中
     if (likely(quicklistIndex(quicklist, index, &entry))) {
         /* quicklistIndex provides an uncompressed node */
-        //删除zi位置的元素
-        entry.node->zl = ziplistDelete(entry.node->zl, &entry.zi);
-        //在zi位置插入data
-        entry.node->zl = ziplistInsert(entry.node->zl, entry.zi, data, sz);
+        //将zi位置的元素原地替换为data
+        entry.node->entry = lpReplace(entry.node->entry, &entry.zi, data, sz);
         //更新node长度
         quicklistNodeUpdateSz(entry.node);
         quicklistCompress(quicklist, entry.node);
@@ -813,9 +805,9 @@ int quicklistReplaceAtIndex(quicklist *quicklist, long index, void *data,
     }
 }
 
-/* Given two nodes, try to merge their ziplists.
+/* Given two nodes, try to merge their listpacks.
  *
- * This helps us not have a quicklist with 3 element ziplists if
+ * This helps us not have a quicklist with 3 element listpacks if
  * our fill factor can handle much higher levels.
  *
  * Note: 'a' must be to the LEFT of 'b'.
@@ -827,28 +819,28 @@ int quicklistReplaceAtIndex(quicklist *quicklist, long index, void *data,
  * Returns the input node picked to merge against or NULL if
  * merging was not possible. */
 //将quicklist的a和b合并，并将其中元素少的一个删除，返回最新的节点
-REDIS_STATIC quicklistNode *_quicklistZiplistMerge(quicklist *quicklist,
-                                                   quicklistNode *a,
-                                                   quicklistNode *b) {
+REDIS_STATIC quicklistNode *_quicklistListpackMerge(quicklist *quicklist,
+                                                    quicklistNode *a,
+                                                    quicklistNode *b) {
     D("Requested merge (a,b) (%u, %u)", a->count, b->count);
 
     quicklistDecompressNode(a);
     quicklistDecompressNode(b);
-    //合并a和b，返回的数据在数据较多的ziplist上，另外一个会被删除释放
-    if ((ziplistMerge(&a->zl, &b->zl))) {
-        /* We merged ziplists! Now remove the unused quicklistNode. */
+    //合并a和b，返回的数据在数据较多的listpack上，另外一个会被删除释放
+    if ((lpMerge(&a->entry, &b->entry))) {
+        /* We merged listpacks! Now remove the unused quicklistNode. */
         quicklistNode *keep = NULL, *nokeep = NULL;
-        if (!a->zl) {
+        if (!a->entry) {
             nokeep = a;
             keep = b;
-        } else if (!b->zl) {
+        } else if (!b->entry) {
             nokeep = b;
             keep = a;
         }
         //重新计算count
-        keep->count = ziplistLen(keep->zl);
+        keep->count = lpLength(keep->entry);
         quicklistNodeUpdateSz(keep);
-        //zl已被释放所以没有元素
+        //entry已被释放所以没有元素
         nokeep->count = 0;
         //删除节点
         __quicklistDelNode(quicklist, nokeep);
@@ -861,7 +853,7 @@ REDIS_STATIC quicklistNode *_quicklistZiplistMerge(quicklist *quicklist,
     }
 }
 
-/* Attempt to merge ziplists within two nodes on either side of 'center'.
+/* Attempt to merge listpacks within two nodes on either side of 'center'.
  *
  * We attempt to merge:
  *   - (center->prev->prev, center->prev)
@@ -906,20 +898,20 @@ REDIS_STATIC void _quicklistMergeNodes(quicklist *quicklist,
     //如果可以前面两个node可以被合并
     if (_quicklistNodeAllowMerge(prev, prev_prev, fill)) {
         //将前两个node合并
-        _quicklistZiplistMerge(quicklist, prev_prev, prev);
+        _quicklistListpackMerge(quicklist, prev_prev, prev);
         prev_prev = prev = NULL; /* they could have moved, invalidate them. */
     }
 
     /* Try to merge next and next_next */
     if (_quicklistNodeAllowMerge(next, next_next, fill)) {//合并后两个可以合并的node
-        _quicklistZiplistMerge(quicklist, next, next_next);
+        _quicklistListpackMerge(quicklist, next, next_next);
         next = next_next = NULL; /* they could have moved, invalidate them. */
     }
 
     /* Try to merge center node and previous node */
     //合并center和前置节点
     if (_quicklistNodeAllowMerge(center, center->prev, fill)) {
-        target = _quicklistZiplistMerge(quicklist, center->prev, center);
+        target = _quicklistListpackMerge(quicklist, center->prev, center);
         center = NULL; /* center could have been deleted, invalidate it. */
     } else {
         /* else, we didn't merge here, but target needs to be valid below. */
@@ -929,7 +921,7 @@ REDIS_STATIC void _quicklistMergeNodes(quicklist *quicklist,
     /* Use result of center merge (or original) to merge with next node. */
     //看能不能和后一个节点合并
     if (_quicklistNodeAllowMerge(target, target->next, fill)) {
-        _quicklistZiplistMerge(quicklist, target, target->next);
+        _quicklistListpackMerge(quicklist, target, target->next);
     }
 }
 
@@ -963,10 +955,10 @@ REDIS_STATIC quicklistNode *_quicklistSplitNode(quicklistNode *node, int offset,
     //创建一个新的node
     quicklistNode *new_node = quicklistCreateNode();
     //申请和原节点相同大小的空间
-    new_node->zl = zmalloc(zl_sz);
-    /* Copy original ziplist so we can split it */
-    //将原node的zl数据拷贝到新node
-    memcpy(new_node->zl, node->zl, zl_sz);
+    new_node->entry = zmalloc(zl_sz);
+    /* Copy original listpack so we can split it */
+    //将原node的listpack数据拷贝到新node
+    memcpy(new_node->entry, node->entry, zl_sz);
 
     /* -1 here means "continue deleting until the list ends" */
     //开始位置
@@ -980,20 +972,20 @@ REDIS_STATIC quicklistNode *_quicklistSplitNode(quicklistNode *node, int offset,
 
     D("After %d (%d); ranges: [%d, %d], [%d, %d]", after, offset, orig_start,
       orig_extent, new_start, new_extent);
-    //注意ziplistDeleteRange最后一个参数的类型就知道后删为什么传-1
+    //注意lpDeleteRange最后一个参数的类型就知道后删为什么传-1
     /*
     根据after决定原node保留后一段数据还是前一段数据
     after=0保留0-offset之间的数据
     after=1保留offset+1，-1之间的数据
     */
-    node->zl = ziplistDeleteRange(node->zl, orig_start, orig_extent);
+    node->entry = lpDeleteRange(node->entry, orig_start, orig_extent);
     //对node元素个数重新计算
-    node->count = ziplistLen(node->zl);
+    node->count = lpLength(node->entry);
     //更新node的长度信息
     quicklistNodeUpdateSz(node);
     //将node保留的元素在newnode中去除
-    new_node->zl = ziplistDeleteRange(new_node->zl, new_start, new_extent);
-    new_node->count = ziplistLen(new_node->zl);
+    new_node->entry = lpDeleteRange(new_node->entry, new_start, new_extent);
+    new_node->count = lpLength(new_node->entry);
     quicklistNodeUpdateSz(new_node);
 
     D("After split lengths: orig (%d), new (%d)", node->count, new_node->count);
@@ -1018,12 +1010,13 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
         D("No node given!");
         //创建新的node
         new_node = quicklistCreateNode();
-        //将value加入到新node的zl中
-        new_node->zl = ziplistPush(ziplistNew(), value, sz, ZIPLIST_HEAD);
+        //将value加入到新node的listpack中
+        new_node->entry = lpPrepend(lpNew(), value, sz);
         //插入到quicklist中
         __quicklistInsertNode(quicklist, NULL, new_node, after);
         //更新node和quicklist的count
         new_node->count++;
+        quicklistNodeUpdateSz(new_node);
         quicklist->count++;
         return;
     }
@@ -1037,7 +1030,7 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
     }
     //如果为尾部插入
     if (after && (entry->offset == node->count)) {
-        D("At Tail of current ziplist");
+        D("At Tail of current listpack");
         at_tail = 1;//代表为尾部插入
         //判断下一个节点能不能插入
         if (!_quicklistNodeAllowInsert(node->next, fill, sz)) {
@@ -1061,13 +1054,9 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
     if (!full && after) {//如果后置插入并且node可被插入value
         D("Not full, inserting after current position.");
         quicklistDecompressNodeForUse(node);//解压当前节点，防止出现意外，这边会设置recompress
-        //获取这个节点的后一个元素的其实地址就是操作的实际地址
-        unsigned char *next = ziplistNext(node->zl, entry->zi);
-        if (next == NULL) {//判断是否为尾节点
-            node->zl = ziplistPush(node->zl, value, sz, ZIPLIST_TAIL);
-        } else {//插入元素
-            node->zl = ziplistInsert(node->zl, next, value, sz);
-        }
+        //在zi之后插入元素，listpack不需要区分是否为尾节点
+        node->entry = lpInsert(node->entry, value, sz, entry->zi, LP_AFTER,
+                               NULL);
         //更新node的count
         node->count++;
         //更新node的sz
@@ -1078,7 +1067,8 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
         D("Not full, inserting before current position.");
         quicklistDecompressNodeForUse(node);
         //就在zi出插入就行
-        node->zl = ziplistInsert(node->zl, entry->zi, value, sz);
+        node->entry = lpInsert(node->entry, value, sz, entry->zi, LP_BEFORE,
+                               NULL);
         node->count++;
         quicklistNodeUpdateSz(node);
         quicklistRecompressOnly(quicklist, node);
@@ -1089,7 +1079,7 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
         new_node = node->next;//替换操作node
         quicklistDecompressNodeForUse(new_node);
         //将元素放在nextnode的头部
-        new_node->zl = ziplistPush(new_node->zl, value, sz, ZIPLIST_HEAD);
+        new_node->entry = lpPrepend(new_node->entry, value, sz);
         //更新nextnode的相关信息
         new_node->count++;
         quicklistNodeUpdateSz(new_node);
@@ -1101,7 +1091,7 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
         new_node = node->prev;//使用前置节点
         quicklistDecompressNodeForUse(new_node);
         //插入前置节点尾部
-        new_node->zl = ziplistPush(new_node->zl, value, sz, ZIPLIST_TAIL);
+        new_node->entry = lpAppend(new_node->entry, value, sz);
         //更新相关信息
         new_node->count++;
         quicklistNodeUpdateSz(new_node);
@@ -1113,7 +1103,7 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
         D("\tprovisioning new node...");
         //创建一个新节点
         new_node = quicklistCreateNode();
-        new_node->zl = ziplistPush(ziplistNew(), value, sz, ZIPLIST_HEAD);
+        new_node->entry = lpPrepend(lpNew(), value, sz);
         new_node->count++;
         quicklistNodeUpdateSz(new_node);
         //根据after看插在node之前还是之后
@@ -1126,8 +1116,8 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
         //将node拆开，根据after和offset分割元素
         new_node = _quicklistSplitNode(node, entry->offset, after);
         //根据after将value插入新node的头或者尾
-        new_node->zl = ziplistPush(new_node->zl, value, sz,
-                                   after ? ZIPLIST_HEAD : ZIPLIST_TAIL);
+        new_node->entry = after ? lpPrepend(new_node->entry, value, sz)
+                                : lpAppend(new_node->entry, value, sz);
         //更新新节点的相关数据
         new_node->count++;
         quicklistNodeUpdateSz(new_node);
@@ -1200,7 +1190,7 @@ int quicklistDelRange(quicklist *quicklist, const long start,
         //如果在node的首元素位置并且删除的数量大于这个node的元素数量
         if (entry.offset == 0 && extent >= node->count) {
             /* If we are deleting more than the count of this node, we
-             * can just delete the entire node without ziplist math. */
+             * can just delete the entire node without listpack math. */
             delete_entire_node = 1;
             del = node->count;
         //如果剩余的元素需要全部删除
@@ -1238,7 +1228,7 @@ int quicklistDelRange(quicklist *quicklist, const long start,
             //解压
             quicklistDecompressNodeForUse(node);
             //删除zl在offset之后的del个元素
-            node->zl = ziplistDeleteRange(node->zl, entry.offset, del);
+            node->entry = lpDeleteRange(node->entry, entry.offset, del);
             //更新node和quicklist的相关长度信息
             quicklistNodeUpdateSz(node);
             node->count -= del;
@@ -1258,10 +1248,10 @@ int quicklistDelRange(quicklist *quicklist, const long start,
     return 1;
 }
 
-/* Passthrough to ziplistCompare() */
-//比较ziplist中p1指向的元素和p2指向的元素是否相同
+/* Passthrough to lpCompare() */
+//比较listpack中p1指向的元素和p2指向的元素是否相同
 int quicklistCompare(unsigned char *p1, unsigned char *p2, int p2_len) {
-    return ziplistCompare(p1, p2, p2_len);
+    return lpCompare(p1, p2, p2_len);
 }
 
 /* Returns a quicklist iterator 'iter'. After the initialization every
@@ -1377,18 +1367,18 @@ int quicklistNext(quicklistIter *iter, quicklistEntry *entry) {
         //解压
         quicklistDecompressNodeForUse(iter->current);
         //指向迭代器offset指向的元素
-        iter->zi = ziplistIndex(iter->current->zl, iter->offset);
+        iter->zi = lpSeek(iter->current->entry, iter->offset);
     } else {
         /* else, use existing iterator offset and get prev/next as necessary. */
         if (iter->direction == AL_START_HEAD) {
-            nextFn = ziplistNext;
+            nextFn = lpNext;
             offset_update = 1;
         } else if (iter->direction == AL_START_TAIL) {
-            nextFn = ziplistPrev;
+            nextFn = lpPrev;
             offset_update = -1;
         }
-        //迭代到ziplist下一个entry
-        iter->zi = nextFn(iter->current->zl, iter->zi);
+        //迭代到listpack下一个entry
+        iter->zi = nextFn(iter->current->entry, iter->zi);
         //设置offset
         iter->offset += offset_update;
     }
@@ -1397,11 +1387,11 @@ int quicklistNext(quicklistIter *iter, quicklistEntry *entry) {
     entry->offset = iter->offset;
 
     if (iter->zi) {//如果有则将值存在entry中
-        /* Populate value from existing ziplist position */
-        ziplistGet(entry->zi, &entry->value, &entry->sz, &entry->longval);
+        /* Populate value from existing listpack position */
+        entry->value = lpGetValue(entry->zi, &entry->sz, &entry->longval);
         return 1;
     } else {//已经没有了
-        /* We ran out of ziplist entries.
+        /* We ran out of listpack entries.
          * Pick next node, update offset, then re-run retrieval. */
         //压缩
         quicklistCompress(iter->quicklist, iter->current);
@@ -1442,13 +1432,13 @@ quicklist *quicklistDup(quicklist *orig) {
         quicklistNode *node = quicklistCreateNode();
 
         if (current->encoding == QUICKLIST_NODE_ENCODING_LZF) {
-            quicklistLZF *lzf = (quicklistLZF *)current->zl;
+            quicklistLZF *lzf = (quicklistLZF *)current->entry;
             size_t lzf_sz = sizeof(*lzf) + lzf->sz;
-            node->zl = zmalloc(lzf_sz);
-            memcpy(node->zl, current->zl, lzf_sz);
+            node->entry = zmalloc(lzf_sz);
+            memcpy(node->entry, current->entry, lzf_sz);
         } else if (current->encoding == QUICKLIST_NODE_ENCODING_RAW) {
-            node->zl = zmalloc(current->sz);
-            memcpy(node->zl, current->zl, current->sz);
+            node->entry = zmalloc(current->sz);
+            memcpy(node->entry, current->entry, current->sz);
         }
 
         node->count = current->count;
@@ -1534,9 +1524,9 @@ int quicklistIndex(const quicklist *quicklist, const long long idx,
     //解压node
     quicklistDecompressNodeForUse(entry->node);
     //zi是元素的位置
-    entry->zi = ziplistIndex(entry->node->zl, entry->offset);
+    entry->zi = lpSeek(entry->node->entry, entry->offset);
     //获取zi存储的元素
-    ziplistGet(entry->zi, &entry->value, &entry->sz, &entry->longval);
+    entry->value = lpGetValue(entry->zi, &entry->sz, &entry->longval);
     /* The caller will use our result, so we don't re-compress here.
      * The caller can recompress or delete the node as needed. */
     return 1;
@@ -1550,31 +1540,38 @@ void quicklistRotate(quicklist *quicklist) {
 
     /* First, get the tail entry */
     //定位到尾node的尾元素
-    unsigned char *p = ziplistIndex(quicklist->tail->zl, -1);
-    unsigned char *value;
+    unsigned char *p = lpSeek(quicklist->tail->entry, -1);
+    unsigned char *value, *tmp = NULL;
     long long longval;
     unsigned int sz;
     char longstr[32] = {0};
     //获取元素
-    ziplistGet(p, &value, &sz, &longval);
+    value = lpGetValue(p, &sz, &longval);
 
-    /* If value found is NULL, then ziplistGet populated longval instead */
+    /* If value found is NULL, then lpGetValue populated longval instead */
     if (!value) {
         /* Write the longval as a string so we can re-add it */
         sz = ll2string(longstr, sizeof(longstr), longval);
         value = (unsigned char *)longstr;
+    } else if (quicklist->len == 1) {
+        /* The value lives in the listpack PushHead() is going to realloc,
+         * so we need a copy of it. */
+        tmp = zmalloc(sz);
+        memcpy(tmp, value, sz);
+        value = tmp;
     }
 
     /* Add tail entry to head (must happen before tail is deleted). */
     // 将这个元素插入头节点的首位
     quicklistPushHead(quicklist, value, sz);
+    zfree(tmp);
 
-    /* If quicklist has only one node, the head ziplist is also the
-     * tail ziplist and PushHead() could have reallocated our single ziplist,
+    /* If quicklist has only one node, the head listpack is also the
+     * tail listpack and PushHead() could have reallocated our single listpack,
      * which would make our pre-existing 'p' unusable. */
-    //如果只有一个node，代表p所在的位置已经变了，因为ziplist修改会重新生成一个ziplist，p指向的地址会失效
+    //如果只有一个node，代表p所在的位置已经变了，因为listpack修改会重新生成一个listpack，p指向的地址会失效
     if (quicklist->len == 1) {
-        p = ziplistIndex(quicklist->tail->zl, -1);
+        p = lpSeek(quicklist->tail->entry, -1);
     }
 
     /* Remove tail entry. */
@@ -1624,10 +1621,11 @@ int quicklistPopCustom(quicklist *quicklist, int where, unsigned char **data,
     } else {
         return 0;
     }
-    //获取ziplist元素
-    p = ziplistIndex(node->zl, pos);
+    //获取listpack元素
+    p = lpSeek(node->entry, pos);
     //将p指向的元素获取并保存到data和sz
-    if (ziplistGet(p, &vstr, &vlen, &vlong)) {
+    if (p) {
+        vstr = lpGetValue(p, &vlen, &vlong);
         if (vstr) {
             if (data)
                 *data = saver(vstr, vlen);
@@ -1843,9 +1841,9 @@ static void ql_info(quicklist *ql) {
     printf("Container length: %lu\n", ql->len);
     printf("Container size: %lu\n", ql->count);
     if (ql->head)
-        printf("\t(zsize head: %d)\n", ziplistLen(ql->head->zl));
+        printf("\t(zsize head: %d)\n", lpLength(ql->head->entry));
     if (ql->tail)
-        printf("\t(zsize tail: %d)\n", ziplistLen(ql->tail->zl));
+        printf("\t(zsize tail: %d)\n", lpLength(ql->tail->entry));
     printf("\n");
 #else
     UNUSED(ql);
@@ -1943,18 +1941,18 @@ static int _ql_verify(quicklist *ql, uint32_t len, uint32_t count,
     }
 
     if (ql->head && head_count != ql->head->count &&
-        head_count != ziplistLen(ql->head->zl)) {
+        head_count != lpLength(ql->head->entry)) {
         yell("quicklist head count wrong: expected %d, "
              "got cached %d vs. actual %d",
-             head_count, ql->head->count, ziplistLen(ql->head->zl));
+             head_count, ql->head->count, lpLength(ql->head->entry));
         errors++;
     }
 
     if (ql->tail && tail_count != ql->tail->count &&
-        tail_count != ziplistLen(ql->tail->zl)) {
+        tail_count != lpLength(ql->tail->entry)) {
         yell("quicklist tail count wrong: expected %d, "
              "got cached %u vs. actual %d",
-             tail_count, ql->tail->count, ziplistLen(ql->tail->zl));
+             tail_count, ql->tail->count, lpLength(ql->tail->entry));
         errors++;
     }
 
@@ -2108,7 +2106,7 @@ int quicklistTest(int argc, char *argv[]) {
                 quicklist *ql = quicklistNew(f, options[_i]);
                 quicklistPushHead(ql, "hello", 6);
                 quicklistRotate(ql);
-                /* Ignore compression verify because ziplist is
+                /* Ignore compression verify because listpack is
                  * too small to compress. */
                 ql_verify(ql, 1, 1, 1, 1);
                 quicklistRelease(ql);
@@ -3087,4 +3085,133 @@ int quicklistTest(int argc, char *argv[]) {
 
     return err;
 }
+
+/* Benchmark the quicklist node container: the same push / pop / insert /
+ * index workloads are executed against a ziplist (the old container) and a
+ * listpack (the current one). Element sizes are mixed around 250-254 bytes,
+ * that is where a ziplist entry 'prevlen' field switches from 1 to 5 bytes,
+ * so that inserts may trigger cascading updates in the ziplist. */
+#define QL_BENCH_ELE_MAX 1024
+static unsigned int benchEleSize(int i) {
+    static const unsigned int sizes[] = {250, 254, 251, 253, 8, 252, 300, 250};
+    return sizes[i % (sizeof(sizes) / sizeof(*sizes))];
+}
+
+static void benchReport(const char *op, int elements, long long zl_us,
+                        long long lp_us) {
+    printf("%-22s ziplist %8lld us  listpack %8lld us  (%d elements)\n", op,
+           zl_us, lp_us, elements);
+}
+
+int quicklistBenchmark(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+    unsigned char buf[QL_BENCH_ELE_MAX];
+    unsigned char *zl, *lp, *p, *vstr;
+    unsigned int vlen;
+    long long vlong, start, zl_us, lp_us;
+    int sizes[] = {16, 128, 512};
+
+    memset(buf, 'x', sizeof(buf));
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(*sizes); k++) {
+        int n = sizes[k];
+
+        /* Push at the tail. */
+        start = ustime();
+        zl = ziplistNew();
+        for (int i = 0; i < n; i++)
+            zl = ziplistPush(zl, buf, benchEleSize(i), ZIPLIST_TAIL);
+        zl_us = ustime() - start;
+        start = ustime();
+        lp = lpNew();
+        for (int i = 0; i < n; i++)
+            lp = lpAppend(lp, buf, benchEleSize(i));
+        lp_us = ustime() - start;
+        benchReport("push tail", n, zl_us, lp_us);
+        zfree(zl);
+        lpFree(lp);
+
+        /* Push at the head: every element shifts the others. With the
+         * ziplist a large element may also grow the 'prevlen' of the next. */
+        start = ustime();
+        zl = ziplistNew();
+        for (int i = 0; i < n; i++)
+            zl = ziplistPush(zl, buf, benchEleSize(i), ZIPLIST_HEAD);
+        zl_us = ustime() - start;
+        start = ustime();
+        lp = lpNew();
+        for (int i = 0; i < n; i++)
+            lp = lpPrepend(lp, buf, benchEleSize(i));
+        lp_us = ustime() - start;
+        benchReport("push head", n, zl_us, lp_us);
+
+        /* Index every element from the head and the tail. */
+        start = ustime();
+        for (int i = 0; i < n; i++) {
+            p = ziplistIndex(zl, i % 2 ? i : -i - 1);
+            ziplistGet(p, &vstr, &vlen, &vlong);
+        }
+        zl_us = ustime() - start;
+        start = ustime();
+        for (int i = 0; i < n; i++) {
+            p = lpSeek(lp, i % 2 ? i : -i - 1);
+            lpGetValue(p, &vlen, &vlong);
+        }
+        lp_us = ustime() - start;
+        benchReport("index", n, zl_us, lp_us);
+
+        /* Insert in the middle. */
+        start = ustime();
+        for (int i = 0; i < n; i++) {
+            p = ziplistIndex(zl, ziplistLen(zl) / 2);
+            zl = ziplistInsert(zl, p, buf, benchEleSize(i + 1));
+        }
+        zl_us = ustime() - start;
+        start = ustime();
+        for (int i = 0; i < n; i++) {
+            p = lpSeek(lp, lpLength(lp) / 2);
+            lp = lpInsert(lp, buf, benchEleSize(i + 1), p, LP_BEFORE, NULL);
+        }
+        lp_us = ustime() - start;
+        benchReport("insert middle", n, zl_us, lp_us);
+
+        /* Pop from the head until empty. */
+        start = ustime();
+        while ((p = ziplistIndex(zl, 0)) != NULL)
+            zl = ziplistDelete(zl, &p);
+        zl_us = ustime() - start;
+        start = ustime();
+        while ((p = lpFirst(lp)) != NULL)
+            lp = lpDelete(lp, p, NULL);
+        lp_us = ustime() - start;
+        benchReport("pop head", n * 2, zl_us, lp_us);
+        zfree(zl);
+        lpFree(lp);
+
+        /* Cascade: a 254 bytes element pushed at the head of a list of 250
+         * bytes elements. The ziplist needs to grow the 'prevlen' of every
+         * element, the listpack does not touch them. Since the ziplist never
+         * shrinks 'prevlen' again, a fresh list is used for every sample. */
+        zl_us = lp_us = 0;
+        for (int r = 0; r < 64; r++) {
+            zl = ziplistNew();
+            lp = lpNew();
+            for (int i = 0; i < n; i++) {
+                zl = ziplistPush(zl, buf, 250, ZIPLIST_TAIL);
+                lp = lpAppend(lp, buf, 250);
+            }
+            start = ustime();
+            zl = ziplistPush(zl, buf, 254, ZIPLIST_HEAD);
+            zl_us += ustime() - start;
+            start = ustime();
+            lp = lpPrepend(lp, buf, 254);
+            lp_us += ustime() - start;
+            zfree(zl);
+            lpFree(lp);
+        }
+        benchReport("cascade update (x64)", n, zl_us, lp_us);
+        printf("\n");
+    }
+    return 0;
+}
 #endif
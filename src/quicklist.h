@@ -35,11 +35,11 @@
 
 /* Node, quicklist, and Iterator are the only data structures used currently. */
 
-/* quicklistNode is a 32 byte struct describing a ziplist for a quicklist.
+/* quicklistNode is a 32 byte struct describing a listpack for a quicklist.
  * We use bit fields keep the quicklistNode at 32 bytes.
- * count: 16 bits, max 65536 (max zl bytes is 65k, so max count actually < 32k).
+ * count: 16 bits, max 65536 (max lp bytes is 65k, so max count actually < 32k).
  * encoding: 2 bits, RAW=1, LZF=2.
- * container: 2 bits, NONE=1, ZIPLIST=2.
+ * container: 2 bits, PLAIN=1, PACKED=2.
  * recompress: 1 bit, bool, true if node is temporarry decompressed for usage.
  * attempted_compress: 1 bit, boolean, used for verifying during testing.
  * extra: 10 bits, free for future use; pads out the remainder of 32 bits */
@@ -47,21 +47,20 @@
 typedef struct quicklistNode {
     struct quicklistNode *prev;//8 bytes 结构体指针 
     struct quicklistNode *next;//8 bytes
-    //数据指针。如果当前节点的数据没有压缩，那么它指向一个ziplist结构；否则，它指向一个quicklistLZF结构。
-    unsigned char *zl;//1 bytes //字节对齐 8 bytes
-    //表示zl指向的ziplist的总大小（包括zlbytes, zltail, zllen, zlend和各个数据项）。需要注意的是：如果ziplist被压缩了，那么这个sz的值仍然是压缩前的ziplist大小。
-    unsigned int sz; //4 bytes            /* ziplist size in bytes */
+    //数据指针。如果当前节点的数据没有压缩，那么它指向一个listpack结构；否则，它指向一个quicklistLZF结构。
+    unsigned char *entry;//1 bytes //字节对齐 8 bytes
+    //表示entry指向的listpack的总大小（包括header, 各个数据项和EOF）。需要注意的是：如果listpack被压缩了，那么这个sz的值仍然是压缩前的listpack大小。
+    unsigned int sz; //4 bytes            /* entry size in bytes */
     /*************************下面的所有字节总共占用32位4字节，与上一个sz int型内存对齐************************************/
-    //ziplist中的item数量
-    unsigned int count : 16; //16 bits    /* count of items in ziplist */
-    //表示ziplist是否压缩了（以及用了哪个压缩算法）。目前只有两种取值：2表示被压缩了（而且用的是LZF压缩算法），1表示没有压缩。
+    //listpack中的item数量
+    unsigned int count : 16; //16 bits    /* count of items in listpack */
+    //表示listpack是否压缩了（以及用了哪个压缩算法）。目前只有两种取值：2表示被压缩了（而且用的是LZF压缩算法），1表示没有压缩。
     unsigned int encoding : 2; // 2 bits  /* RAW==1 or LZF==2 */
     /*
-    是一个预留字段。本来设计是用来表明一个quicklist节点下面是直接存数据，还是使用ziplist存数据，
-    或者用其它的结构来存数据（用作一个数据容器，所以叫container）。
-    但是，在目前的实现中，这个值是一个固定的值2，表示使用ziplist作为数据容器。
+    用来表明一个quicklist节点下面是直接存数据，还是使用listpack存数据（用作一个数据容器，所以叫container）。
+    目前的实现中，这个值是一个固定的值2，表示使用listpack作为数据容器。
     */
-    unsigned int container : 2; //2 bits /* NONE==1 or ZIPLIST==2 */
+    unsigned int container : 2; //2 bits /* PLAIN==1 or PACKED==2 */
     //当我们使用类似lindex这样的命令查看了某一项本来压缩的数据时，需要把数据暂时解压，这时就设置recompress=1做一个标记，等有机会再把数据重新压缩。
     unsigned int recompress : 1; // 1 bits/* was this node previous compressed? */
     //这个值只对Redis的自动化测试程序有用。我们不用管它。
@@ -74,11 +73,11 @@ typedef struct quicklistNode {
  * 'sz' is byte length of 'compressed' field.
  * 'compressed' is LZF data with total (compressed) length 'sz'
  * NOTE: uncompressed length is stored in quicklistNode->sz.
- * When quicklistNode->zl is compressed, node->zl points to a quicklistLZF */
+ * When quicklistNode->entry is compressed, node->entry points to a quicklistLZF */
 /*
-quicklistLZF结构表示一个被压缩过的ziplist。其中：
-sz: 表示压缩后的ziplist大小。
-compressed: 是个柔性数组（flexible array member），存放压缩后的ziplist字节数组。
+quicklistLZF结构表示一个被压缩过的listpack。其中：
+sz: 表示压缩后的listpack大小。
+compressed: 是个柔性数组（flexible array member），存放压缩后的listpack字节数组。
 */
 typedef struct quicklistLZF {
     unsigned int sz; /* LZF size in bytes*/
@@ -124,14 +123,14 @@ typedef struct quicklistBookmark {
 typedef struct quicklist {
     quicklistNode *head;
     quicklistNode *tail;
-    //所有ziplist数据项的个数总和。
-    unsigned long count;        /* total count of all entries in all ziplists */
+    //所有listpack数据项的个数总和。
+    unsigned long count;        /* total count of all entries in all listpacks */
     //quicklist节点的个数。
     unsigned long len;          /* number of quicklistNodes */
-    //16bit，ziplist大小设置，存放list-max-ziplist-size参数的值。
+    //16bit，listpack大小设置，存放list-max-ziplist-size参数的值。
     /*
-    这个fill值如果>0,则这个quicklist在插入元素时，ziplist可被插入的判断条件位ziplist的长度有没有查过系统安全上限和节点的count有没有超过fill
-    如果小于0，由于之前设置的时候，最小就是-5，在使用的时候会进行-fill+1，则会在optimization_level这个表中看size是否满足ziplist的判定标准
+    这个fill值如果>0,则这个quicklist在插入元素时，listpack可被插入的判断条件位listpack的长度有没有查过系统安全上限和节点的count有没有超过fill
+    如果小于0，由于之前设置的时候，最小就是-5，在使用的时候会进行-fill+1，则会在optimization_level这个表中看size是否满足listpack的判定标准
     static const size_t optimization_level[] = {4096, 8192, 16384, 32768, 65536};
     */
     int fill : QL_FILL_BITS;  //取值范围：[-5,2^15-1]            /* fill factor for individual nodes */
@@ -145,14 +144,14 @@ typedef struct quicklistIter {
     const quicklist *quicklist;
     quicklistNode *current;
     unsigned char *zi;//初始化的时候为NULL
-    long offset; /* offset in current ziplist */
+    long offset; /* offset in current listpack */
     int direction;//开始迭代的位置，头或者尾，如果current被删除则需要将current指向next或者prev
 } quicklistIter;
 
 typedef struct quicklistEntry {
     const quicklist *quicklist;
     quicklistNode *node;//操作的node
-    unsigned char *zi;//node中zl需要操作的entry位置，结构为ziplist
+    unsigned char *zi;//node中listpack需要操作的entry位置
     unsigned char *value;
     long long longval;
     unsigned int sz;
@@ -163,15 +162,15 @@ typedef struct quicklistEntry {
 #define QUICKLIST_TAIL -1
 
 /* quicklist node encodings */
-#define QUICKLIST_NODE_ENCODING_RAW 1//未压缩的zl
-#define QUICKLIST_NODE_ENCODING_LZF 2//lzf压缩过的zl
+#define QUICKLIST_NODE_ENCODING_RAW 1//未压缩的listpack
+#define QUICKLIST_NODE_ENCODING_LZF 2//lzf压缩过的listpack
 
 /* quicklist compression disable */
 #define QUICKLIST_NOCOMPRESS 0
 
 /* quicklist container formats */
-#define QUICKLIST_NODE_CONTAINER_NONE 1
-#define QUICKLIST_NODE_CONTAINER_ZIPLIST 2
+#define QUICKLIST_NODE_CONTAINER_PLAIN 1
+#define QUICKLIST_NODE_CONTAINER_PACKED 2
 
 #define quicklistNodeIsCompressed(node)                                        \
     ((node)->encoding == QUICKLIST_NODE_ENCODING_LZF)
@@ -206,16 +205,18 @@ int quicklistPushTail(quicklist *quicklist, void *value, const size_t sz);
 //quicklist数据插入，根据where决定调用quicklistPushHead还是quicklistPushTail
 void quicklistPush(quicklist *quicklist, void *value, const size_t sz,int where);
 //在quicklist的tail之后插入一个新的node，node中元素为zl
+void quicklistAppendListpack(quicklist *quicklist, unsigned char *zl);
+//将zl代表的ziplist转换为listpack，作为一个新的node插入到tail之后
 void quicklistAppendZiplist(quicklist *quicklist, unsigned char *zl);
 // 将zl代表的ziplist中的entry全部插入到quicklist的尾节点
 quicklist *quicklistAppendValuesFromZiplist(quicklist *quicklist,unsigned char *zl);
 //用zl代表的ziplist创建一个初始化了fill和compress的quicklist
 quicklist *quicklistCreateFromZiplist(int fill, int compress, unsigned char *zl);
-//向entry指向的node中zl末尾插入value
+//在entry指向的元素之后插入value
 void quicklistInsertAfter(quicklist *quicklist, quicklistEntry *node,void *value, const size_t sz);
-//向entry指向的node中zl头部插入value
+//在entry指向的元素之前插入value
 void quicklistInsertBefore(quicklist *quicklist, quicklistEntry *node, void *value, const size_t sz);
-//删除entry这个node的ziplist中zi所在位置的元素，并更新iter的node和offset
+//删除entry这个node的listpack中zi所在位置的元素，并更新iter的node和offset
 void quicklistDelEntry(quicklistIter *iter, quicklistEntry *entry);
 //替换quicklist位于index位置的元素，index正负代表头部还是尾部第几位
 int quicklistReplaceAtIndex(quicklist *quicklist, long index, void *data, int sz);
@@ -247,7 +248,7 @@ int quicklistPop(quicklist *quicklist, int where, unsigned char **data,
                  unsigned int *sz, long long *slong);
 //获取quicklist的元素个数
 unsigned long quicklistCount(const quicklist *ql);
-//比较ziplist中p1指向的元素和p2指向的元素是否相同
+//比较listpack中p1指向的元素和p2指向的元素是否相同
 int quicklistCompare(unsigned char *p1, unsigned char *p2, int p2_len);
 //获取quicklist这个node压缩过的quicklistLZF数据
 size_t quicklistGetLzf(const quicklistNode *node, void **data);
@@ -264,6 +265,7 @@ void quicklistBookmarksClear(quicklist *ql);
 
 #ifdef REDIS_TEST
 int quicklistTest(int argc, char *argv[]);
+int quicklistBenchmark(int argc, char *argv[]);
 #endif
 
 /* Directions for iterators */
@@ -633,26 +633,31 @@ int rdbSaveObjectType(rio *rdb, robj *o) {
         return rdbSaveType(rdb,RDB_TYPE_STRING);
     case OBJ_LIST:
         if (o->encoding == OBJ_ENCODING_QUICKLIST)
-            return rdbSaveType(rdb,RDB_TYPE_LIST_QUICKLIST);
+            return rdbSaveType(rdb,RDB_TYPE_LIST_QUICKLIST_2);
         else
             serverPanic("Unknown list encoding");
     case OBJ_SET:
         if (o->encoding == OBJ_ENCODING_INTSET)
             return rdbSaveType(rdb,RDB_TYPE_SET_INTSET);
+        else if (o->encoding == OBJ_ENCODING_LISTPACK)
+            return rdbSaveType(rdb,RDB_TYPE_SET_LISTPACK);
+        else if (o->encoding == OBJ_ENCODING_ROARING)
+            return rdbSaveType(rdb,RDB_TYPE_SET_ROARING);
         else if (o->encoding == OBJ_ENCODING_HT)
             return rdbSaveType(rdb,RDB_TYPE_SET);
         else
             serverPanic("Unknown set encoding");
     case OBJ_ZSET:
-        if (o->encoding == OBJ_ENCODING_ZIPLIST)
-            return rdbSaveType(rdb,RDB_TYPE_ZSET_ZIPLIST);
-        else if (o->encoding == OBJ_ENCODING_SKIPLIST)
+        if (o->encoding == OBJ_ENCODING_LISTPACK)
+            return rdbSaveType(rdb,RDB_TYPE_ZSET_LISTPACK);
+        else if (o->encoding == OBJ_ENCODING_SKIPLIST ||
+                 o->encoding == OBJ_ENCODING_BTREE)
             return rdbSaveType(rdb,RDB_TYPE_ZSET_2);
         else
             serverPanic("Unknown sorted set encoding");
     case OBJ_HASH:
-        if (o->encoding == OBJ_ENCODING_ZIPLIST)
-            return rdbSaveType(rdb,RDB_TYPE_HASH_ZIPLIST);
+        if (o->encoding == OBJ_ENCODING_LISTPACK)
+            return rdbSaveType(rdb,RDB_TYPE_HASH_LISTPACK);
         else if (o->encoding == OBJ_ENCODING_HT)
             return rdbSaveType(rdb,RDB_TYPE_HASH);
         else
@@ -773,13 +778,16 @@ ssize_t rdbSaveObject(rio *rdb, robj *o, robj *key) {
             nwritten += n;
 
             while(node) {
+                if ((n = rdbSaveLen(rdb,node->container)) == -1) return -1;
+                nwritten += n;
+
                 if (quicklistNodeIsCompressed(node)) {
                     void *data;
                     size_t compress_len = quicklistGetLzf(node, &data);
                     if ((n = rdbSaveLzfBlob(rdb,data,compress_len,node->sz)) == -1) return -1;
                     nwritten += n;
                 } else {
-                    if ((n = rdbSaveRawString(rdb,node->zl,node->sz)) == -1) return -1;
+                    if ((n = rdbSaveRawString(rdb,node->entry,node->sz)) == -1) return -1;
                     nwritten += n;
                 }
                 node = node->next;
@@ -816,13 +824,27 @@ ssize_t rdbSaveObject(rio *rdb, robj *o, robj *key) {
 
             if ((n = rdbSaveRawString(rdb,o->ptr,l)) == -1) return -1;
             nwritten += n;
+        } else if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            size_t l = lpBytes((unsigned char*)o->ptr);
+
+            if ((n = rdbSaveRawString(rdb,o->ptr,l)) == -1) return -1;
+            nwritten += n;
+        } else if (o->encoding == OBJ_ENCODING_ROARING) {
+            size_t l = roaringSerializedLen(o->ptr);
+            unsigned char *buf = zmalloc(l);
+
+            roaringSerialize(o->ptr,buf);
+            n = rdbSaveRawString(rdb,buf,l);
+            zfree(buf);
+            if (n == -1) return -1;
+            nwritten += n;
         } else {
             serverPanic("Unknown set encoding");
         }
     } else if (o->type == OBJ_ZSET) {
         /* Save a sorted set value */
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            size_t l = ziplistBlobLen((unsigned char*)o->ptr);
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            size_t l = lpBytes((unsigned char*)o->ptr);
 
             if ((n = rdbSaveRawString(rdb,o->ptr,l)) == -1) return -1;
             nwritten += n;
@@ -852,13 +874,36 @@ ssize_t rdbSaveObject(rio *rdb, robj *o, robj *key) {
                 nwritten += n;
                 zn = zn->backward;
             }
+        } else if (o->encoding == OBJ_ENCODING_BTREE) {
+            zset *zs = o->ptr;
+            zbtreePos pos;
+
+            if ((n = rdbSaveLen(rdb,zs->zbt->length)) == -1) return -1;
+            nwritten += n;
+
+            /* Same format and order of the skiplist, so that the two
+             * encodings can be loaded one as the other. */
+            zbtLast(zs->zbt,&pos);
+            while (pos.leaf != NULL) {
+                zbtreeEntry *e = zbtPosEntry(&pos);
+                if ((n = rdbSaveRawString(rdb,
+                    (unsigned char*)e->ele,sdslen(e->ele))) == -1)
+                {
+                    return -1;
+                }
+                nwritten += n;
+                if ((n = rdbSaveBinaryDoubleValue(rdb,e->score)) == -1)
+                    return -1;
+                nwritten += n;
+                if (!zbtPrev(&pos)) break;
+            }
         } else {
             serverPanic("Unknown sorted set encoding");
         }
     } else if (o->type == OBJ_HASH) {
         /* Save a hash value */
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            size_t l = ziplistBlobLen((unsigned char*)o->ptr);
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            size_t l = lpBytes((unsigned char*)o->ptr);
 
             if ((n = rdbSaveRawString(rdb,o->ptr,l)) == -1) return -1;
             nwritten += n;
@@ -1079,6 +1124,27 @@ ssize_t rdbSaveAuxFieldStrInt(rio *rdb, char *key, long long val) {
     return rdbSaveAuxField(rdb,key,strlen(key),buf,vlen);
 }
 
+/* Save the replication backlog (see repl-backlog-persist) as two AUX fields:
+ * "repl-backlog-off", the offset of its first byte, and "repl-backlog", its
+ * content. The latter is written block by block from the replication buffer
+ * instead of being first copied into a single string. */
+static int rdbSaveReplicationBacklog(rio *rdb) {
+    listNode *ln = server.repl_backlog->ref_repl_buf_node;
+
+    if (rdbSaveAuxFieldStrInt(rdb,"repl-backlog-off",server.repl_backlog_off)
+        == -1) return -1;
+    if (rdbSaveType(rdb,RDB_OPCODE_AUX) == -1) return -1;
+    if (rdbSaveRawString(rdb,(unsigned char*)"repl-backlog",12) == -1)
+        return -1;
+    if (rdbSaveLen(rdb,server.repl_backlog_histlen) == -1) return -1;
+    while(ln) {
+        replBufBlock *o = listNodeValue(ln);
+        if (o->used && rdbWriteRaw(rdb,o->buf,o->used) == -1) return -1;
+        ln = listNextNode(ln);
+    }
+    return 1;
+}
+
 /* Save a few default AUX fields with information about the RDB generated. */
 int rdbSaveInfoAuxFields(rio *rdb, int rdbflags, rdbSaveInfo *rsi) {
     int redis_bits = (sizeof(void*) == 8) ? 64 : 32;
@@ -1098,8 +1164,26 @@ int rdbSaveInfoAuxFields(rio *rdb, int rdbflags, rdbSaveInfo *rsi) {
             == -1) return -1;
         if (rdbSaveAuxFieldStrInt(rdb,"repl-offset",server.master_repl_offset)
             == -1) return -1;
+        if (rsi->save_backlog && server.repl_backlog &&
+            server.repl_backlog_histlen > 0 &&
+            rdbSaveReplicationBacklog(rdb) == -1) return -1;
     }
     if (rdbSaveAuxFieldStrInt(rdb,"aof-preamble",aof_preamble) == -1) return -1;
+
+    /* Incremental snapshots: the full snapshot is identified by a random ID
+     * and every delta references the ID of its base and its position in
+     * the chain, followed by the bitmap of the buckets it contains. */
+    if (rdbflags & RDBFLAGS_SNAPSHOT) {
+        if (rdbSaveAuxFieldStrStr(rdb,"snapshot-id",
+            server.rdb_saving_snapshot_id) == -1) return -1;
+    } else if (rdbflags & RDBFLAGS_DELTA) {
+        if (rdbSaveAuxFieldStrStr(rdb,"delta-base",server.rdb_snapshot_id)
+            == -1) return -1;
+        if (rdbSaveAuxFieldStrInt(rdb,"delta-seq",server.rdb_delta_seq+1)
+            == -1) return -1;
+        if (rdbSaveAuxField(rdb,"delta-buckets",13,server.rdb_saving_buckets,
+            RDB_DELTA_BITMAP_LEN) == -1) return -1;
+    }
     return 1;
 }
 
@@ -1142,6 +1226,93 @@ ssize_t rdbSaveSingleModuleAux(rio *rdb, int when, moduleType *mt) {
     return io.bytes;
 }
 
+/* -----------------------------------------------------------------------------
+ * Incremental snapshots
+ *
+ * When rdb-delta-chain-max is non zero, keys are tracked by bucket (the hash
+ * slot of the key) and a background save can write a delta only containing
+ * the buckets modified since the previous snapshot of the chain. Deltas are
+ * stored as "<dbfilename>.delta.<seq>" and are loaded on top of the base
+ * snapshot at startup: every delta removes all the keys of its buckets and
+ * then adds the keys it contains.
+ * -------------------------------------------------------------------------- */
+
+static int rdbBucketIsSet(unsigned char *bitmap, sds key) {
+    unsigned int bucket = keyHashSlot(key,sdslen(key));
+    return bitmap[bucket>>3] & (1<<(bucket&7));
+}
+
+/* Called every time a key is modified or deleted. */
+void rdbMarkKeyDirty(robj *key) {
+    unsigned int bucket;
+
+    if (!server.rdb_delta_chain_max) return;
+    if (sdsEncodedObject(key)) {
+        bucket = keyHashSlot(key->ptr,sdslen(key->ptr));
+    } else {
+        char buf[32];
+        int len = ll2string(buf,sizeof(buf),(long)key->ptr);
+        bucket = keyHashSlot(buf,len);
+    }
+    server.rdb_dirty_buckets[bucket>>3] |= 1<<(bucket&7);
+}
+
+/* Called when the whole dataset changes, like after FLUSHALL: the next
+ * delta will have to include every bucket. */
+void rdbMarkAllDirty(void) {
+    if (!server.rdb_delta_chain_max) return;
+    memset(server.rdb_dirty_buckets,0xff,RDB_DELTA_BITMAP_LEN);
+}
+
+/* Delete from every DB the keys belonging to the buckets set in 'bitmap'. */
+static void rdbPurgeBuckets(unsigned char *bitmap) {
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db+j;
+        dictIterator *di;
+        dictEntry *de;
+
+        if (dictSize(db->dict) == 0) continue;
+        di = dictGetSafeIterator(db->dict);
+        while((de = dictNext(di)) != NULL) {
+            sds keystr = dictGetKey(de);
+            robj key;
+
+            if (!rdbBucketIsSet(bitmap,keystr)) continue;
+            initStaticStringObject(key,keystr);
+            dbSyncDelete(db,&key);
+        }
+        dictReleaseIterator(di);
+    }
+}
+
+/* Return the file name of the delta number 'seq' of the chain. */
+static sds rdbDeltaFilename(long long seq) {
+    return sdscatprintf(sdsempty(),"%s.delta.%lld",server.rdb_filename,seq);
+}
+
+/* Remove the deltas of the current chain, that are no longer useful since a
+ * new full snapshot was saved. */
+static void rdbRemoveDeltaChain(void) {
+    long long seq = 1;
+
+    while(1) {
+        sds fname = rdbDeltaFilename(seq++);
+        int retval = unlink(fname);
+        sdsfree(fname);
+        if (retval == -1) break;
+    }
+}
+
+/* A full snapshot was saved: it becomes the base of a new delta chain. */
+static void rdbCommitFullSnapshot(void) {
+    memcpy(server.rdb_snapshot_id,server.rdb_saving_snapshot_id,
+        sizeof(server.rdb_snapshot_id));
+    rdbRemoveDeltaChain();
+    server.rdb_delta_seq = 0;
+}
+
 /* Produces a dump of the database in RDB format sending it to the specified
  * Redis I/O channel. On success C_OK is returned, otherwise C_ERR
  * is returned and part of the output, or all the output, can be
@@ -1157,6 +1328,11 @@ int rdbSaveRio(rio *rdb, int *error, int rdbflags, rdbSaveInfo *rsi) {
     int j;
     uint64_t cksum;
     size_t processed = 0;
+    size_t keys = 0, keys_total = 0;
+    int ptype = (rdbflags & RDBFLAGS_AOF_PREAMBLE) ? CHILD_INFO_TYPE_AOF :
+                                                     CHILD_INFO_TYPE_RDB;
+
+    for (j = 0; j < server.dbnum; j++) keys_total += dictSize(server.db[j].dict);
 
     if (server.rdb_checksum)
         rdb->update_cksum = rioGenericUpdateChecksum;
@@ -1189,6 +1365,15 @@ int rdbSaveRio(rio *rdb, int *error, int rdbflags, rdbSaveInfo *rsi) {
             robj key, *o = dictGetVal(de);
             long long expire;
 
+            /* Deltas only contain the buckets modified since the last
+             * snapshot of the chain. */
+            if (rdbflags & RDBFLAGS_DELTA &&
+                !rdbBucketIsSet(server.rdb_saving_buckets,keystr)) continue;
+
+            /* Filtered replicas only get the keys they asked for. */
+            if (rsi && rsi->repl_filter &&
+                !replFilterMatchKey(rsi->repl_filter,keystr)) continue;
+
             initStaticStringObject(key,keystr);
             expire = getExpire(db,&key);
             if (rdbSaveKeyValuePair(rdb,&key,o,expire) == -1) goto werr;
@@ -1202,6 +1387,10 @@ int rdbSaveRio(rio *rdb, int *error, int rdbflags, rdbSaveInfo *rsi) {
                 processed = rdb->processed_bytes;
                 aofReadDiffFromParent();
             }
+
+            /* Report the progress to the parent from time to time. */
+            if (!(++keys % CHILD_INFO_KEYS_INTERVAL))
+                sendChildInfoProgress(ptype,keys,keys_total);
         }
         dictReleaseIterator(di);
         di = NULL; /* So that we don't release it again on error. */
@@ -1269,8 +1458,9 @@ werr: /* Write error. */
     return C_ERR;
 }
 
-/* Save the DB on disk. Return C_ERR on error, C_OK on success. */
-int rdbSave(char *filename, rdbSaveInfo *rsi) {
+/* Save the DB on disk, as a full snapshot or as a delta according to
+ * 'rdbflags'. Return C_ERR on error, C_OK on success. */
+static int rdbSaveFile(char *filename, int rdbflags, rdbSaveInfo *rsi) {
     char tmpfile[256];
     char cwd[MAXPATHLEN]; /* Current working dir path for error messages. */
     FILE *fp;
@@ -1296,7 +1486,7 @@ int rdbSave(char *filename, rdbSaveInfo *rsi) {
     if (server.rdb_save_incremental_fsync)
         rioSetAutoSync(&rdb,REDIS_AUTOSYNC_BYTES);
 
-    if (rdbSaveRio(&rdb,&error,RDBFLAGS_NONE,rsi) == C_ERR) {
+    if (rdbSaveRio(&rdb,&error,rdbflags,rsi) == C_ERR) {
         errno = error;
         goto werr;
     }
@@ -1322,7 +1512,8 @@ int rdbSave(char *filename, rdbSaveInfo *rsi) {
         return C_ERR;
     }
 
-    serverLog(LL_NOTICE,"DB saved on disk");
+    serverLog(LL_NOTICE,"%s saved on disk",
+        (rdbflags & RDBFLAGS_DELTA) ? "Delta" : "DB");
     server.dirty = 0;
     server.lastsave = time(NULL);
     server.lastbgsave_status = C_OK;
@@ -1337,13 +1528,40 @@ werr:
     return C_ERR;
 }
 
-int rdbSaveBackground(char *filename, rdbSaveInfo *rsi) {
+/* Save the DB on disk as a full snapshot. Return C_ERR on error, C_OK on
+ * success. */
+int rdbSave(char *filename, rdbSaveInfo *rsi) {
+    int chain = !strcmp(filename,server.rdb_filename);
+
+    /* A child saving in background already got its snapshot ID from the
+     * parent, see rdbSaveBackgroundGeneric(). */
+    if (!server.in_fork_child) {
+        getRandomHexChars(server.rdb_saving_snapshot_id,CONFIG_RUN_ID_SIZE);
+        server.rdb_saving_snapshot_id[CONFIG_RUN_ID_SIZE] = '\0';
+    }
+    if (rdbSaveFile(filename,RDBFLAGS_SNAPSHOT,rsi) == C_ERR) return C_ERR;
+    if (!server.in_fork_child && chain) {
+        rdbCommitFullSnapshot();
+        memset(server.rdb_dirty_buckets,0,RDB_DELTA_BITMAP_LEN);
+    }
+    return C_OK;
+}
+
+static int rdbSaveBackgroundGeneric(char *filename, int delta,
+                                    rdbSaveInfo *rsi)
+{
     pid_t childpid;
 
     if (hasActiveChildProcess()) return C_ERR;
 
     server.dirty_before_bgsave = server.dirty;
     server.lastbgsave_try = time(NULL);
+    if (!delta) {
+        getRandomHexChars(server.rdb_saving_snapshot_id,CONFIG_RUN_ID_SIZE);
+        server.rdb_saving_snapshot_id[CONFIG_RUN_ID_SIZE] = '\0';
+    }
+    memcpy(server.rdb_saving_buckets,server.rdb_dirty_buckets,
+        RDB_DELTA_BITMAP_LEN);
     openChildInfoPipe();
 
     if ((childpid = redisFork()) == 0) {
@@ -1352,7 +1570,13 @@ int rdbSaveBackground(char *filename, rdbSaveInfo *rsi) {
         /* Child */
         redisSetProcTitle("redis-rdb-bgsave");
         redisSetCpuAffinity(server.bgsave_cpulist);
-        retval = rdbSave(filename,rsi);
+        if (delta) {
+            sds fname = rdbDeltaFilename(server.rdb_delta_seq+1);
+            retval = rdbSaveFile(fname,RDBFLAGS_DELTA,rsi);
+            sdsfree(fname);
+        } else {
+            retval = rdbSave(filename,rsi);
+        }
         if (retval == C_OK) {
             sendChildCOWInfo(CHILD_INFO_TYPE_RDB, "RDB");
         }
@@ -1366,15 +1590,44 @@ int rdbSaveBackground(char *filename, rdbSaveInfo *rsi) {
                 strerror(errno));
             return C_ERR;
         }
-        serverLog(LL_NOTICE,"Background saving started by pid %d",childpid);
+        serverLog(LL_NOTICE,"Background %s started by pid %d",
+            delta ? "delta saving" : "saving", childpid);
         server.rdb_save_time_start = time(NULL);
         server.rdb_child_pid = childpid;
         server.rdb_child_type = RDB_CHILD_TYPE_DISK;
+        /* Only snapshots of the configured RDB file are part of the delta
+         * chain: saves to other files leave the chain untouched. */
+        if (delta) {
+            server.rdb_child_delta = RDB_CHILD_DELTA;
+        } else if (!strcmp(filename,server.rdb_filename)) {
+            server.rdb_child_delta = RDB_CHILD_DELTA_BASE;
+        } else {
+            server.rdb_child_delta = RDB_CHILD_DELTA_NONE;
+        }
+        if (server.rdb_child_delta != RDB_CHILD_DELTA_NONE)
+            memset(server.rdb_dirty_buckets,0,RDB_DELTA_BITMAP_LEN);
         return C_OK;
     }
     return C_OK; /* unreached */
 }
 
+int rdbSaveBackground(char *filename, rdbSaveInfo *rsi) {
+    return rdbSaveBackgroundGeneric(filename,0,rsi);
+}
+
+/* Save in background a delta on top of the last snapshot, or a full snapshot
+ * if there is no valid base on disk or the chain reached the configured max
+ * length. */
+static int rdbCanSaveDelta(void) {
+    return server.rdb_delta_chain_max &&
+           server.rdb_snapshot_id[0] != '\0' &&
+           server.rdb_delta_seq < server.rdb_delta_chain_max;
+}
+
+int rdbSaveBackgroundCheckpoint(rdbSaveInfo *rsi) {
+    return rdbSaveBackgroundGeneric(server.rdb_filename,rdbCanSaveDelta(),rsi);
+}
+
 void rdbRemoveTempFile(pid_t childpid) {
     char tmpfile[256];
 
@@ -1457,14 +1710,20 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, sds key) {
         if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
 
         /* Use a regular set when there are too many entries. */
-        if (len > server.set_max_intset_entries) {
+        if (len <= server.set_max_intset_entries) {
+            o = createIntsetObject();
+        } else if (len <= server.set_max_listpack_entries) {
+            o = createSetListpackObject();
+        } else if (server.set_roaring_encoding) {
+            /* Large sets are loaded as roaring bitmaps, and converted as
+             * soon as an element is not an integer. */
+            o = createSetRoaringObject();
+        } else {
             o = createSetObject();
             /* It's faster to expand the dict to the right size asap in order
              * to avoid rehashing */
             if (len > DICT_HT_INITIAL_SIZE)
                 dictExpand(o->ptr,len);
-        } else {
-            o = createIntsetObject();
         }
 
         /* Load every single element of the set */
@@ -1481,6 +1740,29 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, sds key) {
                 /* Fetch integer value from element. */
                 if (isSdsRepresentableAsLongLong(sdsele,&llval) == C_OK) {
                     o->ptr = intsetAdd(o->ptr,llval,NULL);
+                } else if (len <= server.set_max_listpack_entries &&
+                           sdslen(sdsele) <= server.set_max_listpack_value)
+                {
+                    setTypeConvert(o,OBJ_ENCODING_LISTPACK);
+                } else {
+                    setTypeConvert(o,OBJ_ENCODING_HT);
+                    dictExpand(o->ptr,len);
+                }
+            }
+
+            if (o->encoding == OBJ_ENCODING_ROARING) {
+                if (isSdsRepresentableAsLongLong(sdsele,&llval) == C_OK) {
+                    roaringAdd(o->ptr,llval);
+                } else {
+                    setTypeConvert(o,OBJ_ENCODING_HT);
+                    dictExpand(o->ptr,len);
+                }
+            }
+
+            if (o->encoding == OBJ_ENCODING_LISTPACK) {
+                if (sdslen(sdsele) <= server.set_max_listpack_value) {
+                    o->ptr = lpAppend(o->ptr,(unsigned char*)sdsele,
+                                      sdslen(sdsele));
                 } else {
                     setTypeConvert(o,OBJ_ENCODING_HT);
                     dictExpand(o->ptr,len);
@@ -1495,6 +1777,7 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, sds key) {
                 sdsfree(sdsele);
             }
         }
+        setTypeConvertSparseRoaring(o);
     } else if (rdbtype == RDB_TYPE_ZSET_2 || rdbtype == RDB_TYPE_ZSET) {
         /* Read list/set value. */
         uint64_t zsetlen;
@@ -1512,7 +1795,6 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, sds key) {
         while(zsetlen--) {
             sds sdsele;
             double score;
-            zskiplistNode *znode;
 
             if ((sdsele = rdbGenericLoadStringObject(rdb,RDB_LOAD_SDS,NULL)) == NULL) {
                 decrRefCount(o);
@@ -1536,14 +1818,13 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, sds key) {
             /* Don't care about integer-encoded strings. */
             if (sdslen(sdsele) > maxelelen) maxelelen = sdslen(sdsele);
 
-            znode = zslInsert(zs->zsl,score,sdsele);
-            dictAdd(zs->dict,sdsele,&znode->score);
+            zsetInsert(zs,score,sdsele);
         }
 
         /* Convert *after* loading, since sorted sets are not stored ordered. */
-        if (zsetLength(o) <= server.zset_max_ziplist_entries &&
-            maxelelen <= server.zset_max_ziplist_value)
-                zsetConvert(o,OBJ_ENCODING_ZIPLIST);
+        if (zsetLength(o) <= server.zset_max_listpack_entries &&
+            maxelelen <= server.zset_max_listpack_value)
+                zsetConvert(o,OBJ_ENCODING_LISTPACK);
     } else if (rdbtype == RDB_TYPE_HASH) {
         uint64_t len;
         int ret;
@@ -1555,11 +1836,11 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, sds key) {
         o = createHashObject();
 
         /* Too many entries? Use a hash table. */
-        if (len > server.hash_max_ziplist_entries)
+        if (len > server.hash_max_listpack_entries)
             hashTypeConvert(o, OBJ_ENCODING_HT);
 
-        /* Load every field and value into the ziplist */
-        while (o->encoding == OBJ_ENCODING_ZIPLIST && len > 0) {
+        /* Load every field and value into the listpack */
+        while (o->encoding == OBJ_ENCODING_LISTPACK && len > 0) {
             len--;
             /* Load raw strings */
             if ((field = rdbGenericLoadStringObject(rdb,RDB_LOAD_SDS,NULL)) == NULL) {
@@ -1572,15 +1853,13 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, sds key) {
                 return NULL;
             }
 
-            /* Add pair to ziplist */
-            o->ptr = ziplistPush(o->ptr, (unsigned char*)field,
-                    sdslen(field), ZIPLIST_TAIL);
-            o->ptr = ziplistPush(o->ptr, (unsigned char*)value,
-                    sdslen(value), ZIPLIST_TAIL);
+            /* Add pair to listpack */
+            o->ptr = lpAppend(o->ptr, (unsigned char*)field, sdslen(field));
+            o->ptr = lpAppend(o->ptr, (unsigned char*)value, sdslen(value));
 
             /* Convert to hash table if size threshold is exceeded */
-            if (sdslen(field) > server.hash_max_ziplist_value ||
-                sdslen(value) > server.hash_max_ziplist_value)
+            if (sdslen(field) > server.hash_max_listpack_value ||
+                sdslen(value) > server.hash_max_listpack_value)
             {
                 sdsfree(field);
                 sdsfree(value);
@@ -1617,26 +1896,72 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, sds key) {
 
         /* All pairs should be read by now */
         serverAssert(len == 0);
-    } else if (rdbtype == RDB_TYPE_LIST_QUICKLIST) {
+    } else if (rdbtype == RDB_TYPE_LIST_QUICKLIST ||
+               rdbtype == RDB_TYPE_LIST_QUICKLIST_2)
+    {
         if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
         o = createQuicklistObject();
         quicklistSetOptions(o->ptr, server.list_max_ziplist_size,
                             server.list_compress_depth);
 
         while (len--) {
-            unsigned char *zl =
-                rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,NULL);
-            if (zl == NULL) {
+            uint64_t container = QUICKLIST_NODE_CONTAINER_PACKED;
+
+            if (rdbtype == RDB_TYPE_LIST_QUICKLIST_2) {
+                if ((container = rdbLoadLen(rdb,NULL)) == RDB_LENERR) {
+                    decrRefCount(o);
+                    return NULL;
+                }
+                if (container != QUICKLIST_NODE_CONTAINER_PLAIN &&
+                    container != QUICKLIST_NODE_CONTAINER_PACKED)
+                {
+                    rdbExitReportCorruptRDB("Quicklist node container "
+                                            "unknown: %llu",
+                                            (unsigned long long)container);
+                }
+            }
+
+            size_t data_len;
+            unsigned char *data =
+                rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,&data_len);
+            if (data == NULL) {
                 decrRefCount(o);
                 return NULL;
             }
-            quicklistAppendZiplist(o->ptr, zl);
+            /* Serialized nodes are never empty: empty nodes are removed
+             * from the quicklist. */
+            int valid = rdbtype == RDB_TYPE_LIST_QUICKLIST ?
+                (ziplistValidateIntegrity(data,data_len) &&
+                 ziplistLen(data) != 0) :
+                (container == QUICKLIST_NODE_CONTAINER_PLAIN ||
+                 (lpValidateIntegrity(data,data_len) &&
+                  lpFirst(data) != NULL));
+            if (!valid) {
+                zfree(data);
+                decrRefCount(o);
+                rdbExitReportCorruptRDB("Quicklist node integrity check failed.");
+                return NULL;
+            }
+            if (rdbtype == RDB_TYPE_LIST_QUICKLIST) {
+                /* Old quicklist nodes are ziplists: convert them. */
+                quicklistAppendZiplist(o->ptr,data);
+            } else if (container == QUICKLIST_NODE_CONTAINER_PLAIN) {
+                /* A single element saved as it is. */
+                unsigned char *lp = lpAppend(lpNew(),data,data_len);
+                zfree(data);
+                quicklistAppendListpack(o->ptr,lp);
+            } else {
+                quicklistAppendListpack(o->ptr,data);
+            }
         }
     } else if (rdbtype == RDB_TYPE_HASH_ZIPMAP  ||
                rdbtype == RDB_TYPE_LIST_ZIPLIST ||
                rdbtype == RDB_TYPE_SET_INTSET   ||
                rdbtype == RDB_TYPE_ZSET_ZIPLIST ||
-               rdbtype == RDB_TYPE_HASH_ZIPLIST)
+               rdbtype == RDB_TYPE_HASH_ZIPLIST ||
+               rdbtype == RDB_TYPE_HASH_LISTPACK ||
+               rdbtype == RDB_TYPE_ZSET_LISTPACK ||
+               rdbtype == RDB_TYPE_SET_LISTPACK)
     {
         unsigned char *encoded =
             rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,NULL);
@@ -1651,10 +1976,10 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, sds key) {
          * converted. */
         switch(rdbtype) {
             case RDB_TYPE_HASH_ZIPMAP:
-                /* Convert to ziplist encoded hash. This must be deprecated
+                /* Convert to listpack encoded hash. This must be deprecated
                  * when loading dumps created by Redis 2.4 gets deprecated. */
                 {
-                    unsigned char *zl = ziplistNew();
+                    unsigned char *lp = lpNew();
                     unsigned char *zi = zipmapRewind(o->ptr);
                     unsigned char *fstr, *vstr;
                     unsigned int flen, vlen;
@@ -1663,17 +1988,17 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, sds key) {
                     while ((zi = zipmapNext(zi, &fstr, &flen, &vstr, &vlen)) != NULL) {
                         if (flen > maxlen) maxlen = flen;
                         if (vlen > maxlen) maxlen = vlen;
-                        zl = ziplistPush(zl, fstr, flen, ZIPLIST_TAIL);
-                        zl = ziplistPush(zl, vstr, vlen, ZIPLIST_TAIL);
+                        lp = lpAppend(lp, fstr, flen);
+                        lp = lpAppend(lp, vstr, vlen);
                     }
 
                     zfree(o->ptr);
-                    o->ptr = zl;
+                    o->ptr = lp;
                     o->type = OBJ_HASH;
-                    o->encoding = OBJ_ENCODING_ZIPLIST;
+                    o->encoding = OBJ_ENCODING_LISTPACK;
 
-                    if (hashTypeLength(o) > server.hash_max_ziplist_entries ||
-                        maxlen > server.hash_max_ziplist_value)
+                    if (hashTypeLength(o) > server.hash_max_listpack_entries ||
+                        maxlen > server.hash_max_listpack_value)
                     {
                         hashTypeConvert(o, OBJ_ENCODING_HT);
                     }
@@ -1687,19 +2012,42 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, sds key) {
             case RDB_TYPE_SET_INTSET:
                 o->type = OBJ_SET;
                 o->encoding = OBJ_ENCODING_INTSET;
-                if (intsetLen(o->ptr) > server.set_max_intset_entries)
+                if (intsetLen(o->ptr) > server.set_max_intset_entries) {
+                    setTypeConvert(o,server.set_roaring_encoding ?
+                                     OBJ_ENCODING_ROARING : OBJ_ENCODING_HT);
+                    setTypeConvertSparseRoaring(o);
+                }
+                break;
+            case RDB_TYPE_SET_LISTPACK:
+                o->type = OBJ_SET;
+                o->encoding = OBJ_ENCODING_LISTPACK;
+                if (setTypeSize(o) > server.set_max_listpack_entries)
                     setTypeConvert(o,OBJ_ENCODING_HT);
                 break;
             case RDB_TYPE_ZSET_ZIPLIST:
+            case RDB_TYPE_ZSET_LISTPACK:
+                if (rdbtype == RDB_TYPE_ZSET_ZIPLIST) {
+                    /* Old sorted sets are ziplists: convert them. */
+                    unsigned char *lp = ziplistToListpack(o->ptr);
+                    zfree(o->ptr);
+                    o->ptr = lp;
+                }
                 o->type = OBJ_ZSET;
-                o->encoding = OBJ_ENCODING_ZIPLIST;
-                if (zsetLength(o) > server.zset_max_ziplist_entries)
-                    zsetConvert(o,OBJ_ENCODING_SKIPLIST);
+                o->encoding = OBJ_ENCODING_LISTPACK;
+                if (zsetLength(o) > server.zset_max_listpack_entries)
+                    zsetConvert(o,zsetLargeEncoding());
                 break;
             case RDB_TYPE_HASH_ZIPLIST:
+            case RDB_TYPE_HASH_LISTPACK:
+                if (rdbtype == RDB_TYPE_HASH_ZIPLIST) {
+                    /* Old hashes are ziplists: convert them. */
+                    unsigned char *lp = ziplistToListpack(o->ptr);
+                    zfree(o->ptr);
+                    o->ptr = lp;
+                }
                 o->type = OBJ_HASH;
-                o->encoding = OBJ_ENCODING_ZIPLIST;
-                if (hashTypeLength(o) > server.hash_max_ziplist_entries)
+                o->encoding = OBJ_ENCODING_LISTPACK;
+                if (hashTypeLength(o) > server.hash_max_listpack_entries)
                     hashTypeConvert(o, OBJ_ENCODING_HT);
                 break;
             default:
@@ -1707,6 +2055,24 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, sds key) {
                 rdbExitReportCorruptRDB("Unknown RDB encoding type %d",rdbtype);
                 break;
         }
+    } else if (rdbtype == RDB_TYPE_SET_ROARING) {
+        size_t encoded_len;
+        unsigned char *encoded =
+            rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,&encoded_len);
+        roaring *r;
+
+        if (encoded == NULL) return NULL;
+        r = roaringDeserialize(encoded,encoded_len);
+        zfree(encoded);
+        if (r == NULL || roaringCardinality(r) == 0) {
+            if (r) roaringFree(r);
+            rdbExitReportCorruptRDB("Roaring bitmap set integrity check failed.");
+            return NULL;
+        }
+        o = createObject(OBJ_SET,r);
+        o->encoding = OBJ_ENCODING_ROARING;
+        if (!server.set_roaring_encoding) setTypeConvert(o,OBJ_ENCODING_HT);
+        else setTypeConvertSparseRoaring(o);
     } else if (rdbtype == RDB_TYPE_STREAM_LISTPACKS) {
         o = createStreamObject();
         stream *s = o->ptr;
@@ -1957,8 +2323,12 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, sds key) {
 /* Mark that we are loading in the global state and setup the fields
  * needed to provide loading stats. */
 void startLoading(size_t size, int rdbflags) {
-    /* Load the DB */
-    server.loading = 1;
+    /* Load the DB. When loading asynchronously the current data set is
+     * still served, so we don't enter the loading state clients see. */
+    if (rdbflags & RDBFLAGS_ASYNC_LOAD)
+        server.async_loading = 1;
+    else
+        server.loading = 1;
     server.loading_start_time = time(NULL);
     server.loading_loaded_bytes = 0;
     server.loading_total_bytes = size;
@@ -1995,6 +2365,7 @@ void loadingProgress(off_t pos) {
 /* Loading finished */
 void stopLoading(int success) {
     server.loading = 0;
+    server.async_loading = 0;
     rdbFileBeingLoaded = NULL;
 
     /* Fire the loading modules end event. */
@@ -2049,9 +2420,17 @@ void rdbLoadProgressCallback(rio *r, const void *buf, size_t len) {
 /* Load an RDB file from the rio stream 'rdb'. On success C_OK is returned,
  * otherwise C_ERR is returned and 'errno' is set accordingly. */
 int rdbLoadRio(rio *rdb, int rdbflags, rdbSaveInfo *rsi) {
+    return rdbLoadRioWithDb(rdb,rdbflags,rsi,server.db);
+}
+
+/* Like rdbLoadRio() but the keys are loaded into 'dbarray', that must have
+ * server.dbnum entries, instead of server.db. This is used by replicas
+ * loading the RDB from the master with repl-diskless-load async, in order
+ * to keep serving the old data set while the new one is being loaded. */
+int rdbLoadRioWithDb(rio *rdb, int rdbflags, rdbSaveInfo *rsi, redisDb *dbarray) {
     uint64_t dbid;
     int type, rdbver;
-    redisDb *db = server.db+0;
+    redisDb *db = dbarray+0;
     char buf[1024];
 
     rdb->update_cksum = rdbLoadProgressCallback;
@@ -2070,6 +2449,14 @@ int rdbLoadRio(rio *rdb, int rdbflags, rdbSaveInfo *rsi) {
         return C_ERR;
     }
 
+    /* Loading anything but a delta replaces the dataset: the delta chain on
+     * disk, if any, no longer describes it, unless this RDB turns out to be
+     * the base snapshot itself (see the "snapshot-id" AUX field). */
+    if (!(rdbflags & RDBFLAGS_DELTA)) {
+        server.rdb_snapshot_id[0] = '\0';
+        server.rdb_delta_seq = 0;
+    }
+
     /* Key-specific attributes, set by opcodes before the key type. */
     long long lru_idle = -1, lfu_freq = -1, expiretime = -1, now = mstime();
     long long lru_clock = LRU_CLOCK();
@@ -2121,7 +2508,7 @@ int rdbLoadRio(rio *rdb, int rdbflags, rdbSaveInfo *rsi) {
                     "databases. Exiting\n", server.dbnum);
                 exit(1);
             }
-            db = server.db+dbid;
+            db = dbarray+dbid;
             continue; /* Read next opcode. */
         } else if (type == RDB_OPCODE_RESIZEDB) {
             /* RESIZEDB: Hint about the size of the keys in the currently
@@ -2160,6 +2547,17 @@ int rdbLoadRio(rio *rdb, int rdbflags, rdbSaveInfo *rsi) {
                 }
             } else if (!strcasecmp(auxkey->ptr,"repl-offset")) {
                 if (rsi) rsi->repl_offset = strtoll(auxval->ptr,NULL,10);
+            } else if (!strcasecmp(auxkey->ptr,"repl-backlog-off")) {
+                if (rsi) rsi->repl_backlog_off = strtoll(auxval->ptr,NULL,10);
+            } else if (!strcasecmp(auxkey->ptr,"repl-backlog")) {
+                /* Only useful for the RDB loaded at startup, see
+                 * replicationRestoreBacklog(). The string may be big: take
+                 * it from the object instead of copying it. */
+                if (rsi && !(rdbflags & RDBFLAGS_REPLICATION)) {
+                    sdsfree(rsi->repl_backlog);
+                    rsi->repl_backlog = auxval->ptr;
+                    auxval->ptr = sdsempty();
+                }
             } else if (!strcasecmp(auxkey->ptr,"lua")) {
                 /* Load the script back in memory. */
                 if (luaCreateFunction(NULL,server.lua,auxval) == NULL) {
@@ -2182,8 +2580,30 @@ int rdbLoadRio(rio *rdb, int rdbflags, rdbSaveInfo *rsi) {
             } else if (!strcasecmp(auxkey->ptr,"aof-preamble")) {
                 long long haspreamble = strtoll(auxval->ptr,NULL,10);
                 if (haspreamble) serverLog(LL_NOTICE,"RDB has an AOF tail");
-            } else if (!strcasecmp(auxkey->ptr,"redis-bits")) {
-                /* Just ignored. */
+            } else if (!strcasecmp(auxkey->ptr,"snapshot-id")) {
+                /* Only an RDB loaded from our own data file can be the base
+                 * of the delta chain. */
+                if (!(rdbflags & (RDBFLAGS_AOF_PREAMBLE|RDBFLAGS_REPLICATION|
+                                  RDBFLAGS_ALLOW_DUP|RDBFLAGS_DELTA)) &&
+                    sdslen(auxval->ptr) == CONFIG_RUN_ID_SIZE)
+                {
+                    memcpy(server.rdb_snapshot_id,auxval->ptr,
+                        CONFIG_RUN_ID_SIZE+1);
+                }
+            } else if (!strcasecmp(auxkey->ptr,"delta-buckets")) {
+                /* The delta replaces the whole content of its buckets: drop
+                 * the keys loaded so far before loading the new ones. */
+                if (rdbflags & RDBFLAGS_DELTA &&
+                    sdslen(auxval->ptr) == RDB_DELTA_BITMAP_LEN)
+                {
+                    rdbPurgeBuckets((unsigned char*)auxval->ptr);
+                }
+            } else if (!strcasecmp(auxkey->ptr,"redis-bits") ||
+                       !strcasecmp(auxkey->ptr,"delta-base") ||
+                       !strcasecmp(auxkey->ptr,"delta-seq"))
+            {
+                /* Just ignored. "delta-*" fields are checked by
+                 * rdbLoadDeltaChain() before loading the file. */
             } else {
                 /* We ignore fields we don't understand, as by AUX field
                  * contract. */
@@ -2362,6 +2782,78 @@ int rdbLoad(char *filename, rdbSaveInfo *rsi, int rdbflags) {
     return retval;
 }
 
+/* Read the AUX fields at the start of the delta 'filename' in order to
+ * check it belongs to the current chain and comes right after the last
+ * delta loaded. Return C_OK if the delta can be loaded, otherwise C_ERR. */
+static int rdbCheckDeltaHeader(char *filename, long long seq) {
+    char buf[10];
+    FILE *fp;
+    rio rdb;
+    int type, valid_base = 0, valid_seq = 0;
+
+    if ((fp = fopen(filename,"r")) == NULL) return C_ERR;
+    rioInitWithFile(&rdb,fp);
+    if (rioRead(&rdb,buf,9) == 0 || memcmp(buf,"REDIS",5) != 0) goto end;
+    while((type = rdbLoadType(&rdb)) == RDB_OPCODE_AUX) {
+        robj *auxkey, *auxval;
+
+        if ((auxkey = rdbLoadStringObject(&rdb)) == NULL) goto end;
+        if ((auxval = rdbLoadStringObject(&rdb)) == NULL) {
+            decrRefCount(auxkey);
+            goto end;
+        }
+        if (!strcasecmp(auxkey->ptr,"delta-base")) {
+            valid_base = !strcmp(auxval->ptr,server.rdb_snapshot_id);
+        } else if (!strcasecmp(auxkey->ptr,"delta-seq")) {
+            valid_seq = strtoll(auxval->ptr,NULL,10) == seq;
+        }
+        decrRefCount(auxkey);
+        decrRefCount(auxval);
+    }
+
+end:
+    fclose(fp);
+    return (valid_base && valid_seq) ? C_OK : C_ERR;
+}
+
+/* Load on top of the base snapshot just loaded the chain of deltas saved
+ * after it. Deltas not belonging to the chain, like the ones left by an
+ * older base, are ignored. Returns C_ERR if a delta of the chain could not
+ * be loaded, in which case the dataset is only partially updated. */
+int rdbLoadDeltaChain(rdbSaveInfo *rsi) {
+    if (server.rdb_snapshot_id[0] == '\0') return C_OK;
+
+    while(1) {
+        long long start = ustime();
+        sds fname = rdbDeltaFilename(server.rdb_delta_seq+1);
+
+        if (access(fname,F_OK) == -1) {
+            sdsfree(fname);
+            break;
+        }
+        if (rdbCheckDeltaHeader(fname,server.rdb_delta_seq+1) == C_ERR) {
+            serverLog(LL_WARNING,"Ignoring %s: it doesn't belong to the "
+                                 "current delta chain", fname);
+            sdsfree(fname);
+            break;
+        }
+        if (rdbLoad(fname,rsi,RDBFLAGS_DELTA) != C_OK) {
+            serverLog(LL_WARNING,"Error loading %s: %s",
+                fname, strerror(errno));
+            sdsfree(fname);
+            return C_ERR;
+        }
+        server.rdb_delta_seq++;
+        serverLog(LL_NOTICE,"Delta %s loaded: %.3f seconds",
+            fname, (float)(ustime()-start)/1000000);
+        sdsfree(fname);
+    }
+
+    /* Memory and disk are in sync again. */
+    memset(server.rdb_dirty_buckets,0,RDB_DELTA_BITMAP_LEN);
+    return C_OK;
+}
+
 /* A background saving child (BGSAVE) terminated its work. Handle this.
  * This function covers the case of actual BGSAVEs. */
 void backgroundSaveDoneHandlerDisk(int exitcode, int bysignal) {
@@ -2388,6 +2880,20 @@ void backgroundSaveDoneHandlerDisk(int exitcode, int bysignal) {
         if (bysignal != SIGUSR1)
             server.lastbgsave_status = C_ERR;
     }
+    if (server.rdb_child_delta != RDB_CHILD_DELTA_NONE) {
+        if (!bysignal && exitcode == 0) {
+            if (server.rdb_child_delta == RDB_CHILD_DELTA)
+                server.rdb_delta_seq++;
+            else
+                rdbCommitFullSnapshot();
+        } else {
+            /* The buckets saved by the child are still dirty. */
+            int j;
+            for (j = 0; j < RDB_DELTA_BITMAP_LEN; j++)
+                server.rdb_dirty_buckets[j] |= server.rdb_saving_buckets[j];
+        }
+    }
+    server.rdb_child_delta = RDB_CHILD_DELTA_NONE;
     server.rdb_child_pid = -1;
     server.rdb_child_type = RDB_CHILD_TYPE_NONE;
     server.rdb_save_time_last = time(NULL)-server.rdb_save_time_start;
@@ -2473,9 +2979,13 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
     listRewind(server.slaves,&li);
     while((ln = listNext(&li))) {
         client *slave = ln->value;
-        if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) {
-            server.rdb_pipe_conns[server.rdb_pipe_numconns++] = slave->conn;
+        if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START &&
+            replFilterEqual(slave->repl_filter,rsi->repl_filter))
+        {
+            /* Setup the slave first: it may switch to a compressed
+             * connection after the +FULLRESYNC reply. */
             replicationSetupSlaveForFullResync(slave,getPsyncInitialOffset());
+            server.rdb_pipe_conns[server.rdb_pipe_numconns++] = slave->conn;
         }
     }
 
@@ -2514,7 +3024,9 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
             listRewind(server.slaves,&li);
             while((ln = listNext(&li))) {
                 client *slave = ln->value;
-                if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_END) {
+                if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_END &&
+                    !slave->repl_from_spool)
+                {
                     slave->replstate = SLAVE_STATE_WAIT_BGSAVE_START;
                 }
             }
@@ -2532,6 +3044,10 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
             server.rdb_child_pid = childpid;
             server.rdb_child_type = RDB_CHILD_TYPE_SOCKET;
             close(server.rdb_pipe_write); /* close write in parent so that it can detect the close on the child. */
+            /* Replicas of the previous transfer may still be reading its
+             * spool: this one is not spooled in that case. */
+            if (server.repl_diskless_sync_spool && server.rdb_spool_fd == -1)
+                replicationSpoolCreate();
             if (aeCreateFileEvent(server.el, server.rdb_pipe_read, AE_READABLE, rdbPipeReadHandler,NULL) == AE_ERR) {
                 serverPanic("Unrecoverable error creating server.rdb_pipe_read file event.");
             }
@@ -2557,13 +3073,23 @@ void saveCommand(client *c) {
 
 /* BGSAVE [SCHEDULE] */
 void bgsaveCommand(client *c) {
-    int schedule = 0;
+    int schedule = 0, delta = 0;
 
     /* The SCHEDULE option changes the behavior of BGSAVE when an AOF rewrite
-     * is in progress. Instead of returning an error a BGSAVE gets scheduled. */
+     * is in progress. Instead of returning an error a BGSAVE gets scheduled.
+     *
+     * The DELTA option saves only the keys modified since the last snapshot
+     * on top of it, or a full snapshot if a delta can't be chained. */
     if (c->argc > 1) {
         if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"schedule")) {
             schedule = 1;
+        } else if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"delta")) {
+            if (!server.rdb_delta_chain_max) {
+                addReplyError(c,"BGSAVE DELTA requires rdb-delta-chain-max "
+                                "to be greater than zero");
+                return;
+            }
+            delta = 1;
         } else {
             addReply(c,shared.syntaxerr);
             return;
@@ -2585,6 +3111,12 @@ void bgsaveCommand(client *c) {
             "Use BGSAVE SCHEDULE in order to schedule a BGSAVE whenever "
             "possible.");
         }
+    } else if (delta && rdbCanSaveDelta()) {
+        if (rdbSaveBackgroundCheckpoint(rsiptr) == C_OK) {
+            addReplyStatus(c,"Background delta saving started");
+        } else {
+            addReply(c,shared.err);
+        }
     } else if (rdbSaveBackground(server.rdb_filename,rsiptr) == C_OK) {
         addReplyStatus(c,"Background saving started");
     } else {
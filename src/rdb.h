@@ -38,7 +38,7 @@
 
 /* The current RDB version. When the format changes in a way that is no longer
  * backward compatible this number gets incremented. */
-#define RDB_VERSION 9
+#define RDB_VERSION 10
 
 /* Defines related to the dump file format. To store 32 bits lengths for short
  * keys requires a lot of space, so we check the most significant 2 bits of
@@ -91,10 +91,16 @@
 #define RDB_TYPE_HASH_ZIPLIST  13
 #define RDB_TYPE_LIST_QUICKLIST 14
 #define RDB_TYPE_STREAM_LISTPACKS 15
+#define RDB_TYPE_HASH_LISTPACK 16
+#define RDB_TYPE_ZSET_LISTPACK 17
+#define RDB_TYPE_LIST_QUICKLIST_2 18 /* Quicklist of listpacks. */
+#define RDB_TYPE_SET_LISTPACK  20
+#define RDB_TYPE_SET_ROARING   21
 /* NOTE: WHEN ADDING NEW RDB TYPE, UPDATE rdbIsObjectType() BELOW */
 
 /* Test if a type is an object type. */
-#define rdbIsObjectType(t) ((t >= 0 && t <= 7) || (t >= 9 && t <= 15))
+#define rdbIsObjectType(t) ((t >= 0 && t <= 7) || (t >= 9 && t <= 18) || \
+                            (t >= 20 && t <= 21))
 
 /* Special RDB opcodes (saved/loaded with rdbSaveType/rdbLoadType). */
 #define RDB_OPCODE_MODULE_AUX 247   /* Module auxiliary data. */
@@ -126,6 +132,20 @@
 #define RDBFLAGS_AOF_PREAMBLE (1<<0)    /* Load/save the RDB as AOF preamble. */
 #define RDBFLAGS_REPLICATION (1<<1)     /* Load/save for SYNC. */
 #define RDBFLAGS_ALLOW_DUP (1<<2)       /* Allow duplicated keys when loading.*/
+#define RDBFLAGS_SNAPSHOT (1<<3)        /* Full snapshot, base of deltas. */
+#define RDBFLAGS_DELTA (1<<4)           /* Delta on top of the base snapshot. */
+#define RDBFLAGS_ASYNC_LOAD (1<<5)      /* Load while serving the old dataset. */
+
+/* Keys are assigned to one of RDB_DELTA_BUCKETS buckets by hash slot: a
+ * delta snapshot contains all the keys of the buckets that were modified
+ * since the previous snapshot of the chain. */
+#define RDB_DELTA_BUCKETS 16384
+#define RDB_DELTA_BITMAP_LEN (RDB_DELTA_BUCKETS/8)
+
+/* Role of the RDB saved by the active child in the delta chain. */
+#define RDB_CHILD_DELTA_NONE 0  /* Not part of the chain. */
+#define RDB_CHILD_DELTA_BASE 1  /* Full snapshot, new base of the chain. */
+#define RDB_CHILD_DELTA 2       /* Delta appended to the chain. */
 
 int rdbSaveType(rio *rdb, unsigned char type);
 int rdbLoadType(rio *rdb);
@@ -143,6 +163,10 @@ int rdbSaveBackground(char *filename, rdbSaveInfo *rsi);
 int rdbSaveToSlavesSockets(rdbSaveInfo *rsi);
 void rdbRemoveTempFile(pid_t childpid);
 int rdbSave(char *filename, rdbSaveInfo *rsi);
+int rdbSaveBackgroundCheckpoint(rdbSaveInfo *rsi);
+int rdbLoadDeltaChain(rdbSaveInfo *rsi);
+void rdbMarkKeyDirty(robj *key);
+void rdbMarkAllDirty(void);
 ssize_t rdbSaveObject(rio *rdb, robj *o, robj *key);
 size_t rdbSavedObjectLen(robj *o, robj *key);
 robj *rdbLoadObject(int type, rio *rdb, sds key);
@@ -158,6 +182,7 @@ int rdbLoadBinaryDoubleValue(rio *rdb, double *val);
 int rdbSaveBinaryFloatValue(rio *rdb, float val);
 int rdbLoadBinaryFloatValue(rio *rdb, float *val);
 int rdbLoadRio(rio *rdb, int rdbflags, rdbSaveInfo *rsi);
+int rdbLoadRioWithDb(rio *rdb, int rdbflags, rdbSaveInfo *rsi, redisDb *dbarray);
 int rdbSaveRio(rio *rdb, int *error, int rdbflags, rdbSaveInfo *rsi);
 rdbSaveInfo *rdbPopulateSaveInfo(rdbSaveInfo *rsi);
 
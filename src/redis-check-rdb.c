@@ -46,6 +46,9 @@ struct {
     int doing;                      /* The state while reading the RDB. */
     int error_set;                  /* True if error is populated. */
     char error[1024];
+    sds snapshot_id;                /* "snapshot-id" AUX field, if any. */
+    sds delta_base;                 /* "delta-base" AUX field, if any. */
+    long long delta_seq;            /* "delta-seq" AUX field, or 0. */
 } rdbstate;
 
 /* At every loading step try to remember what we were about to do, so that
@@ -85,7 +88,13 @@ char *rdb_type_string[] = {
     "zset-ziplist",
     "hash-ziplist",
     "quicklist",
-    "stream"
+    "stream",
+    "hash-listpack",
+    "zset-listpack",
+    "quicklist-v2",
+    "",
+    "set-listpack",
+    "set-roaring"
 };
 
 /* Show a few stats collected into 'rdbstate' */
@@ -188,6 +197,11 @@ int redis_check_rdb(char *rdbfilename, FILE *fp) {
 
     rioInitWithFile(&rdb,fp);
     rdbstate.rio = &rdb;
+    sdsfree(rdbstate.snapshot_id);
+    sdsfree(rdbstate.delta_base);
+    rdbstate.snapshot_id = NULL;
+    rdbstate.delta_base = NULL;
+    rdbstate.delta_seq = 0;
     rdb.update_cksum = rdbLoadProgressCallback;
     if (rioRead(&rdb,buf,9) == 0) goto eoferr;
     buf[9] = '\0';
@@ -267,8 +281,27 @@ int redis_check_rdb(char *rdbfilename, FILE *fp) {
             if ((auxkey = rdbLoadStringObject(&rdb)) == NULL) goto eoferr;
             if ((auxval = rdbLoadStringObject(&rdb)) == NULL) goto eoferr;
 
-            rdbCheckInfo("AUX FIELD %s = '%s'",
-                (char*)auxkey->ptr, (char*)auxval->ptr);
+            if (!strcasecmp(auxkey->ptr,"delta-buckets")) {
+                /* Binary bitmap: just report how many buckets it has. */
+                rdbCheckInfo("AUX FIELD %s = %zu buckets",
+                    (char*)auxkey->ptr,
+                    redisPopcount(auxval->ptr,sdslen(auxval->ptr)));
+            } else if (!strcasecmp(auxkey->ptr,"repl-backlog")) {
+                rdbCheckInfo("AUX FIELD %s = %zu bytes",
+                    (char*)auxkey->ptr, sdslen(auxval->ptr));
+            } else {
+                rdbCheckInfo("AUX FIELD %s = '%s'",
+                    (char*)auxkey->ptr, (char*)auxval->ptr);
+            }
+            if (!strcasecmp(auxkey->ptr,"snapshot-id")) {
+                sdsfree(rdbstate.snapshot_id);
+                rdbstate.snapshot_id = sdsdup(auxval->ptr);
+            } else if (!strcasecmp(auxkey->ptr,"delta-base")) {
+                sdsfree(rdbstate.delta_base);
+                rdbstate.delta_base = sdsdup(auxval->ptr);
+            } else if (!strcasecmp(auxkey->ptr,"delta-seq")) {
+                rdbstate.delta_seq = strtoll(auxval->ptr,NULL,10);
+            }
             decrRefCount(auxkey);
             decrRefCount(auxval);
             continue; /* Read type again. */
@@ -342,10 +375,15 @@ err:
  * When called with fp = NULL, the function never returns, but exits with the
  * status code according to success (RDB is sane) or error (RDB is corrupted).
  * Otherwise if called with a non NULL fp, the function returns C_OK or
- * C_ERR depending on the success or failure. */
+ * C_ERR depending on the success or failure.
+ *
+ * As a standalone executable, the RDB file can be followed by the deltas
+ * chained to it, that are checked as well, together with the fact they
+ * form a valid chain on top of the first file. */
 int redis_check_rdb_main(int argc, char **argv, FILE *fp) {
-    if (argc != 2 && fp == NULL) {
-        fprintf(stderr, "Usage: %s <rdb-file-name>\n", argv[0]);
+    if (argc < 2 && fp == NULL) {
+        fprintf(stderr, "Usage: %s <rdb-file-name> [<delta-file-name> ...]\n",
+            argv[0]);
         exit(1);
     }
     /* In order to call the loading functions we need to create the shared
@@ -359,6 +397,31 @@ int redis_check_rdb_main(int argc, char **argv, FILE *fp) {
     rdbCheckSetupSignals();
     //校验rdb文件的合法性
     int retval = redis_check_rdb(argv[1],fp);
+    if (retval == 0 && fp == NULL && argc > 2) {
+        sds base = rdbstate.snapshot_id ? sdsdup(rdbstate.snapshot_id) : NULL;
+        int j;
+
+        if (base == NULL) {
+            rdbCheckError("%s is not the base of a delta chain", argv[1]);
+            retval = 1;
+        }
+        for (j = 2; j < argc && retval == 0; j++) {
+            rdbCheckInfo("Checking RDB delta %s", argv[j]);
+            retval = redis_check_rdb(argv[j],NULL);
+            if (retval != 0) break;
+            if (rdbstate.delta_base == NULL ||
+                strcmp(rdbstate.delta_base,base) != 0)
+            {
+                rdbCheckError("%s is not a delta of %s", argv[j], argv[1]);
+                retval = 1;
+            } else if (rdbstate.delta_seq != j-1) {
+                rdbCheckError("%s is delta %lld of the chain, expected %d",
+                    argv[j], rdbstate.delta_seq, j-1);
+                retval = 1;
+            }
+        }
+        sdsfree(base);
+    }
     if (retval == 0) {
         rdbCheckInfo("\\o/ RDB looks OK! \\o/");
         rdbShowGenericInfo();
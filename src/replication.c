@@ -44,6 +44,7 @@ void replicationResurrectCachedMaster(connection *conn);
 void replicationSendAck(void);
 void putSlaveOnline(client *slave);
 int cancelReplicationHandshake(void);
+int replicationAttachToSpool(client *c);
 
 /* We take a global flag to remember if this instance generated an RDB
  * because of replication, so that we can remove the RDB file in case
@@ -111,9 +112,12 @@ int bg_unlink(const char *filename) {
 
 void createReplicationBacklog(void) {
     serverAssert(server.repl_backlog == NULL);
-    server.repl_backlog = zmalloc(server.repl_backlog_size);
+    serverAssert(listLength(server.repl_buffer_blocks) == 0);
+    server.repl_backlog = zmalloc(sizeof(replBacklog));
+    server.repl_backlog->ref_repl_buf_node = NULL;
+    server.repl_backlog->blocks_index = raxNew();
+    server.repl_backlog->unindexed_count = 0;
     server.repl_backlog_histlen = 0;
-    server.repl_backlog_idx = 0;
 
     /* We don't have any data inside our buffer, but virtually the first
      * byte we have is the next byte that will be generated for the
@@ -123,82 +127,195 @@ void createReplicationBacklog(void) {
 
 /* This function is called when the user modifies the replication backlog
  * size at runtime. It is up to the function to both update the
- * server.repl_backlog_size and to resize the buffer and setup it so that
- * it contains the same data as the previous one (possibly less data, but
- * the most recent bytes, or the same data and more free space in case the
- * buffer is enlarged). */
+ * server.repl_backlog_size and to trim the backlog if it is now too big.
+ * Since the backlog just references the shared replication buffer, when
+ * the backlog is enlarged it will refill with new data incrementally, and
+ * when it is shrunk the extra blocks are released incrementally as well by
+ * the next writes and by replicationCron(). */
 void resizeReplicationBacklog(long long newsize) {
     if (newsize < CONFIG_REPL_BACKLOG_MIN_SIZE)
         newsize = CONFIG_REPL_BACKLOG_MIN_SIZE;
     if (server.repl_backlog_size == newsize) return;
 
     server.repl_backlog_size = newsize;
-    if (server.repl_backlog != NULL) {
-        /* What we actually do is to flush the old buffer and realloc a new
-         * empty one. It will refill with new data incrementally.
-         * The reason is that copying a few gigabytes adds latency and even
-         * worse often we need to alloc additional space before freeing the
-         * old buffer. */
-        zfree(server.repl_backlog);
-        server.repl_backlog = zmalloc(server.repl_backlog_size);
-        server.repl_backlog_histlen = 0;
-        server.repl_backlog_idx = 0;
-        /* Next byte we have is... the next since the buffer is empty. */
-        server.repl_backlog_off = server.master_repl_offset+1;
-    }
+    if (server.repl_backlog != NULL)
+        trimReplicationBacklog(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
 }
 
 //释放服务端的backlog
 void freeReplicationBacklog(void) {
     serverAssert(listLength(server.slaves) == 0);
+    if (server.repl_backlog == NULL) return;
+    raxFree(server.repl_backlog->blocks_index);
     zfree(server.repl_backlog);
     server.repl_backlog = NULL;
+
+    /* Without replicas and backlog nobody references the replication
+     * buffer anymore. */
+    listEmpty(server.repl_buffer_blocks);
+    server.repl_buffer_mem = 0;
+}
+
+/* Make 'ln', a block of the replication buffer, the one referenced by the
+ * replica or backlog currently referencing 'ref' (NULL if none). */
+static void moveReplicationBufferRef(listNode **ref, listNode *ln) {
+    if (*ref) ((replBufBlock*)listNodeValue(*ref))->refcount--;
+    if (ln) ((replBufBlock*)listNodeValue(ln))->refcount++;
+    *ref = ln;
+}
+
+/* Release up to 'max_blocks' blocks at the head of the replication buffer
+ * that are no longer referenced: since the backlog and the replicas only
+ * move forward in the buffer, nobody will need them again. The limit
+ * avoids blocking the server when a huge amount of blocks is released at
+ * once, for instance when a replica lagging by gigabytes disconnects: the
+ * rest is released by the next calls. */
+static void freeUnreferencedReplicationBlocks(int max_blocks) {
+    listNode *ln;
+
+    while(max_blocks-- && (ln = listFirst(server.repl_buffer_blocks))) {
+        replBufBlock *o = listNodeValue(ln);
+
+        if (o->refcount) break;
+        server.repl_buffer_mem -= zmalloc_size(o)+sizeof(listNode);
+        listDelNode(server.repl_buffer_blocks,ln);
+    }
+}
+
+/* Called when a new block is appended to the replication buffer while
+ * there is a backlog: index it if enough blocks were added since the last
+ * indexed one. */
+static void indexReplicationBacklogBlock(listNode *ln) {
+    replBufBlock *o = listNodeValue(ln);
+    uint64_t key;
+
+    if (++server.repl_backlog->unindexed_count < REPL_BACKLOG_INDEX_PER_BLOCKS)
+        return;
+    key = htonu64(o->repl_offset);
+    raxInsert(server.repl_backlog->blocks_index,(unsigned char*)&key,
+              sizeof(key),ln,NULL);
+    server.repl_backlog->unindexed_count = 0;
+}
+
+/* Move the start of the backlog forward, a block at a time, as long as it
+ * still retains at least repl-backlog-size bytes of history, and at most
+ * by 'max_blocks' blocks, then release the blocks no longer referenced by
+ * replicas. */
+void trimReplicationBacklog(int max_blocks) {
+    listNode *ln = server.repl_backlog->ref_repl_buf_node;
+    int trimmed = 0;
+
+    while(ln && ln != listLast(server.repl_buffer_blocks) &&
+          trimmed < max_blocks)
+    {
+        replBufBlock *o = listNodeValue(ln);
+        uint64_t key;
+
+        if (server.repl_backlog_histlen - (long long)o->used <
+            server.repl_backlog_size) break;
+        server.repl_backlog_histlen -= o->used;
+        server.repl_backlog_off += o->used;
+        /* The index only references blocks of the backlog. */
+        key = htonu64(o->repl_offset);
+        raxRemove(server.repl_backlog->blocks_index,(unsigned char*)&key,
+                  sizeof(key),NULL);
+        ln = listNextNode(ln);
+        trimmed++;
+    }
+    moveReplicationBufferRef(&server.repl_backlog->ref_repl_buf_node,ln);
+    freeUnreferencedReplicationBlocks(max_blocks);
 }
 
-/* Add data to the replication backlog.
+/* Called by a replica that sent all the data of the block it references:
+ * move to the next block, if any, and release what is no longer needed. */
+void replicaAdvanceReplicationBuffer(client *c) {
+    listNode *next = listNextNode(c->ref_repl_buf_node);
+
+    if (next == NULL) return;
+    moveReplicationBufferRef(&c->ref_repl_buf_node,next);
+    c->ref_block_pos = 0;
+    freeUnreferencedReplicationBlocks(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
+}
+
+/* Called by freeClient() for replicas. */
+void replicaReleaseReplicationBuffer(client *c) {
+    if (c->ref_repl_buf_node == NULL) return;
+    moveReplicationBufferRef(&c->ref_repl_buf_node,NULL);
+    c->ref_block_pos = 0;
+    freeUnreferencedReplicationBlocks(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
+}
+
+/* Return the number of bytes of the replication buffer the replica 'c' has
+ * still to receive. */
+size_t getReplicaPendingReplicationBytes(client *c) {
+    replBufBlock *cur, *last;
+
+    if (c->ref_repl_buf_node == NULL) return 0;
+    cur = listNodeValue(c->ref_repl_buf_node);
+    last = listNodeValue(listLast(server.repl_buffer_blocks));
+    return (last->repl_offset + last->used) -
+           (cur->repl_offset + c->ref_block_pos);
+}
+
+/* Return the last block of the replication buffer, making sure it has some
+ * free space: new replicas will reference it starting from the next byte
+ * that will be appended to the buffer. */
+static listNode *replicationBufferTail(size_t len) {
+    listNode *ln = listLast(server.repl_buffer_blocks);
+    replBufBlock *tail = ln ? listNodeValue(ln) : NULL;
+
+    if (tail && tail->used < tail->size) return ln;
+
+    size_t size = (len < PROTO_REPLY_CHUNK_BYTES) ? PROTO_REPLY_CHUNK_BYTES : len;
+    tail = zmalloc(size+sizeof(replBufBlock));
+    /* Take over the allocation's internal fragmentation space. */
+    tail->size = zmalloc_usable(tail) - sizeof(replBufBlock);
+    tail->used = 0;
+    tail->refcount = 0;
+    tail->repl_offset = server.master_repl_offset+1;
+    listAddNodeTail(server.repl_buffer_blocks,tail);
+    server.repl_buffer_mem += zmalloc_size(tail)+sizeof(listNode);
+    if (server.repl_backlog)
+        indexReplicationBacklogBlock(listLast(server.repl_buffer_blocks));
+    return listLast(server.repl_buffer_blocks);
+}
+
+/* Add data to the replication buffer, referenced by the backlog and by the
+ * replicas.
  * This function also increments the global replication offset stored at
  * server.master_repl_offset, because there is no case where we want to feed
  * the backlog without incrementing the offset. */
-//将数据加入环形缓存backlog
-void feedReplicationBacklog(void *ptr, size_t len) {
+//将数据加入复制缓冲区
+void feedReplicationBuffer(void *ptr, size_t len) {
     unsigned char *p = ptr;
-    //更新主节点缓存偏移
-    server.master_repl_offset += len;
-
-    /* This is a circular buffer, so write as much data we can at every
-     * iteration and rewind the "idx" index if we reach the limit. */
-    while(len) {//这边会循环往里面去写
-        //获取还剩多少剩余位置
-        size_t thislen = server.repl_backlog_size - server.repl_backlog_idx;
-        //如果长度不够怎么处理
+
+    if (server.repl_backlog == NULL) return;
+
+    while(len) {
+        listNode *ln = replicationBufferTail(len);
+        replBufBlock *tail = listNodeValue(ln);
+        size_t thislen = tail->size - tail->used;
+
+        /* The backlog starts from the first block ever written. */
+        if (server.repl_backlog->ref_repl_buf_node == NULL)
+            moveReplicationBufferRef(&server.repl_backlog->ref_repl_buf_node,ln);
+
         if (thislen > len) thislen = len;
-        //先数据复制进去一部分
-        memcpy(server.repl_backlog+server.repl_backlog_idx,p,thislen);
-        //可以直接超出
-        server.repl_backlog_idx += thislen;
-        //如果到上限直接到起点
-        if (server.repl_backlog_idx == server.repl_backlog_size)
-            server.repl_backlog_idx = 0;
-        //获取没有复制进去的长度
+        memcpy(tail->buf+tail->used,p,thislen);
+        tail->used += thislen;
+        //更新主节点缓存偏移
+        server.master_repl_offset += thislen;
+        server.repl_backlog_histlen += thislen;
         len -= thislen;
-        //指针迁移到没有复制的地址首位
         p += thislen;
-        //更新实际使用的长度大小加上实际复制进数据的长度
-        server.repl_backlog_histlen += thislen;
     }
-    //如果已使用的超了直接置为最大值
-    if (server.repl_backlog_histlen > server.repl_backlog_size)
-        server.repl_backlog_histlen = server.repl_backlog_size;
-    /* Set the offset of the first byte we have in the backlog. */
-    //修改backlog的第一个偏移字节位置
-    server.repl_backlog_off = server.master_repl_offset -
-                              server.repl_backlog_histlen + 1;
+    trimReplicationBacklog(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
 }
 
-/* Wrapper for feedReplicationBacklog() that takes Redis string objects
+/* Wrapper for feedReplicationBuffer() that takes Redis string objects
  * as input. */
-//将robj中的元素加入到backlog中
-void feedReplicationBacklogWithObject(robj *o) {
+//将robj中的元素加入到复制缓冲区
+void feedReplicationBufferWithObject(robj *o) {
     char llstr[LONG_STR_SIZE];
     void *p;
     size_t len;
@@ -210,21 +327,204 @@ void feedReplicationBacklogWithObject(robj *o) {
         len = sdslen(o->ptr);
         p = o->ptr;
     }
-    feedReplicationBacklog(p,len);
+    feedReplicationBuffer(p,len);
+}
+
+/* Called before appending new data to the replication buffer: replicas
+ * that don't reference the buffer yet, like the ones waiting for the
+ * BGSAVE to end since it started, are attached to the next byte that will
+ * be written, and the write handler is installed if needed. */
+void prepareReplicasToWrite(void) {
+    listIter li;
+    listNode *ln;
+
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        client *slave = ln->value;
+
+        /* Don't feed slaves that are still waiting for BGSAVE to start,
+         * nor the filtered ones, that have their own stream. */
+        if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) continue;
+        if (slave->repl_filter) continue;
+
+        if (prepareClientToWrite(slave) == C_ERR) continue;
+        if (slave->ref_repl_buf_node == NULL) {
+            listNode *tail = replicationBufferTail(0);
+            moveReplicationBufferRef(&slave->ref_repl_buf_node,tail);
+            slave->ref_block_pos = ((replBufBlock*)listNodeValue(tail))->used;
+        }
+    }
+}
+
+/* Called after new data was appended to the replication buffer, in order
+ * to enforce the output buffer limits of the replicas. */
+void checkReplicasOutputBufferLimits(void) {
+    listIter li;
+    listNode *ln;
+
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        client *slave = ln->value;
+        if (slave->ref_repl_buf_node)
+            asyncCloseClientOnOutputBufferLimitReached(slave);
+    }
+}
+
+/* --------------------------- Filtered replication --------------------------
+ * A filter is a space separated list of rules, a key matches the filter if
+ * it matches at least one of them:
+ *
+ *   prefix:<prefix>    Keys starting with <prefix>.
+ *   slots:<from>-<to>  Keys hashing to a cluster slot in the given range
+ *                      (inclusive), like CLUSTER KEYSLOT. "slots:<n>" for
+ *                      a single slot.
+ *
+ * The RDB of a filtered replica only contains the matching keys, and the
+ * replication stream only the commands with at least one matching key, or
+ * with no key at all (SELECT, PING, FLUSHALL, MULTI/EXEC, ...). */
+
+/* Parse a filter. On error NULL is returned and 'err' is set. */
+replFilter *replFilterCreate(char *spec, char **err) {
+    replFilter *f = zcalloc(sizeof(*f));
+    sds *rules;
+    int numrules, j;
+
+    rules = sdssplitlen(spec,strlen(spec)," ",1,&numrules);
+    f->spec = sdsnew(spec);
+    f->prefixes = zmalloc(sizeof(sds)*(numrules ? numrules : 1));
+    f->seldb = -1;
+    for (j = 0; j < numrules; j++) {
+        sds rule = rules[j];
+
+        if (sdslen(rule) == 0) continue;
+        if (!strncasecmp(rule,"prefix:",7) && sdslen(rule) > 7) {
+            f->prefixes[f->numprefixes++] = sdsnew(rule+7);
+        } else if (!strncasecmp(rule,"slots:",6)) {
+            long long from, to;
+            char *dash = strchr(rule+6,'-');
+
+            if (dash) *dash = '\0';
+            if (!string2ll(rule+6,strlen(rule+6),&from) ||
+                (dash && !string2ll(dash+1,strlen(dash+1),&to)))
+            {
+                *err = "invalid slot range";
+                goto error;
+            }
+            if (!dash) to = from;
+            if (from < 0 || to >= CLUSTER_SLOTS || from > to) {
+                *err = "slot out of range";
+                goto error;
+            }
+            if (!f->slots) f->slots = zcalloc(CLUSTER_SLOTS/8);
+            for (; from <= to; from++)
+                f->slots[from/8] |= 1<<(from&7);
+        } else {
+            *err = "rules must be prefix:<prefix> or slots:<from>-<to>";
+            goto error;
+        }
+    }
+    if (f->numprefixes == 0 && f->slots == NULL) {
+        *err = "empty filter";
+        goto error;
+    }
+    sdsfreesplitres(rules,numrules);
+    return f;
+
+error:
+    sdsfreesplitres(rules,numrules);
+    replFilterFree(f);
+    return NULL;
+}
+
+void replFilterFree(replFilter *f) {
+    int j;
+
+    if (f == NULL) return;
+    for (j = 0; j < f->numprefixes; j++) sdsfree(f->prefixes[j]);
+    zfree(f->prefixes);
+    zfree(f->slots);
+    sdsfree(f->spec);
+    zfree(f);
+}
+
+/* Return true if the two filters select the same keys. Replicas without a
+ * filter (NULL) only match each other. */
+int replFilterEqual(replFilter *a, replFilter *b) {
+    if (a == NULL || b == NULL) return a == b;
+    return sdscmp(a->spec,b->spec) == 0;
+}
+
+int replFilterMatchKey(replFilter *f, sds key) {
+    int j;
+
+    for (j = 0; j < f->numprefixes; j++) {
+        size_t plen = sdslen(f->prefixes[j]);
+        if (sdslen(key) >= plen && !memcmp(key,f->prefixes[j],plen))
+            return 1;
+    }
+    if (f->slots) {
+        unsigned int slot = keyHashSlot(key,sdslen(key));
+        if (f->slots[slot/8] & (1<<(slot&7))) return 1;
+    }
+    return 0;
+}
+
+/* Append a command to the output buffer of the filtered replicas, if it is
+ * one of the commands they want. */
+static void replicationFeedFilteredSlaves(int dictid, robj **argv, int argc) {
+    struct redisCommand *cmd = lookupCommand(argv[0]->ptr);
+    int *keys = NULL, numkeys = 0, j;
+    listNode *ln;
+    listIter li;
+
+    if (cmd) keys = getKeysFromCommand(cmd,argv,argc,&numkeys);
+
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        client *slave = ln->value;
+        replFilter *f = slave->repl_filter;
+
+        if (f == NULL) continue;
+        if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) continue;
+        if (numkeys) {
+            for (j = 0; j < numkeys; j++) {
+                robj *key = argv[keys[j]];
+                if (sdsEncodedObject(key) && replFilterMatchKey(f,key->ptr))
+                    break;
+            }
+            if (j == numkeys) continue;
+        }
+
+        if (f->seldb != dictid) {
+            if (dictid >= 0 && dictid < PROTO_SHARED_SELECT_CMDS) {
+                addReply(slave,shared.select[dictid]);
+            } else {
+                addReplyArrayLen(slave,2);
+                addReplyBulkCString(slave,"SELECT");
+                addReplyBulkLongLong(slave,dictid);
+            }
+            f->seldb = dictid;
+        }
+        addReplyArrayLen(slave,argc);
+        for (j = 0; j < argc; j++) addReplyBulk(slave,argv[j]);
+    }
+    if (keys) getKeysFreeResult(keys);
 }
 
 /* Propagate write commands to slaves, and populate the replication backlog
  * as well. This function is used if the instance is a master: we use
  * the commands received by our clients in order to create the replication
  * stream. Instead if the instance is a slave and has sub-slaves attached,
- * we use replicationFeedSlavesFromMaster() */
+ * we use replicationFeedSlavesFromMaster()
+ *
+ * The stream is appended just once to the replication buffer, that is
+ * shared by the backlog and by the slaves output buffers. */
 //从库同步主库的数据
 void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
-    listNode *ln;
-    listIter li;
     int j, len;
     //长整型最大位数21位 longlong
     char llstr[LONG_STR_SIZE];
+    char aux[LONG_STR_SIZE+3];
 
     /* If the instance is not a top level master, return ASAP: we'll just proxy
      * the stream of data we receive from our master instead, in order to
@@ -243,6 +543,8 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
     //不能接受有从库但是没有backlog
     serverAssert(!(listLength(slaves) != 0 && server.repl_backlog == NULL));
 
+    prepareReplicasToWrite();
+
     /* Send SELECT command to every slave if needed. */
     //判断分库的db是否为正确的db
     if (server.slaveseldb != dictid) {
@@ -262,70 +564,42 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
                 dictid_len, llstr));
         }
 
-        /* Add the SELECT command into the backlog. */
-        //将指令加入到backlog
-        if (server.repl_backlog) feedReplicationBacklogWithObject(selectcmd);
+        /* Add the SELECT command into the replication buffer. */
+        feedReplicationBufferWithObject(selectcmd);
 
-        /* Send it to slaves. */
-        listRewind(slaves,&li);
-        while((ln = listNext(&li))) {
-            client *slave = ln->value;
-            if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) continue;
-            addReply(slave,selectcmd);
-        }
         //如果是新建的robj引用结束，计数--
         if (dictid < 0 || dictid >= PROTO_SHARED_SELECT_CMDS)
             decrRefCount(selectcmd);
     }
     server.slaveseldb = dictid;
 
-    /* Write the command to the replication backlog if any. */
-    if (server.repl_backlog) {
-        char aux[LONG_STR_SIZE+3];
+    /* Write the command to the replication buffer. */
 
-        /* Add the multi bulk reply length. */
-        aux[0] = '*';
-        len = ll2string(aux+1,sizeof(aux)-1,argc);
-        aux[len+1] = '\r';
-        aux[len+2] = '\n';
-        feedReplicationBacklog(aux,len+3);
+    /* Add the multi bulk reply length. */
+    aux[0] = '*';
+    len = ll2string(aux+1,sizeof(aux)-1,argc);
+    aux[len+1] = '\r';
+    aux[len+2] = '\n';
+    feedReplicationBuffer(aux,len+3);
 
-        for (j = 0; j < argc; j++) {
-            long objlen = stringObjectLen(argv[j]);
+    for (j = 0; j < argc; j++) {
+        long objlen = stringObjectLen(argv[j]);
 
-            /* We need to feed the buffer with the object as a bulk reply
-             * not just as a plain string, so create the $..CRLF payload len
-             * and add the final CRLF */
-            aux[0] = '$';
-            len = ll2string(aux+1,sizeof(aux)-1,objlen);
-            aux[len+1] = '\r';
-            aux[len+2] = '\n';
-            feedReplicationBacklog(aux,len+3);
-            feedReplicationBacklogWithObject(argv[j]);
-            feedReplicationBacklog(aux+len+1,2);
-        }
+        /* We need to feed the buffer with the object as a bulk reply
+         * not just as a plain string, so create the $..CRLF payload len
+         * and add the final CRLF */
+        aux[0] = '$';
+        len = ll2string(aux+1,sizeof(aux)-1,objlen);
+        aux[len+1] = '\r';
+        aux[len+2] = '\n';
+        feedReplicationBuffer(aux,len+3);
+        feedReplicationBufferWithObject(argv[j]);
+        feedReplicationBuffer(aux+len+1,2);
     }
 
-    /* Write the command to every slave. */
-    listRewind(slaves,&li);
-    while((ln = listNext(&li))) {
-        client *slave = ln->value;
-
-        /* Don't feed slaves that are still waiting for BGSAVE to start. */
-        if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) continue;
-
-        /* Feed slaves that are waiting for the initial SYNC (so these commands
-         * are queued in the output buffer until the initial SYNC completes),
-         * or are already in sync with the master. */
-
-        /* Add the multi bulk length. */
-        addReplyArrayLen(slave,argc);
-
-        /* Finally any additional argument that was not stored inside the
-         * static buffer if any (from j to argc). */
-        for (j = 0; j < argc; j++)
-            addReplyBulk(slave,argv[j]);
-    }
+    if (server.repl_filtered_slaves)
+        replicationFeedFilteredSlaves(dictid,argv,argc);
+    checkReplicasOutputBufferLimits();
 }
 
 /* This is a debugging function that gets called when we detect something
@@ -334,26 +608,33 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
  * guess what kind of bug it could be. */
 void showLatestBacklog(void) {
     if (server.repl_backlog == NULL) return;
+    if (listLength(server.repl_buffer_blocks) == 0) return;
 
     long long dumplen = 256;
     if (server.repl_backlog_histlen < dumplen)
         dumplen = server.repl_backlog_histlen;
 
-    /* Identify the first byte to dump. */
-    long long idx =
-      (server.repl_backlog_idx + (server.repl_backlog_size - dumplen)) %
-       server.repl_backlog_size;
+    /* Walk the blocks backward to find the first byte to dump. */
+    listNode *ln = listLast(server.repl_buffer_blocks);
+    replBufBlock *o = listNodeValue(ln);
+    long long skip = dumplen;
+    while(skip > (long long)o->used && listPrevNode(ln)) {
+        skip -= o->used;
+        ln = listPrevNode(ln);
+        o = listNodeValue(ln);
+    }
 
-    /* Scan the circular buffer to collect 'dumplen' bytes. */
+    /* Collect 'dumplen' bytes from there. */
     sds dump = sdsempty();
-    while(dumplen) {
-        long long thislen =
-            ((server.repl_backlog_size - idx) < dumplen) ?
-            (server.repl_backlog_size - idx) : dumplen;
-
-        dump = sdscatrepr(dump,server.repl_backlog+idx,thislen);
+    size_t pos = o->used - skip;
+    while(ln && dumplen) {
+        long long thislen = o->used - pos;
+        if (thislen > dumplen) thislen = dumplen;
+        dump = sdscatrepr(dump,o->buf+pos,thislen);
         dumplen -= thislen;
-        idx = 0;
+        pos = 0;
+        ln = listNextNode(ln);
+        if (ln) o = listNodeValue(ln);
     }
 
     /* Finally log such bytes: this is vital debugging info to
@@ -366,9 +647,6 @@ void showLatestBacklog(void) {
  * to our sub-slaves. */
 #include <ctype.h>
 void replicationFeedSlavesFromMasterStream(list *slaves, char *buf, size_t buflen) {
-    listNode *ln;
-    listIter li;
-
     /* Debugging: this is handy to see the stream sent from master
      * to slaves. Disabled with if(0). */
     if (0) {
@@ -379,15 +657,13 @@ void replicationFeedSlavesFromMasterStream(list *slaves, char *buf, size_t bufle
         printf("\n");
     }
 
-    if (server.repl_backlog) feedReplicationBacklog(buf,buflen);
-    listRewind(slaves,&li);
-    while((ln = listNext(&li))) {
-        client *slave = ln->value;
-
-        /* Don't feed slaves that are still waiting for BGSAVE to start. */
-        if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) continue;
-        addReplyProto(slave,buf,buflen);
-    }
+    /* There must be a replication backlog assuming there is a master
+     * client, see readSyncBulkPayload(). */
+    if (server.repl_backlog == NULL) return;
+    UNUSED(slaves);
+    prepareReplicasToWrite();
+    feedReplicationBuffer(buf,buflen);
+    checkReplicasOutputBufferLimits();
 }
 
 void replicationFeedMonitors(client *c, list *monitors, int dictid, robj **argv, int argc) {
@@ -430,9 +706,12 @@ void replicationFeedMonitors(client *c, list *monitors, int dictid, robj **argv,
 }
 
 /* Feed the slave 'c' with the replication backlog starting from the
- * specified 'offset' up to the end of the backlog. */
+ * specified 'offset' up to the end of the backlog. The slave just references
+ * the block of the replication buffer holding 'offset', no data is copied. */
 long long addReplyReplicationBacklog(client *c, long long offset) {
-    long long j, skip, len;
+    long long skip;
+    listNode *ln;
+    replBufBlock *o;
 
     serverLog(LL_DEBUG, "[PSYNC] Replica request offset: %lld", offset);
 
@@ -447,37 +726,38 @@ long long addReplyReplicationBacklog(client *c, long long offset) {
              server.repl_backlog_off);
     serverLog(LL_DEBUG, "[PSYNC] History len: %lld",
              server.repl_backlog_histlen);
-    serverLog(LL_DEBUG, "[PSYNC] Current index: %lld",
-             server.repl_backlog_idx);
 
     /* Compute the amount of bytes we need to discard. */
     skip = offset - server.repl_backlog_off;
     serverLog(LL_DEBUG, "[PSYNC] Skipping: %lld", skip);
 
-    /* Point j to the oldest byte, that is actually our
-     * server.repl_backlog_off byte. */
-    j = (server.repl_backlog_idx +
-        (server.repl_backlog_size-server.repl_backlog_histlen)) %
-        server.repl_backlog_size;
-    serverLog(LL_DEBUG, "[PSYNC] Index of first byte: %lld", j);
-
-    /* Discard the amount of data to seek to the specified 'offset'. */
-    j = (j + skip) % server.repl_backlog_size;
-
-    /* Feed slave with data. Since it is a circular buffer we have to
-     * split the reply in two parts if we are cross-boundary. */
-    len = server.repl_backlog_histlen - skip;
-    serverLog(LL_DEBUG, "[PSYNC] Reply total length: %lld", len);
-    while(len) {
-        long long thislen =
-            ((server.repl_backlog_size - j) < len) ?
-            (server.repl_backlog_size - j) : len;
-
-        serverLog(LL_DEBUG, "[PSYNC] addReply() length: %lld", thislen);
-        addReplySds(c,sdsnewlen(server.repl_backlog + j, thislen));
-        len -= thislen;
-        j = 0;
+    /* Seek the block holding 'offset': start from the last indexed block
+     * with a smaller or equal offset, or from the first block of the
+     * backlog, so that we walk at most REPL_BACKLOG_INDEX_PER_BLOCKS
+     * blocks. */
+    ln = server.repl_backlog->ref_repl_buf_node;
+    if (raxSize(server.repl_backlog->blocks_index)) {
+        uint64_t key = htonu64(offset);
+        raxIterator ri;
+
+        raxStart(&ri,server.repl_backlog->blocks_index);
+        raxSeek(&ri,"<=",(unsigned char*)&key,sizeof(key));
+        if (raxNext(&ri)) ln = ri.data;
+        raxStop(&ri);
     }
+    o = listNodeValue(ln);
+    while(offset >= o->repl_offset + (long long)o->used && listNextNode(ln)) {
+        ln = listNextNode(ln);
+        o = listNodeValue(ln);
+    }
+
+    /* Install the write handler while the client has still nothing to
+     * send, then let the slave reference the data. */
+    prepareClientToWrite(c);
+    moveReplicationBufferRef(&c->ref_repl_buf_node,ln);
+    c->ref_block_pos = offset - o->repl_offset;
+    serverLog(LL_DEBUG, "[PSYNC] Reply total length: %lld",
+        server.repl_backlog_histlen - skip);
     return server.repl_backlog_histlen - skip;
 }
 
@@ -489,6 +769,23 @@ long long getPsyncInitialOffset(void) {
     return server.master_repl_offset;
 }
 
+/* Return true if the replication link with 'slave' should be compressed:
+ * the replica announced it can read the compressed stream, and we are
+ * configured to compress it. */
+static int replicationSlaveUseCompression(client *slave) {
+    return server.repl_compression && (slave->slave_capa & SLAVE_CAPA_LZF) &&
+           !connIsCompressed(slave->conn);
+}
+
+/* Switch the link with 'slave' to a compressed connection. This must be
+ * called right after the PSYNC reply was sent, that announced the switch
+ * to the replica with the "lzf" flag. */
+static void replicationSlaveStartCompression(client *slave) {
+    slave->conn = connCreateCompressed(slave->conn,CONN_COMPRESS_WRITE);
+    serverLog(LL_NOTICE,"Replication stream to replica %s is compressed.",
+        replicationGetSlaveName(slave));
+}
+
 /* Send a FULLRESYNC reply in the specific case of a full resynchronization,
  * as a side effect setup the slave for a full sync in different ways:
  *
@@ -515,16 +812,19 @@ int replicationSetupSlaveForFullResync(client *slave, long long offset) {
      * slave as well. Set slaveseldb to -1 in order to force to re-emit
      * a SELECT statement in the replication stream. */
     server.slaveseldb = -1;
+    if (slave->repl_filter) slave->repl_filter->seldb = -1;
 
     /* Don't send this reply to slaves that approached us with
      * the old SYNC command. */
     if (!(slave->flags & CLIENT_PRE_PSYNC)) {
-        buflen = snprintf(buf,sizeof(buf),"+FULLRESYNC %s %lld\r\n",
-                          server.replid,offset);
+        int compress = replicationSlaveUseCompression(slave);
+        buflen = snprintf(buf,sizeof(buf),"+FULLRESYNC %s %lld%s\r\n",
+                          server.replid,offset,compress ? " lzf" : "");
         if (connWrite(slave->conn,buf,buflen) != buflen) {
             freeClientAsync(slave);
             return C_ERR;
         }
+        if (compress) replicationSlaveStartCompression(slave);
     }
     return C_OK;
 }
@@ -546,6 +846,9 @@ int masterTryPartialResynchronization(client *c) {
     if (getLongLongFromObjectOrReply(c,c->argv[2],&psync_offset,NULL) !=
        C_OK) goto need_full_resync;
 
+    /* The stream of filtered replicas is not the one in the backlog. */
+    if (c->repl_filter) goto need_full_resync;
+
     /* Is the replication ID of this master the same advertised by the wannabe
      * slave via PSYNC? If the replication ID changed this master has a
      * different replication history, and there is no way to continue.
@@ -603,15 +906,19 @@ int masterTryPartialResynchronization(client *c) {
     /* We can't use the connection buffers since they are used to accumulate
      * new commands at this stage. But we are sure the socket send buffer is
      * empty so this write will never fail actually. */
+    int compress = replicationSlaveUseCompression(c);
     if (c->slave_capa & SLAVE_CAPA_PSYNC2) {
-        buflen = snprintf(buf,sizeof(buf),"+CONTINUE %s\r\n", server.replid);
+        buflen = snprintf(buf,sizeof(buf),"+CONTINUE %s%s\r\n",
+                          server.replid, compress ? " lzf" : "");
     } else {
+        compress = 0;
         buflen = snprintf(buf,sizeof(buf),"+CONTINUE\r\n");
     }
     if (connWrite(c->conn,buf,buflen) != buflen) {
         freeClientAsync(c);
         return C_OK;
     }
+    if (compress) replicationSlaveStartCompression(c);
     psync_len = addReplyReplicationBacklog(c,psync_offset);
     serverLog(LL_NOTICE,
         "Partial resynchronization request from %s accepted. Sending %lld bytes of backlog starting from offset %lld.",
@@ -659,9 +966,23 @@ need_full_resync:
 int startBgsaveForReplication(int mincapa) {
     int retval;
     int socket_target = server.repl_diskless_sync && (mincapa & SLAVE_CAPA_EOF);
+    replFilter *filter = NULL;
     listIter li;
     listNode *ln;
 
+    /* Filtered replicas need a transfer of their own, always diskless: if
+     * the first replica waiting has a filter, this BGSAVE is for the
+     * replicas with the same filter, the others will wait for the next. */
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        client *slave = ln->value;
+        if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) {
+            filter = slave->repl_filter;
+            break;
+        }
+    }
+    if (filter) socket_target = 1;
+
     serverLog(LL_NOTICE,"Starting BGSAVE for SYNC with target: %s",
         socket_target ? "replicas sockets" : "disk");
 
@@ -670,6 +991,7 @@ int startBgsaveForReplication(int mincapa) {
     /* Only do rdbSave* when rsiptr is not NULL,
      * otherwise slave will miss repl-stream-db. */
     if (rsiptr) {
+        rsiptr->repl_filter = filter;
         if (socket_target)
             retval = rdbSaveToSlavesSockets(rsiptr);
         else
@@ -715,7 +1037,8 @@ int startBgsaveForReplication(int mincapa) {
         while((ln = listNext(&li))) {
             client *slave = ln->value;
 
-            if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) {
+            if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START &&
+                !slave->repl_filter) {
                     replicationSetupSlaveForFullResync(slave,
                             getPsyncInitialOffset());
             }
@@ -749,6 +1072,12 @@ void syncCommand(client *c) {
         return;
     }
 
+    /* The RDB of filtered replicas is always transferred diskless. */
+    if (c->repl_filter && !(c->slave_capa & SLAVE_CAPA_EOF)) {
+        addReplyError(c,"Filtered replication requires the EOF capability");
+        return;
+    }
+
     serverLog(LL_NOTICE,"Replica %s asks for synchronization",
         replicationGetSlaveName(c));
 
@@ -792,6 +1121,7 @@ void syncCommand(client *c) {
     c->repldbfd = -1;
     c->flags |= CLIENT_SLAVE;
     listAddNodeTail(server.slaves,c);
+    if (c->repl_filter) server.repl_filtered_slaves++;
 
     /* Create the replication backlog if needed. */
     if (listLength(server.slaves) == 1 && server.repl_backlog == NULL) {
@@ -820,14 +1150,24 @@ void syncCommand(client *c) {
         listRewind(server.slaves,&li);
         while((ln = listNext(&li))) {
             slave = ln->value;
-            if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_END) break;
+            /* Replicas reading the spool belong to a diskless transfer. */
+            if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_END &&
+                !slave->repl_from_spool) break;
         }
         /* To attach this slave, we check that it has at least all the
-         * capabilities of the slave that triggered the current BGSAVE. */
-        if (ln && ((c->slave_capa & slave->slave_capa) == slave->slave_capa)) {
+         * capabilities of the slave that triggered the current BGSAVE,
+         * and that it wants the same keys. */
+        if (ln && ((c->slave_capa & slave->slave_capa) == slave->slave_capa) &&
+            replFilterEqual(c->repl_filter,slave->repl_filter))
+        {
             /* Perfect, the server is already registering differences for
              * another slave. Set the right state, and copy the buffer. */
             copyClientOutputBuffer(c,slave);
+            if (slave->ref_repl_buf_node) {
+                moveReplicationBufferRef(&c->ref_repl_buf_node,
+                                         slave->ref_repl_buf_node);
+                c->ref_block_pos = slave->ref_block_pos;
+            }
             replicationSetupSlaveForFullResync(c,slave->psync_initial_offset);
             serverLog(LL_NOTICE,"Waiting for end of BGSAVE for SYNC");
         } else {
@@ -841,9 +1181,13 @@ void syncCommand(client *c) {
                server.rdb_child_type == RDB_CHILD_TYPE_SOCKET)
     {
         /* There is an RDB child process but it is writing directly to
-         * children sockets. We need to wait for the next BGSAVE
-         * in order to synchronize. */
-        serverLog(LL_NOTICE,"Current BGSAVE has socket target. Waiting for next BGSAVE for SYNC");
+         * children sockets. Unless its stream is spooled, we need to wait
+         * for the next BGSAVE in order to synchronize. */
+        if (replicationAttachToSpool(c) == C_OK) {
+            serverLog(LL_NOTICE,"Current BGSAVE has socket target. Replica attached to the spooled RDB stream");
+        } else {
+            serverLog(LL_NOTICE,"Current BGSAVE has socket target. Waiting for next BGSAVE for SYNC");
+        }
 
     /* CASE 3: There is no BGSAVE is progress. */
     } else {
@@ -915,6 +1259,30 @@ void replconfCommand(client *c) {
                 c->slave_capa |= SLAVE_CAPA_EOF;
             else if (!strcasecmp(c->argv[j+1]->ptr,"psync2"))
                 c->slave_capa |= SLAVE_CAPA_PSYNC2;
+            else if (!strcasecmp(c->argv[j+1]->ptr,"lzf"))
+                c->slave_capa |= SLAVE_CAPA_LZF;
+        } else if (!strcasecmp(c->argv[j]->ptr,"filter")) {
+            /* REPLCONF FILTER <rules>: only receive the matching keys.
+             * Replicas proxy the stream of their master as it is, so only
+             * a master can filter it. */
+            replFilter *f;
+            char *err;
+
+            if (c->flags & CLIENT_SLAVE) {
+                addReplyError(c,"REPLCONF FILTER must be sent before SYNC");
+                return;
+            }
+            if (server.masterhost) {
+                addReplyError(c,"Filtered replication is only supported "
+                                "by masters");
+                return;
+            }
+            if ((f = replFilterCreate(c->argv[j+1]->ptr,&err)) == NULL) {
+                addReplyErrorFormat(c,"Invalid replication filter: %s",err);
+                return;
+            }
+            replFilterFree(c->repl_filter);
+            c->repl_filter = f;
         } else if (!strcasecmp(c->argv[j]->ptr,"ack")) {
             /* REPLCONF ACK is used by slave to inform the master the amount
              * of replication stream that it processed so far. It is an
@@ -1141,6 +1509,183 @@ void RdbPipeCleanup() {
     checkChildrenDone();
 }
 
+/* ------------------------- Diskless transfer spool ------------------------
+ * With repl-diskless-sync-spool the parent also writes the RDB stream read
+ * from the child's pipe to an unlinked temporary file. Replicas arriving
+ * while the transfer is in progress attach to it, like they would attach to
+ * a BGSAVE with disk target, and receive the stream from the spool starting
+ * from its first byte. They go online, waiting for the first REPLCONF ACK
+ * like the other diskless replicas, once they read the whole stream. */
+
+/* Create the spool, called after forking the diskless RDB child. */
+void replicationSpoolCreate(void) {
+    char tmpfile[256];
+
+    serverAssert(server.rdb_spool_fd == -1);
+    snprintf(tmpfile,sizeof(tmpfile),"temp-spool-%d.rdb",(int)getpid());
+    server.rdb_spool_fd = open(tmpfile,O_RDWR|O_CREAT|O_TRUNC,0644);
+    if (server.rdb_spool_fd == -1) {
+        serverLog(LL_WARNING,"Can't create the diskless transfer spool, "
+            "late replicas will wait for the next BGSAVE: %s",
+            strerror(errno));
+        return;
+    }
+    /* Only the file descriptor is needed, and we don't want leftovers if
+     * we crash. */
+    unlink(tmpfile);
+    server.rdb_spool_len = 0;
+    server.rdb_spool_done = 0;
+}
+
+/* Close the spool if the transfer is over and nobody is reading it. */
+static void replicationSpoolRelease(void) {
+    if (server.rdb_spool_fd == -1 || server.rdb_spool_readers) return;
+    if (!server.rdb_spool_done &&
+        server.rdb_child_type == RDB_CHILD_TYPE_SOCKET) return;
+    close(server.rdb_spool_fd);
+    server.rdb_spool_fd = -1;
+    server.rdb_spool_len = 0;
+    server.rdb_spool_done = 0;
+}
+
+/* Called by freeClient() for replicas still reading the spool. */
+void replicationSpoolRemoveReader(client *c) {
+    c->repl_from_spool = 0;
+    server.rdb_spool_readers--;
+    replicationSpoolRelease();
+}
+
+/* Write handler of the replicas reading the spool: send what was spooled
+ * so far, and put the replica online once the whole stream was sent. */
+static void sendSpoolToSlave(connection *conn) {
+    client *slave = connGetPrivateData(conn);
+    char buf[PROTO_IOBUF_LEN];
+    ssize_t nwritten, buflen;
+    size_t toread;
+
+    if (slave->repldboff == server.rdb_spool_len) {
+        /* Nothing more to send for now: the handler is installed again by
+         * replicationSpoolAppend() or when the transfer ends. */
+        connSetWriteHandler(conn,NULL);
+        if (!server.rdb_spool_done) return;
+        serverLog(LL_NOTICE,
+            "Spooled RDB transfer with replica %s succeeded. Waiting for "
+            "REPLCONF ACK from slave to enable streaming",
+            replicationGetSlaveName(slave));
+        replicationSpoolRemoveReader(slave);
+        slave->replstate = SLAVE_STATE_ONLINE;
+        slave->repl_put_online_on_ack = 1;
+        slave->repl_ack_time = server.unixtime; /* Timeout otherwise. */
+        return;
+    }
+
+    toread = server.rdb_spool_len - slave->repldboff;
+    if (toread > sizeof(buf)) toread = sizeof(buf);
+    buflen = pread(server.rdb_spool_fd,buf,toread,slave->repldboff);
+    if (buflen <= 0) {
+        serverLog(LL_WARNING,"Read error sending the spooled RDB to "
+            "replica: %s", (buflen == 0) ? "premature EOF" : strerror(errno));
+        freeClient(slave);
+        return;
+    }
+    if ((nwritten = connWrite(conn,buf,buflen)) == -1) {
+        if (connGetState(conn) != CONN_STATE_CONNECTED) {
+            serverLog(LL_WARNING,"Write error sending the spooled RDB to "
+                "replica: %s", connGetLastError(conn));
+            freeClient(slave);
+        }
+        return;
+    }
+    slave->repldboff += nwritten;
+    server.stat_net_output_bytes += nwritten;
+}
+
+/* Install the write handler of the spool readers that are waiting for more
+ * data. */
+static void replicationSpoolWakeReaders(void) {
+    listNode *ln;
+    listIter li;
+
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        client *slave = ln->value;
+        if (slave->repl_from_spool && !connHasWriteHandler(slave->conn))
+            connSetWriteHandler(slave->conn,sendSpoolToSlave);
+    }
+}
+
+/* Stop spooling after an error: the replicas reading the spool can't
+ * complete their transfer. */
+static void replicationSpoolAbort(void) {
+    listNode *ln;
+    listIter li;
+
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        client *slave = ln->value;
+        if (slave->repl_from_spool) freeClient(slave);
+    }
+    close(server.rdb_spool_fd);
+    server.rdb_spool_fd = -1;
+    server.rdb_spool_len = 0;
+    server.rdb_spool_done = 0;
+}
+
+/* Append data read from the child's pipe to the spool. */
+static void replicationSpoolAppend(char *buf, size_t len) {
+    while(len) {
+        ssize_t nwritten = write(server.rdb_spool_fd,buf,len);
+        if (nwritten <= 0) {
+            if (nwritten == -1 && errno == EINTR) continue;
+            serverLog(LL_WARNING,"Write error on the diskless transfer "
+                "spool, late replicas will wait for the next BGSAVE: %s",
+                (nwritten == 0) ? "short write" : strerror(errno));
+            replicationSpoolAbort();
+            return;
+        }
+        server.rdb_spool_len += nwritten;
+        buf += nwritten;
+        len -= nwritten;
+    }
+    if (server.rdb_spool_readers) replicationSpoolWakeReaders();
+}
+
+/* Try to attach a replica to the diskless transfer in progress, reading the
+ * RDB stream from the spool. Like with a BGSAVE with disk target, we need
+ * another replica of the same transfer to copy the replication buffer and
+ * the offset from, and the new replica must have at least its capabilities.
+ * Return C_OK if the replica was attached. */
+int replicationAttachToSpool(client *c) {
+    client *slave;
+    listNode *ln;
+    listIter li;
+
+    if (server.rdb_spool_fd == -1 || server.rdb_spool_done ||
+        !(c->slave_capa & SLAVE_CAPA_EOF)) return C_ERR;
+
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        slave = ln->value;
+        if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_END) break;
+    }
+    if (!ln || (c->slave_capa & slave->slave_capa) != slave->slave_capa ||
+        !replFilterEqual(c->repl_filter,slave->repl_filter)) return C_ERR;
+
+    copyClientOutputBuffer(c,slave);
+    if (slave->ref_repl_buf_node) {
+        moveReplicationBufferRef(&c->ref_repl_buf_node,
+                                 slave->ref_repl_buf_node);
+        c->ref_block_pos = slave->ref_block_pos;
+    }
+    if (replicationSetupSlaveForFullResync(c,slave->psync_initial_offset)
+        == C_ERR) return C_ERR;
+    c->repl_from_spool = 1;
+    c->repldboff = 0;
+    server.rdb_spool_readers++;
+    connSetWriteHandler(c->conn,sendSpoolToSlave);
+    return C_OK;
+}
+
 /* Called in diskless master, when there's data to read from the child's rdb pipe */
 void rdbPipeReadHandler(struct aeEventLoop *eventLoop, int fd, void *clientData, int mask) {
     UNUSED(mask);
@@ -1185,6 +1730,9 @@ void rdbPipeReadHandler(struct aeEventLoop *eventLoop, int fd, void *clientData,
             return;
         }
 
+        if (server.rdb_spool_fd != -1)
+            replicationSpoolAppend(server.rdb_pipe_buff,server.rdb_pipe_bufflen);
+
         int stillAlive = 0;
         for (i=0; i < server.rdb_pipe_numconns; i++)
         {
@@ -1217,6 +1765,9 @@ void rdbPipeReadHandler(struct aeEventLoop *eventLoop, int fd, void *clientData,
             stillAlive++;
         }
 
+        /* Replicas reading the spool still need the rest of the stream. */
+        if (stillAlive == 0 && server.rdb_spool_readers) continue;
+
         if (stillAlive == 0) {
             serverLog(LL_WARNING,"Diskless rdb transfer, last replica dropped, killing fork child.");
             killRDBChild();
@@ -1248,13 +1799,31 @@ void updateSlavesWaitingBgsave(int bgsaveerr, int type) {
     listNode *ln;
     int startbgsave = 0;
     int mincapa = -1;
+    int spool_ending;
     listIter li;
 
+    /* If this is the end of the spooled transfer, the spooled stream is now
+     * complete, unless the transfer failed. */
+    spool_ending = type == RDB_CHILD_TYPE_SOCKET &&
+                   server.rdb_spool_fd != -1 && !server.rdb_spool_done;
+    if (spool_ending) server.rdb_spool_done = (bgsaveerr == C_OK);
+
     listRewind(server.slaves,&li);
     while((ln = listNext(&li))) {
         client *slave = ln->value;
 
-        if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) {
+        if (slave->repl_from_spool) {
+            /* Replicas still reading the spool are put online by
+             * sendSpoolToSlave() once they get to the end of it. */
+            if (!spool_ending) continue;
+            if (bgsaveerr != C_OK) {
+                freeClient(slave);
+                serverLog(LL_WARNING,"SYNC failed. Diskless transfer of the spooled RDB failed");
+                continue;
+            }
+            if (!connHasWriteHandler(slave->conn))
+                connSetWriteHandler(slave->conn,sendSpoolToSlave);
+        } else if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) {
             startbgsave = 1;
             mincapa = (mincapa == -1) ? slave->slave_capa :
                                         (mincapa & slave->slave_capa);
@@ -1324,6 +1893,7 @@ void updateSlavesWaitingBgsave(int bgsaveerr, int type) {
             }
         }
     }
+    replicationSpoolRelease();
     if (startbgsave) startBgsaveForReplication(mincapa);
 }
 
@@ -1444,6 +2014,7 @@ void restartAOFAfterSYNC() {
 static int useDisklessLoad() {
     /* compute boolean decision to use diskless load */
     int enabled = server.repl_diskless_load == REPL_DISKLESS_LOAD_SWAPDB ||
+           server.repl_diskless_load == REPL_DISKLESS_LOAD_ASYNC ||
            (server.repl_diskless_load == REPL_DISKLESS_LOAD_WHEN_DB_EMPTY && dbTotalServerKeyCount()==0);
     /* Check all modules handle read errors, otherwise it's not safe to use diskless load. */
     if (enabled && !moduleAllDatatypesHandleErrors()) {
@@ -1454,6 +2025,65 @@ static int useDisklessLoad() {
     return enabled;
 }
 
+/* Return true if the diskless load can be performed while serving the old
+ * data set (repl-diskless-load async). In cluster mode the keys are also
+ * indexed in the global per slot dictionaries, and modules may access the
+ * keyspace from their own events, so in both cases we fall back to
+ * the "swapdb" behavior. */
+static int useAsyncDisklessLoad(void) {
+    if (server.repl_diskless_load != REPL_DISKLESS_LOAD_ASYNC) return 0;
+    if (server.cluster_enabled || moduleCount()) {
+        serverLog(LL_NOTICE,
+            "Async diskless-load not possible with cluster mode or modules "
+            "loaded, using swapdb instead.");
+        return 0;
+    }
+    return 1;
+}
+
+/* Helper function for readSyncBulkPayload() with repl-diskless-load async:
+ * create the empty databases the new data set is loaded into, while
+ * server.db[] keeps serving the clients. */
+redisDb *disklessLoadInitTempDb(void) {
+    redisDb *tempdb = zcalloc(sizeof(redisDb)*server.dbnum);
+    for (int i=0; i<server.dbnum; i++) {
+        tempdb[i].dict = dictCreate(&dbDictType,NULL);
+        tempdb[i].expires = dictCreate(&keyptrDictType,NULL);
+        tempdb[i].id = i;
+    }
+    return tempdb;
+}
+
+/* Helper function for readSyncBulkPayload(): release the databases
+ * created by disklessLoadInitTempDb() when the loading failed. */
+void disklessLoadDiscardTempDb(redisDb *tempdb, int empty_db_flags) {
+    /* Pass EMPTYDB_BACKUP: the clients never saw these keys. */
+    emptyDbGeneric(tempdb,-1,empty_db_flags|EMPTYDB_BACKUP,
+                   replicationEmptyDbCallback);
+    for (int i=0; i<server.dbnum; i++) {
+        dictRelease(tempdb[i].dict);
+        dictRelease(tempdb[i].expires);
+    }
+    zfree(tempdb);
+}
+
+/* Helper function for readSyncBulkPayload(): the new data set was loaded
+ * with success into 'tempdb', so flush the old data set and replace it with
+ * the new one. No event is processed in between, so the clients see the
+ * two data sets switching atomically. */
+void disklessLoadSwapTempDb(redisDb *tempdb, int empty_db_flags) {
+    emptyDb(-1,empty_db_flags,replicationEmptyDbCallback);
+    for (int i=0; i<server.dbnum; i++) {
+        dictRelease(server.db[i].dict);
+        dictRelease(server.db[i].expires);
+        server.db[i].dict = tempdb[i].dict;
+        server.db[i].expires = tempdb[i].expires;
+        server.db[i].avg_ttl = 0;
+        server.db[i].expires_cursor = 0;
+    }
+    zfree(tempdb);
+}
+
 /* Helper function for readSyncBulkPayload() to make backups of the current
  * DBs before socket-loading the new ones. The backups may be restored later
  * or freed by disklessLoadRestoreBackups(). */
@@ -1504,7 +2134,8 @@ void readSyncBulkPayload(connection *conn) {
     char buf[PROTO_IOBUF_LEN];
     ssize_t nread, readlen, nwritten;
     int use_diskless_load = useDisklessLoad();
-    redisDb *diskless_load_backup = NULL;
+    int async_load = 0;
+    redisDb *diskless_load_backup = NULL, *diskless_load_tempdb = NULL;
     int empty_db_flags = server.repl_slave_lazy_flush ? EMPTYDB_ASYNC :
                                                         EMPTYDB_NO_FLAGS;
     off_t left;
@@ -1672,34 +2303,45 @@ void readSyncBulkPayload(connection *conn) {
      *
      * 2. Or when we are done reading from the socket to the RDB file, in
      *    such case we want just to read the RDB file in memory. */
-    serverLog(LL_NOTICE, "MASTER <-> REPLICA sync: Flushing old data");
+    if (use_diskless_load) async_load = useAsyncDisklessLoad();
+    if (!async_load)
+        serverLog(LL_NOTICE, "MASTER <-> REPLICA sync: Flushing old data");
 
     /* We need to stop any AOF rewriting child before flusing and parsing
      * the RDB, otherwise we'll create a copy-on-write disaster. */
     if (server.aof_state != AOF_OFF) stopAppendOnly();
 
-    /* When diskless RDB loading is used by replicas, it may be configured
-     * in order to save the current DB instead of throwing it away,
-     * so that we can restore it in case of failed transfer. */
-    if (use_diskless_load &&
-        server.repl_diskless_load == REPL_DISKLESS_LOAD_SWAPDB)
-    {
-        /* Create a backup of server.db[] and initialize to empty
-         * dictionaries */
-        diskless_load_backup = disklessLoadMakeBackups();
-    }
-    /* We call to emptyDb even in case of REPL_DISKLESS_LOAD_SWAPDB
-     * (Where disklessLoadMakeBackups left server.db empty) because we
-     * want to execute all the auxiliary logic of emptyDb (Namely,
-     * fire module events) */
-    emptyDb(-1,empty_db_flags,replicationEmptyDbCallback);
+    if (async_load) {
+        /* The new data set is loaded into separate databases, and the
+         * old one is only flushed once the loading succeeded, see
+         * disklessLoadSwapTempDb(). */
+        diskless_load_tempdb = disklessLoadInitTempDb();
+    } else {
+        /* When diskless RDB loading is used by replicas, it may be
+         * configured in order to save the current DB instead of throwing
+         * it away, so that we can restore it in case of failed transfer. */
+        if (use_diskless_load &&
+            (server.repl_diskless_load == REPL_DISKLESS_LOAD_SWAPDB ||
+             server.repl_diskless_load == REPL_DISKLESS_LOAD_ASYNC))
+        {
+            /* Create a backup of server.db[] and initialize to empty
+             * dictionaries */
+            diskless_load_backup = disklessLoadMakeBackups();
+        }
+        /* We call to emptyDb even in case of REPL_DISKLESS_LOAD_SWAPDB
+         * (Where disklessLoadMakeBackups left server.db empty) because we
+         * want to execute all the auxiliary logic of emptyDb (Namely,
+         * fire module events) */
+        emptyDb(-1,empty_db_flags,replicationEmptyDbCallback);
+    }
 
     /* Before loading the DB into memory we need to delete the readable
      * handler, otherwise it will get called recursively since
      * rdbLoad() will call the event loop to process events from time to
      * time for non blocking loading. */
     connSetReadHandler(conn, NULL);
-    serverLog(LL_NOTICE, "MASTER <-> REPLICA sync: Loading DB in memory");
+    serverLog(LL_NOTICE, "MASTER <-> REPLICA sync: Loading DB in memory%s",
+        async_load ? " while serving the old data set" : "");
     rdbSaveInfo rsi = RDB_SAVE_INFO_INIT;
     if (use_diskless_load) {
         rio rdb;
@@ -1709,9 +2351,12 @@ void readSyncBulkPayload(connection *conn) {
          * We'll restore it when the RDB is received. */
         connBlock(conn);
         connRecvTimeout(conn, server.repl_timeout*1000);
-        startLoading(server.repl_transfer_size, RDBFLAGS_REPLICATION);
+        startLoading(server.repl_transfer_size, RDBFLAGS_REPLICATION|
+                     (async_load ? RDBFLAGS_ASYNC_LOAD : 0));
 
-        if (rdbLoadRio(&rdb,RDBFLAGS_REPLICATION,&rsi) != C_OK) {
+        if (rdbLoadRioWithDb(&rdb,RDBFLAGS_REPLICATION,&rsi,
+                async_load ? diskless_load_tempdb : server.db) != C_OK)
+        {
             /* RDB loading failed. */
             stopLoading(0);
             serverLog(LL_WARNING,
@@ -1719,7 +2364,12 @@ void readSyncBulkPayload(connection *conn) {
                 "from socket");
             cancelReplicationHandshake();
             rioFreeConn(&rdb, NULL);
-            if (server.repl_diskless_load == REPL_DISKLESS_LOAD_SWAPDB) {
+            if (async_load) {
+                /* The old data set was never touched: just drop the
+                 * half-loaded one. */
+                disklessLoadDiscardTempDb(diskless_load_tempdb,
+                                          empty_db_flags);
+            } else if (diskless_load_backup) {
                 /* Restore the backed up databases. */
                 disklessLoadRestoreBackups(diskless_load_backup,1,
                                            empty_db_flags);
@@ -1737,7 +2387,10 @@ void readSyncBulkPayload(connection *conn) {
         stopLoading(1);
 
         /* RDB loading succeeded if we reach this point. */
-        if (server.repl_diskless_load == REPL_DISKLESS_LOAD_SWAPDB) {
+        if (async_load) {
+            /* Replace the data set we were serving with the new one. */
+            disklessLoadSwapTempDb(diskless_load_tempdb,empty_db_flags);
+        } else if (diskless_load_backup) {
             /* Delete the backup databases we created before starting to load
              * the new RDB. Now the RDB was loaded with success so the old
              * data is useless. */
@@ -1834,6 +2487,14 @@ void readSyncBulkPayload(connection *conn) {
     server.master_repl_offset = server.master->reploff;
     clearReplicationId2();
 
+    /* A filtered replica only has part of the history of its master: use
+     * an ID of its own, so that it can never continue with a partial
+     * resynchronization from the unfiltered stream. */
+    if (server.repl_filter) {
+        changeReplicationId();
+        memcpy(server.master->replid,server.replid,sizeof(server.replid));
+    }
+
     /* Let's create the replication backlog if needed. Slaves need to
      * accumulate the backlog regardless of the fact they have sub-slaves
      * or not, in order to behave correctly if they are promoted to
@@ -1974,6 +2635,18 @@ char *sendSynchronousCommand(int flags, connection *conn, ...) {
 #define PSYNC_FULLRESYNC 3
 #define PSYNC_NOT_SUPPORTED 4
 #define PSYNC_TRY_LATER 5
+
+/* The master flags its PSYNC reply with a final "lzf" argument when it is
+ * going to compress everything it sends after it. In such a case replace
+ * the connection with the master with one decompressing the stream. */
+static connection *replicaSetupCompression(connection *conn, char *reply) {
+    char *flag = strrchr(reply,' ');
+
+    if (!flag || strcmp(flag+1,"lzf")) return conn;
+    serverLog(LL_NOTICE,"MASTER <-> REPLICA sync: stream is compressed");
+    server.repl_transfer_s = connCreateCompressed(conn,CONN_COMPRESS_READ);
+    return server.repl_transfer_s;
+}
 int slaveTryPartialResynchronization(connection *conn, int read_reply) {
     char *psync_replid;
     char psync_offset[32];
@@ -1988,7 +2661,9 @@ int slaveTryPartialResynchronization(connection *conn, int read_reply) {
          * client structure representing the master into server.master. */
         server.master_initial_offset = -1;
 
-        if (server.cached_master) {
+        /* Filtered replicas can't continue from the backlog of the master,
+         * that only contains the unfiltered stream. */
+        if (server.cached_master && !server.repl_filter) {
             psync_replid = server.cached_master->replid;
             snprintf(psync_offset,sizeof(psync_offset),"%lld", server.cached_master->reploff+1);
             serverLog(LL_NOTICE,"Trying a partial resynchronization (request %s:%s).", psync_replid, psync_offset);
@@ -2049,6 +2724,7 @@ int slaveTryPartialResynchronization(connection *conn, int read_reply) {
         }
         /* We are going to full resync, discard the cached master structure. */
         replicationDiscardCachedMaster();
+        replicaSetupCompression(conn,reply);
         sdsfree(reply);
         return PSYNC_FULLRESYNC;
     }
@@ -2065,7 +2741,9 @@ int slaveTryPartialResynchronization(connection *conn, int read_reply) {
          * disconnection. */
         char *start = reply+10;
         char *end = reply+9;
-        while(end[0] != '\r' && end[0] != '\n' && end[0] != '\0') end++;
+        if (end[0] == ' ') end++;
+        while(end[0] != '\r' && end[0] != '\n' && end[0] != '\0' &&
+              end[0] != ' ') end++;
         if (end-start == CONFIG_RUN_ID_SIZE) {
             char new[CONFIG_RUN_ID_SIZE+1];
             memcpy(new,start,CONFIG_RUN_ID_SIZE);
@@ -2091,6 +2769,7 @@ int slaveTryPartialResynchronization(connection *conn, int read_reply) {
         }
 
         /* Setup the replication to continue. */
+        conn = replicaSetupCompression(conn,reply);
         sdsfree(reply);
         replicationResurrectCachedMaster(conn);
 
@@ -2288,11 +2967,17 @@ void syncWithMaster(connection *conn) {
      *
      * EOF: supports EOF-style RDB transfer for diskless replication.
      * PSYNC2: supports PSYNC v2, so understands +CONTINUE <new repl ID>.
+     * LZF: can read the compressed stream (only if repl-compression is set).
      *
      * The master will ignore capabilities it does not understand. */
     if (server.repl_state == REPL_STATE_SEND_CAPA) {
-        err = sendSynchronousCommand(SYNC_CMD_WRITE,conn,"REPLCONF",
-                "capa","eof","capa","psync2",NULL);
+        if (server.repl_compression) {
+            err = sendSynchronousCommand(SYNC_CMD_WRITE,conn,"REPLCONF",
+                    "capa","eof","capa","psync2","capa","lzf",NULL);
+        } else {
+            err = sendSynchronousCommand(SYNC_CMD_WRITE,conn,"REPLCONF",
+                    "capa","eof","capa","psync2",NULL);
+        }
         if (err) goto write_error;
         sdsfree(err);
         server.repl_state = REPL_STATE_RECEIVE_CAPA;
@@ -2309,6 +2994,31 @@ void syncWithMaster(connection *conn) {
                                   "REPLCONF capa: %s", err);
         }
         sdsfree(err);
+        server.repl_state = server.repl_filter ? REPL_STATE_SEND_FILTER :
+                                                 REPL_STATE_SEND_PSYNC;
+    }
+
+    /* Ask the master only for the keys matching replica-filter. */
+    if (server.repl_state == REPL_STATE_SEND_FILTER) {
+        err = sendSynchronousCommand(SYNC_CMD_WRITE,conn,"REPLCONF",
+                "filter",server.repl_filter,NULL);
+        if (err) goto write_error;
+        sdsfree(err);
+        server.repl_state = REPL_STATE_RECEIVE_FILTER;
+        return;
+    }
+
+    /* Receive REPLCONF filter reply. Unlike the other options this one is
+     * not optional: we don't want the whole data set. */
+    if (server.repl_state == REPL_STATE_RECEIVE_FILTER) {
+        err = sendSynchronousCommand(SYNC_CMD_READ,conn,NULL);
+        if (err[0] == '-') {
+            serverLog(LL_WARNING,"Unable to set the replication filter: %s",
+                err);
+            sdsfree(err);
+            goto error;
+        }
+        sdsfree(err);
         server.repl_state = REPL_STATE_SEND_PSYNC;
     }
 
@@ -2336,6 +3046,8 @@ void syncWithMaster(connection *conn) {
 
     psync_result = slaveTryPartialResynchronization(conn,1);
     if (psync_result == PSYNC_WAIT_REPLY) return; /* Try again later... */
+    /* The connection may have been switched to a compressed one. */
+    conn = server.repl_transfer_s;
 
     /* If the master is in an transient error, we should try to PSYNC
      * from scratch later, so go to the error path. This happens when
@@ -2817,6 +3529,61 @@ void replicationCacheMasterUsingMyself(void) {
     server.master = NULL;
 }
 
+/* Rebuild the replication backlog from the content saved in the RDB file
+ * by a server with repl-backlog-persist enabled, so that after a restart
+ * our replicas can continue with a partial resynchronization.
+ *
+ * The caller is responsible for the replication ID: the backlog is only
+ * meaningful if it ends exactly at the replication offset restored from
+ * the same RDB file. On success server.master_repl_offset is set to that
+ * offset and C_OK is returned, otherwise nothing is touched and C_ERR is
+ * returned. */
+int replicationRestoreBacklog(rdbSaveInfo *rsi) {
+    long long len;
+
+    if (rsi->repl_backlog == NULL) return C_ERR;
+    len = sdslen(rsi->repl_backlog);
+    if (len == 0 || rsi->repl_offset == -1 || rsi->repl_backlog_off < 1 ||
+        rsi->repl_backlog_off+len-1 != rsi->repl_offset)
+    {
+        serverLog(LL_WARNING,"The replication backlog saved in the RDB file "
+            "doesn't match the replication offset, discarding it.");
+        return C_ERR;
+    }
+
+    if (server.repl_backlog) freeReplicationBacklog();
+    server.master_repl_offset = rsi->repl_backlog_off-1;
+    createReplicationBacklog();
+    feedReplicationBuffer(rsi->repl_backlog,len);
+    serverLog(LL_NOTICE,"Restored %lld bytes of replication backlog from "
+        "the RDB file, offsets %lld to %lld.",
+        server.repl_backlog_histlen, server.repl_backlog_off,
+        server.master_repl_offset);
+    return C_OK;
+}
+
+/* Called at startup when a master loaded an RDB file saved with
+ * repl-backlog-persist: take back the replication ID and offset together
+ * with the backlog, then move the ID to the secondary one. Replicas that
+ * followed us before the restart can still PSYNC with the old ID up to the
+ * offset we had, while the new ID makes sure that a stale RDB file, whose
+ * history may have diverged from the one of the replicas, can never be used
+ * for a partial resynchronization past that point. */
+void replicationRestoreMasterFromRdb(rdbSaveInfo *rsi) {
+    if (!rsi->repl_id_is_set) return;
+    if (replicationRestoreBacklog(rsi) == C_ERR) return;
+    memcpy(server.replid,rsi->repl_id,sizeof(server.replid));
+    shiftReplicationId();
+}
+
+/* Called when replica-filter is changed at runtime: drop the link with the
+ * master, so that the next synchronization uses the new filter. */
+void replicationFilterChanged(void) {
+    if (server.masterhost == NULL) return;
+    if (server.master) freeClientAsync(server.master);
+    cancelReplicationHandshake();
+}
+
 /* Free a cached master, called when there are no longer the conditions for
  * a partial resync on reconnection. */
 void replicationDiscardCachedMaster(void) {
@@ -3016,6 +3783,8 @@ int replicationCountAcksByOffset(long long offset) {
         client *slave = ln->value;
 
         if (slave->replstate != SLAVE_STATE_ONLINE) continue;
+        /* The offsets of filtered replicas refer to their own stream. */
+        if (slave->repl_filter) continue;
         if (slave->repl_ack_off >= offset) count++;
     }
     return count;
@@ -3222,7 +3991,8 @@ void replicationCron(void) {
         int is_presync =
             (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START ||
             (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_END &&
-             server.rdb_child_type != RDB_CHILD_TYPE_SOCKET));
+             server.rdb_child_type != RDB_CHILD_TYPE_SOCKET &&
+             !slave->repl_from_spool));
 
         if (is_presync) {
             connWrite(slave->conn, "\n", 1);
@@ -3332,6 +4102,12 @@ void replicationCron(void) {
         }
     }
 
+    /* Keep trimming the backlog and releasing the unreferenced blocks of
+     * the replication buffer also when there are no writes, for instance
+     * after the backlog was shrunk. */
+    if (server.repl_backlog)
+        trimReplicationBacklog(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL*10);
+
     /* Remove the RDB file used for replication if Redis is not running
      * with any persistence. */
     removeRDBUsedToSyncReplicas();
@@ -0,0 +1,1176 @@
+/*
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Roaring bitmaps: a compressed representation of large sets of integers.
+ *
+ * The 64 bit values are split in the high 48 bits, that select a container,
+ * and the low 16 bits, that are stored inside the container. Containers with
+ * up to ROARING_ARRAY_MAX values are sorted arrays of uint16_t, while denser
+ * containers are plain bitmaps of 65536 bits, so that every value never takes
+ * more than 16 bits plus the per container overhead, and the set operations
+ * are merges of small arrays or AND / OR of machine words.
+ *
+ * Values are stored with the sign bit flipped: this way the unsigned order
+ * of the containers keys and of the low bits is the signed order of the
+ * values, and iterating the bitmap returns the values sorted. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "roaring.h"
+#include "zmalloc.h"
+#include "endianconv.h"
+
+#define ROARING_BITMAP_BYTES (ROARING_BITMAP_WORDS*sizeof(uint64_t))
+#define ROARING_MAX_KEY ((1ULL<<48)-1)
+
+#define RB_KEY(u) ((u) >> 16)
+#define RB_LOW(u) ((uint16_t)((u) & 0xffff))
+#define RB_ISBITMAP(c) ((c)->card > ROARING_ARRAY_MAX)
+
+static inline uint64_t rbEncode(int64_t v) {
+    return (uint64_t)v ^ (1ULL<<63);
+}
+
+static inline int64_t rbValue(uint64_t key, uint16_t low) {
+    return (int64_t)(((key << 16) | low) ^ (1ULL<<63));
+}
+
+/* Return the number of bits set in the bitmap. */
+static uint32_t rbBitmapCount(const uint64_t *words) {
+    uint32_t count = 0;
+    for (int j = 0; j < ROARING_BITMAP_WORDS; j++)
+        count += __builtin_popcountll(words[j]);
+    return count;
+}
+
+static uint64_t *rbBitmapFromArray(const uint16_t *a, uint32_t n) {
+    uint64_t *words = zcalloc(ROARING_BITMAP_BYTES);
+    for (uint32_t j = 0; j < n; j++) words[a[j]>>6] |= 1ULL << (a[j]&63);
+    return words;
+}
+
+/* Write into 'a' the values of the bitmap, returning their number. */
+static uint32_t rbArrayFromBitmap(uint16_t *a, const uint64_t *words) {
+    uint32_t n = 0;
+    for (uint32_t w = 0; w < ROARING_BITMAP_WORDS; w++) {
+        uint64_t word = words[w];
+        while (word) {
+            a[n++] = (w<<6) + __builtin_ctzll(word);
+            word &= word-1;
+        }
+    }
+    return n;
+}
+
+/* Return the position of the first array element not smaller than 'v'. */
+static uint32_t rbArrayLowerBound(const uint16_t *a, uint32_t n, uint16_t v) {
+    uint32_t lo = 0, hi = n;
+    while (lo < hi) {
+        uint32_t mid = (lo+hi) >> 1;
+        if (a[mid] < v) lo = mid+1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Return the position of the first container, starting at 'from', whose
+ * key is not smaller than 'key', galloping when the container is far. */
+static uint32_t rbSkip(const roaring *r, uint32_t from, uint64_t key) {
+    uint32_t lo = from, hi, step = 1;
+
+    if (lo >= r->len || r->containers[lo].key >= key) return lo;
+    while (lo+step < r->len && r->containers[lo+step].key < key) {
+        lo += step;
+        step <<= 1;
+    }
+    hi = lo+step < r->len ? lo+step : r->len;
+    lo++;
+    while (lo < hi) {
+        uint32_t mid = lo+((hi-lo) >> 1);
+        if (r->containers[mid].key < key) lo = mid+1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Search the container with the specified key. Returns 1 when found, and
+ * 0 otherwise. In both cases 'pos' is set to the position where the
+ * container is or should be inserted. */
+static int rbFind(const roaring *r, uint64_t key, uint32_t *pos) {
+    uint32_t lo = 0, hi = r->len;
+
+    /* Values are often added in ascending order: check the last container
+     * before searching. */
+    if (r->len && r->containers[r->len-1].key < key) {
+        *pos = r->len;
+        return 0;
+    }
+    while (lo < hi) {
+        uint32_t mid = (lo+hi) >> 1;
+        if (r->containers[mid].key < key) lo = mid+1;
+        else hi = mid;
+    }
+    *pos = lo;
+    return lo < r->len && r->containers[lo].key == key;
+}
+
+static int rbContainerContains(const roaringContainer *c, uint16_t low) {
+    if (RB_ISBITMAP(c)) {
+        const uint64_t *words = c->data;
+        return (words[low>>6] >> (low&63)) & 1;
+    } else {
+        const uint16_t *a = c->data;
+        uint32_t pos = rbArrayLowerBound(a,c->card,low);
+        return pos < c->card && a[pos] == low;
+    }
+}
+
+static int rbContainerAdd(roaringContainer *c, uint16_t low) {
+    uint16_t *a = c->data;
+    uint32_t pos;
+
+    if (RB_ISBITMAP(c)) {
+        uint64_t *words = c->data, bit = 1ULL << (low&63);
+        if (words[low>>6] & bit) return 0;
+        words[low>>6] |= bit;
+        c->card++;
+        return 1;
+    }
+
+    pos = a[c->card-1] < low ? c->card : rbArrayLowerBound(a,c->card,low);
+    if (pos < c->card && a[pos] == low) return 0;
+    if (c->card == ROARING_ARRAY_MAX) {
+        /* The array is full: convert the container into a bitmap. */
+        uint64_t *words = rbBitmapFromArray(a,c->card);
+        words[low>>6] |= 1ULL << (low&63);
+        zfree(a);
+        c->data = words;
+    } else {
+        a = zrealloc(a,sizeof(uint16_t)*(c->card+1));
+        memmove(a+pos+1,a+pos,sizeof(uint16_t)*(c->card-pos));
+        a[pos] = low;
+        c->data = a;
+    }
+    c->card++;
+    return 1;
+}
+
+/* Remove 'low' from the container. A container left empty should be
+ * released by the caller. */
+static int rbContainerRemove(roaringContainer *c, uint16_t low) {
+    uint16_t *a = c->data;
+    uint32_t pos;
+
+    if (RB_ISBITMAP(c)) {
+        uint64_t *words = c->data, bit = 1ULL << (low&63);
+        if (!(words[low>>6] & bit)) return 0;
+        words[low>>6] &= ~bit;
+        if (--c->card == ROARING_ARRAY_MAX) {
+            a = zmalloc(sizeof(uint16_t)*ROARING_ARRAY_MAX);
+            rbArrayFromBitmap(a,words);
+            zfree(words);
+            c->data = a;
+        }
+        return 1;
+    }
+
+    pos = rbArrayLowerBound(a,c->card,low);
+    if (pos == c->card || a[pos] != low) return 0;
+    memmove(a+pos,a+pos+1,sizeof(uint16_t)*(c->card-pos-1));
+    if (--c->card) c->data = zrealloc(a,sizeof(uint16_t)*c->card);
+    return 1;
+}
+
+/* Initialize 'c' with a copy of the 'n' sorted values of 'a', converting
+ * them into a bitmap when needed. Returns 0 if there are no values, so that
+ * the container should not be used. */
+static int rbContainerFromArray(roaringContainer *c, uint64_t key,
+                                const uint16_t *a, uint32_t n) {
+    if (n == 0) return 0;
+    c->key = key;
+    c->card = n;
+    if (n > ROARING_ARRAY_MAX) {
+        c->data = rbBitmapFromArray(a,n);
+    } else {
+        c->data = zmalloc(sizeof(uint16_t)*n);
+        memcpy(c->data,a,sizeof(uint16_t)*n);
+    }
+    return 1;
+}
+
+/* Initialize 'c' taking ownership of the bitmap 'words', that is converted
+ * into an array when it has few values. Returns 0 if the bitmap is empty,
+ * in which case it is released. */
+static int rbContainerFromBitmap(roaringContainer *c, uint64_t key,
+                                 uint64_t *words) {
+    uint32_t card = rbBitmapCount(words);
+
+    if (card == 0) {
+        zfree(words);
+        return 0;
+    }
+    c->key = key;
+    c->card = card;
+    if (card > ROARING_ARRAY_MAX) {
+        c->data = words;
+    } else {
+        c->data = zmalloc(sizeof(uint16_t)*card);
+        rbArrayFromBitmap(c->data,words);
+        zfree(words);
+    }
+    return 1;
+}
+
+static void rbContainerCopy(roaringContainer *dst, const roaringContainer *src) {
+    size_t bytes = RB_ISBITMAP(src) ? ROARING_BITMAP_BYTES :
+                                      sizeof(uint16_t)*src->card;
+    dst->key = src->key;
+    dst->card = src->card;
+    dst->data = zmalloc(bytes);
+    memcpy(dst->data,src->data,bytes);
+}
+
+/* Set in 'words' the bits of the values of the container. */
+static void rbContainerOrInto(uint64_t *words, const roaringContainer *c) {
+    if (RB_ISBITMAP(c)) {
+        const uint64_t *src = c->data;
+        for (int j = 0; j < ROARING_BITMAP_WORDS; j++) words[j] |= src[j];
+    } else {
+        const uint16_t *a = c->data;
+        for (uint32_t j = 0; j < c->card; j++)
+            words[a[j]>>6] |= 1ULL << (a[j]&63);
+    }
+}
+
+static int rbContainerAnd(roaringContainer *dst, const roaringContainer *a,
+                          const roaringContainer *b) {
+    uint16_t buf[ROARING_ARRAY_MAX];
+    uint32_t n = 0;
+
+    if (RB_ISBITMAP(a) && RB_ISBITMAP(b)) {
+        const uint64_t *wa = a->data, *wb = b->data;
+        uint64_t *words = zmalloc(ROARING_BITMAP_BYTES);
+        for (int j = 0; j < ROARING_BITMAP_WORDS; j++) words[j] = wa[j] & wb[j];
+        return rbContainerFromBitmap(dst,a->key,words);
+    } else if (RB_ISBITMAP(a) || RB_ISBITMAP(b)) {
+        /* Filter the array against the bitmap. */
+        const roaringContainer *arr = RB_ISBITMAP(a) ? b : a;
+        const uint64_t *words = RB_ISBITMAP(a) ? a->data : b->data;
+        const uint16_t *va = arr->data;
+        for (uint32_t j = 0; j < arr->card; j++) {
+            buf[n] = va[j];
+            n += (words[va[j]>>6] >> (va[j]&63)) & 1;
+        }
+    } else {
+        const uint16_t *va = a->data, *vb = b->data;
+        uint32_t i = 0, j = 0;
+        while (i < a->card && j < b->card) {
+            if (va[i] < vb[j]) {
+                i++;
+            } else if (va[i] > vb[j]) {
+                j++;
+            } else {
+                buf[n++] = va[i];
+                i++;
+                j++;
+            }
+        }
+    }
+    return rbContainerFromArray(dst,a->key,buf,n);
+}
+
+/* Return the number of values both in 'a' and 'b' without materializing
+ * the intersection. */
+static uint32_t rbContainerAndCard(const roaringContainer *a,
+                                   const roaringContainer *b) {
+    uint32_t n = 0;
+
+    if (RB_ISBITMAP(a) && RB_ISBITMAP(b)) {
+        const uint64_t *wa = a->data, *wb = b->data;
+        for (int j = 0; j < ROARING_BITMAP_WORDS; j++)
+            n += __builtin_popcountll(wa[j] & wb[j]);
+    } else if (RB_ISBITMAP(a) || RB_ISBITMAP(b)) {
+        const roaringContainer *arr = RB_ISBITMAP(a) ? b : a;
+        const uint64_t *words = RB_ISBITMAP(a) ? a->data : b->data;
+        const uint16_t *va = arr->data;
+        for (uint32_t j = 0; j < arr->card; j++)
+            n += (words[va[j]>>6] >> (va[j]&63)) & 1;
+    } else {
+        const uint16_t *va = a->data, *vb = b->data;
+        uint32_t i = 0, j = 0;
+        while (i < a->card && j < b->card) {
+            if (va[i] < vb[j]) {
+                i++;
+            } else if (va[i] > vb[j]) {
+                j++;
+            } else {
+                n++;
+                i++;
+                j++;
+            }
+        }
+    }
+    return n;
+}
+
+static int rbContainerOr(roaringContainer *dst, const roaringContainer *a,
+                         const roaringContainer *b) {
+    uint64_t *words;
+
+    if (!RB_ISBITMAP(a) && !RB_ISBITMAP(b) &&
+        a->card+b->card <= ROARING_ARRAY_MAX)
+    {
+        uint16_t buf[ROARING_ARRAY_MAX];
+        const uint16_t *va = a->data, *vb = b->data;
+        uint32_t i = 0, j = 0, n = 0;
+        while (i < a->card && j < b->card) {
+            if (va[i] < vb[j]) {
+                buf[n++] = va[i++];
+            } else if (va[i] > vb[j]) {
+                buf[n++] = vb[j++];
+            } else {
+                buf[n++] = va[i++];
+                j++;
+            }
+        }
+        while (i < a->card) buf[n++] = va[i++];
+        while (j < b->card) buf[n++] = vb[j++];
+        return rbContainerFromArray(dst,a->key,buf,n);
+    }
+
+    words = zcalloc(ROARING_BITMAP_BYTES);
+    rbContainerOrInto(words,a);
+    rbContainerOrInto(words,b);
+    return rbContainerFromBitmap(dst,a->key,words);
+}
+
+static int rbContainerAndNot(roaringContainer *dst, const roaringContainer *a,
+                             const roaringContainer *b) {
+    if (RB_ISBITMAP(a)) {
+        uint64_t *words = zmalloc(ROARING_BITMAP_BYTES);
+        memcpy(words,a->data,ROARING_BITMAP_BYTES);
+        if (RB_ISBITMAP(b)) {
+            const uint64_t *wb = b->data;
+            for (int j = 0; j < ROARING_BITMAP_WORDS; j++) words[j] &= ~wb[j];
+        } else {
+            const uint16_t *vb = b->data;
+            for (uint32_t j = 0; j < b->card; j++)
+                words[vb[j]>>6] &= ~(1ULL << (vb[j]&63));
+        }
+        return rbContainerFromBitmap(dst,a->key,words);
+    } else {
+        uint16_t buf[ROARING_ARRAY_MAX];
+        const uint16_t *va = a->data;
+        uint32_t i, j = 0, n = 0;
+
+        if (RB_ISBITMAP(b)) {
+            const uint64_t *wb = b->data;
+            for (i = 0; i < a->card; i++) {
+                buf[n] = va[i];
+                n += !((wb[va[i]>>6] >> (va[i]&63)) & 1);
+            }
+        } else {
+            const uint16_t *vb = b->data;
+            for (i = 0; i < a->card; i++) {
+                while (j < b->card && vb[j] < va[i]) j++;
+                if (j == b->card || vb[j] != va[i]) buf[n++] = va[i];
+            }
+        }
+        return rbContainerFromArray(dst,a->key,buf,n);
+    }
+}
+
+/* The Fenwick tree of the containers cardinalities finds the container of
+ * a given rank in O(log(containers)). It is only created by roaringRandom(),
+ * updated when values are added to or removed from an existing container,
+ * and released when containers are added or removed, since it would need
+ * to be rebuilt anyway. */
+static void rbTreeFree(roaring *r) {
+    zfree(r->tree);
+    r->tree = NULL;
+}
+
+static void rbTreeBuild(roaring *r) {
+    r->tree = zmalloc(sizeof(uint64_t)*r->len);
+    for (uint32_t j = 0; j < r->len; j++) r->tree[j] = r->containers[j].card;
+    for (uint32_t j = 1; j <= r->len; j++) {
+        uint32_t parent = j+(j&-j);
+        if (parent <= r->len) r->tree[parent-1] += r->tree[j-1];
+    }
+}
+
+/* Add 'delta' to the cardinality of the container at 'pos'. */
+static void rbTreeUpdate(roaring *r, uint32_t pos, int64_t delta) {
+    if (r->tree == NULL) return;
+    for (uint32_t j = pos+1; j <= r->len; j += j&-j)
+        r->tree[j-1] += delta;
+}
+
+/* Return the position of the container holding the value of rank '*rank',
+ * setting '*rank' to the rank of the value inside the container. */
+static uint32_t rbTreeFind(roaring *r, uint64_t *rank) {
+    uint32_t pos = 0, step = 1;
+
+    while (step*2 <= r->len) step *= 2;
+    for (; step; step >>= 1) {
+        if (pos+step <= r->len && r->tree[pos+step-1] <= *rank) {
+            pos += step;
+            *rank -= r->tree[pos-1];
+        }
+    }
+    return pos;
+}
+
+/* Release the unused space of the containers array. */
+static void rbShrink(roaring *r) {
+    r->containers = zrealloc(r->containers,sizeof(roaringContainer)*r->len);
+    r->alloc = r->len;
+}
+
+/* Create an empty roaring bitmap. */
+roaring *roaringNew(void) {
+    roaring *r = zmalloc(sizeof(*r));
+    r->card = 0;
+    r->len = 0;
+    r->alloc = 0;
+    r->containers = NULL;
+    r->tree = NULL;
+    return r;
+}
+
+void roaringFree(roaring *r) {
+    for (uint32_t j = 0; j < r->len; j++) zfree(r->containers[j].data);
+    zfree(r->containers);
+    zfree(r->tree);
+    zfree(r);
+}
+
+roaring *roaringDup(roaring *r) {
+    roaring *d = roaringNew();
+
+    if (r->len) {
+        d->containers = zmalloc(sizeof(roaringContainer)*r->len);
+        for (uint32_t j = 0; j < r->len; j++)
+            rbContainerCopy(&d->containers[j],&r->containers[j]);
+    }
+    d->len = r->len;
+    d->alloc = r->len;
+    d->card = r->card;
+    return d;
+}
+
+/* Add 'value' to the bitmap. Returns 1 if the value was added, 0 if it was
+ * already present. */
+int roaringAdd(roaring *r, int64_t value) {
+    uint64_t u = rbEncode(value);
+    uint32_t pos;
+
+    if (!rbFind(r,RB_KEY(u),&pos)) {
+        roaringContainer *c;
+        uint16_t *a = zmalloc(sizeof(uint16_t));
+
+        rbTreeFree(r);
+        /* Grow the containers array geometrically, so that sets adding
+         * many containers don't reallocate it at every insertion. */
+        if (r->len == r->alloc) {
+            r->alloc = r->alloc ? r->alloc*2 : 1;
+            r->containers = zrealloc(r->containers,
+                                     sizeof(roaringContainer)*r->alloc);
+        }
+        memmove(r->containers+pos+1,r->containers+pos,
+                sizeof(roaringContainer)*(r->len-pos));
+        a[0] = RB_LOW(u);
+        c = &r->containers[pos];
+        c->key = RB_KEY(u);
+        c->card = 1;
+        c->data = a;
+        r->len++;
+    } else if (rbContainerAdd(&r->containers[pos],RB_LOW(u))) {
+        rbTreeUpdate(r,pos,1);
+    } else {
+        return 0;
+    }
+    r->card++;
+    return 1;
+}
+
+/* Remove 'value' from the bitmap. Returns 1 if the value was removed, 0 if
+ * it was not present. */
+int roaringRemove(roaring *r, int64_t value) {
+    uint64_t u = rbEncode(value);
+    roaringContainer *c;
+    uint32_t pos;
+
+    if (!rbFind(r,RB_KEY(u),&pos)) return 0;
+    c = &r->containers[pos];
+    if (!rbContainerRemove(c,RB_LOW(u))) return 0;
+    if (c->card == 0) {
+        zfree(c->data);
+        rbTreeFree(r);
+        memmove(r->containers+pos,r->containers+pos+1,
+                sizeof(roaringContainer)*(r->len-pos-1));
+        r->len--;
+        if (r->len*2 < r->alloc) rbShrink(r);
+    } else {
+        rbTreeUpdate(r,pos,-1);
+    }
+    r->card--;
+    return 1;
+}
+
+int roaringContains(roaring *r, int64_t value) {
+    uint64_t u = rbEncode(value);
+    uint32_t pos;
+
+    if (!rbFind(r,RB_KEY(u),&pos)) return 0;
+    return rbContainerContains(&r->containers[pos],RB_LOW(u));
+}
+
+uint64_t roaringCardinality(const roaring *r) {
+    return r->card;
+}
+
+uint32_t roaringContainerCount(const roaring *r) {
+    return r->len;
+}
+
+/* Return a random value of a non empty bitmap. Every value has the same
+ * probability of being returned. The container of the value is found with
+ * the Fenwick tree of the containers, so the cost is logarithmic in their
+ * number, plus the cost of building the tree after containers were added
+ * or removed. */
+int64_t roaringRandom(roaring *r) {
+    uint64_t rank = (((uint64_t)rand() << 42) ^ ((uint64_t)rand() << 21) ^
+                     rand()) % r->card;
+    roaringContainer *c;
+
+    if (r->tree == NULL) rbTreeBuild(r);
+    c = &r->containers[rbTreeFind(r,&rank)];
+    if (RB_ISBITMAP(c)) {
+        const uint64_t *words = c->data;
+        uint32_t w = 0, count;
+
+        while (rank >= (count = __builtin_popcountll(words[w]))) {
+            rank -= count;
+            w++;
+        }
+        uint64_t word = words[w];
+        while (rank--) word &= word-1;
+        return rbValue(c->key,(w<<6) + __builtin_ctzll(word));
+    }
+    return rbValue(c->key,((uint16_t*)c->data)[rank]);
+}
+
+/* Remove from the sorted array 'vals' the values that are not part of the
+ * bitmap, returning the number of values left. When 'limit' is not zero the
+ * scan stops as soon as 'limit' values are found. */
+uint32_t roaringIntersectArray(roaring *r, int64_t *vals, uint32_t count, uint32_t limit) {
+    uint32_t j, n = 0, ci = 0;
+
+    if (limit == 0 || limit > count) limit = count;
+    for (j = 0; j < count && n < limit; j++) {
+        uint64_t u = rbEncode(vals[j]);
+
+        /* Values are sorted, so containers are only searched forward. */
+        ci = rbSkip(r,ci,RB_KEY(u));
+        if (ci == r->len) break;
+        if (r->containers[ci].key == RB_KEY(u) &&
+            rbContainerContains(&r->containers[ci],RB_LOW(u)))
+        {
+            vals[n++] = vals[j];
+        }
+    }
+    return n;
+}
+
+/* Return a new bitmap with the values both in 'a' and 'b'. */
+roaring *roaringAnd(roaring *a, roaring *b) {
+    roaring *r = roaringNew();
+    uint32_t i = 0, j = 0;
+
+    r->containers = zmalloc(sizeof(roaringContainer)*
+                            (a->len < b->len ? a->len : b->len));
+    while (i < a->len && j < b->len) {
+        roaringContainer *ca = &a->containers[i], *cb = &b->containers[j];
+        if (ca->key < cb->key) {
+            i = rbSkip(a,i,cb->key);
+        } else if (ca->key > cb->key) {
+            j = rbSkip(b,j,ca->key);
+        } else {
+            roaringContainer *c = &r->containers[r->len];
+            if (rbContainerAnd(c,ca,cb)) {
+                r->card += c->card;
+                r->len++;
+            }
+            i++;
+            j++;
+        }
+    }
+    rbShrink(r);
+    return r;
+}
+
+/* Return the number of values both in 'a' and 'b'. When 'limit' is not zero
+ * the containers are no longer intersected once 'limit' values are found,
+ * and 'limit' is returned. */
+uint64_t roaringAndCardinality(roaring *a, roaring *b, uint64_t limit) {
+    uint64_t card = 0;
+    uint32_t i = 0, j = 0;
+
+    while (i < a->len && j < b->len) {
+        roaringContainer *ca = &a->containers[i], *cb = &b->containers[j];
+        if (ca->key < cb->key) {
+            i = rbSkip(a,i,cb->key);
+        } else if (ca->key > cb->key) {
+            j = rbSkip(b,j,ca->key);
+        } else {
+            card += rbContainerAndCard(ca,cb);
+            if (limit && card >= limit) return limit;
+            i++;
+            j++;
+        }
+    }
+    return card;
+}
+
+/* Return a new bitmap with the values either in 'a' or 'b'. */
+roaring *roaringOr(roaring *a, roaring *b) {
+    roaring *r = roaringNew();
+    uint32_t i = 0, j = 0;
+
+    r->containers = zmalloc(sizeof(roaringContainer)*(a->len+b->len));
+    while (i < a->len || j < b->len) {
+        roaringContainer *c = &r->containers[r->len];
+        if (j == b->len ||
+            (i < a->len && a->containers[i].key < b->containers[j].key))
+        {
+            rbContainerCopy(c,&a->containers[i++]);
+        } else if (i == a->len ||
+                   a->containers[i].key > b->containers[j].key)
+        {
+            rbContainerCopy(c,&b->containers[j++]);
+        } else {
+            rbContainerOr(c,&a->containers[i++],&b->containers[j++]);
+        }
+        r->card += c->card;
+        r->len++;
+    }
+    rbShrink(r);
+    return r;
+}
+
+/* Return a new bitmap with the values of 'a' that are not in 'b'. */
+roaring *roaringAndNot(roaring *a, roaring *b) {
+    roaring *r = roaringNew();
+    uint32_t i, j = 0;
+
+    r->containers = zmalloc(sizeof(roaringContainer)*a->len);
+    for (i = 0; i < a->len; i++) {
+        roaringContainer *ca = &a->containers[i], *c = &r->containers[r->len];
+
+        j = rbSkip(b,j,ca->key);
+        if (j < b->len && b->containers[j].key == ca->key) {
+            if (!rbContainerAndNot(c,ca,&b->containers[j])) continue;
+        } else {
+            rbContainerCopy(c,ca);
+        }
+        r->card += c->card;
+        r->len++;
+    }
+    rbShrink(r);
+    return r;
+}
+
+/* Iterate the values of the bitmap in ascending order. The bitmap should
+ * not be modified while iterating. */
+void roaringInitIterator(roaring *r, roaringIterator *it) {
+    it->r = r;
+    it->ci = 0;
+    it->pos = 0;
+}
+
+int roaringNext(roaringIterator *it, int64_t *value) {
+    roaring *r = it->r;
+
+    while (it->ci < r->len) {
+        roaringContainer *c = &r->containers[it->ci];
+
+        if (!RB_ISBITMAP(c)) {
+            if (it->pos < c->card) {
+                *value = rbValue(c->key,((uint16_t*)c->data)[it->pos++]);
+                return 1;
+            }
+        } else if (it->pos < 65536) {
+            const uint64_t *words = c->data;
+            uint32_t w = it->pos >> 6;
+            uint64_t word = words[w] & (~0ULL << (it->pos&63));
+
+            while (word == 0 && ++w < ROARING_BITMAP_WORDS) word = words[w];
+            if (word) {
+                uint32_t bit = (w<<6) + __builtin_ctzll(word);
+                it->pos = bit+1;
+                *value = rbValue(c->key,bit);
+                return 1;
+            }
+        }
+        it->ci++;
+        it->pos = 0;
+    }
+    return 0;
+}
+
+/* Move the iterator to the first container with a key not smaller than
+ * 'key'. Returns 0 if there is no such container. */
+int roaringSeek(roaringIterator *it, uint64_t key) {
+    it->ci = rbSkip(it->r,0,key);
+    it->pos = 0;
+    return it->ci < it->r->len;
+}
+
+/* The serialized format is the number of containers followed by every
+ * container: the key, the number of values, and either the sorted values or
+ * the bitmap words. All the integers are little endian. */
+size_t roaringSerializedLen(roaring *r) {
+    size_t len = sizeof(uint32_t);
+
+    for (uint32_t j = 0; j < r->len; j++) {
+        roaringContainer *c = &r->containers[j];
+        len += sizeof(uint64_t)+sizeof(uint32_t);
+        len += RB_ISBITMAP(c) ? ROARING_BITMAP_BYTES : sizeof(uint16_t)*c->card;
+    }
+    return len;
+}
+
+void roaringSerialize(roaring *r, unsigned char *buf) {
+    uint32_t v32 = intrev32ifbe(r->len);
+
+    memcpy(buf,&v32,sizeof(v32));
+    buf += sizeof(v32);
+    for (uint32_t j = 0; j < r->len; j++) {
+        roaringContainer *c = &r->containers[j];
+        uint64_t v64 = intrev64ifbe(c->key);
+
+        v32 = intrev32ifbe(c->card);
+        memcpy(buf,&v64,sizeof(v64));
+        buf += sizeof(v64);
+        memcpy(buf,&v32,sizeof(v32));
+        buf += sizeof(v32);
+        if (RB_ISBITMAP(c)) {
+            memcpy(buf,c->data,ROARING_BITMAP_BYTES);
+            for (int k = 0; k < ROARING_BITMAP_WORDS; k++)
+                memrev64ifbe(buf+k*sizeof(uint64_t));
+            buf += ROARING_BITMAP_BYTES;
+        } else {
+            memcpy(buf,c->data,sizeof(uint16_t)*c->card);
+            for (uint32_t k = 0; k < c->card; k++)
+                memrev16ifbe(buf+k*sizeof(uint16_t));
+            buf += sizeof(uint16_t)*c->card;
+        }
+    }
+}
+
+/* Load a bitmap serialized with roaringSerialize(), checking that the
+ * encoding is valid. Returns NULL if the buffer is corrupted. */
+roaring *roaringDeserialize(const unsigned char *buf, size_t len) {
+    const unsigned char *end = buf+len;
+    roaring *r;
+    uint32_t count, j;
+
+    if (len < sizeof(uint32_t)) return NULL;
+    memcpy(&count,buf,sizeof(count));
+    count = intrev32ifbe(count);
+    buf += sizeof(count);
+    if (count > (size_t)(end-buf)/(sizeof(uint64_t)+sizeof(uint32_t)+2))
+        return NULL;
+
+    r = roaringNew();
+    if (count) r->containers = zmalloc(sizeof(roaringContainer)*count);
+    r->alloc = count;
+    for (j = 0; j < count; j++) {
+        roaringContainer *c = &r->containers[j];
+        uint64_t key;
+        uint32_t card;
+        size_t bytes;
+
+        if ((size_t)(end-buf) < sizeof(key)+sizeof(card)) goto err;
+        memcpy(&key,buf,sizeof(key));
+        memcpy(&card,buf+sizeof(key),sizeof(card));
+        key = intrev64ifbe(key);
+        card = intrev32ifbe(card);
+        buf += sizeof(key)+sizeof(card);
+        if (key > ROARING_MAX_KEY || card == 0 || card > 65536) goto err;
+        if (j && key <= r->containers[j-1].key) goto err;
+
+        bytes = card > ROARING_ARRAY_MAX ? ROARING_BITMAP_BYTES :
+                                           sizeof(uint16_t)*card;
+        if ((size_t)(end-buf) < bytes) goto err;
+        c->key = key;
+        c->card = card;
+        c->data = zmalloc(bytes);
+        memcpy(c->data,buf,bytes);
+        buf += bytes;
+        r->len++;
+        r->card += card;
+
+        if (RB_ISBITMAP(c)) {
+            uint64_t *words = c->data;
+            for (int k = 0; k < ROARING_BITMAP_WORDS; k++)
+                memrev64ifbe(&words[k]);
+            if (rbBitmapCount(words) != card) goto err;
+        } else {
+            uint16_t *a = c->data;
+            for (uint32_t k = 0; k < card; k++) {
+                memrev16ifbe(&a[k]);
+                if (k && a[k] <= a[k-1]) goto err;
+            }
+        }
+    }
+    if (buf != end) goto err;
+    return r;
+
+err:
+    roaringFree(r);
+    return NULL;
+}
+
+/* Return the memory used by the bitmap. */
+size_t roaringAllocSize(roaring *r) {
+    size_t size = sizeof(*r)+sizeof(roaringContainer)*r->alloc;
+
+    if (r->tree) size += sizeof(uint64_t)*r->len;
+
+    for (uint32_t j = 0; j < r->len; j++) {
+        roaringContainer *c = &r->containers[j];
+        size += RB_ISBITMAP(c) ? ROARING_BITMAP_BYTES : sizeof(uint16_t)*c->card;
+    }
+    return size;
+}
+
+#ifdef REDIS_TEST
+#include <sys/time.h>
+#include <time.h>
+
+static void ok(void) {
+    printf("OK\n");
+}
+
+static long long usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+#define assert(_e) ((_e)?(void)0:(_assert(#_e,__FILE__,__LINE__),exit(1)))
+static void _assert(char *estr, char *file, int line) {
+    printf("\n\n=== ASSERTION FAILED ===\n");
+    printf("==> %s:%d '%s' is not true\n",file,line,estr);
+}
+
+static int compareInt64(const void *a, const void *b) {
+    int64_t va = *(const int64_t*)a, vb = *(const int64_t*)b;
+    return va < vb ? -1 : (va > vb);
+}
+
+/* Fill 'vals' with 'count' random values in [base, base+range), returning
+ * the number of distinct values, that are sorted. */
+static uint32_t randomValues(int64_t *vals, uint32_t count, int64_t base,
+                             uint64_t range) {
+    uint32_t j, n = 0;
+
+    for (j = 0; j < count; j++) {
+        uint64_t rnd = ((uint64_t)rand() << 42) ^ ((uint64_t)rand() << 21) ^
+                       rand();
+        vals[j] = (int64_t)((uint64_t)base + rnd % range);
+    }
+    qsort(vals,count,sizeof(int64_t),compareInt64);
+    for (j = 0; j < count; j++)
+        if (n == 0 || vals[j] != vals[n-1]) vals[n++] = vals[j];
+    return n;
+}
+
+static roaring *createBitmap(int64_t *vals, uint32_t count) {
+    roaring *r = roaringNew();
+    for (uint32_t j = 0; j < count; j++) assert(roaringAdd(r,vals[j]) == 1);
+    return r;
+}
+
+/* Check that the bitmap contains exactly the 'count' sorted 'vals'. */
+static void checkBitmap(roaring *r, int64_t *vals, uint32_t count) {
+    roaringIterator it;
+    int64_t v;
+    uint32_t j = 0;
+    uint64_t card = 0;
+
+    assert(roaringCardinality(r) == count);
+    roaringInitIterator(r,&it);
+    while (roaringNext(&it,&v)) {
+        assert(j < count && v == vals[j]);
+        j++;
+    }
+    assert(j == count);
+    for (j = 0; j < r->len; j++) {
+        roaringContainer *c = &r->containers[j];
+        assert(c->card > 0);
+        if (j) assert(c->key > r->containers[j-1].key);
+        if (RB_ISBITMAP(c)) assert(rbBitmapCount(c->data) == c->card);
+        card += c->card;
+    }
+    assert(card == count);
+}
+
+#define UNUSED(x) (void)(x)
+int roaringTest(int argc, char **argv) {
+    /* Ranges exercising sparse and dense containers, and negative values. */
+    struct { int64_t base; uint64_t range; uint32_t count; } cases[] = {
+        {0, 100, 50},
+        {0, 70000, 10000},
+        {-100000, 200000, 150000},
+        {INT64_MIN, UINT64_MAX, 5000},
+        {INT64_MAX-300000, 300001, 120000},
+    };
+    int ncases = sizeof(cases)/sizeof(cases[0]);
+    srand(time(NULL));
+
+    UNUSED(argc);
+    UNUSED(argv);
+
+    printf("Add, remove and contains: "); {
+        roaring *r = roaringNew();
+        assert(roaringAdd(r,5) == 1);
+        assert(roaringAdd(r,5) == 0);
+        assert(roaringAdd(r,-1) == 1);
+        assert(roaringAdd(r,INT64_MIN) == 1);
+        assert(roaringAdd(r,INT64_MAX) == 1);
+        assert(roaringContains(r,5) && roaringContains(r,-1));
+        assert(roaringContains(r,INT64_MIN) && roaringContains(r,INT64_MAX));
+        assert(!roaringContains(r,6) && !roaringContains(r,0));
+        assert(roaringCardinality(r) == 4);
+        assert(roaringRemove(r,5) == 1);
+        assert(roaringRemove(r,5) == 0);
+        assert(roaringRemove(r,INT64_MIN) == 1);
+        assert(roaringRemove(r,-1) == 1);
+        assert(roaringRemove(r,INT64_MAX) == 1);
+        assert(roaringCardinality(r) == 0 && r->len == 0);
+        roaringFree(r);
+        ok();
+    }
+
+    printf("Random values and iteration: "); {
+        for (int k = 0; k < ncases; k++) {
+            int64_t *vals = zmalloc(sizeof(int64_t)*cases[k].count);
+            uint32_t n = randomValues(vals,cases[k].count,cases[k].base,
+                                      cases[k].range);
+            roaring *r = roaringNew();
+
+            /* Add in random order to exercise the inserts. */
+            for (uint32_t j = n; j > 0; j--) {
+                uint32_t p = rand() % j;
+                int64_t tmp = vals[p];
+                vals[p] = vals[j-1];
+                vals[j-1] = tmp;
+            }
+            for (uint32_t j = 0; j < n; j++) assert(roaringAdd(r,vals[j]));
+            qsort(vals,n,sizeof(int64_t),compareInt64);
+            checkBitmap(r,vals,n);
+            for (uint32_t j = 0; j < n; j++) assert(roaringContains(r,vals[j]));
+            for (int j = 0; j < 100; j++) {
+                int64_t v = roaringRandom(r);
+                assert(bsearch(&v,vals,n,sizeof(int64_t),compareInt64));
+            }
+
+            /* Remove every other value, converting bitmaps into arrays. */
+            uint32_t m = 0;
+            for (uint32_t j = 0; j < n; j++) {
+                if (j & 1) assert(roaringRemove(r,vals[j]));
+                else vals[m++] = vals[j];
+            }
+            checkBitmap(r,vals,m);
+            roaringFree(r);
+            zfree(vals);
+        }
+        ok();
+    }
+
+    printf("Random values while adding and removing: "); {
+        int64_t *vals = zmalloc(sizeof(int64_t)*20000);
+        uint32_t n = randomValues(vals,20000,0,1ULL<<24);
+        roaring *r = createBitmap(vals,n);
+
+        /* Alternate the updates of the existing containers, that keep the
+         * rank tree, with the ones adding or removing containers. */
+        for (int j = 0; j < 20000; j++) {
+            int64_t v = roaringRandom(r);
+            assert(roaringContains(r,v));
+            assert(roaringRemove(r,v));
+            if (j & 1) roaringAdd(r,rand() % (1<<24));
+            else roaringAdd(r,((int64_t)1<<32)+rand() % (1<<24));
+        }
+        for (uint64_t card = roaringCardinality(r); card > 0; card--)
+            assert(roaringRemove(r,roaringRandom(r)));
+        assert(r->len == 0);
+        roaringFree(r);
+        zfree(vals);
+        ok();
+    }
+
+    printf("AND, OR, ANDNOT: "); {
+        for (int k = 0; k < ncases; k++) {
+            uint32_t cnt = cases[k].count;
+            int64_t *va = zmalloc(sizeof(int64_t)*cnt);
+            int64_t *vb = zmalloc(sizeof(int64_t)*cnt);
+            int64_t *exp = zmalloc(sizeof(int64_t)*cnt*2);
+            uint32_t na = randomValues(va,cnt,cases[k].base,cases[k].range);
+            uint32_t nb = randomValues(vb,cnt/(k+1)+1,cases[k].base,
+                                       cases[k].range);
+            roaring *a = createBitmap(va,na), *b = createBitmap(vb,nb), *r;
+            uint32_t i, j, n;
+
+            r = roaringAnd(a,b);
+            for (i = j = n = 0; i < na && j < nb;) {
+                if (va[i] < vb[j]) i++;
+                else if (va[i] > vb[j]) j++;
+                else { exp[n++] = va[i]; i++; j++; }
+            }
+            checkBitmap(r,exp,n);
+            roaringFree(r);
+            assert(roaringAndCardinality(a,b,0) == n);
+            if (n) assert(roaringAndCardinality(a,b,1) == 1);
+
+            r = roaringOr(a,b);
+            for (i = j = n = 0; i < na || j < nb;) {
+                if (j == nb || (i < na && va[i] < vb[j])) exp[n++] = va[i++];
+                else if (i == na || va[i] > vb[j]) exp[n++] = vb[j++];
+                else { exp[n++] = va[i]; i++; j++; }
+            }
+            checkBitmap(r,exp,n);
+            roaringFree(r);
+
+            r = roaringAndNot(a,b);
+            for (i = j = n = 0; i < na; i++) {
+                while (j < nb && vb[j] < va[i]) j++;
+                if (j == nb || vb[j] != va[i]) exp[n++] = va[i];
+            }
+            checkBitmap(r,exp,n);
+            roaringFree(r);
+
+            memcpy(exp,vb,sizeof(int64_t)*nb);
+            n = roaringIntersectArray(a,exp,nb,0);
+            r = roaringAnd(b,a);
+            checkBitmap(r,exp,n);
+            roaringFree(r);
+
+            roaringFree(a);
+            roaringFree(b);
+            zfree(va);
+            zfree(vb);
+            zfree(exp);
+        }
+        ok();
+    }
+
+    printf("Serialization: "); {
+        for (int k = 0; k < ncases; k++) {
+            int64_t *vals = zmalloc(sizeof(int64_t)*cases[k].count);
+            uint32_t n = randomValues(vals,cases[k].count,cases[k].base,
+                                      cases[k].range);
+            roaring *r = createBitmap(vals,n), *d;
+            size_t len = roaringSerializedLen(r);
+            unsigned char *buf = zmalloc(len);
+
+            roaringSerialize(r,buf);
+            d = roaringDeserialize(buf,len);
+            assert(d != NULL);
+            checkBitmap(d,vals,n);
+            roaringFree(d);
+
+            /* Truncated or corrupted payloads are refused. */
+            assert(roaringDeserialize(buf,len-1) == NULL);
+            buf[len-1] ^= 0xff;
+            d = roaringDeserialize(buf,len);
+            assert(d == NULL || roaringCardinality(d) == n);
+            if (d) roaringFree(d);
+            buf[4] = 0xff; /* Keys are 48 bits. */
+            buf[11] = 0xff;
+            assert(roaringDeserialize(buf,len) == NULL);
+            roaringFree(r);
+            zfree(buf);
+            zfree(vals);
+        }
+        ok();
+    }
+
+    printf("Stress intersections: "); {
+        int64_t *va = zmalloc(sizeof(int64_t)*1000000);
+        int64_t *vb = zmalloc(sizeof(int64_t)*1000000);
+        uint32_t na = randomValues(va,1000000,0,10000000);
+        uint32_t nb = randomValues(vb,1000000,0,10000000);
+        roaring *a = createBitmap(va,na), *b = createBitmap(vb,nb), *r;
+        long long start = usec();
+        int j;
+
+        for (j = 0; j < 10; j++) {
+            r = roaringAnd(a,b);
+            roaringFree(r);
+        }
+        printf("\n10 AND of %u x %u values, %lldusec\n",na,nb,usec()-start);
+        start = usec();
+        for (j = 0; j < 10; j++) {
+            r = roaringOr(a,b);
+            roaringFree(r);
+        }
+        printf("10 OR of %u x %u values, %lldusec\n",na,nb,usec()-start);
+        printf("%u values in %zu bytes\n",na,roaringAllocSize(a));
+        roaringFree(a);
+        roaringFree(b);
+        zfree(va);
+        zfree(vb);
+    }
+
+    printf("Stress random values: "); {
+        int64_t *vals = zmalloc(sizeof(int64_t)*1000000);
+        uint32_t n = randomValues(vals,1000000,0,1ULL<<32);
+        roaring *r = createBitmap(vals,n);
+        long long start = usec();
+        int j;
+
+        for (j = 0; j < 100000; j++) roaringRandom(r);
+        printf("\n100000 random values of %u containers, %lldusec\n",
+            r->len,usec()-start);
+        start = usec();
+        for (j = 0; j < 100000; j++) roaringRemove(r,roaringRandom(r));
+        printf("100000 random removals of %u containers, %lldusec\n",
+            r->len,usec()-start);
+        roaringFree(r);
+        zfree(vals);
+    }
+
+    return 0;
+}
+#endif
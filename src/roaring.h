@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __ROARING_H
+#define __ROARING_H
+#include <stdint.h>
+#include <stddef.h>
+
+/* 一个container保存高48位相同的所有值的低16位：
+ * 值的个数不超过ROARING_ARRAY_MAX时为有序的uint16_t数组，否则为65536位的位图 */
+#define ROARING_ARRAY_MAX 4096
+#define ROARING_BITMAP_WORDS 1024
+
+typedef struct roaringContainer {
+    uint64_t key;//值的高48位
+    uint32_t card;//container中值的个数，card大于ROARING_ARRAY_MAX时为位图
+    void *data;//uint16_t有序数组或者uint64_t[ROARING_BITMAP_WORDS]位图
+} roaringContainer;
+
+typedef struct roaring {
+    uint64_t card;//总的值的个数
+    uint32_t len;//container的个数
+    uint32_t alloc;//containers数组分配的container个数，按2倍增长
+    roaringContainer *containers;//按照key从小到大排序
+    uint64_t *tree;//containers的card组成的Fenwick树，用于随机获取值时按排名查找container，按需创建，增删container时释放
+} roaring;
+
+typedef struct roaringIterator {
+    roaring *r;
+    uint32_t ci;//当前container的下标
+    uint32_t pos;//数组中的下标或者位图中的bit位置
+} roaringIterator;
+
+roaring *roaringNew(void);//创建一个空的roaring bitmap
+void roaringFree(roaring *r);//释放roaring bitmap
+roaring *roaringDup(roaring *r);//复制roaring bitmap
+int roaringAdd(roaring *r, int64_t value);//插入value，成功返回1，已经存在返回0
+int roaringRemove(roaring *r, int64_t value);//删除value，成功返回1，不存在返回0
+int roaringContains(roaring *r, int64_t value);//查看value是否存在
+uint64_t roaringCardinality(const roaring *r);//返回值的个数
+uint32_t roaringContainerCount(const roaring *r);//返回container的个数
+int64_t roaringRandom(roaring *r);//随机获取一个值，r不能为空
+uint32_t roaringIntersectArray(roaring *r, int64_t *vals, uint32_t count, uint32_t limit);//将有序数组vals中不在r的值删除，返回剩下的个数
+roaring *roaringAnd(roaring *a, roaring *b);//返回a和b的交集
+uint64_t roaringAndCardinality(roaring *a, roaring *b, uint64_t limit);//返回a和b交集的个数，limit不为0时最多计算到limit
+roaring *roaringOr(roaring *a, roaring *b);//返回a和b的并集
+roaring *roaringAndNot(roaring *a, roaring *b);//返回a中不在b的值
+void roaringInitIterator(roaring *r, roaringIterator *it);//初始化迭代器
+int roaringNext(roaringIterator *it, int64_t *value);//获取下一个值，没有值时返回0
+int roaringSeek(roaringIterator *it, uint64_t key);//迭代器移动到第一个key不小于参数的container，返回是否存在
+size_t roaringSerializedLen(roaring *r);//返回序列化需要的字节数
+void roaringSerialize(roaring *r, unsigned char *buf);//序列化到buf
+roaring *roaringDeserialize(const unsigned char *buf, size_t len);//反序列化，数据不合法时返回NULL
+size_t roaringAllocSize(roaring *r);//返回占用的内存大小
+
+#ifdef REDIS_TEST
+int roaringTest(int argc, char *argv[]);
+#endif
+
+#endif // __ROARING_H
@@ -367,6 +367,10 @@ struct redisCommand redisCommandTable[] = {
      "read-only to-sort @set",
      0,NULL,1,-1,1,0,0,0},
 
+    {"sintercard",sinterCardCommand,-3,
+     "read-only @set",
+     0,sintercardGetKeys,0,0,0,0,0,0},
+
     {"sinterstore",sinterstoreCommand,-3,
      "write use-memory @set",
      0,NULL,1,-1,1,0,0,0},
@@ -427,6 +431,22 @@ struct redisCommand redisCommandTable[] = {
      "write use-memory @sortedset",
      0,zunionInterGetKeys,0,0,0,0,0,0},
 
+    {"zdiffstore",zdiffstoreCommand,-4,
+     "write use-memory @sortedset",
+     0,zunionInterGetKeys,0,0,0,0,0,0},
+
+    {"zunion",zunionCommand,-3,
+     "read-only @sortedset",
+     0,zunionInterDiffGetKeys,0,0,0,0,0,0},
+
+    {"zinter",zinterCommand,-3,
+     "read-only @sortedset",
+     0,zunionInterDiffGetKeys,0,0,0,0,0,0},
+
+    {"zdiff",zdiffCommand,-3,
+     "read-only @sortedset",
+     0,zunionInterDiffGetKeys,0,0,0,0,0,0},
+
     {"zrange",zrangeCommand,-4,
      "read-only @sortedset",
      0,NULL,1,1,1,0,0,0},
@@ -776,6 +796,20 @@ struct redisCommand redisCommandTable[] = {
      "pub-sub ok-loading ok-stale random",
      0,NULL,0,0,0,0,0,0},
 
+    /* Shard channels are declared as keys so that in cluster mode the
+     * command is redirected to the shard serving the channel slot. */
+    {"ssubscribe",ssubscribeCommand,-2,
+     "pub-sub no-script ok-loading ok-stale read-only",
+     0,NULL,1,-1,1,0,0,0},
+
+    {"sunsubscribe",sunsubscribeCommand,-1,
+     "pub-sub no-script ok-loading ok-stale read-only",
+     0,NULL,1,-1,1,0,0,0},
+
+    {"spublish",spublishCommand,3,
+     "pub-sub ok-loading ok-stale fast",
+     0,NULL,1,1,1,0,0,0},
+
     {"watch",watchCommand,-2,
      "no-script fast ok-loading ok-stale @transaction",
      0,NULL,1,-1,1,0,0,0},
@@ -796,6 +830,14 @@ struct redisCommand redisCommandTable[] = {
     "write use-memory cluster-asking @keyspace @dangerous",
     0,NULL,1,1,1,0,0,0},
 
+    {"restore-batch",restoreBatchCommand,-4,
+     "write use-memory @keyspace @dangerous",
+     0,restoreBatchGetKeys,0,0,0,0,0,0},
+
+    {"restore-batch-asking",restoreBatchCommand,-4,
+    "write use-memory cluster-asking @keyspace @dangerous",
+    0,restoreBatchGetKeys,0,0,0,0,0,0},
+
     {"migrate",migrateCommand,-6,
      "write random @keyspace @dangerous",
      0,migrateGetKeys,0,0,0,0,0,0},
@@ -1609,7 +1651,10 @@ int clientsCronTrackExpansiveClients(client *c) {
 int clientsCronTrackClientsMemUsage(client *c) {
     size_t mem = 0;
     int type = getClientType(c);
-    mem += getClientOutputBufferMemoryUsage(c);
+    /* The replication buffer is shared, and accounted just once, see
+     * getMemoryOverheadData(). */
+    mem += getClientOutputBufferMemoryUsage(c) -
+           getReplicaPendingReplicationBytes(c);
     mem += sdsAllocSize(c->querybuf);
     mem += sizeof(client);
     /* Now that we have the memory used by the client, remove the old
@@ -1982,6 +2027,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     /* Check if a background saving or AOF rewrite in progress terminated. */
     if (hasActiveChildProcess() || ldbPendingChildren())
     {
+        receiveChildInfo();
         checkChildrenDone();
     } else {
         /* If there is not a background saving/rewrite in progress check if
@@ -2003,7 +2049,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
                     sp->changes, (int)sp->seconds);
                 rdbSaveInfo rsi, *rsiptr;
                 rsiptr = rdbPopulateSaveInfo(&rsi);
-                rdbSaveBackground(server.rdb_filename,rsiptr);
+                rdbSaveBackgroundCheckpoint(rsiptr);
                 break;
             }
         }
@@ -2123,6 +2169,7 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
         uint64_t processed = 0;
         processed += handleClientsWithPendingReadsUsingThreads();
         processed += tlsProcessPendingData();
+        processed += connCompressProcessPendingData();
         processed += handleClientsWithPendingWrites();
         processed += freeClientsInAsyncFreeQueue();
         server.events_processed_while_blocked += processed;
@@ -2137,9 +2184,12 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
 
     /* Handle TLS pending data. (must be done before flushAppendOnlyFile) */
     tlsProcessPendingData();
+    connCompressProcessPendingData();
 
-    /* If tls still has pending unread data don't sleep at all. */
-    aeSetDontWait(server.el, tlsHasPendingData());
+    /* If tls or compressed connections still have pending unread data
+     * don't sleep at all. */
+    aeSetDontWait(server.el, tlsHasPendingData() ||
+                             connCompressHasPendingData());
 
     /* Call the Redis Cluster before sleep function. Note that this function
      * may change the state of Redis Cluster (from ok to fail or vice versa),
@@ -2301,6 +2351,9 @@ void createSharedObjects(void) {
     shared.unsubscribebulk = createStringObject("$11\r\nunsubscribe\r\n",18);
     shared.psubscribebulk = createStringObject("$10\r\npsubscribe\r\n",17);
     shared.punsubscribebulk = createStringObject("$12\r\npunsubscribe\r\n",19);
+    shared.smessagebulk = createStringObject("$8\r\nsmessage\r\n",14);
+    shared.ssubscribebulk = createStringObject("$10\r\nssubscribe\r\n",17);
+    shared.sunsubscribebulk = createStringObject("$12\r\nsunsubscribe\r\n",19);
     shared.del = createStringObject("DEL",3);
     shared.unlink = createStringObject("UNLINK",6);
     shared.rpop = createStringObject("RPOP",4);
@@ -2356,11 +2409,13 @@ void initServerConfig(void) {
     server.client_max_querybuf_len = PROTO_MAX_QUERYBUF_LEN;
     server.saveparams = NULL;
     server.loading = 0;
+    server.async_loading = 0;
     server.logfile = zstrdup(CONFIG_DEFAULT_LOGFILE);
     server.aof_state = AOF_OFF;
     server.aof_rewrite_base_size = 0;
     server.aof_rewrite_scheduled = 0;
     server.aof_flush_sleep = 0;
+    server.cluster_handover_debug = SLOT_MIGRATION_HANDOVER_OK;
     server.aof_last_fsync = time(NULL);
     server.aof_rewrite_time_last = -1;
     server.aof_rewrite_time_start = -1;
@@ -2369,6 +2424,7 @@ void initServerConfig(void) {
     server.aof_fd = -1;
     server.aof_selected_db = -1; /* Make sure the first time will not match */
     server.aof_flush_postponed_start = 0;
+    server.aof_fast_loading = 0;
     server.pidfile = NULL;
     server.active_defrag_running = 0;
     server.notify_keyspace_events = 0;
@@ -2408,8 +2464,8 @@ void initServerConfig(void) {
     /* Replication partial resync backlog */
     server.repl_backlog = NULL;
     server.repl_backlog_histlen = 0;
-    server.repl_backlog_idx = 0;
     server.repl_backlog_off = 0;
+    server.repl_buffer_mem = 0;
     server.repl_no_slaves_since = time(NULL);
 
     /* Client output buffer limits */
@@ -2751,6 +2807,7 @@ void resetServerStats(void) {
     server.stat_net_output_bytes = 0;
     server.stat_unexpected_error_replies = 0;
     server.aof_delayed_fsync = 0;
+    if (server.cluster_enabled && server.cluster) clusterSlotStatsReset(-1);
 }
 
 void initServer(void) {
@@ -2775,6 +2832,8 @@ void initServer(void) {
     server.clients_index = raxNew();
     server.clients_to_close = listCreate();
     server.slaves = listCreate();
+    server.repl_buffer_blocks = listCreate();
+    listSetFreeMethod(server.repl_buffer_blocks,zfree);
     server.monitors = listCreate();
     server.clients_pending_write = listCreate();
     server.clients_pending_read = listCreate();
@@ -2853,6 +2912,7 @@ void initServer(void) {
     server.pubsub_channels = dictCreate(&keylistDictType,NULL);
     server.pubsub_patterns = listCreate();
     server.pubsub_patterns_dict = dictCreate(&keylistDictType,NULL);
+    server.pubsubshard_channels = dictCreate(&keylistDictType,NULL);
     listSetFreeMethod(server.pubsub_patterns,freePubsubPattern);
     listSetMatchMethod(server.pubsub_patterns,listMatchPubsubPattern);
     server.cronloops = 0;
@@ -2865,9 +2925,20 @@ void initServer(void) {
     server.rdb_pipe_numconns_writing = 0;
     server.rdb_pipe_buff = NULL;
     server.rdb_pipe_bufflen = 0;
+    server.rdb_spool_fd = -1;
+    server.rdb_spool_len = 0;
+    server.rdb_spool_done = 0;
+    server.rdb_spool_readers = 0;
     server.rdb_bgsave_scheduled = 0;
+    server.rdb_snapshot_id[0] = '\0';
+    server.rdb_saving_snapshot_id[0] = '\0';
+    server.rdb_delta_seq = 0;
+    server.rdb_child_delta = RDB_CHILD_DELTA_NONE;
+    server.rdb_dirty_buckets = zcalloc(RDB_DELTA_BITMAP_LEN);
+    server.rdb_saving_buckets = zcalloc(RDB_DELTA_BITMAP_LEN);
     server.child_info_pipe[0] = -1;
     server.child_info_pipe[1] = -1;
+    server.in_fork_child = 0;
     server.child_info_data.magic = 0;
     //设置aof释放函数
     aofRewriteBufferReset();
@@ -2884,6 +2955,11 @@ void initServer(void) {
     server.stat_rdb_cow_bytes = 0;
     server.stat_aof_cow_bytes = 0;
     server.stat_module_cow_bytes = 0;
+    server.stat_current_cow_bytes = 0;
+    server.stat_current_cow_updated = 0;
+    server.stat_current_save_keys_processed = 0;
+    server.stat_current_save_keys_total = 0;
+    server.stat_current_fork_start = 0;
     for (int j = 0; j < CLIENT_TYPE_COUNT; j++)
         server.stat_clients_type_memory[j] = 0;
     server.cron_malloc_stats.zmalloc_used = 0;
@@ -3514,6 +3590,7 @@ int processCommand(client *c) {
      * However we don't perform the redirection if:
      * 1) The sender of this command is our master.
      * 2) The command has no key arguments. */
+    int hashslot = -1;
     if (server.cluster_enabled &&
         !(c->flags & CLIENT_MASTER) &&
         !(c->flags & CLIENT_LUA &&
@@ -3521,7 +3598,6 @@ int processCommand(client *c) {
         !(c->cmd->getkeys_proc == NULL && c->cmd->firstkey == 0 &&
           c->cmd->proc != execCommand))
     {
-        int hashslot;
         int error_code;
         clusterNode *n = getNodeByQuery(c,c->cmd,c->argv,c->argc,
                                         &hashslot,&error_code);
@@ -3624,10 +3700,12 @@ int processCommand(client *c) {
         c->cmd->proc != subscribeCommand &&
         c->cmd->proc != unsubscribeCommand &&
         c->cmd->proc != psubscribeCommand &&
-        c->cmd->proc != punsubscribeCommand) {
+        c->cmd->proc != punsubscribeCommand &&
+        c->cmd->proc != ssubscribeCommand &&
+        c->cmd->proc != sunsubscribeCommand) {
         addReplyErrorFormat(c,
-            "Can't execute '%s': only (P)SUBSCRIBE / "
-            "(P)UNSUBSCRIBE / PING / QUIT are allowed in this context",
+            "Can't execute '%s': only (P|S)SUBSCRIBE / "
+            "(P|S)UNSUBSCRIBE / PING / QUIT are allowed in this context",
             c->cmd->name);
         return C_OK;
     }
@@ -3651,6 +3729,20 @@ int processCommand(client *c) {
         return C_OK;
     }
 
+    /* Replica loading the new data set from the master in the background?
+     * Reads are served from the old data set, but anything that could
+     * modify it is refused: the change would be lost once the new data set
+     * is swapped in. DEBUG is refused as well since it can reload or flush
+     * the data set under the loading code. */
+    if (server.async_loading &&
+        (!(c->cmd->flags & (CMD_READONLY|CMD_LOADING)) ||
+         c->cmd->proc == debugCommand))
+    {
+        flagTransaction(c);
+        addReply(c, shared.loadingerr);
+        return C_OK;
+    }
+
     /* Lua script too slow? Only allow a limited number of commands.
      * Note that we need to allow the transactions commands, otherwise clients
      * sending a transaction with pipelining without error checking, may have
@@ -3686,7 +3778,11 @@ int processCommand(client *c) {
         queueMultiCommand(c);
         addReply(c,shared.queued);
     } else {
+        c->cmd_reply_bytes = 0;
         call(c,CMD_CALL_FULL);
+        /* Account the command in the stats of its slot. The hash slot is
+         * only known if the command has keys, see getNodeByQuery(). */
+        if (hashslot != -1) clusterSlotStatsAddCommand(c,hashslot);
         c->woff = server.master_repl_offset;
         if (listLength(server.ready_keys))
             handleClientsBlockedOnKeys();
@@ -3765,6 +3861,9 @@ int prepareForShutdown(int flags) {
         /* Snapshotting. Perform a SYNC SAVE and exit */
         rdbSaveInfo rsi, *rsiptr;
         rsiptr = rdbPopulateSaveInfo(&rsi);
+        /* Keep the backlog too, so that our replicas can continue with
+         * a partial resynchronization once we are back. */
+        if (rsiptr && server.repl_backlog_persist) rsiptr->save_backlog = 1;
         if (rdbSave(server.rdb_filename,rsiptr) != C_OK) {
             /* Ooops.. error saving! The best we can do is to continue
              * operating. Note that if there was a background saving process,
@@ -4182,6 +4281,7 @@ sds genRedisInfoString(const char *section) {
             "mem_replication_backlog:%zu\r\n"
             "mem_clients_slaves:%zu\r\n"
             "mem_clients_normal:%zu\r\n"
+            "mem_total_replication_buffers:%zu\r\n"
             "mem_aof_buffer:%zu\r\n"
             "mem_allocator:%s\r\n"
             "active_defrag_running:%d\r\n"
@@ -4225,6 +4325,7 @@ sds genRedisInfoString(const char *section) {
             mh->repl_backlog,
             mh->clients_slaves,
             mh->clients_normal,
+            server.repl_buffer_mem,
             mh->aof_buffer,
             ZMALLOC_LIB,
             server.active_defrag_running,
@@ -4235,10 +4336,28 @@ sds genRedisInfoString(const char *section) {
 
     /* Persistence */
     if (allsections || defsections || !strcasecmp(section,"persistence")) {
+        double fork_perc = 0;
+        long long cow_age = 0, fork_eta = -1;
+
+        /* Progress of the running child, as reported via the child info
+         * pipe. The ETA assumes the remaining keys are saved at the same
+         * speed of the ones already saved. */
+        if (hasActiveChildProcess() && server.stat_current_save_keys_total) {
+            fork_perc = (double)server.stat_current_save_keys_processed*100/
+                        server.stat_current_save_keys_total;
+            if (server.stat_current_save_keys_processed) {
+                long long elapsed = mstime()-server.stat_current_fork_start;
+                fork_eta = (long long)(elapsed*(100-fork_perc)/fork_perc)/1000;
+            }
+        }
+        if (server.stat_current_cow_updated)
+            cow_age = (mstime()-server.stat_current_cow_updated)/1000;
+
         if (sections++) info = sdscat(info,"\r\n");
         info = sdscatprintf(info,
             "# Persistence\r\n"
             "loading:%d\r\n"
+            "async_loading:%d\r\n"
             "rdb_changes_since_last_save:%lld\r\n"
             "rdb_bgsave_in_progress:%d\r\n"
             "rdb_last_save_time:%jd\r\n"
@@ -4246,6 +4365,8 @@ sds genRedisInfoString(const char *section) {
             "rdb_last_bgsave_time_sec:%jd\r\n"
             "rdb_current_bgsave_time_sec:%jd\r\n"
             "rdb_last_cow_size:%zu\r\n"
+            "rdb_delta_chain_len:%lld\r\n"
+            "rdb_dirty_buckets:%zu\r\n"
             "aof_enabled:%d\r\n"
             "aof_rewrite_in_progress:%d\r\n"
             "aof_rewrite_scheduled:%d\r\n"
@@ -4255,8 +4376,15 @@ sds genRedisInfoString(const char *section) {
             "aof_last_write_status:%s\r\n"
             "aof_last_cow_size:%zu\r\n"
             "module_fork_in_progress:%d\r\n"
-            "module_fork_last_cow_size:%zu\r\n",
+            "module_fork_last_cow_size:%zu\r\n"
+            "current_cow_size:%zu\r\n"
+            "current_cow_size_age:%lld\r\n"
+            "current_fork_perc:%.2f\r\n"
+            "current_fork_eta_sec:%lld\r\n"
+            "current_save_keys_processed:%zu\r\n"
+            "current_save_keys_total:%zu\r\n",
             server.loading,
+            server.async_loading,
             server.dirty,
             server.rdb_child_pid != -1,
             (intmax_t)server.lastsave,
@@ -4265,6 +4393,8 @@ sds genRedisInfoString(const char *section) {
             (intmax_t)((server.rdb_child_pid == -1) ?
                 -1 : time(NULL)-server.rdb_save_time_start),
             server.stat_rdb_cow_bytes,
+            server.rdb_delta_seq,
+            redisPopcount(server.rdb_dirty_buckets,RDB_DELTA_BITMAP_LEN),
             server.aof_state != AOF_OFF,
             server.aof_child_pid != -1,
             server.aof_rewrite_scheduled,
@@ -4275,7 +4405,13 @@ sds genRedisInfoString(const char *section) {
             (server.aof_last_write_status == C_OK) ? "ok" : "err",
             server.stat_aof_cow_bytes,
             server.module_child_pid != -1,
-            server.stat_module_cow_bytes);
+            server.stat_module_cow_bytes,
+            server.stat_current_cow_bytes,
+            cow_age,
+            fork_perc,
+            fork_eta,
+            server.stat_current_save_keys_processed,
+            server.stat_current_save_keys_total);
 
         if (server.aof_enabled) {
             info = sdscatprintf(info,
@@ -4295,7 +4431,7 @@ sds genRedisInfoString(const char *section) {
                 server.aof_delayed_fsync);
         }
 
-        if (server.loading) {
+        if (server.loading || server.async_loading) {
             double perc;
             time_t eta, elapsed;
             off_t remaining_bytes = server.loading_total_bytes-
@@ -4352,6 +4488,7 @@ sds genRedisInfoString(const char *section) {
             "keyspace_misses:%lld\r\n"
             "pubsub_channels:%ld\r\n"
             "pubsub_patterns:%lu\r\n"
+            "pubsubshard_channels:%lu\r\n"
             "latest_fork_usec:%lld\r\n"
             "migrate_cached_sockets:%ld\r\n"
             "slave_expires_tracked_keys:%zu\r\n"
@@ -4383,6 +4520,7 @@ sds genRedisInfoString(const char *section) {
             server.stat_keyspace_misses,
             dictSize(server.pubsub_channels),
             listLength(server.pubsub_patterns),
+            dictSize(server.pubsubshard_channels),
             server.stat_fork_time,
             dictSize(server.migrate_cached_sockets),
             getSlaveKeyWithExpireCount(),
@@ -4443,6 +4581,17 @@ sds genRedisInfoString(const char *section) {
                     "master_link_down_since_seconds:%jd\r\n",
                     (intmax_t)(server.unixtime-server.repl_down_since));
             }
+
+            connection *mconn = server.master ? server.master->conn :
+                                                server.repl_transfer_s;
+            if (connIsCompressed(mconn)) {
+                long long raw, wire, usec;
+                connGetCompressionStats(mconn,&raw,&wire,&usec);
+                info = sdscatprintf(info,
+                    "master_link_compression_ratio:%.2f\r\n"
+                    "master_link_decompression_usec:%lld\r\n",
+                    wire ? (double)raw/wire : 1, usec);
+            }
             info = sdscatprintf(info,
                 "slave_priority:%d\r\n"
                 "slave_read_only:%d\r\n",
@@ -4499,9 +4648,17 @@ sds genRedisInfoString(const char *section) {
 
                 info = sdscatprintf(info,
                     "slave%d:ip=%s,port=%d,state=%s,"
-                    "offset=%lld,lag=%ld\r\n",
+                    "offset=%lld,lag=%ld",
                     slaveid,slaveip,slave->slave_listening_port,state,
                     slave->repl_ack_off, lag);
+                if (connIsCompressed(slave->conn)) {
+                    long long raw, wire, usec;
+                    connGetCompressionStats(slave->conn,&raw,&wire,&usec);
+                    info = sdscatprintf(info,
+                        ",compression_ratio=%.2f,compression_usec=%lld",
+                        wire ? (double)raw/wire : 1, usec);
+                }
+                info = sdscatlen(info,"\r\n",2);
                 slaveid++;
             }
         }
@@ -4770,7 +4927,7 @@ static void sigShutdownHandler(int sig) {
         serverLogFromHandler(LL_WARNING, "You insist... exiting now.");
         rdbRemoveTempFile(getpid());
         exit(1); /* Exit with an error since this was not a clean shutdown. */
-    } else if (server.loading) {
+    } else if (server.loading || server.async_loading) {
         serverLogFromHandler(LL_WARNING, "Received shutdown signal during loading, exiting now.");
         exit(0);
     }
@@ -4829,6 +4986,7 @@ int redisFork() {
     long long start = ustime();
     if ((childpid = fork()) == 0) {
         /* Child */
+        server.in_fork_child = 1;
         closeListeningSockets(0);
         setupChildSignalHandlers();
     } else {
@@ -4854,6 +5012,7 @@ void sendChildCOWInfo(int ptype, char *pname) {
     }
 
     server.child_info_data.cow_size = private_dirty;
+    server.child_info_data.final = 1;
     sendChildInfo(ptype);
 }
 
@@ -4879,6 +5038,11 @@ void loadDataFromDisk(void) {
     } else {
         rdbSaveInfo rsi = RDB_SAVE_INFO_INIT;
         if (rdbLoad(server.rdb_filename,&rsi,RDBFLAGS_NONE) == C_OK) {
+            if (rdbLoadDeltaChain(&rsi) != C_OK) {
+                serverLog(LL_WARNING,"Fatal error loading the RDB delta "
+                                     "chain. Exiting.");
+                exit(1);
+            }
             serverLog(LL_NOTICE,"DB loaded from disk: %.3f seconds",
                 (float)(ustime()-start)/1000000);
 
@@ -4900,7 +5064,16 @@ void loadDataFromDisk(void) {
                  * with masters. */
                 replicationCacheMasterUsingMyself();
                 selectDb(server.cached_master,rsi.repl_stream_db);
+                /* Also serve partial resynchronizations to our own
+                 * sub-replicas if the backlog was saved. */
+                replicationRestoreBacklog(&rsi);
+            } else if (!server.masterhost &&
+                       !(server.cluster_enabled &&
+                         nodeIsSlave(server.cluster->myself)))
+            {
+                replicationRestoreMasterFromRdb(&rsi);
             }
+            sdsfree(rsi.repl_backlog);
         } else if (errno != ENOENT) {
             serverLog(LL_WARNING,"Fatal error loading the DB: %s. Exiting.",strerror(errno));
             exit(1);
@@ -5018,8 +5191,16 @@ int main(int argc, char **argv) {
             return ziplistTest(argc, argv);
         } else if (!strcasecmp(argv[2], "quicklist")) {
             quicklistTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "quicklist-benchmark")) {
+            return quicklistBenchmark(argc, argv);
         } else if (!strcasecmp(argv[2], "intset")) {
             return intsetTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "roaring")) {
+            return roaringTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "zbtree")) {
+            return zbtreeTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "zbtree-benchmark")) {
+            return zbtreeBenchmark(argc, argv);
         } else if (!strcasecmp(argv[2], "zipmap")) {
             return zipmapTest(argc, argv);
         } else if (!strcasecmp(argv[2], "sha1test")) {
@@ -64,7 +64,10 @@ typedef long long ustime_t; /* microsecond time type. */
 #include "zmalloc.h" /* total memory usage aware version of malloc/free */
 #include "anet.h"    /* Networking the easy way */
 #include "ziplist.h" /* Compact list data structure */
+#include "listpack.h" /* Compact list data structure, for hashes and zsets */
 #include "intset.h"  /* Compact integer set structure */
+#include "roaring.h" /* Compressed bitmaps for large integer sets */
+#include "zbtree.h" /* B+tree index for large sorted sets */
 #include "version.h" /* Version macro */
 #include "util.h"    /* Misc functions useful in many places */
 #include "latency.h" /* Latency monitor API */
@@ -105,6 +108,8 @@ typedef long long ustime_t; /* microsecond time type. */
 #define CONFIG_RUN_ID_SIZE 40
 #define RDB_EOF_MARK_SIZE 40
 #define CONFIG_REPL_BACKLOG_MIN_SIZE (1024*16)          /* 16k */
+#define REPL_BACKLOG_INDEX_PER_BLOCKS 64 /* Backlog blocks per index entry. */
+#define REPL_BACKLOG_TRIM_BLOCKS_PER_CALL 10 /* Incremental trim/free. */
 #define CONFIG_BGSAVE_RETRY_DELAY 5 /* Wait a few secs before trying again. */
 #define CONFIG_DEFAULT_PID_FILE "/var/run/redis.pid"
 #define CONFIG_DEFAULT_CLUSTER_CONFIG_FILE "nodes.conf"
@@ -297,11 +302,13 @@ typedef long long ustime_t; /* microsecond time type. */
 #define REPL_STATE_RECEIVE_IP 9 /* Wait for REPLCONF reply */
 #define REPL_STATE_SEND_CAPA 10 /* Send REPLCONF capa */
 #define REPL_STATE_RECEIVE_CAPA 11 /* Wait for REPLCONF reply */
-#define REPL_STATE_SEND_PSYNC 12 /* Send PSYNC */
-#define REPL_STATE_RECEIVE_PSYNC 13 /* Wait for PSYNC reply */
+#define REPL_STATE_SEND_FILTER 12 /* Send REPLCONF filter */
+#define REPL_STATE_RECEIVE_FILTER 13 /* Wait for REPLCONF reply */
+#define REPL_STATE_SEND_PSYNC 14 /* Send PSYNC */
+#define REPL_STATE_RECEIVE_PSYNC 15 /* Wait for PSYNC reply */
 /* --- End of handshake states --- */
-#define REPL_STATE_TRANSFER 14 /* Receiving .rdb from master */
-#define REPL_STATE_CONNECTED 15 /* Connected to master */
+#define REPL_STATE_TRANSFER 16 /* Receiving .rdb from master */
+#define REPL_STATE_CONNECTED 17 /* Connected to master */
 
 /* State of slaves from the POV of the master. Used in client->replstate.
  * In SEND_BULK and ONLINE state the slave receives new updates
@@ -316,6 +323,7 @@ typedef long long ustime_t; /* microsecond time type. */
 #define SLAVE_CAPA_NONE 0
 #define SLAVE_CAPA_EOF (1<<0)    /* Can parse the RDB EOF streaming format. */
 #define SLAVE_CAPA_PSYNC2 (1<<1) /* Supports PSYNC2 protocol. */
+#define SLAVE_CAPA_LZF (1<<2)    /* Can read the LZF compressed stream. */
 
 /* Synchronous read timeout - slave side */
 #define CONFIG_REPL_SYNCIO_TIMEOUT 5
@@ -357,6 +365,7 @@ typedef long long ustime_t; /* microsecond time type. */
 #define REPL_DISKLESS_LOAD_DISABLED 0
 #define REPL_DISKLESS_LOAD_WHEN_DB_EMPTY 1
 #define REPL_DISKLESS_LOAD_SWAPDB 2
+#define REPL_DISKLESS_LOAD_ASYNC 3
 
 /* Sets operations codes */
 #define SET_OP_UNION 0
@@ -603,8 +612,11 @@ typedef struct RedisModuleDigest {
 #define OBJ_ENCODING_INTSET 6  /* Encoded as intset */
 #define OBJ_ENCODING_SKIPLIST 7  /* Encoded as skiplist */
 #define OBJ_ENCODING_EMBSTR 8  /* Embedded sds string encoding 嵌入式sds字符串编码*/
-#define OBJ_ENCODING_QUICKLIST 9 /* Encoded as linked list of ziplists */
+#define OBJ_ENCODING_QUICKLIST 9 /* Encoded as linked list of listpacks */
 #define OBJ_ENCODING_STREAM 10 /* Encoded as a radix tree of listpacks */
+#define OBJ_ENCODING_LISTPACK 11 /* Encoded as a listpack */
+#define OBJ_ENCODING_ROARING 12 /* Encoded as a roaring bitmap */
+#define OBJ_ENCODING_BTREE 13 /* Encoded as a B+tree plus a hash table */
 
 #define LRU_BITS 24
 #define LRU_CLOCK_MAX ((1<<LRU_BITS)-1) /* Max value of obj->lru */
@@ -648,6 +660,43 @@ typedef struct clientReplyBlock {
     char buf[];
 } clientReplyBlock;
 
+/* The replication stream is stored only once, as a list of blocks
+ * (server.repl_buffer_blocks) shared by the replication backlog and by the
+ * output buffers of all the replicas. Each of them references the block
+ * holding the next byte it needs: blocks at the head of the list that are
+ * no longer referenced are released. */
+typedef struct replBufBlock {
+    int refcount;           /* Number of replicas or backlog using it. */
+    long long repl_offset;  /* Replication offset of the first byte. */
+    size_t size, used;
+    char buf[];
+} replBufBlock;
+
+/* The replication backlog is just a reference to the oldest block of the
+ * replication buffer that is still needed for partial resynchronizations.
+ * One block every REPL_BACKLOG_INDEX_PER_BLOCKS is indexed by offset, so
+ * that PSYNC can find the block to start from without walking the whole
+ * backlog, that can be made of millions of blocks. */
+typedef struct replBacklog {
+    listNode *ref_repl_buf_node;    /* First block of the backlog. */
+    rax *blocks_index;              /* Big endian block repl_offset ->
+                                       its listNode. */
+    int unindexed_count;            /* Blocks added since the last indexed
+                                       one. */
+} replBacklog;
+
+/* Replicas can ask with REPLCONF FILTER to receive only the keys matching
+ * a set of prefixes or cluster hash slots. Such replicas get a filtered RDB
+ * and their own filtered copy of the replication stream instead of
+ * referencing the shared replication buffer. */
+typedef struct replFilter {
+    sds spec;                   /* Filter as sent by the replica. */
+    sds *prefixes;              /* Key prefixes. */
+    int numprefixes;
+    unsigned char *slots;       /* Bitmap of the hash slots, or NULL. */
+    int seldb;                  /* DB selected in the filtered stream. */
+} replFilter;
+
 /* Redis database representation. There are multiple databases identified
  * by integers from 0 (the default database) up to the max configured
  * database. The database number is the 'id' field in the structure. */
@@ -801,6 +850,10 @@ typedef struct client {
     long bulklen;           /* Length of bulk argument in multi bulk request. */
     list *reply;            /* List of reply objects to send to the client. */
     unsigned long long reply_bytes; /* Tot bytes of objects in reply list. */
+    size_t cmd_reply_bytes; /* Reply bytes produced by the current command. */
+    listNode *ref_repl_buf_node;    /* Replicas: block of the replication
+                                       buffer holding the next byte to send. */
+    size_t ref_block_pos;           /* Replicas: next byte to send in it. */
     size_t sentlen;         /* Amount of bytes already sent in the current
                                buffer or object being sent. */
     time_t ctime;           /* Client creation time. */
@@ -810,6 +863,8 @@ typedef struct client {
     int authenticated;      /* Needed when the default user requires auth. */
     int replstate;          /* Replication state if this is a slave. */
     int repl_put_online_on_ack; /* Install slave write handler on first ACK. */
+    int repl_from_spool;    /* Late diskless replica reading the spool. */
+    replFilter *repl_filter; /* Filter set with REPLCONF FILTER, or NULL. */
     int repldbfd;           /* Replication DB file descriptor. */
     off_t repldboff;        /* Replication DB file offset. */
     off_t repldbsize;       /* Replication DB file size. */
@@ -832,6 +887,7 @@ typedef struct client {
     list *watched_keys;     /* Keys WATCHED for MULTI/EXEC CAS */
     dict *pubsub_channels;  /* channels a client is interested in (SUBSCRIBE) */
     list *pubsub_patterns;  /* patterns a client is interested in (SUBSCRIBE) */
+    dict *pubsubshard_channels;  /* shard channels a client is interested in (SSUBSCRIBE) */
     sds peerid;             /* Cached peer ID. */
     listNode *client_list_node; /* list node in client list */
     RedisModuleUserChangedFunc auth_callback; /* Module callback to execute
@@ -881,7 +937,8 @@ struct sharedObjectsStruct {
     *outofrangeerr, *noscripterr, *loadingerr, *slowscripterr, *bgsaveerr,
     *masterdownerr, *roslaveerr, *execaborterr, *noautherr, *noreplicaserr,
     *busykeyerr, *oomerr, *plus, *messagebulk, *pmessagebulk, *subscribebulk,
-    *unsubscribebulk, *psubscribebulk, *punsubscribebulk, *del, *unlink/*设置为不可达，防止删除的key过大导致性能下降，留给后台慢慢删*/,
+    *unsubscribebulk, *psubscribebulk, *punsubscribebulk, *smessagebulk,
+    *ssubscribebulk, *sunsubscribebulk, *del, *unlink/*设置为不可达，防止删除的key过大导致性能下降，留给后台慢慢删*/,
     *rpop, *lpop, *lpush, *rpoplpush, *zpopmin, *zpopmax, *emptyscan,
     *multi, *exec,
     *select[PROTO_SHARED_SELECT_CMDS],
@@ -908,11 +965,16 @@ typedef struct zskiplist {
     int level;
 } zskiplist;
 
+/* 使用B+树编码时zsl为NULL，zbt保存排序索引，字典中直接保存分值 */
 typedef struct zset {
     dict *dict;
     zskiplist *zsl;
+    zbtree *zbt;
 } zset;
 
+#define zsetDictGetScore(zs,de) \
+    (((const zset*)(zs))->zbt ? dictGetDoubleVal(de) : *(double*)dictGetVal(de))
+
 typedef struct clientBufferLimitsConfig {
     unsigned long long hard_limit_bytes;
     unsigned long long soft_limit_bytes;
@@ -994,9 +1056,17 @@ typedef struct rdbSaveInfo {
     int repl_id_is_set;  /* True if repl_id field is set. */
     char repl_id[CONFIG_RUN_ID_SIZE+1];     /* Replication ID. */
     long long repl_offset;                  /* Replication offset. */
+
+    /* Used saving only: the keys to save for a filtered replica. */
+    replFilter *repl_filter;
+
+    /* Replication backlog, see repl-backlog-persist. */
+    int save_backlog;           /* Saving: store the backlog in the RDB. */
+    sds repl_backlog;           /* Loading: backlog content, or NULL. */
+    long long repl_backlog_off; /* Loading: offset of its first byte. */
 } rdbSaveInfo;
 
-#define RDB_SAVE_INFO_INIT {-1,0,"000000000000000000000000000000",-1}
+#define RDB_SAVE_INFO_INIT {-1,0,"000000000000000000000000000000",-1,NULL,0,NULL,-1}
 
 struct malloc_stats {
     size_t zmalloc_used;
@@ -1039,6 +1109,13 @@ struct clusterState;
 #define CHILD_INFO_TYPE_AOF 1
 #define CHILD_INFO_TYPE_MODULE 3
 
+/* Children report their progress at most once every CHILD_INFO_PERIOD_US
+ * microseconds, and spend at most 1/CHILD_COW_DUTY_CYCLE of their time
+ * measuring the copy-on-write size (reading smaps is not free). */
+#define CHILD_INFO_PERIOD_US 1000000
+#define CHILD_COW_DUTY_CYCLE 100
+#define CHILD_INFO_KEYS_INTERVAL 1024   /* Keys between progress checks. */
+
 struct redisServer {
     /* General */
     pid_t pid;                  /* Main process pid. */
@@ -1125,6 +1202,8 @@ struct redisServer {
 
     /* RDB / AOF loading information */
     int loading;                /* We are loading data from disk if true */
+    int async_loading;          /* We are loading a new data set from the
+                                   master while serving the old one. */
     off_t loading_total_bytes;
     off_t loading_loaded_bytes;
     time_t loading_start_time;
@@ -1168,6 +1247,11 @@ struct redisServer {
     size_t stat_rdb_cow_bytes;      /* Copy on write bytes during RDB saving. */
     size_t stat_aof_cow_bytes;      /* Copy on write bytes during AOF rewrite. */
     size_t stat_module_cow_bytes;   /* Copy on write bytes during module fork. */
+    size_t stat_current_cow_bytes;  /* Copy on write bytes of the running child. */
+    long long stat_current_cow_updated; /* mstime() of the last child report. */
+    size_t stat_current_save_keys_processed; /* Keys saved by the running child. */
+    size_t stat_current_save_keys_total; /* Keys the running child has to save. */
+    long long stat_current_fork_start; /* mstime() the running child was started. */
     uint64_t stat_clients_type_memory[CLIENT_TYPE_COUNT];/* Mem usage by type */
     long long stat_unexpected_error_replies; /* Number of unexpected (aof-loading, replica to master, etc.) error replies */
     /* The following two are used to track instantaneous metrics, like
@@ -1243,6 +1327,8 @@ struct redisServer {
     int aof_last_write_errno;       /* Valid if aof_last_write_status is ERR */
     int aof_load_truncated;         /* Don't stop on unexpected AOF EOF. */
     int aof_use_rdb_preamble;       /* Use RDB preamble on AOF rewrites. */
+    int aof_fast_load;              /* Parse the AOF in a thread on load. */
+    int aof_fast_loading;           /* Replaying the AOF in fast load mode. */
     /* AOF pipes used to communicate between parent and child during rewrite. */
     int aof_pipe_write_data_to_child;
     int aof_pipe_read_data_from_parent;
@@ -1270,6 +1356,17 @@ struct redisServer {
     time_t rdb_save_time_start;     /* Current RDB save start time. */
     int rdb_bgsave_scheduled;       /* BGSAVE when possible if true. */
     int rdb_child_type;             /* Type of save by active child. */
+    /* Incremental snapshots: a full snapshot followed by a chain of deltas
+     * only containing the buckets of keys modified in the meantime. */
+    int rdb_delta_chain_max;        /* Max deltas before a full snapshot. 0 = off. */
+    char rdb_snapshot_id[CONFIG_RUN_ID_SIZE+1]; /* ID of the base snapshot on
+                                       disk, empty if deltas can't be chained. */
+    char rdb_saving_snapshot_id[CONFIG_RUN_ID_SIZE+1]; /* ID of the full
+                                       snapshot being saved. */
+    long long rdb_delta_seq;        /* Number of deltas chained to the base. */
+    int rdb_child_delta;            /* RDB_CHILD_DELTA_* of the active child. */
+    unsigned char *rdb_dirty_buckets;  /* Buckets modified since last save. */
+    unsigned char *rdb_saving_buckets; /* Buckets saved by the active child. */
     int lastbgsave_status;          /* C_OK or C_ERR */
     int stop_writes_on_bgsave_err;  /* Don't allow writes if can't BGSAVE */
     int rdb_pipe_write;             /* RDB pipes used to transfer the rdb */
@@ -1279,15 +1376,24 @@ struct redisServer {
     int rdb_pipe_numconns_writing;  /* Number of rdb conns with pending writes. */
     char *rdb_pipe_buff;            /* In diskless replication, this buffer holds data */
     int rdb_pipe_bufflen;           /* that was read from the the rdb pipe. */
+    int rdb_spool_fd;               /* Copy of the diskless RDB stream read by
+                                       late replicas, or -1. */
+    long long rdb_spool_len;        /* Bytes written to the spool so far. */
+    int rdb_spool_done;             /* The spooled stream is complete. */
+    int rdb_spool_readers;          /* Replicas still reading the spool. */
     int rdb_key_save_delay;         /* Delay in microseconds between keys while
                                      * writing the RDB. (for testings) */
     int key_load_delay;             /* Delay in microseconds between keys while
                                      * loading aof or rdb. (for testings) */
     /* Pipe and data structures for child -> parent info sharing. */
     int child_info_pipe[2];         /* Pipe used to write the child_info_data. */
+    int in_fork_child;              /* Are we the forked child process? */
     struct {
         int process_type;           /* AOF or RDB child? */
+        int final;                  /* Last report, sent before exiting. */
         size_t cow_size;            /* Copy on write size. */
+        size_t keys;                /* Keys processed so far. */
+        size_t keys_total;          /* Keys to process. */
         unsigned long long magic;   /* Magic value to make sure data is valid. */
     } child_info_data;
     /* Propagation of commands in AOF / replication */
@@ -1305,14 +1411,12 @@ struct redisServer {
     long long second_replid_offset; /* Accept offsets up to this for replid2. */
     int slaveseldb;                 /* Last SELECTed DB in replication output */
     int repl_ping_slave_period;     /* Master pings the slave every N seconds */
-    char *repl_backlog;             /* Replication backlog for partial syncs *///环形缓冲赋值队列
+    replBacklog *repl_backlog;      /* Replication backlog for partial syncs *///环形缓冲赋值队列
+    list *repl_buffer_blocks;       /* Replication buffer, see replBufBlock. */
+    size_t repl_buffer_mem;         /* Memory used by the replication buffer. */
     //#设置复制积压缓冲区大小，积压队列越大，允许主从数据库断线的时间就越长
-    long long repl_backlog_size;    /* Backlog circular buffer size *///环形缓冲赋值队列容量
+    long long repl_backlog_size;    /* Backlog size *///环形缓冲赋值队列容量
     long long repl_backlog_histlen; /* Backlog actual data length *///环形缓冲赋值队列已用大小（影响是否能部分复制）
-    // 实际上谈不上空闲，因为总是环绕覆盖写，
-    // 理解为最新数据的截止位置更为合适，更新的数据总是从这里开始写入到repl_backlog中。
-    long long repl_backlog_idx;     /* Backlog circular buffer current offset,
-                                       that is the next byte will'll write to.*/// 环形缓冲复制队列空闲起始位置（写从这里开始）
     long long repl_backlog_off;     /* Replication "master offset" of first
                                        byte in the replication backlog buffer.*/// 数据在环形缓冲复制队列的起始位置（读从这里开始）
     //#没有salve连接时，多久释放一次复制积压缓冲区
@@ -1326,8 +1430,15 @@ struct redisServer {
     int repl_min_slaves_max_lag;    /* Max lag of <count> slaves to write. */
     int repl_good_slaves_count;     /* Number of slaves with lag <= max_lag. */
     int repl_diskless_sync;         /* Master send RDB to slaves sockets directly. */// 不落磁盘（无盘）往从节点发送RDB（全量复制）
+    int repl_compression;           /* Compress the replication link when
+                                       the other side supports it. */
+    int repl_backlog_persist;       /* Save the backlog in the RDB file
+                                       written on shutdown. */
     int repl_diskless_load;         /* Slave parse RDB directly from the socket.
                                      * see REPL_DISKLESS_LOAD_* enum */
+    int repl_filtered_slaves;       /* Number of replicas with a filter. */
+    int repl_diskless_sync_spool;   /* Spool the diskless RDB stream so that
+                                       late replicas can attach to it. */
     int repl_diskless_sync_delay;   /* Delay to start a diskless repl BGSAVE. */// 无盘复制时，延迟指定的时长，以等待更多的从节点
     /* Replication (slave) */
     char *masteruser;               /* AUTH with this user and masterauth with master */
@@ -1354,6 +1465,8 @@ struct redisServer {
     int slave_priority;             /* Reported in INFO and used by Sentinel. */
     int slave_announce_port;        /* Give the master this listening port. */
     char *slave_announce_ip;        /* Give the master this ip address. */
+    char *repl_filter;              /* Ask the master only for these keys,
+                                       see REPLCONF FILTER. */
     /* The following two fields is where we store master PSYNC replid/offset
      * while the PSYNC is in progress. At the end we'll copy the fields into
      * the server->master client structure. */
@@ -1393,11 +1506,15 @@ struct redisServer {
     int sort_bypattern;
     int sort_store;
     /* Zip structure config, see redis.conf for more information  */
-    size_t hash_max_ziplist_entries;
-    size_t hash_max_ziplist_value;
+    size_t hash_max_listpack_entries;
+    size_t hash_max_listpack_value;
     size_t set_max_intset_entries;
-    size_t zset_max_ziplist_entries;
-    size_t zset_max_ziplist_value;
+    size_t set_max_listpack_entries;
+    size_t set_max_listpack_value;
+    int set_roaring_encoding; /* Convert large intsets to roaring bitmaps. */
+    size_t zset_max_listpack_entries;
+    size_t zset_max_listpack_value;
+    int zset_btree_encoding; /* Use a B+tree instead of the skiplist. */
     size_t hll_sparse_max_bytes;
     size_t stream_node_max_bytes;
     long long stream_node_max_entries;
@@ -1414,6 +1531,7 @@ struct redisServer {
     dict *pubsub_channels;  /* Map channels to list of subscribed clients */
     list *pubsub_patterns;  /* A list of pubsub_patterns */
     dict *pubsub_patterns_dict;  /* A dict of pubsub_patterns */
+    dict *pubsubshard_channels;  /* Map shard channels to list of subscribed clients */
     int notify_keyspace_events; /* Events to propagate via Pub/Sub. This is an
                                    xor of NOTIFY_... flags. */
     /* Cluster */
@@ -1436,6 +1554,12 @@ struct redisServer {
                                       REDISMODULE_CLUSTER_FLAG_*. */
     int cluster_allow_reads_when_down; /* Are reads allowed when the cluster
                                         is down? */
+    int cluster_light_header;   /* Omit the slots bitmap from PING / PONG
+                                   when the receiver already knows it. */
+    int cluster_fail_query;     /* Ask the masters for failure reports as
+                                   soon as a node is flagged as PFAIL. */
+    int cluster_handover_debug; /* SLOT_MIGRATION_HANDOVER_* failure to
+                                   simulate. (used by tests) */
     /* Scripting */
     lua_State *lua; /* The Lua interpreter. We use just one for all clients */
     client *lua_client;   /* The "fake client" to query Redis from Lua */
@@ -1557,6 +1681,9 @@ typedef struct {//set的迭代器的结构 set有intset和dict
     int encoding;//subject->encoding intset/dict
     int ii; /* intset iterator */
     dictIterator *di;//dict iterator
+    unsigned char *lpi; /* listpack iterator */
+    sds lpele; /* Current listpack element, reused by setTypeNext() */
+    roaringIterator ri; /* roaring bitmap iterator */
 } setTypeIterator;
 
 /* Structure to hold hash iteration abstraction. Note that iteration over
@@ -1698,6 +1825,7 @@ void addReplyLoadedModules(client *c);
 void copyClientOutputBuffer(client *dst, client *src);
 size_t sdsZmallocSize(sds s);
 size_t getStringObjectSdsUsedMemory(robj *o);
+size_t objectComputeSize(robj *o, size_t sample_size);
 void freeClientReplyValue(void *o);
 void *dupClientReplyValue(void *o);
 void getClientsMaxBuffers(unsigned long *longest_output_list,
@@ -1725,6 +1853,7 @@ int handleClientsWithPendingWritesUsingThreads(void);
 int handleClientsWithPendingReadsUsingThreads(void);
 int stopThreadedIOIfNeeded(void);
 int clientHasPendingReplies(client *c);
+int prepareClientToWrite(client *c);
 void unlinkClient(client *c);
 int writeToClient(client *c, int handler_installed);
 void linkClient(client *c);
@@ -1822,9 +1951,11 @@ robj *createQuicklistObject(void);
 robj *createZiplistObject(void);
 robj *createSetObject(void);
 robj *createIntsetObject(void);
+robj *createSetListpackObject(void);
+robj *createSetRoaringObject(void);
 robj *createHashObject(void);
 robj *createZsetObject(void);
-robj *createZsetZiplistObject(void);
+robj *createZsetListpackObject(void);
 robj *createStreamObject(void);
 robj *createModuleObject(moduleType *mt, void *value);
 int getLongFromObjectOrReply(client *c, robj *o, long *target, const char *msg);
@@ -1842,6 +1973,7 @@ int equalStringObjects(robj *a, robj *b);
 unsigned long long estimateObjectIdleTime(robj *o);
 void trimStringObjectIfNeeded(robj *o);
 #define sdsEncodedObject(objptr) (objptr->encoding == OBJ_ENCODING_RAW || objptr->encoding == OBJ_ENCODING_EMBSTR)
+#define setIntegerEncoding(enc) ((enc) == OBJ_ENCODING_INTSET || (enc) == OBJ_ENCODING_ROARING)
 
 /* Synchronous I/O with timeout */
 ssize_t syncWrite(int fd, char *ptr, ssize_t size, long long timeout);
@@ -1851,6 +1983,11 @@ ssize_t syncReadLine(int fd, char *ptr, ssize_t size, long long timeout);
 /* Replication */
 void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc);
 void replicationFeedSlavesFromMasterStream(list *slaves, char *buf, size_t buflen);
+replFilter *replFilterCreate(char *spec, char **err);
+void replFilterFree(replFilter *f);
+int replFilterMatchKey(replFilter *f, sds key);
+int replFilterEqual(replFilter *a, replFilter *b);
+void replicationFilterChanged(void);
 void replicationFeedMonitors(client *c, list *monitors, int dictid, robj **argv, int argc);
 void updateSlavesWaitingBgsave(int bgsaveerr, int type);
 void replicationCron(void);
@@ -1876,11 +2013,19 @@ void changeReplicationId(void);
 void clearReplicationId2(void);
 void chopReplicationBacklog(void);
 void replicationCacheMasterUsingMyself(void);
-//将ptr加入到backlog
-void feedReplicationBacklog(void *ptr, size_t len);
+int replicationRestoreBacklog(rdbSaveInfo *rsi);
+void replicationRestoreMasterFromRdb(rdbSaveInfo *rsi);
+//将ptr加入到复制缓冲区
+void feedReplicationBuffer(void *ptr, size_t len);
+void trimReplicationBacklog(int max_blocks);
+void replicaAdvanceReplicationBuffer(client *c);
+void replicaReleaseReplicationBuffer(client *c);
+size_t getReplicaPendingReplicationBytes(client *c);
 void showLatestBacklog(void);
 void rdbPipeReadHandler(struct aeEventLoop *eventLoop, int fd, void *clientData, int mask);
 void rdbPipeWriteHandlerConnRemoved(struct connection *conn);
+void replicationSpoolCreate(void);
+void replicationSpoolRemoveReader(client *c);
 
 /* Generic persistence functions */
 void startLoadingFile(FILE* fp, char* filename, int rdbflags);
@@ -1919,6 +2064,7 @@ void restartAOFAfterSYNC();
 void openChildInfoPipe(void);
 void closeChildInfoPipe(void);
 void sendChildInfo(int process_type);
+void sendChildInfoProgress(int process_type, size_t keys, size_t keys_total);
 void receiveChildInfo(void);
 
 /* Fork helpers */
@@ -1996,14 +2142,17 @@ unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range);
 unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range);
 unsigned long zsetLength(const robj *zobj);
 void zsetConvert(robj *zobj, int encoding);
-void zsetConvertToZiplistIfNeeded(robj *zobj, size_t maxelelen);
+int zsetLargeEncoding(void);
+void zsetInsert(zset *zs, double score, sds ele);
+void zrangeReplyByRank(client *c, robj *zobj, long start, long end, int withscores, int reverse);
+void zsetConvertToListpackIfNeeded(robj *zobj, size_t maxelelen);
 int zsetScore(robj *zobj, sds member, double *score);
 unsigned long zslGetRank(zskiplist *zsl, double score, sds o);
 int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore);
 long zsetRank(robj *zobj, sds ele, int reverse);
 int zsetDel(robj *zobj, sds ele);
 void genericZpopCommand(client *c, robj **keyv, int keyc, int where, int emitkey, robj *countarg);
-sds ziplistGetObject(unsigned char *sptr);
+sds lpGetObject(unsigned char *sptr);
 int zslValueGteMin(double value, zrangespec *spec);
 int zslValueLteMax(double value, zrangespec *spec);
 void zslFreeLexRange(zlexrangespec *spec);
@@ -2016,6 +2165,10 @@ int zzlLexValueGteMin(unsigned char *p, zlexrangespec *spec);
 int zzlLexValueLteMax(unsigned char *p, zlexrangespec *spec);
 int zslLexValueGteMin(sds value, zlexrangespec *spec);
 int zslLexValueLteMax(sds value, zlexrangespec *spec);
+int zbtFirstInRange(zbtree *zbt, zrangespec *range, zbtreePos *pos);
+int zbtLastInRange(zbtree *zbt, zrangespec *range, zbtreePos *pos);
+int zbtFirstInLexRange(zbtree *zbt, zlexrangespec *range, zbtreePos *pos);
+int zbtLastInLexRange(zbtree *zbt, zlexrangespec *range, zbtreePos *pos);
 
 /* Core functions */
 int getMaxmemoryState(size_t *total, size_t *logical, size_t *tofree, float *level);
@@ -2076,10 +2229,11 @@ setTypeIterator *setTypeInitIterator(robj *subject);
 void setTypeReleaseIterator(setTypeIterator *si);
 int setTypeNext(setTypeIterator *si, sds *sdsele, int64_t *llele);
 sds setTypeNextObject(setTypeIterator *si);
-int setTypeRandomElement(robj *setobj, sds *sdsele, int64_t *llele);
+int setTypeRandomElement(robj *setobj, char **str, size_t *len, int64_t *llele);
 unsigned long setTypeRandomElements(robj *set, unsigned long count, robj *aux_set);
 unsigned long setTypeSize(const robj *subject);
 void setTypeConvert(robj *subject, int enc);
+void setTypeConvertSparseRoaring(robj *setobj);
 
 /* Hash data type */
 #define HASH_SET_TAKE_FIELD (1<<0)
@@ -2094,7 +2248,7 @@ unsigned long hashTypeLength(const robj *o);
 hashTypeIterator *hashTypeInitIterator(robj *subject);
 void hashTypeReleaseIterator(hashTypeIterator *hi);
 int hashTypeNext(hashTypeIterator *hi);
-void hashTypeCurrentFromZiplist(hashTypeIterator *hi, int what,
+void hashTypeCurrentFromListpack(hashTypeIterator *hi, int what,
                                 unsigned char **vstr,
                                 unsigned int *vlen,
                                 long long *vll);
@@ -2110,8 +2264,13 @@ int pubsubUnsubscribeAllChannels(client *c, int notify);
 int pubsubUnsubscribeAllPatterns(client *c, int notify);
 void freePubsubPattern(void *p);
 int listMatchPubsubPattern(void *a, void *b);
+int pubsubUnsubscribeShardAllChannels(client *c, int notify);
+void pubsubShardUnsubscribeAllClients(robj *channel);
 int pubsubPublishMessage(robj *channel, robj *message);
+int pubsubPublishShardMessage(robj *channel, robj *message);
 void addReplyPubsubMessage(client *c, robj *channel, robj *msg);
+void addReplyPubsubTypeMessage(client *c, robj *channel, robj *msg, robj *msgbulk);
+int clientTotalSubscriptionsCount(client *c);
 
 /* Keyspace events notification */
 void notifyKeyspaceEvent(int type, char *event, robj *key, int dbid);
@@ -2169,6 +2328,7 @@ int selectDb(client *c, int id);
 void signalModifiedKey(client *c, redisDb *db, robj *key);//通知所有监听这个key的客户端有修改
 void signalFlushedDb(int dbid);
 unsigned int getKeysInSlot(unsigned int hashslot, robj **keys, unsigned int count);
+unsigned long scanKeysInSlot(unsigned int hashslot, unsigned long cursor, list *keys, unsigned int count);
 unsigned int countKeysInSlot(unsigned int hashslot);
 unsigned int delKeysInSlot(unsigned int hashslot);
 int verifyClusterConfigWithData(void);
@@ -2177,6 +2337,7 @@ int parseScanCursorOrReply(client *c, robj *o, unsigned long *cursor);
 void slotToKeyAdd(sds key);
 void slotToKeyDel(sds key);
 void slotToKeyFlush(void);
+unsigned long slotToKeyDetach(dict **old);
 int dbAsyncDelete(redisDb *db, robj *key);//异步删除数据
 void emptyDbAsync(redisDb *db);
 void slotToKeyFlushAsync(void);
@@ -2187,22 +2348,35 @@ void freeObjAsync(robj *o);
 int *getKeysFromCommand(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 void getKeysFreeResult(int *result);
 int *zunionInterGetKeys(struct redisCommand *cmd,robj **argv, int argc, int *numkeys);
+int *zunionInterDiffGetKeys(struct redisCommand *cmd,robj **argv, int argc, int *numkeys);
 int *evalGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
+int *sintercardGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 int *sortGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 int *migrateGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
+int *restoreBatchGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 int *georadiusGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 int *xreadGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 int *memoryGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 int *lcsGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 
 /* Cluster */
+
+/* Handover failures simulated by DEBUG SLOT-MIGRATION-HANDOVER. */
+#define SLOT_MIGRATION_HANDOVER_OK 0
+#define SLOT_MIGRATION_HANDOVER_REFUSE 1     /* The target refuses the slot. */
+#define SLOT_MIGRATION_HANDOVER_LOSE_REPLY 2 /* The reply of the target is
+                                                lost. */
+
 void clusterInit(void);
 unsigned short crc16(const char *buf, int len);
 unsigned int keyHashSlot(char *key, int keylen);
 void clusterCron(void);
 void clusterPropagatePublish(robj *channel, robj *message);
+void clusterPropagatePublishShard(robj *channel, robj *message);
 void migrateCloseTimedoutSockets(void);
 void clusterBeforeSleep(void);
+void clusterSlotMigrationKeyChanged(sds key);
+void clusterSlotMigrationAbort(const char *reason);
 int clusterSendModuleMessageToTarget(const char *target, uint64_t module_id, uint8_t type, unsigned char *payload, uint32_t len);
 
 /* Sentinel */
@@ -2326,6 +2500,7 @@ void scardCommand(client *c);//SCARD key
 void spopCommand(client *c);//SPOP key
 void srandmemberCommand(client *c);//
 void sinterCommand(client *c);//
+void sinterCardCommand(client *c);//SINTERCARD numkeys key [key ...] [LIMIT limit]
 void sinterstoreCommand(client *c);//
 void sunionCommand(client *c);//
 void sunionstoreCommand(client *c);//
@@ -2395,6 +2570,10 @@ void hstrlenCommand(client *c);
 void zremrangebyrankCommand(client *c);
 void zunionstoreCommand(client *c);
 void zinterstoreCommand(client *c);
+void zdiffstoreCommand(client *c);
+void zunionCommand(client *c);
+void zinterCommand(client *c);
+void zdiffCommand(client *c);
 void zscanCommand(client *c);
 void hkeysCommand(client *c);
 void hvalsCommand(client *c);
@@ -2410,10 +2589,14 @@ void psubscribeCommand(client *c);
 void punsubscribeCommand(client *c);
 void publishCommand(client *c);
 void pubsubCommand(client *c);
+void ssubscribeCommand(client *c);
+void sunsubscribeCommand(client *c);
+void spublishCommand(client *c);
 void watchCommand(client *c);
 void unwatchCommand(client *c);
 void clusterCommand(client *c);
 void restoreCommand(client *c);
+void restoreBatchCommand(client *c);
 void migrateCommand(client *c);
 void askingCommand(client *c);
 void readonlyCommand(client *c);
@@ -309,8 +309,9 @@ void sortCommand(client *c) {
     }
 
     /* Destructively convert encoded sorted sets for SORT. */
-    if (sortval->type == OBJ_ZSET)
-        zsetConvert(sortval, OBJ_ENCODING_SKIPLIST);
+    if (sortval->type == OBJ_ZSET &&
+        sortval->encoding == OBJ_ENCODING_LISTPACK)
+        zsetConvert(sortval, zsetLargeEncoding());
 
     /* Objtain the length of the object to sort. */
     switch(sortval->type) {
@@ -395,6 +396,29 @@ void sortCommand(client *c) {
             j++;
         }
         setTypeReleaseIterator(si);
+    } else if (sortval->type == OBJ_ZSET && dontsort &&
+               sortval->encoding == OBJ_ENCODING_BTREE) {
+        /* Same as below for the B+tree encoding: seek the starting point
+         * by rank and walk the leaves. */
+        zset *zs = sortval->ptr;
+        long zsetlen = dictSize(zs->dict);
+        zbtreePos pos;
+        sds sdsele;
+        int rangelen = vectorlen;
+
+        zbtSeekRank(zs->zbt,desc ? zsetlen-start : start+1,&pos);
+        while(rangelen--) {
+            serverAssertWithInfo(c,sortval,pos.leaf != NULL);
+            sdsele = zbtPosEntry(&pos)->ele;
+            vector[j].obj = createStringObject(sdsele,sdslen(sdsele));
+            vector[j].u.score = 0;
+            vector[j].u.cmpobj = NULL;
+            j++;
+            if (desc) zbtPrev(&pos); else zbtNext(&pos);
+        }
+        /* Fix start/end: output code is not aware of this optimization. */
+        end -= start;
+        start = 0;
     } else if (sortval->type == OBJ_ZSET && dontsort) {
         /* Special handling for a sorted set, if 'dontsort' is true.
          * This makes sure we return elements in the sorted set original
@@ -35,10 +35,10 @@
  *----------------------------------------------------------------------------*/
 
 /* Check the length of a number of objects to see if we need to convert a
- * ziplist to a real hash. Note that we only check string encoded objects
+ * listpack to a real hash. Note that we only check string encoded objects
  * as their string length can be queried in constant time. */
 /*
-检查多个对象的长度，看看是否需要将ziplist转换为真正的hash表。注意，我们只检查被encode完的对象，因为它们的字符串长度可以在常量时间内查询到。
+检查多个对象的长度，看看是否需要将listpack转换为真正的hash表。注意，我们只检查被encode完的对象，因为它们的字符串长度可以在常量时间内查询到。
 */
 
 // typedef struct redisObject {
@@ -50,16 +50,16 @@
 //     int refcount;
 //     void *ptr;
 // } robj;
-//看看返回的o中的encoding就知道argv数组中的start到end下标中可被encoding的数据可不可以被转换为ziplist，不能则会将o转化为dict对象
+//看看返回的o中的encoding就知道argv数组中的start到end下标中可被encoding的数据可不可以被转换为listpack，不能则会将o转化为dict对象
 void hashTypeTryConversion(robj *o, robj **argv, int start, int end) {
     int i;
-    //压缩类型不是ziplist
-    if (o->encoding != OBJ_ENCODING_ZIPLIST) return;
+    //压缩类型不是listpack
+    if (o->encoding != OBJ_ENCODING_LISTPACK) return;
 
     for (i = start; i <= end; i++) {
-        //如果数据类型不是原始类型或者sds，并且数据的长度超过了ziplist的最大长度
+        //如果数据类型不是原始类型或者sds，并且数据的长度超过了listpack的最大长度
         if (sdsEncodedObject(argv[i]) &&
-            sdslen(argv[i]->ptr) > server.hash_max_ziplist_value)
+            sdslen(argv[i]->ptr) > server.hash_max_listpack_value)
         {
             //将o转化为hashtable
             hashTypeConvert(o, OBJ_ENCODING_HT);
@@ -68,38 +68,36 @@ void hashTypeTryConversion(robj *o, robj **argv, int start, int end) {
     }
 }
 
-/* Get the value from a ziplist encoded hash, identified by field.
+/* Get the value from a listpack encoded hash, identified by field.
  * Returns -1 when the field cannot be found. */
 //在ziplst中获取值为field的后一个元素，无法被用数字表的存在**vstr，可以用数字表示的用*vll
 //找到返回0，否则为-1
-int hashTypeGetFromZiplist(robj *o, sds field,
+int hashTypeGetFromListpack(robj *o, sds field,
                            unsigned char **vstr,
                            unsigned int *vlen,
                            long long *vll)
 {
     unsigned char *zl, *fptr = NULL, *vptr = NULL;
-    int ret;
 
-    serverAssert(o->encoding == OBJ_ENCODING_ZIPLIST);
+    serverAssert(o->encoding == OBJ_ENCODING_LISTPACK);
 
     zl = o->ptr;
-    //获取ziplist的第一个元素地址
-    fptr = ziplistIndex(zl, ZIPLIST_HEAD);
+    //获取listpack的第一个元素地址
+    fptr = lpFirst(zl);
     if (fptr != NULL) {
         //间隔为1的跳跃查找
-        fptr = ziplistFind(fptr, (unsigned char*)field, sdslen(field), 1);
+        fptr = lpFind(zl, fptr, (unsigned char*)field, sdslen(field), 1);
         if (fptr != NULL) {
             /* Grab pointer to the value (fptr points to the field) */
             //fptr的下一个元素就是value的值
-            vptr = ziplistNext(zl, fptr);
+            vptr = lpNext(zl, fptr);
             serverAssert(vptr != NULL);
         }
     }
     //第一个都找不到直接不处理
     if (vptr != NULL) {
         //获取vptr存的值
-        ret = ziplistGet(vptr, vstr, vlen, vll);
-        serverAssert(ret);
+        *vstr = lpGetValue(vptr, vlen, vll);
         return 0;
     }
 
@@ -131,9 +129,9 @@ sds hashTypeGetFromHashTable(robj *o, sds field) {
  * for C_OK and checking if vll (or vstr) is NULL. */
 //在o中查询key为field的值，数据存在**vstr或者*vll
 int hashTypeGetValue(robj *o, sds field, unsigned char **vstr, unsigned int *vlen, long long *vll) {
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {//如果是ziplist
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {//如果是listpack
         *vstr = NULL;
-        if (hashTypeGetFromZiplist(o, field, vstr, vlen, vll) == 0)//如果查到数据在vstr或vll
+        if (hashTypeGetFromListpack(o, field, vstr, vlen, vll) == 0)//如果查到数据在vstr或vll
             return C_OK;
     } else if (o->encoding == OBJ_ENCODING_HT) {//如果为dict
         sds value;
@@ -169,15 +167,15 @@ robj *hashTypeGetValueObject(robj *o, sds field) {
 /* Higher level function using hashTypeGet*() to return the length of the
  * object associated with the requested field, or 0 if the field does not
  * exist. */
-//获取field为key的value，只支持ziplist和dict
+//获取field为key的value，只支持listpack和dict
 size_t hashTypeGetValueLength(robj *o, sds field) {
     size_t len = 0;
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        if (hashTypeGetFromZiplist(o, field, &vstr, &vlen, &vll) == 0)
+        if (hashTypeGetFromListpack(o, field, &vstr, &vlen, &vll) == 0)
             len = vstr ? vlen : sdigits10(vll);
     } else if (o->encoding == OBJ_ENCODING_HT) {
         sds aux;
@@ -192,14 +190,14 @@ size_t hashTypeGetValueLength(robj *o, sds field) {
 
 /* Test if the specified field exists in the given hash. Returns 1 if the field
  * exists, and 0 when it doesn't. */
-//判断robj元素中的key为field的元素是否存在，只适用ziplist和dict
+//判断robj元素中的key为field的元素是否存在，只适用listpack和dict
 int hashTypeExists(robj *o, sds field) {
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        if (hashTypeGetFromZiplist(o, field, &vstr, &vlen, &vll) == 0) return 1;
+        if (hashTypeGetFromListpack(o, field, &vstr, &vlen, &vll) == 0) return 1;
     } else if (o->encoding == OBJ_ENCODING_HT) {
         if (hashTypeGetFromHashTable(o, field) != NULL) return 1;
     } else {
@@ -233,47 +231,41 @@ int hashTypeExists(robj *o, sds field) {
 int hashTypeSet(robj *o, sds field, sds value, int flags) {
     int update = 0;
 
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl, *fptr, *vptr;
 
         zl = o->ptr;//获取数据
-        //定位到ziplist的首数据首地址
-        fptr = ziplistIndex(zl, ZIPLIST_HEAD);
+        //定位到listpack的首数据首地址
+        fptr = lpFirst(zl);
         if (fptr != NULL) {//没有元素
-            //查找field在ziplist中是否存在
-            fptr = ziplistFind(fptr, (unsigned char*)field, sdslen(field), 1);
+            //查找field在listpack中是否存在
+            fptr = lpFind(zl, fptr, (unsigned char*)field, sdslen(field), 1);
             if (fptr != NULL) {//找到
                 /* Grab pointer to the value (fptr points to the field) */
                 //获取这个元素的下一个元素，k-v就是v
-                vptr = ziplistNext(zl, fptr);
+                vptr = lpNext(zl, fptr);
                 serverAssert(vptr != NULL);
                 update = 1;
 
-                /* Delete value */
-                //删除这个元素
-                zl = ziplistDelete(zl, &vptr);
-
-                /* Insert new value */
-                //在这个元素的位置将新元素插入
-                zl = ziplistInsert(zl, vptr, (unsigned char*)value,
+                /* Replace value */
+                //在这个元素的位置将value原地替换
+                zl = lpReplace(zl, &vptr, (unsigned char*)value,
                         sdslen(value));
             }
         }
         //如果有field代表数据被更新
         if (!update) {//没有找到这个field，没有这个key
-            //在ziplist的尾部插入新元素k-v
-            /* Push new field/value pair onto the tail of the ziplist */
-            zl = ziplistPush(zl, (unsigned char*)field, sdslen(field),
-                    ZIPLIST_TAIL);
-            zl = ziplistPush(zl, (unsigned char*)value, sdslen(value),
-                    ZIPLIST_TAIL);
+            //在listpack的尾部插入新元素k-v
+            /* Push new field/value pair onto the tail of the listpack */
+            zl = lpAppend(zl, (unsigned char*)field, sdslen(field));
+            zl = lpAppend(zl, (unsigned char*)value, sdslen(value));
         }
         //重新申请的数据空间赋值过去
         o->ptr = zl;
 
-        /* Check if the ziplist needs to be converted to a hash table */
-        //如果这个ziplist的元素超过了设置的上限需要将他转化为dict
-        if (hashTypeLength(o) > server.hash_max_ziplist_entries)
+        /* Check if the listpack needs to be converted to a hash table */
+        //如果这个listpack的元素超过了设置的上限需要将他转化为dict
+        if (hashTypeLength(o) > server.hash_max_listpack_entries)
             hashTypeConvert(o, OBJ_ENCODING_HT);
     } else if (o->encoding == OBJ_ENCODING_HT) {//类型为dict
         dictEntry *de = dictFind(o->ptr,field);//不用dictscan是因为field确定hash就确定
@@ -324,21 +316,21 @@ int hashTypeSet(robj *o, sds field, sds value, int flags) {
 int hashTypeDelete(robj *o, sds field) {
     //设置删除标志
     int deleted = 0;
-    //ziplist的数据删除
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+    //listpack的数据删除
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl, *fptr;
 
         zl = o->ptr;
-        //定位到ziplist第一个元素
-        fptr = ziplistIndex(zl, ZIPLIST_HEAD);
+        //定位到listpack第一个元素
+        fptr = lpFirst(zl);
         if (fptr != NULL) {//存在元素
-        //查找ziplist是否有这个元素
-            fptr = ziplistFind(fptr, (unsigned char*)field, sdslen(field), 1);
+        //查找listpack是否有这个元素
+            fptr = lpFind(zl, fptr, (unsigned char*)field, sdslen(field), 1);
             if (fptr != NULL) {//如果没有这个元素
                 //删除key代表的元素
-                zl = ziplistDelete(zl,&fptr); /* Delete the key. */
+                zl = lpDelete(zl, fptr, &fptr); /* Delete the key. */
                 //删除value代表的元素
-                zl = ziplistDelete(zl,&fptr); /* Delete the value. */
+                zl = lpDelete(zl, fptr, &fptr); /* Delete the value. */
                 //数据重新赋值
                 o->ptr = zl;
                 //成功删除标志
@@ -362,13 +354,13 @@ int hashTypeDelete(robj *o, sds field) {
 }
 
 /* Return the number of elements in a hash. */
-//获取o元素的k-v数量，只适用ziplist和dict
+//获取o元素的k-v数量，只适用listpack和dict
 unsigned long hashTypeLength(const robj *o) {
     unsigned long length = ULONG_MAX;
 
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
         //获取的是k+v的数量所以/2
-        length = ziplistLen(o->ptr) / 2;
+        length = lpLength(o->ptr) / 2;
     } else if (o->encoding == OBJ_ENCODING_HT) {
         //计算dict两个hash表中被使用的个数和
         length = dictSize((const dict*)o->ptr);
@@ -386,8 +378,8 @@ hashTypeIterator *hashTypeInitIterator(robj *subject) {
     hi->subject = subject;
     //记录转化到hashtable之前的encoding方式
     hi->encoding = subject->encoding;
-    //如果为ziplist
-    if (hi->encoding == OBJ_ENCODING_ZIPLIST) {//filed/value对于ziplist不存在
+    //如果为listpack
+    if (hi->encoding == OBJ_ENCODING_LISTPACK) {//filed/value对于listpack不存在
         hi->fptr = NULL;
         hi->vptr = NULL;
     } else if (hi->encoding == OBJ_ENCODING_HT) {
@@ -408,12 +400,12 @@ void hashTypeReleaseIterator(hashTypeIterator *hi) {
 
 /* Move to the next entry in the hash. Return C_OK when the next entry
  * could be found and C_ERR when the iterator reaches the end. */
-//获取hi指向元素的下一个元素，使用hi内部存储的变量记录当前的迭代元素位置，可用于ziplist和dict，返回是否被检索到
+//获取hi指向元素的下一个元素，使用hi内部存储的变量记录当前的迭代元素位置，可用于listpack和dict，返回是否被检索到
 int hashTypeNext(hashTypeIterator *hi) {
-    if (hi->encoding == OBJ_ENCODING_ZIPLIST) {//查看encoding为ziplist
+    if (hi->encoding == OBJ_ENCODING_LISTPACK) {//查看encoding为listpack
         unsigned char *zl;
         unsigned char *fptr, *vptr;
-        //ziplist的数据
+        //listpack的数据
         zl = hi->subject->ptr;
         //都为空
         fptr = hi->fptr;
@@ -423,18 +415,18 @@ int hashTypeNext(hashTypeIterator *hi) {
             /* Initialize cursor */
             serverAssert(vptr == NULL);
             //fptr定位到第一个元素位置
-            fptr = ziplistIndex(zl, 0);
+            fptr = lpSeek(zl, 0);
         } else {
             /* Advance cursor */
             serverAssert(vptr != NULL);
             //获取下一个元素的首地址
-            fptr = ziplistNext(zl, vptr);
+            fptr = lpNext(zl, vptr);
         }
         //没有元素了
         if (fptr == NULL) return C_ERR;
 
         /* Grab pointer to the value (fptr points to the field) */
-        vptr = ziplistNext(zl, fptr);
+        vptr = lpNext(zl, fptr);
         serverAssert(vptr != NULL);
 
         /* fptr, vptr now point to the first or next pair */
@@ -450,23 +442,19 @@ int hashTypeNext(hashTypeIterator *hi) {
 }
 
 /* Get the field or value at iterator cursor, for an iterator on a hash value
- * encoded as a ziplist. Prototype is similar to `hashTypeGetFromZiplist`. */
-//ziplist中存的数据是以k-v的形式存在的，需要这个去读取
-void hashTypeCurrentFromZiplist(hashTypeIterator *hi, int what,
+ * encoded as a listpack. Prototype is similar to `hashTypeGetFromListpack`. */
+//listpack中存的数据是以k-v的形式存在的，需要这个去读取
+void hashTypeCurrentFromListpack(hashTypeIterator *hi, int what,
                                 unsigned char **vstr,
                                 unsigned int *vlen,
                                 long long *vll)
 {
-    int ret;
-
-    serverAssert(hi->encoding == OBJ_ENCODING_ZIPLIST);
-    //ziplist中的key
+    serverAssert(hi->encoding == OBJ_ENCODING_LISTPACK);
+    //listpack中的key
     if (what & OBJ_HASH_KEY) {
-        ret = ziplistGet(hi->fptr, vstr, vlen, vll);
-        serverAssert(ret);
-    } else {//ziplist中的value
-        ret = ziplistGet(hi->vptr, vstr, vlen, vll);
-        serverAssert(ret);
+        *vstr = lpGetValue(hi->fptr, vlen, vll);
+    } else {//listpack中的value
+        *vstr = lpGetValue(hi->vptr, vlen, vll);
     }
 }
 
@@ -494,12 +482,12 @@ sds hashTypeCurrentFromHashTable(hashTypeIterator *hi, int what) {
  * If *vll is populated *vstr is set to NULL, so the caller
  * can always check the function return by checking the return value
  * type checking if vstr == NULL. */
-//获取当前迭代器的指向元素的key或者value的值，只适用于ziplist和dict
+//获取当前迭代器的指向元素的key或者value的值，只适用于listpack和dict
 void hashTypeCurrentObject(hashTypeIterator *hi, int what, unsigned char **vstr, unsigned int *vlen, long long *vll) {
-    if (hi->encoding == OBJ_ENCODING_ZIPLIST) {//ziplist的压缩方式
+    if (hi->encoding == OBJ_ENCODING_LISTPACK) {//listpack的压缩方式
         *vstr = NULL;
         //这边只能获取到vll
-        hashTypeCurrentFromZiplist(hi, what, vstr, vlen, vll);
+        hashTypeCurrentFromListpack(hi, what, vstr, vlen, vll);
     } else if (hi->encoding == OBJ_ENCODING_HT) {
         sds ele = hashTypeCurrentFromHashTable(hi, what);
         *vstr = (unsigned char*) ele;
@@ -528,7 +516,7 @@ robj *hashTypeLookupWriteOrCreate(client *c, robj *key) {
     //返回redis这个db中是否有这个key
     robj *o = lookupKeyWrite(c->db,key);
     if (o == NULL) {
-        //如果不存在则创建，这边创建的是ziplist的压缩方式
+        //如果不存在则创建，这边创建的是listpack的压缩方式
         o = createHashObject();
         dbAdd(c->db,key,o);
     } else {
@@ -541,12 +529,12 @@ robj *hashTypeLookupWriteOrCreate(client *c, robj *key) {
     return o;
 }
 
-//将ziplist转化为dict
-void hashTypeConvertZiplist(robj *o, int enc) {
+//将listpack转化为dict
+void hashTypeConvertListpack(robj *o, int enc) {
     //校验压缩类型
-    serverAssert(o->encoding == OBJ_ENCODING_ZIPLIST);
+    serverAssert(o->encoding == OBJ_ENCODING_LISTPACK);
     //如果压缩类型为ziplst
-    if (enc == OBJ_ENCODING_ZIPLIST) {
+    if (enc == OBJ_ENCODING_LISTPACK) {
         /* Nothing to do... */
 
     } else if (enc == OBJ_ENCODING_HT) {//如果需要转化为hashtable
@@ -571,7 +559,7 @@ void hashTypeConvertZiplist(robj *o, int enc) {
         */
         dict *dict;
         int ret;
-        //如果encoding为ziplist，则只是记录原始数据和原始的encoding方式
+        //如果encoding为listpack，则只是记录原始数据和原始的encoding方式
         hi = hashTypeInitIterator(o);
         //初始一个dict
         dict = dictCreate(&hashDictType, NULL);
@@ -581,17 +569,17 @@ void hashTypeConvertZiplist(robj *o, int enc) {
 
             key = hashTypeCurrentObjectNewSds(hi,OBJ_HASH_KEY);
             value = hashTypeCurrentObjectNewSds(hi,OBJ_HASH_VALUE);
-            //ziplist的数据为k-v结构
+            //listpack的数据为k-v结构
             ret = dictAdd(dict, key, value);
             if (ret != DICT_OK) {//失败打印
-                serverLogHexDump(LL_WARNING,"ziplist with dup elements dump",
-                    o->ptr,ziplistBlobLen(o->ptr));
-                serverPanic("Ziplist corruption detected");
+                serverLogHexDump(LL_WARNING,"listpack with dup elements dump",
+                    o->ptr,lpBytes(o->ptr));
+                serverPanic("Listpack corruption detected");
             }
         }
         //释放hi
         hashTypeReleaseIterator(hi);
-        //释放ziplist，已经将数据都放入dict中
+        //释放listpack，已经将数据都放入dict中
         zfree(o->ptr);
         //修改encoding方式
         o->encoding = OBJ_ENCODING_HT;
@@ -604,9 +592,9 @@ void hashTypeConvertZiplist(robj *o, int enc) {
 
 //将各种类型转化为dict
 void hashTypeConvert(robj *o, int enc) {
-    //如果需要转化的压缩类型为ziplist
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-        hashTypeConvertZiplist(o, enc);
+    //如果需要转化的压缩类型为listpack
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
+        hashTypeConvertListpack(o, enc);
     } else if (o->encoding == OBJ_ENCODING_HT) {
         serverPanic("Not implemented");
     } else {
@@ -622,7 +610,7 @@ void hsetnxCommand(client *c) {
     robj *o;
     //如果找到的这个对象类型不是hash
     if ((o = hashTypeLookupWriteOrCreate(c,c->argv[1])) == NULL) return;
-    //将参数的2-3转化为ziplist或者dict
+    //将参数的2-3转化为listpack或者dict
     hashTypeTryConversion(o,c->argv,2,3);
     //如果存在这个key
     if (hashTypeExists(o, c->argv[2]->ptr)) {
@@ -812,12 +800,12 @@ static void addHashFieldToReply(client *c, robj *o, sds field) {
         return;
     }
     //根据o的encoding方式解析数据
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
         //获取field后一个元素value
-        ret = hashTypeGetFromZiplist(o, field, &vstr, &vlen, &vll);
+        ret = hashTypeGetFromListpack(o, field, &vstr, &vlen, &vll);
         if (ret < 0) {//未找到
             addReplyNull(c);
         } else {//返回实际值
@@ -925,12 +913,12 @@ void hstrlenCommand(client *c) {
 }
 
 static void addHashIteratorCursorToReply(client *c, hashTypeIterator *hi, int what) {
-    if (hi->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (hi->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        hashTypeCurrentFromZiplist(hi, what, &vstr, &vlen, &vll);
+        hashTypeCurrentFromListpack(hi, what, &vstr, &vlen, &vll);
         if (vstr)
             addReplyBulkCBuffer(c, vstr, vlen);
         else
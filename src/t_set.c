@@ -37,16 +37,113 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
                               robj *dstkey, int op);
 
 /* Factory method to return a set that *can* hold "value". When the object has
- * an integer-encodable value, an intset will be returned. Otherwise a regular
- * hash table. */
-//工具函数返回一个robj根据value判断是intset还是dict
+ * an integer-encodable value, an intset will be returned. Otherwise a listpack
+ * when the value is small enough, or a regular hash table. */
+//工具函数返回一个robj根据value判断是intset、listpack还是dict
 robj *setTypeCreate(sds value) {
     //判断是否可被转化为longlong
     if (isSdsRepresentableAsLongLong(value,NULL) == C_OK)
         return createIntsetObject();//intset
+    if (server.set_max_listpack_entries &&
+        sdslen(value) <= server.set_max_listpack_value)
+        return createSetListpackObject();//listpack
     return createSetObject();//dict
 }
 
+/* Store the listpack element pointed by 'p' into the SDS string 'buf', that
+ * is created when NULL and reused otherwise. Integers are converted into
+ * their string representation. Returns the (possibly reallocated) string. */
+static sds setTypeLoadListpackElement(sds buf, unsigned char *p) {
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vll;
+    char nbuf[LP_INTBUF_SIZE];
+
+    vstr = lpGetValue(p,&vlen,&vll);
+    if (vstr == NULL) {
+        vlen = ll2string(nbuf,sizeof(nbuf),vll);
+        vstr = (unsigned char*)nbuf;
+    }
+    if (buf == NULL) return sdsnewlen(vstr,vlen);
+    return sdscpylen(buf,(char*)vstr,vlen);
+}
+
+/* Return the listpack element matching 'value', or NULL if not found. */
+static unsigned char *setTypeListpackFind(unsigned char *lp, sds value) {
+    return lpFind(lp,lpFirst(lp),(unsigned char*)value,sdslen(value),0);
+}
+
+/* Return a new roaring bitmap with the values of the intset. */
+static roaring *intsetToRoaring(intset *is) {
+    roaring *r = roaringNew();
+    int64_t v;
+    uint32_t j = 0;
+
+    while (intsetGet(is,j++,&v)) roaringAdd(r,v);
+    return r;
+}
+
+/* Roaring bitmaps with less than SET_ROARING_MIN_PER_CONTAINER values per
+ * container on average are sparse. Up to SET_ROARING_SPARSE_CONTAINERS
+ * containers they are kept anyway: they still use less memory than a hash
+ * table, and the sets of 32 bit IDs, that can't have more containers, tend
+ * to become dense as they grow, so the encoding does not depend on the
+ * order of the insertions. Above this size, every value creating a new
+ * container moves a large part of the containers array, and a hash table
+ * is used instead. */
+#define SET_ROARING_MIN_PER_CONTAINER 2
+#define SET_ROARING_SPARSE_CONTAINERS 65536
+
+/* Convert the set to a hash table if it is a large sparse roaring bitmap. */
+void setTypeConvertSparseRoaring(robj *setobj) {
+    roaring *r = setobj->ptr;
+    uint64_t containers;
+
+    if (setobj->encoding != OBJ_ENCODING_ROARING) return;
+    containers = roaringContainerCount(r);
+    if (containers > SET_ROARING_SPARSE_CONTAINERS &&
+        containers*SET_ROARING_MIN_PER_CONTAINER > roaringCardinality(r))
+    {
+        setTypeConvert(setobj,OBJ_ENCODING_HT);
+    }
+}
+
+/* Return a set object holding the values of the roaring bitmap 'r', that
+ * becomes owned by the set. Small results are converted into intsets. */
+static robj *setTypeFromRoaring(roaring *r) {
+    robj *o = createObject(OBJ_SET,r);
+
+    o->encoding = OBJ_ENCODING_ROARING;
+    if (roaringCardinality(r) <= server.set_max_intset_entries)
+        setTypeConvert(o,OBJ_ENCODING_INTSET);
+    else if (!server.set_roaring_encoding)
+        setTypeConvert(o,OBJ_ENCODING_HT);
+    else
+        setTypeConvertSparseRoaring(o);
+    return o;
+}
+
+/* Remove from an intset, roaring or listpack encoded set the integer
+ * returned by setTypeNext() or setTypeRandomElement(). */
+static void setTypeRemoveInteger(robj *setobj, int64_t llele) {
+    if (setobj->encoding == OBJ_ENCODING_INTSET) {
+        setobj->ptr = intsetRemove(setobj->ptr,llele,NULL);
+    } else if (setobj->encoding == OBJ_ENCODING_ROARING) {
+        roaringRemove(setobj->ptr,llele);
+    } else {
+        sds ele = sdsfromlonglong(llele);
+        setTypeRemove(setobj,ele);
+        sdsfree(ele);
+    }
+}
+
+/* Convert an intset that grew over set-max-intset-entries. */
+static void setTypeConvertLargeIntset(robj *setobj) {
+    setTypeConvert(setobj,server.set_roaring_encoding ?
+                          OBJ_ENCODING_ROARING : OBJ_ENCODING_HT);
+    setTypeConvertSparseRoaring(setobj);
+}
+
 /* Add the specified value into a set.
  *
  * If the value was already member of the set, nothing is done and 0 is
@@ -63,6 +160,20 @@ int setTypeAdd(robj *subject, sds value) {
             dictSetVal(ht,de,NULL);
             return 1;
         }
+    } else if (subject->encoding == OBJ_ENCODING_LISTPACK) {//如果是listpack
+        unsigned char *lp = subject->ptr;
+        if (setTypeListpackFind(lp,value) != NULL) return 0;//已经存在
+
+        if (lpLength(lp) < server.set_max_listpack_entries &&
+            sdslen(value) <= server.set_max_listpack_value)
+        {
+            subject->ptr = lpAppend(lp,(unsigned char*)value,sdslen(value));
+        } else {
+            /* Too many or too big elements, convert to regular set. */
+            setTypeConvert(subject,OBJ_ENCODING_HT);
+            serverAssert(dictAdd(subject->ptr,sdsdup(value),NULL) == DICT_OK);
+        }
+        return 1;
     } else if (subject->encoding == OBJ_ENCODING_INTSET) {//如果是intset
         if (isSdsRepresentableAsLongLong(value,&llval) == C_OK) {//如果可被插入
             uint8_t success = 0;
@@ -72,9 +183,19 @@ int setTypeAdd(robj *subject, sds value) {
                  * too many entries. */
                 //如果inset的值的数量超过系统设置的最大上限
                 if (intsetLen(subject->ptr) > server.set_max_intset_entries)
-                    setTypeConvert(subject,OBJ_ENCODING_HT);
+                    setTypeConvertLargeIntset(subject);
                 return 1;
             }
+        } else if (intsetLen(subject->ptr) < server.set_max_listpack_entries &&
+                   sdslen(value) <= server.set_max_listpack_value)
+        {
+            /* Failed to get integer from object, but the set is still small:
+             * convert to a listpack. The value is not integer encodable, so
+             * it can't be already part of the set. */
+            setTypeConvert(subject,OBJ_ENCODING_LISTPACK);
+            subject->ptr = lpAppend(subject->ptr,(unsigned char*)value,
+                                    sdslen(value));
+            return 1;
         } else {
             /* Failed to get integer from object, convert to regular set. */
             setTypeConvert(subject,OBJ_ENCODING_HT);
@@ -84,6 +205,18 @@ int setTypeAdd(robj *subject, sds value) {
             serverAssert(dictAdd(subject->ptr,sdsdup(value),NULL) == DICT_OK);
             return 1;
         }
+    } else if (subject->encoding == OBJ_ENCODING_ROARING) {//如果是roaring bitmap
+        if (isSdsRepresentableAsLongLong(value,&llval) == C_OK) {
+            if (!roaringAdd(subject->ptr,llval)) return 0;
+            setTypeConvertSparseRoaring(subject);
+            return 1;
+        }
+
+        /* Not an integer: convert to regular set, the value can't be
+         * already part of the set. */
+        setTypeConvert(subject,OBJ_ENCODING_HT);
+        serverAssert(dictAdd(subject->ptr,sdsdup(value),NULL) == DICT_OK);
+        return 1;
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -98,12 +231,21 @@ int setTypeRemove(robj *setobj, sds value) {
             if (htNeedsResize(setobj->ptr)) dictResize(setobj->ptr);//查看是否需要resize
             return 1;
         }
+    } else if (setobj->encoding == OBJ_ENCODING_LISTPACK) {
+        unsigned char *p = setTypeListpackFind(setobj->ptr,value);
+        if (p != NULL) {
+            setobj->ptr = lpDelete(setobj->ptr,p,NULL);
+            return 1;
+        }
     } else if (setobj->encoding == OBJ_ENCODING_INTSET) {
         if (isSdsRepresentableAsLongLong(value,&llval) == C_OK) {//value可被表示
             int success;
             setobj->ptr = intsetRemove(setobj->ptr,llval,&success);
             if (success) return 1;
         }
+    } else if (setobj->encoding == OBJ_ENCODING_ROARING) {
+        if (isSdsRepresentableAsLongLong(value,&llval) == C_OK)
+            return roaringRemove(setobj->ptr,llval);
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -115,10 +257,15 @@ int setTypeIsMember(robj *subject, sds value) {
     long long llval;
     if (subject->encoding == OBJ_ENCODING_HT) {
         return dictFind((dict*)subject->ptr,value) != NULL;
+    } else if (subject->encoding == OBJ_ENCODING_LISTPACK) {
+        return setTypeListpackFind(subject->ptr,value) != NULL;
     } else if (subject->encoding == OBJ_ENCODING_INTSET) {
         if (isSdsRepresentableAsLongLong(value,&llval) == C_OK) {
             return intsetFind((intset*)subject->ptr,llval);
         }
+    } else if (subject->encoding == OBJ_ENCODING_ROARING) {
+        if (isSdsRepresentableAsLongLong(value,&llval) == C_OK)
+            return roaringContains(subject->ptr,llval);
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -133,8 +280,13 @@ setTypeIterator *setTypeInitIterator(robj *subject) {
     //根据encoding的不同创建不同的迭代器
     if (si->encoding == OBJ_ENCODING_HT) {
         si->di = dictGetIterator(subject->ptr);
+    } else if (si->encoding == OBJ_ENCODING_LISTPACK) {
+        si->lpi = lpFirst(subject->ptr);//listpack中的当前元素
+        si->lpele = NULL;
     } else if (si->encoding == OBJ_ENCODING_INTSET) {
         si->ii = 0;//intset中的pos
+    } else if (si->encoding == OBJ_ENCODING_ROARING) {
+        roaringInitIterator(subject->ptr,&si->ri);
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -145,6 +297,8 @@ setTypeIterator *setTypeInitIterator(robj *subject) {
 void setTypeReleaseIterator(setTypeIterator *si) {
     if (si->encoding == OBJ_ENCODING_HT)
         dictReleaseIterator(si->di);
+    else if (si->encoding == OBJ_ENCODING_LISTPACK)
+        sdsfree(si->lpele);
     zfree(si);
 }
 
@@ -160,6 +314,10 @@ void setTypeReleaseIterator(setTypeIterator *si) {
  * be NULL since the function will try to defensively populate the non
  * used field with values which are easy to trap if misused.
  *
+ * Listpack encoded sets populate sdsele with a string owned by the iterator,
+ * that is only valid until the next call. Roaring encoded sets populate
+ * llele like intsets, setIntegerEncoding() tells which field is used.
+ *
  * When there are no longer elements -1 is returned. */
 //获取si指向的subject的下一个元素，dict中的key放在sdsele，intset中的key放在llele
 int setTypeNext(setTypeIterator *si, sds *sdsele, int64_t *llele) {
@@ -168,10 +326,19 @@ int setTypeNext(setTypeIterator *si, sds *sdsele, int64_t *llele) {
         if (de == NULL) return -1;//元素遍历完
         *sdsele = dictGetKey(de);//获取key
         *llele = -123456789; /* Not needed. Defensive. */
+    } else if (si->encoding == OBJ_ENCODING_LISTPACK) {//如果为listpack
+        if (si->lpi == NULL) return -1;//元素遍历完
+        si->lpele = setTypeLoadListpackElement(si->lpele,si->lpi);
+        si->lpi = lpNext(si->subject->ptr,si->lpi);
+        *sdsele = si->lpele;
+        *llele = -123456789; /* Not needed. Defensive. */
     } else if (si->encoding == OBJ_ENCODING_INTSET) {//如果为intset
         if (!intsetGet(si->subject->ptr,si->ii++,llele))//获取下标ii的数据
             return -1;
         *sdsele = NULL; /* Not needed. Defensive. */
+    } else if (si->encoding == OBJ_ENCODING_ROARING) {//如果为roaring bitmap
+        if (!roaringNext(&si->ri,llele)) return -1;
+        *sdsele = NULL; /* Not needed. Defensive. */
     } else {
         serverPanic("Wrong set encoding in setTypeNext");
     }
@@ -194,8 +361,10 @@ sds setTypeNextObject(setTypeIterator *si) {
     switch(encoding) {
         case -1:    return NULL;
         case OBJ_ENCODING_INTSET:
+        case OBJ_ENCODING_ROARING:
             return sdsfromlonglong(intele);
         case OBJ_ENCODING_HT:
+        case OBJ_ENCODING_LISTPACK:
             return sdsdup(sdsele);
         default:
             serverPanic("Unsupported encoding");
@@ -204,27 +373,38 @@ sds setTypeNextObject(setTypeIterator *si) {
 }
 
 /* Return random element from a non empty set.
- * The returned element can be a int64_t value if the set is encoded
- * as an "intset" blob of integers, or an SDS string if the set
- * is a regular set.
- *
- * The caller provides both pointers to be populated with the right
- * object. The return value of the function is the object->encoding
- * field of the object and is used by the caller to check if the
- * int64_t pointer or the redis object pointer was populated.
+ * The returned element can be a int64_t value, stored into *llele with
+ * *str set to NULL, or a string stored into *str and *len. Strings point
+ * inside the set and are valid until the set is modified: this is the case
+ * of the elements of regular sets, and of the non integer elements of
+ * listpack encoded sets, whose integers are returned as int64_t values.
  *
- * Note that both the sdsele and llele pointers should be passed and cannot
- * be NULL since the function will try to defensively populate the non
- * used field with values which are easy to trap if misused. */
-//随机获取set中的一个值，dict将值赋给sdsele，intset赋值给llele
-int setTypeRandomElement(robj *setobj, sds *sdsele, int64_t *llele) {
+ * The caller provides all the pointers to be populated with the right
+ * value, that cannot be NULL. The return value of the function is the
+ * object->encoding field of the object. */
+//随机获取set中的一个值，字符串赋给str和len，整数赋给llele并将str设为NULL
+int setTypeRandomElement(robj *setobj, char **str, size_t *len, int64_t *llele) {
     if (setobj->encoding == OBJ_ENCODING_HT) {
         dictEntry *de = dictGetFairRandomKey(setobj->ptr);//获取一个随机key
-        *sdsele = dictGetKey(de);
+        sds key = dictGetKey(de);
+        *str = key;
+        *len = sdslen(key);
         *llele = -123456789; /* Not needed. Defensive. */
+    } else if (setobj->encoding == OBJ_ENCODING_LISTPACK) {
+        unsigned char *lp = setobj->ptr;
+        unsigned char *p = lpSeek(lp,random() % lpLength(lp));
+        unsigned int vlen;
+        long long vll;
+
+        *str = (char*)lpGetValue(p,&vlen,&vll);
+        *len = vlen;
+        *llele = *str ? -123456789 : vll;
     } else if (setobj->encoding == OBJ_ENCODING_INTSET) {
         *llele = intsetRandom(setobj->ptr);
-        *sdsele = NULL; /* Not needed. Defensive. */
+        *str = NULL;
+    } else if (setobj->encoding == OBJ_ENCODING_ROARING) {
+        *llele = roaringRandom(setobj->ptr);
+        *str = NULL;
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -235,8 +415,12 @@ int setTypeRandomElement(robj *setobj, sds *sdsele, int64_t *llele) {
 unsigned long setTypeSize(const robj *subject) {
     if (subject->encoding == OBJ_ENCODING_HT) {//dict
         return dictSize((const dict*)subject->ptr);
+    } else if (subject->encoding == OBJ_ENCODING_LISTPACK) {//listpack
+        return lpLength(subject->ptr);
     } else if (subject->encoding == OBJ_ENCODING_INTSET) {//intset
         return intsetLen((const intset*)subject->ptr);
+    } else if (subject->encoding == OBJ_ENCODING_ROARING) {//roaring bitmap
+        return roaringCardinality(subject->ptr);
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -244,35 +428,76 @@ unsigned long setTypeSize(const robj *subject) {
 
 /* Convert the set to specified encoding. The resulting dict (when converting
  * to a hash table) is presized to hold the number of elements in the original
- * set. */
-//将intset转化为dict
+ * set. Only intsets can be converted to listpacks and roaring bitmaps, and
+ * only roaring bitmaps can be converted to intsets. */
+//将intset、listpack或roaring bitmap转化为dict，或者在intset和listpack、roaring bitmap之间转化
 void setTypeConvert(robj *setobj, int enc) {
     setTypeIterator *si;
     serverAssertWithInfo(NULL,setobj,setobj->type == OBJ_SET &&
-                             setobj->encoding == OBJ_ENCODING_INTSET);
+                             setobj->encoding != OBJ_ENCODING_HT);
 
-    if (enc == OBJ_ENCODING_HT) {//只对dict类型做处理
-        int64_t intele;
+    if (enc == OBJ_ENCODING_HT) {
         //创建set专用的dict
         dict *d = dictCreate(&setDictType,NULL);
         sds element;
 
         /* Presize the dict to avoid rehashing */
-        //申请intset大小的空间
-        dictExpand(d,intsetLen(setobj->ptr));
+        //申请set大小的空间
+        dictExpand(d,setTypeSize(setobj));
 
-        /* To add the elements we extract integers and create redis objects */
+        /* To add the elements we extract them as new SDS strings */
         si = setTypeInitIterator(setobj);//获取迭代器
-        while (setTypeNext(si,&element,&intele) != -1) {//这边只能是从intset->dict所以直接将数据转化为sds存入dict即可
-            element = sdsfromlonglong(intele);
+        while ((element = setTypeNextObject(si)) != NULL)
             serverAssert(dictAdd(d,element,NULL) == DICT_OK);
-        }
         //释放iterator
         setTypeReleaseIterator(si);
 
+        if (setobj->encoding == OBJ_ENCODING_LISTPACK)//释放原来的intset、listpack或roaring bitmap
+            lpFree(setobj->ptr);
+        else if (setobj->encoding == OBJ_ENCODING_ROARING)
+            roaringFree(setobj->ptr);
+        else
+            zfree(setobj->ptr);
         setobj->encoding = OBJ_ENCODING_HT;//修改encoding方式
-        zfree(setobj->ptr);//释放原来的intset
         setobj->ptr = d;//将dict的数据赋值给原来的位置
+    } else if (enc == OBJ_ENCODING_LISTPACK) {
+        unsigned char *lp = lpNew();
+        char buf[LP_INTBUF_SIZE];
+        int64_t intele;
+        int ii = 0;
+
+        serverAssertWithInfo(NULL,setobj,
+            setobj->encoding == OBJ_ENCODING_INTSET);
+        while (intsetGet(setobj->ptr,ii++,&intele)) {
+            int len = ll2string(buf,sizeof(buf),intele);
+            lp = lpAppend(lp,(unsigned char*)buf,len);
+        }
+
+        setobj->encoding = OBJ_ENCODING_LISTPACK;
+        zfree(setobj->ptr);
+        setobj->ptr = lp;
+    } else if (enc == OBJ_ENCODING_ROARING) {
+        roaring *r;
+
+        serverAssertWithInfo(NULL,setobj,
+            setobj->encoding == OBJ_ENCODING_INTSET);
+        r = intsetToRoaring(setobj->ptr);
+        zfree(setobj->ptr);
+        setobj->encoding = OBJ_ENCODING_ROARING;
+        setobj->ptr = r;
+    } else if (enc == OBJ_ENCODING_INTSET) {
+        intset *is = intsetNew();
+        roaringIterator it;
+        int64_t intele;
+
+        serverAssertWithInfo(NULL,setobj,
+            setobj->encoding == OBJ_ENCODING_ROARING);
+        roaringInitIterator(setobj->ptr,&it);
+        while (roaringNext(&it,&intele)) is = intsetAdd(is,intele,NULL);
+
+        roaringFree(setobj->ptr);
+        setobj->encoding = OBJ_ENCODING_INTSET;
+        setobj->ptr = is;
     } else {
         serverPanic("Unsupported set conversion");
     }
@@ -515,6 +740,8 @@ void spopWithCountCommand(client *c) {
 
     /* Common iteration vars. */
     sds sdsele;
+    char *str;
+    size_t len;
     robj *objele;
     int encoding;
     int64_t llele;
@@ -530,15 +757,15 @@ void spopWithCountCommand(client *c) {
     if (remaining*SPOP_MOVE_STRATEGY_MUL > count) {
         while(count--) {
             /* Emit and remove. */
-            encoding = setTypeRandomElement(set,&sdsele,&llele);
-            if (encoding == OBJ_ENCODING_INTSET) {
+            setTypeRandomElement(set,&str,&len,&llele);
+            if (str == NULL) {
                 addReplyBulkLongLong(c,llele);
                 objele = createStringObjectFromLongLong(llele);
-                set->ptr = intsetRemove(set->ptr,llele,NULL);
+                setTypeRemoveInteger(set,llele);
             } else {
-                addReplyBulkCBuffer(c,sdsele,sdslen(sdsele));
-                objele = createStringObject(sdsele,sdslen(sdsele));
-                setTypeRemove(set,sdsele);
+                addReplyBulkCBuffer(c,str,len);
+                objele = createStringObject(str,len);
+                setTypeRemove(set,objele->ptr);
             }
 
             /* Replicate/AOF this command as an SREM operation */
@@ -560,11 +787,11 @@ void spopWithCountCommand(client *c) {
 
         /* Create a new set with just the remaining elements. */
         while(remaining--) {
-            encoding = setTypeRandomElement(set,&sdsele,&llele);
-            if (encoding == OBJ_ENCODING_INTSET) {
+            setTypeRandomElement(set,&str,&len,&llele);
+            if (str == NULL) {
                 sdsele = sdsfromlonglong(llele);
             } else {
-                sdsele = sdsdup(sdsele);
+                sdsele = sdsnewlen(str,len);
             }
             if (!newset) newset = setTypeCreate(sdsele);
             setTypeAdd(newset,sdsele);
@@ -576,7 +803,7 @@ void spopWithCountCommand(client *c) {
         setTypeIterator *si;
         si = setTypeInitIterator(set);
         while((encoding = setTypeNext(si,&sdsele,&llele)) != -1) {
-            if (encoding == OBJ_ENCODING_INTSET) {
+            if (setIntegerEncoding(encoding)) {
                 addReplyBulkLongLong(c,llele);
                 objele = createStringObjectFromLongLong(llele);
             } else {
@@ -615,9 +842,9 @@ SPOP key [count]
 */
 void spopCommand(client *c) {
     robj *set, *ele, *aux;
-    sds sdsele;
+    char *str;
+    size_t len;
     int64_t llele;
-    int encoding;
 
     if (c->argc == 3) {//pop多个
         spopWithCountCommand(c);
@@ -635,14 +862,14 @@ void spopCommand(client *c) {
 
     /* Get a random element from the set */
     //获取一个随机的entry
-    encoding = setTypeRandomElement(set,&sdsele,&llele);
+    setTypeRandomElement(set,&str,&len,&llele);
 
     /* Remove the element from the set */
-    if (encoding == OBJ_ENCODING_INTSET) {//删除元素
+    if (str == NULL) {//删除元素
         ele = createStringObjectFromLongLong(llele);
-        set->ptr = intsetRemove(set->ptr,llele,NULL);
+        setTypeRemoveInteger(set,llele);
     } else {
-        ele = createStringObject(sdsele,sdslen(sdsele));
+        ele = createStringObject(str,len);
         setTypeRemove(set,ele->ptr);
     }
 
@@ -682,6 +909,8 @@ void srandmemberWithCountCommand(client *c) {
     int uniq = 1;
     robj *set;
     sds ele;
+    char *str;
+    size_t len;
     int64_t llele;
     int encoding;
 
@@ -714,11 +943,11 @@ void srandmemberWithCountCommand(client *c) {
     if (!uniq) {
         addReplySetLen(c,count);
         while(count--) {
-            encoding = setTypeRandomElement(set,&ele,&llele);
-            if (encoding == OBJ_ENCODING_INTSET) {
+            setTypeRandomElement(set,&str,&len,&llele);
+            if (str == NULL) {
                 addReplyBulkLongLong(c,llele);
             } else {
-                addReplyBulkCBuffer(c,ele,sdslen(ele));
+                addReplyBulkCBuffer(c,str,len);
             }
         }
         return;
@@ -752,7 +981,7 @@ void srandmemberWithCountCommand(client *c) {
         while((encoding = setTypeNext(si,&ele,&llele)) != -1) {
             int retval = DICT_ERR;
 
-            if (encoding == OBJ_ENCODING_INTSET) {
+            if (setIntegerEncoding(encoding)) {
                 retval = dictAdd(d,createStringObjectFromLongLong(llele),NULL);
             } else {
                 retval = dictAdd(d,createStringObject(ele,sdslen(ele)),NULL);
@@ -781,11 +1010,11 @@ void srandmemberWithCountCommand(client *c) {
         robj *objele;
 
         while(added < count) {
-            encoding = setTypeRandomElement(set,&ele,&llele);
-            if (encoding == OBJ_ENCODING_INTSET) {
+            setTypeRandomElement(set,&str,&len,&llele);
+            if (str == NULL) {
                 objele = createStringObjectFromLongLong(llele);
             } else {
-                objele = createStringObject(ele,sdslen(ele));
+                objele = createStringObject(str,len);
             }
             /* Try to add the object to the dictionary. If it already exists
              * free it, otherwise increment the number of objects we have
@@ -813,9 +1042,9 @@ void srandmemberWithCountCommand(client *c) {
 
 void srandmemberCommand(client *c) {
     robj *set;
-    sds ele;
+    char *str;
+    size_t len;
     int64_t llele;
-    int encoding;
 
     if (c->argc == 3) {
         srandmemberWithCountCommand(c);
@@ -828,11 +1057,11 @@ void srandmemberCommand(client *c) {
     if ((set = lookupKeyReadOrReply(c,c->argv[1],shared.null[c->resp]))
         == NULL || checkType(c,set,OBJ_SET)) return;
 
-    encoding = setTypeRandomElement(set,&ele,&llele);
-    if (encoding == OBJ_ENCODING_INTSET) {
+    setTypeRandomElement(set,&str,&len,&llele);
+    if (str == NULL) {
         addReplyBulkLongLong(c,llele);
     } else {
-        addReplyBulkCBuffer(c,ele,sdslen(ele));
+        addReplyBulkCBuffer(c,str,len);
     }
 }
 
@@ -855,8 +1084,87 @@ int qsortCompareSetsByRevCardinality(const void *s1, const void *s2) {
     return 0;
 }
 
+/* Intersect the intset 'sets[0]' with the other intset or roaring encoded
+ * sets, sorted from the smallest to the largest, returning a sorted array
+ * with the common values that the caller should free with zfree(). The
+ * number of values is stored into *count.
+ *
+ * When 'limit' is not zero at most 'limit' values are returned: the
+ * intersection with the last set stops as soon as they are found, the
+ * previous ones must be complete since the last set may discard values. */
+int64_t *sinterIntegers(robj **sets, unsigned long setnum, uint32_t *count,
+                        unsigned long limit) {
+    intset *is = sets[0]->ptr;
+    uint32_t len = intsetLen(is), i;
+    int64_t *vals = zmalloc(sizeof(int64_t)*(len ? len : 1));
+    unsigned long j;
+
+    if (limit >= len) limit = 0;
+    for (i = 0; i < len; i++) intsetGet(is,i,&vals[i]);
+    for (j = 1; j < setnum && len; j++) {
+        uint32_t l = (j == setnum-1) ? limit : 0;
+
+        if (sets[j] == sets[0]) continue;
+        if (sets[j]->encoding == OBJ_ENCODING_INTSET)
+            len = intsetIntersect(sets[j]->ptr,vals,len,l);
+        else
+            len = roaringIntersectArray(sets[j]->ptr,vals,len,l);
+    }
+    if (limit && len > limit) len = limit;
+    *count = len;
+    return vals;
+}
+
+/* Intersect the roaring encoded 'sets[0]' with the other intset or roaring
+ * encoded sets, returning a new roaring bitmap, or NULL when the result is
+ * just 'sets[0]' itself. */
+roaring *sinterRoaring(robj **sets, unsigned long setnum) {
+    roaring *res = NULL, *tmp, *r;
+    unsigned long j;
+
+    for (j = 1; j < setnum; j++) {
+        if (sets[j] == sets[0]) continue;
+        r = sets[j]->encoding == OBJ_ENCODING_ROARING ?
+            sets[j]->ptr : intsetToRoaring(sets[j]->ptr);
+        tmp = roaringAnd(res ? res : sets[0]->ptr,r);
+        if (r != sets[j]->ptr) roaringFree(r);
+        if (res) roaringFree(res);
+        res = tmp;
+        if (roaringCardinality(res) == 0) break;
+    }
+    return res;
+}
+
+/* Like sinterRoaring() but only return the size of the intersection. The
+ * last set is not intersected but counted against the intersection of the
+ * previous ones, stopping once 'limit' values are found (0 means no limit). */
+unsigned long sinterRoaringCard(robj **sets, unsigned long setnum,
+                                unsigned long limit) {
+    robj *last = sets[setnum-1];
+    roaring *bitmap, *r;
+    unsigned long card;
+
+    if (setnum > 1 && last != sets[0]) {
+        bitmap = sinterRoaring(sets,setnum-1);
+        r = last->encoding == OBJ_ENCODING_ROARING ?
+            last->ptr : intsetToRoaring(last->ptr);
+        card = roaringAndCardinality(bitmap ? bitmap : sets[0]->ptr,r,limit);
+        if (r != last->ptr) roaringFree(r);
+    } else {
+        bitmap = sinterRoaring(sets,setnum);
+        card = roaringCardinality(bitmap ? bitmap : sets[0]->ptr);
+    }
+    if (bitmap) roaringFree(bitmap);
+    if (limit && card > limit) card = limit;
+    return card;
+}
+
+/* Implements SINTER, SINTERSTORE and SINTERCARD. When 'cardinality_only' is
+ * true only the size of the intersection is replied, and the computation
+ * stops once 'limit' common elements are found (0 means no limit). */
 void sinterGenericCommand(client *c, robj **setkeys,
-                          unsigned long setnum, robj *dstkey) {
+                          unsigned long setnum, robj *dstkey,
+                          int cardinality_only, unsigned long limit) {
     robj **sets = zmalloc(sizeof(robj*)*setnum);
     setTypeIterator *si;
     robj *dstset = NULL;
@@ -864,7 +1172,7 @@ void sinterGenericCommand(client *c, robj **setkeys,
     int64_t intobj;
     void *replylen = NULL;
     unsigned long j, cardinality = 0;
-    int encoding;
+    int encoding, integers_only = 1;
 
     for (j = 0; j < setnum; j++) {
         robj *setobj = dstkey ?
@@ -878,6 +1186,8 @@ void sinterGenericCommand(client *c, robj **setkeys,
                     server.dirty++;
                 }
                 addReply(c,shared.czero);
+            } else if (cardinality_only) {
+                addReply(c,shared.czero);
             } else {
                 addReply(c,shared.emptyset[c->resp]);
             }
@@ -888,6 +1198,7 @@ void sinterGenericCommand(client *c, robj **setkeys,
             return;
         }
         sets[j] = setobj;
+        if (!setIntegerEncoding(setobj->encoding)) integers_only = 0;
     }
     /* Sort sets from the smallest to largest, this will improve our
      * algorithm's performance */
@@ -898,12 +1209,59 @@ void sinterGenericCommand(client *c, robj **setkeys,
      * the intersection set size, so we use a trick, append an empty object
      * to the output list and save the pointer to later modify it with the
      * right length */
-    if (!dstkey) {
-        replylen = addReplyDeferredLen(c);
-    } else {
+    if (dstkey) {
         /* If we have a target key where to store the resulting set
          * create this key with an empty set inside */
         dstset = createIntsetObject();
+    } else if (!cardinality_only) {
+        replylen = addReplyDeferredLen(c);
+    }
+
+    /* When all the sets are roaring bitmaps they are intersected with
+     * bitwise operations. */
+    if (integers_only && sets[0]->encoding == OBJ_ENCODING_ROARING) {
+        roaring *bitmap, *result;
+
+        if (cardinality_only) {
+            cardinality = sinterRoaringCard(sets,setnum,limit);
+            goto reply;
+        }
+        bitmap = sinterRoaring(sets,setnum);
+        result = bitmap ? bitmap : sets[0]->ptr;
+        cardinality = roaringCardinality(result);
+        if (dstkey) {
+            decrRefCount(dstset);
+            dstset = setTypeFromRoaring(bitmap ? bitmap : roaringDup(result));
+            bitmap = NULL;
+        } else {
+            roaringIterator it;
+
+            roaringInitIterator(result,&it);
+            while (roaringNext(&it,&intobj)) addReplyBulkLongLong(c,intobj);
+        }
+        if (bitmap) roaringFree(bitmap);
+        goto reply;
+    }
+
+    /* When the smallest set is an intset and the others are intsets or
+     * roaring bitmaps, they are intersected as sorted arrays, merging or
+     * galloping depending on the size of the sets. */
+    if (integers_only) {
+        uint32_t count, i;
+        int64_t *vals = sinterIntegers(sets,setnum,&count,
+                                       cardinality_only ? limit : 0);
+
+        for (i = 0; i < count; i++) {
+            if (dstkey)
+                dstset->ptr = intsetAdd(dstset->ptr,vals[i],NULL);
+            else if (!cardinality_only)
+                addReplyBulkLongLong(c,vals[i]);
+        }
+        cardinality = count;
+        zfree(vals);
+        if (dstkey && intsetLen(dstset->ptr) > server.set_max_intset_entries)
+            setTypeConvertLargeIntset(dstset);
+        goto reply;
     }
 
     /* Iterate all the elements of the first (smallest) set, and test
@@ -913,16 +1271,20 @@ void sinterGenericCommand(client *c, robj **setkeys,
     while((encoding = setTypeNext(si,&elesds,&intobj)) != -1) {
         for (j = 1; j < setnum; j++) {
             if (sets[j] == sets[0]) continue;
-            if (encoding == OBJ_ENCODING_INTSET) {
+            if (setIntegerEncoding(encoding)) {
                 /* intset with intset is simple... and fast */
                 if (sets[j]->encoding == OBJ_ENCODING_INTSET &&
                     !intsetFind((intset*)sets[j]->ptr,intobj))
                 {
                     break;
+                } else if (sets[j]->encoding == OBJ_ENCODING_ROARING &&
+                           !roaringContains(sets[j]->ptr,intobj))
+                {
+                    break;
                 /* in order to compare an integer with an object we
                  * have to use the generic function, creating an object
                  * for this */
-                } else if (sets[j]->encoding == OBJ_ENCODING_HT) {
+                } else if (!setIntegerEncoding(sets[j]->encoding)) {
                     elesds = sdsfromlonglong(intobj);
                     if (!setTypeIsMember(sets[j],elesds)) {
                         sdsfree(elesds);
@@ -930,7 +1292,7 @@ void sinterGenericCommand(client *c, robj **setkeys,
                     }
                     sdsfree(elesds);
                 }
-            } else if (encoding == OBJ_ENCODING_HT) {
+            } else {
                 if (!setTypeIsMember(sets[j],elesds)) {
                     break;
                 }
@@ -939,14 +1301,18 @@ void sinterGenericCommand(client *c, robj **setkeys,
 
         /* Only take action when all sets contain the member */
         if (j == setnum) {
-            if (!dstkey) {
-                if (encoding == OBJ_ENCODING_HT)
+            if (cardinality_only) {
+                cardinality++;
+                /* We stop the computation once we reach the limit. */
+                if (limit && cardinality >= limit) break;
+            } else if (!dstkey) {
+                if (!setIntegerEncoding(encoding))
                     addReplyBulkCBuffer(c,elesds,sdslen(elesds));
                 else
                     addReplyBulkLongLong(c,intobj);
                 cardinality++;
             } else {
-                if (encoding == OBJ_ENCODING_INTSET) {
+                if (setIntegerEncoding(encoding)) {
                     elesds = sdsfromlonglong(intobj);
                     setTypeAdd(dstset,elesds);
                     sdsfree(elesds);
@@ -958,7 +1324,10 @@ void sinterGenericCommand(client *c, robj **setkeys,
     }
     setTypeReleaseIterator(si);
 
-    if (dstkey) {
+reply:
+    if (cardinality_only) {
+        addReplyLongLong(c,cardinality);
+    } else if (dstkey) {
         /* Store the resulting set into the target, if the intersection
          * is not an empty set. */
         int deleted = dbDelete(c->db,dstkey);
@@ -983,22 +1352,101 @@ void sinterGenericCommand(client *c, robj **setkeys,
 }
 
 void sinterCommand(client *c) {
-    sinterGenericCommand(c,c->argv+1,c->argc-1,NULL);
+    sinterGenericCommand(c,c->argv+1,c->argc-1,NULL,0,0);
+}
+
+/*
+SINTERCARD numkeys key [key ...] [LIMIT limit]
+返回多个集合交集的元素个数，不返回交集本身。
+LIMIT不为0时，交集的元素个数达到limit即停止计算并返回limit。
+*/
+void sinterCardCommand(client *c) {
+    long j;
+    long numkeys = 0; /* Number of keys. */
+    long limit = 0;   /* 0 means no limit. */
+
+    if (getLongFromObjectOrReply(c,c->argv[1],&numkeys,NULL) != C_OK)
+        return;
+    if (numkeys < 1) {
+        addReplyError(c,"numkeys should be greater than 0");
+        return;
+    }
+    if (numkeys > (c->argc - 2)) {
+        addReplyError(c,"Number of keys can't be greater than number of args");
+        return;
+    }
+
+    for (j = 2 + numkeys; j < c->argc; j++) {
+        char *opt = c->argv[j]->ptr;
+        int moreargs = (c->argc - 1) - j;
+
+        if (!strcasecmp(opt,"LIMIT") && moreargs) {
+            j++;
+            if (getLongFromObjectOrReply(c,c->argv[j],&limit,NULL) != C_OK)
+                return;
+            if (limit < 0) {
+                addReplyError(c,"LIMIT can't be negative");
+                return;
+            }
+        } else {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+    }
+
+    sinterGenericCommand(c,c->argv+2,numkeys,NULL,1,limit);
 }
 
 void sinterstoreCommand(client *c) {
-    sinterGenericCommand(c,c->argv+2,c->argc-2,c->argv[1]);
+    sinterGenericCommand(c,c->argv+2,c->argc-2,c->argv[1],0,0);
 }
 
 #define SET_OP_UNION 0
 #define SET_OP_DIFF 1
 #define SET_OP_INTER 2
 
+/* When all the sets are intsets or roaring bitmaps, and at least one of them
+ * is a roaring bitmap, perform the union or the difference with bitwise
+ * operations, converting the intsets first. Returns the resulting bitmap,
+ * or NULL if the sets can't be handled this way. */
+roaring *sunionDiffRoaring(robj **sets, int setnum, int op) {
+    roaring *res = NULL, *tmp, *r;
+    int j, found = 0;
+
+    for (j = 0; j < setnum; j++) {
+        if (!sets[j]) continue;
+        if (!setIntegerEncoding(sets[j]->encoding)) return NULL;
+        if (sets[j]->encoding == OBJ_ENCODING_ROARING) found = 1;
+    }
+    if (!found) return NULL;
+    if (op == SET_OP_DIFF && !sets[0]) return roaringNew();
+
+    for (j = 0; j < setnum; j++) {
+        if (!sets[j]) continue; /* non existing keys are like empty sets */
+        r = sets[j]->encoding == OBJ_ENCODING_ROARING ?
+            sets[j]->ptr : intsetToRoaring(sets[j]->ptr);
+        if (res == NULL) {
+            res = r == sets[j]->ptr ? roaringDup(r) : r;
+            continue;
+        }
+        tmp = op == SET_OP_UNION ? roaringOr(res,r) : roaringAndNot(res,r);
+        if (r != sets[j]->ptr) roaringFree(r);
+        roaringFree(res);
+        res = tmp;
+
+        /* Exit if the difference is empty, as any additional removal
+         * will have no effect. */
+        if (op == SET_OP_DIFF && roaringCardinality(res) == 0) break;
+    }
+    return res;
+}
+
 void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
                               robj *dstkey, int op) {
     robj **sets = zmalloc(sizeof(robj*)*setnum);//获取临时变量
     setTypeIterator *si;//set的迭代器
     robj *dstset = NULL;
+    roaring *bitmap;
     sds ele;
     int j, cardinality = 0;//cardinality 为union操作过的元素个数
     int diff_algo = 1;
@@ -1056,9 +1504,13 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
     /* We need a temp set object to store our union. If the dstkey
      * is not NULL (that is, we are inside an SUNIONSTORE operation) then
      * this set object will be the resulting object to set into the target key*/
-    dstset = createIntsetObject();//创建一个新的intset
+    bitmap = sunionDiffRoaring(sets,setnum,op);
+    dstset = bitmap ? setTypeFromRoaring(bitmap) : createIntsetObject();//创建一个新的intset
 
-    if (op == SET_OP_UNION) {//合并
+    if (bitmap) {
+        /* The result was already computed with bitwise operations. */
+        cardinality = setTypeSize(dstset);
+    } else if (op == SET_OP_UNION) {//合并
         /* Union is trivial, just add every element of every set to the
          * temporary set. */
         for (j = 0; j < setnum; j++) {
@@ -717,7 +717,86 @@ zskiplistNode *zslLastInLexRange(zskiplist *zsl, zlexrangespec *range) {
 }
 
 /*-----------------------------------------------------------------------------
- * Ziplist-backed sorted set API
+ * B+tree range functions, see zbtree.c for the B+tree implementation
+ *----------------------------------------------------------------------------*/
+
+/* 以下谓词对排序在前面的一部分元素为真，用于zbtSeek()定位范围的两端 */
+static int zbtScoreLtMin(zbtreeEntry *e, void *range) {
+    return !zslValueGteMin(e->score,range);
+}
+
+static int zbtScoreLteMax(zbtreeEntry *e, void *range) {
+    return zslValueLteMax(e->score,range);
+}
+
+static int zbtLexLtMin(zbtreeEntry *e, void *range) {
+    return !zslLexValueGteMin(e->ele,range);
+}
+
+static int zbtLexLteMax(zbtreeEntry *e, void *range) {
+    return zslLexValueLteMax(e->ele,range);
+}
+
+/* 定位到第一个在范围内的元素，没有元素在范围内时返回0 */
+int zbtFirstInRange(zbtree *zbt, zrangespec *range, zbtreePos *pos) {
+    zbtSeek(zbt,zbtScoreLtMin,range,pos);
+    return pos->leaf != NULL && zslValueLteMax(zbtPosEntry(pos)->score,range);
+}
+
+/* 定位到最后一个在范围内的元素，没有元素在范围内时返回0 */
+int zbtLastInRange(zbtree *zbt, zrangespec *range, zbtreePos *pos) {
+    if (zbtSeek(zbt,zbtScoreLteMax,range,pos) == 0) return 0;
+    if (pos->leaf) zbtPrev(pos);
+    else zbtLast(zbt,pos);
+    return zslValueGteMin(zbtPosEntry(pos)->score,range);
+}
+
+int zbtFirstInLexRange(zbtree *zbt, zlexrangespec *range, zbtreePos *pos) {
+    zbtSeek(zbt,zbtLexLtMin,range,pos);
+    return pos->leaf != NULL && zslLexValueLteMax(zbtPosEntry(pos)->ele,range);
+}
+
+int zbtLastInLexRange(zbtree *zbt, zlexrangespec *range, zbtreePos *pos) {
+    if (zbtSeek(zbt,zbtLexLteMax,range,pos) == 0) return 0;
+    if (pos->leaf) zbtPrev(pos);
+    else zbtLast(zbt,pos);
+    return zslLexValueGteMin(zbtPosEntry(pos)->ele,range);
+}
+
+/* 返回在范围内的元素的个数，只需要两次查找而不需要遍历 */
+static unsigned long zbtCountInRange(zbtree *zbt, zrangespec *range) {
+    zbtreePos pos;
+    unsigned long start = zbtSeek(zbt,zbtScoreLtMin,range,&pos);
+    unsigned long end = zbtSeek(zbt,zbtScoreLteMax,range,&pos);
+    return end > start ? end-start : 0;
+}
+
+static unsigned long zbtCountInLexRange(zbtree *zbt, zlexrangespec *range) {
+    zbtreePos pos;
+    unsigned long start = zbtSeek(zbt,zbtLexLtMin,range,&pos);
+    unsigned long end = zbtSeek(zbt,zbtLexLteMax,range,&pos);
+    return end > start ? end-start : 0;
+}
+
+/* 删除分值在范围内的元素，同时从字典中删除，返回删除的个数 */
+static unsigned long zbtDeleteRangeByScore(zbtree *zbt, zrangespec *range, dict *dict) {
+    zbtreePos pos;
+    unsigned long start = zbtSeek(zbt,zbtScoreLtMin,range,&pos);
+    unsigned long end = zbtSeek(zbt,zbtScoreLteMax,range,&pos);
+    if (end <= start) return 0;
+    return zbtDeleteRangeByRank(zbt,start+1,end,dict);
+}
+
+static unsigned long zbtDeleteRangeByLex(zbtree *zbt, zlexrangespec *range, dict *dict) {
+    zbtreePos pos;
+    unsigned long start = zbtSeek(zbt,zbtLexLtMin,range,&pos);
+    unsigned long end = zbtSeek(zbt,zbtLexLteMax,range,&pos);
+    if (end <= start) return 0;
+    return zbtDeleteRangeByRank(zbt,start+1,end,dict);
+}
+
+/*-----------------------------------------------------------------------------
+ * Listpack-backed sorted set API
  *----------------------------------------------------------------------------*/
 
 double zzlGetScore(unsigned char *sptr) {
@@ -728,7 +807,7 @@ double zzlGetScore(unsigned char *sptr) {
     double score;
 
     serverAssert(sptr != NULL);
-    serverAssert(ziplistGet(sptr,&vstr,&vlen,&vlong));
+    vstr = lpGetValue(sptr,&vlen,&vlong);
 
     if (vstr) {
         memcpy(buf,vstr,vlen);
@@ -741,14 +820,14 @@ double zzlGetScore(unsigned char *sptr) {
     return score;
 }
 
-/* Return a ziplist element as an SDS string. */
-sds ziplistGetObject(unsigned char *sptr) {
+/* Return a listpack element as an SDS string. */
+sds lpGetObject(unsigned char *sptr) {
     unsigned char *vstr;
     unsigned int vlen;
     long long vlong;
 
     serverAssert(sptr != NULL);
-    serverAssert(ziplistGet(sptr,&vstr,&vlen,&vlong));
+    vstr = lpGetValue(sptr,&vlen,&vlong);
 
     if (vstr) {
         return sdsnewlen((char*)vstr,vlen);
@@ -765,7 +844,7 @@ int zzlCompareElements(unsigned char *eptr, unsigned char *cstr, unsigned int cl
     unsigned char vbuf[32];
     int minlen, cmp;
 
-    serverAssert(ziplistGet(eptr,&vstr,&vlen,&vlong));
+    vstr = lpGetValue(eptr,&vlen,&vlong);
     if (vstr == NULL) {
         /* Store string representation of long long in buf. */
         vlen = ll2string((char*)vbuf,sizeof(vbuf),vlong);
@@ -779,7 +858,7 @@ int zzlCompareElements(unsigned char *eptr, unsigned char *cstr, unsigned int cl
 }
 
 unsigned int zzlLength(unsigned char *zl) {
-    return ziplistLen(zl)/2;
+    return lpLength(zl)/2;
 }
 
 /* Move to next entry based on the values in eptr and sptr. Both are set to
@@ -788,9 +867,9 @@ void zzlNext(unsigned char *zl, unsigned char **eptr, unsigned char **sptr) {
     unsigned char *_eptr, *_sptr;
     serverAssert(*eptr != NULL && *sptr != NULL);
 
-    _eptr = ziplistNext(zl,*sptr);
+    _eptr = lpNext(zl,*sptr);
     if (_eptr != NULL) {
-        _sptr = ziplistNext(zl,_eptr);
+        _sptr = lpNext(zl,_eptr);
         serverAssert(_sptr != NULL);
     } else {
         /* No next entry. */
@@ -807,9 +886,9 @@ void zzlPrev(unsigned char *zl, unsigned char **eptr, unsigned char **sptr) {
     unsigned char *_eptr, *_sptr;
     serverAssert(*eptr != NULL && *sptr != NULL);
 
-    _sptr = ziplistPrev(zl,*eptr);
+    _sptr = lpPrev(zl,*eptr);
     if (_sptr != NULL) {
-        _eptr = ziplistPrev(zl,_sptr);
+        _eptr = lpPrev(zl,_sptr);
         serverAssert(_eptr != NULL);
     } else {
         /* No previous entry. */
@@ -831,13 +910,13 @@ int zzlIsInRange(unsigned char *zl, zrangespec *range) {
             (range->min == range->max && (range->minex || range->maxex)))
         return 0;
 
-    p = ziplistIndex(zl,-1); /* Last score. */
+    p = lpSeek(zl,-1); /* Last score. */
     if (p == NULL) return 0; /* Empty sorted set */
     score = zzlGetScore(p);
     if (!zslValueGteMin(score,range))
         return 0;
 
-    p = ziplistIndex(zl,1); /* First score. */
+    p = lpSeek(zl,1); /* First score. */
     serverAssert(p != NULL);
     score = zzlGetScore(p);
     if (!zslValueLteMax(score,range))
@@ -849,14 +928,14 @@ int zzlIsInRange(unsigned char *zl, zrangespec *range) {
 /* Find pointer to the first element contained in the specified range.
  * Returns NULL when no element is contained in the range. */
 unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    unsigned char *eptr = lpSeek(zl,0), *sptr;
     double score;
 
     /* If everything is out of range, return early. */
     if (!zzlIsInRange(zl,range)) return NULL;
 
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         serverAssert(sptr != NULL);
 
         score = zzlGetScore(sptr);
@@ -868,7 +947,7 @@ unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range) {
         }
 
         /* Move to next element. */
-        eptr = ziplistNext(zl,sptr);
+        eptr = lpNext(zl,sptr);
     }
 
     return NULL;
@@ -877,14 +956,14 @@ unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range) {
 /* Find pointer to the last element contained in the specified range.
  * Returns NULL when no element is contained in the range. */
 unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,-2), *sptr;
+    unsigned char *eptr = lpSeek(zl,-2), *sptr;
     double score;
 
     /* If everything is out of range, return early. */
     if (!zzlIsInRange(zl,range)) return NULL;
 
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         serverAssert(sptr != NULL);
 
         score = zzlGetScore(sptr);
@@ -897,9 +976,9 @@ unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range) {
 
         /* Move to previous element by moving to the score of previous element.
          * When this returns NULL, we know there also is no element. */
-        sptr = ziplistPrev(zl,eptr);
+        sptr = lpPrev(zl,eptr);
         if (sptr != NULL)
-            serverAssert((eptr = ziplistPrev(zl,sptr)) != NULL);
+            serverAssert((eptr = lpPrev(zl,sptr)) != NULL);
         else
             eptr = NULL;
     }
@@ -908,14 +987,14 @@ unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range) {
 }
 
 int zzlLexValueGteMin(unsigned char *p, zlexrangespec *spec) {
-    sds value = ziplistGetObject(p);
+    sds value = lpGetObject(p);
     int res = zslLexValueGteMin(value,spec);
     sdsfree(value);
     return res;
 }
 
 int zzlLexValueLteMax(unsigned char *p, zlexrangespec *spec) {
-    sds value = ziplistGetObject(p);
+    sds value = lpGetObject(p);
     int res = zslLexValueLteMax(value,spec);
     sdsfree(value);
     return res;
@@ -931,12 +1010,12 @@ int zzlIsInLexRange(unsigned char *zl, zlexrangespec *range) {
     if (cmp > 0 || (cmp == 0 && (range->minex || range->maxex)))
         return 0;
 
-    p = ziplistIndex(zl,-2); /* Last element. */
+    p = lpSeek(zl,-2); /* Last element. */
     if (p == NULL) return 0;
     if (!zzlLexValueGteMin(p,range))
         return 0;
 
-    p = ziplistIndex(zl,0); /* First element. */
+    p = lpSeek(zl,0); /* First element. */
     serverAssert(p != NULL);
     if (!zzlLexValueLteMax(p,range))
         return 0;
@@ -947,7 +1026,7 @@ int zzlIsInLexRange(unsigned char *zl, zlexrangespec *range) {
 /* Find pointer to the first element contained in the specified lex range.
  * Returns NULL when no element is contained in the range. */
 unsigned char *zzlFirstInLexRange(unsigned char *zl, zlexrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    unsigned char *eptr = lpSeek(zl,0), *sptr;
 
     /* If everything is out of range, return early. */
     if (!zzlIsInLexRange(zl,range)) return NULL;
@@ -961,9 +1040,9 @@ unsigned char *zzlFirstInLexRange(unsigned char *zl, zlexrangespec *range) {
         }
 
         /* Move to next element. */
-        sptr = ziplistNext(zl,eptr); /* This element score. Skip it. */
+        sptr = lpNext(zl,eptr); /* This element score. Skip it. */
         serverAssert(sptr != NULL);
-        eptr = ziplistNext(zl,sptr); /* Next element. */
+        eptr = lpNext(zl,sptr); /* Next element. */
     }
 
     return NULL;
@@ -972,7 +1051,7 @@ unsigned char *zzlFirstInLexRange(unsigned char *zl, zlexrangespec *range) {
 /* Find pointer to the last element contained in the specified lex range.
  * Returns NULL when no element is contained in the range. */
 unsigned char *zzlLastInLexRange(unsigned char *zl, zlexrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,-2), *sptr;
+    unsigned char *eptr = lpSeek(zl,-2), *sptr;
 
     /* If everything is out of range, return early. */
     if (!zzlIsInLexRange(zl,range)) return NULL;
@@ -987,9 +1066,9 @@ unsigned char *zzlLastInLexRange(unsigned char *zl, zlexrangespec *range) {
 
         /* Move to previous element by moving to the score of previous element.
          * When this returns NULL, we know there also is no element. */
-        sptr = ziplistPrev(zl,eptr);
+        sptr = lpPrev(zl,eptr);
         if (sptr != NULL)
-            serverAssert((eptr = ziplistPrev(zl,sptr)) != NULL);
+            serverAssert((eptr = lpPrev(zl,sptr)) != NULL);
         else
             eptr = NULL;
     }
@@ -998,32 +1077,32 @@ unsigned char *zzlLastInLexRange(unsigned char *zl, zlexrangespec *range) {
 }
 
 unsigned char *zzlFind(unsigned char *zl, sds ele, double *score) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    unsigned char *eptr = lpSeek(zl,0), *sptr;
 
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         serverAssert(sptr != NULL);
 
-        if (ziplistCompare(eptr,(unsigned char*)ele,sdslen(ele))) {
+        if (lpCompare(eptr,(unsigned char*)ele,sdslen(ele))) {
             /* Matching element, pull out score. */
             if (score != NULL) *score = zzlGetScore(sptr);
             return eptr;
         }
 
         /* Move to next element. */
-        eptr = ziplistNext(zl,sptr);
+        eptr = lpNext(zl,sptr);
     }
     return NULL;
 }
 
-/* Delete (element,score) pair from ziplist. Use local copy of eptr because we
- * don't want to modify the one given as argument. */
+/* Delete (element,score) pair from listpack. Deleting by pointer avoids
+ * walking the listpack from the head to find the index of eptr: after the
+ * first lpDelete() 'p' points to the score. */
 unsigned char *zzlDelete(unsigned char *zl, unsigned char *eptr) {
     unsigned char *p = eptr;
 
-    /* TODO: add function to ziplist API to delete N elements from offset. */
-    zl = ziplistDelete(zl,&p);
-    zl = ziplistDelete(zl,&p);
+    zl = lpDelete(zl,p,&p);
+    zl = lpDelete(zl,p,&p);
     return zl;
 }
 
@@ -1035,29 +1114,29 @@ unsigned char *zzlInsertAt(unsigned char *zl, unsigned char *eptr, sds ele, doub
 
     scorelen = d2string(scorebuf,sizeof(scorebuf),score);
     if (eptr == NULL) {
-        zl = ziplistPush(zl,(unsigned char*)ele,sdslen(ele),ZIPLIST_TAIL);
-        zl = ziplistPush(zl,(unsigned char*)scorebuf,scorelen,ZIPLIST_TAIL);
+        zl = lpAppend(zl,(unsigned char*)ele,sdslen(ele));
+        zl = lpAppend(zl,(unsigned char*)scorebuf,scorelen);
     } else {
         /* Keep offset relative to zl, as it might be re-allocated. */
         offset = eptr-zl;
-        zl = ziplistInsert(zl,eptr,(unsigned char*)ele,sdslen(ele));
+        zl = lpInsert(zl,(unsigned char*)ele,sdslen(ele),eptr,LP_BEFORE,NULL);
         eptr = zl+offset;
 
         /* Insert score after the element. */
-        serverAssert((sptr = ziplistNext(zl,eptr)) != NULL);
-        zl = ziplistInsert(zl,sptr,(unsigned char*)scorebuf,scorelen);
+        serverAssert((sptr = lpNext(zl,eptr)) != NULL);
+        zl = lpInsert(zl,(unsigned char*)scorebuf,scorelen,sptr,LP_BEFORE,NULL);
     }
     return zl;
 }
 
-/* Insert (element,score) pair in ziplist. This function assumes the element is
+/* Insert (element,score) pair in listpack. This function assumes the element is
  * not yet present in the list. */
 unsigned char *zzlInsert(unsigned char *zl, sds ele, double score) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    unsigned char *eptr = lpSeek(zl,0), *sptr;
     double s;
 
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         serverAssert(sptr != NULL);
         s = zzlGetScore(sptr);
 
@@ -1076,7 +1155,7 @@ unsigned char *zzlInsert(unsigned char *zl, sds ele, double score) {
         }
 
         /* Move to next element. */
-        eptr = ziplistNext(zl,sptr);
+        eptr = lpNext(zl,sptr);
     }
 
     /* Push on tail of list when it was not yet inserted. */
@@ -1095,14 +1174,13 @@ unsigned char *zzlDeleteRangeByScore(unsigned char *zl, zrangespec *range, unsig
     eptr = zzlFirstInRange(zl,range);
     if (eptr == NULL) return zl;
 
-    /* When the tail of the ziplist is deleted, eptr will point to the sentinel
-     * byte and ziplistNext will return NULL. */
-    while ((sptr = ziplistNext(zl,eptr)) != NULL) {
+    /* When the tail of the listpack is deleted, eptr will be NULL. */
+    while (eptr && (sptr = lpNext(zl,eptr)) != NULL) {
         score = zzlGetScore(sptr);
         if (zslValueLteMax(score,range)) {
             /* Delete both the element and the score. */
-            zl = ziplistDelete(zl,&eptr);
-            zl = ziplistDelete(zl,&eptr);
+            zl = lpDelete(zl,eptr,&eptr);
+            zl = lpDelete(zl,eptr,&eptr);
             num++;
         } else {
             /* No longer in range. */
@@ -1123,13 +1201,12 @@ unsigned char *zzlDeleteRangeByLex(unsigned char *zl, zlexrangespec *range, unsi
     eptr = zzlFirstInLexRange(zl,range);
     if (eptr == NULL) return zl;
 
-    /* When the tail of the ziplist is deleted, eptr will point to the sentinel
-     * byte and ziplistNext will return NULL. */
-    while ((sptr = ziplistNext(zl,eptr)) != NULL) {
+    /* When the tail of the listpack is deleted, eptr will be NULL. */
+    while (eptr && (sptr = lpNext(zl,eptr)) != NULL) {
         if (zzlLexValueLteMax(eptr,range)) {
             /* Delete both the element and the score. */
-            zl = ziplistDelete(zl,&eptr);
-            zl = ziplistDelete(zl,&eptr);
+            zl = lpDelete(zl,eptr,&eptr);
+            zl = lpDelete(zl,eptr,&eptr);
             num++;
         } else {
             /* No longer in range. */
@@ -1146,7 +1223,7 @@ unsigned char *zzlDeleteRangeByLex(unsigned char *zl, zlexrangespec *range, unsi
 unsigned char *zzlDeleteRangeByRank(unsigned char *zl, unsigned int start, unsigned int end, unsigned long *deleted) {
     unsigned int num = (end-start)+1;
     if (deleted) *deleted = num;
-    zl = ziplistDeleteRange(zl,2*(start-1),2*num);
+    zl = lpDeleteRange(zl,2*(start-1),2*num);
     return zl;
 }
 
@@ -1156,16 +1233,39 @@ unsigned char *zzlDeleteRangeByRank(unsigned char *zl, unsigned int start, unsig
 
 unsigned long zsetLength(const robj *zobj) {
     unsigned long length = 0;
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         length = zzlLength(zobj->ptr);
     } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
         length = ((const zset*)zobj->ptr)->zsl->length;
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        length = ((const zset*)zobj->ptr)->zbt->length;
     } else {
         serverPanic("Unknown sorted set encoding");
     }
     return length;
 }
 
+/* Return the encoding used for sorted sets that are too big for a listpack,
+ * according to the zset-btree-encoding option. */
+int zsetLargeEncoding(void) {
+    return server.zset_btree_encoding ? OBJ_ENCODING_BTREE : OBJ_ENCODING_SKIPLIST;
+}
+
+/* Insert a new element into a sorted set encoded as skiplist or B+tree. The
+ * element must not already exist, and the SDS string 'ele' is referenced by
+ * the sorted set after the call. */
+void zsetInsert(zset *zs, double score, sds ele) {
+    if (zs->zbt) {
+        dictEntry *de = dictAddRaw(zs->dict,ele,NULL);
+        serverAssert(de != NULL);
+        dictSetDoubleVal(de,score);
+        zbtInsert(zs->zbt,score,ele);
+    } else {
+        zskiplistNode *node = zslInsert(zs->zsl,score,ele);
+        serverAssert(dictAdd(zs->dict,ele,&node->score) == DICT_OK);
+    }
+}
+
 void zsetConvert(robj *zobj, int encoding) {
     zset *zs;
     zskiplistNode *node, *next;
@@ -1173,49 +1273,49 @@ void zsetConvert(robj *zobj, int encoding) {
     double score;
 
     if (zobj->encoding == encoding) return;
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
         unsigned int vlen;
         long long vlong;
 
-        if (encoding != OBJ_ENCODING_SKIPLIST)
+        if (encoding != OBJ_ENCODING_SKIPLIST && encoding != OBJ_ENCODING_BTREE)
             serverPanic("Unknown target encoding");
 
         zs = zmalloc(sizeof(*zs));
         zs->dict = dictCreate(&zsetDictType,NULL);
-        zs->zsl = zslCreate();
+        zs->zsl = (encoding == OBJ_ENCODING_SKIPLIST) ? zslCreate() : NULL;
+        zs->zbt = (encoding == OBJ_ENCODING_BTREE) ? zbtCreate() : NULL;
 
-        eptr = ziplistIndex(zl,0);
+        eptr = lpSeek(zl,0);
         serverAssertWithInfo(NULL,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         serverAssertWithInfo(NULL,zobj,sptr != NULL);
 
         while (eptr != NULL) {
             score = zzlGetScore(sptr);
-            serverAssertWithInfo(NULL,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            vstr = lpGetValue(eptr,&vlen,&vlong);
             if (vstr == NULL)
                 ele = sdsfromlonglong(vlong);
             else
                 ele = sdsnewlen((char*)vstr,vlen);
 
-            node = zslInsert(zs->zsl,score,ele);
-            serverAssert(dictAdd(zs->dict,ele,&node->score) == DICT_OK);
+            zsetInsert(zs,score,ele);
             zzlNext(zl,&eptr,&sptr);
         }
 
         zfree(zobj->ptr);
         zobj->ptr = zs;
-        zobj->encoding = OBJ_ENCODING_SKIPLIST;
+        zobj->encoding = encoding;
     } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
-        unsigned char *zl = ziplistNew();
+        unsigned char *zl = lpNew();
 
-        if (encoding != OBJ_ENCODING_ZIPLIST)
+        if (encoding != OBJ_ENCODING_LISTPACK)
             serverPanic("Unknown target encoding");
 
         /* Approach similar to zslFree(), since we want to free the skiplist at
-         * the same time as creating the ziplist. */
+         * the same time as creating the listpack. */
         zs = zobj->ptr;
         dictRelease(zs->dict);
         node = zs->zsl->header->level[0].forward;
@@ -1231,22 +1331,39 @@ void zsetConvert(robj *zobj, int encoding) {
 
         zfree(zs);
         zobj->ptr = zl;
-        zobj->encoding = OBJ_ENCODING_ZIPLIST;
+        zobj->encoding = OBJ_ENCODING_LISTPACK;
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        unsigned char *zl = lpNew();
+        zbtreePos pos;
+
+        if (encoding != OBJ_ENCODING_LISTPACK)
+            serverPanic("Unknown target encoding");
+
+        zs = zobj->ptr;
+        if (zbtFirst(zs->zbt,&pos)) {
+            do {
+                zbtreeEntry *e = zbtPosEntry(&pos);
+                zl = zzlInsertAt(zl,NULL,e->ele,e->score);
+            } while (zbtNext(&pos));
+        }
+        dictRelease(zs->dict);
+        zbtFree(zs->zbt);
+        zfree(zs);
+        zobj->ptr = zl;
+        zobj->encoding = OBJ_ENCODING_LISTPACK;
     } else {
         serverPanic("Unknown sorted set encoding");
     }
 }
 
-/* Convert the sorted set object into a ziplist if it is not already a ziplist
+/* Convert the sorted set object into a listpack if it is not already a listpack
  * and if the number of elements and the maximum element size is within the
  * expected ranges. */
-void zsetConvertToZiplistIfNeeded(robj *zobj, size_t maxelelen) {
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) return;
-    zset *zset = zobj->ptr;
-
-    if (zset->zsl->length <= server.zset_max_ziplist_entries &&
-        maxelelen <= server.zset_max_ziplist_value)
-            zsetConvert(zobj,OBJ_ENCODING_ZIPLIST);
+void zsetConvertToListpackIfNeeded(robj *zobj, size_t maxelelen) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) return;
+    if (zsetLength(zobj) <= server.zset_max_listpack_entries &&
+        maxelelen <= server.zset_max_listpack_value)
+            zsetConvert(zobj,OBJ_ENCODING_LISTPACK);
 }
 
 /* Return (by reference) the score of the specified member of the sorted set
@@ -1256,13 +1373,14 @@ void zsetConvertToZiplistIfNeeded(robj *zobj, size_t maxelelen) {
 int zsetScore(robj *zobj, sds member, double *score) {
     if (!zobj || !member) return C_ERR;
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         if (zzlFind(zobj->ptr, member, score) == NULL) return C_ERR;
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST ||
+               zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = zobj->ptr;
         dictEntry *de = dictFind(zs->dict, member);
         if (de == NULL) return C_ERR;
-        *score = *(double*)dictGetVal(de);
+        *score = zsetDictGetScore(zs,de);
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -1306,7 +1424,7 @@ int zsetScore(robj *zobj, sds member, double *score) {
  * start.
  *
  * The command as a side effect of adding a new element may convert the sorted
- * set internal encoding from ziplist to hashtable+skiplist.
+ * set internal encoding from listpack to hashtable+skiplist.
  *
  * Memory management of 'ele':
  *
@@ -1327,7 +1445,7 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
     }
 
     /* Update the sorted set according to its encoding. */
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *eptr;
 
         if ((eptr = zzlFind(zobj->ptr,ele,&curscore)) != NULL) {
@@ -1358,9 +1476,9 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
             /* Optimize: check if the element is too large or the list
              * becomes too long *before* executing zzlInsert. */
             zobj->ptr = zzlInsert(zobj->ptr,ele,score);
-            if (zzlLength(zobj->ptr) > server.zset_max_ziplist_entries ||
-                sdslen(ele) > server.zset_max_ziplist_value)
-                zsetConvert(zobj,OBJ_ENCODING_SKIPLIST);
+            if (zzlLength(zobj->ptr) > server.zset_max_listpack_entries ||
+                sdslen(ele) > server.zset_max_listpack_value)
+                zsetConvert(zobj,zsetLargeEncoding());
             if (newscore) *newscore = score;
             *flags |= ZADD_ADDED;
             return 1;
@@ -1368,7 +1486,8 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
             *flags |= ZADD_NOP;
             return 1;
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST ||
+               zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = zobj->ptr;
         zskiplistNode *znode;
         dictEntry *de;
@@ -1380,7 +1499,7 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
                 *flags |= ZADD_NOP;
                 return 1;
             }
-            curscore = *(double*)dictGetVal(de);
+            curscore = zsetDictGetScore(zs,de);
 
             /* Prepare the score for the increment if needed. */
             if (incr) {
@@ -1394,18 +1513,24 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
 
             /* Remove and re-insert when score changes. */
             if (score != curscore) {
-                znode = zslUpdateScore(zs->zsl,curscore,ele,score);
-                /* Note that we did not removed the original element from
-                 * the hash table representing the sorted set, so we just
-                 * update the score. */
-                dictGetVal(de) = &znode->score; /* Update score ptr. */
+                if (zs->zbt) {
+                    /* The B+tree keeps the same SDS string, the score is
+                     * stored directly in the hash table. */
+                    zbtUpdateScore(zs->zbt,curscore,ele,score);
+                    dictSetDoubleVal(de,score);
+                } else {
+                    znode = zslUpdateScore(zs->zsl,curscore,ele,score);
+                    /* Note that we did not removed the original element from
+                     * the hash table representing the sorted set, so we just
+                     * update the score. */
+                    dictGetVal(de) = &znode->score; /* Update score ptr. */
+                }
                 *flags |= ZADD_UPDATED;
             }
             return 1;
         } else if (!xx) {
             ele = sdsdup(ele);
-            znode = zslInsert(zs->zsl,score,ele);
-            serverAssert(dictAdd(zs->dict,ele,&znode->score) == DICT_OK);
+            zsetInsert(zs,score,ele);
             *flags |= ZADD_ADDED;
             if (newscore) *newscore = score;
             return 1;
@@ -1422,14 +1547,15 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
 /* Delete the element 'ele' from the sorted set, returning 1 if the element
  * existed and was deleted, 0 otherwise (the element was not there). */
 int zsetDel(robj *zobj, sds ele) {
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *eptr;
 
         if ((eptr = zzlFind(zobj->ptr,ele,NULL)) != NULL) {
             zobj->ptr = zzlDelete(zobj->ptr,eptr);
             return 1;
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST ||
+               zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = zobj->ptr;
         dictEntry *de;
         double score;
@@ -1437,7 +1563,7 @@ int zsetDel(robj *zobj, sds ele) {
         de = dictUnlink(zs->dict,ele);
         if (de != NULL) {
             /* Get the score in order to delete from the skiplist later. */
-            score = *(double*)dictGetVal(de);
+            score = zsetDictGetScore(zs,de);
 
             /* Delete from the hash table and later from the skiplist.
              * Note that the order is important: deleting from the skiplist
@@ -1446,8 +1572,9 @@ int zsetDel(robj *zobj, sds ele) {
              * we need to delete from the skiplist as the final step. */
             dictFreeUnlinkedEntry(zs->dict,de);
 
-            /* Delete from skiplist. */
-            int retval = zslDelete(zs->zsl,score,ele,NULL);
+            /* Delete from skiplist or B+tree. */
+            int retval = zs->zbt ? zbtDelete(zs->zbt,score,ele,NULL) :
+                                   zslDelete(zs->zsl,score,ele,NULL);
             serverAssert(retval);
 
             if (htNeedsResize(zs->dict)) dictResize(zs->dict);
@@ -1476,18 +1603,18 @@ long zsetRank(robj *zobj, sds ele, int reverse) {
 
     llen = zsetLength(zobj);
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
 
-        eptr = ziplistIndex(zl,0);
+        eptr = lpSeek(zl,0);
         serverAssert(eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         serverAssert(sptr != NULL);
 
         rank = 1;
         while(eptr != NULL) {
-            if (ziplistCompare(eptr,(unsigned char*)ele,sdslen(ele)))
+            if (lpCompare(eptr,(unsigned char*)ele,sdslen(ele)))
                 break;
             rank++;
             zzlNext(zl,&eptr,&sptr);
@@ -1501,16 +1628,17 @@ long zsetRank(robj *zobj, sds ele, int reverse) {
         } else {
             return -1;
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST ||
+               zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = zobj->ptr;
-        zskiplist *zsl = zs->zsl;
         dictEntry *de;
         double score;
 
         de = dictFind(zs->dict,ele);
         if (de != NULL) {
-            score = *(double*)dictGetVal(de);
-            rank = zslGetRank(zsl,score,ele);
+            score = zsetDictGetScore(zs,de);
+            rank = zs->zbt ? zbtGetRank(zs->zbt,score,ele) :
+                             zslGetRank(zs->zsl,score,ele);
             /* Existing elements always have a rank. */
             serverAssert(rank != 0);
             if (reverse)
@@ -1600,12 +1728,12 @@ void zaddGenericCommand(client *c, int flags) {
     zobj = lookupKeyWrite(c->db,key);
     if (zobj == NULL) {
         if (xx) goto reply_to_client; /* No key + XX option: nothing to do. */
-        if (server.zset_max_ziplist_entries == 0 ||
-            server.zset_max_ziplist_value < sdslen(c->argv[scoreidx+1]->ptr))
+        if (server.zset_max_listpack_entries == 0 ||
+            server.zset_max_listpack_value < sdslen(c->argv[scoreidx+1]->ptr))
         {
             zobj = createZsetObject();
         } else {
-            zobj = createZsetZiplistObject();
+            zobj = createZsetListpackObject();
         }
         dbAdd(c->db,key,zobj);
     } else {
@@ -1738,7 +1866,7 @@ void zremrangeGenericCommand(client *c, int rangetype) {
     }
 
     /* Step 3: Perform the range deletion operation. */
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         switch(rangetype) {
         case ZRANGE_RANK:
             zobj->ptr = zzlDeleteRangeByRank(zobj->ptr,start+1,end+1,&deleted);
@@ -1772,6 +1900,24 @@ void zremrangeGenericCommand(client *c, int rangetype) {
             dbDelete(c->db,key);
             keyremoved = 1;
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        switch(rangetype) {
+        case ZRANGE_RANK:
+            deleted = zbtDeleteRangeByRank(zs->zbt,start+1,end+1,zs->dict);
+            break;
+        case ZRANGE_SCORE:
+            deleted = zbtDeleteRangeByScore(zs->zbt,&range,zs->dict);
+            break;
+        case ZRANGE_LEX:
+            deleted = zbtDeleteRangeByLex(zs->zbt,&lexrange,zs->dict);
+            break;
+        }
+        if (htNeedsResize(zs->dict)) dictResize(zs->dict);
+        if (dictSize(zs->dict) == 0) {
+            dbDelete(c->db,key);
+            keyremoved = 1;
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -1816,6 +1962,11 @@ typedef struct {
                 intset *is;
                 int ii;
             } is;
+            struct {
+                unsigned char *lp;
+                unsigned char *p;
+            } lp;
+            roaringIterator rb;
             struct {
                 dict *dict;
                 dictIterator *di;
@@ -1833,6 +1984,7 @@ typedef struct {
                 zset *zs;
                 zskiplistNode *node;
             } sl;
+            zbtreePos bt;
         } zset;
     } iter;
 } zsetopsrc;
@@ -1871,6 +2023,11 @@ void zuiInitIterator(zsetopsrc *op) {
         if (op->encoding == OBJ_ENCODING_INTSET) {
             it->is.is = op->subject->ptr;
             it->is.ii = 0;
+        } else if (op->encoding == OBJ_ENCODING_LISTPACK) {
+            it->lp.lp = op->subject->ptr;
+            it->lp.p = lpFirst(it->lp.lp);
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            roaringInitIterator(op->subject->ptr,&it->rb);
         } else if (op->encoding == OBJ_ENCODING_HT) {
             it->ht.dict = op->subject->ptr;
             it->ht.di = dictGetIterator(op->subject->ptr);
@@ -1880,16 +2037,19 @@ void zuiInitIterator(zsetopsrc *op) {
         }
     } else if (op->type == OBJ_ZSET) {
         iterzset *it = &op->iter.zset;
-        if (op->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (op->encoding == OBJ_ENCODING_LISTPACK) {
             it->zl.zl = op->subject->ptr;
-            it->zl.eptr = ziplistIndex(it->zl.zl,0);
+            it->zl.eptr = lpSeek(it->zl.zl,0);
             if (it->zl.eptr != NULL) {
-                it->zl.sptr = ziplistNext(it->zl.zl,it->zl.eptr);
+                it->zl.sptr = lpNext(it->zl.zl,it->zl.eptr);
                 serverAssert(it->zl.sptr != NULL);
             }
         } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
             it->sl.zs = op->subject->ptr;
             it->sl.node = it->sl.zs->zsl->header->level[0].forward;
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
+            zset *zs = op->subject->ptr;
+            zbtFirst(zs->zbt,&it->bt);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -1906,6 +2066,10 @@ void zuiClearIterator(zsetopsrc *op) {
         iterset *it = &op->iter.set;
         if (op->encoding == OBJ_ENCODING_INTSET) {
             UNUSED(it); /* skip */
+        } else if (op->encoding == OBJ_ENCODING_LISTPACK) {
+            UNUSED(it); /* skip */
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            UNUSED(it); /* skip */
         } else if (op->encoding == OBJ_ENCODING_HT) {
             dictReleaseIterator(it->ht.di);
         } else {
@@ -1913,10 +2077,12 @@ void zuiClearIterator(zsetopsrc *op) {
         }
     } else if (op->type == OBJ_ZSET) {
         iterzset *it = &op->iter.zset;
-        if (op->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (op->encoding == OBJ_ENCODING_LISTPACK) {
             UNUSED(it); /* skip */
         } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
             UNUSED(it); /* skip */
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
+            UNUSED(it); /* skip */
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -1932,6 +2098,10 @@ unsigned long zuiLength(zsetopsrc *op) {
     if (op->type == OBJ_SET) {
         if (op->encoding == OBJ_ENCODING_INTSET) {
             return intsetLen(op->subject->ptr);
+        } else if (op->encoding == OBJ_ENCODING_LISTPACK) {
+            return lpLength(op->subject->ptr);
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            return roaringCardinality(op->subject->ptr);
         } else if (op->encoding == OBJ_ENCODING_HT) {
             dict *ht = op->subject->ptr;
             return dictSize(ht);
@@ -1939,11 +2109,14 @@ unsigned long zuiLength(zsetopsrc *op) {
             serverPanic("Unknown set encoding");
         }
     } else if (op->type == OBJ_ZSET) {
-        if (op->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (op->encoding == OBJ_ENCODING_LISTPACK) {
             return zzlLength(op->subject->ptr);
         } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
             zset *zs = op->subject->ptr;
             return zs->zsl->length;
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
+            zset *zs = op->subject->ptr;
+            return zs->zbt->length;
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -1976,6 +2149,21 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
 
             /* Move to next element. */
             it->is.ii++;
+        } else if (op->encoding == OBJ_ENCODING_LISTPACK) {
+            if (it->lp.p == NULL)
+                return 0;
+            val->estr = lpGetValue(it->lp.p,&val->elen,&val->ell);
+            val->score = 1.0;
+
+            /* Move to next element. */
+            it->lp.p = lpNext(it->lp.lp,it->lp.p);
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            int64_t ell;
+
+            if (!roaringNext(&it->rb,&ell))
+                return 0;
+            val->ell = ell;
+            val->score = 1.0;
         } else if (op->encoding == OBJ_ENCODING_HT) {
             if (it->ht.de == NULL)
                 return 0;
@@ -1989,11 +2177,11 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
         }
     } else if (op->type == OBJ_ZSET) {
         iterzset *it = &op->iter.zset;
-        if (op->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (op->encoding == OBJ_ENCODING_LISTPACK) {
             /* No need to check both, but better be explicit. */
             if (it->zl.eptr == NULL || it->zl.sptr == NULL)
                 return 0;
-            serverAssert(ziplistGet(it->zl.eptr,&val->estr,&val->elen,&val->ell));
+            val->estr = lpGetValue(it->zl.eptr,&val->elen,&val->ell);
             val->score = zzlGetScore(it->zl.sptr);
 
             /* Move to next element. */
@@ -2006,6 +2194,14 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
 
             /* Move to next element. */
             it->sl.node = it->sl.node->level[0].forward;
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
+            if (it->bt.leaf == NULL)
+                return 0;
+            val->ele = zbtPosEntry(&it->bt)->ele;
+            val->score = zbtPosEntry(&it->bt)->score;
+
+            /* Move to next element. */
+            zbtNext(&it->bt);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -2092,6 +2288,24 @@ int zuiFind(zsetopsrc *op, zsetopval *val, double *score) {
             } else {
                 return 0;
             }
+        } else if (op->encoding == OBJ_ENCODING_LISTPACK) {
+            unsigned char *lp = op->subject->ptr;
+            zuiBufferFromValue(val);
+            if (lpFind(lp,lpFirst(lp),val->estr,val->elen,0) != NULL) {
+                *score = 1.0;
+                return 1;
+            } else {
+                return 0;
+            }
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            if (zuiLongLongFromValue(val) &&
+                roaringContains(op->subject->ptr,val->ell))
+            {
+                *score = 1.0;
+                return 1;
+            } else {
+                return 0;
+            }
         } else if (op->encoding == OBJ_ENCODING_HT) {
             dict *ht = op->subject->ptr;
             zuiSdsFromValue(val);
@@ -2107,18 +2321,19 @@ int zuiFind(zsetopsrc *op, zsetopval *val, double *score) {
     } else if (op->type == OBJ_ZSET) {
         zuiSdsFromValue(val);
 
-        if (op->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (op->encoding == OBJ_ENCODING_LISTPACK) {
             if (zzlFind(op->subject->ptr,val->ele,score) != NULL) {
                 /* Score is already set by zzlFind. */
                 return 1;
             } else {
                 return 0;
             }
-        } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
+        } else if (op->encoding == OBJ_ENCODING_SKIPLIST ||
+                   op->encoding == OBJ_ENCODING_BTREE) {
             zset *zs = op->subject->ptr;
             dictEntry *de;
             if ((de = dictFind(zs->dict,val->ele)) != NULL) {
-                *score = *(double*)dictGetVal(de);
+                *score = zsetDictGetScore(zs,de);
                 return 1;
             } else {
                 return 0;
@@ -2173,7 +2388,188 @@ dictType setAccumulatorDictType = {
     NULL                       /* val destructor */
 };
 
-void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
+/* Check if all the inputs of a ZUNION are small: sorted sets encoded as
+ * listpacks, or sets encoded as intsets / listpacks. */
+static int zuiAllSmall(zsetopsrc *src, long setnum) {
+    for (long i = 0; i < setnum; i++) {
+        if (src[i].subject == NULL) continue;
+        if (src[i].type == OBJ_ZSET &&
+            src[i].encoding == OBJ_ENCODING_LISTPACK) continue;
+        if (src[i].type == OBJ_SET &&
+            (src[i].encoding == OBJ_ENCODING_INTSET ||
+             src[i].encoding == OBJ_ENCODING_LISTPACK)) continue;
+        return 0;
+    }
+    return 1;
+}
+
+/* An element of a small ZUNION. The element points inside the listpack of
+ * its input, or it is an integer: listpacks always store the strings that
+ * are valid integers as integers, so the two forms never represent the same
+ * element. 'src' is the index of the input, so that scores are aggregated in
+ * the same order of the dict based path, and 'ele' is only created for the
+ * elements of the result. */
+typedef struct {
+    unsigned char *estr;
+    unsigned int elen;
+    long long ell;
+    double score;
+    long src;
+    sds ele;
+} zsetopentry;
+
+static int zsetopEntryCompareEle(const zsetopentry *ea, const zsetopentry *eb) {
+    if (ea->estr == NULL || eb->estr == NULL) {
+        if (ea->estr != NULL) return 1;
+        if (eb->estr != NULL) return -1;
+        return (ea->ell > eb->ell) - (ea->ell < eb->ell);
+    } else {
+        unsigned int minlen = ea->elen < eb->elen ? ea->elen : eb->elen;
+        int cmp = memcmp(ea->estr,eb->estr,minlen);
+
+        if (cmp != 0) return cmp;
+        return (ea->elen > eb->elen) - (ea->elen < eb->elen);
+    }
+}
+
+static int zsetopEntryCompareByEle(const void *a, const void *b) {
+    const zsetopentry *ea = a, *eb = b;
+    int cmp = zsetopEntryCompareEle(ea,eb);
+
+    if (cmp != 0) return cmp;
+    return (ea->src > eb->src) - (ea->src < eb->src);
+}
+
+static int zsetopEntryCompareByScore(const void *a, const void *b) {
+    const zsetopentry *ea = a, *eb = b;
+
+    if (ea->score != eb->score) return ea->score < eb->score ? -1 : 1;
+    return sdscmp(ea->ele,eb->ele);
+}
+
+/* ZUNION of small inputs. Instead of accumulating the elements in a dict,
+ * which costs a lookup and an insertion for every element, all the elements
+ * are collected in an array and sorted, so that the copies of the same
+ * element are adjacent and can be aggregated. Returns the elements of the
+ * result sorted by score, setting their number in '*len', or NULL if the
+ * result is empty. */
+static zsetopentry *zunionSmallInputs(zsetopsrc *src, long setnum,
+                                      int aggregate, unsigned long *len,
+                                      size_t *maxelelen)
+{
+    zsetopval zval;
+    zsetopentry *entries;
+    unsigned long total = 0, count = 0, j;
+    long i;
+
+    *len = 0;
+    for (i = 0; i < setnum; i++) total += zuiLength(&src[i]);
+    if (total == 0) return NULL;
+    entries = zmalloc(sizeof(zsetopentry)*total);
+
+    memset(&zval, 0, sizeof(zval));
+    for (i = 0; i < setnum; i++) {
+        if (zuiLength(&src[i]) == 0) continue;
+
+        zuiInitIterator(&src[i]);
+        while (zuiNext(&src[i],&zval)) {
+            double score = src[i].weight * zval.score;
+            if (isnan(score)) score = 0;
+            entries[count].estr = zval.estr;
+            entries[count].elen = zval.elen;
+            entries[count].ell = zval.ell;
+            entries[count].score = score;
+            entries[count].src = i;
+            count++;
+        }
+        zuiClearIterator(&src[i]);
+    }
+
+    /* Aggregate the copies of every element into the first one. */
+    qsort(entries,count,sizeof(zsetopentry),zsetopEntryCompareByEle);
+    total = 0;
+    for (j = 0; j < count; j++) {
+        if (total && zsetopEntryCompareEle(&entries[total-1],&entries[j]) == 0) {
+            zunionInterAggregate(&entries[total-1].score,entries[j].score,
+                                 aggregate);
+        } else {
+            entries[total++] = entries[j];
+        }
+    }
+    for (j = 0; j < total; j++) {
+        zsetopentry *e = &entries[j];
+        e->ele = e->estr ? sdsnewlen((char*)e->estr,e->elen) :
+                           sdsfromlonglong(e->ell);
+        if (sdslen(e->ele) > *maxelelen) *maxelelen = sdslen(e->ele);
+    }
+
+    qsort(entries,total,sizeof(zsetopentry),zsetopEntryCompareByScore);
+    *len = total;
+    return entries;
+}
+
+/* Move the elements returned by zunionSmallInputs() into the empty sorted
+ * set 'dstobj', directly as a listpack when the result is small enough, and
+ * free the array. */
+static void zsetopEntriesToZset(zsetopentry *entries, unsigned long len,
+                                robj *dstobj, size_t maxelelen)
+{
+    unsigned long j;
+
+    if (len <= server.zset_max_listpack_entries &&
+        maxelelen <= server.zset_max_listpack_value)
+    {
+        unsigned char *zl;
+
+        zsetConvert(dstobj,OBJ_ENCODING_LISTPACK);
+        zl = dstobj->ptr;
+        for (j = 0; j < len; j++) {
+            zl = zzlInsertAt(zl,NULL,entries[j].ele,entries[j].score);
+            sdsfree(entries[j].ele);
+        }
+        dstobj->ptr = zl;
+    } else {
+        zset *dstzset = dstobj->ptr;
+
+        dictExpand(dstzset->dict,len);
+        for (j = 0; j < len; j++)
+            zsetInsert(dstzset,entries[j].score,entries[j].ele);
+    }
+    zfree(entries);
+}
+
+/* Reply with the elements returned by zunionSmallInputs() having a rank
+ * between 'start' and 'end' (inclusive, 'end' may be -1 for the last one). */
+static void zsetopEntriesReply(client *c, zsetopentry *entries,
+                               unsigned long len, long start, long end,
+                               int withscores)
+{
+    long rangelen = 0, j;
+
+    if (end < 0 || (unsigned long)end >= len) end = (long)len-1;
+    if (start <= end) rangelen = end-start+1;
+
+    if (withscores && c->resp == 2)
+        addReplyArrayLen(c, rangelen*2);
+    else
+        addReplyArrayLen(c, rangelen);
+    for (j = start; j < start+rangelen; j++) {
+        if (withscores && c->resp > 2) addReplyArrayLen(c,2);
+        addReplyBulkCBuffer(c,entries[j].ele,sdslen(entries[j].ele));
+        if (withscores) addReplyDouble(c,entries[j].score);
+    }
+}
+
+static void zsetopEntriesFree(zsetopentry *entries, unsigned long len) {
+    for (unsigned long j = 0; j < len; j++) sdsfree(entries[j].ele);
+    zfree(entries);
+}
+
+/* Implements ZUNION, ZINTER, ZDIFF and the STORE variants. 'numkeysIndex'
+ * is the index of the numkeys argument, the input keys follow it. When
+ * 'dstkey' is NULL the result is not stored, but returned to the client,
+ * optionally with the scores and limited with LIMIT offset count. */
+void zunionInterDiffGenericCommand(client *c, robj *dstkey, int numkeysIndex, int op) {
     int i, j;
     long setnum;
     int aggregate = REDIS_AGGR_SUM;
@@ -2183,29 +2579,34 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
     size_t maxelelen = 0;
     robj *dstobj;
     zset *dstzset;
-    zskiplistNode *znode;
     int touched = 0;
+    int withscores = 0;
+    long offset = 0, limit = -1;
+    zsetopentry *small = NULL;
+    unsigned long smalllen = 0;
 
     /* expect setnum input keys to be given */
-    if ((getLongFromObjectOrReply(c, c->argv[2], &setnum, NULL) != C_OK))
+    if ((getLongFromObjectOrReply(c, c->argv[numkeysIndex], &setnum, NULL) != C_OK))
         return;
 
     if (setnum < 1) {
-        addReplyError(c,
-            "at least 1 input key is needed for ZUNIONSTORE/ZINTERSTORE");
+        addReplyErrorFormat(c,
+            "at least 1 input key is needed for %s", c->cmd->name);
         return;
     }
 
     /* test if the expected number of keys would overflow */
-    if (setnum > c->argc-3) {
+    if (setnum > (c->argc-(numkeysIndex+1))) {
         addReply(c,shared.syntaxerr);
         return;
     }
 
     /* read keys to be used for input */
     src = zcalloc(sizeof(zsetopsrc) * setnum);
-    for (i = 0, j = 3; i < setnum; i++, j++) {
-        robj *obj = lookupKeyWrite(c->db,c->argv[j]);
+    for (i = 0, j = numkeysIndex+1; i < setnum; i++, j++) {
+        robj *obj = dstkey ?
+            lookupKeyWrite(c->db,c->argv[j]) :
+            lookupKeyRead(c->db,c->argv[j]);
         if (obj != NULL) {
             if (obj->type != OBJ_ZSET && obj->type != OBJ_SET) {
                 zfree(src);
@@ -2229,7 +2630,8 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
         int remaining = c->argc - j;
 
         while (remaining) {
-            if (remaining >= (setnum + 1) &&
+            if (op != SET_OP_DIFF &&
+                remaining >= (setnum + 1) &&
                 !strcasecmp(c->argv[j]->ptr,"weights"))
             {
                 j++; remaining--;
@@ -2241,7 +2643,8 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
                         return;
                     }
                 }
-            } else if (remaining >= 2 &&
+            } else if (op != SET_OP_DIFF &&
+                       remaining >= 2 &&
                        !strcasecmp(c->argv[j]->ptr,"aggregate"))
             {
                 j++; remaining--;
@@ -2257,6 +2660,24 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
                     return;
                 }
                 j++; remaining--;
+            } else if (dstkey == NULL &&
+                       !strcasecmp(c->argv[j]->ptr,"withscores"))
+            {
+                j++; remaining--;
+                withscores = 1;
+            } else if (dstkey == NULL &&
+                       remaining >= 3 &&
+                       !strcasecmp(c->argv[j]->ptr,"limit"))
+            {
+                if ((getLongFromObjectOrReply(c, c->argv[j+1], &offset, NULL)
+                        != C_OK) ||
+                    (getLongFromObjectOrReply(c, c->argv[j+2], &limit, NULL)
+                        != C_OK))
+                {
+                    zfree(src);
+                    return;
+                }
+                j += 3; remaining -= 3;
             } else {
                 zfree(src);
                 addReply(c,shared.syntaxerr);
@@ -2266,8 +2687,10 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
     }
 
     /* sort sets from the smallest to largest, this will improve our
-     * algorithm's performance */
-    qsort(src,setnum,sizeof(zsetopsrc),zuiCompareByCardinality);
+     * algorithm's performance. The first input of a difference is the
+     * one the others are subtracted from, so it must stay in place. */
+    if (op != SET_OP_DIFF)
+        qsort(src,setnum,sizeof(zsetopsrc),zuiCompareByCardinality);
 
     dstobj = createZsetObject();
     dstzset = dstobj->ptr;
@@ -2302,13 +2725,18 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
                 /* Only continue when present in every input. */
                 if (j == setnum) {
                     tmp = zuiNewSdsFromValue(&zval);
-                    znode = zslInsert(dstzset->zsl,score,tmp);
-                    dictAdd(dstzset->dict,tmp,&znode->score);
+                    zsetInsert(dstzset,score,tmp);
                     if (sdslen(tmp) > maxelelen) maxelelen = sdslen(tmp);
                 }
             }
             zuiClearIterator(&src[0]);
         }
+    } else if (op == SET_OP_UNION && zuiAllSmall(src,setnum)) {
+        small = zunionSmallInputs(src,setnum,aggregate,&smalllen,&maxelelen);
+        if (small && dstkey) {
+            zsetopEntriesToZset(small,smalllen,dstobj,maxelelen);
+            small = NULL;
+        }
     } else if (op == SET_OP_UNION) {
         dict *accumulator = dictCreate(&setAccumulatorDictType,NULL);
         dictIterator *di;
@@ -2338,7 +2766,7 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
                 if (!existing) {
                     tmp = zuiNewSdsFromValue(&zval);
                     /* Remember the longest single element encountered,
-                     * to understand if it's possible to convert to ziplist
+                     * to understand if it's possible to convert to listpack
                      * at the end. */
                      if (sdslen(tmp) > maxelelen) maxelelen = sdslen(tmp);
                     /* Update the element with its initial score. */
@@ -2368,24 +2796,67 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
         while((de = dictNext(di)) != NULL) {
             sds ele = dictGetKey(de);
             score = dictGetDoubleVal(de);
-            znode = zslInsert(dstzset->zsl,score,ele);
-            dictAdd(dstzset->dict,ele,&znode->score);
+            zsetInsert(dstzset,score,ele);
         }
         dictReleaseIterator(di);
         dictRelease(accumulator);
+    } else if (op == SET_OP_DIFF) {
+        /* The difference is empty when the first input is empty, or when
+         * it is also one of the other inputs. */
+        for (j = 1; j < setnum; j++)
+            if (src[j].subject == src[0].subject) break;
+
+        if (zuiLength(&src[0]) > 0 && j == setnum) {
+            zuiInitIterator(&src[0]);
+            while (zuiNext(&src[0],&zval)) {
+                double value;
+
+                for (j = 1; j < setnum; j++) {
+                    if (zuiFind(&src[j],&zval,&value)) break;
+                }
+
+                /* Only continue when missing in every other input. */
+                if (j == setnum) {
+                    tmp = zuiNewSdsFromValue(&zval);
+                    zsetInsert(dstzset,zval.score,tmp);
+                    if (sdslen(tmp) > maxelelen) maxelelen = sdslen(tmp);
+                }
+            }
+            zuiClearIterator(&src[0]);
+        }
     } else {
         serverPanic("Unknown operator");
     }
 
+    if (dstkey == NULL) {
+        /* Reply with the result as ZRANGE would, LIMIT selecting a window
+         * of it like in ZRANGEBYSCORE. */
+        if (offset < 0 || limit == 0) {
+            addReply(c,shared.emptyarray);
+        } else {
+            long end = (limit < 0 || limit > LONG_MAX-offset) ?
+                       -1 : offset+limit-1;
+            if (small)
+                zsetopEntriesReply(c,small,smalllen,offset,end,withscores);
+            else
+                zrangeReplyByRank(c,dstobj,offset,end,withscores,0);
+        }
+        if (small) zsetopEntriesFree(small,smalllen);
+        decrRefCount(dstobj);
+        zfree(src);
+        return;
+    }
+
     if (dbDelete(c->db,dstkey))
         touched = 1;
-    if (dstzset->zsl->length) {
-        zsetConvertToZiplistIfNeeded(dstobj,maxelelen);
+    if (zsetLength(dstobj)) {
+        zsetConvertToListpackIfNeeded(dstobj,maxelelen);
         dbAdd(c->db,dstkey,dstobj);
         addReplyLongLong(c,zsetLength(dstobj));
         signalModifiedKey(c,c->db,dstkey);
         notifyKeyspaceEvent(NOTIFY_ZSET,
-            (op == SET_OP_UNION) ? "zunionstore" : "zinterstore",
+            (op == SET_OP_UNION) ? "zunionstore" :
+            (op == SET_OP_INTER ? "zinterstore" : "zdiffstore"),
             dstkey,c->db->id);
         server.dirty++;
     } else {
@@ -2401,11 +2872,27 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
 }
 
 void zunionstoreCommand(client *c) {
-    zunionInterGenericCommand(c,c->argv[1], SET_OP_UNION);
+    zunionInterDiffGenericCommand(c, c->argv[1], 2, SET_OP_UNION);
 }
 
 void zinterstoreCommand(client *c) {
-    zunionInterGenericCommand(c,c->argv[1], SET_OP_INTER);
+    zunionInterDiffGenericCommand(c, c->argv[1], 2, SET_OP_INTER);
+}
+
+void zdiffstoreCommand(client *c) {
+    zunionInterDiffGenericCommand(c, c->argv[1], 2, SET_OP_DIFF);
+}
+
+void zunionCommand(client *c) {
+    zunionInterDiffGenericCommand(c, NULL, 1, SET_OP_UNION);
+}
+
+void zinterCommand(client *c) {
+    zunionInterDiffGenericCommand(c, NULL, 1, SET_OP_INTER);
+}
+
+void zdiffCommand(client *c) {
+    zunionInterDiffGenericCommand(c, NULL, 1, SET_OP_DIFF);
 }
 
 void zrangeGenericCommand(client *c, int reverse) {
@@ -2414,8 +2901,6 @@ void zrangeGenericCommand(client *c, int reverse) {
     int withscores = 0;
     long start;
     long end;
-    long llen;
-    long rangelen;
 
     if ((getLongFromObjectOrReply(c, c->argv[2], &start, NULL) != C_OK) ||
         (getLongFromObjectOrReply(c, c->argv[3], &end, NULL) != C_OK)) return;
@@ -2430,6 +2915,19 @@ void zrangeGenericCommand(client *c, int reverse) {
     if ((zobj = lookupKeyReadOrReply(c,key,shared.emptyarray)) == NULL
          || checkType(c,zobj,OBJ_ZSET)) return;
 
+    zrangeReplyByRank(c,zobj,start,end,withscores,reverse);
+}
+
+/* Reply with the elements of the sorted set 'zobj' having a rank between
+ * 'start' and 'end' (inclusive, negative values count from the tail), with
+ * their scores if 'withscores' is true. Shared by ZRANGE / ZREVRANGE and by
+ * the ZUNION / ZINTER / ZDIFF commands that reply without storing. */
+void zrangeReplyByRank(client *c, robj *zobj, long start, long end,
+                       int withscores, int reverse)
+{
+    long llen;
+    long rangelen;
+
     /* Sanitize indexes. */
     llen = zsetLength(zobj);
     if (start < 0) start = llen+start;
@@ -2453,7 +2951,7 @@ void zrangeGenericCommand(client *c, int reverse) {
     else
         addReplyArrayLen(c, rangelen);
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -2461,16 +2959,16 @@ void zrangeGenericCommand(client *c, int reverse) {
         long long vlong;
 
         if (reverse)
-            eptr = ziplistIndex(zl,-2-(2*start));
+            eptr = lpSeek(zl,-2-(2*start));
         else
-            eptr = ziplistIndex(zl,2*start);
+            eptr = lpSeek(zl,2*start);
 
         serverAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
 
         while (rangelen--) {
             serverAssertWithInfo(c,zobj,eptr != NULL && sptr != NULL);
-            serverAssertWithInfo(c,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            vstr = lpGetValue(eptr,&vlen,&vlong);
 
             if (withscores && c->resp > 2) addReplyArrayLen(c,2);
             if (vstr == NULL)
@@ -2510,6 +3008,21 @@ void zrangeGenericCommand(client *c, int reverse) {
             if (withscores) addReplyDouble(c,ln->score);
             ln = reverse ? ln->backward : ln->level[0].forward;
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtreePos pos;
+
+        zbtSeekRank(zs->zbt,reverse ? llen-start : start+1,&pos);
+        while(rangelen--) {
+            zbtreeEntry *e;
+            serverAssertWithInfo(c,zobj,pos.leaf != NULL);
+            e = zbtPosEntry(&pos);
+            if (withscores && c->resp > 2) addReplyArrayLen(c,2);
+            addReplyBulkCBuffer(c,e->ele,sdslen(e->ele));
+            if (withscores) addReplyDouble(c,e->score);
+            if (reverse) zbtPrev(&pos);
+            else zbtNext(&pos);
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -2578,7 +3091,7 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
     if ((zobj = lookupKeyReadOrReply(c,key,shared.emptyarray)) == NULL ||
         checkType(c,zobj,OBJ_ZSET)) return;
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -2601,7 +3114,7 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
 
         /* Get score pointer for the first element. */
         serverAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
 
         /* We don't know in advance how many matching elements there are in the
          * list, so we push this object that will represent the multi-bulk
@@ -2628,9 +3141,9 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
                 if (!zslValueLteMax(score,&range)) break;
             }
 
-            /* We know the element exists, so ziplistGet should always
+            /* We know the element exists, so lpGetValue should always
              * succeed */
-            serverAssertWithInfo(c,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            vstr = lpGetValue(eptr,&vlen,&vlong);
 
             rangelen++;
             if (withscores && c->resp > 2) addReplyArrayLen(c,2);
@@ -2701,6 +3214,58 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
                 ln = ln->level[0].forward;
             }
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtreePos pos;
+        zbtreeEntry *e;
+        int found;
+
+        if (reverse) {
+            found = zbtLastInRange(zs->zbt,&range,&pos);
+        } else {
+            found = zbtFirstInRange(zs->zbt,&range,&pos);
+        }
+
+        /* No "first" element in the specified interval. */
+        if (!found) {
+            addReply(c,shared.emptyarray);
+            return;
+        }
+
+        replylen = addReplyDeferredLen(c);
+
+        /* The B+tree knows the rank of every element, so the offset is
+         * skipped with a lookup by rank instead of walking the elements. */
+        if (offset > 0) {
+            unsigned long rank;
+
+            e = zbtPosEntry(&pos);
+            rank = zbtGetRank(zs->zbt,e->score,e->ele);
+            if (reverse)
+                rank = (unsigned long)offset < rank ? rank-offset : 0;
+            else
+                rank += offset;
+            if (!zbtSeekRank(zs->zbt,rank,&pos)) pos.leaf = NULL;
+        }
+
+        while (pos.leaf && limit--) {
+            e = zbtPosEntry(&pos);
+
+            /* Abort when the node is no longer in range. */
+            if (reverse) {
+                if (!zslValueGteMin(e->score,&range)) break;
+            } else {
+                if (!zslValueLteMax(e->score,&range)) break;
+            }
+
+            rangelen++;
+            if (withscores && c->resp > 2) addReplyArrayLen(c,2);
+            addReplyBulkCBuffer(c,e->ele,sdslen(e->ele));
+            if (withscores) addReplyDouble(c,e->score);
+
+            if (reverse) zbtPrev(&pos);
+            else zbtNext(&pos);
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -2733,7 +3298,7 @@ void zcountCommand(client *c) {
     if ((zobj = lookupKeyReadOrReply(c, key, shared.czero)) == NULL ||
         checkType(c, zobj, OBJ_ZSET)) return;
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         double score;
@@ -2748,7 +3313,7 @@ void zcountCommand(client *c) {
         }
 
         /* First element is in range */
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         score = zzlGetScore(sptr);
         serverAssertWithInfo(c,zobj,zslValueLteMax(score,&range));
 
@@ -2787,6 +3352,8 @@ void zcountCommand(client *c) {
                 count -= (zsl->length - rank);
             }
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        count = zbtCountInRange(((zset*)zobj->ptr)->zbt, &range);
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -2814,7 +3381,7 @@ void zlexcountCommand(client *c) {
         return;
     }
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
 
@@ -2829,7 +3396,7 @@ void zlexcountCommand(client *c) {
         }
 
         /* First element is in range */
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         serverAssertWithInfo(c,zobj,zzlLexValueLteMax(eptr,&range));
 
         /* Iterate over elements in range */
@@ -2865,6 +3432,8 @@ void zlexcountCommand(client *c) {
                 count -= (zsl->length - rank);
             }
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        count = zbtCountInLexRange(((zset*)zobj->ptr)->zbt, &range);
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -2927,7 +3496,7 @@ void genericZrangebylexCommand(client *c, int reverse) {
         return;
     }
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -2950,7 +3519,7 @@ void genericZrangebylexCommand(client *c, int reverse) {
 
         /* Get score pointer for the first element. */
         serverAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
 
         /* We don't know in advance how many matching elements there are in the
          * list, so we push this object that will represent the multi-bulk
@@ -2975,9 +3544,9 @@ void genericZrangebylexCommand(client *c, int reverse) {
                 if (!zzlLexValueLteMax(eptr,&range)) break;
             }
 
-            /* We know the element exists, so ziplistGet should always
+            /* We know the element exists, so lpGetValue should always
              * succeed. */
-            serverAssertWithInfo(c,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            vstr = lpGetValue(eptr,&vlen,&vlong);
 
             rangelen++;
             if (vstr == NULL) {
@@ -3045,6 +3614,56 @@ void genericZrangebylexCommand(client *c, int reverse) {
                 ln = ln->level[0].forward;
             }
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtreePos pos;
+        zbtreeEntry *e;
+        int found;
+
+        if (reverse) {
+            found = zbtLastInLexRange(zs->zbt,&range,&pos);
+        } else {
+            found = zbtFirstInLexRange(zs->zbt,&range,&pos);
+        }
+
+        /* No "first" element in the specified interval. */
+        if (!found) {
+            addReply(c,shared.emptyarray);
+            zslFreeLexRange(&range);
+            return;
+        }
+
+        replylen = addReplyDeferredLen(c);
+
+        /* Skip the offset with a lookup by rank, see ZRANGEBYSCORE. */
+        if (offset > 0) {
+            unsigned long rank;
+
+            e = zbtPosEntry(&pos);
+            rank = zbtGetRank(zs->zbt,e->score,e->ele);
+            if (reverse)
+                rank = (unsigned long)offset < rank ? rank-offset : 0;
+            else
+                rank += offset;
+            if (!zbtSeekRank(zs->zbt,rank,&pos)) pos.leaf = NULL;
+        }
+
+        while (pos.leaf && limit--) {
+            e = zbtPosEntry(&pos);
+
+            /* Abort when the node is no longer in range. */
+            if (reverse) {
+                if (!zslLexValueGteMin(e->ele,&range)) break;
+            } else {
+                if (!zslLexValueLteMax(e->ele,&range)) break;
+            }
+
+            rangelen++;
+            addReplyBulkCBuffer(c,e->ele,sdslen(e->ele));
+
+            if (reverse) zbtPrev(&pos);
+            else zbtNext(&pos);
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -3173,7 +3792,7 @@ void genericZpopCommand(client *c, robj **keyv, int keyc, int where, int emitkey
 
     /* Remove the element. */
     do {
-        if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
             unsigned char *zl = zobj->ptr;
             unsigned char *eptr, *sptr;
             unsigned char *vstr;
@@ -3181,16 +3800,16 @@ void genericZpopCommand(client *c, robj **keyv, int keyc, int where, int emitkey
             long long vlong;
 
             /* Get the first or last element in the sorted set. */
-            eptr = ziplistIndex(zl,where == ZSET_MAX ? -2 : 0);
+            eptr = lpSeek(zl,where == ZSET_MAX ? -2 : 0);
             serverAssertWithInfo(c,zobj,eptr != NULL);
-            serverAssertWithInfo(c,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            vstr = lpGetValue(eptr,&vlen,&vlong);
             if (vstr == NULL)
                 ele = sdsfromlonglong(vlong);
             else
                 ele = sdsnewlen(vstr,vlen);
 
             /* Get the score. */
-            sptr = ziplistNext(zl,eptr);
+            sptr = lpNext(zl,eptr);
             serverAssertWithInfo(c,zobj,sptr != NULL);
             score = zzlGetScore(sptr);
         } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
@@ -3206,6 +3825,18 @@ void genericZpopCommand(client *c, robj **keyv, int keyc, int where, int emitkey
             serverAssertWithInfo(c,zobj,zln != NULL);
             ele = sdsdup(zln->ele);
             score = zln->score;
+        } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+            zset *zs = zobj->ptr;
+            zbtreePos pos;
+
+            /* Get the first or last element in the sorted set. */
+            if (where == ZSET_MAX) zbtLast(zs->zbt,&pos);
+            else zbtFirst(zs->zbt,&pos);
+
+            /* There must be an element in the sorted set. */
+            serverAssertWithInfo(c,zobj,pos.leaf != NULL);
+            ele = sdsdup(zbtPosEntry(&pos)->ele);
+            score = zbtPosEntry(&pos)->score;
         } else {
             serverPanic("Unknown sorted set encoding");
         }
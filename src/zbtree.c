@@ -0,0 +1,864 @@
+/*
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/* B+树：大的有序集合的另一种排序索引。
+ *
+ * 跳跃表的每个元素都是一次单独的内存分配，而且层级数组的大小不固定，
+ * 范围查询时每访问一个元素都要跟随一次指针。这里的B+树把元素(score,ele)
+ * 按顺序连续保存在叶子节点中，每个叶子最多保存ZBTREE_LEAF_SIZE个元素，
+ * 所有叶子组成双向链表用于正向和反向遍历。内部节点保存每个子树的最小元素
+ * 以及子树的元素个数，因此除了按照(score,ele)查找，还可以按照排名查找，
+ * 以及在查找的同时计算排名(ZRANK, ZCOUNT)。
+ *
+ * 元素的sds和zset的字典共享，内部节点中的最小元素也只是引用叶子中的sds，
+ * 所以元素从树中删除以后，路径上所有引用它的内部节点都会被更新。
+ * 节点中元素的位置会因为插入和删除而移动，所以字典中不能保存指向分值的指针，
+ * 使用B+树的zset在字典中直接保存分值。
+ *
+ * 插入时节点满了就分裂成两半(在最右边的叶子追加时不平分，避免顺序插入时
+ * 叶子只有一半被使用)，删除后节点的元素个数低于容量的1/4时和相邻的节点合并，
+ * 如果合并放不下，就在两个节点之间平均分配元素。 */
+
+#include "server.h"
+
+#define ZBTREE_LEAF_MIN (ZBTREE_LEAF_SIZE/4)
+#define ZBTREE_INNER_MIN (ZBTREE_INNER_SIZE/4)
+
+/* 比较元素e和(score,ele)，alias是另一个和ele内容相同的指针，
+ * e->ele等于ele或者alias时不需要比较字符串。 */
+static inline int zbtCompare(zbtreeEntry *e, double score, sds ele, sds alias) {
+    if (e->score < score) return -1;
+    if (e->score > score) return 1;
+    if (e->ele == ele || e->ele == alias) return 0;
+    return sdscmp(e->ele,ele);
+}
+
+/* 返回叶子中第一个不小于(score,ele)的元素的下标 */
+static unsigned int zbtLeafFind(zbtreeLeaf *leaf, double score, sds ele, sds alias) {
+    unsigned int lo = 0, hi = leaf->count;
+    while (lo < hi) {
+        unsigned int mid = (lo+hi) >> 1;
+        if (zbtCompare(&leaf->entries[mid],score,ele,alias) < 0) lo = mid+1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* 返回内部节点中可能包含(score,ele)的子树的下标，
+ * 也就是最后一个最小元素不大于(score,ele)的子树，没有时返回0 */
+static unsigned int zbtInnerFind(zbtreeInner *in, double score, sds ele, sds alias) {
+    unsigned int lo = 1, hi = in->count;
+    while (lo < hi) {
+        unsigned int mid = (lo+hi) >> 1;
+        if (zbtCompare(&in->keys[mid],score,ele,alias) <= 0) lo = mid+1;
+        else hi = mid;
+    }
+    return lo-1;
+}
+
+static inline unsigned int zbtNodeCount(void *node, int height) {
+    return height ? ((zbtreeInner*)node)->count : ((zbtreeLeaf*)node)->count;
+}
+
+static inline zbtreeEntry *zbtNodeMin(void *node, int height) {
+    return height ? &((zbtreeInner*)node)->keys[0] : &((zbtreeLeaf*)node)->entries[0];
+}
+
+/* 返回子树中元素的个数 */
+static unsigned long zbtNodeSize(void *node, int height) {
+    zbtreeInner *in = node;
+    unsigned long size = 0;
+
+    if (height == 0) return ((zbtreeLeaf*)node)->count;
+    for (unsigned int j = 0; j < in->count; j++) size += in->sizes[j];
+    return size;
+}
+
+static zbtreeLeaf *zbtCreateLeaf(zbtree *zbt) {
+    zbtreeLeaf *leaf = zmalloc(sizeof(*leaf));
+    leaf->prev = leaf->next = NULL;
+    leaf->count = 0;
+    zbt->leaves++;
+    return leaf;
+}
+
+static zbtreeInner *zbtCreateInner(zbtree *zbt) {
+    zbtreeInner *in = zmalloc(sizeof(*in));
+    in->count = 0;
+    zbt->inners++;
+    return in;
+}
+
+/* 创建一个空的B+树 */
+zbtree *zbtCreate(void) {
+    zbtree *zbt = zmalloc(sizeof(*zbt));
+    zbt->leaves = zbt->inners = 0;
+    zbt->root = zbt->head = zbt->tail = zbtCreateLeaf(zbt);
+    zbt->length = 0;
+    zbt->height = 0;
+    return zbt;
+}
+
+static void zbtFreeNode(void *node, int height) {
+    if (height) {
+        zbtreeInner *in = node;
+        for (unsigned int j = 0; j < in->count; j++)
+            zbtFreeNode(in->children[j],height-1);
+    } else {
+        zbtreeLeaf *leaf = node;
+        for (unsigned int j = 0; j < leaf->count; j++)
+            sdsfree(leaf->entries[j].ele);
+    }
+    zfree(node);
+}
+
+/* 释放B+树以及所有元素的sds */
+void zbtFree(zbtree *zbt) {
+    zbtFreeNode(zbt->root,zbt->height);
+    zfree(zbt);
+}
+
+/* 把src中从spos开始的n个子树移动到dst的dpos，src和dst可以是同一个节点 */
+static void zbtInnerMove(zbtreeInner *dst, unsigned int dpos,
+                         zbtreeInner *src, unsigned int spos, unsigned int n)
+{
+    memmove(dst->keys+dpos,src->keys+spos,sizeof(zbtreeEntry)*n);
+    memmove(dst->sizes+dpos,src->sizes+spos,sizeof(unsigned long)*n);
+    memmove(dst->children+dpos,src->children+spos,sizeof(void*)*n);
+}
+
+static void zbtInnerInsertAt(zbtreeInner *in, unsigned int pos, void *child, int height) {
+    zbtInnerMove(in,pos+1,in,pos,in->count-pos);
+    in->keys[pos] = *zbtNodeMin(child,height);
+    in->sizes[pos] = zbtNodeSize(child,height);
+    in->children[pos] = child;
+    in->count++;
+}
+
+/* 将(score,ele)插入以node为根、高度为height的子树。
+ * 如果node满了需要分裂，返回分裂出来的右边的节点，否则返回NULL。 */
+static void *zbtInsertNode(zbtree *zbt, void *node, int height, double score, sds ele) {
+    if (height == 0) {
+        zbtreeLeaf *leaf = node, *right;
+        unsigned int i = zbtLeafFind(leaf,score,ele,NULL), half;
+
+        if (leaf->count < ZBTREE_LEAF_SIZE) {
+            memmove(leaf->entries+i+1,leaf->entries+i,
+                    sizeof(zbtreeEntry)*(leaf->count-i));
+            leaf->entries[i].score = score;
+            leaf->entries[i].ele = ele;
+            leaf->count++;
+            return NULL;
+        }
+
+        /* 在两端的叶子的最外侧插入时不平分，顺序插入时叶子是满的 */
+        if (i == leaf->count && leaf->next == NULL) half = leaf->count;
+        else if (i == 0 && leaf->prev == NULL) half = 0;
+        else half = leaf->count/2;
+
+        right = zbtCreateLeaf(zbt);
+        right->count = leaf->count-half;
+        memcpy(right->entries,leaf->entries+half,sizeof(zbtreeEntry)*right->count);
+        leaf->count = half;
+        right->prev = leaf;
+        right->next = leaf->next;
+        if (leaf->next) leaf->next->prev = right;
+        else zbt->tail = right;
+        leaf->next = right;
+        zbtInsertNode(zbt,(half == 0 || (i <= half && half != ZBTREE_LEAF_SIZE)) ?
+                      leaf : right,0,score,ele);
+        return right;
+    }
+
+    zbtreeInner *in = node, *right;
+    unsigned int i = zbtInnerFind(in,score,ele,NULL), half;
+    void *child = in->children[i], *newchild;
+
+    newchild = zbtInsertNode(zbt,child,height-1,score,ele);
+    in->keys[i] = *zbtNodeMin(child,height-1);
+    if (newchild == NULL) {
+        in->sizes[i]++;
+        return NULL;
+    }
+    in->sizes[i] = zbtNodeSize(child,height-1);
+    if (in->count < ZBTREE_INNER_SIZE) {
+        zbtInnerInsertAt(in,i+1,newchild,height-1);
+        return NULL;
+    }
+
+    right = zbtCreateInner(zbt);
+    half = in->count/2;
+    right->count = in->count-half;
+    zbtInnerMove(right,0,in,half,right->count);
+    in->count = half;
+    if (i+1 <= half) zbtInnerInsertAt(in,i+1,newchild,height-1);
+    else zbtInnerInsertAt(right,i+1-half,newchild,height-1);
+    return right;
+}
+
+/* 插入一个元素，调用者需要保证元素不存在。sds在插入后由B+树引用。 */
+void zbtInsert(zbtree *zbt, double score, sds ele) {
+    void *right = zbtInsertNode(zbt,zbt->root,zbt->height,score,ele);
+
+    if (right) {
+        zbtreeInner *root = zbtCreateInner(zbt);
+        zbtInnerInsertAt(root,0,zbt->root,zbt->height);
+        zbtInnerInsertAt(root,1,right,zbt->height);
+        zbt->root = root;
+        zbt->height++;
+    }
+    zbt->length++;
+}
+
+/* 内部节点in的第i个子树的元素太少，和相邻的子树合并，或者从相邻的子树移动
+ * 一部分元素过来。height是in的高度。 */
+static void zbtRebalance(zbtree *zbt, zbtreeInner *in, int height, unsigned int i) {
+    unsigned int l, r, total, target;
+    int merged = 0;
+
+    if (in->count < 2) return;
+    l = (i+1 < in->count) ? i : i-1;
+    r = l+1;
+
+    if (height == 1) {
+        zbtreeLeaf *a = in->children[l], *b = in->children[r];
+
+        total = a->count+b->count;
+        if (total <= ZBTREE_LEAF_SIZE) {
+            memcpy(a->entries+a->count,b->entries,sizeof(zbtreeEntry)*b->count);
+            a->count = total;
+            a->next = b->next;
+            if (b->next) b->next->prev = a;
+            else zbt->tail = a;
+            zfree(b);
+            zbt->leaves--;
+            merged = 1;
+        } else {
+            target = total/2;
+            if (a->count < target) {
+                unsigned int n = target-a->count;
+                memcpy(a->entries+a->count,b->entries,sizeof(zbtreeEntry)*n);
+                memmove(b->entries,b->entries+n,sizeof(zbtreeEntry)*(b->count-n));
+                a->count += n;
+                b->count -= n;
+            } else {
+                unsigned int n = a->count-target;
+                memmove(b->entries+n,b->entries,sizeof(zbtreeEntry)*b->count);
+                memcpy(b->entries,a->entries+target,sizeof(zbtreeEntry)*n);
+                a->count -= n;
+                b->count += n;
+            }
+        }
+    } else {
+        zbtreeInner *a = in->children[l], *b = in->children[r];
+
+        total = a->count+b->count;
+        if (total <= ZBTREE_INNER_SIZE) {
+            zbtInnerMove(a,a->count,b,0,b->count);
+            a->count = total;
+            zfree(b);
+            zbt->inners--;
+            merged = 1;
+        } else {
+            target = total/2;
+            if (a->count < target) {
+                unsigned int n = target-a->count;
+                zbtInnerMove(a,a->count,b,0,n);
+                zbtInnerMove(b,0,b,n,b->count-n);
+                a->count += n;
+                b->count -= n;
+            } else {
+                unsigned int n = a->count-target;
+                zbtInnerMove(b,n,b,0,b->count);
+                zbtInnerMove(b,0,a,target,n);
+                a->count -= n;
+                b->count += n;
+            }
+        }
+    }
+
+    in->keys[l] = *zbtNodeMin(in->children[l],height-1);
+    in->sizes[l] = zbtNodeSize(in->children[l],height-1);
+    if (merged) {
+        zbtInnerMove(in,r,in,r+1,in->count-r-1);
+        in->count--;
+    } else {
+        in->keys[r] = *zbtNodeMin(in->children[r],height-1);
+        in->sizes[r] = zbtNodeSize(in->children[r],height-1);
+    }
+}
+
+/* 从以node为根的子树中删除第idx个元素(从0开始)，删除的元素保存在removed中 */
+static void zbtDeleteNode(zbtree *zbt, void *node, int height, unsigned long idx,
+                          zbtreeEntry *removed)
+{
+    if (height == 0) {
+        zbtreeLeaf *leaf = node;
+        *removed = leaf->entries[idx];
+        memmove(leaf->entries+idx,leaf->entries+idx+1,
+                sizeof(zbtreeEntry)*(leaf->count-idx-1));
+        leaf->count--;
+        return;
+    }
+
+    zbtreeInner *in = node;
+    unsigned int i = 0, count;
+    void *child;
+
+    while (idx >= in->sizes[i]) idx -= in->sizes[i++];
+    child = in->children[i];
+    zbtDeleteNode(zbt,child,height-1,idx,removed);
+    in->sizes[i]--;
+    count = zbtNodeCount(child,height-1);
+    if (count) in->keys[i] = *zbtNodeMin(child,height-1);
+    if (count < (height == 1 ? ZBTREE_LEAF_MIN : ZBTREE_INNER_MIN))
+        zbtRebalance(zbt,in,height,i);
+}
+
+/* 删除排名为rank(从1开始)的元素，元素的sds不会被释放而是保存在removed中 */
+static void zbtDeleteByRank(zbtree *zbt, unsigned long rank, zbtreeEntry *removed) {
+    zbtDeleteNode(zbt,zbt->root,zbt->height,rank-1,removed);
+    zbt->length--;
+
+    /* 根节点只剩下一个子树时，树的高度降低一层 */
+    while (zbt->height && ((zbtreeInner*)zbt->root)->count == 1) {
+        zbtreeInner *root = zbt->root;
+        zbt->root = root->children[0];
+        zbt->height--;
+        zfree(root);
+        zbt->inners--;
+    }
+}
+
+/* 返回元素的排名，第一个元素的排名是1，元素不存在时返回0 */
+unsigned long zbtGetRank(zbtree *zbt, double score, sds ele) {
+    void *node = zbt->root;
+    unsigned long rank = 0;
+    zbtreeLeaf *leaf;
+    unsigned int idx;
+
+    for (int h = zbt->height; h > 0; h--) {
+        zbtreeInner *in = node;
+        unsigned int i = zbtInnerFind(in,score,ele,NULL);
+        for (unsigned int j = 0; j < i; j++) rank += in->sizes[j];
+        node = in->children[i];
+    }
+    leaf = node;
+    idx = zbtLeafFind(leaf,score,ele,NULL);
+    if (idx < leaf->count && zbtCompare(&leaf->entries[idx],score,ele,NULL) == 0)
+        return rank+idx+1;
+    return 0;
+}
+
+/* 删除元素，成功返回1，元素不存在返回0。
+ * node为NULL时释放元素的sds，否则通过node返回，由调用者释放。 */
+int zbtDelete(zbtree *zbt, double score, sds ele, sds *node) {
+    unsigned long rank = zbtGetRank(zbt,score,ele);
+    zbtreeEntry removed;
+
+    if (rank == 0) return 0;
+    zbtDeleteByRank(zbt,rank,&removed);
+    if (node) *node = removed.ele;
+    else sdsfree(removed.ele);
+    return 1;
+}
+
+/* 定位到排名为rank(从1开始)的元素，rank超出范围时返回0 */
+int zbtSeekRank(zbtree *zbt, unsigned long rank, zbtreePos *pos) {
+    void *node = zbt->root;
+    unsigned long idx = rank-1;
+
+    if (rank == 0 || rank > zbt->length) return 0;
+    for (int h = zbt->height; h > 0; h--) {
+        zbtreeInner *in = node;
+        unsigned int i = 0;
+        while (idx >= in->sizes[i]) idx -= in->sizes[i++];
+        node = in->children[i];
+    }
+    pos->leaf = node;
+    pos->idx = idx;
+    return 1;
+}
+
+/* 定位到第一个使pred为假的元素，返回使pred为真的元素的个数。
+ * 所有元素都使pred为真时pos->leaf被设置为NULL。 */
+unsigned long zbtSeek(zbtree *zbt, zbtreePredicate *pred, void *privdata, zbtreePos *pos) {
+    void *node = zbt->root;
+    unsigned long rank = 0;
+    unsigned int lo, hi;
+    zbtreeLeaf *leaf;
+
+    for (int h = zbt->height; h > 0; h--) {
+        zbtreeInner *in = node;
+        lo = 1;
+        hi = in->count;
+        while (lo < hi) {
+            unsigned int mid = (lo+hi) >> 1;
+            if (pred(&in->keys[mid],privdata)) lo = mid+1;
+            else hi = mid;
+        }
+        for (unsigned int j = 0; j < lo-1; j++) rank += in->sizes[j];
+        node = in->children[lo-1];
+    }
+
+    leaf = node;
+    lo = 0;
+    hi = leaf->count;
+    while (lo < hi) {
+        unsigned int mid = (lo+hi) >> 1;
+        if (pred(&leaf->entries[mid],privdata)) lo = mid+1;
+        else hi = mid;
+    }
+    rank += lo;
+    if (lo == leaf->count) {
+        pos->leaf = leaf->next;
+        pos->idx = 0;
+    } else {
+        pos->leaf = leaf;
+        pos->idx = lo;
+    }
+    return rank;
+}
+
+/* 定位到第一个元素，B+树为空时返回0 */
+int zbtFirst(zbtree *zbt, zbtreePos *pos) {
+    pos->leaf = zbt->length ? zbt->head : NULL;
+    pos->idx = 0;
+    return pos->leaf != NULL;
+}
+
+/* 定位到最后一个元素，B+树为空时返回0 */
+int zbtLast(zbtree *zbt, zbtreePos *pos) {
+    if (zbt->length == 0) {
+        pos->leaf = NULL;
+        return 0;
+    }
+    pos->leaf = zbt->tail;
+    pos->idx = zbt->tail->count-1;
+    return 1;
+}
+
+/* 移动到下一个元素，没有下一个元素时返回0 */
+int zbtNext(zbtreePos *pos) {
+    if (++pos->idx >= pos->leaf->count) {
+        pos->leaf = pos->leaf->next;
+        pos->idx = 0;
+    }
+    return pos->leaf != NULL;
+}
+
+/* 移动到上一个元素，没有上一个元素时返回0 */
+int zbtPrev(zbtreePos *pos) {
+    if (pos->idx == 0) {
+        pos->leaf = pos->leaf->prev;
+        if (pos->leaf == NULL) return 0;
+        pos->idx = pos->leaf->count;
+    }
+    pos->idx--;
+    return 1;
+}
+
+/* 更新元素的分值，调用者需要保证元素存在，元素的sds保持不变。 */
+void zbtUpdateScore(zbtree *zbt, double curscore, sds ele, double newscore) {
+    unsigned long rank = zbtGetRank(zbt,curscore,ele);
+    zbtreeEntry removed;
+    zbtreePos pos;
+
+    serverAssert(rank != 0);
+    zbtSeekRank(zbt,rank,&pos);
+
+    /* 新的分值不改变元素的顺序时直接修改。叶子的第一个元素在内部节点中有
+     * 拷贝，为了简单起见总是删除后重新插入。 */
+    if (pos.idx > 0) {
+        zbtreeLeaf *leaf = pos.leaf;
+        zbtreeEntry *next = NULL;
+
+        if (pos.idx+1 < leaf->count) next = &leaf->entries[pos.idx+1];
+        else if (leaf->next) next = &leaf->next->entries[0];
+        if (zbtCompare(&leaf->entries[pos.idx-1],newscore,ele,NULL) < 0 &&
+            (next == NULL || zbtCompare(next,newscore,ele,NULL) > 0))
+        {
+            leaf->entries[pos.idx].score = newscore;
+            return;
+        }
+    }
+    zbtDeleteByRank(zbt,rank,&removed);
+    zbtInsert(zbt,newscore,removed.ele);
+}
+
+/* 删除排名在[start,end]之间的元素(从1开始，包含两端)，同时从字典中删除。
+ * 返回删除的元素个数。 */
+unsigned long zbtDeleteRangeByRank(zbtree *zbt, unsigned long start, unsigned long end, dict *dict) {
+    unsigned long removed = 0;
+    zbtreeEntry e;
+
+    if (end > zbt->length) end = zbt->length;
+    while (start <= end) {
+        zbtDeleteByRank(zbt,start,&e);
+        dictDelete(dict,e.ele);
+        sdsfree(e.ele);
+        removed++;
+        end--;
+    }
+    return removed;
+}
+
+/* 内存碎片整理时元素的sds被移动到了newele，oldele已经被释放，不能访问其内容。
+ * 更新叶子和内部节点中所有指向oldele的指针。 */
+void zbtReplaceEle(zbtree *zbt, double score, sds oldele, sds newele) {
+    void *node = zbt->root;
+    zbtreeLeaf *leaf;
+    unsigned int idx;
+
+    for (int h = zbt->height; h > 0; h--) {
+        zbtreeInner *in = node;
+        unsigned int i = zbtInnerFind(in,score,newele,oldele);
+        if (in->keys[i].ele == oldele) in->keys[i].ele = newele;
+        node = in->children[i];
+    }
+    leaf = node;
+    idx = zbtLeafFind(leaf,score,newele,oldele);
+    serverAssert(idx < leaf->count && leaf->entries[idx].ele == oldele);
+    leaf->entries[idx].ele = newele;
+}
+
+/* 返回B+树节点占用的内存，不包括元素的sds */
+size_t zbtAllocSize(zbtree *zbt) {
+    return zmalloc_size(zbt) +
+           zbt->leaves*zmalloc_size(zbt->head) +
+           zbt->inners*(zbt->height ? zmalloc_size(zbt->root) : 0);
+}
+
+#ifdef REDIS_TEST
+zskiplistNode *zslUpdateScore(zskiplist *zsl, double curscore, sds ele, double newscore);
+zskiplistNode *zslGetElementByRank(zskiplist *zsl, unsigned long rank);
+unsigned long zslDeleteRangeByRank(zskiplist *zsl, unsigned int start, unsigned int end, dict *dict);
+
+/* 检查子树的结构，返回子树中元素的个数 */
+static unsigned long zbtCheckNode(zbtree *zbt, void *node, int height, int isroot,
+                                  zbtreeLeaf **prev)
+{
+    if (height == 0) {
+        zbtreeLeaf *leaf = node;
+        serverAssert(isroot || leaf->count > 0);
+        serverAssert(leaf->prev == *prev);
+        if (*prev) serverAssert((*prev)->next == leaf);
+        else serverAssert(zbt->head == leaf);
+        for (unsigned int j = 1; j < leaf->count; j++)
+            serverAssert(zbtCompare(&leaf->entries[j-1],leaf->entries[j].score,
+                                    leaf->entries[j].ele,NULL) < 0);
+        if (*prev && (*prev)->count && leaf->count)
+            serverAssert(zbtCompare(&(*prev)->entries[(*prev)->count-1],
+                leaf->entries[0].score,leaf->entries[0].ele,NULL) < 0);
+        *prev = leaf;
+        return leaf->count;
+    }
+
+    zbtreeInner *in = node;
+    unsigned long size = 0;
+    serverAssert(in->count >= (isroot ? 2 : 1));
+    for (unsigned int j = 0; j < in->count; j++) {
+        zbtreeEntry *min = zbtNodeMin(in->children[j],height-1);
+        unsigned long s = zbtCheckNode(zbt,in->children[j],height-1,0,prev);
+        serverAssert(s == in->sizes[j]);
+        serverAssert(in->keys[j].ele == min->ele && in->keys[j].score == min->score);
+        size += s;
+    }
+    return size;
+}
+
+static void zbtCheck(zbtree *zbt) {
+    zbtreeLeaf *prev = NULL;
+    serverAssert(zbtCheckNode(zbt,zbt->root,zbt->height,1,&prev) == zbt->length);
+    serverAssert(zbt->tail == prev && prev->next == NULL);
+}
+
+/* 检查B+树和作为参照的跳跃表中的元素完全相同，排名也相同 */
+static void zbtCheckWithSkiplist(zbtree *zbt, zskiplist *zsl) {
+    zskiplistNode *x = zsl->header->level[0].forward;
+    zbtreePos pos;
+    unsigned long rank = 1;
+
+    zbtCheck(zbt);
+    serverAssert(zbt->length == zsl->length);
+    zbtFirst(zbt,&pos);
+    while (x) {
+        serverAssert(pos.leaf != NULL);
+        serverAssert(zbtPosEntry(&pos)->score == x->score);
+        serverAssert(sdscmp(zbtPosEntry(&pos)->ele,x->ele) == 0);
+        if (rank % 7 == 0)
+            serverAssert(zbtGetRank(zbt,x->score,x->ele) == rank);
+        zbtNext(&pos);
+        x = x->level[0].forward;
+        rank++;
+    }
+    serverAssert(pos.leaf == NULL);
+}
+
+static int zbtTestBelow(zbtreeEntry *e, void *privdata) {
+    return e->score < *(double*)privdata;
+}
+
+static sds zbtTestEle(long j) {
+    return sdscatprintf(sdsempty(),"ele:%ld",j);
+}
+
+static double zbtTestScore(void) {
+    return (double)(rand() % 100000);
+}
+
+int zbtreeTest(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+    srand(time(NULL));
+
+    printf("Insert, delete and update against a skiplist: "); {
+        for (int round = 0; round < 20; round++) {
+            zbtree *zbt = zbtCreate();
+            zskiplist *zsl = zslCreate();
+            dict *d = dictCreate(&zsetDictType,NULL);
+            long n = rand() % 20000;
+
+            for (long j = 0; j < n; j++) {
+                sds ele = zbtTestEle(rand() % (n+1));
+                dictEntry *de = dictFind(d,ele);
+                double score = (round & 1) ? (double)j : zbtTestScore();
+
+                if (de) {
+                    /* 已经存在的元素随机删除或者更新分值 */
+                    sds old = dictGetKey(de);
+                    double cur = dictGetDoubleVal(de);
+                    if (rand() & 1) {
+                        dictDelete(d,old);
+                        serverAssert(zslDelete(zsl,cur,old,NULL));
+                        serverAssert(zbtDelete(zbt,cur,ele,NULL));
+                        serverAssert(!zbtDelete(zbt,cur,ele,NULL));
+                    } else {
+                        zslUpdateScore(zsl,cur,old,score);
+                        zbtUpdateScore(zbt,cur,old,score);
+                        dictSetDoubleVal(dictFind(d,old),score);
+                    }
+                    sdsfree(ele);
+                } else {
+                    zslInsert(zsl,score,sdsdup(ele));
+                    zbtInsert(zbt,score,ele);
+                    de = dictAddRaw(d,ele,NULL);
+                    dictSetDoubleVal(de,score);
+                }
+            }
+            zbtCheckWithSkiplist(zbt,zsl);
+
+            /* 按排名删除一段，再随机删除直到为空 */
+            if (zbt->length > 10) {
+                unsigned long start = rand() % (zbt->length-10) + 1;
+                unsigned long end = start + rand() % (zbt->length-start+1);
+                serverAssert(zslDeleteRangeByRank(zsl,start,end,d) ==
+                             end-start+1);
+                dictRelease(d);
+                d = dictCreate(&zsetDictType,NULL);
+                zskiplistNode *x = zsl->header->level[0].forward;
+                for (; x; x = x->level[0].forward) {
+                    dictEntry *de = dictAddRaw(d,x->ele,NULL);
+                    dictSetDoubleVal(de,x->score);
+                }
+                dict *tmp = dictCreate(&zsetDictType,NULL);
+                zbtreePos pos;
+                if (zbtFirst(zbt,&pos)) {
+                    do dictAdd(tmp,zbtPosEntry(&pos)->ele,NULL);
+                    while (zbtNext(&pos));
+                }
+                serverAssert(zbtDeleteRangeByRank(zbt,start,end,tmp) ==
+                             end-start+1);
+                serverAssert(dictSize(tmp) == zbt->length);
+                dictRelease(tmp);
+                zbtCheckWithSkiplist(zbt,zsl);
+            }
+            while (zbt->length) {
+                unsigned long rank = rand() % zbt->length + 1;
+                zbtreePos pos;
+                sds ele;
+                serverAssert(zbtSeekRank(zbt,rank,&pos));
+                ele = zbtPosEntry(&pos)->ele;
+                double score = zbtPosEntry(&pos)->score;
+                dictDelete(d,ele);
+                serverAssert(zslDelete(zsl,score,ele,NULL));
+                serverAssert(zbtDelete(zbt,score,ele,NULL));
+                if (zbt->length % 97 == 0) zbtCheckWithSkiplist(zbt,zsl);
+            }
+            serverAssert(zbt->height == 0 && zbt->leaves == 1 && zbt->inners == 0);
+            zbtFree(zbt);
+            zslFree(zsl);
+            dictRelease(d);
+        }
+        printf("OK\n");
+    }
+
+    printf("Seek, iteration and ranks: "); {
+        zbtree *zbt = zbtCreate();
+        zbtreePos pos;
+        long n = 100000;
+
+        for (long j = n-1; j >= 0; j--) zbtInsert(zbt,(double)j,zbtTestEle(j));
+        zbtCheck(zbt);
+        for (int k = 0; k < 1000; k++) {
+            double min = (double)(rand() % (n+10));
+            unsigned long below = zbtSeek(zbt,zbtTestBelow,&min,&pos);
+            serverAssert(below == (min < n ? (unsigned long)min : (unsigned long)n));
+            if (min < n) {
+                serverAssert(zbtPosEntry(&pos)->score == min);
+                serverAssert(zbtGetRank(zbt,min,zbtPosEntry(&pos)->ele) == below+1);
+                serverAssert(zbtSeekRank(zbt,below+1,&pos));
+                serverAssert(zbtPosEntry(&pos)->score == min);
+            } else {
+                serverAssert(pos.leaf == NULL);
+            }
+        }
+        long count = 0;
+        for (zbtLast(zbt,&pos); pos.leaf; count++) {
+            serverAssert(zbtPosEntry(&pos)->score == (double)(n-1-count));
+            if (!zbtPrev(&pos)) break;
+        }
+        serverAssert(count == n-1);
+        serverAssert(!zbtSeekRank(zbt,0,&pos) && !zbtSeekRank(zbt,n+1,&pos));
+        /* 顺序插入时叶子几乎是满的 */
+        serverAssert(zbt->leaves <= (unsigned long)n/ZBTREE_LEAF_SIZE+1);
+        zbtFree(zbt);
+        printf("OK\n");
+    }
+    return 0;
+}
+
+static void zbtBenchReport(const char *op, long n, long long zsl_us, long long zbt_us) {
+    printf("%-22s skiplist %9lld us  btree %9lld us  (%ld elements)\n", op,
+           zsl_us, zbt_us, n);
+}
+
+/* 比较跳跃表和B+树的插入、排名、范围查询的性能以及内存占用 */
+int zbtreeBenchmark(int argc, char *argv[]) {
+    long sizes[] = {1000000, 10000000};
+    UNUSED(argc);
+    UNUSED(argv);
+    srand(1234);
+
+    for (size_t k = 0; k < sizeof(sizes)/sizeof(*sizes); k++) {
+        long n = sizes[k], queries = 1000000;
+        double *scores = zmalloc(sizeof(double)*n);
+        long long start, zsl_us, zbt_us;
+        size_t mem, zsl_mem, zbt_mem;
+        zskiplist *zsl;
+        zbtree *zbt;
+        long long sum = 0;
+
+        for (long j = 0; j < n; j++) scores[j] = (double)rand()/RAND_MAX*n;
+
+        mem = zmalloc_used_memory();
+        start = ustime();
+        zsl = zslCreate();
+        for (long j = 0; j < n; j++) zslInsert(zsl,scores[j],zbtTestEle(j));
+        zsl_us = ustime()-start;
+        zsl_mem = zmalloc_used_memory()-mem;
+
+        mem = zmalloc_used_memory();
+        start = ustime();
+        zbt = zbtCreate();
+        for (long j = 0; j < n; j++) zbtInsert(zbt,scores[j],zbtTestEle(j));
+        zbt_us = ustime()-start;
+        zbt_mem = zmalloc_used_memory()-mem;
+        zbtBenchReport("insert random",n,zsl_us,zbt_us);
+
+        /* ZRANK */
+        start = ustime();
+        for (long j = 0; j < queries; j++) {
+            long i = rand() % n;
+            sds ele = zbtTestEle(i);
+            sum += zslGetRank(zsl,scores[i],ele);
+            sdsfree(ele);
+        }
+        zsl_us = ustime()-start;
+        start = ustime();
+        for (long j = 0; j < queries; j++) {
+            long i = rand() % n;
+            sds ele = zbtTestEle(i);
+            sum += zbtGetRank(zbt,scores[i],ele);
+            sdsfree(ele);
+        }
+        zbt_us = ustime()-start;
+        zbtBenchReport("rank",queries,zsl_us,zbt_us);
+
+        /* ZRANGEBYSCORE min +inf LIMIT 0 100 */
+        start = ustime();
+        for (long j = 0; j < queries/10; j++) {
+            zrangespec range = {(double)(rand() % n),(double)n,0,0};
+            zskiplistNode *x = zslFirstInRange(zsl,&range);
+            for (int i = 0; x && i < 100; i++, x = x->level[0].forward)
+                sum += (long long)x->score;
+        }
+        zsl_us = ustime()-start;
+        start = ustime();
+        for (long j = 0; j < queries/10; j++) {
+            double min = (double)(rand() % n);
+            zbtreePos pos;
+            zbtSeek(zbt,zbtTestBelow,&min,&pos);
+            for (int i = 0; pos.leaf && i < 100; i++, zbtNext(&pos))
+                sum += (long long)zbtPosEntry(&pos)->score;
+        }
+        zbt_us = ustime()-start;
+        zbtBenchReport("range of 100",queries/10,zsl_us,zbt_us);
+
+        /* ZRANGE by rank */
+        start = ustime();
+        for (long j = 0; j < queries; j++)
+            sum += (long long)zslGetElementByRank(zsl,rand() % n + 1)->score;
+        zsl_us = ustime()-start;
+        start = ustime();
+        for (long j = 0; j < queries; j++) {
+            zbtreePos pos;
+            zbtSeekRank(zbt,rand() % n + 1,&pos);
+            sum += (long long)zbtPosEntry(&pos)->score;
+        }
+        zbt_us = ustime()-start;
+        zbtBenchReport("element by rank",queries,zsl_us,zbt_us);
+
+        printf("memory: skiplist %zu bytes, btree %zu bytes "
+               "(including the elements, %ld elements, checksum %lld)\n",
+               zsl_mem,zbt_mem,n,sum & 1);
+
+        start = ustime();
+        zslFree(zsl);
+        zsl_us = ustime()-start;
+        start = ustime();
+        zbtFree(zbt);
+        zbt_us = ustime()-start;
+        zbtBenchReport("free",n,zsl_us,zbt_us);
+        zfree(scores);
+    }
+    return 0;
+}
+#endif
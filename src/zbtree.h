@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __ZBTREE_H
+#define __ZBTREE_H
+#include "sds.h"
+#include "dict.h"
+
+/* 叶子节点和内部节点的容量，选择的大小使节点刚好不超过1KB和2KB的分配粒度 */
+#define ZBTREE_LEAF_SIZE 62
+#define ZBTREE_INNER_SIZE 63
+
+typedef struct zbtreeEntry {
+    double score;
+    sds ele;
+} zbtreeEntry;
+
+/* 叶子节点按照(score,ele)的顺序保存元素，所有叶子组成一个双向链表 */
+typedef struct zbtreeLeaf {
+    struct zbtreeLeaf *prev, *next;
+    unsigned int count;
+    zbtreeEntry entries[ZBTREE_LEAF_SIZE];
+} zbtreeLeaf;
+
+/* 内部节点保存每个子树的最小元素(和叶子共享同一个sds)以及子树的元素个数，
+ * 元素个数用于按照排名查找 */
+typedef struct zbtreeInner {
+    unsigned int count;
+    zbtreeEntry keys[ZBTREE_INNER_SIZE];
+    unsigned long sizes[ZBTREE_INNER_SIZE];
+    void *children[ZBTREE_INNER_SIZE];
+} zbtreeInner;
+
+typedef struct zbtree {
+    void *root;//height为0时是叶子，否则是内部节点
+    zbtreeLeaf *head, *tail;
+    unsigned long length;
+    unsigned long leaves, inners;//节点的个数
+    int height;
+} zbtree;
+
+/* 指向一个元素的位置，leaf为NULL表示已经越过了最后一个元素 */
+typedef struct zbtreePos {
+    zbtreeLeaf *leaf;
+    unsigned int idx;
+} zbtreePos;
+
+#define zbtPosEntry(p) (&(p)->leaf->entries[(p)->idx])
+
+/* 查找用的谓词，必须对前面一部分元素为真，对剩下的元素为假 */
+typedef int zbtreePredicate(zbtreeEntry *e, void *privdata);
+
+zbtree *zbtCreate(void);
+void zbtFree(zbtree *zbt);
+void zbtInsert(zbtree *zbt, double score, sds ele);
+int zbtDelete(zbtree *zbt, double score, sds ele, sds *node);
+void zbtUpdateScore(zbtree *zbt, double curscore, sds ele, double newscore);
+unsigned long zbtGetRank(zbtree *zbt, double score, sds ele);
+int zbtSeekRank(zbtree *zbt, unsigned long rank, zbtreePos *pos);
+unsigned long zbtSeek(zbtree *zbt, zbtreePredicate *pred, void *privdata, zbtreePos *pos);
+int zbtFirst(zbtree *zbt, zbtreePos *pos);
+int zbtLast(zbtree *zbt, zbtreePos *pos);
+int zbtNext(zbtreePos *pos);
+int zbtPrev(zbtreePos *pos);
+unsigned long zbtDeleteRangeByRank(zbtree *zbt, unsigned long start, unsigned long end, dict *dict);
+void zbtReplaceEle(zbtree *zbt, double score, sds oldele, sds newele);
+size_t zbtAllocSize(zbtree *zbt);
+
+#ifdef REDIS_TEST
+int zbtreeTest(int argc, char *argv[]);
+int zbtreeBenchmark(int argc, char *argv[]);
+#endif
+
+#endif // __ZBTREE_H
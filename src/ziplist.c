@@ -206,6 +206,7 @@
 #include "zmalloc.h"
 #include "util.h"
 #include "ziplist.h"
+#include "listpack.h"
 #include "endianconv.h"
 #include "redisassert.h"
 
@@ -577,9 +578,9 @@ int zipPrevLenByteDiff(unsigned char *p, unsigned int len) {
 //返回p所在位置的entry所占用的字节总数
 unsigned int zipRawEntryLength(unsigned char *p) {
     unsigned int prevlensize, encoding, lensize, len;
-    //not understand why add prevlensize,because the value is 0 and p do not change any thing
-    ZIP_DECODE_LENGTH(p + prevlensize, encoding, lensize, len);
+    //先解码prevlen占用的字节数，encoding紧跟在prevlen之后
     ZIP_DECODE_PREVLENSIZE(p, prevlensize);
+    ZIP_DECODE_LENGTH(p + prevlensize, encoding, lensize, len);
     return prevlensize + lensize + len;
 }
 
@@ -1570,6 +1571,81 @@ void ziplistRepr(unsigned char *zl) {
     printf("{end}\n\n");
 }
 
+/* Check the integrity of a ziplist of 'size' bytes loaded from an untrusted
+ * source, like an RDB file: the header must match the size, and every entry
+ * must be correctly encoded, end before the end byte, and store the length
+ * of the previous entry. Returns 1 if the ziplist is valid, 0 otherwise. */
+int ziplistValidateIntegrity(unsigned char *zl, size_t size) {
+    unsigned char *p, *end, *tail;
+    unsigned int prevlen = 0, count = 0;
+
+    if (size < ZIPLIST_HEADER_SIZE+ZIPLIST_END_SIZE ||
+        intrev32ifbe(ZIPLIST_BYTES(zl)) != size) return 0;
+    end = ZIPLIST_ENTRY_END(zl);
+    if (end[0] != ZIP_END) return 0;
+
+    p = tail = ZIPLIST_ENTRY_HEAD(zl);
+    while (p < end) {
+        unsigned int prevlensize, prevrawlen, lensize, len;
+        unsigned char encoding;
+        size_t avail = end-p;
+        uint64_t entrylen;
+
+        /* Make sure every field of the header is inside the ziplist before
+         * decoding it. */
+        ZIP_DECODE_PREVLENSIZE(p,prevlensize);
+        if (avail < prevlensize+1) return 0;
+        ZIP_DECODE_PREVLEN(p,prevlensize,prevrawlen);
+        if (prevrawlen != prevlen) return 0;
+
+        ZIP_ENTRY_ENCODING((p+prevlensize),encoding);
+        if (encoding == ZIP_STR_14B) lensize = 2;
+        else if (encoding == ZIP_STR_32B) lensize = 5;
+        else lensize = 1;
+        if (encoding >= ZIP_INT_16B &&
+            encoding != ZIP_INT_8B && encoding != ZIP_INT_16B &&
+            encoding != ZIP_INT_24B && encoding != ZIP_INT_32B &&
+            encoding != ZIP_INT_64B &&
+            (encoding < ZIP_INT_IMM_MIN || encoding > ZIP_INT_IMM_MAX))
+            return 0;
+        if (avail < prevlensize+lensize) return 0;
+        ZIP_DECODE_LENGTH(p+prevlensize,encoding,lensize,len);
+        entrylen = (uint64_t)prevlensize+lensize+len;
+        if (entrylen > avail) return 0;
+
+        tail = p;
+        prevlen = entrylen;
+        p += entrylen;
+        count++;
+    }
+    if (p != end || ZIPLIST_ENTRY_TAIL(zl) != tail) return 0;
+    if (intrev16ifbe(ZIPLIST_LENGTH(zl)) != UINT16_MAX &&
+        intrev16ifbe(ZIPLIST_LENGTH(zl)) != count) return 0;
+    return 1;
+}
+
+/* Return a new listpack holding the same elements of the ziplist 'zl', in
+ * the same order. Used in order to load the old RDB encodings of hashes,
+ * sorted sets and quicklist nodes. The ziplist is not freed. */
+unsigned char *ziplistToListpack(unsigned char *zl) {
+    unsigned char *lp = lpNew();
+    unsigned char *p, *vstr;
+    unsigned int vlen;
+    long long vll;
+    char buf[32];
+
+    p = ziplistIndex(zl,0);
+    while (ziplistGet(p,&vstr,&vlen,&vll)) {
+        if (vstr == NULL) {
+            vlen = ll2string(buf,sizeof(buf),vll);
+            vstr = (unsigned char*)buf;
+        }
+        lp = lpAppend(lp,vstr,vlen);
+        p = ziplistNext(zl,p);
+    }
+    return lp;
+}
+
 #ifdef REDIS_TEST
 #include <sys/time.h>
 #include "adlist.h"
@@ -64,6 +64,10 @@ unsigned int ziplistLen(unsigned char *zl);
 size_t ziplistBlobLen(unsigned char *zl);
 //打印ziplist
 void ziplistRepr(unsigned char *zl);
+//校验从RDB等不可信来源加载的ziplist结构是否完整
+int ziplistValidateIntegrity(unsigned char *zl, size_t size);
+//将ziplist转换为一个新的listpack
+unsigned char *ziplistToListpack(unsigned char *zl);
 
 #ifdef REDIS_TEST
 int ziplistTest(int argc, char *argv[]);
@@ -48,3 +48,57 @@ test "client can handle keys with hash tag" {
     $cluster set foo{tag} bar
     $cluster close
 }
+
+test "CLUSTER SLOTS and CLUSTER NODES replies are served from the cache" {
+    set slots [R 0 cluster slots]
+    R 0 cluster nodes
+    set slots_hits [CI 0 cluster_slots_cache_hits]
+    set nodes_hits [CI 0 cluster_nodes_cache_hits]
+    assert_equal $slots [R 0 cluster slots]
+    R 0 cluster nodes
+    assert {[CI 0 cluster_slots_cache_hits] > $slots_hits}
+    assert {[CI 0 cluster_nodes_cache_hits] > $nodes_hits}
+}
+
+test "Cached CLUSTER SLOTS reply is dropped when slots change" {
+    set misses [CI 0 cluster_slots_cache_misses]
+    R 0 cluster delslots 0
+    set ranges {}
+    foreach range [R 0 cluster slots] {
+        lappend ranges [lrange $range 0 1]
+    }
+    assert {[lsearch -exact $ranges {0 0}] == -1}
+    assert {[CI 0 cluster_slots_cache_misses] > $misses}
+    foreach line [split [R 0 cluster nodes] "\n"] {
+        if {[string match "*myself*" $line]} {
+            assert {![string match "*connected 0 *" $line]}
+        }
+    }
+    R 0 cluster addslots 0
+    set ranges {}
+    foreach range [R 0 cluster slots] {
+        lappend ranges [lrange $range 0 1]
+    }
+    assert {[lsearch -exact $ranges {0 0}] != -1}
+}
+
+test "Cluster is up after the slot is served again" {
+    assert_cluster_state ok
+}
+
+test "Cached CLUSTER SLOTS reply drops a failed replica" {
+    set port [get_instance_attrib redis 5 port]
+    assert_match "* $port *" [R 0 cluster slots]
+    kill_instance redis 5
+    wait_for_condition 1000 50 {
+        ![string match "* $port *" [R 0 cluster slots]]
+    } else {
+        fail "The failed replica is still listed by CLUSTER SLOTS"
+    }
+    restart_instance redis 5
+    wait_for_condition 1000 50 {
+        [string match "* $port *" [R 0 cluster slots]]
+    } else {
+        fail "The replica is not listed again by CLUSTER SLOTS"
+    }
+}
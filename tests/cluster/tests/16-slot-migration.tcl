@@ -0,0 +1,195 @@
+# Server side slot migration with CLUSTER MIGRATESLOT.
+
+source "../tests/includes/init-tests.tcl"
+
+test "Create a 3 nodes cluster" {
+    create_cluster 3 3
+}
+
+test "Cluster is up" {
+    assert_cluster_state ok
+}
+
+set cluster [redis_cluster 127.0.0.1:[get_instance_attrib redis 0 port]]
+set slot [R 0 cluster keyslot "{foo}"]
+
+# Return the ID of the master instance serving 'slot', and one of the other
+# masters.
+proc slot_owner_and_other {slot} {
+    set owner -1
+    set other -1
+    foreach_redis_id id {
+        if {[RI $id role] ne {master}} continue
+        set found 0
+        foreach range [R $id cluster slots] {
+            if {[lindex $range 0] <= $slot && [lindex $range 1] >= $slot &&
+                [lindex $range 2 2] eq [R $id cluster myid]} {
+                set found 1
+            }
+        }
+        if {$found} {set owner $id} elseif {$other == -1} {set other $id}
+    }
+    list $owner $other
+}
+
+test "Populate the slot" {
+    for {set j 0} {$j < 20000} {incr j} {
+        $cluster set "{foo}:$j" [string repeat x 1000]
+    }
+    $cluster expire "{foo}:0" 1000
+    $cluster rpush "{foo}:list" a b c
+}
+
+lassign [slot_owner_and_other $slot] src dst
+set dst_id [R $dst cluster myid]
+set dst_port [get_instance_attrib redis $dst port]
+
+test "CLUSTER MIGRATESLOT ABORT leaves the slot to the source" {
+    set rd [redis 127.0.0.1 $dst_port 1 $::tls]
+    $rd debug sleep 1
+    after 100
+    R $src cluster migrateslot $slot $dst_id
+    assert_equal 1 [CI $src cluster_slot_migration_in_progress]
+    assert_error {*already in progress*} {R $src cluster migrateslot $slot $dst_id}
+    R $src cluster migrateslot abort
+    $rd read
+    $rd close
+    assert_equal 0 [CI $src cluster_slot_migration_in_progress]
+    assert_equal 1 [CI $src cluster_slot_migrations_aborted]
+    assert_equal 20001 [R $src cluster countkeysinslot $slot]
+    assert_equal {a b c} [$cluster lrange "{foo}:list" 0 -1]
+}
+
+# Return true if the node 'id' has no keys of 'slot' and is not importing it.
+proc import_cancelled {id slot} {
+    expr {[R $id cluster countkeysinslot $slot] == 0 &&
+          ![string match "*\\\[$slot-<-*" [R $id cluster nodes]]}
+}
+
+test "The target drops the keys imported before the abort" {
+    wait_for_condition 1000 50 {
+        [import_cancelled $dst $slot]
+    } else {
+        fail "The target still imports the slot of the aborted migration"
+    }
+}
+
+test "A migration refused by the target drops the imported keys" {
+    R $dst config set maxmemory [expr {[RI $dst used_memory]+4*1024*1024}]
+    R $src cluster migrateslot $slot $dst_id
+    wait_for_condition 1000 50 {
+        [CI $src cluster_slot_migrations_aborted] == 2
+    } else {
+        fail "The slot migration was not aborted"
+    }
+    R $dst config set maxmemory 0
+    wait_for_condition 1000 50 {
+        [import_cancelled $dst $slot]
+    } else {
+        fail "The target still imports the slot of the aborted migration"
+    }
+    assert_equal 20001 [R $src cluster countkeysinslot $slot]
+}
+
+test "A handover refused by the target leaves the slot to the source" {
+    R $src debug slot-migration-handover refuse
+    R $src cluster migrateslot $slot $dst_id
+    wait_for_condition 1000 50 {
+        [CI $src cluster_slot_migrations_aborted] == 3
+    } else {
+        fail "The slot migration was not aborted"
+    }
+    R $src debug slot-migration-handover ok
+    wait_for_condition 1000 50 {
+        [import_cancelled $dst $slot]
+    } else {
+        fail "The target still imports the slot of the aborted migration"
+    }
+    assert_equal 0 [CI $src cluster_slot_migrations_completed]
+    assert_equal 20001 [R $src cluster countkeysinslot $slot]
+    assert_equal $src [lindex [slot_owner_and_other $slot] 0]
+    assert_equal {a b c} [$cluster lrange "{foo}:list" 0 -1]
+}
+
+test "CLUSTER MIGRATESLOT moves the keys changed during the migration" {
+    # Keep the target busy so that the changes below happen while the
+    # slot is being streamed.
+    set rd [redis 127.0.0.1 $dst_port 1 $::tls]
+    $rd debug sleep 1
+    after 100
+    R $src cluster migrateslot $slot $dst_id
+    R $src set "{foo}:1" changed
+    R $src del "{foo}:2"
+    R $src rpush "{foo}:list" d
+    R $src set "{foo}:new" created
+    $rd read
+    $rd close
+    wait_for_condition 1000 50 {
+        [CI $src cluster_slot_migrations_completed] == 1
+    } else {
+        fail "The slot migration did not complete"
+    }
+    assert {[CI $src cluster_slot_migration_last_keys] >= 20001}
+    assert {[CI $src cluster_slot_migration_last_bytes] > 0}
+    assert {[CI $src cluster_slot_migration_last_pause_us] > 0}
+}
+
+test "The target serves the slot with the migrated keys" {
+    assert_equal 20001 [R $dst cluster countkeysinslot $slot]
+    assert_equal changed [$cluster get "{foo}:1"]
+    assert_equal 0 [$cluster exists "{foo}:2"]
+    assert_equal created [$cluster get "{foo}:new"]
+    assert_equal {a b c d} [$cluster lrange "{foo}:list" 0 -1]
+    assert_equal [string repeat x 1000] [$cluster get "{foo}:3"]
+    set ttl [$cluster ttl "{foo}:0"]
+    assert {$ttl > 900 && $ttl <= 1000}
+    assert_equal $dst [lindex [slot_owner_and_other $slot] 0]
+    assert_error {*MOVED*} {R $src get "{foo}:1"}
+}
+
+test "The source releases the migrated keys after the handover" {
+    wait_for_condition 1000 50 {
+        [R $src cluster countkeysinslot $slot] == 0
+    } else {
+        fail "The source still has keys of the migrated slot"
+    }
+}
+
+test "Cluster is up after the migration" {
+    assert_cluster_state ok
+}
+
+test "The source replicas dropped the migrated keys" {
+    foreach_redis_id id {
+        if {[RI $id role] ne {slave}} continue
+        if {[RI $id master_port] != [get_instance_attrib redis $src port]} continue
+        wait_for_condition 1000 50 {
+            [R $id dbsize] == 0
+        } else {
+            fail "Replica #$id still has keys of the migrated slot"
+        }
+    }
+}
+
+test "A handover with a lost reply gives the slot to the target" {
+    # Move the slot back, acting as if the reply to CLUSTER SETSLOT NODE
+    # was lost: only one node must serve the slot, and the source must keep
+    # the keys until the target claims it.
+    R $dst debug slot-migration-handover lose-reply
+    R $dst cluster migrateslot $slot [R $src cluster myid]
+    wait_for_condition 1000 50 {
+        [CI $dst cluster_slot_migrations_completed] == 1
+    } else {
+        fail "The slot migration did not complete"
+    }
+    R $dst debug slot-migration-handover ok
+    wait_for_condition 1000 50 {
+        [R $dst cluster countkeysinslot $slot] == 0
+    } else {
+        fail "The source still has keys of the migrated slot"
+    }
+    assert_equal $src [lindex [slot_owner_and_other $slot] 0]
+    assert_equal 20001 [R $src cluster countkeysinslot $slot]
+    assert_equal {a b c d} [$cluster lrange "{foo}:list" 0 -1]
+    assert_cluster_state ok
+}
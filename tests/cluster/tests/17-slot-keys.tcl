@@ -0,0 +1,52 @@
+# Check the per slot keys index used by COUNTKEYSINSLOT / GETKEYSINSLOT.
+
+source "../tests/includes/init-tests.tcl"
+
+test "Create a 1 node cluster" {
+    create_cluster 1 0
+}
+
+test "Cluster is up" {
+    assert_cluster_state ok
+}
+
+set slot [R 0 cluster keyslot "{foo}"]
+
+test "Keys are indexed by slot when added and removed" {
+    for {set j 0} {$j < 1000} {incr j} {
+        R 0 set "{foo}:$j" $j
+    }
+    R 0 set "{bar}:0" 0
+    assert_equal 1000 [R 0 cluster countkeysinslot $slot]
+    assert_equal 10 [llength [R 0 cluster getkeysinslot $slot 10]]
+    assert_equal 1000 [llength [R 0 cluster getkeysinslot $slot 2000]]
+    R 0 del "{foo}:0"
+    R 0 unlink "{foo}:1"
+    R 0 rename "{foo}:2" "{foo}:renamed"
+    R 0 pexpire "{foo}:3" 1
+    after 10
+    R 0 get "{foo}:3"
+    assert_equal 997 [R 0 cluster countkeysinslot $slot]
+    set keys [R 0 cluster getkeysinslot $slot 2000]
+    assert {[lsearch -exact $keys "{foo}:renamed"] != -1}
+    assert {[lsearch -exact $keys "{foo}:2"] == -1}
+}
+
+test "The slot index is emptied by FLUSHALL" {
+    R 0 flushall async
+    assert_equal 0 [R 0 cluster countkeysinslot $slot]
+    assert_equal {} [R 0 cluster getkeysinslot $slot 10]
+    R 0 set "{foo}:x" 1
+    assert_equal 1 [R 0 cluster countkeysinslot $slot]
+    R 0 flushall
+    assert_equal 0 [R 0 cluster countkeysinslot $slot]
+}
+
+test "The slot index survives a restart" {
+    for {set j 0} {$j < 100} {incr j} {
+        R 0 set "{foo}:$j" $j
+    }
+    R 0 debug reload
+    assert_equal 100 [R 0 cluster countkeysinslot $slot]
+    assert_equal 0 [R 0 cluster countkeysinslot [expr {($slot+1)%16384}]]
+}
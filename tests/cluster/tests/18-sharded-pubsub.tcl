@@ -0,0 +1,145 @@
+# Test SSUBSCRIBE / SPUBLISH: shard channels are served by the nodes of the
+# shard owning the channel slot, and messages are only propagated inside it.
+
+source "../tests/includes/init-tests.tcl"
+
+test "Create a 5 nodes cluster" {
+    create_cluster 5 5
+}
+
+test "Cluster is up" {
+    assert_cluster_state ok
+}
+
+proc bus_stat {id type {dir sent}} {
+    set val [CI $id cluster_stats_messages_${type}_${dir}]
+    if {$val eq {}} {set val 0}
+    return $val
+}
+
+proc total_bus_stat {type {dir sent}} {
+    set total 0
+    foreach_redis_id id {
+        incr total [bus_stat $id $type $dir]
+    }
+    return $total
+}
+
+proc shard_client {id} {
+    set port [get_instance_attrib redis $id port]
+    redis 127.0.0.1 $port 1 $::tls
+}
+
+set channel "{shard}channel"
+set slot [R 0 cluster keyslot $channel]
+
+# Find the master serving the channel slot and one of its replicas.
+set owner -1
+set replica -1
+foreach_redis_id id {
+    if {[lindex [R $id role] 0] eq {master}} {
+        foreach range [R $id cluster slots] {
+            if {$slot >= [lindex $range 0] && $slot <= [lindex $range 1] &&
+                [lindex $range 2 0] eq {127.0.0.1} &&
+                [lindex $range 2 1] == [get_instance_attrib redis $id port]} {
+                set owner $id
+            }
+        }
+    }
+}
+set owner_port [get_instance_attrib redis $owner port]
+foreach_redis_id id {
+    set r [R $id role]
+    if {[lindex $r 0] eq {slave} && [lindex $r 2] == $owner_port} {
+        set replica $id
+    }
+}
+
+test "The channel slot is served by a master with a replica" {
+    assert {$owner != -1 && $replica != -1}
+}
+
+test "SSUBSCRIBE is redirected outside the shard" {
+    set other [expr {($owner+1)%5}]
+    catch {R $other ssubscribe $channel} e
+    assert_match {*MOVED*} $e
+    catch {R $owner ssubscribe $channel "{other}channel"} e
+    assert_match {*CROSSSLOT*} $e
+}
+
+test "SPUBLISH reaches the subscribers of the master and its replicas" {
+    set m [shard_client $owner]
+    set s [shard_client $replica]
+    $s readonly
+    $s read
+    $m ssubscribe $channel
+    assert_equal [list ssubscribe $channel 1] [$m read]
+    $s ssubscribe $channel
+    assert_equal [list ssubscribe $channel 1] [$s read]
+
+    assert_equal [list $channel 1] [R $owner pubsub shardnumsub $channel]
+    assert_equal [list $channel] [R $owner pubsub shardchannels]
+    assert_equal 1 [RI $owner pubsubshard_channels]
+
+    set publish [total_bus_stat publish]
+    set shard [bus_stat $owner publishshard]
+    set data [randomValue]
+    assert_equal 1 [R $owner spublish $channel $data]
+    assert_equal [list smessage $channel $data] [$m read]
+    assert_equal [list smessage $channel $data] [$s read]
+
+    # Only the replica of the shard got the message over the bus.
+    assert_equal [expr {$shard+1}] [bus_stat $owner publishshard]
+    assert_equal $publish [total_bus_stat publish]
+}
+
+test "SPUBLISH bus traffic does not reach the nodes outside the shard" {
+    foreach_redis_id id {
+        set shard_received($id) [bus_stat $id publishshard received]
+    }
+    set publish [total_bus_stat publish received]
+    for {set j 0} {$j < 10} {incr j} {
+        R $owner spublish $channel [randomValue]
+        assert_equal [list smessage $channel] [lrange [$m read] 0 1]
+        assert_equal [list smessage $channel] [lrange [$s read] 0 1]
+    }
+
+    # The replica got every message, the other nodes none, whatever the
+    # size of the cluster.
+    assert_equal [expr {$shard_received($replica)+10}] \
+        [bus_stat $replica publishshard received]
+    foreach_redis_id id {
+        if {$id == $replica} continue
+        assert_equal $shard_received($id) [bus_stat $id publishshard received]
+    }
+    assert_equal $publish [total_bus_stat publish received]
+}
+
+test "PUBLISH is still broadcast to the whole cluster" {
+    set publish [bus_stat $owner publish]
+    set others [expr {[CI $owner cluster_known_nodes]-1}]
+    R $owner publish $channel [randomValue]
+    assert_equal [expr {$publish+$others}] [bus_stat $owner publish]
+}
+
+test "Subscribers are unsubscribed when the slot moves away" {
+    set target [expr {($owner+1)%5}]
+    set target_id [R $target cluster myid]
+    set completed [CI $owner cluster_slot_migrations_completed]
+    R $owner cluster migrateslot $slot $target_id
+    wait_for_condition 1000 50 {
+        [CI $owner cluster_slot_migrations_completed] > $completed
+    } else {
+        fail "Slot migration did not complete"
+    }
+    assert_equal [list sunsubscribe $channel 0] [$m read]
+    wait_for_condition 1000 50 {
+        [RI $replica pubsubshard_channels] == 0
+    } else {
+        fail "Replica subscribers were not removed"
+    }
+    assert_equal [list sunsubscribe $channel 0] [$s read]
+    assert_equal 0 [RI $owner pubsubshard_channels]
+    $m close
+    $s close
+}
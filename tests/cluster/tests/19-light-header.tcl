@@ -0,0 +1,148 @@
+# Check that PING / PONG messages omit the slots bitmap between nodes
+# accepting light headers, and that the cluster still converges.
+
+source "../tests/includes/init-tests.tcl"
+
+test "Create a 5 nodes cluster" {
+    create_cluster 5 5
+}
+
+test "Cluster is up" {
+    assert_cluster_state ok
+}
+
+# Return the average size of the PING messages sent by instance 'id' in
+# the next 'ms' milliseconds.
+proc ping_bytes_avg_during {id ms} {
+    set bytes [CI $id cluster_stats_bytes_ping_sent]
+    set msgs [CI $id cluster_stats_messages_ping_sent]
+    after $ms
+    set bytes [expr {[CI $id cluster_stats_bytes_ping_sent]-$bytes}]
+    set msgs [expr {[CI $id cluster_stats_messages_ping_sent]-$msgs}]
+    assert {$msgs > 0}
+    expr {double($bytes)/$msgs}
+}
+
+# Return the number of UPDATE messages sent by all the nodes.
+proc total_update_sent {} {
+    set total 0
+    foreach_redis_id id {
+        set val [CI $id cluster_stats_messages_update_sent]
+        if {$val ne {}} {incr total $val}
+    }
+    return $total
+}
+
+# Return the port of the node serving 'slot' according to instance 'id'.
+proc slot_owner_port {id slot} {
+    foreach range [R $id cluster slots] {
+        if {$slot >= [lindex $range 0] && $slot <= [lindex $range 1]} {
+            return [lindex $range 2 1]
+        }
+    }
+    return -1
+}
+
+test "Nodes exchange light PING / PONG headers" {
+    wait_for_condition 1000 50 {
+        [CI 0 cluster_stats_messages_light_sent] > 0 &&
+        [CI 0 cluster_stats_messages_light_received] > 0
+    } else {
+        fail "No light header was exchanged"
+    }
+    assert {[CI 0 cluster_stats_bytes_sent] > 0}
+    assert {[CI 0 cluster_stats_bytes_received] > 0}
+}
+
+test "Light headers are smaller than full ones" {
+    set light [ping_bytes_avg_during 0 3000]
+    foreach_redis_id id {
+        R $id config set cluster-light-header no
+    }
+    # Wait for all the nodes to advertise they no longer accept them.
+    after 2000
+    set sent [CI 0 cluster_stats_messages_light_sent]
+    set full [ping_bytes_avg_during 0 3000]
+    assert_equal $sent [CI 0 cluster_stats_messages_light_sent]
+    assert {$full - $light > 1024}
+}
+
+test "A node not accepting light headers only receives full ones" {
+    foreach_redis_id id {
+        if {$id != 0} {R $id config set cluster-light-header yes}
+    }
+    set sent [CI 0 cluster_stats_messages_light_sent]
+    wait_for_condition 1000 50 {
+        [CI 1 cluster_stats_messages_light_received] > 0
+    } else {
+        fail "No light header was exchanged"
+    }
+    set received [CI 0 cluster_stats_messages_light_received]
+    after 3000
+    assert_equal $received [CI 0 cluster_stats_messages_light_received]
+    assert_equal $sent [CI 0 cluster_stats_messages_light_sent]
+    R 0 config set cluster-light-header yes
+}
+
+test "Slot changes are propagated while light headers are in use" {
+    set slot [R 0 cluster keyslot "{light}"]
+    set src -1
+    for {set id 0} {$id < 5} {incr id} {
+        if {[catch {R $id set "{light}" x}] == 0} {set src $id}
+    }
+    set dst [expr {($src+1)%5}]
+    set dst_port [get_instance_attrib redis $dst port]
+    R $src cluster migrateslot $slot [R $dst cluster myid]
+    wait_for_condition 1000 50 {
+        [CI $src cluster_slot_migrations_completed] > 0
+    } else {
+        fail "Slot migration did not complete"
+    }
+    foreach_redis_id id {
+        wait_for_condition 1000 50 {
+            [slot_owner_port $id $slot] == $dst_port
+        } else {
+            fail "Node $id did not learn the new slot owner"
+        }
+    }
+    assert_cluster_state ok
+}
+
+test "Light headers use the slots of the last full header after a toggle" {
+    # The current owner stops sending light headers, loses the slot, then
+    # sends light headers again: the other nodes must expand them with the
+    # slots of its last full header, that no longer include the slot.
+    set src_port [get_instance_attrib redis $src port]
+    R $dst config set cluster-light-header no
+    set completed [CI $dst cluster_slot_migrations_completed]
+    R $dst cluster migrateslot $slot [R $src cluster myid]
+    wait_for_condition 1000 50 {
+        [CI $dst cluster_slot_migrations_completed] > $completed
+    } else {
+        fail "Slot migration did not complete"
+    }
+    foreach_redis_id id {
+        wait_for_condition 1000 50 {
+            [slot_owner_port $id $slot] == $src_port
+        } else {
+            fail "Node $id did not learn the new slot owner"
+        }
+    }
+    after 2000
+    set sent [CI $dst cluster_stats_messages_light_sent]
+    R $dst config set cluster-light-header yes
+    wait_for_condition 1000 50 {
+        [CI $dst cluster_stats_messages_light_sent] > $sent
+    } else {
+        fail "No light header was sent"
+    }
+    # Expanding them with stale slots would make the other nodes believe
+    # the node still claims the slot, and send it UPDATE messages.
+    set updates [total_update_sent]
+    after 3000
+    assert_equal $updates [total_update_sent]
+    foreach_redis_id id {
+        assert_equal $src_port [slot_owner_port $id $slot]
+    }
+    assert_cluster_state ok
+}
@@ -0,0 +1,74 @@
+# Check the per slot statistics reported by CLUSTER SLOT-STATS.
+
+source "../tests/includes/init-tests.tcl"
+
+test "Create a 1 node cluster" {
+    create_cluster 1 0
+}
+
+test "Cluster is up" {
+    assert_cluster_state ok
+}
+
+set slot_a [R 0 cluster keyslot "{a}"]
+set slot_b [R 0 cluster keyslot "{b}"]
+
+proc slot_stat {slot stat} {
+    set reply [R 0 cluster slot-stats slotsrange $slot $slot]
+    dict get [lindex $reply 0 1] $stat
+}
+
+test "Reads, writes and network bytes are accounted per slot" {
+    R 0 config resetstat
+    for {set j 0} {$j < 10} {incr j} {
+        R 0 set "{a}:$j" [string repeat x 100]
+    }
+    for {set j 0} {$j < 5} {incr j} {
+        R 0 get "{b}:missing"
+    }
+    R 0 get "{a}:0"
+    assert_equal 10 [slot_stat $slot_a writes]
+    assert_equal 1 [slot_stat $slot_a reads]
+    assert_equal 0 [slot_stat $slot_b writes]
+    assert_equal 5 [slot_stat $slot_b reads]
+    assert_equal 10 [slot_stat $slot_a key-count]
+    assert_equal 0 [slot_stat $slot_b key-count]
+    assert_equal [expr {10*(3+5+100)+3+5}] [slot_stat $slot_a network-bytes-in]
+    # Ten +OK and one bulk reply of 100 bytes.
+    assert_equal [expr {10*5+4+100+2+2}] [slot_stat $slot_a network-bytes-out]
+    assert {[slot_stat $slot_a memory-bytes] >= 1000}
+}
+
+test "SLOTSRANGE reports every served slot in the range" {
+    set reply [R 0 cluster slot-stats slotsrange 100 109]
+    assert_equal 10 [llength $reply]
+    assert_equal 100 [lindex $reply 0 0]
+    assert_equal 109 [lindex $reply 9 0]
+    assert_equal {key-count memory-bytes reads writes network-bytes-in network-bytes-out} \
+        [dict keys [lindex $reply 0 1]]
+}
+
+test "ORDERBY returns the slots sorted by the metric" {
+    assert_equal $slot_a [lindex [R 0 cluster slot-stats orderby writes limit 1] 0 0]
+    assert_equal $slot_b [lindex [R 0 cluster slot-stats orderby reads limit 1] 0 0]
+    set reply [R 0 cluster slot-stats orderby key-count limit 3]
+    assert_equal 3 [llength $reply]
+    assert_equal $slot_a [lindex $reply 0 0]
+    set reply [R 0 cluster slot-stats orderby writes limit 2 asc]
+    assert_equal 0 [dict get [lindex $reply 0 1] writes]
+    assert_equal 16 [llength [R 0 cluster slot-stats orderby memory-bytes]]
+}
+
+test "CLUSTER SLOT-STATS errors" {
+    assert_error {*Unknown slot statistic*} {R 0 cluster slot-stats orderby foo}
+    assert_error {*Limit*} {R 0 cluster slot-stats orderby reads limit 0}
+    assert_error {*Start slot*} {R 0 cluster slot-stats slotsrange 10 5}
+    assert_error {*syntax*} {R 0 cluster slot-stats foo}
+}
+
+test "CONFIG RESETSTAT clears the slot counters" {
+    R 0 config resetstat
+    assert_equal 0 [slot_stat $slot_a writes]
+    assert_equal 0 [slot_stat $slot_b reads]
+    assert_equal 10 [slot_stat $slot_a key-count]
+}
@@ -0,0 +1,91 @@
+# Check that a node flagging another node as PFAIL queries the masters with
+# FAIL_QUERY messages, and that the failure is detected with or without them.
+
+source "../tests/includes/init-tests.tcl"
+
+test "Create a 5 nodes cluster" {
+    create_cluster 5 5
+}
+
+test "Cluster is up" {
+    assert_cluster_state ok
+}
+
+proc bus_stat {id type dir} {
+    set val [CI $id cluster_stats_messages_${type}_${dir}]
+    if {$val eq {}} {set val 0}
+    return $val
+}
+
+proc total_bus_stat {type dir} {
+    set total 0
+    foreach_redis_id id {
+        if {[instance_is_killed redis $id]} continue
+        incr total [bus_stat $id $type $dir]
+    }
+    return $total
+}
+
+test "Instance #5 is a slave" {
+    assert {[RI 5 role] eq {slave}}
+    # 13-no-failover-option leaves the option set on this instance.
+    R 5 config set cluster-slave-no-failover no
+}
+
+set current_epoch [CI 1 cluster_current_epoch]
+
+test "Killing one master node" {
+    kill_instance redis 0
+}
+
+test "Wait for failover" {
+    wait_for_condition 1000 50 {
+        [CI 1 cluster_current_epoch] > $current_epoch
+    } else {
+        fail "No failover detected"
+    }
+}
+
+test "Failure reports were exchanged with FAIL_QUERY / FAIL_REPORT" {
+    assert {[total_bus_stat fail-query sent] > 0}
+    assert {[total_bus_stat fail-query received] > 0}
+    assert {[total_bus_stat fail-report sent] > 0}
+    assert {[total_bus_stat fail-report received] > 0}
+}
+
+test "Cluster should eventually be up again" {
+    assert_cluster_state ok
+}
+
+test "Instance #5 is now a master" {
+    assert {[RI 5 role] eq {master}}
+}
+
+test "Restarting the previously killed master node" {
+    restart_instance redis 0
+}
+
+test "Instance #0 gets converted into a slave" {
+    wait_for_condition 1000 50 {
+        [RI 0 role] eq {slave}
+    } else {
+        fail "Old master was not converted into slave"
+    }
+}
+
+test "Failures are still detected with cluster-fail-query disabled" {
+    foreach_redis_id id {
+        R $id config set cluster-fail-query no
+    }
+    set queries [expr {[total_bus_stat fail-query sent]-
+                       [bus_stat 1 fail-query sent]}]
+    set current_epoch [CI 2 cluster_current_epoch]
+    kill_instance redis 1
+    wait_for_condition 1000 50 {
+        [CI 2 cluster_current_epoch] > $current_epoch
+    } else {
+        fail "No failover detected"
+    }
+    assert_cluster_state ok
+    assert_equal $queries [total_bus_stat fail-query sent]
+}
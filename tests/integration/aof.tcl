@@ -263,6 +263,91 @@ tags {"aof"} {
         }
     }
 
+    ## Test that the threaded parser loads batches, big arguments,
+    ## transactions and rewritten argv vectors correctly
+    create_aof {
+        for {set j 0} {$j < 5000} {incr j} {
+            append_to_aof [formatCommand rpush list $j]
+        }
+        append_to_aof [formatCommand set big [string repeat x 5000000]]
+        append_to_aof [formatCommand multi]
+        append_to_aof [formatCommand incr counter]
+        append_to_aof [formatCommand sadd set foo bar gah]
+        append_to_aof [formatCommand sadd other foo bar]
+        append_to_aof [formatCommand exec]
+        append_to_aof [formatCommand spop other 2]
+    }
+
+    start_server_aof [list dir $server_path aof-fast-load yes] {
+        test "AOF fast load: Server should have been started" {
+            assert_equal 1 [is_alive $srv]
+        }
+
+        test "AOF fast load: Keyspace should match the AOF" {
+            set client [redis [dict get $srv host] [dict get $srv port] 0 $::tls]
+            wait_for_condition 50 100 {
+                [catch {$client ping} e] == 0
+            } else {
+                fail "Loading DB is taking too much time."
+            }
+            assert_equal 5000 [$client llen list]
+            assert_equal 4999 [$client lindex list -1]
+            assert_equal 5000000 [$client strlen big]
+            assert_equal 1 [$client get counter]
+            assert_equal 3 [$client scard set]
+            assert_equal 0 [$client exists other]
+        }
+
+        test "AOF fast load: DEBUG LOADAOF gives the same dataset in both modes" {
+            set digest [$client debug digest]
+            $client config set aof-fast-load no
+            $client debug loadaof
+            assert_equal $digest [$client debug digest]
+            $client config set aof-fast-load yes
+            $client debug loadaof
+            assert_equal $digest [$client debug digest]
+        }
+
+        test "AOF fast load: notify-keyspace-events is not modified by the load" {
+            $client config set notify-keyspace-events KEA
+            set flags [lindex [$client config get notify-keyspace-events] 1]
+            $client config set key-load-delay 500
+            set rd [redis [dict get $srv host] [dict get $srv port] 1 $::tls]
+            $rd debug loadaof
+            wait_for_condition 50 100 {
+                [string match "*loading:1*" [$client info persistence]]
+            } else {
+                fail "The AOF is not being loaded"
+            }
+            assert_equal $flags [lindex [$client config get notify-keyspace-events] 1]
+            assert_equal OK [$rd read]
+            $rd close
+            $client config set key-load-delay 0
+            assert_equal $flags [lindex [$client config get notify-keyspace-events] 1]
+            $client config set notify-keyspace-events ""
+        }
+    }
+
+    ## Short reads are handled by the threaded parser as well
+    create_aof {
+        for {set j 0} {$j < 3000} {incr j} {
+            append_to_aof [formatCommand incr foo]
+        }
+        append_to_aof [string range [formatCommand incr foo] 0 end-1]
+    }
+
+    start_server_aof [list dir $server_path aof-load-truncated yes aof-fast-load yes] {
+        test "AOF fast load: Truncated AOF loaded, foo should be 3000" {
+            set client [redis [dict get $srv host] [dict get $srv port] 0 $::tls]
+            wait_for_condition 50 100 {
+                [catch {$client ping} e] == 0
+            } else {
+                fail "Loading DB is taking too much time."
+            }
+            assert_equal 3000 [$client get foo]
+        }
+    }
+
     start_server {overrides {appendonly {yes} appendfilename {appendonly.aof}}} {
         test {Redis should not try to convert DEL into EXPIREAT for EXPIRE -1} {
             r set x 10
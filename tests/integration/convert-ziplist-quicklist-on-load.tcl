@@ -0,0 +1,40 @@
+# Copy RDB with ziplist encoded quicklist nodes to server path
+set server_path [tmpdir "server.convert-ziplist-quicklist-on-load"]
+set expected [list a b 7 -100 1000 [string repeat x 300] c \
+                   123456789012 [string repeat y 500] d e]
+
+exec cp -f tests/assets/list-quicklist.rdb $server_path
+start_server [list overrides [list "dir" $server_path "dbfilename" "list-quicklist.rdb"]] {
+  test "RDB load ziplist quicklist: converts the nodes to listpacks" {
+    r select 0
+
+    assert_match "*quicklist*ql_nodes:3 *" [r debug object list]
+    assert_equal 11 [r llen list]
+    assert_equal $expected [r lrange list 0 -1]
+  }
+
+  test "RDB load ziplist quicklist: the converted list survives a reload" {
+    r debug reload
+    assert_match "*quicklist*ql_nodes:3 *" [r debug object list]
+    assert_equal $expected [r lrange list 0 -1]
+  }
+}
+
+# Break the header of the first ziplist node: the load must fail.
+exec cp -f tests/assets/list-quicklist.rdb $server_path
+set fd [open [file join $server_path list-quicklist.rdb] r+]
+fconfigure $fd -translation binary
+seek $fd 20
+puts -nonewline $fd "\x00"
+close $fd
+
+set srv [start_server [list overrides [list "dir" $server_path "dbfilename" "list-quicklist.rdb"]]]
+test "RDB load ziplist quicklist: a corrupted node fails the load" {
+    wait_for_condition 50 100 {
+        [string match {*Quicklist node integrity check failed*} \
+            [exec cat [dict get $srv stdout]]]
+    } else {
+        fail "Server started even if a quicklist node was corrupted!"
+    }
+}
+kill_server $srv
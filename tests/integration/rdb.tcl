@@ -180,4 +180,102 @@ test {client freed during loading} {
         # no need to keep waiting for loading to complete
         exec kill [srv 0 pid]
     }
-}
\ No newline at end of file
+}
+start_server {} {
+    test {Child process reports its progress while saving} {
+        r debug populate 5000
+        r config set rdb-key-save-delay 500
+        r bgsave
+        wait_for_condition 50 100 {
+            [s current_save_keys_processed] > 0
+        } else {
+            fail "No progress reported by the child"
+        }
+        assert_equal 5000 [s current_save_keys_total]
+        assert {[s current_fork_perc] > 0 && [s current_fork_perc] < 100}
+        assert {[s current_fork_eta_sec] >= 0}
+        wait_for_condition 100 100 {
+            [s rdb_bgsave_in_progress] == 0
+        } else {
+            fail "bgsave did not stop in time"
+        }
+        assert_equal 0 [s current_save_keys_processed]
+        assert_equal 0 [s current_cow_size]
+    }
+}
+
+set server_path [tmpdir "server.rdb-delta-test"]
+
+start_server [list overrides [list "dir" $server_path "rdb-delta-chain-max" 2]] {
+    test {BGSAVE DELTA only saves the modified buckets} {
+        r debug populate 1000
+        r save
+        assert_equal 0 [s rdb_dirty_buckets]
+        r set key:0 changed
+        r del key:1
+        r rpush newlist a b c
+        r select 10
+        r set otherdb foo
+        r select 9
+        assert {[s rdb_dirty_buckets] > 0 && [s rdb_dirty_buckets] <= 4}
+        assert_equal {Background delta saving started} [r bgsave delta]
+        waitForBgsave r
+        assert_equal 1 [s rdb_delta_chain_len]
+        assert_equal 0 [s rdb_dirty_buckets]
+        assert {[file size $server_path/dump.rdb.delta.1] <
+                [file size $server_path/dump.rdb]/10}
+        r expire key:2 1000
+        r bgsave delta
+        waitForBgsave r
+        assert_equal 2 [s rdb_delta_chain_len]
+        set ::delta_digest [r debug digest]
+    }
+
+    test {redis-check-rdb verifies the delta chain} {
+        exec src/redis-check-rdb $server_path/dump.rdb \
+            $server_path/dump.rdb.delta.1 $server_path/dump.rdb.delta.2
+        catch {exec src/redis-check-rdb $server_path/dump.rdb \
+            $server_path/dump.rdb.delta.2} err
+        assert_match {*expected 1*} $err
+    }
+
+    test {DEBUG RELOAD NOSAVE loads the delta chain} {
+        r debug reload nosave
+        assert_equal $::delta_digest [r debug digest]
+        assert_equal 2 [s rdb_delta_chain_len]
+    }
+    # Don't save a full snapshot at shutdown, needed for the next test.
+    r config set save ""
+}
+
+start_server [list overrides [list "dir" $server_path "rdb-delta-chain-max" 2]] {
+    test {Server loads the delta chain at startup} {
+        assert_equal $::delta_digest [r debug digest]
+        assert_equal 2 [s rdb_delta_chain_len]
+        assert_equal 0 [s rdb_dirty_buckets]
+        assert_equal changed [r get key:0]
+        assert_equal 0 [r exists key:1]
+        assert {[r ttl key:2] > 0}
+    }
+
+    test {A full snapshot is saved when the delta chain is full} {
+        r set key:3 changed
+        assert_equal {Background saving started} [r bgsave delta]
+        waitForBgsave r
+        assert_equal 0 [s rdb_delta_chain_len]
+        assert {![file exists $server_path/dump.rdb.delta.1]}
+        assert {![file exists $server_path/dump.rdb.delta.2]}
+    }
+
+    test {FLUSHDB marks all the buckets as dirty} {
+        r flushdb
+        assert_equal 16384 [s rdb_dirty_buckets]
+    }
+}
+
+start_server {} {
+    test {BGSAVE DELTA is refused when deltas are disabled} {
+        catch {r bgsave delta} err
+        set err
+    } {ERR*rdb-delta-chain-max*}
+}
@@ -0,0 +1,111 @@
+# The replication stream is stored once in a buffer shared by the backlog and
+# by the output buffers of all the replicas.
+start_server {tags {"repl"}} {
+    start_server {} {
+        start_server {} {
+            start_server {} {
+                set master [srv -3 client]
+                set master_host [srv -3 host]
+                set master_port [srv -3 port]
+                set master_pid [srv -3 pid]
+                set replica1 [srv -2 client]
+                set replica1_pid [srv -2 pid]
+                set replica2 [srv -1 client]
+                set replica3 [srv 0 client]
+
+                $master config set repl-backlog-size 16384
+                $master config set client-output-buffer-limit "replica 0 0 0"
+                foreach replica [list $replica1 $replica2 $replica3] {
+                    $replica replicaof $master_host $master_port
+                    wait_for_condition 50 100 {
+                        [lindex [$replica role] 3] eq {connected}
+                    } else {
+                        fail "Replica not connected"
+                    }
+                }
+
+                test {Replicas share the replication buffer} {
+                    # Stop a replica so that the stream accumulates in its
+                    # output buffer, while the other ones keep up.
+                    exec kill -SIGSTOP $replica1_pid
+                    set val [string repeat x 1024]
+                    for {set j 0} {$j < 20000} {incr j} {
+                        $master set key:$j $val
+                    }
+                    wait_for_ofs_sync $master $replica2
+                    wait_for_ofs_sync $master $replica3
+
+                    # About 20MB of stream are buffered just once, not once
+                    # for every replica and once for the backlog.
+                    set repl_buf [s -3 mem_total_replication_buffers]
+                    assert {$repl_buf > 10*1024*1024}
+                    assert {$repl_buf < 2*20000*1024}
+                    assert {[s -3 mem_clients_slaves] < 2*20000*1024}
+
+                    # The stopped replica is the only one with pending data.
+                    set omem {}
+                    foreach line [split [$master client list type replica] "\n"] {
+                        if {[regexp {omem=([0-9]+)} $line -> m]} {
+                            lappend omem $m
+                        }
+                    }
+                    assert {[lindex [lsort -integer $omem] end] > 10*1024*1024}
+                    assert_equal 0 [lindex [lsort -integer $omem] 0]
+                }
+
+                test {Replication buffer is trimmed once the replicas catch up} {
+                    exec kill -SIGCONT $replica1_pid
+                    wait_for_ofs_sync $master $replica1
+                    wait_for_condition 50 100 {
+                        [s -3 mem_total_replication_buffers] < 100000
+                    } else {
+                        fail "Replication buffer was not trimmed"
+                    }
+                    assert {[s -3 repl_backlog_histlen] >= 16384}
+                    assert_equal [$master debug digest] [$replica1 debug digest]
+                    assert_equal [$master debug digest] [$replica3 debug digest]
+                }
+
+                test {Partial resync is served from the shared replication buffer} {
+                    set full [s -3 sync_full]
+                    set partial [s -3 sync_partial_ok]
+                    $master set before-restart 1
+                    wait_for_ofs_sync $master $replica2
+                    $master client kill type replica
+                    $master set after-restart 1
+                    wait_for_condition 50 100 {
+                        [s -3 sync_partial_ok] == $partial+3
+                    } else {
+                        fail "Replicas didn't partially resync"
+                    }
+                    foreach replica [list $replica1 $replica2 $replica3] {
+                        wait_for_ofs_sync $master $replica
+                    }
+                    assert_equal $full [s -3 sync_full]
+                    assert_equal 1 [$replica2 get after-restart]
+                    assert_equal [$master debug digest] [$replica2 debug digest]
+                }
+
+                test {Replica is disconnected when its output buffer limit is reached} {
+                    $master config set client-output-buffer-limit "replica 1mb 0 0"
+                    exec kill -SIGSTOP $replica1_pid
+                    set val [string repeat x 1024]
+                    for {set j 0} {$j < 20000} {incr j} {
+                        $master set key:$j $val
+                    }
+                    wait_for_condition 50 100 {
+                        [s -3 connected_slaves] == 2
+                    } else {
+                        fail "Replica was not disconnected"
+                    }
+                    exec kill -SIGCONT $replica1_pid
+                    wait_for_condition 50 100 {
+                        [s -3 mem_total_replication_buffers] < 100000
+                    } else {
+                        fail "Replication buffer was not trimmed"
+                    }
+                }
+            }
+        }
+    }
+}
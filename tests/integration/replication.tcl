@@ -393,6 +393,64 @@ test {slave fails full sync and diskless load swapdb recovers it} {
     }
 }
 
+test {diskless load async serves the old data set while loading} {
+    start_server {tags {"repl"}} {
+        set slave [srv 0 client]
+        start_server {} {
+            set master [srv 0 client]
+            set master_host [srv 0 host]
+            set master_port [srv 0 port]
+
+            $slave debug populate 2000 slave 10
+            $master debug populate 200 master 100000
+            $master config set rdbcompression no
+
+            $master config set repl-diskless-sync yes
+            $master config set repl-diskless-sync-delay 0
+            $slave config set repl-diskless-load async
+
+            # 10ms per key, with 200 keys is 2 seconds
+            $master config set rdb-key-save-delay 10000
+            $slave slaveof $master_host $master_port
+
+            # The replica keeps replying while loading, INFO included
+            wait_for_condition 50 100 {
+                [s -1 async_loading] eq 1
+            } else {
+                fail "Replica didn't get into async loading mode"
+            }
+            assert_equal [s -1 loading] 0
+
+            # Reads are served from the old data set, writes are refused
+            assert_equal [$slave dbsize] 2000
+            assert_match {value:0*} [$slave get slave:0]
+            assert_error {*LOADING*} {$slave config set slave-read-only no; $slave set foo bar}
+            $slave config set slave-read-only yes
+
+            # Kill the transfer: the old data set must be untouched
+            $master config set repl-diskless-sync-delay 5
+            $master config set rdb-key-save-delay 0
+            $master client kill type slave
+            wait_for_condition 50 100 {
+                [s -1 async_loading] eq 0
+            } else {
+                fail "Replica didn't disconnect"
+            }
+            assert_equal [$slave dbsize] 2000
+            assert_match {value:0*} [$slave get slave:0]
+
+            # The next sync completes and swaps in the master data set
+            wait_for_condition 100 100 {
+                [s -1 master_link_status] eq {up}
+            } else {
+                fail "Replica didn't sync"
+            }
+            assert_equal [$slave dbsize] 200
+            assert_equal [$slave debug digest] [$master debug digest]
+        }
+    }
+}
+
 test {diskless loading short read} {
     start_server {tags {"repl"}} {
         set replica [srv 0 client]
@@ -689,3 +747,284 @@ test {replicaof right after disconnection} {
         }
     }
 }
+
+foreach mdl {no yes} {
+    foreach sdl {disabled swapdb} {
+        start_server {tags {"repl"}} {
+            set master [srv 0 client]
+            set master_host [srv 0 host]
+            set master_port [srv 0 port]
+            $master config set repl-compression yes
+            $master config set repl-diskless-sync $mdl
+            $master config set repl-diskless-sync-delay 0
+            $master config set rdbcompression no
+            $master debug populate 10000 key 100
+            start_server {} {
+                set replica [srv 0 client]
+                $replica config set repl-compression yes
+                $replica config set repl-diskless-load $sdl
+
+                test "Compressed replication stream, diskless: $mdl, $sdl" {
+                    set load_handle [start_write_load $master_host $master_port 3]
+                    $replica replicaof $master_host $master_port
+                    wait_for_condition 50 100 {
+                        [s master_link_status] eq {up}
+                    } else {
+                        fail "Replica not connected"
+                    }
+                    after 1000
+                    stop_write_load $load_handle
+                    wait_for_ofs_sync $master $replica
+                    assert_equal [$master debug digest] [$replica debug digest]
+
+                    # Both sides report the compression of the link
+                    set info [$master info replication]
+                    assert {[regexp {compression_ratio=([0-9.]+)} $info - ratio]}
+                    assert {$ratio > 1}
+                    assert {[s master_link_compression_ratio] > 1}
+                }
+
+                test "Compressed replication stream, partial resync, diskless: $mdl, $sdl" {
+                    set sync_partial [s -1 sync_partial_ok]
+                    $replica client kill type master
+                    wait_for_condition 50 100 {
+                        [s master_link_status] eq {up}
+                    } else {
+                        fail "Replica not reconnected"
+                    }
+                    assert_equal [expr [s -1 sync_partial_ok]-$sync_partial] 1
+                    $master set foo [string repeat x 1000]
+                    $master incr counter
+                    wait_for_ofs_sync $master $replica
+                    assert_equal [$master debug digest] [$replica debug digest]
+                    assert_match {*compression_ratio=*} [$master info replication]
+                }
+            }
+        }
+    }
+}
+
+start_server {tags {"repl"}} {
+    set master [srv 0 client]
+    set master_host [srv 0 host]
+    set master_port [srv 0 port]
+    $master config set repl-compression yes
+    start_server {} {
+        set replica [srv 0 client]
+        test "Replication stream is not compressed if the replica doesn't ask" {
+            $replica replicaof $master_host $master_port
+            wait_for_condition 50 100 {
+                [s master_link_status] eq {up}
+            } else {
+                fail "Replica not connected"
+            }
+            $master set foo bar
+            wait_for_ofs_sync $master $replica
+            assert_equal [$replica get foo] bar
+            assert_no_match {*compression_ratio*} [$master info replication]
+            assert_no_match {*master_link_compression*} [$replica info replication]
+        }
+    }
+}
+
+foreach persist {yes no} {
+    start_server {tags {"repl"}} {
+        set master [srv 0 client]
+        set master_host [srv 0 host]
+        set master_port [srv 0 port]
+        $master config set repl-backlog-persist $persist
+        start_server {} {
+            set replica [srv 0 client]
+            test "Replica resync after a master restart, repl-backlog-persist $persist" {
+                $replica replicaof $master_host $master_port
+                wait_for_condition 50 100 {
+                    [s master_link_status] eq {up}
+                } else {
+                    fail "Replica not connected"
+                }
+                for {set j 0} {$j < 100} {incr j} {
+                    $master set key:$j [string repeat x 100]
+                }
+                wait_for_ofs_sync $master $replica
+
+                catch {$master debug restart}
+                wait_for_condition 50 100 {
+                    [catch {set master [redis $master_host $master_port]}] == 0
+                } else {
+                    fail "Master not restarted"
+                }
+                wait_for_condition 50 100 {
+                    [s master_link_status] eq {up}
+                } else {
+                    fail "Replica not reconnected"
+                }
+                if {$persist} {
+                    assert_equal [status $master sync_partial_ok] 1
+                    assert_equal [status $master sync_full] 0
+                } else {
+                    assert_equal [status $master sync_full] 1
+                }
+
+                $master incr counter
+                wait_for_ofs_sync $master $replica
+                assert_equal [$master debug digest] [$replica debug digest]
+                $master close
+            }
+        }
+    }
+}
+
+start_server {tags {"repl"}} {
+    set master [srv 0 client]
+    set master_host [srv 0 host]
+    set master_port [srv 0 port]
+    $master config set repl-diskless-sync yes
+    $master config set repl-diskless-sync-delay 0
+    $master config set repl-diskless-sync-spool yes
+    $master debug populate 1000 key 100
+    # Make the transfer last ~2 seconds.
+    $master config set rdb-key-save-delay 2000
+    start_server {} {
+        set replica1 [srv 0 client]
+        start_server {} {
+            set replica2 [srv 0 client]
+            test "Late replica attaches to the spooled diskless transfer" {
+                $replica1 replicaof $master_host $master_port
+                wait_for_condition 50 100 {
+                    [s -2 rdb_bgsave_in_progress] == 1
+                } else {
+                    fail "Diskless transfer not started"
+                }
+                $replica2 replicaof $master_host $master_port
+                wait_for_log_message -2 "*attached to the spooled RDB stream*" 10 50 100
+                $master set late foo
+
+                wait_for_condition 100 100 {
+                    [status $replica1 master_link_status] eq {up} &&
+                    [status $replica2 master_link_status] eq {up}
+                } else {
+                    fail "Replicas not synced"
+                }
+                $master config set rdb-key-save-delay 0
+                wait_for_ofs_sync $master $replica1
+                wait_for_ofs_sync $master $replica2
+                assert_equal [$master debug digest] [$replica1 debug digest]
+                assert_equal [$master debug digest] [$replica2 debug digest]
+                assert_equal [$replica2 get late] foo
+
+                # A single fork served both replicas.
+                assert_equal [s -2 sync_full] 2
+                set forks [exec grep -c "Background RDB transfer started" [srv -2 stdout]]
+                assert_equal $forks 1
+            }
+        }
+    }
+}
+
+start_server {tags {"repl"}} {
+    set master [srv 0 client]
+    set master_host [srv 0 host]
+    set master_port [srv 0 port]
+    for {set j 0} {$j < 100} {incr j} {
+        $master set user:$j $j
+        $master set other:$j $j
+    }
+    $master select 10
+    $master set user:db10 foo
+    $master select 9
+    start_server {} {
+        set replica [srv 0 client]
+        test "Filtered replica only receives the matching keys" {
+            catch {$replica config set replica-filter "foo:bar"} e
+            assert_match {*rules must be*} $e
+            # 12182 is the hash slot of "foo".
+            $replica config set replica-filter "prefix:user: slots:12182"
+            $replica replicaof $master_host $master_port
+            wait_for_condition 50 100 {
+                [s master_link_status] eq {up}
+            } else {
+                fail "Replica not connected"
+            }
+            assert_equal [$replica dbsize] 100
+            assert_equal [$replica get user:42] 42
+            assert_equal [$replica exists other:42] 0
+
+            $master set user:new 1
+            $master set other:new 1
+            $master set "{foo}:key" 1
+            $master del user:0 other:0
+            $master select 10
+            $master incr user:db10:counter
+            $master select 9
+            wait_for_condition 50 100 {
+                [$replica get "{foo}:key"] eq {1}
+            } else {
+                fail "Filtered stream not received"
+            }
+            assert_equal [$replica get user:new] 1
+            assert_equal [$replica exists other:new] 0
+            assert_equal [$replica exists user:0] 0
+            $replica select 10
+            assert_equal [$replica get user:db10] foo
+            assert_equal [$replica get user:db10:counter] 1
+            $replica select 9
+        }
+
+        test "Filtered replica resyncs when the filter changes" {
+            set fullsync [s -1 sync_full]
+            $replica config set replica-filter "prefix:other:"
+            wait_for_condition 50 100 {
+                [s -1 sync_full] == $fullsync+1 &&
+                [s master_link_status] eq {up}
+            } else {
+                fail "Replica didn't resync"
+            }
+            assert_equal [$replica dbsize] 100
+            assert_equal [$replica exists user:42] 0
+            assert_equal [$replica get other:new] 1
+        }
+    }
+}
+
+start_server {tags {"repl"}} {
+    set master [srv 0 client]
+    set master_host [srv 0 host]
+    set master_port [srv 0 port]
+    $master config set repl-backlog-size 64mb
+    start_server {} {
+        set replica [srv 0 client]
+        test "PSYNC from the middle of a backlog made of many indexed blocks" {
+            $replica replicaof $master_host $master_port
+            wait_for_condition 50 100 {
+                [s master_link_status] eq {up}
+            } else {
+                fail "Replica not connected"
+            }
+            set payload [string repeat x 1000]
+            for {set j 0} {$j < 5000} {incr j} {
+                $master set key:$j $payload
+            }
+            wait_for_ofs_sync $master $replica
+
+            # Stop the replica while the master writes more, then drop the
+            # link: the replica will ask for the data it didn't receive,
+            # that starts far from both ends of the backlog.
+            set partial [s -1 sync_partial_ok]
+            exec kill -SIGSTOP [srv 0 pid]
+            for {set j 0} {$j < 20000} {incr j} {
+                $master set other:$j $payload
+            }
+            $master client kill type slave
+            exec kill -SIGCONT [srv 0 pid]
+            wait_for_condition 50 100 {
+                [s -1 sync_partial_ok] > $partial || [s -1 sync_full] > 1
+            } else {
+                fail "Replica not reconnected"
+            }
+            assert_equal [s -1 sync_partial_ok] [expr {$partial+1}]
+            assert_equal [s -1 sync_full] 1
+            wait_for_ofs_sync $master $replica
+            assert_equal [$master debug digest] [$replica debug digest]
+        }
+    }
+}
@@ -41,9 +41,11 @@ set ::all_tests {
     integration/replication-3
     integration/replication-4
     integration/replication-psync
+    integration/replication-buffer
     integration/aof
     integration/rdb
     integration/convert-zipmap-hash-on-load
+    integration/convert-ziplist-quicklist-on-load
     integration/logging
     integration/psync2
     integration/psync2-reg
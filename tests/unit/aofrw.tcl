@@ -106,10 +106,12 @@ start_server {tags {"aofrw"} overrides {aof-use-rdb-preamble no}} {
     }
 
     foreach d {string int} {
-        foreach e {intset hashtable} {
+        foreach e {intset roaring hashtable} {
+            if {$d eq {string} && $e eq {roaring}} continue
             test "AOF rewrite of set with $e encoding, $d data" {
                 r flushall
                 if {$e eq {intset}} {set len 10} else {set len 1000}
+                if {$e eq {hashtable}} {r config set set-roaring-encoding no}
                 for {set j 0} {$j < $len} {incr j} {
                     if {$d eq {string}} {
                         set data [randstring 0 16 alpha]
@@ -121,6 +123,7 @@ start_server {tags {"aofrw"} overrides {aof-use-rdb-preamble no}} {
                 if {$d ne {string}} {
                     assert_equal [r object encoding key] $e
                 }
+                r config set set-roaring-encoding yes
                 set d1 [r debug digest]
                 r bgrewriteaof
                 waitForBgrewriteaof r
@@ -134,10 +137,10 @@ start_server {tags {"aofrw"} overrides {aof-use-rdb-preamble no}} {
     }
 
     foreach d {string int} {
-        foreach e {ziplist hashtable} {
+        foreach e {listpack hashtable} {
             test "AOF rewrite of hash with $e encoding, $d data" {
                 r flushall
-                if {$e eq {ziplist}} {set len 10} else {set len 1000}
+                if {$e eq {listpack}} {set len 10} else {set len 1000}
                 for {set j 0} {$j < $len} {incr j} {
                     if {$d eq {string}} {
                         set data [randstring 0 16 alpha]
@@ -160,10 +163,11 @@ start_server {tags {"aofrw"} overrides {aof-use-rdb-preamble no}} {
     }
 
     foreach d {string int} {
-        foreach e {ziplist skiplist} {
+        foreach e {listpack skiplist btree} {
             test "AOF rewrite of zset with $e encoding, $d data" {
                 r flushall
-                if {$e eq {ziplist}} {set len 10} else {set len 1000}
+                if {$e eq {listpack}} {set len 10} else {set len 1000}
+                if {$e eq {btree}} {r config set zset-btree-encoding yes}
                 for {set j 0} {$j < $len} {incr j} {
                     if {$d eq {string}} {
                         set data [randstring 0 16 alpha]
@@ -181,6 +185,8 @@ start_server {tags {"aofrw"} overrides {aof-use-rdb-preamble no}} {
                 if {$d1 ne $d2} {
                     error "assertion:$d1 is not equal to $d2"
                 }
+                assert_equal [r object encoding key] $e
+                r config set zset-btree-encoding no
             }
         }
     }
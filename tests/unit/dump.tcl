@@ -86,6 +86,27 @@ start_server {tags {"dump"}} {
         r dump nonexisting_key
     } {}
 
+    test {RESTORE converts ziplist encoded hashes and sorted sets to listpacks} {
+        r del h z
+        # Payloads created by DUMP when small hashes and sorted sets were
+        # encoded as ziplists.
+        r restore h 0 [binary format H* 0d191900000016000000040000026631040276310402663204f3ff0a00e23802e8c3402953]
+        r restore z 0 [binary format H* 0c181800000012000000040000016103f20201620303322e35ff0a005c571d9d946faeb7]
+        assert_encoding listpack h
+        assert_encoding listpack z
+        assert_equal {f1 v1 f2 2} [r hgetall h]
+        assert_equal {a 1 b 2.5} [r zrange z 0 -1 withscores]
+        r hset h f3 v3
+        r zadd z 3 c
+        set encoded [r dump h]
+        r del h
+        r restore h 0 $encoded
+        set encoded [r dump z]
+        r del z
+        r restore z 0 $encoded
+        list [r hgetall h] [r zrange z 0 -1 withscores]
+    } {{f1 v1 f2 2 f3 v3} {a 1 b 2.5 c 3}}
+
     test {MIGRATE is caching connections} {
         # Note, we run this as first test so that the connection cache
         # is empty.
@@ -341,6 +362,57 @@ start_server {tags {"dump"}} {
         }
     }
 
+    test {MIGRATE with multiple keys uses a single RESTORE-BATCH} {
+        set first [srv 0 client]
+        r flushdb
+        r mset a 1 b 2 c 3
+        r rpush list x y z
+        r pexpire b 100000
+        start_server {tags {"repl"}} {
+            set second [srv 0 client]
+            set second_host [srv 0 host]
+            set second_port [srv 0 port]
+
+            set ret [r -1 migrate $second_host $second_port "" 9 5000 keys a b c list]
+            assert {$ret eq {OK}}
+            assert {[$first dbsize] == 0}
+            $second select 9
+            assert {[$second mget a b c] eq {1 2 3}}
+            assert {[$second lrange list 0 -1] eq {x y z}}
+            assert {[$second pttl b] > 90000}
+            assert {[$second pttl a] == -1}
+            set stats [$second info commandstats]
+            assert_match {*cmdstat_restore-batch:calls=1,*} $stats
+            assert {![string match {*cmdstat_restore:*} $stats]}
+        }
+    }
+
+    test {MIGRATE with multiple keys falls back to RESTORE on old targets} {
+        set first [srv 0 client]
+        r flushdb
+        r mset a 1 b 2 c 3
+        start_server {tags {"repl"} overrides {rename-command {restore-batch ""}}} {
+            set second [srv 0 client]
+            set second_host [srv 0 host]
+            set second_port [srv 0 port]
+
+            set ret [r -1 migrate $second_host $second_port "" 9 5000 keys a b c]
+            assert {$ret eq {OK}}
+            assert {[$first dbsize] == 0}
+            $second select 9
+            assert {[$second mget a b c] eq {1 2 3}}
+            assert_match {*cmdstat_restore:calls=3,*} [$second info commandstats]
+        }
+    }
+
+    test {RESTORE-BATCH refuses invalid payloads} {
+        catch {r restore-batch 2 a b "not a payload"} e
+        assert_match {*payload*} $e
+        catch {r restore-batch 3 a b "not a payload"} e
+        assert_match {*Number of keys*} $e
+        assert {[r exists a b] == 0}
+    }
+
     test {MIGRATE AUTH: correct and wrong password cases} {
         set first [srv 0 client]
         r del list
@@ -98,17 +98,22 @@ start_server {tags {"scan"}} {
         assert_equal 1000 [llength $keys]
     }
 
-    foreach enc {intset hashtable} {
+    foreach enc {intset roaring listpack hashtable} {
         test "SSCAN with encoding $enc" {
             # Create the Set
             r del set
-            if {$enc eq {intset}} {
+            if {$enc eq {intset} || $enc eq {roaring}} {
                 set prefix ""
             } else {
                 set prefix "ele:"
             }
+            if {$enc eq {hashtable} || $enc eq {roaring}} {
+                set count 1000
+            } else {
+                set count 100
+            }
             set elements {}
-            for {set j 0} {$j < 100} {incr j} {
+            for {set j 0} {$j < $count} {incr j} {
                 lappend elements ${prefix}${j}
             }
             r sadd set {*}$elements
@@ -128,15 +133,15 @@ start_server {tags {"scan"}} {
             }
 
             set keys [lsort -unique $keys]
-            assert_equal 100 [llength $keys]
+            assert_equal $count [llength $keys]
         }
     }
 
-    foreach enc {ziplist hashtable} {
+    foreach enc {listpack hashtable} {
         test "HSCAN with encoding $enc" {
             # Create the Hash
             r del hash
-            if {$enc eq {ziplist}} {
+            if {$enc eq {listpack}} {
                 set count 30
             } else {
                 set count 1000
@@ -172,15 +177,16 @@ start_server {tags {"scan"}} {
         }
     }
 
-    foreach enc {ziplist skiplist} {
+    foreach enc {listpack skiplist btree} {
         test "ZSCAN with encoding $enc" {
             # Create the Sorted Set
             r del zset
-            if {$enc eq {ziplist}} {
+            if {$enc eq {listpack}} {
                 set count 30
             } else {
                 set count 1000
             }
+            r config set zset-btree-encoding [expr {$enc eq {btree} ? "yes" : "no"}]
             set elements {}
             for {set j 0} {$j < $count} {incr j} {
                 lappend elements $j key:$j
@@ -189,6 +195,7 @@ start_server {tags {"scan"}} {
 
             # Verify that the encoding matches.
             assert {[r object encoding zset] eq $enc}
+            r config set zset-btree-encoding no
 
             # Test ZSCAN
             set cur 0
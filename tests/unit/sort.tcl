@@ -39,9 +39,11 @@ start_server {
         1000 lpush quicklist "Old Linked list"
         10000 lpush quicklist "Old Big Linked list"
         16 sadd intset "Intset"
+        1000 sadd roaring "Roaring bitmap"
         1000 sadd hashtable "Hash table"
         10000 sadd hashtable "Big Hash table"
     } {
+        r config set set-roaring-encoding [expr {$enc eq {roaring} ? "yes" : "no"}]
         set result [create_random_dataset $num $cmd]
         assert_encoding $enc tosort
 
@@ -57,6 +59,7 @@ start_server {
             assert_equal $result [r sort tosort BY wobj_*->weight]
         }
     }
+    r config set set-roaring-encoding yes
 
     set result [create_random_dataset 16 lpush]
     test "SORT GET #" {
@@ -57,6 +57,35 @@ start_server {
         }
     }
 
+    foreach depth {0 1} {
+        test "Lists are saved as RDB type 18 and restored - compress depth $depth" {
+            r config set list-compress-depth $depth
+            r del l
+            set l {}
+            for {set i 0} {$i < 100} {incr i} {
+                randpath {
+                    set data [string repeat x [randomInt 1000]]
+                } {
+                    set data [randomInt 65536]
+                } {
+                    set data -[randomInt 4294967296]
+                    if {$data eq {-0}} {set data 0}
+                }
+                lappend l $data
+                r rpush l $data
+            }
+            set dump [r dump l]
+            assert_equal 18 [scan [string index $dump 0] %c]
+            r del l
+            r restore l 0 $dump
+            assert_equal $l [r lrange l 0 -1]
+            r debug reload
+            assert_encoding quicklist l
+            assert_equal $l [r lrange l 0 -1]
+        }
+    }
+    r config set list-compress-depth 0
+
     tags {slow} {
         test {ziplist implementation: value encoding and backlink} {
             if {$::accurate} {set iterations 100} else {set iterations 10}
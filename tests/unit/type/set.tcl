@@ -2,6 +2,8 @@ start_server {
     tags {"set"}
     overrides {
         "set-max-intset-entries" 512
+        "set-max-listpack-entries" 0
+        "set-roaring-encoding" no
     }
 } {
     proc create_set {key entries} {
@@ -279,6 +281,99 @@ start_server {
         assert_equal 0 [r exists setres]
     }
 
+    test "SINTERCARD basics" {
+        r del set1 set2 set3
+        r sadd set1 a b c d e
+        r sadd set2 b c d e f
+        r sadd set3 c d e f g
+        assert_equal 4 [r sintercard 2 set1 set2]
+        assert_equal 3 [r sintercard 3 set1 set2 set3]
+        assert_equal 5 [r sintercard 1 set1]
+        assert_equal 3 [r sintercard 3 set1 set2 set3 limit 0]
+        assert_equal 2 [r sintercard 3 set1 set2 set3 limit 2]
+        assert_equal 3 [r sintercard 3 set1 set2 set3 LIMIT 10]
+        assert_equal 0 [r sintercard 2 set1 nosuchkey]
+    }
+
+    test "SINTERCARD with intsets" {
+        r del set1 set2
+        r sadd set1 1 2 3 4 5
+        r sadd set2 3 4 5 6 7
+        assert_encoding intset set1
+        assert_equal 3 [r sintercard 2 set1 set2]
+        assert_equal 1 [r sintercard 2 set1 set2 limit 1]
+        assert_equal 5 [r sintercard 2 set1 set1]
+        assert_equal 2 [r sintercard 2 set1 set1 limit 2]
+
+        # Only the last intersection may stop at the limit.
+        r del set3
+        r sadd set3 5 6 7
+        assert_equal 1 [r sintercard 3 set1 set2 set3 limit 2]
+        assert_equal 2 [r sintercard 3 set2 set3 set2 limit 2]
+    }
+
+    test "SINTERCARD errors" {
+        r del set1
+        r sadd set1 a
+        assert_error "*numkeys*greater than 0*" {r sintercard 0 set1}
+        assert_error "*not an integer*" {r sintercard a set1}
+        assert_error "*Number of keys*" {r sintercard 2 set1}
+        assert_error "*LIMIT can't be negative*" {r sintercard 1 set1 limit -1}
+        assert_error "*not an integer*" {r sintercard 1 set1 limit x}
+        assert_error "*syntax*" {r sintercard 1 set1 foo}
+        assert_error "*syntax*" {r sintercard 1 set1 limit}
+        r set key1 x
+        assert_error "WRONGTYPE*" {r sintercard 2 set1 key1}
+    }
+
+    test "COMMAND GETKEYS SINTERCARD" {
+        assert_equal {key1 key2} [r command getkeys sintercard 2 key1 key2 limit 10]
+    }
+
+    test "SINTER / SINTERSTORE with intsets of very different sizes" {
+        set max [lindex [r config get set-max-intset-entries] 1]
+        r config set set-max-intset-entries 100000
+        foreach {len1 len2} {3 20000 50 20000 5000 6000 20000 20000} {
+            r del set1 set2 setres
+            unset -nocomplain s1
+            array set s1 {}
+            for {set j 0} {$j < $len1} {incr j} {
+                set v [randomInt 40000]
+                set s1($v) {}
+                r sadd set1 $v
+            }
+            set expected {}
+            for {set j 0} {$j < $len2} {incr j} {
+                set v [expr {$j*2}]
+                r sadd set2 $v
+                if {[info exists s1($v)]} {lappend expected $v}
+            }
+            assert_encoding intset set1
+            assert_encoding intset set2
+            set expected [lsort -integer $expected]
+            assert_equal $expected [lsort -integer [r sinter set1 set2]]
+            assert_equal $expected [lsort -integer [r sinter set2 set1]]
+            assert_equal [llength $expected] [r sintercard 2 set2 set1]
+            assert_equal [llength $expected] [r sinterstore setres set1 set2]
+            assert_equal $expected [lsort -integer [r smembers setres]]
+        }
+        r config set set-max-intset-entries $max
+    }
+
+    test "SINTERSTORE of intsets converts a large result to hashtable" {
+        set max [lindex [r config get set-max-intset-entries] 1]
+        r config set set-max-intset-entries 100000
+        r del set1 set2 setres
+        for {set j 0} {$j < 1000} {incr j} {
+            r sadd set1 $j
+            r sadd set2 $j
+        }
+        r config set set-max-intset-entries 100
+        assert_equal 1000 [r sinterstore setres set1 set2]
+        assert_encoding hashtable setres
+        r config set set-max-intset-entries $max
+    }
+
     test "SUNIONSTORE against non existing keys should delete dstkey" {
         r set setres xxx
         assert_equal 0 [r sunionstore setres foo111 bar222]
@@ -599,3 +694,449 @@ start_server {
         }
     }
 }
+
+start_server {
+    tags {"set"}
+    overrides {
+        "set-max-intset-entries" 512
+        "set-max-listpack-entries" 128
+        "set-max-listpack-value" 32
+        "set-roaring-encoding" no
+    }
+} {
+    proc create_set {key entries} {
+        r del $key
+        foreach entry $entries { r sadd $key $entry }
+    }
+
+    test {SADD, SCARD, SISMEMBER, SMEMBERS basics - listpack} {
+        create_set myset {foo}
+        assert_encoding listpack myset
+        assert_equal 2 [r sadd myset bar 17]
+        assert_equal 0 [r sadd myset bar 17]
+        assert_equal 3 [r scard myset]
+        assert_equal 1 [r sismember myset foo]
+        assert_equal 1 [r sismember myset 17]
+        assert_equal 0 [r sismember myset bla]
+        assert_equal 0 [r sismember myset 18]
+        assert_equal {17 bar foo} [lsort [r smembers myset]]
+    }
+
+    test "SADD a non-integer against an intset - listpack" {
+        create_set myset {1 2 3}
+        assert_encoding intset myset
+        assert_equal 1 [r sadd myset a]
+        assert_encoding listpack myset
+        assert_equal 0 [r sadd myset 2]
+        assert_equal {1 2 3 a} [lsort [r smembers myset]]
+    }
+
+    test "Listpack set is converted when thresholds are exceeded" {
+        create_set myset {a b c}
+        r sadd myset [string repeat x 33]
+        assert_encoding hashtable myset
+
+        r del myset
+        for {set i 0} {$i < 128} {incr i} { r sadd myset "e$i" }
+        assert_encoding listpack myset
+        r sadd myset e128
+        assert_encoding hashtable myset
+        assert_equal 129 [r scard myset]
+
+        # An intset too large to become a listpack is converted to hashtable.
+        r del myset
+        for {set i 0} {$i < 200} {incr i} { r sadd myset $i }
+        r sadd myset a
+        assert_encoding hashtable myset
+    }
+
+    test "SREM basics - listpack" {
+        create_set myset {foo bar ciao 5}
+        assert_encoding listpack myset
+        assert_equal 0 [r srem myset qux]
+        assert_equal 1 [r srem myset foo]
+        assert_equal 1 [r srem myset 5]
+        assert_equal {bar ciao} [lsort [r smembers myset]]
+        assert_equal 2 [r srem myset bar ciao]
+        assert_equal 0 [r exists myset]
+    }
+
+    test "Listpack set encoding after DEBUG RELOAD" {
+        create_set myset {a b c 1 2 3}
+        create_set mybigset {}
+        for {set i 0} {$i < 100} {incr i} { r sadd mybigset "e$i" }
+        r debug reload
+        assert_encoding listpack myset
+        assert_encoding listpack mybigset
+        assert_equal {1 2 3 a b c} [lsort [r smembers myset]]
+        assert_equal 100 [r scard mybigset]
+
+        # Sets saved as listpacks are converted on load when too big.
+        r config set set-max-listpack-entries 50
+        r debug reload
+        assert_encoding hashtable mybigset
+        assert_equal 100 [r scard mybigset]
+        r config set set-max-listpack-entries 128
+    }
+
+    test "Listpack set DUMP / RESTORE and AOF rewrite" {
+        create_set myset {a b c 1 2 3}
+        set encoded [r dump myset]
+        r del myset
+        r restore myset 0 $encoded
+        assert_encoding listpack myset
+        assert_equal {1 2 3 a b c} [lsort [r smembers myset]]
+        r config set appendonly yes
+        waitForBgrewriteaof r
+        r debug loadaof
+        assert_encoding listpack myset
+        assert_equal {1 2 3 a b c} [lsort [r smembers myset]]
+        r config set appendonly no
+    }
+
+    test "SINTER / SUNION / SDIFF with listpack sets" {
+        create_set set1 {a b c 1 2}
+        create_set set2 {b c d 2 3}
+        create_set set3 {1 2 3}
+        assert_encoding listpack set1
+        assert_encoding intset set3
+        assert_equal {2 b c} [lsort [r sinter set1 set2]]
+        assert_equal {2} [lsort [r sinter set1 set2 set3]]
+        assert_equal {1 2 3 a b c d} [lsort [r sunion set1 set2]]
+        assert_equal {1 a} [lsort [r sdiff set1 set2]]
+        assert_equal {3 d} [lsort [r sdiff set2 set1]]
+        assert_equal 3 [r sinterstore setres set1 set2]
+        assert_encoding listpack setres
+        assert_equal 7 [r sunionstore setres set1 set2]
+        assert_encoding listpack setres
+        assert_equal {2} [lsort [r sinter set3 set2 set1]]
+    }
+
+    test "ZUNIONSTORE / ZINTERSTORE with listpack sets" {
+        create_set set1 {a b c 1 2}
+        create_set set2 {b c d 2 3}
+        r zunionstore zres 2 set1 set2
+        assert_equal {1 1 3 1 a 1 d 1 2 2 b 2 c 2} [r zrange zres 0 -1 withscores]
+        r zinterstore zres 2 set1 set2
+        assert_equal {2 2 b 2 c 2} [r zrange zres 0 -1 withscores]
+    }
+
+    foreach {contents} {
+        {a b c}
+        {a b c d e f g h i j k l m n o p q r s t u v w x y z}
+    } {
+        test "SPOP and SRANDMEMBER - listpack [llength $contents] elements" {
+            create_set myset $contents
+            assert_encoding listpack myset
+            unset -nocomplain seen
+            for {set i 0} {$i < 1000} {incr i} {
+                set seen([r srandmember myset]) 1
+            }
+            assert_equal $contents [lsort [array names seen]]
+            foreach count [list -10 2 [llength $contents]] {
+                foreach ele [r srandmember myset $count] {
+                    assert {[lsearch $contents $ele] != -1}
+                }
+            }
+            assert_equal $contents [lsort [concat [r spop myset 2] [r spop myset 1] [r spop myset 100]]]
+            assert_equal 0 [r exists myset]
+            create_set myset $contents
+            set popped {}
+            while {[r scard myset]} { lappend popped [r spop myset] }
+            assert_equal $contents [lsort $popped]
+        }
+    }
+
+    test "SMOVE from and to listpack sets" {
+        create_set myset1 {a b 1}
+        create_set myset2 {2 3}
+        assert_equal 1 [r smove myset1 myset2 a]
+        assert_encoding listpack myset2
+        assert_equal 1 [r smove myset2 myset3 a]
+        assert_encoding listpack myset3
+        assert_equal {1 b} [lsort [r smembers myset1]]
+        assert_equal {2 3} [lsort [r smembers myset2]]
+    }
+
+    test "SSCAN with listpack sets" {
+        create_set myset {a b c 1 2 3}
+        set res [r sscan myset 0 count 1]
+        assert_equal 0 [lindex $res 0]
+        assert_equal {1 2 3 a b c} [lsort [lindex $res 1]]
+        assert_equal {a} [lindex [r sscan myset 0 match a] 1]
+    }
+
+    test "Small string sets use less memory as listpacks" {
+        set tags {redis database cache nosql fast}
+        create_set lpset $tags
+        assert_encoding listpack lpset
+        r config set set-max-listpack-entries 0
+        create_set htset $tags
+        assert_encoding hashtable htset
+        r config set set-max-listpack-entries 128
+        set lpmem [r memory usage lpset]
+        set htmem [r memory usage htset]
+        assert {$lpmem*3 < $htmem}
+    }
+
+    test "Listpack sets stress testing" {
+        for {set j 0} {$j < 20} {incr j} {
+            unset -nocomplain s
+            array set s {}
+            r del s
+            # Start with a string member, otherwise a set made only of
+            # random integers would stay intset encoded.
+            set s(foo) {}
+            r sadd s foo
+            set len [randomInt 128]
+            for {set i 0} {$i < $len} {incr i} {
+                randpath {
+                    set data [randomInt 1000]
+                } {
+                    set data [randstring 0 32 alpha]
+                }
+                set s($data) {}
+                r sadd s $data
+            }
+            assert_encoding listpack s
+            assert_equal [lsort [r smembers s]] [lsort [array names s]]
+            foreach e [array names s] {
+                if {[randomInt 2]} {
+                    assert_equal 1 [r srem s $e]
+                    unset s($e)
+                }
+            }
+            assert_equal [lsort [r smembers s]] [lsort [array names s]]
+        }
+    }
+}
+
+start_server {
+    tags {"set"}
+    overrides {
+        "set-max-intset-entries" 512
+        "set-max-listpack-entries" 0
+        "set-roaring-encoding" yes
+    }
+} {
+    # 生成count个随机整数，覆盖负数、64位的边界值以及位图和数组两种container
+    proc create_roaring_set {key count} {
+        r del $key
+        set res {}
+        for {set j 0} {$j < $count} {incr j} {
+            randpath {
+                set v [randomInt 100000]
+            } {
+                set v [expr {-[randomInt 200000]}]
+            } {
+                set v [expr {[randomInt 1000000]*65536+[randomInt 65536]}]
+            }
+            lappend res $v
+        }
+        lappend res 9223372036854775807 -9223372036854775808
+        r sadd $key {*}$res
+        lsort -integer -unique $res
+    }
+
+    proc tcl_setop {op a b} {
+        foreach e $b {set inb($e) 1}
+        set res {}
+        foreach e $a {
+            if {$op eq {inter} && [info exists inb($e)]} {lappend res $e}
+            if {$op eq {diff} && ![info exists inb($e)]} {lappend res $e}
+        }
+        if {$op eq {union}} {set res [concat $a $b]}
+        lsort -integer -unique $res
+    }
+
+    test "SADD overflows the maximum allowed integers in an intset - roaring" {
+        r del myset
+        for {set i 0} {$i < 512} {incr i} { r sadd myset $i }
+        assert_encoding intset myset
+        assert_equal 1 [r sadd myset 512]
+        assert_encoding roaring myset
+        assert_equal 513 [r scard myset]
+        assert_equal 1 [r sismember myset 300]
+        assert_equal 0 [r sismember myset 513]
+    }
+
+    test "SADD a non-integer against a roaring set" {
+        r del myset
+        for {set i 0} {$i < 1000} {incr i} { r sadd myset $i }
+        assert_encoding roaring myset
+        assert_equal 1 [r sadd myset a]
+        assert_encoding hashtable myset
+        assert_equal 1001 [r scard myset]
+        assert_equal 1 [r sismember myset 999]
+    }
+
+    test "Sets of random 32 bit integers stay roaring encoded" {
+        r del myset
+        set vals {}
+        for {set i 0} {$i < 20000} {incr i} {
+            lappend vals [randomInt 4294967296]
+        }
+        for {set i 0} {$i < 20000} {incr i 1000} {
+            r sadd myset {*}[lrange $vals $i [expr {$i+999}]]
+        }
+        assert_encoding roaring myset
+        r debug reload
+        assert_encoding roaring myset
+    }
+
+    test "Large sparse integer sets are converted to hashtable" {
+        r del myset
+        for {set i 0} {$i < 1000} {incr i} { r sadd myset $i }
+        assert_encoding roaring myset
+        set vals {}
+        for {set i 1} {$i <= 70000} {incr i} { lappend vals [expr {$i*65536}] }
+        r sadd myset {*}[lrange $vals 0 59999]
+        assert_encoding roaring myset
+        r sadd myset {*}[lrange $vals 60000 end]
+        assert_encoding hashtable myset
+        assert_equal 71000 [r scard myset]
+        assert_equal 1 [r sismember myset 65536000]
+    }
+
+    test "SREM and SPOP against a roaring set" {
+        set vals [create_roaring_set myset 2000]
+        assert_encoding roaring myset
+        assert_equal 1 [r srem myset [lindex $vals 0]]
+        assert_equal 0 [r srem myset [lindex $vals 0]]
+        set vals [lrange $vals 1 end]
+        set popped [r spop myset 10]
+        assert_equal 10 [llength $popped]
+        foreach e $popped {
+            assert {[lsearch -exact $vals $e] != -1}
+            assert_equal 0 [r sismember myset $e]
+        }
+        assert_equal [expr {[llength $vals]-10}] [r scard myset]
+        set rand [r srandmember myset]
+        assert_equal 1 [r sismember myset $rand]
+    }
+
+    test "A roaring set shrinking below the intset limit is stored as intset" {
+        r del myset
+        for {set i 0} {$i < 1000} {incr i} { r sadd myset $i }
+        r sadd other 1 2 3
+        r sinterstore res myset other
+        assert_encoding intset res
+        assert_equal {1 2 3} [lsort -integer [r smembers res]]
+    }
+
+    test "SINTER / SUNION / SDIFF against roaring sets" {
+        for {set j 0} {$j < 5} {incr j} {
+            set a [create_roaring_set seta [expr {1000+[randomInt 8000]}]]
+            set b [create_roaring_set setb [expr {1000+[randomInt 8000]}]]
+            assert_encoding roaring seta
+            assert_encoding roaring setb
+            foreach op {inter union diff} {
+                set expected [tcl_setop $op $a $b]
+                assert_equal $expected [lsort -integer [r s$op seta setb]]
+                assert_equal [llength $expected] [r s${op}store res seta setb]
+                assert_equal $expected [lsort -integer [r smembers res]]
+            }
+            set card [llength [tcl_setop inter $a $b]]
+            assert_equal $card [r sintercard 2 seta setb]
+            assert_equal [expr {min($card,10)}] \
+                [r sintercard 2 seta setb limit 10]
+            assert_equal [expr {min($card,10)}] \
+                [r sintercard 3 seta setb seta limit 10]
+        }
+    }
+
+    test "SINTER / SUNION / SDIFF mixing roaring sets and intsets" {
+        set a [create_roaring_set seta 5000]
+        set b [lrange $a 0 99]
+        lappend b 7 -7
+        r del setb
+        r sadd setb {*}$b
+        assert_encoding intset setb
+        foreach op {inter union diff} {
+            assert_equal [tcl_setop $op $a $b] [lsort -integer [r s$op seta setb]]
+            assert_equal [tcl_setop $op $b $a] [lsort -integer [r s$op setb seta]]
+        }
+    }
+
+    test "SINTER / SUNION between roaring and hashtable sets" {
+        set a [create_roaring_set seta 2000]
+        r del setb
+        r sadd setb foo {*}[lrange $a 0 9]
+        assert_encoding hashtable setb
+        assert_equal [lsort [lrange $a 0 9]] [lsort [r sinter seta setb]]
+        assert_equal [expr {[llength $a]+1}] [r sunionstore res seta setb]
+        assert_equal {foo} [r sdiff setb seta]
+    }
+
+    test "SSCAN returns every element of a roaring set" {
+        set vals [create_roaring_set myset 10000]
+        assert_encoding roaring myset
+        set cur 0
+        set keys {}
+        while 1 {
+            set res [r sscan myset $cur count 100]
+            set cur [lindex $res 0]
+            lappend keys {*}[lindex $res 1]
+            if {$cur == 0} break
+        }
+        assert_equal $vals [lsort -integer -unique $keys]
+    }
+
+    test "Roaring sets are persisted by RDB, DUMP/RESTORE and AOF rewrite" {
+        set vals [create_roaring_set myset 10000]
+        set digest [r debug digest]
+        r debug reload
+        assert_encoding roaring myset
+        assert_equal $digest [r debug digest]
+        assert_equal $vals [lsort -integer [r smembers myset]]
+
+        set dump [r dump myset]
+        r del myset
+        r restore myset 0 $dump
+        assert_encoding roaring myset
+        assert_equal $vals [lsort -integer [r smembers myset]]
+
+        r config set appendonly yes
+        waitForBgrewriteaof r
+        r bgrewriteaof
+        waitForBgrewriteaof r
+        r debug loadaof
+        r config set appendonly no
+        assert_encoding roaring myset
+        assert_equal $digest [r debug digest]
+    }
+
+    test "Dense integer sets use less memory as roaring bitmaps" {
+        r del rset hset
+        for {set i 0} {$i < 20000} {incr i 1000} {
+            set batch {}
+            for {set j $i} {$j < $i+1000} {incr j} { lappend batch $j }
+            r sadd rset {*}$batch
+        }
+        assert_encoding roaring rset
+        r config set set-roaring-encoding no
+        r sunionstore hset rset
+        assert_encoding hashtable hset
+        r config set set-roaring-encoding yes
+        assert {[r memory usage rset]*20 < [r memory usage hset]}
+    }
+
+    test "Roaring set stress testing" {
+        for {set j 0} {$j < 10} {incr j} {
+            unset -nocomplain s
+            array set s {}
+            set vals [create_roaring_set s [expr {600+[randomInt 3000]}]]
+            foreach e $vals {set s($e) {}}
+            assert_encoding roaring s
+            foreach e $vals {
+                if {[randomInt 2]} {
+                    assert_equal 1 [r srem s $e]
+                    unset s($e)
+                }
+            }
+            assert_equal [lsort -integer [array names s]] \
+                [lsort -integer [r smembers s]]
+            assert_equal [array size s] [r scard s]
+        }
+    }
+}
@@ -7,12 +7,19 @@ start_server {tags {"zset"}} {
     }
 
     proc basics {encoding} {
-        if {$encoding == "ziplist"} {
-            r config set zset-max-ziplist-entries 128
-            r config set zset-max-ziplist-value 64
+        if {$encoding == "listpack"} {
+            r config set zset-max-listpack-entries 128
+            r config set zset-max-listpack-value 64
+            r config set zset-btree-encoding no
         } elseif {$encoding == "skiplist"} {
+            # The old ziplist names are aliases of the listpack ones.
             r config set zset-max-ziplist-entries 0
             r config set zset-max-ziplist-value 0
+            r config set zset-btree-encoding no
+        } elseif {$encoding == "btree"} {
+            r config set zset-max-listpack-entries 0
+            r config set zset-max-listpack-value 0
+            r config set zset-btree-encoding yes
         } else {
             puts "Unknown sorted set encoding"
             exit
@@ -629,6 +636,55 @@ start_server {tags {"zset"}} {
             assert_equal {b 2 c 3} [r zrange zsetc 0 -1 withscores]
         }
 
+        test "ZUNION/ZINTER/ZDIFF reply without storing - $encoding" {
+            r del zsetc
+            set dbsize [r dbsize]
+            assert_equal {a b d c} [r zunion 2 zseta zsetb]
+            assert_equal {a 2 b 7 d 9 c 12} \
+                [r zunion 2 zseta zsetb weights 2 3 withscores]
+            assert_equal {b 1 c 2} \
+                [r zinter 2 zseta zsetb aggregate min withscores]
+            assert_equal {a 1} [r zdiff 2 zseta zsetb withscores]
+            assert_equal {d 3} [r zdiff 2 zsetb zseta withscores]
+            assert_equal {} [r zdiff 2 zseta zseta]
+            assert_equal {a b c} [r zdiff 2 zseta nokey]
+            assert_equal {} [r zunion 2 nokey1 nokey2]
+            assert_equal $dbsize [r dbsize]
+            assert_equal 0 [r exists zsetc]
+        }
+
+        test "ZUNION/ZINTER/ZDIFF with LIMIT - $encoding" {
+            assert_equal {b 3 d 3} [r zunion 2 zseta zsetb withscores limit 1 2]
+            assert_equal {d c} [r zunion 2 zseta zsetb limit 2 -1]
+            assert_equal {} [r zunion 2 zseta zsetb limit 4 10]
+            assert_equal {} [r zunion 2 zseta zsetb limit 0 0]
+            assert_equal {} [r zunion 2 zseta zsetb limit -1 10]
+            assert_equal {c} [r zinter 2 zseta zsetb limit 1 10]
+            assert_equal {d} [r zdiff 2 zsetb seta limit 0 1]
+        }
+
+        test "ZDIFFSTORE basics - $encoding" {
+            assert_equal 1 [r zdiffstore zsetc 2 zseta zsetb]
+            assert_equal {a 1} [r zrange zsetc 0 -1 withscores]
+            assert_equal 1 [r zdiffstore zsetc 2 zsetb seta]
+            assert_equal {d 3} [r zrange zsetc 0 -1 withscores]
+            assert_equal 0 [r zdiffstore zsetc 2 zseta zseta]
+            assert_equal 0 [r exists zsetc]
+        }
+
+        test "ZUNION/ZINTER/ZDIFF option errors - $encoding" {
+            assert_error "*syntax*" {r zdiff 2 zseta zsetb weights 1 2}
+            assert_error "*syntax*" {r zdiff 2 zseta zsetb aggregate min}
+            assert_error "*syntax*" {r zunionstore zsetc 2 zseta zsetb withscores}
+            assert_error "*syntax*" {r zinterstore zsetc 2 zseta zsetb limit 0 1}
+            assert_error "*not an integer*" {r zunion 2 zseta zsetb limit a 1}
+            assert_error "*at least 1 input key*" {r zunion 0 zseta}
+            assert_error "*syntax*" {r zinter 3 zseta zsetb}
+            r set foo bar
+            assert_error "*WRONGTYPE*" {r zunion 2 zseta foo}
+            r del foo
+        }
+
         foreach cmd {ZUNIONSTORE ZINTERSTORE} {
             test "$cmd with +inf/-inf scores - $encoding" {
                 r del zsetinf1 zsetinf2
@@ -735,8 +791,10 @@ start_server {tags {"zset"}} {
         }
     }
 
-    basics ziplist
+    basics listpack
     basics skiplist
+    basics btree
+    r config set zset-btree-encoding no
 
     test {ZINTERSTORE regression with two sets, intset+hashtable} {
         r del seta setb setc
@@ -751,7 +809,7 @@ start_server {tags {"zset"}} {
         r zrange out 0 -1 withscores
     } {neginf 0}
 
-    test {ZINTERSTORE #516 regression, mixed sets and ziplist zsets} {
+    test {ZINTERSTORE #516 regression, mixed sets and listpack zsets} {
         r sadd one 100 101 102 103
         r sadd two 100 200 201 202
         r zadd three 1 500 1 501 1 502 1 503 1 100
@@ -781,19 +839,56 @@ start_server {tags {"zset"}} {
         }
     }
 
+    test {ZUNION of small inputs matches the union of large inputs} {
+        # Inputs encoded as listpacks take a path that doesn't use a dict:
+        # the result must be the same as with skiplist encoded inputs.
+        r del a1 a2 a3 b1 b2 b3 s
+        r config set zset-max-listpack-entries 128
+        r config set zset-max-listpack-value 64
+        foreach key {a1 a2 a3} {
+            for {set j 0} {$j < 100} {incr j} {
+                set score [expr {[randomInt 1000]/10.0}]
+                set ele [randomInt 200]
+                r zadd $key $score $ele
+                r zadd [string map {a b} $key] $score $ele
+            }
+        }
+        r sadd s x y 1 2
+        r config set zset-max-listpack-entries 0
+        foreach key {b1 b2} {r zunionstore $key 1 $key}
+        r config set zset-max-listpack-entries 128
+        assert_encoding listpack a1
+        assert_encoding skiplist b1
+        foreach aggr {sum min max} {
+            assert_equal \
+                [r zunion 4 b1 b2 b3 s weights 1 2 3 4 aggregate $aggr withscores] \
+                [r zunion 4 a1 a2 a3 s weights 1 2 3 4 aggregate $aggr withscores]
+        }
+        assert_equal [r zunionstore b 4 b1 b2 b3 s] [r zunionstore a 4 a1 a2 a3 s]
+        assert_encoding skiplist b
+        assert_equal [r zrange a 0 -1 withscores] [r zrange b 0 -1 withscores]
+    }
+
     test "ZSET commands don't accept the empty strings as valid score" {
         assert_error "*not*float*" {r zadd myzset "" abc}
     }
 
     proc stressers {encoding} {
-        if {$encoding == "ziplist"} {
+        if {$encoding == "listpack"} {
             # Little extra to allow proper fuzzing in the sorting stresser
-            r config set zset-max-ziplist-entries 256
-            r config set zset-max-ziplist-value 64
+            r config set zset-max-listpack-entries 256
+            r config set zset-max-listpack-value 64
             set elements 128
+            r config set zset-btree-encoding no
         } elseif {$encoding == "skiplist"} {
-            r config set zset-max-ziplist-entries 0
-            r config set zset-max-ziplist-value 0
+            r config set zset-max-listpack-entries 0
+            r config set zset-max-listpack-value 0
+            r config set zset-btree-encoding no
+            if {$::accurate} {set elements 1000} else {set elements 100}
+        } elseif {$encoding == "btree"} {
+            r config set zset-max-listpack-entries 0
+            r config set zset-max-listpack-value 0
+            r config set zset-btree-encoding yes
             if {$::accurate} {set elements 1000} else {set elements 100}
         } else {
             puts "Unknown sorted set encoding"
@@ -1198,13 +1293,69 @@ start_server {tags {"zset"}} {
     }
 
     tags {"slow"} {
-        stressers ziplist
+        stressers listpack
         stressers skiplist
+        stressers btree
+        r config set zset-btree-encoding no
+    }
+
+    test {ZSET btree and skiplist encodings agree on large sorted sets} {
+        r config set zset-max-listpack-entries 0
+        r del zsl zbt
+        foreach key {zsl zbt} btree {no yes} {
+            r config set zset-btree-encoding $btree
+            r zadd $key 0 placeholder
+        }
+        assert_encoding skiplist zsl
+        assert_encoding btree zbt
+
+        # Enough elements for a B+tree with a few levels, plus deletions and
+        # score updates so that nodes get split, merged and rebalanced.
+        for {set j 0} {$j < 20000} {incr j} {
+            set ele ele-[randomInt 10000]
+            set score [randomInt 1000]
+            switch [randomInt 4] {
+                0 {
+                    r zrem zsl $ele
+                    r zrem zbt $ele
+                }
+                1 {
+                    r zincrby zsl $score $ele
+                    r zincrby zbt $score $ele
+                }
+                default {
+                    r zadd zsl $score $ele
+                    r zadd zbt $score $ele
+                }
+            }
+        }
+        r zremrangebyrank zsl 100 1999
+        r zremrangebyrank zbt 100 1999
+        r zremrangebyscore zsl 300 (400
+        r zremrangebyscore zbt 300 (400
+
+        assert_equal [r zcard zsl] [r zcard zbt]
+        assert_equal [r zrange zsl 0 -1 withscores] [r zrange zbt 0 -1 withscores]
+        assert_equal [r zrevrange zsl 10 500] [r zrevrange zbt 10 500]
+        assert_equal [r zrangebyscore zsl 100 (700 limit 50 200] \
+                     [r zrangebyscore zbt 100 (700 limit 50 200]
+        assert_equal [r zrevrangebyscore zsl 900 200 limit 30 100] \
+                     [r zrevrangebyscore zbt 900 200 limit 30 100]
+        assert_equal [r zcount zsl 200 (600] [r zcount zbt 200 (600]
+        for {set j 0} {$j < 100} {incr j} {
+            set ele ele-[randomInt 10000]
+            assert_equal [r zrank zsl $ele] [r zrank zbt $ele]
+            assert_equal [r zrevrank zsl $ele] [r zrevrank zbt $ele]
+            assert_equal [r zscore zsl $ele] [r zscore zbt $ele]
+        }
+        assert_equal [r debug digest-value zsl] [r debug digest-value zbt]
+        r config set zset-btree-encoding no
+        r config set zset-max-listpack-entries 128
     }
 
     test {ZSET skiplist order consistency when elements are moved} {
-        set original_max [lindex [r config get zset-max-ziplist-entries] 1]
-        r config set zset-max-ziplist-entries 0
+        set original_max [lindex [r config get zset-max-listpack-entries] 1]
+        r config set zset-max-listpack-entries 0
         for {set times 0} {$times < 10} {incr times} {
             r del zset
             for {set j 0} {$j < 1000} {incr j} {
@@ -1225,6 +1376,6 @@ start_server {tags {"zset"}} {
                 set prev_score $score
             }
         }
-        r config set zset-max-ziplist-entries $original_max
+        r config set zset-max-listpack-entries $original_max
     }
 }
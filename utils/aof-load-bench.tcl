@@ -0,0 +1,101 @@
+#!/usr/bin/env tclsh8.5
+# Released under the BSD license like Redis itself
+#
+# Compare the time needed to replay the same AOF file with aof-fast-load
+# disabled (commands parsed by the main thread) and enabled (commands parsed
+# by a background thread).
+#
+# Usage: cd utils; ./aof-load-bench.tcl [--requests <count>] [--datasize <bytes>]
+#                                       [--runs <count>]
+
+source ../tests/support/redis.tcl
+set ::port 12124
+set ::tests {SET,LPUSH,SADD,INCR,HSET}
+set ::datasize 32
+set ::requests 1000000
+set ::runs 3
+set ::dir /tmp/redis-aof-load-bench
+
+proc start-server {} {
+    file delete -force $::dir
+    file mkdir $::dir
+    set conf "port $::port\ndir $::dir\nappendonly yes\n"
+    append conf "aof-use-rdb-preamble no\nauto-aof-rewrite-percentage 0\n"
+    append conf "loglevel warning\n"
+    set pids [exec echo $conf | ../src/redis-server - > /dev/null 2> /dev/null &]
+    after 1000
+    return $pids
+}
+
+proc load-time {r fast} {
+    $r config set aof-fast-load $fast
+    set start [clock milliseconds]
+    $r debug loadaof
+    return [expr {[clock milliseconds]-$start}]
+}
+
+proc main {} {
+    set pids [start-server]
+    set r [redis 127.0.0.1 $::port]
+
+    puts "Populating the AOF with $::requests requests per test..."
+    exec ../src/redis-benchmark -p $::port -n $::requests -t $::tests \
+        -d $::datasize -r 1000000 -P 64 -q > /dev/null
+    set size [file size [file join $::dir appendonly.aof]]
+    set digest [$r debug digest]
+    puts "AOF size: [expr {$size/1024/1024}] MB, [$r dbsize] keys"
+
+    foreach fast {no yes} {
+        set best 0
+        for {set j 0} {$j < $::runs} {incr j} {
+            set ms [load-time $r $fast]
+            if {$best == 0 || $ms < $best} {set best $ms}
+            if {[$r debug digest] ne $digest} {
+                puts "Dataset mismatch after loading with aof-fast-load $fast"
+                exit 1
+            }
+        }
+        puts [format "aof-fast-load %-3s %8d ms %10.2f MB/s" $fast $best \
+            [expr {($size/1048576.0)/($best/1000.0)}]]
+    }
+
+    $r close
+    catch {exec kill -9 [lindex $pids 0]}
+    catch {exec kill -9 [lindex $pids 1]}
+    file delete -force $::dir
+}
+
+# Force the user to run the script from the 'utils' directory.
+if {![file exists aof-load-bench.tcl]} {
+    puts "Please make sure to run aof-load-bench.tcl while inside /utils."
+    puts "Example: cd utils; ./aof-load-bench.tcl"
+    exit 1
+}
+
+# Make sure there is not already a server running on our port.
+set is_not_running [catch {set r [redis 127.0.0.1 $::port]}]
+if {!$is_not_running} {
+    puts "Sorry, you have a running server on port $::port"
+    exit 1
+}
+
+# parse arguments
+for {set j 0} {$j < [llength $argv]} {incr j} {
+    set opt [lindex $argv $j]
+    set arg [lindex $argv [expr $j+1]]
+    if {$opt eq {--requests}} {
+        set ::requests $arg
+        incr j
+    } elseif {$opt eq {--datasize}} {
+        set ::datasize $arg
+        incr j
+    } elseif {$opt eq {--runs}} {
+        set ::runs $arg
+        incr j
+    } else {
+        puts "Wrong argument: $opt"
+        exit 1
+    }
+}
+
+main
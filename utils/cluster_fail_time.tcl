@@ -1,9 +1,51 @@
-# This simple script is used in order to estimate the average PFAIL->FAIL
-# state switch after a failure.
+# This script is used in order to estimate the time needed after a failure
+# to switch a node from PFAIL to FAIL state, and in general the time from
+# the failure to the FAIL state, that is, when the failover can start.
+#
+# It is meant to run against a local test cluster, like the one created by
+# utils/create-cluster, and it is repeatable: it runs a fixed number of
+# samples and reports the average, minimum and maximum times. With the
+# --compare option the samples are taken both with cluster-fail-query
+# disabled and enabled in all the nodes, in order to measure the effect
+# of the failure reports aggregation.
+#
+# Usage: tclsh cluster_fail_time.tcl [--fail-port <port>] [--other-port <port>]
+#                                    [--sleep <seconds>] [--samples <count>]
+#                                    [--compare]
 
 set ::sleep_time 10     ; # How much to sleep to trigger PFAIL.
 set ::fail_port 30016   ; # Node to put in sleep.
 set ::other_port 30001  ; # Node to use to monitor the flag switch.
+set ::samples 10        ; # Number of samples for every run.
+set ::compare 0         ; # Run with cluster-fail-query no and yes.
+
+for {set j 0} {$j < [llength $argv]} {incr j} {
+    set opt [lindex $argv $j]
+    set arg [lindex $argv [expr {$j+1}]]
+    if {$opt eq {--fail-port}} {
+        set ::fail_port $arg
+        incr j
+    } elseif {$opt eq {--other-port}} {
+        set ::other_port $arg
+        incr j
+    } elseif {$opt eq {--sleep}} {
+        set ::sleep_time $arg
+        incr j
+    } elseif {$opt eq {--samples}} {
+        set ::samples $arg
+        incr j
+    } elseif {$opt eq {--compare}} {
+        set ::compare 1
+    } else {
+        puts "Usage: $argv0 \[--fail-port <port>\] \[--other-port <port>\]"
+        puts "       \[--sleep <seconds>\] \[--samples <count>\] \[--compare\]"
+        exit 1
+    }
+}
+
+proc cli {port args} {
+    exec redis-cli -p $port {*}$args
+}
 
 proc avg vector {
     set sum 0.0
@@ -13,38 +55,123 @@ proc avg vector {
     expr {$sum/[llength $vector]}
 }
 
-set samples {}
-while 1 {
-    exec redis-cli -p $::fail_port debug sleep $::sleep_time > /dev/null &
+proc report {title vector} {
+    puts [format "%-22s avg %8.1f ms  min %6d ms  max %6d ms" $title \
+        [avg $vector] \
+        [tcl::mathfunc::min {*}$vector] [tcl::mathfunc::max {*}$vector]]
+}
 
-    # Wait for fail? to appear.
-    while 1 {
-        set output [exec redis-cli -p $::other_port cluster nodes]
-        if {[string match {*fail\?*} $output]} break
-        after 100
+# Return the line of CLUSTER NODES, as seen by the monitoring node, about
+# the node listening at 'port'.
+proc node_line {port} {
+    foreach line [split [cli $::other_port cluster nodes] "\n"] {
+        if {[string match "* *:$port@*" $line]} {return $line}
     }
+    return {}
+}
+
+proc node_flags {port} {
+    lindex [split [node_line $port]] 2
+}
 
-    puts "FAIL?"
-    set start [clock milliseconds]
+# Return the ports of all the nodes of the cluster.
+proc cluster_ports {} {
+    set ports {}
+    foreach line [split [cli $::other_port cluster nodes] "\n"] {
+        if {$line eq {}} continue
+        set addr [lindex [split $line] 1]
+        lappend ports [lindex [split [lindex [split $addr @] 0] :] end]
+    }
+    return $ports
+}
+
+proc set_fail_query {value} {
+    foreach port [cluster_ports] {
+        cli $port config set cluster-fail-query $value
+    }
+}
 
-    # Wait for fail? to disappear.
-    while 1 {
-        set output [exec redis-cli -p $::other_port cluster nodes]
-        if {![string match {*fail\?*} $output]} break
+# Wait for the failing node to be reachable again and for the cluster to be
+# back to the original configuration, failing back if the node was a master
+# and one of its replicas was promoted meanwhile.
+proc restore_node {was_master} {
+    cli $::fail_port ping
+    while {[string match {*fail*} [node_flags $::fail_port]]} {
         after 100
     }
+    if {$was_master && [string match {*slave*} [node_flags $::fail_port]]} {
+        # Wait for the replication link to be up before failing back.
+        while {![string match {*master_link_status:up*} \
+                 [cli $::fail_port info replication]]} {
+            after 100
+        }
+        cli $::fail_port cluster failover
+        while {![string match {*master*} [node_flags $::fail_port]]} {
+            after 100
+        }
+    }
+    after 2000
+}
 
-    puts "FAIL"
-    set now [clock milliseconds]
-    set elapsed [expr {$now-$start}]
-    puts $elapsed
-    lappend samples $elapsed
+# Take ::samples samples, returning two lists of times in milliseconds: from
+# the PFAIL to the FAIL flag, and from the failure to the FAIL flag.
+proc run_samples {} {
+    set pfail_to_fail {}
+    set failure_to_fail {}
+    for {set i 0} {$i < $::samples} {incr i} {
+        set was_master [string match {*master*} [node_flags $::fail_port]]
+        set failure [clock milliseconds]
+        exec redis-cli -p $::fail_port debug sleep $::sleep_time > /dev/null &
 
-    puts "AVG([llength $samples]): [avg $samples]"
+        # Wait for fail? to appear. With fast failure reports the node may
+        # switch to FAIL before we are able to observe the PFAIL state.
+        while {![string match {*fail*} [node_flags $::fail_port]]} {
+            after 10
+        }
+        set pfail [clock milliseconds]
 
-    # Wait for the instance to be available again.
-    exec redis-cli -p $::fail_port ping
+        # Wait for fail? to disappear.
+        while {[string match {*fail\?*} [node_flags $::fail_port]]} {
+            after 10
+        }
+        set fail [clock milliseconds]
+        if {![string match {*fail*} [node_flags $::fail_port]]} {
+            puts "Sample $i: the node was reachable again before FAIL"
+            restore_node $was_master
+            continue
+        }
 
-    # Wait for the fail flag to be cleared.
-    after 2000
+        lappend pfail_to_fail [expr {$fail-$pfail}]
+        lappend failure_to_fail [expr {$fail-$failure}]
+        puts "Sample $i: PFAIL->FAIL [expr {$fail-$pfail}] ms,\
+              failure->FAIL [expr {$fail-$failure}] ms"
+        restore_node $was_master
+    }
+    if {[llength $pfail_to_fail] == 0} {
+        puts "No valid sample, try a longer --sleep"
+        exit 1
+    }
+    list $pfail_to_fail $failure_to_fail
+}
+
+if {$::compare} {
+    set modes {no yes}
+} else {
+    set modes {{}}
+}
+
+foreach mode $modes {
+    if {$mode ne {}} {
+        puts "=== cluster-fail-query $mode"
+        set_fail_query $mode
+    }
+    lassign [run_samples] pfail_to_fail failure_to_fail
+    set results($mode) [list $pfail_to_fail $failure_to_fail]
+}
+
+foreach mode $modes {
+    if {$mode ne {}} {puts "=== cluster-fail-query $mode"}
+    lassign $results($mode) pfail_to_fail failure_to_fail
+    report "PFAIL->FAIL" $pfail_to_fail
+    report "failure->FAIL" $failure_to_fail
 }